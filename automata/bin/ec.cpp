@@ -55,6 +55,7 @@ int main(int argc, char **argv)
     size_t id_width = 0;
     size_t align_to = 1;
     double high_node_weight = 1.0;
+    bool packed_labels = false;
 
     po::options_description desc("Options:");
     desc.add_options()
@@ -77,6 +78,9 @@ int main(int argc, char **argv)
             "> 1 favors low nodes; < 1 favors high nodes; 1.0 = smallest; "
             "default 1.0"
         )
+        ("packed-labels,p", po::bool_switch(&packed_labels),
+            "store low node labels contiguously for SIMD lookup"
+        )
         ;
 
     po::positional_options_description pd;
@@ -149,6 +153,7 @@ int main(int argc, char **argv)
         configuration.id_width = id_width;
         configuration.align_to = align_to;
         configuration.high_node_weight = high_node_weight;
+        configuration.packed_labels = packed_labels;
         try {
             result = EudoxusCompiler::compile(automata, configuration);
         }
@@ -162,6 +167,7 @@ int main(int argc, char **argv)
         cout << "id_width         = " << result.configuration.id_width << endl;
         cout << "align_to         = " << result.configuration.align_to << endl;
         cout << "high_node_weight = " << result.configuration.high_node_weight << endl;
+        cout << "packed_labels    = " << result.configuration.packed_labels << endl;
         cout << "ids_used         = " << result.ids_used << endl;
         cout << "padding          = " << result.padding << endl;
         cout << "low_nodes        = " << result.low_nodes << endl;
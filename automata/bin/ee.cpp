@@ -358,6 +358,8 @@ int main(int argc, char **argv)
     bool no_output = false;
     bool final = false;
     bool list_output = false;
+    bool throughput = false;
+    bool use_mmap = false;
     size_t n = 1;
 
     po::options_description desc("Options:");
@@ -393,6 +395,12 @@ int main(int argc, char **argv)
         ("list-output,L", po::bool_switch(&list_output),
             "list all outputs of automata and exit"
         )
+        ("throughput,T", po::bool_switch(&throughput),
+            "report eudoxus throughput in MB/s over all runs"
+        )
+        ("mmap,m", po::bool_switch(&use_mmap),
+            "memory map automata instead of reading it"
+        )
         ;
 
     po::positional_options_description pd;
@@ -445,7 +453,16 @@ int main(int argc, char **argv)
     ia_eudoxus_t* eudoxus;
 
     TimingInfo ti;
-    rc = ia_eudoxus_create_from_path(&eudoxus, automata_s.c_str());
+    if (use_mmap) {
+        rc = ia_eudoxus_create_from_path_mmap(
+            &eudoxus,
+            automata_s.c_str(),
+            0
+        );
+    }
+    else {
+        rc = ia_eudoxus_create_from_path(&eudoxus, automata_s.c_str());
+    }
     if (rc != IA_EUDOXUS_OK) {
         output_eudoxus_result(NULL, rc);
         return 1;
@@ -553,6 +570,7 @@ int main(int argc, char **argv)
     }
 
     // Run Engine
+    size_t total_bytes = 0;
     for (size_t i = 0; i < n || n == 0; ++i) {
         ia_eudoxus_state_t* state;
         rc = ia_eudoxus_create_state(
@@ -626,6 +644,7 @@ int main(int argc, char **argv)
             }
 
             pre_block += read;
+            total_bytes += read;
         }
         if (final) {
             ia_eudoxus_execute(state, NULL, 0);
@@ -646,6 +665,16 @@ int main(int argc, char **argv)
          << " output=" << ti.elapsed_ms(TimingInfo::OUTPUT)
          << endl;
 
+    if (throughput) {
+        double seconds = ti.elapsed_ms(TimingInfo::EUDOXUS).count() / 1000;
+        cout << "Throughput: " << total_bytes << " bytes";
+        if (seconds > 0) {
+            cout << boost::format(" at %.2f MB/s")
+                % (total_bytes / seconds / (1024 * 1024));
+        }
+        cout << endl;
+    }
+
     ia_eudoxus_destroy(eudoxus);
 
     return 0;
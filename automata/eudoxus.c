@@ -45,13 +45,192 @@
 #include <ironautomata/eudoxus_automata.h>
 #include <ironautomata/vls.h>
 
+#include <sys/mman.h>
+#include <sys/stat.h>
+
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#ifdef __SSE2__
+#define IA_EUDOXUS_SSE2
+#include <emmintrin.h>
+#if defined(__GNUC__) && !defined(__clang__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))
+#define IA_EUDOXUS_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+/* Packed Label Search */
+
+/**
+ * Find @a c in the padded label array of a packed low node.
+ *
+ * @param[in] labels     Labels, padded to IA_EUDOXUS_LABELS_PADDED(n).
+ * @param[in] n          Number of labels (out degree).
+ * @param[in] c          Input byte.
+ * @return Index of @a c in @a labels or @a n if not present.
+ */
+typedef int (*ia_eudoxus_find_label_fn_t)(
+    const uint8_t *labels,
+    int            n,
+    uint8_t        c
+);
+
+/**
+ * Scalar label search.
+ *
+ * @sa ia_eudoxus_find_label_fn_t
+ */
+static
+int ia_eudoxus_find_label_scalar(
+    const uint8_t *labels,
+    int            n,
+    uint8_t        c
+)
+{
+    int i = 0;
+    while (i < n && labels[i] != c) {
+        ++i;
+    }
+    return i;
+}
+
+#ifdef IA_EUDOXUS_SSE2
+/**
+ * Compare 16 labels starting at @a i.
+ *
+ * Padding is zero, so a match in the padding is reported as @a n.
+ *
+ * @return Index of first match, @a n if match in padding, -1 if no match.
+ */
+static inline
+int ia_eudoxus_find_label16(
+    const uint8_t *labels,
+    int            i,
+    int            n,
+    __m128i        needle
+)
+{
+    unsigned int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+        _mm_loadu_si128((const __m128i *)(labels + i)),
+        needle
+    ));
+    if (mask == 0) {
+        return -1;
+    }
+    i += __builtin_ctz(mask);
+    return i < n ? i : n;
+}
+
+/**
+ * SSE2 label search.
+ *
+ * @sa ia_eudoxus_find_label_fn_t
+ */
+static
+int ia_eudoxus_find_label_sse2(
+    const uint8_t *labels,
+    int            n,
+    uint8_t        c
+)
+{
+    const __m128i needle = _mm_set1_epi8((char)c);
+
+    for (int i = 0; i < n; i += 16) {
+        int result = ia_eudoxus_find_label16(labels, i, n, needle);
+        if (result >= 0) {
+            return result;
+        }
+    }
+    return n;
+}
+#endif
+
+#ifdef IA_EUDOXUS_AVX2
+/**
+ * AVX2 label search.
+ *
+ * Compares 32 labels at a time and finishes a trailing 16 byte block with
+ * SSE2 so as not to read past the padded labels.
+ *
+ * @sa ia_eudoxus_find_label_fn_t
+ */
+__attribute__((target("avx2")))
+static
+int ia_eudoxus_find_label_avx2(
+    const uint8_t *labels,
+    int            n,
+    uint8_t        c
+)
+{
+    const __m256i needle = _mm256_set1_epi8((char)c);
+    const int padded = IA_EUDOXUS_LABELS_PADDED(n);
+    int i;
+
+    for (i = 0; i + 32 <= padded; i += 32) {
+        unsigned int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *)(labels + i)),
+            needle
+        ));
+        if (mask != 0) {
+            i += __builtin_ctz(mask);
+            return i < n ? i : n;
+        }
+    }
+    if (i < padded) {
+        int result = ia_eudoxus_find_label16(
+            labels, i, n, _mm_set1_epi8((char)c)
+        );
+        if (result >= 0) {
+            return result;
+        }
+    }
+    return n;
+}
+#endif
+
+/**
+ * Label search used by the subengines.
+ *
+ * Starts as the best compile time choice and is upgraded to AVX2, if the
+ * CPU supports it, by ia_eudoxus_select_find_label().  Written only once,
+ * before the first engine is created.
+ */
+static ia_eudoxus_find_label_fn_t ia_eudoxus_find_label =
+#ifdef IA_EUDOXUS_SSE2
+    ia_eudoxus_find_label_sse2;
+#else
+    ia_eudoxus_find_label_scalar;
+#endif
+
+/**
+ * Guards ia_eudoxus_select_find_label().
+ */
+static pthread_once_t ia_eudoxus_find_label_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Select the label search for the running CPU.
+ *
+ * Run once through @c ia_eudoxus_find_label_once.
+ */
+static
+void ia_eudoxus_select_find_label(void)
+{
+#ifdef IA_EUDOXUS_AVX2
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        ia_eudoxus_find_label = ia_eudoxus_find_label_avx2;
+    }
+#endif
+}
+
 struct ia_eudoxus_t
 {
     /**
@@ -78,6 +257,14 @@ struct ia_eudoxus_t
      * otherwise.
      */
     bool free_error_message;
+
+    /**
+     * Length of the mapping holding @c automata or 0 if not mapped.
+     *
+     * If non-zero, @c automata was mapped by
+     * ia_eudoxus_create_from_path_mmap() and is unmapped rather than freed.
+     */
+    size_t mapped_length;
 };
 
 struct ia_eudoxus_state_t
@@ -187,9 +374,12 @@ ia_eudoxus_result_t ia_eudoxus_create(
         return IA_EUDOXUS_EINVAL;
     }
 
+    pthread_once(&ia_eudoxus_find_label_once, ia_eudoxus_select_find_label);
+
     eudoxus->automata           = (ia_eudoxus_automata_t *)data;
     eudoxus->error_message      = NULL;
     eudoxus->free_error_message = false;
+    eudoxus->mapped_length      = 0;
 
     if (eudoxus->automata->version != IA_EUDOXUS_VERSION) {
         rc = IA_EUDOXUS_EINCOMPAT;
@@ -245,12 +435,74 @@ ia_eudoxus_result_t ia_eudoxus_create_from_path(
     const char    *path
 )
 {
+    ia_eudoxus_result_t rc;
     FILE *fp = fopen(path, "r");
     if (! fp) {
         return IA_EUDOXUS_EINVAL;
     }
 
-    return ia_eudoxus_create_from_file(out_eudoxus, fp);
+    rc = ia_eudoxus_create_from_file(out_eudoxus, fp);
+    fclose(fp);
+
+    return rc;
+}
+
+ia_eudoxus_result_t ia_eudoxus_create_from_path_mmap(
+    ia_eudoxus_t **out_eudoxus,
+    const char    *path,
+    int            flags
+)
+{
+    ia_eudoxus_result_t rc;
+    struct stat st;
+    void *data;
+    int map_flags = MAP_SHARED;
+    int fd;
+
+    if (out_eudoxus == NULL || path == NULL) {
+        return IA_EUDOXUS_EINVAL;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return IA_EUDOXUS_EINVAL;
+    }
+    if (
+        fstat(fd, &st) != 0 ||
+        (size_t)st.st_size < sizeof(ia_eudoxus_automata_t)
+    ) {
+        close(fd);
+        return IA_EUDOXUS_EINVAL;
+    }
+
+#ifdef MAP_POPULATE
+    if (flags & IA_EUDOXUS_MMAP_POPULATE) {
+        map_flags |= MAP_POPULATE;
+    }
+#endif
+
+    data = mmap(NULL, st.st_size, PROT_READ, map_flags, fd, 0);
+    /* The mapping holds its own reference to the file. */
+    close(fd);
+    if (data == MAP_FAILED) {
+        return IA_EUDOXUS_EALLOC;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (flags & IA_EUDOXUS_MMAP_HUGEPAGE) {
+        /* Only a hint; failure is harmless. */
+        madvise(data, st.st_size, MADV_HUGEPAGE);
+    }
+#endif
+
+    rc = ia_eudoxus_create(out_eudoxus, (char *)data);
+    if (rc != IA_EUDOXUS_OK) {
+        munmap(data, st.st_size);
+        return rc;
+    }
+    (*out_eudoxus)->mapped_length = st.st_size;
+
+    return IA_EUDOXUS_OK;
 }
 
 void ia_eudoxus_destroy(
@@ -263,7 +515,10 @@ void ia_eudoxus_destroy(
 
     /* Better to cast away const here than to not have const checks for
      * all uses. */
-    if (eudoxus->automata) {
+    if (eudoxus->automata && eudoxus->mapped_length > 0) {
+        munmap((void *)eudoxus->automata, eudoxus->mapped_length);
+    }
+    else if (eudoxus->automata) {
         free((void *)eudoxus->automata);
     }
     if (eudoxus->error_message != NULL && eudoxus->free_error_message) {
@@ -111,9 +111,14 @@ private:
         //! use_ali will be set if num_consecutive > c_ali_threshold.
         static const size_t c_ali_threshold = 32;
 
-        //! Constructor.
-        explicit
-        NodeOracle(const Intermediate::node_p& node)
+        /**
+         * Constructor.
+         *
+         * @param[in] node          Node to answer questions about.
+         * @param[in] packed_labels If true, low node costs are for the
+         *                          packed label layout.
+         */
+        NodeOracle(const Intermediate::node_p& node, bool packed_labels)
         {
             has_nonadvancing = (
                 find_if(node->edges().begin(), node->edges().end(), is_nonadvancing)
@@ -154,7 +159,14 @@ private:
             }
             if (! node->edges().empty()) {
                 low_node_cost += sizeof(uint8_t);
-                low_node_cost += sizeof(typename traits_t::low_edge_t) * out_degree;
+                if (packed_labels && out_degree > 0) {
+                    low_node_cost += IA_EUDOXUS_LABELS_PADDED(out_degree);
+                    low_node_cost += sizeof(e_id_t) * out_degree;
+                }
+                else {
+                    low_node_cost +=
+                        sizeof(typename traits_t::low_edge_t) * out_degree;
+                }
             }
             if (node->default_target()) {
                 low_node_cost += sizeof(e_id_t);
@@ -293,7 +305,7 @@ private:
     //! Compile node into a demux (high or low) node.
     void demux_node(const Intermediate::node_p& node)
     {
-        NodeOracle oracle(node);
+        NodeOracle oracle(node, m_configuration.packed_labels);
 
         if (! oracle.deterministic) {
             throw runtime_error(
@@ -345,6 +357,8 @@ private:
         const NodeOracle& oracle
     )
     {
+        const bool packed = m_configuration.packed_labels;
+
         {
             e_low_node_t* header =
                 m_assembler.append_object(e_low_node_t());
@@ -365,6 +379,9 @@ private:
             if (oracle.out_degree > 0) {
                 header->header = ia_setbit8(header->header, 4 + IA_EUDOXUS_TYPE_WIDTH);
             }
+            if (packed && oracle.out_degree > 0) {
+                header->header = ia_setbit8(header->header, 5 + IA_EUDOXUS_TYPE_WIDTH);
+            }
         }
 
         if (node.first_output()) {
@@ -391,6 +408,21 @@ private:
             advance_index = m_assembler.index(advance);
         }
 
+        size_t labels_index = 0;
+        size_t targets_index = 0;
+        if (packed && oracle.out_degree > 0) {
+            uint8_t* labels =
+                m_assembler.template append_array<uint8_t>(
+                    IA_EUDOXUS_LABELS_PADDED(oracle.out_degree)
+                );
+            labels_index = m_assembler.index(labels);
+            e_id_t* targets =
+                m_assembler.template append_array<e_id_t>(
+                    oracle.out_degree
+                );
+            targets_index = m_assembler.index(targets);
+        }
+
         size_t edge_i = 0;
         BOOST_FOREACH(const Intermediate::Edge& edge, node.edges()) {
             if (edge.epsilon()) {
@@ -407,15 +439,25 @@ private:
                         edge_i
                     );
                 }
-                ++edge_i;
 
-                e_low_edge_t* e_edge =
-                    m_assembler.append_object(e_low_edge_t());
-                e_edge->c = value;
-                register_node_ref(
-                    m_assembler.index(&(e_edge->next_node)),
-                    edge.target()
-                );
+                if (packed) {
+                    m_assembler.template ptr<uint8_t>(labels_index)[edge_i]
+                        = value;
+                    register_node_ref(
+                        targets_index + edge_i * sizeof(e_id_t),
+                        edge.target()
+                    );
+                }
+                else {
+                    e_low_edge_t* e_edge =
+                        m_assembler.append_object(e_low_edge_t());
+                    e_edge->c = value;
+                    register_node_ref(
+                        m_assembler.index(&(e_edge->next_node)),
+                        edge.target()
+                    );
+                }
+                ++edge_i;
             }
         }
     }
@@ -1017,7 +1059,8 @@ result_t compile_minimal(
 configuration_t::configuration_t() :
     id_width(0),
     align_to(1),
-    high_node_weight(1.0)
+    high_node_weight(1.0),
+    packed_labels(false)
 {
     // nop
 }
@@ -74,6 +74,7 @@ ia_eudoxus_result_t IA_EUDOXUS(next_low)(
     bool has_default        = IA_EUDOXUS_FLAG(state->node->header, 2);
     bool advance_on_default = IA_EUDOXUS_FLAG(state->node->header, 3);
     bool has_edges          = IA_EUDOXUS_FLAG(state->node->header, 4);
+    bool has_packed_labels  = IA_EUDOXUS_FLAG(state->node->header, 5);
     const IA_EUDOXUS(low_node_t) *node
         = (const IA_EUDOXUS(low_node_t) *)(state->node);
     if (has_nonadvancing & ! has_edges) {
@@ -94,29 +95,47 @@ ia_eudoxus_result_t IA_EUDOXUS(next_low)(
     const uint8_t *advance = IA_VLS_VARRAY_IF(
         vls,
         const uint8_t,
-        out_degree / 8,
+        (out_degree + 7) / 8,
         has_nonadvancing & has_edges
     );
+    const uint8_t *labels = IA_VLS_VARRAY_IF(
+        vls,
+        const uint8_t,
+        IA_EUDOXUS_LABELS_PADDED(out_degree),
+        has_packed_labels & has_edges
+    );
     const IA_EUDOXUS(low_edge_t) *edges = IA_VLS_FINAL(
         vls,
         const IA_EUDOXUS(low_edge_t)
     );
+    const IA_EUDOXUS_ID_T *targets = IA_VLS_FINAL(
+        vls,
+        const IA_EUDOXUS_ID_T
+    );
 
     IA_EUDOXUS_ID_T next_node            = 0;
     bool            advance_on_next_node = true;
 
     if (has_edges) {
         int i = 0;
-        while (i < out_degree && edges[i].c != c) {
-            ++i;
+        if (has_packed_labels) {
+            i = ia_eudoxus_find_label(labels, out_degree, c);
+            if (i != out_degree) {
+                next_node = targets[i];
+            }
         }
-
-        if (i != out_degree) {
-            next_node = edges[i].next_node;
-            if (has_nonadvancing) {
-                advance_on_next_node = ia_bitv(advance, i);
+        else {
+            while (i < out_degree && edges[i].c != c) {
+                ++i;
+            }
+            if (i != out_degree) {
+                next_node = edges[i].next_node;
             }
         }
+
+        if ( (i != out_degree) && has_nonadvancing ) {
+            advance_on_next_node = ia_bitv(advance, i);
+        }
     }
 
     if (next_node == 0) {
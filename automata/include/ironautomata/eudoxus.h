@@ -80,7 +80,8 @@ typedef enum ia_eudoxus_result_t ia_eudoxus_result_t;
  * A Eudoxus automata engine.
  *
  * An opaque data structure representing a Eudoxus engine.  It can be created
- * from file system (ia_eudoxus_create_from_path()), a FILE
+ * from file system (ia_eudoxus_create_from_path()), a memory mapped file
+ * (ia_eudoxus_create_from_path_mmap()), a FILE
  * (ia_eudoxus_create_from_file()), or a chunk of memory
  * (ia_eudoxus_create()).  When finished, it should be destroyed with
  * ia_eudoxus_destroy().  It can be used via ia_eudoxus_create_state().
@@ -154,6 +155,46 @@ ia_eudoxus_result_t ia_eudoxus_create_from_path(
     const char    *path
 );
 
+/**
+ * Flags for ia_eudoxus_create_from_path_mmap().
+ */
+enum ia_eudoxus_mmap_flags_t
+{
+    /** Fault in the whole file at load time (MAP_POPULATE). */
+    IA_EUDOXUS_MMAP_POPULATE = 1 << 0,
+    /** Advise the kernel to back the mapping with huge pages. */
+    IA_EUDOXUS_MMAP_HUGEPAGE = 1 << 1
+};
+typedef enum ia_eudoxus_mmap_flags_t ia_eudoxus_mmap_flags_t;
+
+/**
+ * As ia_eudoxus_create_from_path(), but memory map the file.
+ *
+ * The file is mapped read only and shared.  The automata is not copied: it
+ * is loaded in constant time, its pages are shared via the page cache by
+ * every process that maps the same file, and it is paged in on demand
+ * unless @ref IA_EUDOXUS_MMAP_POPULATE is given.  The mapping is released by
+ * ia_eudoxus_destroy().  The file should not be modified while mapped.
+ *
+ * Flags that are not supported by the platform are ignored.
+ *
+ * @param[out] out_eudoxus Variable to hold pointer to created engine.
+ * @param[in]  path        Path to file on disk holding automata.
+ * @param[in]  flags       Bitwise or of @ref ia_eudoxus_mmap_flags_t.
+ * @return
+ * - IA_EUDOXUS_EINVAL if @a out_eudoxus or @a path is NULL, the file can
+ *   not be opened or is too small to hold an automata.
+ * - IA_EUDOXUS_EALLOC if the file can not be mapped.
+ * - Other codes as described in ia_eudoxus_create().
+ *
+ * @sa ia_eudoxus_t
+ */
+ia_eudoxus_result_t ia_eudoxus_create_from_path_mmap(
+    ia_eudoxus_t **out_eudoxus,
+    const char    *path,
+    int            flags
+);
+
 /**
  * Destroy engine @a eudoxus, releasing associated memory.
  *
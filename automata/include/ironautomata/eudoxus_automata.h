@@ -225,6 +225,21 @@ typedef enum ia_eudoxus_nodetype_t ia_eudoxus_nodetype_t;
 #define IA_EUDOXUS_FLAG(header, n) \
      (ia_bit8(header, (n) + IA_EUDOXUS_TYPE_WIDTH))
 
+/**
+ * Padding granularity of the label array of packed low degree nodes.
+ *
+ * Labels are padded with zeros to a multiple of this so that they can be
+ * compared a full SIMD register at a time.
+ */
+#define IA_EUDOXUS_LABEL_PAD 16
+
+/**
+ * Size of the padded label array of a packed low node of @a out_degree.
+ */
+#define IA_EUDOXUS_LABELS_PADDED(out_degree) \
+     ((((out_degree) + IA_EUDOXUS_LABEL_PAD - 1) / IA_EUDOXUS_LABEL_PAD) * \
+      IA_EUDOXUS_LABEL_PAD)
+
 /**
  * A generic node.
  *
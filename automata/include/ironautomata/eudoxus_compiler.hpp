@@ -52,6 +52,7 @@ struct configuration_t
      * - id_width = 0, i.e., minimal.
      * - align_to = 1, i.e., no alignment
      * - high_node_weight = 1.0, i.e., optimize space
+     * - packed_labels = false, i.e., interleaved low node edges
      */
     configuration_t();
 
@@ -107,6 +108,17 @@ struct configuration_t
      * for very low degree.
      */
     double high_node_weight;
+
+    /**
+     * Packed Labels
+     *
+     * If true, low nodes store their edge labels as a contiguous array,
+     * zero padded to a multiple of 16 bytes, followed by an array of
+     * targets.  This allows the engine to search labels with SIMD compares
+     * at the cost of up to 15 bytes of padding per low node.  If false, low
+     * nodes store interleaved (label, target) pairs.
+     */
+    bool packed_labels;
 };
 
 /**
@@ -67,6 +67,7 @@ struct IA_EUDOXUS(low_node_t)
      * flag2: has_default
      * flag3: advance_on_default
      * flag4: has_edges
+     * flag5: has_packed_labels -- labels and targets in separate arrays.
      */
     uint8_t header;
 
@@ -91,8 +92,19 @@ struct IA_EUDOXUS(low_node_t)
 
     /*
     IA_EUDOXUS_ID_T default_node          if has_defaults
-    uint8_t         advance[out_degree/8] if has_nonadvancing & has_edges
-    low_edge_t      edges[]
+    uint8_t         advance[(out_degree+7)/8] if has_nonadvancing & has_edges
+    low_edge_t      edges[]               if ! has_packed_labels
+    */
+
+    /*
+     * Packed labels: the edge values padded with zeros to
+     * IA_EUDOXUS_LABELS_PADDED(out_degree) bytes, followed by the edge
+     * targets in the same order.
+     */
+    /*
+    uint8_t         labels[IA_EUDOXUS_LABELS_PADDED(out_degree)]
+                                          if has_packed_labels
+    IA_EUDOXUS_ID_T targets[out_degree]   if has_packed_labels
     */
 } __attribute((packed));
 
@@ -61,6 +61,32 @@ class TestBasic < Test::Unit::TestCase
     ac_test(words, text, "moderate_space", :space)
   end
 
+  # Packed labels are searched with SIMD in 16 or 32 byte blocks; cover
+  # out degrees around those block sizes in low nodes and check that the
+  # packed and interleaved layouts report the same matches.
+  def test_packed_labels
+    alphabet = ('a'..'z').to_a + ('A'..'Z').to_a + ('0'..'9').to_a
+    words = []
+    [1, 2, 15, 16, 17, 31, 32, 33, 62].each do |degree|
+      alphabet[0, degree].each do |x|
+        words << "p#{degree}_#{x}"
+      end
+    end
+    text = words.join(" ") + " p16_z p33_Z p62_."
+
+    low_nodes = ["-h", "1000"]
+    outputs = [[], ["--packed-labels"]].collect do |packed|
+      result = nil
+      automata_test(words, ACGEN, "packed_labels", false, low_nodes + packed) do |dir, eudoxus_path|
+        result = ee(eudoxus_path, dir, text)
+      end
+      result
+    end
+
+    assert_substrings_equal(substrings(words, text), outputs[0])
+    assert_substrings_equal(outputs[0], outputs[1])
+  end
+
   def test_aaaa
     words = ["a", "aa", "aaa", "aaaa"]
     text = "aaaaaaaaaaaa"
@@ -127,6 +127,9 @@ typedef struct {
     /* Dump output */
     ib_flags_t dump_flags;
 
+    /* Rule profile output ("-" for stdout, NULL if disabled) */
+    const char *rule_profile;
+
     /* Request header fields */
     struct {
         int              num_headers;
@@ -279,6 +282,8 @@ static void help(void)
     print_option("remote-ip", "x.x.x.x", "Specify remote IP address", 0, NULL );
     print_option("remote-port", "num", "Specify remote port", 0, NULL );
     print_option("trace", NULL, "Enable tracing", 0, NULL );
+    print_option("rule-profile", "path",
+                 "Profile rules, write JSON to path (- for stdout)", 0, NULL );
     print_option("dump", "name", "Dump specified field", 0,
                  "tx, tx-{args,flags,data,all}, user-agent, geoip, all");
     print_option("request-header", "name: value",
@@ -400,6 +405,7 @@ static ib_status_t command_line(int argc, char *argv[])
         { "request-header", required_argument, 0, 0 },
         { "trace", no_argument, 0, 0 },
         { "dump", required_argument, 0, 0 },
+        { "rule-profile", required_argument, 0, 0 },
 
 #if DEBUG_ARGS_ENABLE
         { "debug-level", required_argument, 0, 0 },
@@ -478,6 +484,9 @@ static ib_status_t command_line(int argc, char *argv[])
         else if (! strcmp("trace", longopts[option_index].name)) {
             settings.trace = 1;
         }
+        else if (! strcmp("rule-profile", longopts[option_index].name)) {
+            settings.rule_profile = optarg;
+        }
         else if (! strcmp("dump", longopts[option_index].name)) {
             if (strcasecmp(optarg, "geoip") == 0) {
                 settings.dump_flags |= DUMP_GEOIP;
@@ -2417,6 +2426,15 @@ int main(int argc, char* argv[])
         fatal_error("Failed to register one or more handlers\n");
     }
 
+    /* Enable rule profiling; the profile is written after the run. */
+    if (settings.rule_profile != NULL) {
+        rc = ib_rule_profile_enable(ironbee, NULL);
+        if (rc != IB_OK) {
+            fatal_error("Failed to enable rule profiling: %s\n",
+                        ib_status_to_string(rc));
+        }
+    }
+
     /* Set the engine's debug flags from the command line args */
 #if DEBUG_ARGS_ENABLE
     set_debug( ib_context_engine(ironbee) );
@@ -2480,6 +2498,27 @@ int main(int argc, char* argv[])
     /* Pass connection data to the engine. */
     run_connection(ironbee);
 
+    /* Write the rule profile */
+    if (settings.rule_profile != NULL) {
+        FILE *fp = stdout;
+
+        if (strcmp(settings.rule_profile, "-") != 0) {
+            fp = fopen(settings.rule_profile, "w");
+            if (fp == NULL) {
+                fatal_error("Failed to open rule profile \"%s\": %s\n",
+                            settings.rule_profile, strerror(errno));
+            }
+        }
+        rc = ib_rule_profile_write(ironbee, fp);
+        if (fp != stdout) {
+            fclose(fp);
+        }
+        if (rc != IB_OK) {
+            fatal_error("Failed to write rule profile: %s\n",
+                        ib_status_to_string(rc));
+        }
+    }
+
     /* Done */
     ib_engine_destroy(ironbee);
     ib_shutdown();
@@ -0,0 +1,389 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- CLIPP Benchmark Support Implementation
+ *
+ * @author Christopher Alfeld <calfeld@qualys.com>
+ */
+
+#include "bench.hpp"
+
+#include <boost/format.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <time.h>
+
+using namespace std;
+
+namespace IronBee {
+namespace CLIPP {
+
+namespace {
+
+//! Number of buckets per power of two.
+static const size_t c_sub_buckets = 16;
+
+//! log2(c_sub_buckets)
+static const size_t c_sub_bucket_bits = 4;
+
+//! Number of buckets: enough for any 64 bit value.
+static const size_t c_num_buckets =
+    (64 - c_sub_bucket_bits + 1) * c_sub_buckets;
+
+//! Percentiles reported by LatencyHistogram::write_json().
+static const double c_percentiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+//! Names of percentiles in c_percentiles.
+static const char* c_percentile_names[] = { "p50", "p90", "p99", "p999" };
+
+//! Names of events, indexed by Input::event_e.
+static const char* c_event_names[] = {
+    "unknown",
+    "connection_opened",
+    "connection_data_in",
+    "connection_data_out",
+    "connection_closed",
+    "request_started",
+    "request_header",
+    "request_header_finished",
+    "request_body",
+    "request_finished",
+    "response_started",
+    "response_header",
+    "response_header_finished",
+    "response_body",
+    "response_finished"
+};
+
+//! Number of events.
+static const size_t c_num_events =
+    sizeof(c_event_names) / sizeof(*c_event_names);
+
+//! Index of most significant bit of @a v; @a v must be non-zero.
+size_t msb(uint64_t v)
+{
+    size_t r = 0;
+    while (v >>= 1) {
+        ++r;
+    }
+    return r;
+}
+
+}
+
+LatencyHistogram::LatencyHistogram() :
+    m_buckets(c_num_buckets, 0),
+    m_count(0),
+    m_min(numeric_limits<uint64_t>::max()),
+    m_max(0),
+    m_total(0)
+{
+    // nop
+}
+
+size_t LatencyHistogram::bucket_of(uint64_t ns)
+{
+    if (ns < 2 * c_sub_buckets) {
+        return ns;
+    }
+
+    size_t shift = msb(ns) - c_sub_bucket_bits;
+    return shift * c_sub_buckets + (ns >> shift);
+}
+
+uint64_t LatencyHistogram::upper_of(size_t bucket)
+{
+    if (bucket < 2 * c_sub_buckets) {
+        return bucket;
+    }
+
+    size_t   shift = bucket / c_sub_buckets - 1;
+    uint64_t sub   = bucket % c_sub_buckets + c_sub_buckets;
+    return ((sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns)
+{
+    ++m_buckets[bucket_of(ns)];
+    ++m_count;
+    m_min    = min(m_min, ns);
+    m_max    = max(m_max, ns);
+    m_total += ns;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other)
+{
+    for (size_t i = 0; i < c_num_buckets; ++i) {
+        m_buckets[i] += other.m_buckets[i];
+    }
+    m_count += other.m_count;
+    m_min    = min(m_min, other.m_min);
+    m_max    = max(m_max, other.m_max);
+    m_total += other.m_total;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if (m_count == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(ceil(p * m_count));
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < c_num_buckets; ++i) {
+        seen += m_buckets[i];
+        if (seen >= rank) {
+            return min(upper_of(i), m_max);
+        }
+    }
+
+    return m_max;
+}
+
+void LatencyHistogram::write_json(ostream& out) const
+{
+    out << "{\"count\": " << m_count;
+    if (m_count > 0) {
+        out << ", \"min_ns\": " << m_min
+            << ", \"mean_ns\": "
+            << boost::format("%.1f") % (m_total / m_count)
+            << ", \"max_ns\": " << m_max;
+        for (size_t i = 0; i < sizeof(c_percentiles) / sizeof(double); ++i) {
+            out << ", \"" << c_percentile_names[i] << "_ns\": "
+                << percentile(c_percentiles[i]);
+        }
+    }
+    out << ", \"buckets\": [";
+    bool first = true;
+    for (size_t i = 0; i < c_num_buckets; ++i) {
+        if (m_buckets[i] == 0) {
+            continue;
+        }
+        if (! first) {
+            out << ", ";
+        }
+        first = false;
+        out << "[" << upper_of(i) << ", " << m_buckets[i] << "]";
+    }
+    out << "]}";
+}
+
+BenchStatistics::BenchStatistics() :
+    inputs(0),
+    transactions(0),
+    bytes(0),
+    event_latency(c_num_events)
+{
+    // nop
+}
+
+void BenchStatistics::merge(const BenchStatistics& other)
+{
+    inputs       += other.inputs;
+    transactions += other.transactions;
+    bytes        += other.bytes;
+    input_latency.merge(other.input_latency);
+    for (size_t i = 0; i < c_num_events; ++i) {
+        event_latency[i].merge(other.event_latency[i]);
+    }
+}
+
+void BenchStatistics::write_json(ostream& out, double elapsed_seconds) const
+{
+    double per_second = elapsed_seconds > 0 ? 1.0 / elapsed_seconds : 0;
+
+    out << "{\n"
+        << "  \"inputs\": " << inputs << ",\n"
+        << "  \"transactions\": " << transactions << ",\n"
+        << "  \"bytes\": " << bytes << ",\n"
+        << "  \"elapsed_seconds\": "
+        << boost::format("%.6f") % elapsed_seconds << ",\n"
+        << "  \"inputs_per_second\": "
+        << boost::format("%.1f") % (inputs * per_second) << ",\n"
+        << "  \"transactions_per_second\": "
+        << boost::format("%.1f") % (transactions * per_second) << ",\n"
+        << "  \"megabytes_per_second\": "
+        << boost::format("%.3f") % (bytes * per_second / (1024 * 1024))
+        << ",\n"
+        << "  \"input_latency\": ";
+    input_latency.write_json(out);
+    out << ",\n"
+        << "  \"event_latency\": {";
+    bool first = true;
+    for (size_t i = 0; i < c_num_events; ++i) {
+        if (event_latency[i].count() == 0) {
+            continue;
+        }
+        out << (first ? "\n" : ",\n")
+            << "    \"" << c_event_names[i] << "\": ";
+        event_latency[i].write_json(out);
+        first = false;
+    }
+    out << "\n  }\n"
+        << "}" << endl;
+}
+
+BenchDelegate::BenchDelegate(
+    Input::Delegate& to,
+    BenchStatistics& statistics
+) :
+    m_to(to),
+    m_statistics(statistics)
+{
+    // nop
+}
+
+namespace {
+
+//! Call @a method of @a to with @a event, recording latency in @a stats.
+template <typename EventType>
+void timed_call(
+    BenchStatistics&  stats,
+    Input::Delegate&  to,
+    void (Input::Delegate::*method)(const EventType&),
+    const EventType&  event
+)
+{
+    uint64_t start = bench_now();
+    (to.*method)(event);
+    stats.event_latency[event.which].record(bench_now() - start);
+}
+
+}
+
+void BenchDelegate::connection_opened(const Input::ConnectionEvent& event)
+{
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::connection_opened, event
+    );
+}
+
+void BenchDelegate::connection_closed(const Input::NullEvent& event)
+{
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::connection_closed, event
+    );
+}
+
+void BenchDelegate::connection_data_in(const Input::DataEvent& event)
+{
+    m_statistics.bytes += event.data.length;
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::connection_data_in, event
+    );
+}
+
+void BenchDelegate::connection_data_out(const Input::DataEvent& event)
+{
+    m_statistics.bytes += event.data.length;
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::connection_data_out, event
+    );
+}
+
+void BenchDelegate::request_started(const Input::RequestEvent& event)
+{
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::request_started, event
+    );
+}
+
+void BenchDelegate::request_header(const Input::HeaderEvent& event)
+{
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::request_header, event
+    );
+}
+
+void BenchDelegate::request_header_finished(const Input::NullEvent& event)
+{
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::request_header_finished, event
+    );
+}
+
+void BenchDelegate::request_body(const Input::DataEvent& event)
+{
+    m_statistics.bytes += event.data.length;
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::request_body, event
+    );
+}
+
+void BenchDelegate::request_finished(const Input::NullEvent& event)
+{
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::request_finished, event
+    );
+}
+
+void BenchDelegate::response_started(const Input::ResponseEvent& event)
+{
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::response_started, event
+    );
+}
+
+void BenchDelegate::response_header(const Input::HeaderEvent& event)
+{
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::response_header, event
+    );
+}
+
+void BenchDelegate::response_header_finished(const Input::NullEvent& event)
+{
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::response_header_finished, event
+    );
+}
+
+void BenchDelegate::response_body(const Input::DataEvent& event)
+{
+    m_statistics.bytes += event.data.length;
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::response_body, event
+    );
+}
+
+void BenchDelegate::response_finished(const Input::NullEvent& event)
+{
+    timed_call(
+        m_statistics, m_to, &Input::Delegate::response_finished, event
+    );
+}
+
+uint64_t bench_now()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return uint64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+} // CLIPP
+} // IronBee
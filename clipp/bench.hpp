@@ -0,0 +1,179 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- CLIPP Benchmark Support
+ *
+ * Latency histograms and a timing delegate used by the bench consumer.
+ *
+ * @author Christopher Alfeld <calfeld@qualys.com>
+ */
+
+#ifndef __IRONBEE__CLIPP__BENCH__
+#define __IRONBEE__CLIPP__BENCH__
+
+#include "input.hpp"
+
+#include <ostream>
+#include <vector>
+
+namespace IronBee {
+namespace CLIPP {
+
+/**
+ * Latency histogram.
+ *
+ * Values are nanoseconds.  Buckets are log-linear in the style of HDR
+ * histograms: values below 32 have their own bucket and every power of two
+ * above that is split into 16 equal buckets, giving a relative error of at
+ * most 1/16 over the full 64 bit range with a fixed number of buckets.
+ **/
+class LatencyHistogram
+{
+public:
+    //! Constructor.
+    LatencyHistogram();
+
+    //! Record a value of @a ns nanoseconds.
+    void record(uint64_t ns);
+
+    //! Add all values of @a other.
+    void merge(const LatencyHistogram& other);
+
+    //! Number of values recorded.
+    uint64_t count() const
+    {
+        return m_count;
+    }
+
+    /**
+     * Value at percentile @a p.
+     *
+     * @param[in] p Percentile as a fraction in [0, 1].
+     * @returns Upper bound of bucket containing percentile @a p, limited to
+     *          the maximum value recorded.  0 if no values were recorded.
+     **/
+    uint64_t percentile(double p) const;
+
+    /**
+     * Write histogram as a JSON object.
+     *
+     * The object contains count, min, mean, max, common percentiles and a
+     * list of [upper bound, count] pairs for each non-empty bucket.
+     *
+     * @param[in] out Stream to write to.
+     **/
+    void write_json(std::ostream& out) const;
+
+private:
+    //! Bucket index of @a ns.
+    static size_t bucket_of(uint64_t ns);
+    //! Largest value of bucket @a bucket.
+    static uint64_t upper_of(size_t bucket);
+
+    std::vector<uint64_t> m_buckets;
+    uint64_t              m_count;
+    uint64_t              m_min;
+    uint64_t              m_max;
+    double                m_total;
+};
+
+/**
+ * Statistics gathered by a benchmark.
+ *
+ * Not thread safe.  Threaded users should gather into a local instance and
+ * merge() into a shared one under a lock.
+ **/
+struct BenchStatistics
+{
+    //! Constructor.
+    BenchStatistics();
+
+    //! Add all statistics of @a other.
+    void merge(const BenchStatistics& other);
+
+    /**
+     * Write statistics as a JSON object.
+     *
+     * @param[in] out             Stream to write to.
+     * @param[in] elapsed_seconds Wall clock duration of benchmark.
+     **/
+    void write_json(std::ostream& out, double elapsed_seconds) const;
+
+    //! Number of inputs processed.
+    uint64_t inputs;
+
+    //! Number of transactions processed.
+    uint64_t transactions;
+
+    //! Number of data bytes processed.
+    uint64_t bytes;
+
+    //! Latency of each input.
+    LatencyHistogram input_latency;
+
+    //! Latency of each event, indexed by Input::event_e.
+    std::vector<LatencyHistogram> event_latency;
+};
+
+/**
+ * Delegate that times another delegate.
+ *
+ * Forwards every event to a delegate and records how long it took in the
+ * histogram of that event.  The sizes of data events are added to the
+ * byte count.
+ **/
+class BenchDelegate :
+    public Input::Delegate
+{
+public:
+    /**
+     * Constructor.
+     *
+     * @param[in] to         Delegate to time.
+     * @param[in] statistics Statistics to record to.
+     **/
+    BenchDelegate(Input::Delegate& to, BenchStatistics& statistics);
+
+    void connection_opened(const Input::ConnectionEvent& event);
+    void connection_closed(const Input::NullEvent& event);
+    void connection_data_in(const Input::DataEvent& event);
+    void connection_data_out(const Input::DataEvent& event);
+    void request_started(const Input::RequestEvent& event);
+    void request_header(const Input::HeaderEvent& event);
+    void request_header_finished(const Input::NullEvent& event);
+    void request_body(const Input::DataEvent& event);
+    void request_finished(const Input::NullEvent& event);
+    void response_started(const Input::ResponseEvent& event);
+    void response_header(const Input::HeaderEvent& event);
+    void response_header_finished(const Input::NullEvent& event);
+    void response_body(const Input::DataEvent& event);
+    void response_finished(const Input::NullEvent& event);
+
+private:
+    Input::Delegate& m_to;
+    BenchStatistics& m_statistics;
+};
+
+//! Current time in nanoseconds from an arbitrary, monotonic, origin.
+uint64_t bench_now();
+
+} // CLIPP
+} // IronBee
+
+#endif
@@ -216,6 +216,13 @@ component_t construct_component(const string& arg)
 //! Construct threaded IronBee consumer, interpreting @a arg as @e path:n
 component_t construct_ironbee_threaded_consumer(const string& arg);
 
+/**
+ * Construct IronBee bench consumer.
+ *
+ * @param[in] arg @a arg is @e path[:iterations[:n[:output]]].
+ **/
+component_t construct_ironbee_bench_consumer(const string& arg);
+
 //! Construct raw generator, interpreting @a arg as @e request,response.
 component_t construct_raw_generator(const string& arg);
 
@@ -319,6 +326,12 @@ void help()
     "  writepb:<path>  -- Output to protobuf file at <path>.\n"
     "  writehtp:<path> -- Output in HTP test format at <path>.\n"
     "                     Best with unparsed format and only 1 connection.\n"
+    "  bench:<path>    -- Benchmark internal IronBee using <path> as\n"
+    "                     configuration.  Outputs JSON to stdout.\n"
+    "  bench:<path>:<i>:<n>:<out> --\n"
+    "    Benchmark internal IronBee using <path> as configuration.  Feed\n"
+    "    each input <i> times (default 1) using <n> threads (default 0,\n"
+    "    i.e., no threads).  Write JSON to <out> (default stdout).\n"
     "  view            -- Output to stdout for human consumption.\n"
     "  view:id         -- Output IDs to stdout for human consumption.\n"
     "  view:summary    -- Output summary to stdout for human consumption.\n"
@@ -572,6 +585,7 @@ int main(int argc, char** argv)
     component_factory_map_t consumer_factory_map = boost::assign::map_list_of
         ("ironbee",  construct_component<IronBeeConsumer>)
         ("ironbee_threaded",  construct_ironbee_threaded_consumer)
+        ("bench",    construct_ironbee_bench_consumer)
         ("writepb",  construct_component<PBConsumer>)
         ("writehtp", construct_component<HTPConsumer>)
         ("view",     construct_component<ViewConsumer>)
@@ -1043,6 +1057,34 @@ component_t construct_ironbee_threaded_consumer(const string& arg)
     return IronBeeThreadedConsumer(config_path, num_workers);
 }
 
+component_t construct_ironbee_bench_consumer(const string& arg)
+{
+    size_t iterations  = 1;
+    size_t num_workers = 0;
+    string output_path;
+
+    vector<string> subargs = split_on_char(arg, ':');
+    if (subargs.empty() || subargs.size() > 4 || subargs[0].empty()) {
+        throw runtime_error("Could not parse bench arg: " + arg);
+    }
+    if (subargs.size() > 1 && ! subargs[1].empty()) {
+        iterations = boost::lexical_cast<size_t>(subargs[1]);
+    }
+    if (subargs.size() > 2 && ! subargs[2].empty()) {
+        num_workers = boost::lexical_cast<size_t>(subargs[2]);
+    }
+    if (subargs.size() > 3) {
+        output_path = subargs[3];
+    }
+
+    return IronBeeBenchConsumer(
+        subargs[0],
+        iterations,
+        num_workers,
+        output_path
+    );
+}
+
 component_t construct_ironbee_modifier(const string& arg)
 {
     IronBeeModifier::behavior_e behavior = IronBeeModifier::ALLOW;
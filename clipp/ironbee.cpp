@@ -23,13 +23,19 @@
  */
 
 #include "ironbee.hpp"
+#include "bench.hpp"
 #include "control.hpp"
 
 #include <ironbeepp/all.hpp>
 #include <ironbee/action.h>
+#include <boost/foreach.hpp>
 #include <boost/make_shared.hpp>
+#include <boost/scoped_ptr.hpp>
 #include <boost/thread.hpp>
 
+#include <fstream>
+#include <list>
+
 using namespace std;
 
 using boost::make_shared;
@@ -771,5 +777,155 @@ bool IronBeeThreadedConsumer::operator()(const Input::input_p& input)
     return true;
 }
 
+struct IronBeeBenchConsumer::State
+{
+    //! Per thread statistics, owned by @c all_statistics.
+    BenchStatistics& local_statistics()
+    {
+        BenchStatistics* statistics = thread_statistics.get();
+        if (! statistics) {
+            boost::shared_ptr<BenchStatistics> new_statistics =
+                make_shared<BenchStatistics>();
+            {
+                boost::lock_guard<boost::mutex> guard(mutex);
+                all_statistics.push_back(new_statistics);
+            }
+            statistics = new_statistics.get();
+            thread_statistics.reset(statistics);
+        }
+        return *statistics;
+    }
+
+    void process_input(Input::input_p input)
+    {
+        if (! input) {
+            return;
+        }
+
+        BenchStatistics& statistics = local_statistics();
+        for (size_t i = 0; i < iterations; ++i) {
+            IronBeeDelegate ironbee_delegate(engine);
+            BenchDelegate   delegate(ironbee_delegate, statistics);
+
+            uint64_t start = bench_now();
+            input->connection.dispatch(delegate, false);
+            statistics.input_latency.record(bench_now() - start);
+        }
+        statistics.inputs       += iterations;
+        statistics.transactions +=
+            iterations * input->connection.transactions.size();
+    }
+
+    static
+    void release_statistics(BenchStatistics*)
+    {
+        // Owned by all_statistics.
+    }
+
+    void report()
+    {
+        double elapsed = started ?
+            double(bench_now() - start_at) / 1e9 :
+            0;
+
+        BenchStatistics total;
+        BOOST_FOREACH(
+            const boost::shared_ptr<BenchStatistics>& statistics,
+            all_statistics
+        ) {
+            total.merge(*statistics);
+        }
+
+        if (output_path.empty()) {
+            total.write_json(cout, elapsed);
+        }
+        else {
+            ofstream out(output_path.c_str());
+            if (! out) {
+                cerr << "Could not open " << output_path << " for writing."
+                     << endl;
+                return;
+            }
+            total.write_json(out, elapsed);
+        }
+    }
+
+    State(size_t iterations_, size_t num_workers) :
+        iterations(iterations_),
+        started(false),
+        start_at(0),
+        thread_statistics(&release_statistics),
+        server_value(__FILE__, "clipp")
+    {
+        IronBee::initialize();
+        engine = IronBee::Engine::create(server_value.get());
+
+        if (num_workers > 0) {
+            worker_pool.reset(
+                new FunctionWorkerPool<Input::input_p>(
+                    num_workers,
+                    boost::bind(
+                        &IronBeeBenchConsumer::State::process_input,
+                        this,
+                        _1
+                    )
+                )
+            );
+        }
+    }
+
+    ~State()
+    {
+        if (worker_pool) {
+            worker_pool->shutdown();
+        }
+
+        report();
+
+        engine.destroy();
+        IronBee::shutdown();
+    }
+
+    size_t                                         iterations;
+    string                                         output_path;
+    bool                                           started;
+    uint64_t                                       start_at;
+    boost::mutex                                   mutex;
+    list<boost::shared_ptr<BenchStatistics> >      all_statistics;
+    boost::thread_specific_ptr<BenchStatistics>    thread_statistics;
+    boost::scoped_ptr<FunctionWorkerPool<Input::input_p> > worker_pool;
+    IronBee::Engine                                engine;
+    IronBee::ServerValue                           server_value;
+};
+
+IronBeeBenchConsumer::IronBeeBenchConsumer(
+    const string& config_path,
+    size_t        iterations,
+    size_t        num_workers,
+    const string& output_path
+) :
+    m_state(make_shared<State>(iterations, num_workers))
+{
+    m_state->output_path = output_path;
+    load_configuration(m_state->engine, config_path);
+}
+
+bool IronBeeBenchConsumer::operator()(const Input::input_p& input)
+{
+    if (! m_state->started) {
+        m_state->started  = true;
+        m_state->start_at = bench_now();
+    }
+
+    if (m_state->worker_pool) {
+        (*m_state->worker_pool)(input);
+    }
+    else {
+        m_state->process_input(input);
+    }
+
+    return true;
+}
+
 } // CLIPP
 } // IronBee
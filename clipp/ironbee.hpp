@@ -79,6 +79,34 @@ private:
     boost::shared_ptr<State> m_state;
 };
 
+/**
+ * CLIPP consumer that benchmarks an internal IronBee Engine.
+ *
+ * This consumer is as IronBeeConsumer, or IronBeeThreadedConsumer if
+ * @a num_workers is non-zero, except that every input is fed to IronBee
+ * @a iterations times, without delays, and the time taken by every event
+ * and input is recorded.  When the consumer is destroyed, throughput
+ * (inputs, transactions, and bytes per second) and latency histograms for
+ * inputs and each event are written as JSON to @a output_path or, if
+ * empty, to standard output.
+ **/
+class IronBeeBenchConsumer
+{
+public:
+    IronBeeBenchConsumer(
+        const std::string& config_path,
+        size_t             iterations,
+        size_t             num_workers,
+        const std::string& output_path
+    );
+
+    bool operator()(const Input::input_p& input);
+
+private:
+    struct State;
+    boost::shared_ptr<State> m_state;
+};
+
 /**
  * CLIPP modifier that feeds inputs to an internal IronBee Engine.
  *
@@ -0,0 +1,78 @@
+$:.unshift(File.dirname(File.dirname(__FILE__)))
+require 'clipp_test'
+
+class TestLua < Test::Unit::TestCase
+  include CLIPPTest
+
+  # Number of connections fed to IronBee by the threaded test.
+  LUA_THREADED_CONNECTIONS = 50
+
+  # Number of connections fed to IronBee by the contention benchmark.
+  LUA_BENCH_CONNECTIONS = 2000
+
+  # Lua rule run by every transaction.  It does a little work so that, in
+  # the benchmark, time spent in Lua dominates.
+  LUA_BENCH_RULE = <<-EOS
+    local t = ...
+    local n = 0
+    for i = 1, 2000 do
+      n = n + (i % 7)
+    end
+    io.stderr:write("LUA BENCH RULE\\n")
+    return 1
+  EOS
+
+  def lua_bench_inputs(connections)
+    (1..connections).collect do |i|
+      h = simple_hash("GET /lua/#{i} HTTP/1.1\nHost: lua.bench\n\n")
+      h["id"] = "lua_bench_#{i}"
+      h
+    end
+  end
+
+  # Run the Lua rule on the given inputs with the given number of worker
+  # threads and return the elapsed wall clock time.
+  def lua_bench(inputs, workers)
+    rule_path = write_temp_file("clipp_test_lua_RAND.lua", LUA_BENCH_RULE)
+    start = Time.now
+    clipp(
+      :input_hashes => inputs,
+      :consumer     => "ironbee_threaded:IRONBEE_CONFIG:#{workers}",
+      :config       => <<-EOS,
+        LoadModule "ibmod_lua.so"
+        RuleBasePath "#{BUILDDIR}/../lua"
+        LuaWorkerStates #{workers}
+      EOS
+      :default_site_config => <<-EOS
+        RuleExt lua:#{rule_path} id:lua_bench phase:REQUEST_HEADER
+      EOS
+    )
+    elapsed = Time.now - start
+    File.unlink(rule_path)
+    elapsed
+  end
+
+  # Every transaction runs the Lua rule once with several worker threads.
+  def test_lua_rule_threaded
+    lua_bench(lua_bench_inputs(LUA_THREADED_CONNECTIONS), 4)
+    assert_no_issues
+    assert_equal(LUA_THREADED_CONNECTIONS, log_count(/LUA BENCH RULE/))
+  end
+
+  # Contention benchmark for Lua rules.  Each worker thread runs Lua on its
+  # own state, so throughput should scale with the number of workers.  Only
+  # run when CLIPP_BENCH is set, e.g., by "make bench".
+  if ENV['CLIPP_BENCH']
+    def test_lua_rule_bench
+      inputs = lua_bench_inputs(LUA_BENCH_CONNECTIONS)
+      [1, 2, 4, 8].each do |workers|
+        elapsed = lua_bench(inputs, workers)
+        assert_no_issues
+        assert_equal(LUA_BENCH_CONNECTIONS, log_count(/LUA BENCH RULE/))
+        puts "Lua rules with #{workers} workers: " +
+          "#{LUA_BENCH_CONNECTIONS} connections in #{elapsed.round(3)}s " +
+          "(#{(LUA_BENCH_CONNECTIONS / elapsed).round} conn/s)"
+      end
+    end
+  end
+end
@@ -180,4 +180,36 @@ Content-Length: 1234
     assert_no_issues
     assert_log_no_match /CLIPP ANNOUNCE: ipmatch6_11c/
   end
+
+  def test_ipmatch_from_file
+    ip_path = write_temp_file("clipp_test_ipmatch_RAND.txt", <<-EOS)
+# Reputation list
+10.11.12.13
+6.6.6.0/24
+6::6:0/112
+    EOS
+    begin
+      [
+        ["6.6.6.6",  true],
+        ["6.6.7.6",  false],
+        ["6::6:6",   true],
+        ["6::7:6",   false]
+      ].each do |ip, expected|
+        clipp(
+          :input => "echo:\"GET /foo\" @set_remote_ip:#{ip}",
+          :default_site_config => <<-EOS
+            Rule REMOTE_ADDR @ipmatchFromFile "#{ip_path}" id:1 rev:1 phase:REQUEST_HEADER clipp_announce:ipmatch_from_file
+          EOS
+        )
+        assert_no_issues
+        if expected
+          assert_log_match /CLIPP ANNOUNCE: ipmatch_from_file/
+        else
+          assert_log_no_match /CLIPP ANNOUNCE: ipmatch_from_file/
+        end
+      end
+    ensure
+      File.unlink(ip_path)
+    end
+  end
 end
@@ -87,4 +87,14 @@ class TestTesting < Test::Unit::TestCase
     )
     assert_log_match /clipp_header/
   end
+
+  def test_bench
+    clipp(
+      :input_hashes => [simple_hash("GET /foo HTTP/1.1", "HTTP/1.1 200 OK")],
+      :consumer     => 'bench:IRONBEE_CONFIG:3'
+    )
+    assert_log_match /"inputs": 3,/
+    assert_log_match /"transactions_per_second":/
+    assert_log_match /"connection_data_in": \{"count": 3,/
+  end
 end
@@ -4,3 +4,4 @@ $:.unshift(File.dirname(__FILE__))
 
 require 'tc_testing'
 require 'tc_regression'
+require 'tc_lua'
@@ -415,6 +415,26 @@ static ib_status_t ctxsel_store(
     return IB_OK;
 }
 
+/**
+ * Is @a module the core module of @a ib?
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] module Module to check
+ *
+ * @returns true if @a module is the engine's core module
+ */
+static bool ctxsel_is_core(
+    const ib_engine_t *ib,
+    const ib_module_t *module)
+{
+    ib_module_t *core_module;
+
+    if (ib_core_module_data(ib, &core_module, NULL) != IB_OK) {
+        return false;
+    }
+    return module == core_module;
+}
+
 ib_status_t ib_ctxsel_registration_register(
     ib_engine_t                    *ib,
     const ib_ctxsel_registration_t *registration)
@@ -427,7 +447,7 @@ ib_status_t ib_ctxsel_registration_register(
         return IB_EINVAL;
     }
 
-    if (registration->module == ib_core_module()) {
+    if (ctxsel_is_core(ib, registration->module)) {
         if (ib->core_ctxsel.module != NULL) {
             return IB_DECLINED;
         }
@@ -435,7 +455,7 @@ ib_status_t ib_ctxsel_registration_register(
     }
 
     /* If it's not the core module, don't allow a second registrant */
-    else if (ib->act_ctxsel.module != ib_core_module()) {
+    else if (! ctxsel_is_core(ib, ib->act_ctxsel.module)) {
         return IB_DECLINED;
     }
 
@@ -449,10 +469,10 @@ ib_status_t ib_ctxsel_unregister(
     const ib_module_t *module)
 {
     assert(ib != NULL);
-    assert(ib->core_ctxsel.module == ib_core_module());
+    assert(ctxsel_is_core(ib, ib->core_ctxsel.module));
 
     /* Don't allow core to unregister. */
-    if (module == ib_core_module()) {
+    if (ctxsel_is_core(ib, module)) {
         return IB_DECLINED;
     }
     /* Verify that this is the current module */
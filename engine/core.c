@@ -101,6 +101,27 @@ static const char * const ib_uuid_default_str = "00000000-0000-0000-0000-0000000
 /* Instantiate a module global configuration. */
 static ib_core_cfg_t core_global_cfg;
 
+/**
+ * Get the global core configuration of engine @a ib.
+ *
+ * Each engine has its own copy of the core global configuration; the static
+ * one is only used before the core module is registered with @a ib.
+ *
+ * @param[in] ib IronBee engine.
+ *
+ * @returns Global core configuration of @a ib.
+ */
+static ib_core_cfg_t *core_global_config(const ib_engine_t *ib)
+{
+    ib_module_t *module;
+
+    if (ib_core_module_data(ib, &module, NULL) != IB_OK) {
+        return &core_global_cfg;
+    }
+
+    return (ib_core_cfg_t *)module->gcdata;
+}
+
 
 #define IB_ALPART_HEADER                  (1<< 0)
 #define IB_ALPART_EVENTS                  (1<< 1)
@@ -301,12 +322,12 @@ void logger_vlogmsg(
                                       (void *)&main_core_config);
         /* When a module fails to find its context, use the global one. */
         if (rc != IB_OK) {
-            main_core_config = &core_global_cfg;
+            main_core_config = core_global_config(ib);
         }
     }
     else {
         /* If there is no main context, use the global one. */
-        main_core_config = &core_global_cfg;
+        main_core_config = core_global_config(ib);
     }
 
     /* Check the log level, return if we're not interested. */
@@ -345,6 +366,27 @@ void logger_vlogmsg(
         main_core_config->log_uri = "stderr";
     }
 
+    /* In async mode, queue the message for the log writer thread. */
+    {
+        ib_core_module_data_t *core_data;
+
+        rc = ib_core_module_data(ib, NULL, &core_data);
+        if ( (rc == IB_OK) && (core_data->log_writer != NULL) ) {
+            rc = core_log_writer_log(
+                core_data->log_writer,
+                fileno(main_core_config->log_fp),
+                level,
+                ((line > 0) && (logger_level >= IB_LOG_DEBUG)) ? file : NULL,
+                line,
+                fmt,
+                ap
+            );
+            if (rc == IB_OK) {
+                return;
+            }
+        }
+    }
+
     /* Compose message */
     {
         static const size_t c_line_info_length = 35;
@@ -426,7 +468,7 @@ ib_log_level_t logger_loglevel(
 
     /* If not available, fall back to the core global configuration. */
     if (main_ctx == NULL || rc != IB_OK) {
-        main_core_config = &core_global_cfg;
+        main_core_config = core_global_config(ib);
     }
 
     return main_core_config->log_level;
@@ -447,6 +489,8 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
         (IB_PROVIDER_IFACE_TYPE(audit) *)lpi->pr->iface;
     ib_auditlog_t *log = (ib_auditlog_t *)lpi->data;
     ib_list_node_t *node;
+    ib_core_cfg_t *corecfg;
+    bool lock_index;
     ib_status_t rc;
 
     if (ib_list_elements(log->parts) == 0) {
@@ -454,11 +498,21 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
         return IB_EINVAL;
     }
 
+    rc = ib_context_module_config(log->ctx, ib_core_module(),
+                                  (void *)&corecfg);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    /* In segment mode only the writer thread touches the index file. */
+    lock_index = (log->ctx->auditlog->index != NULL) &&
+                 (corecfg->auditlog_mode != IB_AUDITLOG_MODE_SEGMENT);
+
     /* Open the log if required. This is thread safe. */
     if (iface->open != NULL) {
         rc = iface->open(lpi, log);
         if (rc != IB_OK) {
-            if (log->ctx->auditlog->index != NULL) {
+            if (lock_index) {
                 ib_lock_unlock(&log->ctx->auditlog->index_fp_lock);
             }
             return rc;
@@ -466,7 +520,7 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
     }
 
     /* Lock to write. */
-    if (log->ctx->auditlog->index != NULL) {
+    if (lock_index) {
         rc = ib_lock_lock(&log->ctx->auditlog->index_fp_lock);
         if (rc != IB_OK) {
             ib_log_error(lpi->pr->ib, "Cannot lock %s for write.",
@@ -479,7 +533,9 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
     if (iface->write_header != NULL) {
         rc = iface->write_header(lpi, log);
         if (rc != IB_OK) {
-            ib_lock_unlock(&log->ctx->auditlog->index_fp_lock);
+            if (lock_index) {
+                ib_lock_unlock(&log->ctx->auditlog->index_fp_lock);
+            }
             return rc;
         }
     }
@@ -499,7 +555,7 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
     if (iface->write_footer != NULL) {
         rc = iface->write_footer(lpi, log);
         if (rc != IB_OK) {
-            if (log->ctx->auditlog->index != NULL) {
+            if (lock_index) {
                 ib_lock_unlock(&log->ctx->auditlog->index_fp_lock);
             }
             return rc;
@@ -507,7 +563,7 @@ static ib_status_t audit_api_write_log(ib_provider_inst_t *lpi)
     }
 
     /* Writing is done. Unlock. Close is thread-safe. */
-    if (log->ctx->auditlog->index != NULL) {
+    if (lock_index) {
         ib_lock_unlock(&log->ctx->auditlog->index_fp_lock);
     }
 
@@ -2647,13 +2703,23 @@ static ib_status_t core_hook_response_body_data(ib_engine_t *ib,
     return rc;
 }
 
-ib_status_t ib_core_module_data(ib_module_t **core_module,
+ib_status_t ib_core_module_data(const ib_engine_t *ib,
+                                ib_module_t **core_module,
                                 ib_core_module_data_t **core_data)
 {
     ib_module_t *module;
+    ib_status_t rc;
+
+    assert(ib != NULL);
 
-    /* Get the core module data */
-    module = ib_core_module();
+    /* Get the engine's core module and its data */
+    rc = ib_array_get(ib->modules, ib_core_module()->idx, &module);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if (module == NULL) {
+        return IB_ENOENT;
+    }
     if (core_module != NULL) {
         *core_module = module;
     }
@@ -3121,7 +3187,7 @@ static ib_status_t core_dir_site_start(ib_cfgparser_t *cp,
     assert(p1 != NULL);
 
     /* Get core module data */
-    rc = ib_core_module_data(NULL, &core_data);
+    rc = ib_core_module_data(cp->ib, NULL, &core_data);
     if (rc != IB_OK) {
         return rc;
     }
@@ -3182,7 +3248,7 @@ static ib_status_t core_dir_site_end(ib_cfgparser_t *cp,
     const char *site_name;
 
     /* Get core module data */
-    rc = ib_core_module_data(NULL, &core_data);
+    rc = ib_core_module_data(cp->ib, NULL, &core_data);
     if (rc != IB_OK) {
         return rc;
     }
@@ -3236,7 +3302,7 @@ static ib_status_t core_dir_loc_start(ib_cfgparser_t *cp,
     assert(p1 != NULL);
 
     /* Get core module data */
-    rc = ib_core_module_data(NULL, &core_data);
+    rc = ib_core_module_data(cp->ib, NULL, &core_data);
     if (rc != IB_OK) {
         return rc;
     }
@@ -3294,7 +3360,7 @@ static ib_status_t core_dir_loc_end(ib_cfgparser_t *cp,
     ib_core_module_data_t *core_data;
 
     /* Get core module data */
-    rc = ib_core_module_data(NULL, &core_data);
+    rc = ib_core_module_data(cp->ib, NULL, &core_data);
     if (rc != IB_OK) {
         return rc;
     }
@@ -3343,7 +3409,7 @@ static ib_status_t core_dir_site_list(ib_cfgparser_t *cp,
     ib_site_t *site;
 
     /* Get core module data */
-    rc = ib_core_module_data(NULL, &core_data);
+    rc = ib_core_module_data(cp->ib, NULL, &core_data);
     if (rc != IB_OK) {
         return rc;
     }
@@ -3607,6 +3673,63 @@ static ib_status_t core_dir_param1(ib_cfgparser_t *cp,
         rc = ib_context_set_string(ctx, "auditlog_sdir_fmt", p1_unescaped);
         return rc;
     }
+    else if ( (strcasecmp("AuditLogMode", name) == 0) ||
+              (strcasecmp("AuditLogSegmentSize", name) == 0) ||
+              (strcasecmp("AuditLogFlushInterval", name) == 0) ||
+              (strcasecmp("AuditLogQueueLimit", name) == 0) ||
+              (strcasecmp("AuditLogBackPressure", name) == 0) )
+    {
+        /* The segment writer is shared by the whole engine. */
+        if (ctx != ib_context_main(ib)) {
+            ib_log_error(ib, "The %s directive is only valid in the "
+                         "main context.", name);
+            return IB_EINVAL;
+        }
+        ib_log_debug2(ib, "%s: \"%s\" ctx=%p", name, p1_unescaped, ctx);
+
+        if (strcasecmp("AuditLogMode", name) == 0) {
+            if (strcasecmp("File", p1_unescaped) == 0) {
+                return ib_context_set_num(ctx, "auditlog_mode",
+                                          IB_AUDITLOG_MODE_FILE);
+            }
+            else if (strcasecmp("Segment", p1_unescaped) == 0) {
+                return ib_context_set_num(ctx, "auditlog_mode",
+                                          IB_AUDITLOG_MODE_SEGMENT);
+            }
+        }
+        else if (strcasecmp("AuditLogBackPressure", name) == 0) {
+            if (strcasecmp("Block", p1_unescaped) == 0) {
+                return ib_context_set_num(ctx, "auditlog_backpressure",
+                                          IB_AUDITLOG_BP_BLOCK);
+            }
+            else if (strcasecmp("Drop", p1_unescaped) == 0) {
+                return ib_context_set_num(ctx, "auditlog_backpressure",
+                                          IB_AUDITLOG_BP_DROP);
+            }
+        }
+        else {
+            ib_num_t num;
+            const char *field =
+                (strcasecmp("AuditLogSegmentSize", name) == 0) ?
+                    "auditlog_seg_size" :
+                (strcasecmp("AuditLogFlushInterval", name) == 0) ?
+                    "auditlog_flush_ms" : "auditlog_queue_limit";
+
+            rc = ib_string_to_num(p1_unescaped, 0, &num);
+            if ( (rc == IB_OK) &&
+                 ((num > 0) ||
+                  ((num == 0) && (strcmp(field, "auditlog_flush_ms") == 0))) )
+            {
+                return ib_context_set_num(ctx, field, num);
+            }
+        }
+
+        ib_log_error(ib,
+                     "Failed to parse directive: %s \"%s\"",
+                     name,
+                     p1_unescaped);
+        return IB_EINVAL;
+    }
     /* Set the default block status for responding to blocked transactions. */
     else if (strcasecmp("DefaultBlockStatus", name) == 0) {
         int status;
@@ -3662,6 +3785,42 @@ static ib_status_t core_dir_param1(ib_cfgparser_t *cp,
         rc = ib_context_set_string(ctx, "logger.log_uri", uri);
         return rc;
     }
+    else if ( (strcasecmp("LogMode", name) == 0) ||
+              (strcasecmp("LogBufferSize", name) == 0) )
+    {
+        /* The log writer is shared by the whole engine. */
+        if (ctx != ib_context_main(ib)) {
+            ib_log_error(ib, "The %s directive is only valid in the "
+                         "main context.", name);
+            return IB_EINVAL;
+        }
+        ib_log_debug2(ib, "%s: \"%s\" ctx=%p", name, p1_unescaped, ctx);
+
+        if (strcasecmp("LogMode", name) == 0) {
+            if (strcasecmp("Sync", p1_unescaped) == 0) {
+                return ib_context_set_num(ctx, "logger.log_mode",
+                                          IB_LOG_MODE_SYNC);
+            }
+            else if (strcasecmp("Async", p1_unescaped) == 0) {
+                return ib_context_set_num(ctx, "logger.log_mode",
+                                          IB_LOG_MODE_ASYNC);
+            }
+        }
+        else {
+            ib_num_t num;
+
+            rc = ib_string_to_num(p1_unescaped, 0, &num);
+            if ( (rc == IB_OK) && (num > 0) ) {
+                return ib_context_set_num(ctx, "logger.log_buffer_size", num);
+            }
+        }
+
+        ib_log_error(ib,
+                     "Failed to parse directive: %s \"%s\"",
+                     name,
+                     p1_unescaped);
+        return IB_EINVAL;
+    }
     else if (strcasecmp("LoadModule", name) == 0) {
         char *absfile;
         ib_module_t *m;
@@ -3786,6 +3945,22 @@ static ib_status_t core_dir_param1(ib_cfgparser_t *cp,
         return IB_OK;
 
     }
+    else if (strcasecmp("RuleEngineProfile", name) == 0) {
+        if (ctx != ib_context_main(ib)) {
+            ib_log_error(ib,
+                         "%s is only allowed in the main context", name);
+            return IB_EINVAL;
+        }
+
+        rc = ib_rule_profile_enable(ib, p1_unescaped);
+        if (rc != IB_OK) {
+            ib_log_error(ib, "Failed to enable rule profiling: %s",
+                         ib_status_to_string(rc));
+            return rc;
+        }
+        ib_log_debug2(ib, "%s: %s", name, p1_unescaped);
+        return IB_OK;
+    }
 
     ib_log_error(ib, "Unhandled directive: %s %s", name, p1_unescaped);
     return IB_EINVAL;
@@ -4107,7 +4282,7 @@ static ib_status_t core_set_value(ib_cfgparser_t *cp,
     rc = ib_context_module_config(ib->ctx, ib_core_module(),
                                   (void *)&corecfg);
     if (rc != IB_OK) {
-        corecfg = &core_global_cfg;
+        corecfg = core_global_config(ib);
     }
 
     if (strcasecmp("parser", name) == 0) {
@@ -4242,7 +4417,7 @@ static ib_status_t core_dir_initvar(ib_cfgparser_t *cp,
     rc = ib_context_module_config(cp->cur_ctx, ib_core_module(),
                                   (void *)&corecfg);
     if (rc != IB_OK) {
-        corecfg = &core_global_cfg;
+        corecfg = core_global_config(cp->ib);
     }
 
     /* Initialize the fields list */
@@ -4448,6 +4623,16 @@ static IB_DIRMAP_INIT_STRUCTURE(core_directive_map) = {
         core_dir_param1,
         NULL
     ),
+    IB_DIRMAP_INIT_PARAM1(
+        "LogMode",
+        core_dir_param1,
+        NULL
+    ),
+    IB_DIRMAP_INIT_PARAM1(
+        "LogBufferSize",
+        core_dir_param1,
+        NULL
+    ),
 
     /* Config */
     IB_DIRMAP_INIT_SBLK1(
@@ -4523,6 +4708,31 @@ static IB_DIRMAP_INIT_STRUCTURE(core_directive_map) = {
         core_dir_param1,
         NULL
     ),
+    IB_DIRMAP_INIT_PARAM1(
+        "AuditLogMode",
+        core_dir_param1,
+        NULL
+    ),
+    IB_DIRMAP_INIT_PARAM1(
+        "AuditLogSegmentSize",
+        core_dir_param1,
+        NULL
+    ),
+    IB_DIRMAP_INIT_PARAM1(
+        "AuditLogFlushInterval",
+        core_dir_param1,
+        NULL
+    ),
+    IB_DIRMAP_INIT_PARAM1(
+        "AuditLogQueueLimit",
+        core_dir_param1,
+        NULL
+    ),
+    IB_DIRMAP_INIT_PARAM1(
+        "AuditLogBackPressure",
+        core_dir_param1,
+        NULL
+    ),
     IB_DIRMAP_INIT_OPFLAGS(
         "AuditLogParts",
         core_dir_auditlogparts,
@@ -4557,6 +4767,13 @@ static IB_DIRMAP_INIT_STRUCTURE(core_directive_map) = {
         core_loglevels_map
     ),
 
+    /* Rule profiling */
+    IB_DIRMAP_INIT_PARAM1(
+        "RuleEngineProfile",
+        core_dir_param1,
+        NULL
+    ),
+
     /* TX DPI Initializers */
     IB_DIRMAP_INIT_PARAM2(
         "InitVar",
@@ -4623,6 +4840,8 @@ static ib_status_t core_init(ib_engine_t *ib,
     /* Set defaults */
     corecfg->log_level            = 4;
     corecfg->log_uri              = "";
+    corecfg->log_mode             = IB_LOG_MODE_SYNC;
+    corecfg->log_buffer_size      = IB_LOG_BUFFER_SIZE_DEFAULT;
     corecfg->parser               = MODULE_NAME_STR;
     corecfg->buffer_req           = 0;
     corecfg->buffer_res           = 0;
@@ -4633,6 +4852,11 @@ static ib_status_t core_init(ib_engine_t *ib,
     corecfg->auditlog_dir         = "/var/log/ironbee";
     corecfg->auditlog_sdir_fmt    = "";
     corecfg->auditlog_index_fmt   = IB_LOGFORMAT_DEFAULT;
+    corecfg->auditlog_mode        = IB_AUDITLOG_MODE_FILE;
+    corecfg->auditlog_seg_size    = 64 * 1024 * 1024;
+    corecfg->auditlog_flush_ms    = 1000;
+    corecfg->auditlog_queue_limit = 16 * 1024 * 1024;
+    corecfg->auditlog_backpressure = IB_AUDITLOG_BP_BLOCK;
     corecfg->audit                = MODULE_NAME_STR;
     corecfg->data                 = MODULE_NAME_STR;
     corecfg->module_base_path     = X_MODULE_BASE_PATH;
@@ -4837,6 +5061,7 @@ ib_status_t core_finish(
 )
 {
     ib_core_cfg_t *corecfg;
+    ib_core_module_data_t *core_data;
     ib_status_t rc;
 
     /* Get the core module config. */
@@ -4847,18 +5072,24 @@ ib_status_t core_finish(
         return rc;
     }
 
+    /* Drain and stop the segment mode audit log writer */
+    core_data = (ib_core_module_data_t *)m->data;
+    if ( (core_data != NULL) && (core_data->audit_writer != NULL) ) {
+        core_audit_writer_destroy(core_data->audit_writer);
+        core_data->audit_writer = NULL;
+    }
+
+    /* Drain and stop the async log writer; log synchronously from here. */
+    if ( (core_data != NULL) && (core_data->log_writer != NULL) ) {
+        core_log_writer_destroy(core_data->log_writer);
+        core_data->log_writer = NULL;
+    }
+
     if ( (corecfg->log_fp != NULL) && (corecfg->log_fp != stderr) ) {
         fclose(corecfg->log_fp);
         corecfg->log_fp = stderr;
     }
 
-    /* Shut down the core collection managers */
-    rc = ib_core_collection_managers_finish(ib, m);
-    if (rc != IB_OK) {
-        ib_log_alert(ib, "Failed to shut down core collection managers: %s",
-                     ib_status_to_string(rc));
-    }
-
     /* Shut down the managed collection logic */
     rc = ib_managed_collection_finish(ib);
     if (rc != IB_OK) {
@@ -4886,6 +5117,18 @@ static IB_CFGMAP_INIT_STRUCTURE(core_config_map) = {
         ib_core_cfg_t,
         log_uri
     ),
+    IB_CFGMAP_INIT_ENTRY(
+        "logger.log_mode",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        log_mode
+    ),
+    IB_CFGMAP_INIT_ENTRY(
+        "logger.log_buffer_size",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        log_buffer_size
+    ),
 
     /* Rule logging */
     IB_CFGMAP_INIT_ENTRY(
@@ -4978,6 +5221,36 @@ static IB_CFGMAP_INIT_STRUCTURE(core_config_map) = {
         ib_core_cfg_t,
         auditlog_index_fmt
     ),
+    IB_CFGMAP_INIT_ENTRY(
+        "auditlog_mode",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        auditlog_mode
+    ),
+    IB_CFGMAP_INIT_ENTRY(
+        "auditlog_seg_size",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        auditlog_seg_size
+    ),
+    IB_CFGMAP_INIT_ENTRY(
+        "auditlog_flush_ms",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        auditlog_flush_ms
+    ),
+    IB_CFGMAP_INIT_ENTRY(
+        "auditlog_queue_limit",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        auditlog_queue_limit
+    ),
+    IB_CFGMAP_INIT_ENTRY(
+        "auditlog_backpressure",
+        IB_FTYPE_NUM,
+        ib_core_cfg_t,
+        auditlog_backpressure
+    ),
     IB_CFGMAP_INIT_ENTRY(
         IB_PROVIDER_TYPE_AUDIT,
         IB_FTYPE_NULSTR,
@@ -5073,6 +5346,42 @@ static ib_status_t core_ctx_close(ib_engine_t  *ib,
         }
     }
 
+    /* Create the async log writer for the engine */
+    if ( (ib_context_type(ctx) == IB_CTYPE_MAIN) &&
+         (corecfg->log_mode == IB_LOG_MODE_ASYNC) )
+    {
+        ib_core_module_data_t *core_data =
+            (ib_core_module_data_t *)mod->data;
+
+        if (core_data->log_writer == NULL) {
+            rc = core_log_writer_create((size_t)corecfg->log_buffer_size,
+                                        &core_data->log_writer);
+            if (rc != IB_OK) {
+                ib_log_alert(ib, "Failed to create log writer: %s",
+                             ib_status_to_string(rc));
+                return rc;
+            }
+        }
+    }
+
+    /* Create the segment mode audit log writer for the engine */
+    if ( (ib_context_type(ctx) == IB_CTYPE_MAIN) &&
+         (corecfg->auditlog_mode == IB_AUDITLOG_MODE_SEGMENT) )
+    {
+        ib_core_module_data_t *core_data =
+            (ib_core_module_data_t *)mod->data;
+
+        if (core_data->audit_writer == NULL) {
+            rc = core_audit_writer_create(ib, corecfg,
+                                          &core_data->audit_writer);
+            if (rc != IB_OK) {
+                ib_log_alert(ib, "Failed to create audit log writer: %s",
+                             ib_status_to_string(rc));
+                return rc;
+            }
+        }
+    }
+
     return IB_OK;
 }
 
@@ -148,11 +148,12 @@ typedef union {
  * Structure storing setvar instance data.
  */
 typedef struct {
-    setvar_op_t      op;          /**< Setvar operation */
-    char            *name;        /**< Field name */
-    bool             name_expand; /**< Field name should be expanded */
-    ib_ftype_t       type;        /**< Data type */
-    setvar_value_t   value;       /**< Value. value.num, flt, or bstr. */
+    setvar_op_t       op;           /**< Setvar operation */
+    char             *name;         /**< Field name */
+    ib_data_expand_t *name_expand;  /**< Compiled name if expandable */
+    ib_data_expand_t *value_expand; /**< Compiled value if expandable */
+    ib_ftype_t        type;         /**< Data type */
+    setvar_value_t    value;        /**< Value. value.num, flt, or bstr. */
 } setvar_data_t;
 
 /**
@@ -507,7 +508,14 @@ static ib_status_t act_event_execute(
     /* Expand the message string */
     if ( (rule->meta.flags & IB_RULEMD_FLAG_EXPAND_MSG) != 0) {
         char *tmp;
-        rc = ib_data_expand_str(tx->data, rule->meta.msg, false, &tmp);
+        size_t len;
+        if (rule->meta.msg_expand != NULL) {
+            rc = ib_data_expand_render(tx->data, rule->meta.msg_expand, true,
+                                       &tmp, &len);
+        }
+        else {
+            rc = ib_data_expand_str(tx->data, rule->meta.msg, false, &tmp);
+        }
         if (rc != IB_OK) {
             ib_rule_log_error(rule_exec,
                               "event: Failed to expand string '%s': %s",
@@ -540,9 +548,18 @@ static ib_status_t act_event_execute(
 
     /* Set the data */
     if (rule->meta.data != NULL) {
+        size_t len;
         if ( (rule->meta.flags & IB_RULEMD_FLAG_EXPAND_DATA) != 0) {
             char *tmp;
-            rc = ib_data_expand_str(tx->data, rule->meta.data, false, &tmp);
+            if (rule->meta.data_expand != NULL) {
+                rc = ib_data_expand_render(tx->data, rule->meta.data_expand,
+                                           true, &tmp, &len);
+            }
+            else {
+                rc = ib_data_expand_str(tx->data, rule->meta.data, false,
+                                        &tmp);
+                len = (rc == IB_OK) ? strlen(tmp) : 0;
+            }
             if (rc != IB_OK) {
                 ib_rule_log_error(rule_exec,
                                   "event: Failed to expand data '%s': %s",
@@ -553,8 +570,9 @@ static ib_status_t act_event_execute(
         }
         else {
             expanded = rule->meta.data;
+            len = strlen(expanded);
         }
-        rc = ib_logevent_data_set(event, expanded, strlen(expanded));
+        rc = ib_logevent_data_set(event, expanded, len);
         if (rc != IB_OK) {
             ib_rule_log_error(rule_exec, "event: Failed to set data: %s",
                               ib_status_to_string(rc));
@@ -638,6 +656,7 @@ static ib_status_t act_setvar_create(
     const char *mod;             /* '+'/'-'/'*' character in params */
     const char *value;           /* Value in params */
     bool compat_syntax = false;  /* Using old 0.5.x =+ compatibility? */
+    bool name_expand = false;    /* Is the name expandable? */
     size_t vlen;                 /* Length of value */
     setvar_data_t *data;         /* Data for the execute function */
     ib_status_t rc;              /* Status code */
@@ -674,16 +693,22 @@ static ib_status_t act_setvar_create(
     vlen = strlen(value);
 
     /* Create the data structure for the execute function */
-    data = ib_mpool_alloc(mp, sizeof(*data) );
+    data = ib_mpool_calloc(mp, 1, sizeof(*data) );
     if (data == NULL) {
         return IB_EALLOC;
     }
 
     /* Does the name need to be expanded? */
-    rc = ib_data_expand_test_str_ex(params, nlen, &(data->name_expand));
+    rc = ib_data_expand_test_str_ex(params, nlen, &name_expand);
     if (rc != IB_OK) {
         return rc;
     }
+    if (name_expand) {
+        rc = ib_rule_expand_compile(ib, params, nlen, &(data->name_expand));
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
 
     /* Copy the name */
     data->name = ib_mpool_memdup_to_str(mp, params, nlen);
@@ -748,6 +773,11 @@ static ib_status_t act_setvar_create(
         }
         else if (expand) {
             inst->flags |= IB_ACTINST_FLAG_EXPAND;
+            rc = ib_rule_expand_compile(ib, value, vlen,
+                                        &(data->value_expand));
+            if (rc != IB_OK) {
+                return rc;
+            }
         }
 
         rc = ib_bytestr_dup_nulstr(&(data->value.bstr), mp, value);
@@ -792,15 +822,13 @@ static ib_status_t expand_name(const ib_rule_exec_t *rule_exec,
     ib_tx_t *tx = rule_exec->tx;
 
     /* If it's expandable, expand it */
-    if (setvar_data->name_expand) {
+    if (setvar_data->name_expand != NULL) {
         char *tmp;
         size_t len;
         ib_status_t rc;
 
-        rc = ib_data_expand_str_ex(tx->data,
-                                   name, strlen(name),
-                                   false, false,
-                                   &tmp, &len);
+        rc = ib_data_expand_render(tx->data, setvar_data->name_expand,
+                                   false, &tmp, &len);
         if (rc != IB_OK) {
             ib_rule_log_error(rule_exec,
                               "%s: Failed to expand name \"%s\": %s",
@@ -955,9 +983,10 @@ static ib_status_t expand_data(
 
         /* Expand the string */
         if (flags & IB_ACTINST_FLAG_EXPAND) {
+            assert(setvar_data->value_expand != NULL);
 
-            rc = ib_data_expand_str_ex(
-                tx->data, bsdata, bslen, false, false, expanded, exlen);
+            rc = ib_data_expand_render(
+                tx->data, setvar_data->value_expand, false, expanded, exlen);
             if (rc != IB_OK) {
                 ib_rule_log_debug(
                     rule_exec,
@@ -1643,7 +1672,7 @@ static ib_status_t act_status_create(
  * @param[in] rule_exec Rule execution object
  * @param[in] label Label to use for debug / error messages
  * @param[in] name Name to expand
- * @param[in] expandable Is @a expandable?
+ * @param[in] name_expand Compiled @a name or NULL if not expandable
  * @param[out] exname Expanded name
  * @param[out] exnlen Length of @a exname
  *
@@ -1652,7 +1681,7 @@ static ib_status_t act_status_create(
 static ib_status_t expand_name_hdr(const ib_rule_exec_t *rule_exec,
                                    const char *label,
                                    const char *name,
-                                   bool expandable,
+                                   const ib_data_expand_t *name_expand,
                                    const char **exname,
                                    size_t *exnlen)
 {
@@ -1664,19 +1693,19 @@ static ib_status_t expand_name_hdr(const ib_rule_exec_t *rule_exec,
     assert(exnlen != NULL);
 
     /* If it's expandable, expand it */
-    if (expandable) {
+    if (name_expand != NULL) {
         char *tmp;
         size_t len;
         ib_status_t rc;
 
-        rc = ib_data_expand_str(rule_exec->tx->data, name, false, &tmp);
+        rc = ib_data_expand_render(rule_exec->tx->data, name_expand, true,
+                                   &tmp, &len);
         if (rc != IB_OK) {
             ib_rule_log_error(rule_exec,
                               "%s: Failed to expand name \"%s\": %s",
                               label, name, ib_status_to_string(rc));
             return rc;
         }
-        len = strlen(tmp);
         *exname = tmp;
         *exnlen = len;
         ib_log_debug_tx(rule_exec->tx,
@@ -1695,12 +1724,10 @@ static ib_status_t expand_name_hdr(const ib_rule_exec_t *rule_exec,
 /**
  * Expand a string from the DPI
  *
- * @todo Should call ib_data_expand_str_ex()
- *
  * @param[in] rule_exec Rule execution object
  * @param[in] label Label to use for debug / error messages
  * @param[in] str String to expand
- * @param[in] flags Action flags
+ * @param[in] str_expand Compiled @a str or NULL if not expandable
  * @param[out] expanded Expanded string
  * @param[out] exlen Length of @a expanded
  *
@@ -1709,7 +1736,7 @@ static ib_status_t expand_name_hdr(const ib_rule_exec_t *rule_exec,
 static ib_status_t expand_str(const ib_rule_exec_t *rule_exec,
                               const char *label,
                               const char *str,
-                              ib_flags_t flags,
+                              const ib_data_expand_t *str_expand,
                               const char **expanded,
                               size_t *exlen)
 {
@@ -1721,19 +1748,18 @@ static ib_status_t expand_str(const ib_rule_exec_t *rule_exec,
     ib_tx_t *tx = rule_exec->tx;
 
     /* If it's expandable, expand it */
-    if ( (flags & IB_ACTINST_FLAG_EXPAND) != 0) {
+    if (str_expand != NULL) {
         char *tmp;
         size_t len;
         ib_status_t rc;
 
-        rc = ib_data_expand_str(tx->data, str, false, &tmp);
+        rc = ib_data_expand_render(tx->data, str_expand, true, &tmp, &len);
         if (rc != IB_OK) {
             ib_rule_log_error(rule_exec,
                               "%s: Failed to expand \"%s\": %s",
                               label, str, ib_status_to_string(rc));
             return rc;
         }
-        len = strlen(tmp);
         *expanded = tmp;
         *exlen = len;
         ib_rule_log_debug(rule_exec,
@@ -1752,10 +1778,11 @@ static ib_status_t expand_str(const ib_rule_exec_t *rule_exec,
  * and regexp with which to edit as applicable.
  */
 struct act_header_data_t {
-    const char *name;        /**< Name of the header to operate on. */
-    bool        name_expand; /**< Is name expandable? */
-    const char *value;       /**< Value to replace the header with. */
-    ib_rx_t    *rx;          /**< Regexp substitution to apply to header */
+    const char       *name;         /**< Name of the header to operate on. */
+    ib_data_expand_t *name_expand;  /**< Compiled name if expandable */
+    const char       *value;        /**< Value to replace the header with. */
+    ib_data_expand_t *value_expand; /**< Compiled value if expandable */
+    ib_rx_t          *rx;           /**< Regexp substitution to apply */
 };
 typedef struct act_header_data_t act_header_data_t;
 
@@ -1786,7 +1813,8 @@ static ib_status_t act_del_header_create(
     assert(inst != NULL);
 
     act_header_data_t *act_data =
-        (act_header_data_t *)ib_mpool_alloc(mp, sizeof(*act_data));
+        (act_header_data_t *)ib_mpool_calloc(mp, 1, sizeof(*act_data));
+    bool expand = false;
     ib_status_t rc;
 
     if (act_data == NULL) {
@@ -1805,11 +1833,17 @@ static ib_status_t act_del_header_create(
     }
 
     /* Does the name need to be expanded? */
-    rc = ib_data_expand_test_str_ex(params, strlen(params),
-                                    &(act_data->name_expand));
+    rc = ib_data_expand_test_str_ex(params, strlen(params), &expand);
     if (rc != IB_OK) {
         return rc;
     }
+    if (expand) {
+        rc = ib_rule_expand_compile(ib, params, strlen(params),
+                                    &(act_data->name_expand));
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
 
     inst->data = act_data;
 
@@ -1847,7 +1881,7 @@ static ib_status_t act_set_header_create(
     size_t params_len;
     char *equals_idx;
     act_header_data_t *act_data =
-        (act_header_data_t *)ib_mpool_alloc(mp, sizeof(*act_data));
+        (act_header_data_t *)ib_mpool_calloc(mp, 1, sizeof(*act_data));
     bool expand = false;
     ib_status_t rc;
     size_t value_offs = 1;
@@ -1888,11 +1922,17 @@ static ib_status_t act_set_header_create(
     ((char *)act_data->name)[name_len] = '\0';
 
     /* Does the name need to be expanded? */
-    rc = ib_data_expand_test_str_ex(act_data->name, name_len,
-                                    &(act_data->name_expand));
+    rc = ib_data_expand_test_str_ex(act_data->name, name_len, &expand);
     if (rc != IB_OK) {
         return rc;
     }
+    if (expand) {
+        rc = ib_rule_expand_compile(ib, act_data->name, name_len,
+                                    &(act_data->name_expand));
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
 
     act_data->value = (value_len == 0)?
         ib_mpool_strdup(mp, ""):
@@ -1907,6 +1947,11 @@ static ib_status_t act_set_header_create(
     }
     else if (expand) {
         inst->flags |= IB_ACTINST_FLAG_EXPAND;
+        rc = ib_rule_expand_compile(ib, act_data->value, value_len,
+                                    &(act_data->value_expand));
+        if (rc != IB_OK) {
+            return rc;
+        }
     }
 
     /* If we have a regexp and we're not expanding, we can compile it now */
@@ -1961,7 +2006,8 @@ static ib_status_t act_set_request_header_execute(
     }
 
     rc = expand_str(rule_exec, "setRequestHeader",
-                    act_data->value, flags, &value, &value_len);
+                    act_data->value, act_data->value_expand,
+                    &value, &value_len);
     if (rc != IB_OK) {
         return rc;
     }
@@ -2014,7 +2060,8 @@ static ib_status_t act_edit_request_header_execute(
     }
 
     rc = expand_str(rule_exec, "editRequestHeader",
-                    act_data->value, flags, &value, &value_len);
+                    act_data->value, act_data->value_expand,
+                    &value, &value_len);
     if (rc != IB_OK) {
         return rc;
     }
@@ -2113,7 +2160,8 @@ static ib_status_t act_set_response_header_execute(
         return rc;
     }
 
-    rc = expand_str(rule_exec, "setResponseHeader", act_data->value, flags,
+    rc = expand_str(rule_exec, "setResponseHeader",
+                    act_data->value, act_data->value_expand,
                     &value, &value_len);
     if (rc != IB_OK) {
         return rc;
@@ -2170,7 +2218,7 @@ static ib_status_t act_edit_response_header_execute(
     }
 
     rc = expand_str(rule_exec, "editResponseHeader",
-                    act_data->value, flags,
+                    act_data->value, act_data->value_expand,
                     &value, &value_len);
     if (rc != IB_OK) {
         return rc;
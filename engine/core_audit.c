@@ -38,9 +38,15 @@
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdarg.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 
 /* POSIX doesn't define O_BINARY */
@@ -60,6 +66,668 @@ typedef struct {
 static const char * const ib_pipe_shell = "/bin/sh";
 const size_t LOGFORMAT_MAX_LINE_LENGTH = 8192;
 
+/* -- Segment Mode Writer -- */
+
+/** Initial size of a segment mode record buffer. */
+#define CORE_AUDIT_BUF_MIN 16384
+
+/** Number of segment files the writer thread keeps open. */
+#define CORE_AUDIT_SEG_CACHE 4
+
+/** Writers created by this process; keeps segment names of writers unique. */
+static unsigned core_audit_writer_count = 0;
+
+/**
+ * A serialized audit log record waiting for the writer thread.
+ *
+ * Buffers are recycled through the writer's free list and cached per
+ * thread, so steady state logging does not allocate.
+ */
+struct core_audit_buf_t {
+    char                *data;         /**< Serialized record */
+    size_t               len;          /**< Bytes used in data */
+    size_t               size;         /**< Bytes allocated for data */
+    char                *line;         /**< AuditLogIndex line */
+    size_t               line_len;     /**< Length of line; 0 if none */
+    char                 tx_id[64];    /**< Transaction ID */
+    ib_num_t             seg;          /**< Segment sequence number */
+    size_t               offset;       /**< Offset within the segment */
+    FILE                *index_fp;     /**< AuditLogIndex destination */
+    core_audit_writer_t *writer;       /**< Owning writer */
+    core_audit_buf_t    *next;         /**< Next in queue or free list */
+    core_audit_buf_t    *all_next;     /**< Next in list of all buffers */
+};
+
+/**
+ * An open segment file and its offset index.
+ */
+typedef struct {
+    ib_num_t             seq;          /**< Sequence number; -1 if unused */
+    int                  fd;           /**< Segment file descriptor */
+    FILE                *idx_fp;       /**< Offset index file */
+} core_audit_seg_t;
+
+/**
+ * Segment mode audit log writer.
+ *
+ * Transactions reserve a (segment, offset) range under @a lock and queue
+ * their record; the writer thread pwrite()s queued records in batches, so
+ * records may land out of order but never overlap.
+ */
+struct core_audit_writer_t {
+    ib_engine_t         *ib;           /**< Engine (for logging) */
+    char                *dir;          /**< Segment directory */
+    ib_num_t             dmode;        /**< Directory create mode */
+    ib_num_t             fmode;        /**< File create mode */
+    size_t               seg_size;     /**< Segment rotation size */
+    ib_num_t             flush_ms;     /**< Flush interval (ms) */
+    size_t               queue_limit;  /**< Max bytes queued */
+    ib_auditlog_backpressure_t backpressure; /**< Full queue policy */
+    time_t               created;      /**< Creation time (segment names) */
+    unsigned             serial;       /**< Writer number (segment names) */
+    pthread_key_t        buf_key;      /**< Per-thread spare buffer */
+    pthread_mutex_t      lock;         /**< Protects the fields below */
+    pthread_cond_t       work;         /**< Signals the writer thread */
+    pthread_cond_t       space;        /**< Signals queue space */
+    pthread_t            thread;       /**< Writer thread */
+    pid_t                pid;          /**< Process running thread, or 0 */
+    bool                 shutdown;     /**< Writer is shutting down */
+    core_audit_buf_t    *queue_head;   /**< Records to write (FIFO) */
+    core_audit_buf_t    *queue_tail;   /**< Last queued record */
+    core_audit_buf_t    *free_list;    /**< Recycled buffers */
+    core_audit_buf_t    *all;          /**< Every buffer allocated */
+    size_t               pending;      /**< Bytes reserved, not written */
+    ib_num_t             seg_seq;      /**< Current segment number */
+    size_t               seg_offset;   /**< Next offset in segment */
+    uint64_t             dropped;      /**< Records dropped, not logged */
+    core_audit_seg_t     segs[CORE_AUDIT_SEG_CACHE]; /**< Writer thread only */
+};
+
+/**
+ * Append data to a record buffer, growing it as needed.
+ *
+ * @param[in] buf Buffer.
+ * @param[in] data Data to append.
+ * @param[in] len Length of @a data.
+ *
+ * @returns IB_OK or IB_EALLOC.
+ */
+static ib_status_t core_audit_buf_append(core_audit_buf_t *buf,
+                                         const void *data,
+                                         size_t len)
+{
+    if (buf->len + len > buf->size) {
+        size_t size = (buf->size == 0) ? CORE_AUDIT_BUF_MIN : buf->size;
+        char *tmp;
+
+        while (size < buf->len + len) {
+            size *= 2;
+        }
+        tmp = (char *)realloc(buf->data, size);
+        if (tmp == NULL) {
+            return IB_EALLOC;
+        }
+        buf->data = tmp;
+        buf->size = size;
+    }
+
+    memcpy(buf->data + buf->len, data, len);
+    buf->len += len;
+
+    return IB_OK;
+}
+
+/**
+ * Write to the audit log file or, in segment mode, the record buffer.
+ *
+ * @param[in] cfg Audit configuration.
+ * @param[in] data Data to write.
+ * @param[in] len Length of @a data.
+ *
+ * @returns IB_OK, IB_EALLOC or IB_EUNKNOWN.
+ */
+static ib_status_t core_audit_write(core_audit_cfg_t *cfg,
+                                    const void *data,
+                                    size_t len)
+{
+    if (len == 0) {
+        return IB_OK;
+    }
+    if (cfg->buf != NULL) {
+        return core_audit_buf_append(cfg->buf, data, len);
+    }
+    if (fwrite(data, len, 1, cfg->fp) != 1) {
+        return IB_EUNKNOWN;
+    }
+    return IB_OK;
+}
+
+/**
+ * Formatted version of core_audit_write().
+ *
+ * @param[in] cfg Audit configuration.
+ * @param[in] fmt Format string.
+ *
+ * @returns IB_OK, IB_EALLOC or IB_EUNKNOWN.
+ */
+static ib_status_t core_audit_printf(core_audit_cfg_t *cfg,
+                                     const char *fmt, ...)
+    PRINTF_ATTRIBUTE(2, 3);
+static ib_status_t core_audit_printf(core_audit_cfg_t *cfg,
+                                     const char *fmt, ...)
+{
+    char small[512];
+    char *str = small;
+    va_list ap;
+    int len;
+    ib_status_t rc;
+
+    va_start(ap, fmt);
+    len = vsnprintf(small, sizeof(small), fmt, ap);
+    va_end(ap);
+    if (len < 0) {
+        return IB_EUNKNOWN;
+    }
+
+    if ((size_t)len >= sizeof(small)) {
+        str = (char *)malloc(len + 1);
+        if (str == NULL) {
+            return IB_EALLOC;
+        }
+        va_start(ap, fmt);
+        vsnprintf(str, len + 1, fmt, ap);
+        va_end(ap);
+    }
+
+    rc = core_audit_write(cfg, str, len);
+
+    if (str != small) {
+        free(str);
+    }
+    return rc;
+}
+
+/**
+ * Build the file name of a segment, relative to the audit log directory.
+ *
+ * @param[in] writer Writer.
+ * @param[in] seq Segment sequence number.
+ * @param[out] name Name buffer.
+ * @param[in] name_sz Size of @a name.
+ */
+static void core_audit_seg_name(const core_audit_writer_t *writer,
+                                ib_num_t seq,
+                                char *name,
+                                size_t name_sz)
+{
+    snprintf(name, name_sz, "audit-%ld-%ld-%u-%06" PRId64 ".seg",
+             (long)writer->pid, (long)writer->created, writer->serial,
+             (int64_t)seq);
+}
+
+/**
+ * Find or open segment @a seq (writer thread only).
+ *
+ * @param[in] writer Writer.
+ * @param[in] seq Segment sequence number.
+ *
+ * @returns The open segment or NULL on error (logged).
+ */
+static core_audit_seg_t *core_audit_writer_segment(core_audit_writer_t *writer,
+                                                   ib_num_t seq)
+{
+    core_audit_seg_t *seg = &writer->segs[0];
+    char name[128];
+    char *path;
+    size_t path_sz;
+    int idx_fd;
+    int i;
+
+    for (i = 0; i < CORE_AUDIT_SEG_CACHE; ++i) {
+        if (writer->segs[i].seq == seq) {
+            return &writer->segs[i];
+        }
+        /* Evict unused slots first, then the oldest segment. */
+        if ((seg->seq != -1) &&
+            ((writer->segs[i].seq == -1) || (writer->segs[i].seq < seg->seq)))
+        {
+            seg = &writer->segs[i];
+        }
+    }
+
+    if (seg->seq != -1) {
+        close(seg->fd);
+        fclose(seg->idx_fp);
+        seg->seq = -1;
+    }
+
+    if (ib_util_mkpath(writer->dir, writer->dmode) != IB_OK) {
+        ib_log_error(writer->ib,
+                     "Could not create audit log dir: %s", writer->dir);
+        return NULL;
+    }
+
+    core_audit_seg_name(writer, seq, name, sizeof(name));
+    path_sz = strlen(writer->dir) + strlen(name) + 6;
+    path = (char *)malloc(path_sz);
+    if (path == NULL) {
+        return NULL;
+    }
+
+    snprintf(path, path_sz, "%s/%s", writer->dir, name);
+    seg->fd = open(path, (O_WRONLY|O_CREAT|O_BINARY), writer->fmode);
+    if (seg->fd < 0) {
+        int sys_rc = errno;
+        ib_log_error(writer->ib,
+                     "Failed to open audit log segment \"%s\": %s (%d)",
+                     path, strerror(sys_rc), sys_rc);
+        free(path);
+        return NULL;
+    }
+
+    snprintf(path, path_sz, "%s/%s.idx", writer->dir, name);
+    idx_fd = open(path, (O_WRONLY|O_APPEND|O_CREAT|O_BINARY), writer->fmode);
+    seg->idx_fp = (idx_fd >= 0) ? fdopen(idx_fd, "ab") : NULL;
+    if (seg->idx_fp == NULL) {
+        int sys_rc = errno;
+        ib_log_error(writer->ib,
+                     "Failed to open audit log segment index \"%s\": %s (%d)",
+                     path, strerror(sys_rc), sys_rc);
+        if (idx_fd >= 0) {
+            close(idx_fd);
+        }
+        close(seg->fd);
+        free(path);
+        return NULL;
+    }
+
+    free(path);
+    seg->seq = seq;
+    return seg;
+}
+
+/**
+ * Close all open segments (writer thread only).
+ *
+ * @param[in] writer Writer.
+ */
+static void core_audit_writer_close_segments(core_audit_writer_t *writer)
+{
+    int i;
+
+    for (i = 0; i < CORE_AUDIT_SEG_CACHE; ++i) {
+        if (writer->segs[i].seq != -1) {
+            close(writer->segs[i].fd);
+            fclose(writer->segs[i].idx_fp);
+            writer->segs[i].seq = -1;
+        }
+    }
+}
+
+/**
+ * Write a batch of records to their segments (writer thread only).
+ *
+ * @param[in] writer Writer.
+ * @param[in] batch Records to write.
+ * @param[out] tail Last record of @a batch.
+ *
+ * @returns Number of record bytes in @a batch.
+ */
+static size_t core_audit_writer_flush(core_audit_writer_t *writer,
+                                      core_audit_buf_t *batch,
+                                      core_audit_buf_t **tail)
+{
+    core_audit_buf_t *buf;
+    size_t bytes = 0;
+    int i;
+
+    for (buf = batch; buf != NULL; buf = buf->next) {
+        core_audit_seg_t *seg = core_audit_writer_segment(writer, buf->seg);
+        size_t done = 0;
+
+        *tail = buf;
+        bytes += buf->len;
+        if (seg == NULL) {
+            continue;
+        }
+
+        while (done < buf->len) {
+            ssize_t n = pwrite(seg->fd, buf->data + done, buf->len - done,
+                               buf->offset + done);
+            if (n < 0) {
+                int sys_rc = errno;
+                if (sys_rc == EINTR) {
+                    continue;
+                }
+                ib_log_error(writer->ib,
+                             "Failed to write audit log record %s: %s (%d)",
+                             buf->tx_id, strerror(sys_rc), sys_rc);
+                break;
+            }
+            done += n;
+        }
+        if (done < buf->len) {
+            continue;
+        }
+
+        fprintf(seg->idx_fp, "%zu %zu %s\n",
+                buf->offset, buf->len, buf->tx_id);
+        if ((buf->index_fp != NULL) && (buf->line_len > 0)) {
+            fwrite(buf->line, buf->line_len, 1, buf->index_fp);
+        }
+    }
+
+    for (i = 0; i < CORE_AUDIT_SEG_CACHE; ++i) {
+        if (writer->segs[i].seq != -1) {
+            fflush(writer->segs[i].idx_fp);
+        }
+    }
+    for (buf = batch; buf != NULL; buf = buf->next) {
+        if (buf->index_fp != NULL) {
+            fflush(buf->index_fp);
+        }
+    }
+
+    return bytes;
+}
+
+/**
+ * Writer thread: drain the queue every flush interval, or sooner when
+ * half of the queue limit is pending or the writer is shutting down.
+ *
+ * @param[in] arg Writer.
+ *
+ * @returns NULL
+ */
+static void *core_audit_writer_main(void *arg)
+{
+    core_audit_writer_t *writer = (core_audit_writer_t *)arg;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        core_audit_buf_t *batch;
+        core_audit_buf_t *tail = NULL;
+        uint64_t dropped;
+        size_t bytes;
+
+        while ((writer->queue_head == NULL) && !writer->shutdown) {
+            pthread_cond_wait(&writer->work, &writer->lock);
+        }
+
+        if (writer->flush_ms > 0) {
+            struct timeval now;
+            struct timespec deadline;
+            long nsec;
+
+            gettimeofday(&now, NULL);
+            nsec = (now.tv_usec * 1000L) + ((writer->flush_ms % 1000) * 1000000L);
+            deadline.tv_sec = now.tv_sec + (writer->flush_ms / 1000) +
+                              (nsec / 1000000000L);
+            deadline.tv_nsec = nsec % 1000000000L;
+
+            while (!writer->shutdown &&
+                   (writer->pending < (writer->queue_limit / 2)))
+            {
+                if (pthread_cond_timedwait(&writer->work, &writer->lock,
+                                           &deadline) == ETIMEDOUT)
+                {
+                    break;
+                }
+            }
+        }
+
+        batch = writer->queue_head;
+        writer->queue_head = NULL;
+        writer->queue_tail = NULL;
+        dropped = writer->dropped;
+        writer->dropped = 0;
+        if ((batch == NULL) && writer->shutdown) {
+            break;
+        }
+        pthread_mutex_unlock(&writer->lock);
+
+        if (dropped > 0) {
+            ib_log_error(writer->ib,
+                         "Audit log queue full: dropped %" PRIu64 " records",
+                         dropped);
+        }
+        bytes = core_audit_writer_flush(writer, batch, &tail);
+
+        pthread_mutex_lock(&writer->lock);
+        if (tail != NULL) {
+            tail->next = writer->free_list;
+            writer->free_list = batch;
+        }
+        writer->pending -= bytes;
+        pthread_cond_broadcast(&writer->space);
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    core_audit_writer_close_segments(writer);
+
+    return NULL;
+}
+
+/**
+ * Start the writer thread in this process if it is not running.
+ *
+ * Must be called with the writer lock held. Records queued before a
+ * fork() belong to the parent and are discarded in the child, which
+ * writes its own segments.
+ *
+ * @param[in] writer Writer.
+ *
+ * @returns IB_OK or IB_EUNKNOWN if the thread could not be created.
+ */
+static ib_status_t core_audit_writer_start(core_audit_writer_t *writer)
+{
+    pid_t pid = getpid();
+    int i;
+
+    if (writer->pid == pid) {
+        return IB_OK;
+    }
+
+    if (writer->pid != 0) {
+        if (writer->queue_tail != NULL) {
+            writer->queue_tail->next = writer->free_list;
+            writer->free_list = writer->queue_head;
+        }
+        writer->queue_head = NULL;
+        writer->queue_tail = NULL;
+        writer->pending = 0;
+        writer->seg_seq = 0;
+        writer->seg_offset = 0;
+        for (i = 0; i < CORE_AUDIT_SEG_CACHE; ++i) {
+            if (writer->segs[i].seq != -1) {
+                close(writer->segs[i].fd);
+                fclose(writer->segs[i].idx_fp);
+                writer->segs[i].seq = -1;
+            }
+        }
+    }
+
+    writer->pid = pid;
+    if (pthread_create(&writer->thread, NULL,
+                       core_audit_writer_main, writer) != 0)
+    {
+        writer->pid = 0;
+        ib_log_error(writer->ib, "Failed to start audit log writer thread");
+        return IB_EUNKNOWN;
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Take a buffer for a new record: the calling thread's spare buffer, a
+ * recycled one, or a new one.
+ *
+ * @param[in] writer Writer.
+ * @param[out] pbuf Empty buffer.
+ *
+ * @returns IB_OK or IB_EALLOC.
+ */
+static ib_status_t core_audit_buf_get(core_audit_writer_t *writer,
+                                      core_audit_buf_t **pbuf)
+{
+    core_audit_buf_t *buf = pthread_getspecific(writer->buf_key);
+
+    if (buf != NULL) {
+        pthread_setspecific(writer->buf_key, NULL);
+    }
+    else {
+        pthread_mutex_lock(&writer->lock);
+        buf = writer->free_list;
+        if (buf != NULL) {
+            writer->free_list = buf->next;
+        }
+        else {
+            buf = (core_audit_buf_t *)calloc(1, sizeof(*buf));
+            if (buf != NULL) {
+                buf->line = (char *)malloc(LOGFORMAT_MAX_LINE_LENGTH + 2);
+                buf->writer = writer;
+                buf->all_next = writer->all;
+                writer->all = buf;
+            }
+        }
+        pthread_mutex_unlock(&writer->lock);
+        if ((buf == NULL) || (buf->line == NULL)) {
+            return IB_EALLOC;
+        }
+    }
+
+    buf->len = 0;
+    buf->line_len = 0;
+    buf->next = NULL;
+    *pbuf = buf;
+
+    return IB_OK;
+}
+
+/**
+ * Give an unused buffer back to the calling thread or the free list.
+ *
+ * @param[in] writer Writer.
+ * @param[in] buf Buffer.
+ */
+static void core_audit_buf_release(core_audit_writer_t *writer,
+                                   core_audit_buf_t *buf)
+{
+    if (pthread_getspecific(writer->buf_key) == NULL) {
+        pthread_setspecific(writer->buf_key, buf);
+        return;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    buf->next = writer->free_list;
+    writer->free_list = buf;
+    pthread_mutex_unlock(&writer->lock);
+}
+
+/**
+ * Thread exit destructor for the per-thread spare buffer.
+ *
+ * @param[in] data The buffer.
+ */
+static void core_audit_buf_key_destroy(void *data)
+{
+    core_audit_buf_t *buf = (core_audit_buf_t *)data;
+    core_audit_writer_t *writer = buf->writer;
+
+    pthread_mutex_lock(&writer->lock);
+    buf->next = writer->free_list;
+    writer->free_list = buf;
+    pthread_mutex_unlock(&writer->lock);
+}
+
+ib_status_t core_audit_writer_create(ib_engine_t *ib,
+                                     const ib_core_cfg_t *corecfg,
+                                     core_audit_writer_t **pwriter)
+{
+    assert(ib != NULL);
+    assert(corecfg != NULL);
+    assert(pwriter != NULL);
+
+    core_audit_writer_t *writer;
+    int i;
+
+    writer = (core_audit_writer_t *)calloc(1, sizeof(*writer));
+    if (writer == NULL) {
+        return IB_EALLOC;
+    }
+    writer->dir = strdup(corecfg->auditlog_dir);
+    if (writer->dir == NULL) {
+        free(writer);
+        return IB_EALLOC;
+    }
+
+    writer->ib = ib;
+    writer->dmode = corecfg->auditlog_dmode;
+    writer->fmode = corecfg->auditlog_fmode;
+    writer->seg_size = corecfg->auditlog_seg_size;
+    writer->flush_ms = corecfg->auditlog_flush_ms;
+    writer->queue_limit = corecfg->auditlog_queue_limit;
+    writer->backpressure =
+        (ib_auditlog_backpressure_t)corecfg->auditlog_backpressure;
+    writer->created = time(NULL);
+    writer->serial = __sync_fetch_and_add(&core_audit_writer_count, 1);
+    for (i = 0; i < CORE_AUDIT_SEG_CACHE; ++i) {
+        writer->segs[i].seq = -1;
+    }
+
+    if (pthread_key_create(&writer->buf_key, core_audit_buf_key_destroy) != 0) {
+        free(writer->dir);
+        free(writer);
+        return IB_EUNKNOWN;
+    }
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->work, NULL);
+    pthread_cond_init(&writer->space, NULL);
+
+    *pwriter = writer;
+    return IB_OK;
+}
+
+void core_audit_writer_destroy(core_audit_writer_t *writer)
+{
+    core_audit_buf_t *buf;
+    bool running;
+
+    if (writer == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    writer->shutdown = true;
+    running = (writer->pid == getpid());
+    pthread_cond_broadcast(&writer->work);
+    pthread_cond_broadcast(&writer->space);
+    pthread_mutex_unlock(&writer->lock);
+
+    if (running) {
+        pthread_join(writer->thread, NULL);
+    }
+    core_audit_writer_close_segments(writer);
+
+    pthread_key_delete(writer->buf_key);
+    pthread_cond_destroy(&writer->space);
+    pthread_cond_destroy(&writer->work);
+    pthread_mutex_destroy(&writer->lock);
+
+    buf = writer->all;
+    while (buf != NULL) {
+        core_audit_buf_t *next = buf->all_next;
+        free(buf->data);
+        free(buf->line);
+        free(buf);
+        buf = next;
+    }
+
+    free(writer->dir);
+    free(writer);
+}
+
 ib_status_t core_audit_open_auditfile(ib_provider_inst_t *lpi,
                                       ib_auditlog_t *log,
                                       core_audit_cfg_t *cfg,
@@ -382,6 +1050,7 @@ ib_status_t core_audit_open(ib_provider_inst_t *lpi,
 {
     core_audit_cfg_t *cfg = (core_audit_cfg_t *)log->cfg_data;
     ib_core_cfg_t *corecfg;
+    ib_core_module_data_t *core_data;
     ib_status_t rc;
 
     /* Non const struct we will build and then assign to
@@ -422,9 +1091,28 @@ ib_status_t core_audit_open(ib_provider_inst_t *lpi,
         }
     }
 
+    rc = ib_core_module_data(log->ib, NULL, &core_data);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    /* In segment mode the record is buffered and written by the writer
+     * thread; the index line is written along with it. */
+    if ( (corecfg->auditlog_mode == IB_AUDITLOG_MODE_SEGMENT) &&
+         (core_data->audit_writer != NULL) )
+    {
+        if (cfg->buf == NULL) {
+            rc = core_audit_buf_get(core_data->audit_writer, &cfg->buf);
+            if (rc != IB_OK) {
+                ib_log_error(log->ib,  "Failed to allocate audit log buffer.");
+                return rc;
+            }
+        }
+    }
+
     /* Open audit file that contains the record identified by the line
      * written in index_fp. */
-    if (cfg->fp == NULL) {
+    else if (cfg->fp == NULL) {
         rc = core_audit_open_auditfile(lpi, log, cfg, corecfg);
 
         if (rc!=IB_OK) {
@@ -480,11 +1168,13 @@ ib_status_t core_audit_write_header(ib_provider_inst_t *lpi,
     }
 
     hlen = strlen(header);
-    if (fwrite(header, hlen, 1, cfg->fp) != 1) {
+    if (core_audit_write(cfg, header, hlen) != IB_OK) {
         ib_log_error(lpi->pr->ib,  "Failed to write audit log header");
         return IB_EUNKNOWN;
     }
-    fflush(cfg->fp);
+    if (cfg->fp != NULL) {
+        fflush(cfg->fp);
+    }
 
     return IB_OK;
 }
@@ -498,28 +1188,32 @@ ib_status_t core_audit_write_part(ib_provider_inst_t *lpi,
     size_t chunk_size;
 
     /* Write the MIME boundary and part header */
-    fprintf(cfg->fp,
-            "\r\n--%s"
-            "\r\nContent-Disposition: audit-log-part; name=\"%s\""
-            "\r\nContent-Transfer-Encoding: binary"
-            "\r\nContent-Type: %s"
-            "\r\n\r\n",
-            cfg->boundary,
-            part->name,
-            part->content_type);
+    core_audit_printf(cfg,
+                      "\r\n--%s"
+                      "\r\nContent-Disposition: audit-log-part; name=\"%s\""
+                      "\r\nContent-Transfer-Encoding: binary"
+                      "\r\nContent-Type: %s"
+                      "\r\n\r\n",
+                      cfg->boundary,
+                      part->name,
+                      part->content_type);
 
     /* Write the part data. */
     while((chunk_size = part->fn_gen(part, &chunk)) != 0) {
-        if (fwrite(chunk, chunk_size, 1, cfg->fp) != 1) {
+        if (core_audit_write(cfg, chunk, chunk_size) != IB_OK) {
             ib_log_error(lpi->pr->ib,  "Failed to write audit log part");
-            fflush(cfg->fp);
+            if (cfg->fp != NULL) {
+                fflush(cfg->fp);
+            }
             return IB_EUNKNOWN;
         }
         cfg->parts_written++;
     }
 
     /* Finish the part. */
-    fflush(cfg->fp);
+    if (cfg->fp != NULL) {
+        fflush(cfg->fp);
+    }
 
     return IB_OK;
 }
@@ -530,7 +1224,7 @@ ib_status_t core_audit_write_footer(ib_provider_inst_t *lpi,
     core_audit_cfg_t *cfg = (core_audit_cfg_t *)log->cfg_data;
 
     if (cfg->parts_written > 0) {
-        fprintf(cfg->fp, "\r\n--%s--\r\n", cfg->boundary);
+        core_audit_printf(cfg, "\r\n--%s--\r\n", cfg->boundary);
     }
 
     return IB_OK;
@@ -643,6 +1337,124 @@ static ib_status_t core_audit_get_index_line(ib_provider_inst_t *lpi,
     return rc;
 }
 
+/**
+ * Hand a buffered record to the segment writer.
+ *
+ * Reserves the record's segment and offset, applying the back-pressure
+ * policy if the queue is full, then formats the index line and queues
+ * the record for the writer thread.
+ *
+ * @param[in] lpi Log provider interface.
+ * @param[in] log The log record.
+ * @param[in] cfg Audit configuration holding the record buffer.
+ *
+ * @returns IB_OK or other. See log file for details of failure.
+ */
+static ib_status_t core_audit_close_segment(ib_provider_inst_t *lpi,
+                                            ib_auditlog_t *log,
+                                            core_audit_cfg_t *cfg)
+{
+    core_audit_buf_t *buf = cfg->buf;
+    core_audit_writer_t *writer = buf->writer;
+    core_audit_buf_t *spare;
+    char name[128];
+    size_t fn_sz;
+    char *fn;
+    bool wake;
+    ib_status_t rc;
+
+    cfg->buf = NULL;
+
+    pthread_mutex_lock(&writer->lock);
+    rc = core_audit_writer_start(writer);
+    if (rc != IB_OK) {
+        pthread_mutex_unlock(&writer->lock);
+        core_audit_buf_release(writer, buf);
+        return rc;
+    }
+
+    /* A single record larger than the limit is let through once the
+     * queue is empty rather than blocked (or dropped) forever. */
+    while ((writer->backpressure == IB_AUDITLOG_BP_BLOCK) &&
+           !writer->shutdown &&
+           (writer->pending > 0) &&
+           (writer->pending + buf->len > writer->queue_limit))
+    {
+        pthread_cond_wait(&writer->space, &writer->lock);
+    }
+    if ((writer->pending > 0) &&
+        (writer->pending + buf->len > writer->queue_limit))
+    {
+        ++writer->dropped;
+        pthread_mutex_unlock(&writer->lock);
+        core_audit_buf_release(writer, buf);
+        return IB_OK;
+    }
+
+    if ((writer->seg_offset > 0) &&
+        (writer->seg_offset + buf->len > writer->seg_size))
+    {
+        ++writer->seg_seq;
+        writer->seg_offset = 0;
+    }
+    buf->seg = writer->seg_seq;
+    buf->offset = writer->seg_offset;
+    writer->seg_offset += buf->len;
+    writer->pending += buf->len;
+    core_audit_seg_name(writer, buf->seg, name, sizeof(name));
+    pthread_mutex_unlock(&writer->lock);
+
+    /* The record's file name is "<segment>:<offset>". */
+    fn_sz = strlen(name) + 24;
+    fn = (char *)ib_mpool_alloc(cfg->tx->mp, fn_sz);
+    if (fn != NULL) {
+        snprintf(fn, fn_sz, "%s:%zu", name, buf->offset);
+        cfg->fn = fn;
+        cfg->full_path = fn;
+        ib_rule_log_add_audit(cfg->tx->rule_exec, fn);
+    }
+    snprintf(buf->tx_id, sizeof(buf->tx_id), "%s",
+             (cfg->tx->id != NULL) ? cfg->tx->id : "-");
+
+    buf->index_fp = cfg->index_fp;
+    if ((cfg->index_fp != NULL) && (cfg->parts_written > 0) && (fn != NULL)) {
+        size_t len = 0;
+
+        rc = core_audit_get_index_line(lpi, log, buf->line,
+                                       LOGFORMAT_MAX_LINE_LENGTH, &len);
+        if ((rc == IB_OK) || (rc == IB_ETRUNC)) {
+            buf->line[len] = '\n';
+            buf->line_len = len + 1;
+        }
+    }
+
+    /* The reserved range must be written even if the index line failed,
+     * so always queue the record. */
+    pthread_mutex_lock(&writer->lock);
+    wake = (writer->queue_head == NULL);
+    if (writer->queue_tail != NULL) {
+        writer->queue_tail->next = buf;
+    }
+    else {
+        writer->queue_head = buf;
+    }
+    writer->queue_tail = buf;
+    if (wake || (writer->pending >= (writer->queue_limit / 2))) {
+        pthread_cond_signal(&writer->work);
+    }
+    spare = writer->free_list;
+    if (spare != NULL) {
+        writer->free_list = spare->next;
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    if (spare != NULL) {
+        core_audit_buf_release(writer, spare);
+    }
+
+    return IB_OK;
+}
+
 ib_status_t core_audit_close(ib_provider_inst_t *lpi, ib_auditlog_t *log)
 {
     core_audit_cfg_t *cfg = (core_audit_cfg_t *)log->cfg_data;
@@ -652,6 +1464,10 @@ ib_status_t core_audit_close(ib_provider_inst_t *lpi, ib_auditlog_t *log)
     char *line = NULL;
     size_t len = 0;
 
+    if (cfg->buf != NULL) {
+        return core_audit_close_segment(lpi, log, cfg);
+    }
+
     line = malloc(LOGFORMAT_MAX_LINE_LENGTH + 2);
     if (line == NULL) {
         return IB_EALLOC;
@@ -46,8 +46,26 @@
  */
 #define IB_AUDITLOG_VERSION 201212210
 
-/* Forward define this structure. */
+/**
+ * Audit log storage modes (AuditLogMode).
+ */
+typedef enum {
+    IB_AUDITLOG_MODE_FILE,          /**< One file per transaction */
+    IB_AUDITLOG_MODE_SEGMENT        /**< Batched appends to segment files */
+} ib_auditlog_mode_t;
+
+/**
+ * Segment writer back-pressure policies (AuditLogBackPressure).
+ */
+typedef enum {
+    IB_AUDITLOG_BP_BLOCK,           /**< Wait for the writer to catch up */
+    IB_AUDITLOG_BP_DROP             /**< Drop the record and count it */
+} ib_auditlog_backpressure_t;
+
+/* Forward define these structures. */
 typedef struct core_audit_cfg_t core_audit_cfg_t;
+typedef struct core_audit_buf_t core_audit_buf_t;
+typedef struct core_audit_writer_t core_audit_writer_t;
 
 /**
  * Core audit configuration structure
@@ -61,8 +79,37 @@ struct core_audit_cfg_t {
     int             parts_written;  /**< Parts written so far */
     const char     *boundary;       /**< Audit log boundary */
     ib_tx_t        *tx;             /**< Transaction being logged */
+    core_audit_buf_t *buf;          /**< Record buffer (segment mode) */
 };
 
+/**
+ * Create the segment mode audit log writer.
+ *
+ * The writer owns a background thread which appends serialized records
+ * to rotating segment files under the audit log base directory. The
+ * thread is started lazily by the first record written in a process, so
+ * a writer created before a fork() starts a fresh thread in the child.
+ *
+ * @param[in] ib IronBee engine (used for logging).
+ * @param[in] corecfg Main context core configuration.
+ * @param[out] pwriter The new writer.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation errors.
+ * - IB_EUNKNOWN if a synchronization primitive could not be created.
+ */
+ib_status_t core_audit_writer_create(ib_engine_t *ib,
+                                     const ib_core_cfg_t *corecfg,
+                                     core_audit_writer_t **pwriter);
+
+/**
+ * Stop the writer thread after draining its queue and free the writer.
+ *
+ * @param[in] writer The writer to destroy (may be NULL).
+ */
+void core_audit_writer_destroy(core_audit_writer_t *writer);
+
 /**
  * Set cfg->fn to the file name and cfg->fp to the FILE* of the audit log.
  *
@@ -89,6 +136,9 @@ ib_status_t core_audit_open_auditindexfile(ib_provider_inst_t *lpi,
  * The other is the shared audit log index file. This index file is
  * protected by a lock during open and close calls but not writes.
  *
+ * In segment mode no audit log file is opened; the record is serialized
+ * into a per-thread buffer which is handed to the writer on close.
+ *
  * This and core_audit_close are thread-safe.
  *
  * @param[in] lpi Log provider interface.
@@ -47,12 +47,11 @@
 #include <inttypes.h>
 #include <sys/stat.h>
 
-/** Name/value Pair static data */
+/** Name/value Pair manager data, one per engine */
 typedef struct {
     const pcre                    *pattern;   /**< Compiled PCRE */
     const ib_collection_manager_t *manager;   /**< The manager object */
 } core_vars_manager_t;
-static core_vars_manager_t core_vars_manager = { NULL, NULL };
 
 /** Core InitCollection vars parameter data */
 typedef struct {
@@ -78,7 +77,7 @@ typedef struct {
  * @param[in] uri_scheme URI scheme (unused)
  * @param[in] uri_data Hierarchical/data part of the URI
  * @param[in] params List of parameter strings
- * @param[in] register_data Register callback data (unused)
+ * @param[in] register_data Register callback data (core_vars_manager_t)
  * @param[out] pmanager_inst_data Pointer to manager specific collection data
  *
  * @returns Status code:
@@ -103,8 +102,11 @@ static ib_status_t core_managed_collection_vars_register_fn(
     assert(mp != NULL);
     assert(collection_name != NULL);
     assert(params != NULL);
+    assert(register_data != NULL);
     assert(pmanager_inst_data != NULL);
 
+    const core_vars_manager_t *vars_manager =
+        (const core_vars_manager_t *)register_data;
     const ib_list_node_t *node;
     ib_list_t *vars_list;
     ib_list_t *field_list;
@@ -132,7 +134,7 @@ static ib_status_t core_managed_collection_vars_register_fn(
         core_vars_t *vars;
         int pcre_rc;
 
-        pcre_rc = pcre_exec(core_vars_manager.pattern, NULL,
+        pcre_rc = pcre_exec(vars_manager->pattern, NULL,
                             param, strlen(param),
                             0, 0, ovector, ovecsize);
         if (pcre_rc < 0) {
@@ -555,6 +557,21 @@ static ib_status_t core_managed_collection_jsonfile_persist_fn(
 }
 #endif /* ENABLE_JSON */
 
+/**
+ * Free the name/value pair pattern of an engine
+ *
+ * @param[in] data Name/value pair manager data (core_vars_manager_t)
+ */
+static void core_vars_manager_cleanup(void *data)
+{
+    core_vars_manager_t *vars_manager = (core_vars_manager_t *)data;
+
+    if (vars_manager->pattern != NULL) {
+        pcre_free((void *)vars_manager->pattern);
+        vars_manager->pattern = NULL;
+    }
+}
+
 ib_status_t ib_core_collection_managers_register(
     ib_engine_t  *ib,
     const ib_module_t *module)
@@ -564,16 +581,37 @@ ib_status_t ib_core_collection_managers_register(
 
     const char *pattern = "^(\\w+)=(.*)$";
     const int compile_flags = PCRE_DOTALL | PCRE_DOLLAR_ENDONLY;
-    pcre *compiled;
+    core_vars_manager_t *vars_manager;
     const char *error;
     int eoff;
     ib_status_t rc;
     const ib_collection_manager_t *manager;
 
+    vars_manager = ib_mpool_calloc(ib_engine_pool_main_get(ib),
+                                   1, sizeof(*vars_manager));
+    if (vars_manager == NULL) {
+        return IB_EALLOC;
+    }
+
+    /* Compile the name/value pair pattern */
+    vars_manager->pattern =
+        pcre_compile(pattern, compile_flags, &error, &eoff, NULL);
+    if (vars_manager->pattern == NULL) {
+        ib_log_error(ib, "Failed to compile pattern \"%s\": %s", pattern,
+                     error ? error : "(null)");
+        return IB_EUNKNOWN;
+    }
+    rc = ib_mpool_cleanup_register(ib_engine_pool_main_get(ib),
+                                   core_vars_manager_cleanup, vars_manager);
+    if (rc != IB_OK) {
+        pcre_free((void *)vars_manager->pattern);
+        return rc;
+    }
+
     /* Register the name/value pair InitCollection manager */
     rc = ib_collection_manager_register(
         ib, module, "core name/value pair", "vars:",
-        core_managed_collection_vars_register_fn, NULL,
+        core_managed_collection_vars_register_fn, vars_manager,
         NULL, NULL,
         core_managed_collection_vars_populate_fn, NULL,
         NULL, NULL,
@@ -583,16 +621,7 @@ ib_status_t ib_core_collection_managers_register(
                      ib_status_to_string(rc));
         return rc;
     }
-
-    /* Compile the name/value pair pattern */
-    compiled = pcre_compile(pattern, compile_flags, &error, &eoff, NULL);
-    if (compiled == NULL) {
-        ib_log_error(ib, "Failed to compile pattern \"%s\": %s", pattern,
-                     error ? error : "(null)");
-        return IB_EUNKNOWN;
-    }
-    core_vars_manager.pattern = compiled;
-    core_vars_manager.manager = manager;
+    vars_manager->manager = manager;
 
 #if ENABLE_JSON
     /* Register the JSON file InitCollection manager */
@@ -612,17 +641,3 @@ ib_status_t ib_core_collection_managers_register(
 
     return IB_OK;
 }
-
-ib_status_t ib_core_collection_managers_finish(
-    ib_engine_t  *ib,
-    const ib_module_t *module)
-{
-    assert(ib != NULL);
-    assert(module != NULL);
-
-    if (core_vars_manager.pattern != NULL) {
-        pcre_free((void *)core_vars_manager.pattern);
-        core_vars_manager.pattern = NULL;
-    }
-    return IB_OK;
-}
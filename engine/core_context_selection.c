@@ -36,12 +36,15 @@
 
 #include <ironbee/context_selection.h>
 #include <ironbee/field.h>
+#include <ironbee/hash.h>
 #include <ironbee/mpool.h>
 #include <ironbee/string.h>
 #include <ironbee/util.h>
 
 #include <assert.h>
+#include <ctype.h>
 #include <inttypes.h>
+#include <stdio.h>
 #include <unistd.h>
 
 
@@ -66,6 +69,12 @@
  *    allows the selection to avoid looking at the other fields in the
  *    structure.
  *
+ * 4. The index and location_trie fields are filled in by
+ *    core_ctxsel_finalize(), which also builds a core_ctxsel_index_t of
+ *    services and hosts.  Selection uses hash and trie lookups instead of
+ *    walking every site, but still picks the first match in configuration
+ *    order.
+ *
  * Note that the code does not enforce that the last item in the lists be
  * a default; it is possible to create a configuration without a default site,
  * or with a default site in the middle of the list, or a default service /
@@ -73,12 +82,18 @@
  * do that.  If you do, the site selection will not do what you expect.
  */
 
+/** Byte-keyed trie node used by the context selection index */
+typedef struct core_trie_node_t core_trie_node_t;
+
 /** Core context selection site structure */
 typedef struct core_site_t {
     ib_site_t              site;         /**< Site data */
     ib_list_t             *hosts;        /**< List of core_host_t* */
     ib_list_t             *services;     /**< List of core_service_t* */
     ib_list_t             *locations;    /**< List of core_location_t* */
+    size_t                 index;        /**< Position in the site list */
+    core_trie_node_t      *location_trie;/**< Path prefix trie */
+    const struct core_location_t *any_location; /**< First 'match any' */
 } core_site_t;
 
 /** Core context selection host name entity */
@@ -101,16 +116,102 @@ typedef struct core_location_t {
     ib_site_location_t     location;     /**< Site location data */
     size_t                 path_len;     /**< Length of path string */
     bool                   match_any;    /** Is this a 'match any' location? */
+    size_t                 index;        /**< Position in site's list */
 } core_location_t;
 
-/** Core site selection data */
-typedef struct core_site_selector_t {
-    const core_site_t     *site;         /**< Pointer to the site */
-    const core_service_t  *service;      /**< Service (IP/Port) */
-    const ib_list_t       *hosts;        /**< List of core_host_t* */
-    const ib_list_t       *locations;    /**< List of core_location_t* */
-} core_site_selector_t;
+struct core_trie_node_t {
+    core_trie_node_t      *child;        /**< First child */
+    core_trie_node_t      *sibling;      /**< Next sibling */
+    void                  *data;         /**< Data for a key ending here */
+    unsigned char          c;            /**< Key byte */
+};
+
+/**
+ * Core site selection index, built by core_ctxsel_finalize().
+ *
+ * Every list in the index holds core_site_t pointers in site list order,
+ * so the first match is the candidate with the lowest core_site_t::index.
+ */
+struct core_ctxsel_index_t {
+    size_t                 num_sites;    /**< Number of sites */
+    ib_hash_t             *services;     /**< "ip port" -> ib_list_t */
+    ib_hash_t             *hostnames;    /**< Hostname (nocase) -> ib_list_t */
+    core_trie_node_t      *suffixes;     /**< Reversed suffix -> ib_list_t */
+    ib_list_t             *any_host;     /**< Sites matching any host */
+};
+
+/** Maximum length of a service key: IPv6 address, space, port */
+#define CORE_SERVICE_KEY_MAX 64
+
+/**
+ * Find the child of @a node for byte @a c, creating it if requested.
+ *
+ * @param[in] mp Memory pool for new nodes (NULL to only look up)
+ * @param[in] node Parent node
+ * @param[in] c Key byte
+ *
+ * @returns Child node or NULL if not found / allocation failed
+ */
+static core_trie_node_t *core_trie_child(
+    ib_mpool_t *mp,
+    core_trie_node_t *node,
+    unsigned char c)
+{
+    assert(node != NULL);
+
+    core_trie_node_t *child;
 
+    for (child = node->child; child != NULL; child = child->sibling) {
+        if (child->c == c) {
+            return child;
+        }
+    }
+    if (mp == NULL) {
+        return NULL;
+    }
+
+    child = ib_mpool_calloc(mp, 1, sizeof(*child));
+    if (child == NULL) {
+        return NULL;
+    }
+    child->c = c;
+    child->sibling = node->child;
+    node->child = child;
+
+    return child;
+}
+
+/**
+ * Push @a site onto a site list unless it is already the last entry.
+ *
+ * @param[in] mp Memory pool
+ * @param[in,out] plist Address of the list (created if NULL)
+ * @param[in] site Site to add
+ *
+ * @returns IB_OK or errors from ib_list_create() / ib_list_push()
+ */
+static ib_status_t core_ctxsel_site_list_add(
+    ib_mpool_t *mp,
+    ib_list_t **plist,
+    const core_site_t *site)
+{
+    assert(plist != NULL);
+    assert(site != NULL);
+
+    ib_status_t rc;
+
+    if (*plist == NULL) {
+        rc = ib_list_create(plist, mp);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+    else if (ib_list_node_data_const(ib_list_last_const(*plist)) == site) {
+        return IB_OK;
+    }
+
+    return ib_list_push(*plist, (void *)site);
+}
 
 /**
  * Find the first 'match any' location for the given site
@@ -140,180 +241,305 @@ static const core_location_t *core_ctxsel_matchany_location(
 }
 
 /**
- * Check for a matching host within a host list
+ * Mark the sites whose host list matches the transaction's hostname
  *
- * This function takes a list of hosts, and attempts to find the first
- * host that matches the transaction.  This function is intended to aid in
- * the development of context selection functions, but it's use is optional.
- * It is used by the core site selector.
+ * Sites are marked in the @a match bitmap by core_site_t::index.  A site
+ * matches if it has no hosts or a 'match any' host, one of its hosts is
+ * the hostname (case insensitive), or one of its wildcard suffixes is a
+ * suffix of the hostname.
  *
- * @param[in] ib IronBee engine
+ * @param[in] index Site selection index
  * @param[in] tx Transaction to match
- * @param[in] hosts List of ib_core_host_t
- * @param[out] match true if a match was found, else false
- *
- * @returns IB_OK
+ * @param[in,out] match Bitmap of matching sites
  */
-static ib_status_t core_ctxsel_match_host(
-    const ib_engine_t *ib,
+static void core_ctxsel_match_hosts(
+    const core_ctxsel_index_t *index,
     const ib_tx_t *tx,
-    const ib_list_t *hosts,
-    bool *match)
+    uint8_t *match)
 {
-    assert(ib != NULL);
+    assert(index != NULL);
     assert(tx != NULL);
     assert(match != NULL);
 
     const ib_list_node_t *node;
+    const ib_list_t *sites;
+    const core_trie_node_t *trie;
     size_t len;
 
-    /* If no hosts in the list, we have an automatic match */
-    if (hosts == NULL) {
-        *match = true;
-        return IB_OK;
+#define CORE_MARK_SITES(list) \
+    IB_LIST_LOOP_CONST((list), node) { \
+        const core_site_t *site = (const core_site_t *)node->data; \
+        match[site->index / 8] |= (uint8_t)(1 << (site->index % 8)); \
     }
 
-    /* Now, loop through the list of hostnames */
-    len = strlen(tx->hostname);
-    IB_LIST_LOOP_CONST(hosts, node) {
-        const core_host_t *core_host = (const core_host_t *)node->data;
-        const ib_site_host_t *host = &(core_host->host);
+    if (index->any_host != NULL) {
+        CORE_MARK_SITES(index->any_host);
+    }
 
-        /* If this is a "match any" host entry? */
-        if (core_host->match_any) {
-            *match = true;
-            return IB_OK;
+    len = strlen(tx->hostname);
+    if (ib_hash_get_ex(index->hostnames, &sites, tx->hostname, len) == IB_OK) {
+        CORE_MARK_SITES(sites);
+    }
+
+    /* Walk the reversed hostname; every stored suffix on the path matches */
+    trie = index->suffixes;
+    while ( (len > 0) && (trie != NULL) ) {
+        --len;
+        trie = core_trie_child(NULL, (core_trie_node_t *)trie,
+                               tolower((unsigned char)tx->hostname[len]));
+        if ( (trie != NULL) && (trie->data != NULL) ) {
+            CORE_MARK_SITES((const ib_list_t *)trie->data);
         }
+    }
 
-        /* Check the suffix */
-        if ( (host->suffix != NULL) && (len >= core_host->suffix_len) ) {
-            const char *suffix = tx->hostname + len - core_host->suffix_len;
-            if (strcasecmp(host->suffix, suffix) == 0) {
-                *match = true;
-                return IB_OK;
-            }
-        }
+#undef CORE_MARK_SITES
+}
+
+/**
+ * Find the first location of a site that matches the transaction's path
+ *
+ * @param[in] site Site to match
+ * @param[in] tx Transaction to match
+ *
+ * @returns The matching location with the lowest list position or NULL
+ */
+static const core_location_t *core_ctxsel_match_location(
+    const core_site_t *site,
+    const ib_tx_t *tx)
+{
+    assert(site != NULL);
+    assert(tx != NULL);
+
+    const core_location_t *match = site->any_location;
+    const core_trie_node_t *trie = site->location_trie;
+    const char *path = tx->path;
+
+    /* Every prefix of the path that is a location is a candidate */
+    while (trie != NULL) {
+        const core_location_t *location = (const core_location_t *)trie->data;
 
-        /* Finally, do a full hostname match */
-        if ( (core_host->hostname_len == len) &&
-             (strcasecmp(host->hostname, tx->hostname) == 0) )
+        if ( (location != NULL) &&
+             ((match == NULL) || (location->index < match->index)) )
         {
-            *match = true;
-            return IB_OK;
+            match = location;
         }
+        if (*path == '\0') {
+            break;
+        }
+        trie = core_trie_child(NULL, (core_trie_node_t *)trie,
+                               (unsigned char)*path);
+        ++path;
     }
 
-    /* No matches */
-    *match = false;
-    return IB_OK;
+    return match;
 }
 
 /**
- * Check for a matching location within a location list
+ * Add a site to the service index under @a key.
  *
- * This function takes a list of locations, and attempts to find the first
- * location that matches the transaction.  This function is intended to aid in
- * the development of context selection functions, but it's use is optional.
- * It is used by the core site selector.
- *
- * @param[in] ib IronBee engine
- * @param[in] tx Transaction to match
- * @param[in] locations List of ib_ctxsel_location_t
- * @param[out] match Pointer to matched location (or NULL)
+ * @param[in] mp Memory pool
+ * @param[in,out] index Site selection index
+ * @param[in] key Service key ("ip port", either may be "*")
+ * @param[in] site Site
  *
- * @returns IB_OK
+ * @returns IB_OK or errors from the hash / list functions
  */
-static ib_status_t core_ctxsel_match_location(
-    const ib_engine_t *ib,
-    const ib_tx_t *tx,
-    const ib_list_t *locations,
-    const core_location_t **match)
+static ib_status_t core_ctxsel_index_service(
+    ib_mpool_t *mp,
+    core_ctxsel_index_t *index,
+    const char *key,
+    const core_site_t *site)
 {
-    assert(ib != NULL);
-    assert(tx != NULL);
-    assert(locations != NULL);
-    assert(match != NULL);
+    ib_list_t *sites = NULL;
+    ib_status_t rc;
 
+    rc = ib_hash_get(index->services, &sites, key);
+    if (rc == IB_ENOENT) {
+        key = ib_mpool_strdup(mp, key);
+        if (key == NULL) {
+            return IB_EALLOC;
+        }
+    }
+    else if (rc != IB_OK) {
+        return rc;
+    }
+
+    rc = core_ctxsel_site_list_add(mp, &sites, site);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    return ib_hash_set(index->services, key, sites);
+}
+
+/**
+ * Add a site's services to the service index.
+ *
+ * @param[in] mp Memory pool
+ * @param[in,out] index Site selection index
+ * @param[in] site Site
+ *
+ * @returns IB_OK or errors from the hash / list functions
+ */
+static ib_status_t core_ctxsel_index_services(
+    ib_mpool_t *mp,
+    core_ctxsel_index_t *index,
+    const core_site_t *site)
+{
     const ib_list_node_t *node;
-    size_t len;
+    char key[CORE_SERVICE_KEY_MAX];
+    ib_status_t rc;
+
+    /* No services is the same as a single 'match any' service */
+    if (site->services == NULL) {
+        return core_ctxsel_index_service(mp, index, "* *", site);
+    }
 
-    /* Now, loop through the list of locations */
-    len = strlen(tx->path);
-    IB_LIST_LOOP_CONST(locations, node) {
-        const core_location_t *core_location =
-            (const core_location_t *)node->data;
-        const ib_site_location_t *location = &(core_location->location);
-
-        /* Is this a "match any" location? */
-        if (core_location->match_any) {
-            *match = core_location;
-            return IB_OK;
+    IB_LIST_LOOP_CONST(site->services, node) {
+        const core_service_t *service = (const core_service_t *)node->data;
+        const ib_site_service_t *svc = &(service->service);
+        const char *ip = (svc->ipstr != NULL) ? svc->ipstr : "*";
+
+        if (svc->port >= 0) {
+            snprintf(key, sizeof(key), "%s %" PRId64, ip, (int64_t)svc->port);
+        }
+        else {
+            snprintf(key, sizeof(key), "%s *", ip);
         }
 
-        /* Check the path */
-        if ( (core_location->path_len <= len) &&
-             (strncmp(location->path, tx->path, core_location->path_len) == 0) )
-        {
-            *match = core_location;
-            return IB_OK;
+        rc = core_ctxsel_index_service(mp, index, key, site);
+        if (rc != IB_OK) {
+            return rc;
         }
     }
 
-    /* No matches */
-    *match = NULL;
     return IB_OK;
 }
 
 /**
- * Create a site selector object
+ * Add a site's hosts to the host name index.
  *
- * @param[in,out] core_data Core module data
- * @param[in] site Site object
- * @param[in] service Service object (can be NULL)
- * @param[out] selector New selector object (or NULL)
+ * @param[in] mp Memory pool
+ * @param[in,out] index Site selection index
+ * @param[in] site Site
  *
- * @returns IB_OK or IB_EALLOC
+ * @returns IB_OK or errors from the hash / list functions
  */
-static ib_status_t core_create_site_selector(
-    ib_core_module_data_t *core_data,
-    const core_site_t *site,
-    const core_service_t *service,
-    core_site_selector_t **selector)
+static ib_status_t core_ctxsel_index_hosts(
+    ib_mpool_t *mp,
+    core_ctxsel_index_t *index,
+    const core_site_t *site)
 {
-    assert(core_data != NULL);
-    assert(site != NULL);
-
+    const ib_list_node_t *node;
     ib_status_t rc;
-    core_site_selector_t *object;
 
-    /* Create & populate a site selector object */
-    object = ib_mpool_alloc(site->site.mp, sizeof(*object));
-    if (object == NULL) {
-        return IB_EALLOC;
+    /* No hosts is an automatic match */
+    if (site->hosts == NULL) {
+        return core_ctxsel_site_list_add(mp, &(index->any_host), site);
     }
-    object->service = service;
-    object->hosts = site->hosts;
-    object->locations = site->locations;
-    object->site = site;
 
-    /* Add it to the site selector list */
-    rc = ib_list_push(core_data->selector_list, object);
-    if (rc != IB_OK) {
-        return rc;
+    IB_LIST_LOOP_CONST(site->hosts, node) {
+        const core_host_t *core_host = (const core_host_t *)node->data;
+        const ib_site_host_t *host = &(core_host->host);
+
+        if (core_host->match_any) {
+            rc = core_ctxsel_site_list_add(mp, &(index->any_host), site);
+        }
+        else if (host->suffix != NULL) {
+            core_trie_node_t *trie = index->suffixes;
+            size_t len = core_host->suffix_len;
+
+            while ( (len > 0) && (trie != NULL) ) {
+                --len;
+                trie = core_trie_child(
+                    mp, trie, tolower((unsigned char)host->suffix[len]));
+            }
+            if (trie == NULL) {
+                return IB_EALLOC;
+            }
+            rc = core_ctxsel_site_list_add(mp, (ib_list_t **)&(trie->data),
+                                           site);
+        }
+        else {
+            ib_list_t *sites = NULL;
+
+            rc = ib_hash_get(index->hostnames, &sites, host->hostname);
+            if ( (rc != IB_OK) && (rc != IB_ENOENT) ) {
+                return rc;
+            }
+            rc = core_ctxsel_site_list_add(mp, &sites, site);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            rc = ib_hash_set(index->hostnames, host->hostname, sites);
+        }
+        if (rc != IB_OK) {
+            return rc;
+        }
     }
 
-    if (selector != NULL) {
-        *selector = object;
+    return IB_OK;
+}
+
+/**
+ * Build a site's location prefix trie.
+ *
+ * @param[in] mp Memory pool
+ * @param[in,out] site Site
+ *
+ * @returns IB_OK or IB_EALLOC
+ */
+static ib_status_t core_ctxsel_index_locations(
+    ib_mpool_t *mp,
+    core_site_t *site)
+{
+    const ib_list_node_t *node;
+
+    site->location_trie = NULL;
+    site->any_location = NULL;
+
+    IB_LIST_LOOP_CONST(site->locations, node) {
+        const core_location_t *location = (const core_location_t *)node->data;
+        const char *path = location->location.path;
+        core_trie_node_t *trie;
+
+        if (location->match_any) {
+            if (site->any_location == NULL) {
+                site->any_location = location;
+            }
+            continue;
+        }
+
+        if (site->location_trie == NULL) {
+            site->location_trie = ib_mpool_calloc(mp, 1, sizeof(*trie));
+            if (site->location_trie == NULL) {
+                return IB_EALLOC;
+            }
+        }
+        trie = site->location_trie;
+        while ( (*path != '\0') && (trie != NULL) ) {
+            trie = core_trie_child(mp, trie, (unsigned char)*path);
+            ++path;
+        }
+        if (trie == NULL) {
+            return IB_EALLOC;
+        }
+
+        /* Locations are walked in order: keep the first one */
+        if (trie->data == NULL) {
+            trie->data = (void *)location;
+        }
     }
+
     return IB_OK;
 }
 
 /**
  * Finalize the core context selection.
  *
- * This functions creates the site selector list which is used during the site
- * selection process.  It walks through the list of sites / locations, and
- * creates corresponding site selector objects.
+ * This function builds the site selection index used during the site
+ * selection process.  It walks through the list of sites, and indexes their
+ * services, hosts and locations.
  *
  * @param[in] ib IronBee engine
  * @param[in] common_cb_data Common callback data
@@ -332,13 +558,21 @@ static ib_status_t core_ctxsel_finalize(
 
     const ib_list_node_t *site_node;
     ib_core_module_data_t *core_data = (ib_core_module_data_t *)common_cb_data;
+    core_ctxsel_index_t *index;
+    ib_module_t *core_module;
     ib_status_t rc;
 
     /* Do nothing if we're not the current site selector */
-    if (ib_ctxsel_module_is_active(ib, ib_core_module()) == false) {
+    rc = ib_core_module_data(ib, &core_module, NULL);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if (ib_ctxsel_module_is_active(ib, core_module) == false) {
         return IB_OK;
     }
 
+    core_data->ctxsel_index = NULL;
+
     /* If there are no sites, do nothing */
     if (core_data->site_list == NULL) {
         ib_log_alert(ib, "No site list");
@@ -349,54 +583,58 @@ static ib_status_t core_ctxsel_finalize(
         return IB_OK;
     }
 
-    /* Create the site selector list */
-    if (core_data->selector_list == NULL) {
-        rc = ib_list_create(&(core_data->selector_list), ib->mp);
-        if (rc != IB_OK) {
-            ib_log_error(ib, "Failed to create core site selector list: %s",
-                         ib_status_to_string(rc));
-            return rc;
-        }
+    /* Create the site selection index */
+    index = ib_mpool_calloc(ib->mp, 1, sizeof(*index));
+    if (index == NULL) {
+        return IB_EALLOC;
     }
-    else {
-        ib_list_clear(core_data->selector_list);
+    index->suffixes = ib_mpool_calloc(ib->mp, 1, sizeof(*index->suffixes));
+    if (index->suffixes == NULL) {
+        return IB_EALLOC;
+    }
+    rc = ib_hash_create(&(index->services), ib->mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = ib_hash_create_nocase(&(index->hostnames), ib->mp);
+    if (rc != IB_OK) {
+        return rc;
     }
 
-    /* Build the site selector list from the site / location list */
-
-    /* Walk through all of the sites, and it's locations & services */
+    /* Walk through all of the sites, and index their services, hosts and
+     * locations */
     IB_LIST_LOOP_CONST(core_data->site_list, site_node) {
-        const core_site_t *site = (const core_site_t *)site_node->data;
-        const ib_list_node_t *service_node;
+        core_site_t *site = (core_site_t *)site_node->data;
 
-        /* If no services defined, just create a single selector with
-         * a default service */
-        if (site->services == NULL) {
-            rc = core_create_site_selector(core_data, site, NULL, NULL);
-            if (rc != IB_OK) {
-                return rc;
-            }
-            continue;
-        }
+        site->index = index->num_sites++;
 
-        /* Otherwise, loop through all of the services, create a single
-         * selector for each */
-        IB_LIST_LOOP_CONST(site->services, service_node) {
-            const core_service_t *service =
-                (const core_service_t *)service_node->data;
-            rc = core_create_site_selector(core_data, site, service, NULL);
-            if (rc != IB_OK) {
-                return rc;
-            }
+        rc = core_ctxsel_index_services(ib->mp, index, site);
+        if (rc == IB_OK) {
+            rc = core_ctxsel_index_hosts(ib->mp, index, site);
+        }
+        if (rc == IB_OK) {
+            rc = core_ctxsel_index_locations(ib->mp, site);
+        }
+        if (rc != IB_OK) {
+            ib_log_error(ib, "Failed to index site \"%s\": %s",
+                         site->site.name, ib_status_to_string(rc));
+            return rc;
         }
     }
 
+    core_data->ctxsel_index = index;
+
     return IB_OK;
 }
 
 /**
  * Select the correct context for a connection / transaction.
  *
+ * The candidate sites for the connection's local IP and port are looked up
+ * in the service index.  They are walked in site list order, and the first
+ * one whose hosts and locations also match the transaction (if any) is
+ * selected, exactly as a linear walk of the site list would.
+ *
  * @param[in] ib Engine
  * @param[in] conn Pointer to connection
  * @param[in] tx Pointer to transaction / NULL
@@ -419,103 +657,121 @@ static ib_status_t core_ctxsel_select(
     assert(common_cb_data != NULL);
     assert(pctx != NULL);
 
-    const ib_list_node_t *node;
-    size_t ip_len;
-    ib_status_t rc;
     ib_core_module_data_t *core_data = (ib_core_module_data_t *)common_cb_data;
+    const core_ctxsel_index_t *index = core_data->ctxsel_index;
+    ib_module_t *core_module;
+    const ib_list_node_t *cursors[4];
+    char key[CORE_SERVICE_KEY_MAX];
+    uint8_t *host_match = NULL;
+    int num_cursors = 0;
+    int n;
 
     /* Verify that we're the current selector */
-    if (ib_ctxsel_module_is_active(ib, ib_core_module()) == false) {
+    if ( (ib_core_module_data(ib, &core_module, NULL) != IB_OK) ||
+         (ib_ctxsel_module_is_active(ib, core_module) == false) )
+    {
         return IB_EINVAL;
     }
 
-    if (core_data->selector_list == NULL) {
-        ib_log_alert(ib, "No site selection list: Using main context");
+    if (index == NULL) {
+        ib_log_alert(ib, "No site selection index: Using main context");
         goto select_main_context;
     }
 
-    /* Get the length of the IP address string before the main loop */
-    ip_len = strlen(conn->local_ipstr);
+    /* Look up the sites for the exact, IP-only, port-only and 'match any'
+     * services. */
+    for (n = 0; n < 4; ++n) {
+        const ib_list_t *sites;
+
+        const char *ip = (n & 2) ? "*" : conn->local_ipstr;
+
+        if (n & 1) {
+            snprintf(key, sizeof(key), "%s *", ip);
+        }
+        else {
+            snprintf(key, sizeof(key), "%s %u",
+                     ip, (unsigned int)conn->local_port);
+        }
+        if (ib_hash_get(index->services, &sites, key) == IB_OK) {
+            cursors[num_cursors++] = ib_list_first_const(sites);
+        }
+    }
+
+    /* Mark the sites matching the hostname */
+    if (tx != NULL) {
+        host_match = ib_mpool_calloc(tx->mp, (index->num_sites + 7) / 8, 1);
+        if (host_match == NULL) {
+            return IB_EALLOC;
+        }
+        core_ctxsel_match_hosts(index, tx, host_match);
+    }
 
     /*
-     * Walk through the list of site selectors, return when the first matching
-     * selector is found.  At any point in the loop if a non-match is found,
-     * we continue to the top of the loop, and try the next selector.
+     * Merge the service candidates in site list order, return when the
+     * first matching site is found.
      */
-    IB_LIST_LOOP_CONST(core_data->selector_list, node) {
-        const core_site_selector_t *selector =
-            (const core_site_selector_t *)node->data;
-        const core_service_t *service = selector->service;
-        const core_site_t *site = selector->site;
+    for (;;) {
+        const core_site_t *site = NULL;
         const core_location_t *location;
         ib_context_t *ctx;
         const char *ctx_type;
-        bool match;
 
-        /*
-         * If there is no service or it's a "match any", match is automatic.
-         */
-        if ( (service != NULL) && (! service->match_any) ) {
-            /* Check that the port matches the service (if specified) */
-            if ( (service->service.port >= 0) &&
-                 (service->service.port != conn->local_port) ) {
+        for (n = 0; n < num_cursors; ++n) {
+            const core_site_t *candidate;
+
+            if (cursors[n] == NULL) {
                 continue;
             }
-            /* Check that the host name matches the service (if specified) */
-            if ( (service->service.ipstr != NULL) &&
-                 (service->ip_len == ip_len) &&
-                 (strcmp(service->service.ipstr, conn->local_ipstr) != 0) )
-            {
-                continue;
+            candidate = (const core_site_t *)cursors[n]->data;
+            if ( (site == NULL) || (candidate->index < site->index) ) {
+                site = candidate;
+            }
+        }
+        if (site == NULL) {
+            break;
+        }
+        for (n = 0; n < num_cursors; ++n) {
+            if ( (cursors[n] != NULL) && (cursors[n]->data == site) ) {
+                cursors[n] = ib_list_node_next_const(cursors[n]);
             }
         }
 
         /*
          * If we're looking for a connection context, there is no hostname or
-         * location, so go with this selector.
+         * location, so go with this site.
          */
         if (tx == NULL) {
-            ctx = selector->site->site.context;
+            ctx = site->site.context;
             ctx_type = "site";
             goto found;
         }
 
         /* Check if the hostname matches */
-        rc = core_ctxsel_match_host(ib, tx, selector->hosts, &match);
-        if (rc != IB_OK) {
-            /* todo: What is the right thing to do here? */
-            continue;
-        }
-        if (! match) {
+        if ((host_match[site->index / 8] & (1 << (site->index % 8))) == 0) {
             continue;
         }
 
         /* Check if the location matches */
-        rc = core_ctxsel_match_location(ib, tx, selector->locations, &location);
-        if (rc != IB_OK) {
-            /* todo: What is the right thing to do here? */
-            continue;
-        }
+        location = core_ctxsel_match_location(site, tx);
         if (location == NULL) {
             continue;
         }
 
-        /* Everything matches.  Use this selector's context */
+        /* Everything matches.  Use this location's context */
         ctx = location->location.context;
         ctx_type = "location";
 
   found:
         ib_log_debug2(ib, "Selected %s context %p \"%s\" site=%s(%s)",
                       ctx_type, ctx, ib_context_full_get(ctx),
-                      (site ? site->site.id_str : "none"),
-                      (site ? site->site.name : "none"));
+                      site->site.id_str, site->site.name);
         *pctx = ctx;
         return IB_OK;
     }
 
     /*
-     * If we get here, we've exhausted the list of selectors, with no matching
-     * selector found
+     * If we get here, we've exhausted the candidate sites, with no matching
+     * site found
      */
     if (tx == NULL) {
         ib_log_debug(ib, "No matching site found for connection:"
@@ -646,6 +902,7 @@ static ib_status_t core_ctxsel_location_create(
     /* Fill in the context selection specific parts */
     core_location->path_len = strlen(location_str);
     core_location->match_any = (strcmp(location_str, "/") == 0);
+    core_location->index = ib_list_elements(core_site->locations);
 
     /* And, add it to the locations list */
     rc = ib_list_push(core_site->locations, core_location);
@@ -965,7 +1222,7 @@ ib_status_t ib_core_ctxsel_init(ib_engine_t *ib,
     const char *failed = "unknown";
 
     /* Get core module data */
-    rc = ib_core_module_data(NULL, &core_data);
+    rc = ib_core_module_data(ib, NULL, &core_data);
     if (rc != IB_OK) {
         return rc;
     }
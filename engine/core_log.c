@@ -0,0 +1,712 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee -- Core Asynchronous Log Writer
+ *
+ * Each logging thread owns a single producer, single consumer ring of
+ * variable length records.  The logging thread only advances the ring head
+ * and the writer thread only advances the ring tail, so queuing a message
+ * takes no lock.  The writer thread wakes every CORE_LOG_TICK_MS (or sooner
+ * when a ring fills past half), refreshes the coarse clock used to stamp
+ * records and writes out every ring with writev().
+ */
+
+#include "ironbee_config_auto.h"
+
+#include "core_log_private.h"
+
+#include <ironbee/clock.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+/** Writer thread wakeup interval and clock resolution (milliseconds). */
+#define CORE_LOG_TICK_MS       10
+/** Maximum number of messages per writev() call. */
+#define CORE_LOG_BATCH_MAX     64
+/** Size of the per-message line prefix buffer. */
+#define CORE_LOG_PREFIX_MAX    128
+/** Messages shorter than this are formatted without malloc(). */
+#define CORE_LOG_MSG_SMALL     1024
+/** Smallest allowed ring size. */
+#define CORE_LOG_RING_MIN      4096
+/** Level value of a record that pads the ring up to its end. */
+#define CORE_LOG_PAD           0xffff
+
+/** Round @a n up to a multiple of the record alignment. */
+#define CORE_LOG_ALIGN(n) (((n) + 7) & ~(size_t)7)
+
+/**
+ * Record header.  The header is followed by the source file name (not NUL
+ * terminated) and the message, which ends with a newline.
+ */
+typedef struct {
+    uint64_t usec;      /**< Coarse timestamp (microseconds since epoch) */
+    uint32_t len;       /**< Size of the record including header */
+    uint32_t msg_len;   /**< Message length including the newline */
+    int32_t  fd;        /**< File descriptor to write to */
+    int32_t  line;      /**< Source line */
+    uint16_t level;     /**< Log level or CORE_LOG_PAD */
+    uint16_t file_len;  /**< Source file name length; 0 if none */
+} core_log_rec_t;
+
+typedef struct core_log_ring_t core_log_ring_t;
+
+/** Per-thread ring buffer. */
+struct core_log_ring_t {
+    char              *data;      /**< Record storage */
+    size_t             mask;      /**< Size of data minus one */
+    volatile size_t    head;      /**< Bytes queued; logging thread only */
+    volatile size_t    tail;      /**< Bytes written; writer thread only */
+    volatile uint64_t  dropped;   /**< Dropped count; logging thread only */
+    uint64_t           reported;  /**< Drops already logged; writer only */
+    volatile int       orphaned;  /**< The logging thread has exited */
+    core_log_ring_t   *next;      /**< Next ring of the writer */
+};
+
+/** Asynchronous log writer. */
+struct core_log_writer_t {
+    size_t            ring_size;  /**< Size of each ring (power of two) */
+    pthread_key_t     ring_key;   /**< Ring of the current thread */
+    pthread_mutex_t   lock;       /**< Protects rings and thread state */
+    pthread_cond_t    wakeup;     /**< Signals the writer thread */
+    pthread_t         thread;     /**< Writer thread */
+    unsigned          generation; /**< Fork generation of thread; 0=none */
+    volatile int      shutdown;   /**< Writer thread should exit */
+    volatile uint64_t now_usec;   /**< Coarse clock */
+    int               last_fd;    /**< Last fd written; used for notices */
+    core_log_ring_t  *rings;      /**< All rings; new rings at the front */
+    uint64_t          dropped;    /**< Dropped count of freed rings */
+    core_log_writer_t *next;      /**< Next writer of the process */
+};
+
+/** Incremented in each child process; the writer thread does not survive
+ *  a fork(). */
+static volatile unsigned core_log_generation = 1;
+static pthread_once_t core_log_atfork_once = PTHREAD_ONCE_INIT;
+
+/** All writers, so that their locks can be held across a fork(). */
+static core_log_writer_t *core_log_writers = NULL;
+static pthread_mutex_t core_log_writers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/** Hold every writer lock so the child does not inherit one locked by a
+ *  thread that does not exist there. */
+static void core_log_atfork_prepare(void)
+{
+    core_log_writer_t *writer;
+
+    pthread_mutex_lock(&core_log_writers_lock);
+    for (writer = core_log_writers; writer != NULL; writer = writer->next) {
+        pthread_mutex_lock(&writer->lock);
+    }
+}
+
+static void core_log_atfork_parent(void)
+{
+    core_log_writer_t *writer;
+
+    for (writer = core_log_writers; writer != NULL; writer = writer->next) {
+        pthread_mutex_unlock(&writer->lock);
+    }
+    pthread_mutex_unlock(&core_log_writers_lock);
+}
+
+/** Logging threads signal the writer without holding its lock, so the
+ *  condition variable is recreated rather than trusted in the child. */
+static void core_log_atfork_child(void)
+{
+    core_log_writer_t *writer;
+
+    ++core_log_generation;
+    for (writer = core_log_writers; writer != NULL; writer = writer->next) {
+        pthread_cond_init(&writer->wakeup, NULL);
+        pthread_mutex_unlock(&writer->lock);
+    }
+    pthread_mutex_unlock(&core_log_writers_lock);
+}
+
+static void core_log_atfork_register(void)
+{
+    pthread_atfork(core_log_atfork_prepare,
+                   core_log_atfork_parent,
+                   core_log_atfork_child);
+}
+
+/** Current time in microseconds. */
+static uint64_t core_log_clock(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+}
+
+/** pthread_key destructor: the writer frees the ring once it is drained. */
+static void core_log_ring_orphan(void *data)
+{
+    core_log_ring_t *ring = (core_log_ring_t *)data;
+
+    __sync_synchronize();
+    ring->orphaned = 1;
+}
+
+static void core_log_ring_free(core_log_ring_t *ring)
+{
+    free(ring->data);
+    free(ring);
+}
+
+/**
+ * Write all of @a iov to @a fd, retrying on short writes.
+ *
+ * Errors are ignored: there is nowhere to report them.
+ */
+static void core_log_writev(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/**
+ * Format the line prefix of @a rec into @a buf.
+ *
+ * @returns Length of the prefix.
+ */
+static size_t core_log_prefix(const core_log_rec_t *rec,
+                              char *buf,
+                              size_t buf_size)
+{
+    char         time_info[30];
+    char         line_info[35];
+    ib_timeval_t tv;
+    int          n;
+
+    tv.tv_sec = (uint32_t)(rec->usec / 1000000);
+    tv.tv_usec = (uint32_t)(rec->usec % 1000000);
+    ib_clock_timestamp(time_info, &tv);
+
+    line_info[0] = '\0';
+    if (rec->file_len > 0) {
+        snprintf(line_info, sizeof(line_info), "(%23.*s:%-5d)",
+                 (int)rec->file_len, (const char *)(rec + 1),
+                 (int)rec->line);
+    }
+
+    n = snprintf(buf, buf_size, "%s %-10s- %s [%d] ",
+                 time_info,
+                 ib_log_level_to_string((ib_log_level_t)rec->level),
+                 line_info,
+                 (int)getpid());
+    if (n < 0) {
+        return 0;
+    }
+    return ((size_t)n < buf_size) ? (size_t)n : buf_size - 1;
+}
+
+/**
+ * Write out all complete records of @a ring.
+ *
+ * Called only by the writer thread.  The tail is advanced after each
+ * batch has been written, so records are never overwritten while they are
+ * referenced by an iovec.
+ */
+static void core_log_ring_drain(core_log_writer_t *writer,
+                                core_log_ring_t *ring)
+{
+    char          prefix[CORE_LOG_BATCH_MAX][CORE_LOG_PREFIX_MAX];
+    struct iovec  iov[CORE_LOG_BATCH_MAX * 2];
+    size_t        size = ring->mask + 1;
+    size_t        head;
+    size_t        pos = ring->tail;
+    int           niov = 0;
+    int           nmsg = 0;
+    int           fd = -1;
+    uint64_t      dropped;
+
+    head = ring->head;
+    __sync_synchronize();
+
+    while (pos != head) {
+        size_t                off = pos & ring->mask;
+        const core_log_rec_t *rec;
+
+        /* Not enough room for a header at the end: implicit padding. */
+        if (size - off < sizeof(*rec)) {
+            pos += size - off;
+            continue;
+        }
+
+        rec = (const core_log_rec_t *)(ring->data + off);
+        if (rec->level == CORE_LOG_PAD) {
+            pos += rec->len;
+            continue;
+        }
+
+        if (nmsg == CORE_LOG_BATCH_MAX || (nmsg > 0 && rec->fd != fd)) {
+            core_log_writev(fd, iov, niov);
+            writer->last_fd = fd;
+            __sync_synchronize();
+            ring->tail = pos;
+            niov = 0;
+            nmsg = 0;
+        }
+
+        fd = rec->fd;
+        iov[niov].iov_base = prefix[nmsg];
+        iov[niov].iov_len = core_log_prefix(rec, prefix[nmsg],
+                                            CORE_LOG_PREFIX_MAX);
+        ++niov;
+        iov[niov].iov_base = (char *)(rec + 1) + rec->file_len;
+        iov[niov].iov_len = rec->msg_len;
+        ++niov;
+        ++nmsg;
+
+        pos += rec->len;
+    }
+
+    if (niov > 0) {
+        core_log_writev(fd, iov, niov);
+        writer->last_fd = fd;
+    }
+    __sync_synchronize();
+    ring->tail = pos;
+
+    /* Report drops after the messages that made it. */
+    dropped = ring->dropped;
+    if (dropped != ring->reported) {
+        core_log_rec_t rec;
+        char           msg[64];
+        int            n;
+
+        memset(&rec, 0, sizeof(rec));
+        rec.usec = writer->now_usec;
+        rec.level = IB_LOG_ERROR;
+        n = snprintf(msg, sizeof(msg), "Dropped %" PRIu64 " log messages.\n",
+                     dropped - ring->reported);
+        iov[0].iov_base = prefix[0];
+        iov[0].iov_len = core_log_prefix(&rec, prefix[0],
+                                         CORE_LOG_PREFIX_MAX);
+        iov[1].iov_base = msg;
+        iov[1].iov_len = (n > 0 && (size_t)n < sizeof(msg)) ? n : 0;
+        core_log_writev(writer->last_fd, iov, 2);
+        ring->reported = dropped;
+    }
+}
+
+/** Writer thread. */
+static void *core_log_writer_main(void *data)
+{
+    core_log_writer_t *writer = (core_log_writer_t *)data;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        core_log_ring_t  *ring;
+        core_log_ring_t **prev;
+        bool              shutdown = writer->shutdown;
+
+        if (! shutdown) {
+            struct timespec deadline;
+            uint64_t        wake = core_log_clock() + CORE_LOG_TICK_MS * 1000;
+
+            deadline.tv_sec = wake / 1000000;
+            deadline.tv_nsec = (wake % 1000000) * 1000;
+            pthread_cond_timedwait(&writer->wakeup, &writer->lock, &deadline);
+            shutdown = writer->shutdown;
+        }
+        writer->now_usec = core_log_clock();
+
+        /* Rings are only added at the front and only removed by this
+         * thread, so the list can be walked without the lock. */
+        ring = writer->rings;
+        pthread_mutex_unlock(&writer->lock);
+        for (; ring != NULL; ring = ring->next) {
+            core_log_ring_drain(writer, ring);
+        }
+        pthread_mutex_lock(&writer->lock);
+
+        /* Free rings of exited threads.  The orphaned flag is set after
+         * the thread's last message, so an orphaned ring is empty once it
+         * has been drained after the flag was seen. */
+        prev = &writer->rings;
+        while (*prev != NULL) {
+            ring = *prev;
+            if (ring->orphaned) {
+                __sync_synchronize();
+                core_log_ring_drain(writer, ring);
+                writer->dropped += ring->dropped;
+                *prev = ring->next;
+                core_log_ring_free(ring);
+            }
+            else {
+                prev = &ring->next;
+            }
+        }
+
+        if (shutdown) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return NULL;
+}
+
+/**
+ * Start the writer thread for this process.
+ *
+ * Rings inherited across a fork() are emptied: their records belong to
+ * the parent's writer.
+ */
+static ib_status_t core_log_writer_start(core_log_writer_t *writer)
+{
+    ib_status_t     rc = IB_OK;
+    core_log_ring_t *ring;
+    int              sys_rc;
+
+    pthread_mutex_lock(&writer->lock);
+    if (writer->generation != core_log_generation) {
+        for (ring = writer->rings; ring != NULL; ring = ring->next) {
+            ring->tail = ring->head;
+            ring->reported = ring->dropped;
+        }
+        writer->now_usec = core_log_clock();
+        sys_rc = pthread_create(&writer->thread, NULL,
+                                core_log_writer_main, writer);
+        if (sys_rc == 0) {
+            writer->generation = core_log_generation;
+        }
+        else {
+            writer->generation = 0;
+            rc = IB_EUNKNOWN;
+        }
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return rc;
+}
+
+/** Get the ring of the calling thread, creating it if needed. */
+static ib_status_t core_log_ring_get(core_log_writer_t *writer,
+                                     core_log_ring_t **pring)
+{
+    core_log_ring_t *ring = pthread_getspecific(writer->ring_key);
+
+    if (ring == NULL) {
+        ring = calloc(1, sizeof(*ring));
+        if (ring == NULL) {
+            return IB_EALLOC;
+        }
+        ring->data = malloc(writer->ring_size);
+        if (ring->data == NULL) {
+            free(ring);
+            return IB_EALLOC;
+        }
+        ring->mask = writer->ring_size - 1;
+
+        if (pthread_setspecific(writer->ring_key, ring) != 0) {
+            core_log_ring_free(ring);
+            return IB_EALLOC;
+        }
+
+        pthread_mutex_lock(&writer->lock);
+        ring->next = writer->rings;
+        writer->rings = ring;
+        pthread_mutex_unlock(&writer->lock);
+    }
+
+    *pring = ring;
+    return IB_OK;
+}
+
+ib_status_t core_log_writer_create(size_t buffer_size,
+                                   core_log_writer_t **pwriter)
+{
+    assert(pwriter != NULL);
+
+    core_log_writer_t *writer;
+    size_t             ring_size = CORE_LOG_RING_MIN;
+
+    while (ring_size < buffer_size && ring_size * 2 > ring_size) {
+        ring_size *= 2;
+    }
+
+    writer = calloc(1, sizeof(*writer));
+    if (writer == NULL) {
+        return IB_EALLOC;
+    }
+    writer->ring_size = ring_size;
+    writer->last_fd = STDERR_FILENO;
+
+    if (pthread_key_create(&writer->ring_key, core_log_ring_orphan) != 0) {
+        free(writer);
+        return IB_EUNKNOWN;
+    }
+    if (pthread_mutex_init(&writer->lock, NULL) != 0) {
+        pthread_key_delete(writer->ring_key);
+        free(writer);
+        return IB_EUNKNOWN;
+    }
+    if (pthread_cond_init(&writer->wakeup, NULL) != 0) {
+        pthread_mutex_destroy(&writer->lock);
+        pthread_key_delete(writer->ring_key);
+        free(writer);
+        return IB_EUNKNOWN;
+    }
+
+    pthread_once(&core_log_atfork_once, core_log_atfork_register);
+
+    pthread_mutex_lock(&core_log_writers_lock);
+    writer->next = core_log_writers;
+    core_log_writers = writer;
+    pthread_mutex_unlock(&core_log_writers_lock);
+
+    *pwriter = writer;
+    return IB_OK;
+}
+
+void core_log_writer_destroy(core_log_writer_t *writer)
+{
+    core_log_writer_t **link;
+    core_log_ring_t    *ring;
+    bool                running;
+
+    if (writer == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&core_log_writers_lock);
+    for (link = &core_log_writers; *link != NULL; link = &(*link)->next) {
+        if (*link == writer) {
+            *link = writer->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&core_log_writers_lock);
+
+    pthread_mutex_lock(&writer->lock);
+    running = (writer->generation == core_log_generation);
+    writer->shutdown = 1;
+    pthread_cond_signal(&writer->wakeup);
+    pthread_mutex_unlock(&writer->lock);
+
+    /* The writer thread drains all rings before it exits. */
+    if (running) {
+        pthread_join(writer->thread, NULL);
+    }
+
+    pthread_key_delete(writer->ring_key);
+    ring = writer->rings;
+    while (ring != NULL) {
+        core_log_ring_t *next = ring->next;
+        core_log_ring_free(ring);
+        ring = next;
+    }
+    pthread_cond_destroy(&writer->wakeup);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer);
+}
+
+ib_status_t core_log_writer_log(core_log_writer_t *writer,
+                                int fd,
+                                ib_log_level_t level,
+                                const char *file,
+                                int line,
+                                const char *fmt,
+                                va_list ap)
+{
+    assert(writer != NULL);
+    assert(fmt != NULL);
+
+    core_log_ring_t *ring;
+    core_log_rec_t  *rec;
+    char             small[CORE_LOG_MSG_SMALL];
+    char            *msg = small;
+    char            *dst;
+    size_t           msg_len;
+    size_t           file_len = 0;
+    size_t           rec_len;
+    size_t           rec_max;
+    size_t           size;
+    size_t           head;
+    size_t           tail;
+    size_t           off;
+    size_t           contiguous;
+    va_list          ap_copy;
+    int              n;
+    ib_status_t      rc;
+
+    if (writer->generation != core_log_generation) {
+        rc = core_log_writer_start(writer);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    rc = core_log_ring_get(writer, &ring);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    size = ring->mask + 1;
+
+    /* The arguments can only be used on this thread, so the message is
+     * formatted here; everything else is left to the writer thread. */
+    va_copy(ap_copy, ap);
+    n = vsnprintf(small, sizeof(small), fmt, ap_copy);
+    va_end(ap_copy);
+    if (n < 0) {
+        n = 0;
+        small[0] = '\0';
+    }
+    msg_len = (size_t)n;
+    if (msg_len >= sizeof(small)) {
+        msg = malloc(msg_len + 1);
+        if (msg == NULL) {
+            msg = small;
+            msg_len = sizeof(small) - 1;
+        }
+        else {
+            va_copy(ap_copy, ap);
+            vsnprintf(msg, msg_len + 1, fmt, ap_copy);
+            va_end(ap_copy);
+        }
+    }
+
+    if (file != NULL) {
+        while (strncmp(file, "../", 3) == 0) {
+            file += 3;
+        }
+        file_len = strlen(file);
+        if (file_len > 255) {
+            file += file_len - 255;
+            file_len = 255;
+        }
+    }
+
+    /* Keep single records small relative to the ring. */
+    rec_max = size / 4;
+    rec_len = CORE_LOG_ALIGN(sizeof(*rec) + file_len + msg_len + 1);
+    if (rec_len > rec_max) {
+        msg_len = rec_max - sizeof(*rec) - file_len - 1;
+        rec_len = rec_max;
+    }
+
+    head = ring->head;
+    tail = ring->tail;
+    __sync_synchronize();
+    off = head & ring->mask;
+    contiguous = size - off;
+
+    if (head - tail + rec_len + (contiguous < rec_len ? contiguous : 0) >
+        size)
+    {
+        ++ring->dropped;
+        pthread_cond_signal(&writer->wakeup);
+        if (msg != small) {
+            free(msg);
+        }
+        return IB_OK;
+    }
+
+    /* Records do not wrap; pad to the end of the ring instead. */
+    if (contiguous < rec_len) {
+        if (contiguous >= sizeof(*rec)) {
+            rec = (core_log_rec_t *)(ring->data + off);
+            rec->len = (uint32_t)contiguous;
+            rec->level = CORE_LOG_PAD;
+        }
+        head += contiguous;
+        off = 0;
+    }
+
+    rec = (core_log_rec_t *)(ring->data + off);
+    rec->usec = writer->now_usec;
+    rec->len = (uint32_t)rec_len;
+    rec->msg_len = (uint32_t)(msg_len + 1);
+    rec->fd = fd;
+    rec->line = line;
+    rec->level = (uint16_t)level;
+    rec->file_len = (uint16_t)file_len;
+    dst = (char *)(rec + 1);
+    if (file_len > 0) {
+        memcpy(dst, file, file_len);
+        dst += file_len;
+    }
+    memcpy(dst, msg, msg_len);
+    dst[msg_len] = '\n';
+
+    if (msg != small) {
+        free(msg);
+    }
+
+    /* Publish the record. */
+    __sync_synchronize();
+    ring->head = head + rec_len;
+
+    if (head + rec_len - tail > size / 2) {
+        pthread_cond_signal(&writer->wakeup);
+    }
+
+    return IB_OK;
+}
+
+uint64_t core_log_writer_dropped(core_log_writer_t *writer)
+{
+    assert(writer != NULL);
+
+    const core_log_ring_t *ring;
+    uint64_t               dropped;
+
+    pthread_mutex_lock(&writer->lock);
+    dropped = writer->dropped;
+    for (ring = writer->rings; ring != NULL; ring = ring->next) {
+        dropped += ring->dropped;
+    }
+    pthread_mutex_unlock(&writer->lock);
+
+    return dropped;
+}
@@ -0,0 +1,118 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee -- Core Asynchronous Log Writer
+ */
+
+#ifndef _IB_CORE_LOG_PRIVATE_H_
+#define _IB_CORE_LOG_PRIVATE_H_
+
+#include <ironbee/log.h>
+#include <ironbee/types.h>
+
+#include <stdarg.h>
+
+/**
+ * Log modes (LogMode).
+ */
+typedef enum {
+    IB_LOG_MODE_SYNC,               /**< Write each message as it is logged */
+    IB_LOG_MODE_ASYNC               /**< Queue messages for a writer thread */
+} ib_log_mode_t;
+
+/** Default size of the per-thread log buffer (LogBufferSize). */
+#define IB_LOG_BUFFER_SIZE_DEFAULT (256 * 1024)
+
+/* Forward define this structure. */
+typedef struct core_log_writer_t core_log_writer_t;
+
+/**
+ * Create the asynchronous log writer.
+ *
+ * Each logging thread gets its own ring buffer of @a buffer_size bytes on
+ * its first message.  Messages are formatted into the ring by the logging
+ * thread; timestamps come from a coarse clock maintained by the writer
+ * thread, which also formats the line prefix and writes batches of
+ * messages with writev().  A message that does not fit in its ring is
+ * dropped and counted; the writer logs the count.
+ *
+ * The writer thread is started lazily by the first message logged in a
+ * process, so a writer created before a fork() starts a fresh thread in
+ * the child.
+ *
+ * @param[in] buffer_size Size of each per-thread buffer in bytes; rounded
+ *            up to a power of two.
+ * @param[out] pwriter The new writer.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation errors.
+ * - IB_EUNKNOWN if a synchronization primitive could not be created.
+ */
+ib_status_t core_log_writer_create(size_t buffer_size,
+                                   core_log_writer_t **pwriter);
+
+/**
+ * Stop the writer thread after draining all buffers and free the writer.
+ *
+ * No thread may log through @a writer during or after this call.
+ *
+ * @param[in] writer The writer to destroy (may be NULL).
+ */
+void core_log_writer_destroy(core_log_writer_t *writer);
+
+/**
+ * Queue a message.
+ *
+ * Never blocks on I/O.  @a ap is not consumed; on failure the caller may
+ * still log the message itself.
+ *
+ * @param[in] writer Writer.
+ * @param[in] fd File descriptor to write the message to.
+ * @param[in] level Log level.
+ * @param[in] file Source file name or NULL to omit file and line.
+ * @param[in] line Source line number.
+ * @param[in] fmt Printf like format string.
+ * @param[in] ap Arguments for @a fmt.
+ *
+ * @returns
+ * - IB_OK if the message was queued or dropped because its buffer was
+ *   full.
+ * - IB_EALLOC if the calling thread's buffer could not be allocated.
+ * - IB_EUNKNOWN if the writer thread could not be started.
+ */
+ib_status_t core_log_writer_log(core_log_writer_t *writer,
+                                int fd,
+                                ib_log_level_t level,
+                                const char *file,
+                                int line,
+                                const char *fmt,
+                                va_list ap)
+VPRINTF_ATTRIBUTE(6);
+
+/**
+ * Number of messages dropped because a buffer was full.
+ *
+ * @param[in] writer Writer.
+ *
+ * @returns Total number of dropped messages.
+ */
+uint64_t core_log_writer_dropped(core_log_writer_t *writer);
+
+#endif /* _IB_CORE_LOG_PRIVATE_H_ */
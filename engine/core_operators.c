@@ -32,8 +32,10 @@
 #include <ironbee/escape.h>
 #include <ironbee/field.h>
 #include <ironbee/ipset.h>
+#include <ironbee/iptrie.h>
 #include <ironbee/mpool.h>
 #include <ironbee/operator.h>
+#include <ironbee/path.h>
 #include <ironbee/rule_engine.h>
 #include <ironbee/string.h>
 #include <ironbee/util.h>
@@ -932,6 +934,194 @@ ib_status_t op_ipmatch6_execute(
     return IB_OK;
 }
 
+/**
+ * Create function for the "ipmatchFromFile" operator
+ *
+ * @param[in] ib         The IronBee engine.
+ * @param[in] ctx        The current IronBee context.
+ * @param[in] rule       Parent rule to the operator.
+ * @param[in] mp         Memory pool to use for allocation.
+ * @param[in] parameters File of IPv4 and IPv6 addresses and networks.
+ * @param[in] op_inst    Instance operator.
+ *
+ * @returns
+ * - IB_OK if no failure.
+ * - IB_EALLOC on allocation failure.
+ * - IB_ENOENT if the file can not be opened.
+ * - IB_EINVAL on unable to parse the file.
+ */
+static
+ib_status_t op_ipmatch_file_create(
+    ib_engine_t        *ib,
+    ib_context_t       *ctx,
+    const ib_rule_t    *rule,
+    ib_mpool_t         *mp,
+    const char         *parameters,
+    ib_operator_inst_t *op_inst
+)
+{
+    assert(ib      != NULL);
+    assert(ctx     != NULL);
+    assert(rule    != NULL);
+    assert(mp      != NULL);
+    assert(op_inst != NULL);
+
+    ib_status_t  rc;
+    ib_iptrie_t *trie = NULL;
+    const char  *path = parameters;
+    size_t       line = 0;
+
+    if (parameters == NULL) {
+        return IB_EINVAL;
+    }
+
+    rc = ib_iptrie_create_from_file(&trie, mp, path, &line);
+    if (rc == IB_ENOENT && *parameters != '/') {
+        /* Relative to the configuration. */
+        const char *cwd = ib_context_config_cwd(ctx);
+        if (cwd != NULL) {
+            path = ib_util_path_join(mp, cwd, parameters);
+            if (path == NULL) {
+                return IB_EALLOC;
+            }
+            rc = ib_iptrie_create_from_file(&trie, mp, path, &line);
+        }
+    }
+    if (rc == IB_EINVAL) {
+        ib_log_error(ib, "Error parsing %s line %zd.", path, line);
+        return rc;
+    }
+    if (rc != IB_OK) {
+        ib_log_error(ib,
+            "Error loading IP file \"%s\": %s",
+            path, ib_status_to_string(rc)
+        );
+        return rc;
+    }
+
+    ib_log_debug(ib, "Loaded IP file \"%s\": %zd bytes.",
+                 path, ib_iptrie_memory_size(trie));
+
+    /* Done */
+    op_inst->data = trie;
+
+    return IB_OK;
+}
+
+/**
+ * Execute function for the "ipmatchFromFile" operator
+ *
+ * The connection's parsed remote address is used if @a field holds it, so
+ * the usual case of matching REMOTE_ADDR does not parse the address.
+ *
+ * @param[in] rule_exec Rule execution object
+ * @param[in] data      IP trie.
+ * @param[in] flags     Operator instance flags.
+ * @param[in] field     Field value.
+ * @param[out] result   Pointer to number in which to store the result.
+ *
+ * @returns
+ * - IB_OK if no failure, regardless of match status.
+ * - IB_EINVAL on unable to parse @a field as IP address.
+ */
+static
+ib_status_t op_ipmatch_file_execute(
+    const ib_rule_exec_t *rule_exec,
+    void                 *data,
+    ib_flags_t            flags,
+    ib_field_t           *field,
+    ib_num_t             *result
+)
+{
+    assert(rule_exec != NULL);
+    assert(data      != NULL);
+    assert(field     != NULL);
+    assert(result    != NULL);
+
+    ib_status_t        rc;
+    const ib_iptrie_t *trie     = (const ib_iptrie_t *)data;
+    ib_tx_t           *tx       = rule_exec->tx;
+    const char        *ipstr    = NULL;
+    size_t             ipstr_len;
+    const ib_ip4_t    *ip4      = NULL;
+    const ib_ip6_t    *ip6      = NULL;
+    ib_ip4_t           ip4_buf;
+    ib_ip6_t           ip6_buf;
+    char               ipstr_buffer[46];
+
+    if (field->type == IB_FTYPE_NULSTR) {
+        rc = ib_field_value(field, ib_ftype_nulstr_out(&ipstr));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if (ipstr == NULL) {
+            ib_log_error_tx(tx, "Failed to get NULSTR from field");
+            return IB_EUNKNOWN;
+        }
+        ipstr_len = strlen(ipstr);
+    }
+    else if (field->type == IB_FTYPE_BYTESTR) {
+        const ib_bytestr_t *bs;
+        rc = ib_field_value(field, ib_ftype_bytestr_out(&bs));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        assert(bs != NULL);
+
+        ipstr = (const char *)ib_bytestr_const_ptr(bs);
+        ipstr_len = ib_bytestr_length(bs);
+    }
+    else {
+        return IB_EINVAL;
+    }
+
+    /* Use the connection's parsed address if this is it. */
+    if (tx != NULL &&
+        ib_conn_remote_ip(tx->conn, &ip4, &ip6) == IB_OK &&
+        (ipstr_len != tx->conn->remote_ip.ipstr_len ||
+         memcmp(ipstr, tx->conn->remote_ip.ipstr, ipstr_len) != 0))
+    {
+        ip4 = NULL;
+        ip6 = NULL;
+    }
+
+    if (ip4 == NULL && ip6 == NULL) {
+        if (ipstr_len >= sizeof(ipstr_buffer)) {
+            ib_log_info_tx(tx, "Could not parse as IP: %.*s",
+                           (int)ipstr_len, ipstr);
+            return IB_EINVAL;
+        }
+        memcpy(ipstr_buffer, ipstr, ipstr_len);
+        ipstr_buffer[ipstr_len] = '\0';
+
+        if (ib_ip4_str_to_ip(ipstr_buffer, &ip4_buf) == IB_OK) {
+            ip4 = &ip4_buf;
+        }
+        else if (ib_ip6_str_to_ip(ipstr_buffer, &ip6_buf) == IB_OK) {
+            ip6 = &ip6_buf;
+        }
+        else {
+            ib_log_info_tx(tx, "Could not parse as IP: %s", ipstr_buffer);
+            return IB_EINVAL;
+        }
+    }
+
+    if (ip4 != NULL) {
+        rc = ib_iptrie_query4(trie, *ip4);
+    }
+    else {
+        rc = ib_iptrie_query6(trie, ip6);
+    }
+
+    *result = (rc == IB_OK);
+    if (ib_rule_should_capture(rule_exec, *result)) {
+        ib_capture_clear(tx);
+        ib_capture_set_item(tx, 0, field);
+    }
+
+    return IB_OK;
+}
+
 /**
  * Convert @a in_field from a string by expanding it to an expanded
  * string and then convert that string to a number-type if
@@ -1740,6 +1930,20 @@ ib_status_t ib_core_operators_init(ib_engine_t *ib, ib_module_t *mod)
         return rc;
     }
 
+    /* Register the ipmatchFromFile operator */
+    rc = ib_operator_register(ib,
+                              "ipmatchFromFile",
+                              IB_OP_FLAG_PHASE | IB_OP_FLAG_CAPTURE,
+                              op_ipmatch_file_create,
+                              NULL,
+                              NULL, /* no destroy function */
+                              NULL,
+                              op_ipmatch_file_execute,
+                              NULL);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
     /**
      * Numeric comparison operators
      */
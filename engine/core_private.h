@@ -26,6 +26,7 @@
  */
 
 #include "core_audit_private.h"
+#include "core_log_private.h"
 
 #include <ironbee/context_selection.h>
 #include <ironbee/engine.h>
@@ -39,13 +40,18 @@ typedef struct {
     bool             default_value; /**< The flag's default value? */
 } ib_tx_flag_map_t;
 
+/** Core site selection index (see core_context_selection.c) */
+typedef struct core_ctxsel_index_t core_ctxsel_index_t;
+
 /** Core-module-specific non-context-aware data accessed via module->data */
 typedef struct {
     ib_list_t            *site_list;      /**< List: ib_site_t */
-    ib_list_t            *selector_list;  /**< List: core_site_selector_t */
+    core_ctxsel_index_t  *ctxsel_index;   /**< Site selection index */
     ib_context_t         *cur_ctx;        /**< Current context */
     ib_site_t            *cur_site;       /**< Current site */
     ib_site_location_t   *cur_location;   /**< Current location */
+    core_audit_writer_t  *audit_writer;   /**< Segment mode audit writer */
+    core_log_writer_t    *log_writer;     /**< Async mode log writer */
 } ib_core_module_data_t;
 
 /**
@@ -84,14 +90,16 @@ ib_status_t ib_core_fields_ctx_init(ib_engine_t *ib,
 const ib_tx_flag_map_t *ib_core_fields_tx_flags( void );
 
 /**
- * Get the core mode and data
+ * Get the core module and data of engine @a ib
  *
+ * @param[in] ib IronBee engine
  * @param[out] core_module Pointer to core module (or NULL)
  * @param[out] core_data Pointer to core data (or NULL)
  *
- * @returns IB_OK / return value from ib_engine_module_get()
+ * @returns IB_OK / return value from ib_array_get()
  */
-ib_status_t ib_core_module_data(ib_module_t **core_module,
+ib_status_t ib_core_module_data(const ib_engine_t *ib,
+                                ib_module_t **core_module,
                                 ib_core_module_data_t **core_data);
 
 /**
@@ -159,18 +167,5 @@ ib_status_t ib_core_collection_managers_register(
     ib_engine_t       *ib,
     const ib_module_t *module);
 
-/**
- * Shut down core collections managers
- *
- * @param[in] ib Engine
- * @param[in] module Collection manager's module object
- *
- * @returns Status code:
- *   - IB_OK All OK
- */
-ib_status_t ib_core_collection_managers_finish(
-    ib_engine_t       *ib,
-    const ib_module_t *module);
-
 
 #endif /* _IB_CORE_PRIVATE_H_ */
@@ -40,6 +40,7 @@
 #include <pcre.h>
 
 #include <assert.h>
+#include <inttypes.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -58,19 +59,87 @@ static const char *IB_VARIABLE_EXPANSION_PREFIX = "%{";
 /** Variable postfix */
 static const char *IB_VARIABLE_EXPANSION_POSTFIX = "}";
 
+/**
+ * Cached result of a slot-indexed lookup.
+ *
+ * Adding, setting or removing a top-level field clears the slot cached for
+ * its key, found through ib_data_t::slot_index; other slots stay valid.
+ */
+typedef struct {
+    ib_field_t *field;       /**< Field found (NULL if not found) */
+    bool        valid;       /**< Is @a field a valid lookup result? */
+} ib_data_slot_t;
+
 struct ib_data_t
 {
-    ib_mpool_t *mp;    /**< Memory pool. */
-    ib_hash_t  *hash;  /**< Hash of data fields. */
+    ib_mpool_t     *mp;          /**< Memory pool. */
+    ib_hash_t      *hash;        /**< Hash of data fields. */
+    ib_data_slot_t *slots;       /**< Slot cache for ib_data_target_get(). */
+    size_t          num_slots;   /**< Number of elements in @a slots. */
+    ib_hash_t      *slot_index;  /**< Key -> size_t slot; NULL if unused */
+    ib_hash_t      *filters;     /**< Pattern -> compiled filter (pcre *) */
 };
 
+/**
+ * Type of filter applied by a compiled target.
+ */
+typedef enum {
+    DATA_FILTER_NONE,      /**< Plain field: FOO */
+    DATA_FILTER_SUBFIELD,  /**< Subfield: FOO:bar */
+    DATA_FILTER_REGEX      /**< Regex on subfield names: FOO:/bar/ */
+} data_filter_type_t;
+
+struct ib_data_target_t
+{
+    const char         *name;        /**< Full target name. */
+    size_t              nlen;        /**< Length of @a name. */
+    size_t              klen;        /**< Length of the key part of @a name */
+    data_filter_type_t  filter_type; /**< Filter type. */
+    const char         *filter;      /**< Subfield name (SUBFIELD). */
+    size_t              filter_len;  /**< Length of @a filter. */
+    pcre               *filter_re;   /**< Compiled filter (REGEX). */
+    size_t              slot;        /**< Slot index in ib_data_t. */
+};
+
+/**
+ * Segment of a compiled expansion: literal text or a field reference.
+ */
+typedef struct {
+    const char             *str;     /**< Literal text or field name. */
+    size_t                  len;     /**< Length of @a str. */
+    bool                    is_name; /**< Is @a str a field name? */
+    const ib_data_target_t *target;  /**< Target for name or NULL. */
+} data_expand_seg_t;
+
+struct ib_data_expand_t
+{
+    data_expand_seg_t *segs;        /**< Segments in order. */
+    size_t             num_segs;    /**< Number of elements in @a segs. */
+    size_t             num_names;   /**< Number of field references. */
+    size_t             literal_len; /**< Total length of literal text. */
+};
+
+/**
+ * Rendered value of a field reference of an expansion.
+ */
+typedef struct {
+    const char *str;         /**< Value; NULL if it is @a num. */
+    size_t      len;         /**< Length of value. */
+    char        num[24];     /**< Number formatted as a string. */
+} data_expand_value_t;
+
+/** Field references rendered without allocating a value array. */
+#define DATA_EXPAND_LOCAL_VALUES 8
+
 /* Internal helper functions */
 
 /**
  * Get a subfield from @a data.
  *
- * If @a parent_field is a list (IB_FTYPE_LIST) then a case insensitive
- * string comparison is done to find the first list element that matches.
+ * If @a parent_field is a list (IB_FTYPE_LIST) then the list elements whose
+ * names match @a name case insensitively are returned.  This uses the list's
+ * name index (see ib_field_list_subfields()); the result is a view of the
+ * indexed members that is copied if it is modified.
  *
  * If @a parent_field is a dynamic field, then the field @a name
  * is fetched from it and the return code from that operation is returned.
@@ -104,8 +173,6 @@ ib_status_t ib_data_get_subfields(
     assert(result_field != NULL);
 
     ib_status_t rc;
-    ib_list_t *list; /* List of values to check stored in parent_field. */
-    ib_list_node_t *list_node; /* List node in list. */
 
     if (name_len == 0) {
         return IB_EINVAL;
@@ -114,6 +181,7 @@ ib_status_t ib_data_get_subfields(
     /* Check that our input field is a list type. */
     if (parent_field->type == IB_FTYPE_LIST) {
         ib_list_t *result_list;
+        const ib_list_t *members;
         /* Pull a value from a dynamic field. */
         /* TODO: Make all of this const correct. */
         if (ib_field_is_dynamic(parent_field)) {
@@ -124,43 +192,30 @@ ib_status_t ib_data_get_subfields(
             if (rc != IB_OK) {
               return rc;
             }
-        }
-        else {
-            /* Make the result list */
-            rc = ib_list_create(&result_list, data->mp);
-            if (rc != IB_OK) {
-                return rc;
-            }
 
-            /* Fetch the parent list. */
-            rc = ib_field_value(parent_field, &list);
-            if (rc != IB_OK) {
-                return rc;
-            }
+            /* Send back the result_list inside of result_field. */
+            return ib_field_create(result_field,
+                                   data->mp,
+                                   parent_field->name,
+                                   parent_field->nlen,
+                                   IB_FTYPE_LIST,
+                                   result_list);
+        }
 
-            IB_LIST_LOOP(list, list_node) {
-                ib_field_t *list_field =
-                    (ib_field_t *) IB_LIST_NODE_DATA(list_node);
-
-                if (list_field->nlen == name_len &&
-                    strncasecmp(list_field->name, name, name_len) == 0)
-                {
-                    rc = ib_list_push(result_list, list_field);
-                    if (rc != IB_OK) {
-                        return rc;
-                    }
-                }
-            }
-          }
-          /* Send back the result_list inside of result_field. */
-          rc = ib_field_create(result_field,
-                               data->mp,
-                               parent_field->name,
-                               parent_field->nlen,
-                               IB_FTYPE_LIST,
-                               result_list);
+        /* Static lists are looked up through their name index. */
+        rc = ib_field_list_subfields(parent_field,
+                                     name,
+                                     name_len,
+                                     &members);
+        if (rc != IB_OK) {
+            return rc;
+        }
 
-          return rc;
+        return ib_field_create_list_view(result_field,
+                                         data->mp,
+                                         parent_field->name,
+                                         parent_field->nlen,
+                                         members);
     }
 
     /* We don't know what input type this is. Return IB_EINVAL. */
@@ -168,92 +223,61 @@ ib_status_t ib_data_get_subfields(
 }
 
 /**
- * Return a list of fields whose name matches @a pattern.
+ * Return a list of fields whose name matches the compiled regex @a re.
  *
- * The list @a field_name is retrieved from @a data. Its members are iterated
- * through and the names of those fields compared against @a pattern. If the
- * name matches, the field is added to an @c ib_list_t* which will be returned
- * via @a result_field.
+ * The members of @a parent_field are iterated through and the names of those
+ * fields compared against @a re.  If the name matches, the field is added to
+ * an @c ib_list_t* which will be returned via @a result_field.
  *
  * @param[in] data         Data.
  * @param[in] parent_field The parent field whose member fields will
- *                         be filtered with @a pattern.
+ *                         be filtered with @a re.
  *                         This must be an IB_FTYPE_LIST.
- * @param[in] pattern The regex to use to match member field names in
- *                    @a field_name.
- * @param[in] pattern_len The length of @a pattern.
+ * @param[in] re           Compiled regex.
  * @param[out] result_field The result field.
  *
  * @returns
  *  - IB_OK if a successful search is performed.
- *  - IB_EINVAL if field is not a list or the pattern cannot compile.
- *  - IB_ENOENT if the field name is not found.
+ *  - IB_EINVAL if field is not a list.
+ *  - IB_EALLOC on allocation errors.
  */
 static
-ib_status_t ib_data_get_filtered_list(
+ib_status_t ib_data_get_filtered_list_re(
     const ib_data_t           *data,
     const ib_field_t          *parent_field,
-    const char                *pattern,
-    size_t                     pattern_len,
+    const pcre                *re,
     ib_field_t               **result_field
 )
 {
     assert(data != NULL);
-    assert(pattern != NULL);
     assert(parent_field != NULL);
-    assert(pattern_len > 0);
+    assert(re != NULL);
     assert(result_field != NULL);
 
     ib_status_t rc;
-    char *pattern_str = NULL; /* NULL terminated string to pass to pcre. */
-    pcre *pcre_pattern = NULL; /* PCRE pattern. */
-    const char *errptr = NULL; /* PCRE Error reporter. */
-    int erroffset; /* PCRE Error offset into subject reporter. */
     ib_list_t *list = NULL; /* Holds the value of field when fetched. */
     ib_list_node_t *list_node = NULL; /* A node in list. */
     ib_list_t *result_list = NULL; /* Holds matched list_node values. */
 
     /* Check that our input field is a list type. */
     if (parent_field->type != IB_FTYPE_LIST) {
-        rc = IB_EINVAL;
-        goto exit_label;
-    }
-
-    /* Allocate pattern_str to hold null terminated string. */
-    pattern_str = (char *)malloc(pattern_len+1);
-    if (pattern_str == NULL) {
-        rc = IB_EALLOC;
-        goto exit_label;
+        return IB_EINVAL;
     }
 
-    /* Build a string to hand to the pcre library. */
-    memcpy(pattern_str, pattern, pattern_len);
-    pattern_str[pattern_len] = '\0';
-
     rc = ib_field_value(parent_field, &list);
     if (rc != IB_OK) {
-        goto exit_label;
-    }
-
-    pcre_pattern = pcre_compile(pattern_str, 0, &errptr, &erroffset, NULL);
-    if (pcre_pattern == NULL) {
-        rc = IB_EINVAL;
-        goto exit_label;
-    }
-    if (errptr) {
-        rc = IB_EINVAL;
-        goto exit_label;
+        return rc;
     }
 
     rc = ib_list_create(&result_list, data->mp);
     if (rc != IB_OK) {
-        goto exit_label;
+        return rc;
     }
 
     IB_LIST_LOOP(list, list_node) {
         int pcre_rc;
         ib_field_t *list_field = (ib_field_t *)list_node->data;
-        pcre_rc = pcre_exec(pcre_pattern,
+        pcre_rc = pcre_exec(re,
                             NULL,
                             list_field->name,
                             list_field->nlen,
@@ -265,27 +289,220 @@ ib_status_t ib_data_get_filtered_list(
         if (pcre_rc == 0) {
             rc = ib_list_push(result_list, list_node->data);
             if (rc != IB_OK) {
-                goto exit_label;
+                return rc;
             }
         }
     }
 
-    rc = ib_field_create(result_field,
-                         data->mp,
-                         parent_field->name,
-                         parent_field->nlen,
-                         IB_FTYPE_LIST,
-                         result_list);
+    return ib_field_create(result_field,
+                           data->mp,
+                           parent_field->name,
+                           parent_field->nlen,
+                           IB_FTYPE_LIST,
+                           result_list);
+}
+
+/**
+ * Compile a list filter pattern.
+ *
+ * @param[in] pattern The regex.
+ * @param[in] pattern_len The length of @a pattern.
+ * @param[out] re The compiled regex; caller must pcre_free() it.
+ *
+ * @returns
+ *  - IB_OK on success.
+ *  - IB_EINVAL if the pattern cannot compile.
+ *  - IB_EALLOC on allocation errors.
+ */
+static
+ib_status_t ib_data_compile_filter(
+    const char  *pattern,
+    size_t       pattern_len,
+    pcre       **re
+)
+{
+    assert(pattern != NULL);
+    assert(re != NULL);
 
+    char *pattern_str; /* NULL terminated string to pass to pcre. */
+    const char *errptr = NULL; /* PCRE Error reporter. */
+    int erroffset; /* PCRE Error offset into subject reporter. */
 
-exit_label:
-    if (pattern_str) {
-        free(pattern_str);
+    /* Allocate pattern_str to hold null terminated string. */
+    pattern_str = (char *)malloc(pattern_len+1);
+    if (pattern_str == NULL) {
+        return IB_EALLOC;
     }
-    if (pcre_pattern) {
-        pcre_free(pcre_pattern);
+
+    /* Build a string to hand to the pcre library. */
+    memcpy(pattern_str, pattern, pattern_len);
+    pattern_str[pattern_len] = '\0';
+
+    *re = pcre_compile(pattern_str, 0, &errptr, &erroffset, NULL);
+    free(pattern_str);
+    if (*re == NULL) {
+        return IB_EINVAL;
     }
-    return rc;
+
+    return IB_OK;
+}
+
+/**
+ * Memory pool cleanup function to release a cached compiled filter.
+ *
+ * @param[in] re Compiled filter (pcre *).
+ */
+static
+void ib_data_filter_cleanup(void *re)
+{
+    pcre_free(re);
+}
+
+/**
+ * Return a list of fields whose name matches @a pattern.
+ *
+ * Compiles @a pattern, once per @a data, and calls
+ * ib_data_get_filtered_list_re().
+ *
+ * @param[in] data         Data.
+ * @param[in] parent_field The parent field whose member fields will
+ *                         be filtered with @a pattern.
+ *                         This must be an IB_FTYPE_LIST.
+ * @param[in] pattern The regex to use to match member field names in
+ *                    @a field_name.
+ * @param[in] pattern_len The length of @a pattern.
+ * @param[out] result_field The result field.
+ *
+ * @returns
+ *  - IB_OK if a successful search is performed.
+ *  - IB_EINVAL if field is not a list or the pattern cannot compile.
+ *  - IB_ENOENT if the field name is not found.
+ */
+static
+ib_status_t ib_data_get_filtered_list(
+    const ib_data_t           *data,
+    const ib_field_t          *parent_field,
+    const char                *pattern,
+    size_t                     pattern_len,
+    ib_field_t               **result_field
+)
+{
+    assert(data != NULL);
+    assert(pattern != NULL);
+    assert(parent_field != NULL);
+    assert(pattern_len > 0);
+    assert(result_field != NULL);
+
+    ib_status_t rc;
+    pcre *pcre_pattern = NULL; /* PCRE pattern. */
+
+    /* Check that our input field is a list type. */
+    if (parent_field->type != IB_FTYPE_LIST) {
+        return IB_EINVAL;
+    }
+
+    rc = ib_hash_get_ex(data->filters, &pcre_pattern, pattern, pattern_len);
+    if (rc == IB_ENOENT) {
+        const char *key;
+
+        rc = ib_data_compile_filter(pattern, pattern_len, &pcre_pattern);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_mpool_cleanup_register(data->mp,
+                                       ib_data_filter_cleanup,
+                                       pcre_pattern);
+        if (rc != IB_OK) {
+            pcre_free(pcre_pattern);
+            return rc;
+        }
+        key = ib_mpool_memdup(data->mp, pattern, pattern_len);
+        if (key == NULL) {
+            return IB_EALLOC;
+        }
+        rc = ib_hash_set_ex(data->filters, key, pattern_len, pcre_pattern);
+    }
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    return ib_data_get_filtered_list_re(data,
+                                        parent_field,
+                                        pcre_pattern,
+                                        result_field);
+}
+
+/**
+ * Clear the cached slot of a top-level key, if any.
+ *
+ * @param[in] data Data.
+ * @param[in] name Key.
+ * @param[in] nlen Length of @a name.
+ */
+static
+void ib_data_slot_invalidate(
+    ib_data_t  *data,
+    const char *name,
+    size_t      nlen
+)
+{
+    assert(data != NULL);
+    assert(name != NULL);
+
+    const size_t *index;
+
+    if (data->slot_index == NULL) {
+        return;
+    }
+    if (ib_hash_get_ex(data->slot_index, &index, name, nlen) == IB_OK) {
+        assert(*index < data->num_slots);
+        data->slots[*index].valid = false;
+    }
+}
+
+/**
+ * Record the key of @a target so that changes to it clear its slot.
+ *
+ * @param[in] data Data.
+ * @param[in] target Target whose slot is about to be filled.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on memory allocation errors; the slot must not be filled.
+ */
+static
+ib_status_t ib_data_slot_register(
+    ib_data_t              *data,
+    const ib_data_target_t *target
+)
+{
+    assert(data != NULL);
+    assert(target != NULL);
+
+    ib_status_t rc;
+    char *key;
+    size_t *index;
+
+    if (data->slot_index == NULL) {
+        rc = ib_hash_create_nocase(&data->slot_index, data->mp);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+    else if (ib_hash_get_ex(data->slot_index,
+                            &index, target->name, target->klen) == IB_OK)
+    {
+        return IB_OK;
+    }
+
+    index = ib_mpool_alloc(data->mp, sizeof(*index));
+    key = ib_mpool_memdup(data->mp, target->name, target->klen);
+    if ( (key == NULL) || (index == NULL) ) {
+        return IB_EALLOC;
+    }
+    *index = target->slot;
+
+    return ib_hash_set_ex(data->slot_index, key, target->klen, index);
 }
 
 /**
@@ -382,6 +599,7 @@ ib_status_t ib_data_add_internal(
 
     /* Normal add. */
     else {
+        ib_data_slot_invalidate(data, name, nlen);
         return ib_hash_set_ex(data->hash, name, nlen, field);
     }
 
@@ -407,6 +625,133 @@ ib_status_t expand_lookup_fn(
     return rc;
 }
 
+/**
+ * Set @a value to the string form of field @a f for expansion.
+ *
+ * Follows the rules of ib_expand_str_gen_ex(): strings are used as is,
+ * numbers are formatted, lists use their first element and anything else
+ * is replaced by an empty string.
+ *
+ * @param[in] f Field.
+ * @param[out] value Value to set.
+ *
+ * @returns Status code of ib_field_value().
+ */
+static
+ib_status_t data_expand_field_value(
+    const ib_field_t    *f,
+    data_expand_value_t *value
+)
+{
+    assert(f != NULL);
+    assert(value != NULL);
+
+    ib_status_t rc;
+
+    value->str = "";
+    value->len = 0;
+
+    switch (f->type) {
+    case IB_FTYPE_NULSTR:
+    {
+        const char *s;
+        rc = ib_field_value(f, ib_ftype_nulstr_out(&s));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if (s != NULL) {
+            value->str = s;
+            value->len = strlen(s);
+        }
+        return IB_OK;
+    }
+
+    case IB_FTYPE_BYTESTR:
+    {
+        const ib_bytestr_t *bs;
+        rc = ib_field_value(f, ib_ftype_bytestr_out(&bs));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if ( (bs != NULL) && (ib_bytestr_length(bs) != 0) ) {
+            value->str = (const char *)ib_bytestr_const_ptr(bs);
+            value->len = ib_bytestr_length(bs);
+        }
+        return IB_OK;
+    }
+
+    case IB_FTYPE_NUM:
+    {
+        ib_num_t n;
+        int      len;
+        rc = ib_field_value(f, ib_ftype_num_out(&n));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        len = snprintf(value->num, sizeof(value->num), "%"PRId64, n);
+        assert( (len > 0) && ((size_t)len < sizeof(value->num)) );
+        value->str = NULL;
+        value->len = len;
+        return IB_OK;
+    }
+
+    case IB_FTYPE_LIST:
+    {
+        const ib_list_t      *list;
+        const ib_list_node_t *node;
+        rc = ib_field_value(f, ib_ftype_list_out(&list));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        node = ib_list_first_const(list);
+        if (node == NULL) {
+            return IB_OK;
+        }
+        return data_expand_field_value(
+            (const ib_field_t *)ib_list_node_data_const(node),
+            value
+        );
+    }
+
+    default:
+        return IB_OK;
+    }
+}
+
+/**
+ * Add a segment to @a expand.
+ *
+ * @param[in,out] expand Expansion with room for the segment.
+ * @param[in] str Literal text or field name.
+ * @param[in] len Length of @a str.
+ * @param[in] is_name Is @a str a field name?
+ *
+ * @returns The new segment.
+ */
+static
+data_expand_seg_t *data_expand_add_seg(
+    ib_data_expand_t *expand,
+    const char       *str,
+    size_t            len,
+    bool              is_name
+)
+{
+    data_expand_seg_t *seg = &(expand->segs[expand->num_segs++]);
+
+    seg->str = str;
+    seg->len = len;
+    seg->is_name = is_name;
+    seg->target = NULL;
+    if (is_name) {
+        ++expand->num_names;
+    }
+    else {
+        expand->literal_len += len;
+    }
+
+    return seg;
+}
+
 /* -- Exported Data Access Routines -- */
 
 ib_status_t ib_data_create(
@@ -430,6 +775,11 @@ ib_status_t ib_data_create(
         *data = NULL;
         return rc;
     }
+    rc = ib_hash_create(&(*data)->filters, mp);
+    if (rc != IB_OK) {
+        *data = NULL;
+        return rc;
+    }
 
     return IB_OK;
 }
@@ -739,6 +1089,178 @@ error_handler:
     return rc;
 }
 
+/**
+ * Release the compiled filter of a target.
+ *
+ * @param[in] data Target (ib_data_target_t *).
+ */
+static
+void ib_data_target_cleanup(void *data)
+{
+    ib_data_target_t *target = (ib_data_target_t *)data;
+
+    if (target->filter_re != NULL) {
+        pcre_free(target->filter_re);
+        target->filter_re = NULL;
+    }
+}
+
+ib_status_t ib_data_target_create(
+    ib_mpool_t        *mp,
+    const char        *name,
+    size_t             nlen,
+    size_t             slot,
+    ib_data_target_t **ptarget
+)
+{
+    assert(mp != NULL);
+    assert(name != NULL);
+    assert(ptarget != NULL);
+
+    ib_status_t rc;
+    ib_data_target_t *target;
+    const char *filter_marker;
+    const char *filter_start;
+    const char *filter_end = NULL;
+
+    if (nlen == 0) {
+        return IB_EINVAL;
+    }
+
+    target = ib_mpool_calloc(mp, 1, sizeof(*target));
+    if (target == NULL) {
+        return IB_EALLOC;
+    }
+    target->name = ib_mpool_memdup(mp, name, nlen);
+    if (target->name == NULL) {
+        return IB_EALLOC;
+    }
+    target->nlen = nlen;
+    target->slot = slot;
+    name = target->name;
+
+    /* Parse exactly as ib_data_get_ex() does, just once. */
+    filter_marker = memchr(name, DPI_LIST_FILTER_MARKER, nlen);
+    if (filter_marker == NULL) {
+        target->klen = nlen;
+        target->filter_type = DATA_FILTER_NONE;
+        *ptarget = target;
+        return IB_OK;
+    }
+
+    target->klen = filter_marker - name;
+    filter_start = memchr(name, DPI_LIST_FILTER_PREFIX, nlen);
+    if ( filter_start && filter_start + 1 < name + nlen ) {
+        filter_end = memchr(filter_start+1,
+                            DPI_LIST_FILTER_SUFFIX,
+                            nlen - (filter_start+1-name));
+    }
+
+    if (filter_start && filter_end) {
+        /* Reject FOO/:, FOO:/ and FOO:// */
+        if ( (filter_marker != filter_start-1) ||
+             (filter_start == filter_end-1) )
+        {
+            return IB_EINVAL;
+        }
+
+        rc = ib_data_compile_filter(filter_start+1,
+                                    filter_end - filter_start - 1,
+                                    &target->filter_re);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_mpool_cleanup_register(mp, ib_data_target_cleanup, target);
+        if (rc != IB_OK) {
+            pcre_free(target->filter_re);
+            return rc;
+        }
+        target->filter_type = DATA_FILTER_REGEX;
+    }
+    else {
+        target->filter = filter_marker + 1;
+        target->filter_len = nlen - (filter_marker+1-name);
+        if (target->filter_len == 0) {
+            return IB_EINVAL;
+        }
+        target->filter_type = DATA_FILTER_SUBFIELD;
+    }
+
+    *ptarget = target;
+    return IB_OK;
+}
+
+ib_status_t ib_data_target_get(
+    ib_data_t               *data,
+    const ib_data_target_t  *target,
+    ib_field_t             **pf
+)
+{
+    assert(data != NULL);
+    assert(target != NULL);
+    assert(pf != NULL);
+
+    ib_status_t rc;
+    ib_data_slot_t *slot = NULL;
+    ib_field_t *field;
+
+    /* Grow the slot cache on demand; on failure just skip the cache. */
+    if (target->slot >= data->num_slots) {
+        size_t num = (data->num_slots == 0) ? 16 : data->num_slots * 2;
+        ib_data_slot_t *slots;
+
+        while (num <= target->slot) {
+            num *= 2;
+        }
+        slots = ib_mpool_calloc(data->mp, num, sizeof(*slots));
+        if (slots != NULL) {
+            if (data->num_slots != 0) {
+                memcpy(slots, data->slots,
+                       data->num_slots * sizeof(*slots));
+            }
+            data->slots = slots;
+            data->num_slots = num;
+        }
+    }
+    if (target->slot < data->num_slots) {
+        slot = &data->slots[target->slot];
+    }
+
+    if ( (slot != NULL) && slot->valid ) {
+        field = slot->field;
+        rc = (field == NULL) ? IB_ENOENT : IB_OK;
+    }
+    else {
+        rc = ib_hash_get_ex(data->hash, &field, target->name, target->klen);
+        if ( (slot != NULL) &&
+             ((rc == IB_OK) || (rc == IB_ENOENT)) &&
+             (ib_data_slot_register(data, target) == IB_OK) )
+        {
+            slot->field = field;
+            slot->valid = true;
+        }
+    }
+    if (rc != IB_OK) {
+        *pf = NULL;
+        return rc;
+    }
+
+    switch (target->filter_type) {
+    case DATA_FILTER_NONE:
+        *pf = field;
+        return IB_OK;
+    case DATA_FILTER_SUBFIELD:
+        return ib_data_get_subfields(data, field,
+                                     target->filter, target->filter_len,
+                                     pf);
+    case DATA_FILTER_REGEX:
+        return ib_data_get_filtered_list_re(data, field,
+                                            target->filter_re, pf);
+    }
+
+    return IB_EINVAL;
+}
+
 ib_status_t ib_data_get_all(
     const ib_data_t *data,
     ib_list_t       *list
@@ -824,6 +1346,7 @@ ib_status_t ib_data_remove_ex(ib_data_t *data,
 {
     assert(data != NULL);
 
+    ib_data_slot_invalidate(data, name, nlen);
     return ib_hash_remove_ex(data->hash, pf, name, nlen);
 }
 
@@ -835,6 +1358,8 @@ ib_status_t ib_data_set(
 )
 {
     assert(data != NULL);
+
+    ib_data_slot_invalidate(data, name, nlen);
     return ib_hash_set_ex(data->hash, name, nlen, f);
 }
 
@@ -947,3 +1472,193 @@ ib_status_t ib_data_expand_test_str_ex(
         result
     );
 }
+
+ib_status_t ib_data_expand_compile(
+    ib_mpool_t                  *mp,
+    const char                  *str,
+    size_t                       slen,
+    ib_data_expand_target_fn_t   target_fn,
+    void                        *cbdata,
+    ib_data_expand_t           **pexpand
+)
+{
+    assert(mp != NULL);
+    assert(str != NULL);
+    assert(pexpand != NULL);
+
+    const size_t      pre_len = strlen(IB_VARIABLE_EXPANSION_PREFIX);
+    const size_t      suf_len = strlen(IB_VARIABLE_EXPANSION_POSTFIX);
+    ib_data_expand_t *expand;
+    const char       *copy;
+    const char       *cur;
+    const char       *end;
+    size_t            max_segs = 1;
+    ib_status_t       rc;
+
+    /* Copy the string and bound the number of segments. */
+    copy = ib_mpool_memdup(mp, str, slen);
+    if ( (copy == NULL) && (slen != 0) ) {
+        return IB_EALLOC;
+    }
+    end = copy + slen;
+    cur = (slen == 0) ? NULL :
+        ib_strstr_ex(copy, slen, IB_VARIABLE_EXPANSION_PREFIX, pre_len);
+    while (cur != NULL) {
+        max_segs += 2;
+        cur += pre_len;
+        cur = ib_strstr_ex(cur, end - cur,
+                           IB_VARIABLE_EXPANSION_PREFIX, pre_len);
+    }
+
+    expand = ib_mpool_calloc(mp, 1, sizeof(*expand));
+    if (expand == NULL) {
+        return IB_EALLOC;
+    }
+    expand->segs = ib_mpool_alloc(mp, max_segs * sizeof(*expand->segs));
+    if (expand->segs == NULL) {
+        return IB_EALLOC;
+    }
+
+    /* Split into literals and names, left to right. */
+    cur = copy;
+    while (cur < end) {
+        const char *pre;
+        const char *suf;
+        const char *name;
+        size_t      nlen;
+
+        pre = ib_strstr_ex(cur, end - cur,
+                           IB_VARIABLE_EXPANSION_PREFIX, pre_len);
+        if (pre == NULL) {
+            break;
+        }
+        name = pre + pre_len;
+        suf = ib_strstr_ex(name, end - name,
+                           IB_VARIABLE_EXPANSION_POSTFIX, suf_len);
+        if (suf == NULL) {
+            break;
+        }
+        nlen = suf - name;
+
+        if (pre > cur) {
+            data_expand_add_seg(expand, cur, pre - cur, false);
+        }
+        /* Zero length names expand to "". */
+        if (nlen != 0) {
+            data_expand_seg_t *seg =
+                data_expand_add_seg(expand, name, nlen, true);
+            if (target_fn != NULL) {
+                ib_data_target_t *target;
+                rc = target_fn(cbdata, name, nlen, &target);
+                if (rc == IB_OK) {
+                    seg->target = target;
+                }
+                else if (rc != IB_EINVAL) {
+                    return rc;
+                }
+            }
+        }
+        cur = suf + suf_len;
+    }
+    if (cur < end) {
+        data_expand_add_seg(expand, cur, end - cur, false);
+    }
+    assert(expand->num_segs <= max_segs);
+
+    *pexpand = expand;
+    return IB_OK;
+}
+
+ib_status_t ib_data_expand_render(
+    ib_data_t               *data,
+    const ib_data_expand_t  *expand,
+    bool                     nul,
+    char                   **result,
+    size_t                  *result_len
+)
+{
+    assert(data != NULL);
+    assert(expand != NULL);
+    assert(result != NULL);
+    assert(result_len != NULL);
+
+    data_expand_value_t  local[DATA_EXPAND_LOCAL_VALUES];
+    data_expand_value_t *values = local;
+    size_t               len = expand->literal_len;
+    size_t               n;
+    size_t               i;
+    char                *buf;
+    char                *p;
+    ib_status_t          rc;
+
+    if (expand->num_names > DATA_EXPAND_LOCAL_VALUES) {
+        values = ib_mpool_alloc(data->mp,
+                                expand->num_names * sizeof(*values));
+        if (values == NULL) {
+            return IB_EALLOC;
+        }
+    }
+
+    /* Resolve every reference to size the result. */
+    for (i = 0, n = 0; i < expand->num_segs; ++i) {
+        const data_expand_seg_t *seg = &(expand->segs[i]);
+        ib_field_t              *f;
+
+        if (! seg->is_name) {
+            continue;
+        }
+        if (seg->target != NULL) {
+            rc = ib_data_target_get(data, seg->target, &f);
+        }
+        else {
+            rc = ib_data_get_ex(data, seg->str, seg->len, &f);
+        }
+        if ( (rc == IB_ENOENT) || ((rc == IB_OK) && (f == NULL)) ) {
+            values[n].str = "";
+            values[n].len = 0;
+        }
+        else if (rc != IB_OK) {
+            return rc;
+        }
+        else {
+            rc = data_expand_field_value(f, &values[n]);
+            if (rc != IB_OK) {
+                return rc;
+            }
+        }
+        len += values[n].len;
+        ++n;
+    }
+
+    buf = ib_mpool_alloc(data->mp, len + (nul ? 1 : 0));
+    if ( (buf == NULL) && ((len != 0) || nul) ) {
+        return IB_EALLOC;
+    }
+
+    /* Copy it all in. */
+    p = buf;
+    for (i = 0, n = 0; i < expand->num_segs; ++i) {
+        const data_expand_seg_t *seg = &(expand->segs[i]);
+
+        if (! seg->is_name) {
+            memcpy(p, seg->str, seg->len);
+            p += seg->len;
+        }
+        else {
+            const data_expand_value_t *value = &values[n++];
+            if (value->len != 0) {
+                memcpy(p, (value->str == NULL) ? value->num : value->str,
+                       value->len);
+                p += value->len;
+            }
+        }
+    }
+    assert( (size_t)(p - buf) == len );
+    if (nul) {
+        *p = '\0';
+    }
+
+    *result = buf;
+    *result_len = len;
+    return IB_OK;
+}
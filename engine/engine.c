@@ -26,6 +26,7 @@
 #include "ironbee_config_auto.h"
 
 #include <ironbee/engine.h>
+#include "core_private.h"
 #include "engine_private.h"
 
 #include "state_notify_private.h"
@@ -562,11 +563,13 @@ void ib_engine_destroy(ib_engine_t *ib)
         size_t ne;
         size_t idx;
         ib_list_node_t *node;
-        ib_module_t *cm = ib_core_module();
+        ib_module_t *cm = NULL;
         ib_module_t *m;
 
         /// @todo Destroy filters
 
+        ib_core_module_data(ib, &cm, NULL);
+
         ib_log_debug3(ib, "Unloading modules...");
         IB_ARRAY_LOOP_REVERSE(ib->modules, ne, idx, m) {
             if ( (m != NULL) && (m != cm) ) {
@@ -575,7 +578,9 @@ void ib_engine_destroy(ib_engine_t *ib)
         }
 
         /* Unload core module. */
-        ib_module_unload(cm);
+        if (cm != NULL) {
+            ib_module_unload(cm);
+        }
         /* No logging from here on out. */
 
         IB_LIST_LOOP_REVERSE(ib->contexts, node) {
@@ -621,7 +626,7 @@ ib_status_t ib_conn_create(ib_engine_t *ib,
 
     /* Create a sub-pool for each connection and allocate from it */
     /// @todo Need to tune the pool size
-    rc = ib_mpool_create(&pool, "conn", ib->mp);
+    rc = ib_mpool_create_recycled(&pool, "conn", ib->mp);
     if (rc != IB_OK) {
         ib_log_alert(ib,
             "Failed to create connection memory pool: %s",
@@ -722,6 +727,45 @@ void *ib_conn_parser_context_get(ib_conn_t *conn)
 }
 
 
+ib_status_t ib_conn_remote_ip(
+    ib_conn_t       *conn,
+    const ib_ip4_t **ip4,
+    const ib_ip6_t **ip6
+)
+{
+    assert(conn != NULL);
+    assert(ip4 != NULL);
+    assert(ip6 != NULL);
+
+    if (conn->remote_ipstr == NULL) {
+        return IB_ENOENT;
+    }
+
+    /* Servers may set remote_ipstr at any time, so re-parse on change. */
+    if (conn->remote_ip.ipstr != conn->remote_ipstr) {
+        conn->remote_ip.ipstr = conn->remote_ipstr;
+        conn->remote_ip.ipstr_len = strlen(conn->remote_ipstr);
+        conn->remote_ip.ip4 = NULL;
+        conn->remote_ip.ip6 = NULL;
+
+        if (ib_ip4_str_to_ip(conn->remote_ipstr,
+                             &(conn->remote_ip.ip4_buf)) == IB_OK)
+        {
+            conn->remote_ip.ip4 = &(conn->remote_ip.ip4_buf);
+        }
+        else if (ib_ip6_str_to_ip(conn->remote_ipstr,
+                                  &(conn->remote_ip.ip6_buf)) == IB_OK)
+        {
+            conn->remote_ip.ip6 = &(conn->remote_ip.ip6_buf);
+        }
+    }
+
+    *ip4 = conn->remote_ip.ip4;
+    *ip6 = conn->remote_ip.ip6;
+
+    return (*ip4 != NULL || *ip6 != NULL) ? IB_OK : IB_EINVAL;
+}
+
 ib_status_t ib_conn_data_create(ib_conn_t *conn,
                                 ib_conndata_t **pconndata,
                                 size_t dalloc)
@@ -832,7 +876,7 @@ ib_status_t ib_tx_create(ib_tx_t **ptx,
     /* Create a sub-pool from the connection memory pool for each
      * transaction and allocate from it
      */
-    rc = ib_mpool_create(&pool, "tx", conn->mp);
+    rc = ib_mpool_create_recycled(&pool, "tx", conn->mp);
     if (rc != IB_OK) {
         ib_log_alert(ib,
             "Failed to create transaction memory pool: %s",
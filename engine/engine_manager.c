@@ -0,0 +1,354 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- Engine Manager
+ */
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/engine_manager.h>
+
+#include <ironbee/config.h>
+#include <ironbee/lock.h>
+#include <ironbee/log.h>
+
+#include <assert.h>
+#include <stdlib.h>
+
+/**
+ * An engine owned by a manager.
+ */
+typedef struct ib_manager_engine_t ib_manager_engine_t;
+struct ib_manager_engine_t {
+    ib_engine_t         *engine;  /**< The engine */
+    size_t               refs;    /**< References, including the manager's */
+    ib_manager_engine_t *next;    /**< Next engine */
+};
+
+/**
+ * Engine manager.
+ *
+ * The current engine holds a reference for the manager.  Engines that are
+ * no longer current stay on the list until their last reference goes.
+ */
+struct ib_manager_t {
+    ib_server_t                  *server;       /**< Server for new engines */
+    ib_manager_engine_setup_fn_t  setup_fn;     /**< Engine setup function */
+    void                         *setup_cbdata; /**< Callback data */
+    ib_lock_t                     lock;         /**< Protects the rest */
+    ib_manager_engine_t          *engines;      /**< All engines */
+    ib_manager_engine_t          *current;      /**< Current engine or NULL */
+    size_t                        num_engines;  /**< Length of @a engines */
+};
+
+/**
+ * Drop a reference to an engine; return it if it should be destroyed.
+ *
+ * Must be called with the manager's lock held.  If the last reference is
+ * dropped, the engine is removed from the manager.
+ *
+ * @param[in] manager Engine manager.
+ * @param[in] menode Engine to drop a reference to.
+ *
+ * @returns Engine to destroy after unlocking, or NULL.
+ */
+static ib_engine_t *manager_engine_unref(
+    ib_manager_t        *manager,
+    ib_manager_engine_t *menode
+)
+{
+    ib_manager_engine_t **link;
+    ib_engine_t          *engine;
+
+    assert(menode->refs > 0);
+
+    if (--menode->refs > 0) {
+        return NULL;
+    }
+    assert(menode != manager->current);
+
+    link = &(manager->engines);
+    while (*link != menode) {
+        assert(*link != NULL);
+        link = &((*link)->next);
+    }
+    *link = menode->next;
+    --manager->num_engines;
+
+    engine = menode->engine;
+    free(menode);
+
+    return engine;
+}
+
+ib_status_t ib_manager_create(
+    ib_manager_t                  **pmanager,
+    ib_server_t                    *server,
+    ib_manager_engine_setup_fn_t    setup_fn,
+    void                           *setup_cbdata
+)
+{
+    assert(pmanager != NULL);
+    assert(server != NULL);
+
+    ib_manager_t *manager;
+    ib_status_t   rc;
+
+    manager = calloc(1, sizeof(*manager));
+    if (manager == NULL) {
+        return IB_EALLOC;
+    }
+
+    rc = ib_lock_init(&(manager->lock));
+    if (rc != IB_OK) {
+        free(manager);
+        return rc;
+    }
+
+    manager->server       = server;
+    manager->setup_fn     = setup_fn;
+    manager->setup_cbdata = setup_cbdata;
+
+    *pmanager = manager;
+
+    return IB_OK;
+}
+
+void ib_manager_destroy(
+    ib_manager_t *manager
+)
+{
+    ib_manager_engine_t *menode;
+    ib_manager_engine_t *next;
+
+    if (manager == NULL) {
+        return;
+    }
+
+    for (menode = manager->engines; menode != NULL; menode = next) {
+        next = menode->next;
+        ib_engine_destroy(menode->engine);
+        free(menode);
+    }
+
+    ib_lock_destroy(&(manager->lock));
+    free(manager);
+}
+
+/**
+ * Create and configure an engine.
+ *
+ * @param[in] manager Engine manager.
+ * @param[in] config_file Configuration file.
+ * @param[out] pengine Configured engine.
+ *
+ * @returns Status code.
+ */
+static ib_status_t manager_engine_configure(
+    ib_manager_t  *manager,
+    const char    *config_file,
+    ib_engine_t  **pengine
+)
+{
+    ib_engine_t    *engine;
+    ib_cfgparser_t *cp;
+    ib_status_t     rc;
+
+    rc = ib_engine_create(&engine, manager->server);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    if (manager->setup_fn != NULL) {
+        rc = manager->setup_fn(engine, manager->setup_cbdata);
+        if (rc != IB_OK) {
+            goto failed;
+        }
+    }
+
+    rc = ib_engine_init(engine);
+    if (rc != IB_OK) {
+        goto failed;
+    }
+
+    rc = ib_cfgparser_create(&cp, engine);
+    if (rc != IB_OK) {
+        goto failed;
+    }
+    rc = ib_engine_config_started(engine, cp);
+    if (rc != IB_OK) {
+        ib_cfgparser_destroy(cp);
+        goto failed;
+    }
+
+    rc = ib_cfgparser_parse(cp, config_file);
+    if (rc != IB_OK) {
+        ib_log_error(engine, "Failed to parse configuration \"%s\": %s",
+                     config_file, ib_status_to_string(rc));
+        ib_engine_config_finished(engine);
+        ib_cfgparser_destroy(cp);
+        goto failed;
+    }
+
+    rc = ib_engine_config_finished(engine);
+    ib_cfgparser_destroy(cp);
+    if (rc != IB_OK) {
+        goto failed;
+    }
+
+    *pengine = engine;
+    return IB_OK;
+
+failed:
+    ib_engine_destroy(engine);
+    return rc;
+}
+
+ib_status_t ib_manager_engine_create(
+    ib_manager_t *manager,
+    const char   *config_file
+)
+{
+    assert(manager != NULL);
+    assert(config_file != NULL);
+
+    ib_manager_engine_t *menode;
+    ib_engine_t         *engine;
+    ib_engine_t         *old = NULL;
+    ib_status_t          rc;
+
+    /* Configure outside of the lock; traffic keeps the current engine. */
+    rc = manager_engine_configure(manager, config_file, &engine);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    menode = calloc(1, sizeof(*menode));
+    if (menode == NULL) {
+        ib_engine_destroy(engine);
+        return IB_EALLOC;
+    }
+    menode->engine = engine;
+    menode->refs = 1;
+
+    /* Publish it. */
+    rc = ib_lock_lock(&(manager->lock));
+    if (rc != IB_OK) {
+        free(menode);
+        ib_engine_destroy(engine);
+        return rc;
+    }
+    menode->next = manager->engines;
+    manager->engines = menode;
+    ++manager->num_engines;
+    if (manager->current != NULL) {
+        ib_manager_engine_t *previous = manager->current;
+        manager->current = menode;
+        old = manager_engine_unref(manager, previous);
+    }
+    else {
+        manager->current = menode;
+    }
+    ib_lock_unlock(&(manager->lock));
+
+    /* Destroy the previous engine if nothing was using it. */
+    if (old != NULL) {
+        ib_engine_destroy(old);
+    }
+
+    return IB_OK;
+}
+
+ib_status_t ib_manager_engine_acquire(
+    ib_manager_t  *manager,
+    ib_engine_t  **pengine
+)
+{
+    assert(manager != NULL);
+    assert(pengine != NULL);
+
+    ib_status_t rc;
+
+    rc = ib_lock_lock(&(manager->lock));
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if (manager->current == NULL) {
+        rc = IB_DECLINED;
+    }
+    else {
+        ++manager->current->refs;
+        *pengine = manager->current->engine;
+    }
+    ib_lock_unlock(&(manager->lock));
+
+    return rc;
+}
+
+ib_status_t ib_manager_engine_release(
+    ib_manager_t *manager,
+    ib_engine_t  *engine
+)
+{
+    assert(manager != NULL);
+    assert(engine != NULL);
+
+    ib_manager_engine_t *menode;
+    ib_engine_t         *old = NULL;
+    ib_status_t          rc;
+
+    rc = ib_lock_lock(&(manager->lock));
+    if (rc != IB_OK) {
+        return rc;
+    }
+    for (menode = manager->engines; menode != NULL; menode = menode->next) {
+        if (menode->engine == engine) {
+            break;
+        }
+    }
+    if (menode == NULL) {
+        rc = IB_ENOENT;
+    }
+    else {
+        old = manager_engine_unref(manager, menode);
+    }
+    ib_lock_unlock(&(manager->lock));
+
+    /* Destroy a drained engine outside of the lock. */
+    if (old != NULL) {
+        ib_engine_destroy(old);
+    }
+
+    return rc;
+}
+
+size_t ib_manager_engine_count(
+    ib_manager_t *manager
+)
+{
+    assert(manager != NULL);
+
+    size_t count;
+
+    ib_lock_lock(&(manager->lock));
+    count = manager->num_engines;
+    ib_lock_unlock(&(manager->lock));
+
+    return count;
+}
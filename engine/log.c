@@ -31,6 +31,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 
 /**
@@ -52,9 +53,8 @@ static void default_logger(FILE *fp, int level,
                            const char *file, int line,
                            const char *fmt, va_list ap)
 {
-    char *new_fmt;
     char time_info[32 + 1];
-    struct tm *tminfo;
+    struct tm tminfo;
     time_t timet;
 
     if (level > 4) {
@@ -62,37 +62,25 @@ static void default_logger(FILE *fp, int level,
     }
 
     timet = time(NULL);
-    tminfo = localtime(&timet);
-    strftime(time_info, sizeof(time_info)-1, "%d%m%Y.%Hh%Mm%Ss", tminfo);
+    localtime_r(&timet, &tminfo);
+    strftime(time_info, sizeof(time_info)-1, "%d%m%Y.%Hh%Mm%Ss", &tminfo);
 
-    /* 100 is more than sufficient. */
-    new_fmt = (char *)malloc(strlen(time_info) + strlen(fmt) + 100);
-    sprintf(new_fmt, "%s %-10s- ", time_info, ib_log_level_to_string(level));
+    /* Write the pieces directly; the stream lock keeps the line whole. */
+    flockfile(fp);
+    fprintf(fp, "%s %-10s- ", time_info, ib_log_level_to_string(level));
 
     if ( (file != NULL) && (line > 0) ) {
         while ( (file != NULL) && (strncmp(file, "../", 3) == 0) ) {
             file += 3;
         }
 
-        static const size_t c_line_info_length = 35;
-        char line_info[c_line_info_length];
-        snprintf(
-            line_info,
-            c_line_info_length,
-            "(%23s:%-5d) ",
-            file,
-            line
-        );
-        strcat(new_fmt, line_info);
+        fprintf(fp, "(%23s:%-5d) ", file, line);
     }
 
-    strcat(new_fmt, fmt);
-    strcat(new_fmt, "\n");
-
-    vfprintf(fp, new_fmt, ap);
+    vfprintf(fp, fmt, ap);
+    fputc('\n', fp);
     fflush(fp);
-
-    free(new_fmt);
+    funlockfile(fp);
 
     return;
 }
@@ -210,8 +198,16 @@ void DLL_PUBLIC ib_log_tx_vex(
      va_list         ap
 )
 {
-    char *new_fmt = malloc(strlen(fmt) + 45);
+    char fmt_buf[256];
+    char *new_fmt = fmt_buf;
     const char *which_fmt = new_fmt;
+    size_t fmt_len = strlen(fmt);
+
+    /* Only unusually long formats need the heap. */
+    if (fmt_len + 45 > sizeof(fmt_buf)) {
+        new_fmt = malloc(fmt_len + 45);
+        which_fmt = new_fmt;
+    }
     if (! new_fmt) {
         /* Do our best */
         which_fmt = fmt;
@@ -223,7 +219,9 @@ void DLL_PUBLIC ib_log_tx_vex(
 
     ib_log_vex_ex(tx->ib, level, file, line, which_fmt, ap);
 
-    free(new_fmt);
+    if (new_fmt != fmt_buf) {
+        free(new_fmt);
+    }
 
     return;
 }
@@ -35,15 +35,117 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 
-/// @todo Probably need to load into a given context???
-ib_status_t ib_module_init(ib_module_t *m, ib_engine_t *ib)
+/**
+ * Process wide module index.
+ *
+ * A module has the same index in every engine of the process.  Modules
+ * find their configuration and transaction data through the index in
+ * their static module structure, so it must not depend on which engine
+ * initialized the module last.
+ */
+typedef struct {
+    char   *name;  /**< Module name */
+    size_t  idx;   /**< Index of @a name */
+} module_index_t;
+
+static pthread_mutex_t  module_index_lock = PTHREAD_MUTEX_INITIALIZER;
+static module_index_t  *module_index = NULL;
+static size_t           module_index_count = 0;
+
+/**
+ * Set the index of module @a m, assigning one to its name if needed.
+ *
+ * @param[in,out] m Module.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+static ib_status_t module_index_set(ib_module_t *m)
+{
+    module_index_t *entries;
+    char           *name;
+    size_t          i;
+
+    pthread_mutex_lock(&module_index_lock);
+    for (i = 0; i < module_index_count; ++i) {
+        if (strcmp(module_index[i].name, m->name) == 0) {
+            m->idx = module_index[i].idx;
+            pthread_mutex_unlock(&module_index_lock);
+            return IB_OK;
+        }
+    }
+
+    name = strdup(m->name);
+    entries = realloc(module_index,
+                      (module_index_count + 1) * sizeof(*entries));
+    if ( (name == NULL) || (entries == NULL) ) {
+        free(name);
+        if (entries != NULL) {
+            module_index = entries;
+        }
+        pthread_mutex_unlock(&module_index_lock);
+        return IB_EALLOC;
+    }
+    module_index = entries;
+    module_index[module_index_count].name = name;
+    module_index[module_index_count].idx = module_index_count;
+    m->idx = module_index_count;
+    ++module_index_count;
+    pthread_mutex_unlock(&module_index_lock);
+
+    return IB_OK;
+}
+
+/**
+ * Initialize module @a m in engine @a ib.
+ *
+ * A module structure that does not belong to @a ib, i.e., the static
+ * structure of a compiled in or loaded module, is shared by every engine
+ * in the process.  The engine gets its own copy of it, including its
+ * global configuration, so that module state of different engines does
+ * not collide.
+ *
+ * @param[in] m Module.
+ * @param[in] ib Engine.
+ * @param[in] shared Is @a m shared with other engines?  Module structures
+ *                   with a different engine always are.
+ * @param[out] pinstance The engine's module structure.
+ *
+ * @returns Status code
+ */
+static ib_status_t module_init(ib_module_t  *m,
+                               ib_engine_t  *ib,
+                               bool          shared,
+                               ib_module_t **pinstance)
 {
     ib_status_t rc;
 
-    /* Keep track of the module index. */
-    m->idx = ib_array_elements(ib->modules);
-    m->ib = ib;
+    rc = module_index_set(m);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    if (shared || (m->ib != ib)) {
+        ib_module_t *instance = ib_mpool_memdup(ib->mp, m, sizeof(*m));
+        if (instance == NULL) {
+            return IB_EALLOC;
+        }
+        if (m->gclen > 0) {
+            instance->gcdata = ib_mpool_memdup(ib->mp, m->gcdata, m->gclen);
+            if (instance->gcdata == NULL) {
+                return IB_EALLOC;
+            }
+        }
+        instance->ib = ib;
+        instance->rule = NULL;
+        m = instance;
+    }
+    *pinstance = m;
 
     ib_log_debug2(ib, "Initializing module %s (%zd): %s",
                   m->name, m->idx, m->filename);
@@ -102,6 +204,13 @@ ib_status_t ib_module_init(ib_module_t *m, ib_engine_t *ib)
     return IB_OK;
 }
 
+ib_status_t ib_module_init(ib_module_t *m, ib_engine_t *ib)
+{
+    ib_module_t *instance;
+
+    return module_init(m, ib, false, &instance);
+}
+
 ib_status_t ib_module_create(ib_module_t **pm,
                              ib_engine_t *ib)
 {
@@ -186,7 +295,9 @@ ib_status_t ib_module_load(ib_module_t **pm,
                   (*pm)->vernum, (*pm)->abinum, (*pm)->version,
                   (*pm)->idx, (*pm)->filename);
 
-    rc = ib_module_init(*pm, ib);
+    /* The structure comes from the module's symbol and may have been
+     * returned to other engines as well. */
+    rc = module_init(*pm, ib, true, pm);
     return rc;
 }
 
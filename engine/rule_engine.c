@@ -37,6 +37,7 @@
 #include <ironbee/engine.h>
 #include <ironbee/escape.h>
 #include <ironbee/field.h>
+#include <ironbee/hash.h>
 #include <ironbee/mpool.h>
 #include <ironbee/operator.h>
 #include <ironbee/rule_logger.h>
@@ -45,6 +46,10 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
 
 /**
  * Phase Flags
@@ -240,6 +245,30 @@ typedef struct {
     ib_num_t                result;      /**< Rule execution result */
 } rule_exec_stack_frame_t;
 
+/**
+ * Key of a memoized transformation result.
+ */
+typedef struct {
+    const ib_field_t       *in;          /**< Input field */
+    const ib_tfn_t         *tfn;         /**< Transformation */
+} tfn_cache_key_t;
+
+/**
+ * A memoized transformation result.
+ *
+ * Chains that share a prefix share the results of that prefix, as the
+ * output of one step is the input field (key) of the next.  An entry is
+ * only valid while the input and output are unchanged.
+ */
+typedef struct {
+    tfn_cache_key_t         key;         /**< Key */
+    size_t                  in_version;  /**< Version of the input field */
+    const void             *in_value;    /**< Value of the input field */
+    size_t                  in_length;   /**< Length of the input value */
+    ib_field_t             *out;         /**< Transformation result */
+    size_t                  out_version; /**< Version of the result */
+} tfn_cache_entry_t;
+
 /**
  * The rule engine uses recursion to walk through lists and chains.  These
  * define the limits of the recursion depth.
@@ -356,6 +385,438 @@ static ib_status_t find_meta(
     return IB_ENOENT;
 }
 
+/**
+ * Per-thread rule profiling counters.
+ */
+typedef struct rule_profile_thread_t rule_profile_thread_t;
+struct rule_profile_thread_t {
+    rule_profile_thread_t      *next;        /**< Next thread */
+    ib_rule_profile_counters_t  counters[];  /**< Counters by rule index */
+};
+
+/**
+ * Rule profiling data.
+ *
+ * Each thread updates its own counters without locking; @a lock only
+ * protects the list of threads.  Counters are summed on demand, so sums
+ * taken while transactions are running are approximate.
+ */
+struct ib_rule_profile_t {
+    pthread_key_t           key;         /**< Thread's rule_profile_thread_t */
+    pthread_mutex_t         lock;        /**< Protects @a threads */
+    rule_profile_thread_t  *threads;     /**< Counters of all threads */
+    bool                    sized;       /**< Is @a num_rules fixed? */
+    size_t                  num_rules;   /**< Number of counters per thread */
+    const char             *path;        /**< Profile file (or NULL) */
+    volatile sig_atomic_t   dump;        /**< Dump has been requested */
+};
+
+/**
+ * Current time for profiling.
+ *
+ * @returns Monotonic time in nanoseconds
+ */
+static inline uint64_t rule_profile_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t)ts.tv_sec * 1000000000) + ts.tv_nsec;
+}
+
+/**
+ * Get the profiling counters of @a rule for the current thread.
+ *
+ * @param[in] rule_exec Rule execution object
+ * @param[in] rule Rule
+ *
+ * @returns Counters or NULL if @a rule is not being profiled
+ */
+static inline ib_rule_profile_counters_t *rule_profile_counters(
+    const ib_rule_exec_t *rule_exec,
+    const ib_rule_t *rule)
+{
+    if ( (rule_exec->profile == NULL) ||
+         (rule->index >= rule_exec->profile_size) )
+    {
+        return NULL;
+    }
+    return rule_exec->profile + rule->index;
+}
+
+/**
+ * Write the profile to the profile file, if any.
+ *
+ * @param[in] ib IronBee engine
+ *
+ * @returns Status code
+ */
+static ib_status_t rule_profile_dump(const ib_engine_t *ib)
+{
+    const ib_rule_profile_t *profile = ib->rule_engine->profile;
+    ib_status_t              rc;
+    FILE                    *fp;
+
+    if ( (profile == NULL) || (profile->path == NULL) ) {
+        return IB_OK;
+    }
+
+    fp = fopen(profile->path, "w");
+    if (fp == NULL) {
+        return IB_EOTHER;
+    }
+    rc = ib_rule_profile_write(ib, fp);
+    if (fclose(fp) != 0) {
+        rc = IB_EOTHER;
+    }
+    return rc;
+}
+
+/**
+ * Attach the current thread's profiling counters to @a rule_exec.
+ *
+ * Also writes the profile if a dump has been requested.
+ *
+ * @param[in,out] rule_exec Rule execution object
+ */
+static void rule_profile_attach(ib_rule_exec_t *rule_exec)
+{
+    ib_rule_profile_t     *profile = rule_exec->ib->rule_engine->profile;
+    rule_profile_thread_t *thread;
+
+    rule_exec->profile = NULL;
+    rule_exec->profile_size = 0;
+    if (profile == NULL) {
+        return;
+    }
+
+    if ( (profile->dump != 0) &&
+         (__sync_lock_test_and_set(&(profile->dump), 0) != 0) )
+    {
+        ib_status_t rc = rule_profile_dump(rule_exec->ib);
+        if (rc != IB_OK) {
+            ib_log_error(rule_exec->ib,
+                         "Failed to write rule profile to \"%s\": %s",
+                         profile->path, ib_status_to_string(rc));
+        }
+    }
+
+    thread = (rule_profile_thread_t *)pthread_getspecific(profile->key);
+    if (thread == NULL) {
+        pthread_mutex_lock(&(profile->lock));
+        if (! profile->sized) {
+            profile->num_rules = rule_exec->ib->rule_engine->num_rules;
+            profile->sized = true;
+        }
+        thread = (rule_profile_thread_t *)calloc(
+            1,
+            sizeof(*thread) +
+            (profile->num_rules * sizeof(ib_rule_profile_counters_t)));
+        if (thread != NULL) {
+            thread->next = profile->threads;
+            profile->threads = thread;
+        }
+        pthread_mutex_unlock(&(profile->lock));
+
+        if ( (thread == NULL) ||
+             (pthread_setspecific(profile->key, thread) != 0) )
+        {
+            return;
+        }
+    }
+
+    rule_exec->profile = thread->counters;
+    rule_exec->profile_size = profile->num_rules;
+}
+
+/**
+ * Engine pool cleanup: write the profile and free the counters.
+ *
+ * @param[in] data IronBee engine
+ */
+static void rule_profile_cleanup(void *data)
+{
+    ib_engine_t           *ib = (ib_engine_t *)data;
+    ib_rule_profile_t     *profile = ib->rule_engine->profile;
+    rule_profile_thread_t *thread;
+
+    if (profile == NULL) {
+        return;
+    }
+
+    rule_profile_dump(ib);
+
+    thread = profile->threads;
+    while (thread != NULL) {
+        rule_profile_thread_t *next = thread->next;
+        free(thread);
+        thread = next;
+    }
+    pthread_key_delete(profile->key);
+    pthread_mutex_destroy(&(profile->lock));
+    ib->rule_engine->profile = NULL;
+}
+
+/**
+ * Sum the profiling counters of all threads.
+ *
+ * @param[in] profile Profiling data
+ *
+ * @returns Array of profile->num_rules counters (free with free()) or NULL
+ */
+static ib_rule_profile_counters_t *rule_profile_sum(
+    ib_rule_profile_t *profile)
+{
+    ib_rule_profile_counters_t  *sums;
+    const rule_profile_thread_t *thread;
+
+    pthread_mutex_lock(&(profile->lock));
+    sums = (ib_rule_profile_counters_t *)calloc(
+        profile->num_rules + 1, sizeof(*sums));
+    if (sums != NULL) {
+        for (thread = profile->threads; thread != NULL; thread = thread->next)
+        {
+            size_t n;
+            for (n = 0; n < profile->num_rules; ++n) {
+                const ib_rule_profile_counters_t *c = &(thread->counters[n]);
+                sums[n].invocations += c->invocations;
+                sums[n].targets     += c->targets;
+                sums[n].tfn_ns      += c->tfn_ns;
+                sums[n].operator_ns += c->operator_ns;
+                sums[n].matches     += c->matches;
+                sums[n].actions     += c->actions;
+                sums[n].operator_skips += c->operator_skips;
+            }
+        }
+    }
+    pthread_mutex_unlock(&(profile->lock));
+
+    return sums;
+}
+
+ib_status_t ib_rule_profile_enable(ib_engine_t *ib,
+                                   const char *path)
+{
+    assert(ib != NULL);
+    assert(ib->rule_engine != NULL);
+
+    ib_rule_profile_t *profile = ib->rule_engine->profile;
+    ib_status_t        rc;
+
+    if (profile == NULL) {
+        profile = ib_mpool_calloc(ib->mp, 1, sizeof(*profile));
+        if (profile == NULL) {
+            return IB_EALLOC;
+        }
+        if (pthread_key_create(&(profile->key), NULL) != 0) {
+            return IB_EUNKNOWN;
+        }
+        if (pthread_mutex_init(&(profile->lock), NULL) != 0) {
+            pthread_key_delete(profile->key);
+            return IB_EUNKNOWN;
+        }
+        rc = ib_mpool_cleanup_register(ib->mp, rule_profile_cleanup, ib);
+        if (rc != IB_OK) {
+            pthread_key_delete(profile->key);
+            pthread_mutex_destroy(&(profile->lock));
+            return rc;
+        }
+        ib->rule_engine->profile = profile;
+    }
+
+    if (path != NULL) {
+        profile->path = ib_mpool_strdup(ib->mp, path);
+        if (profile->path == NULL) {
+            return IB_EALLOC;
+        }
+    }
+
+    return IB_OK;
+}
+
+ib_status_t ib_rule_profile_get(const ib_engine_t *ib,
+                                const ib_rule_t *rule,
+                                ib_rule_profile_counters_t *counters)
+{
+    assert(ib != NULL);
+    assert(rule != NULL);
+    assert(counters != NULL);
+
+    ib_rule_profile_t *profile = ib->rule_engine->profile;
+    ib_rule_profile_counters_t *sums;
+
+    if ( (profile == NULL) || (! profile->sized) ||
+         (rule->index >= profile->num_rules) )
+    {
+        return IB_ENOENT;
+    }
+
+    sums = rule_profile_sum(profile);
+    if (sums == NULL) {
+        return IB_EALLOC;
+    }
+    *counters = sums[rule->index];
+    free(sums);
+
+    return IB_OK;
+}
+
+/**
+ * A rule and its summed counters, for sorting.
+ */
+typedef struct {
+    const ib_rule_t                  *rule;     /**< Rule */
+    const ib_rule_profile_counters_t *counters; /**< Rule's counters */
+} rule_profile_entry_t;
+
+/**
+ * Order profile entries by descending total time.
+ *
+ * @param[in] a First entry
+ * @param[in] b Second entry
+ *
+ * @returns qsort() comparison result
+ */
+static int rule_profile_entry_cmp(const void *a, const void *b)
+{
+    const ib_rule_profile_counters_t *ca =
+        ((const rule_profile_entry_t *)a)->counters;
+    const ib_rule_profile_counters_t *cb =
+        ((const rule_profile_entry_t *)b)->counters;
+    uint64_t ta = ca->tfn_ns + ca->operator_ns;
+    uint64_t tb = cb->tfn_ns + cb->operator_ns;
+
+    return (ta < tb) ? 1 : ((ta > tb) ? -1 : 0);
+}
+
+/**
+ * Write @a str as a quoted JSON string.
+ *
+ * @param[in] fp File to write to
+ * @param[in] str String to write (NULL is written as an empty string)
+ */
+static void rule_profile_print_string(FILE *fp, const char *str)
+{
+    size_t  size;
+    char   *buf;
+
+    if (str == NULL) {
+        str = "";
+    }
+    size = (strlen(str) * 6) + 3;
+    buf = (char *)malloc(size);
+    if ( (buf == NULL) ||
+         (ib_string_escape_json_buf(str, true, buf, size, NULL, NULL)
+          != IB_OK) )
+    {
+        fputs("\"\"", fp);
+    }
+    else {
+        fputs(buf, fp);
+    }
+    free(buf);
+}
+
+ib_status_t ib_rule_profile_write(const ib_engine_t *ib,
+                                  FILE *fp)
+{
+    assert(ib != NULL);
+    assert(fp != NULL);
+
+    ib_rule_profile_t          *profile = ib->rule_engine->profile;
+    ib_rule_profile_counters_t *sums;
+    rule_profile_entry_t       *entries;
+    size_t                      num_entries = 0;
+    const ib_list_node_t       *node;
+    size_t                      n;
+
+    if (profile == NULL) {
+        return IB_ENOENT;
+    }
+    if (! profile->sized) {
+        fputs("{\n  \"rules\": []\n}\n", fp);
+        return ferror(fp) ? IB_EOTHER : IB_OK;
+    }
+
+    sums = rule_profile_sum(profile);
+    if (sums == NULL) {
+        return IB_EALLOC;
+    }
+    entries = (rule_profile_entry_t *)calloc(
+        profile->num_rules + 1, sizeof(*entries));
+    if (entries == NULL) {
+        free(sums);
+        return IB_EALLOC;
+    }
+
+    IB_LIST_LOOP_CONST(ib->rule_engine->rule_list, node) {
+        const ib_rule_t *rule =
+            (const ib_rule_t *)ib_list_node_data_const(node);
+
+        if ( (rule->index < profile->num_rules) &&
+             (sums[rule->index].invocations != 0) )
+        {
+            entries[num_entries].rule = rule;
+            entries[num_entries].counters = &(sums[rule->index]);
+            ++num_entries;
+        }
+    }
+    qsort(entries, num_entries, sizeof(*entries), rule_profile_entry_cmp);
+
+    fputs("{\n  \"rules\": [", fp);
+    for (n = 0; n < num_entries; ++n) {
+        const ib_rule_t                  *rule = entries[n].rule;
+        const ib_rule_profile_counters_t *c = entries[n].counters;
+
+        fputs( (n == 0) ? "\n    {\"id\": " : ",\n    {\"id\": ", fp);
+        rule_profile_print_string(fp, ib_rule_id(rule));
+        fputs(", \"file\": ", fp);
+        rule_profile_print_string(fp, rule->meta.config_file);
+        fprintf(fp, ", \"line\": %u, \"phase\": ", rule->meta.config_line);
+        rule_profile_print_string(fp, phase_name(rule->phase_meta));
+        fprintf(fp,
+                ", \"invocations\": %" PRIu64
+                ", \"targets\": %" PRIu64
+                ", \"tfn_ns\": %" PRIu64
+                ", \"operator_ns\": %" PRIu64
+                ", \"matches\": %" PRIu64
+                ", \"actions\": %" PRIu64
+                ", \"operator_skips\": %" PRIu64 "}",
+                c->invocations, c->targets, c->tfn_ns, c->operator_ns,
+                c->matches, c->actions, c->operator_skips);
+    }
+    fputs( (num_entries == 0) ? "]\n}\n" : "\n  ]\n}\n", fp);
+
+    free(entries);
+    free(sums);
+
+    return ferror(fp) ? IB_EOTHER : IB_OK;
+}
+
+void ib_rule_profile_operator_skip(const ib_rule_exec_t *rule_exec)
+{
+    assert(rule_exec != NULL);
+
+    ib_rule_profile_counters_t *counters;
+
+    if (rule_exec->rule == NULL) {
+        return;
+    }
+    counters = rule_profile_counters(rule_exec, rule_exec->rule);
+    if (counters != NULL) {
+        ++counters->operator_skips;
+    }
+}
+
+void ib_rule_profile_request_dump(ib_engine_t *ib)
+{
+    assert(ib != NULL);
+
+    if (ib->rule_engine->profile != NULL) {
+        ib->rule_engine->profile->dump = 1;
+    }
+}
+
 ib_status_t ib_rule_exec_create(ib_tx_t *tx,
                                 ib_rule_exec_t **rule_exec)
 {
@@ -366,6 +827,7 @@ ib_status_t ib_rule_exec_create(ib_tx_t *tx,
 
     /* Re-use the TX's rule execution object if it's there */
     if (tx->rule_exec != NULL) {
+        rule_profile_attach(tx->rule_exec);
         *rule_exec = tx->rule_exec;
         return IB_OK;
     }
@@ -394,6 +856,14 @@ ib_status_t ib_rule_exec_create(ib_tx_t *tx,
         return rc;
     }
 
+    /* Create the transformation result cache */
+    rc = ib_hash_create(&(exec->tfn_cache), tx->mp);
+    if (rc != IB_OK) {
+        ib_rule_log_tx_error(tx, "Failed to create tfn cache: %s",
+                             ib_status_to_string(rc));
+        return rc;
+    }
+
     /* Create the TX log object */
     rc = ib_rule_log_tx_create(exec, &(exec->tx_log));
     if (rc != IB_OK) {
@@ -409,6 +879,9 @@ ib_status_t ib_rule_exec_create(ib_tx_t *tx,
 
     exec->exec_log = NULL;
 
+    /* Attach the thread's profiling counters */
+    rule_profile_attach(exec);
+
     /* Pass the new object back to the caller if required */
     if (rule_exec != NULL) {
         *rule_exec = exec;
@@ -578,6 +1051,162 @@ static void rule_exec_pop_value(ib_rule_exec_t *rule_exec,
     return;
 }
 
+/**
+ * Get the identity of a field's current value for the tfn cache.
+ *
+ * Only static string fields are cached.  Their value pointer and length
+ * change when the value is replaced; the field version covers changes made
+ * in place.
+ *
+ * @param[in] field Field
+ * @param[out] value Value pointer
+ * @param[out] length Value length
+ *
+ * @returns true if results for @a field may be cached.
+ */
+static bool tfn_cache_value(const ib_field_t *field,
+                            const void **value,
+                            size_t *length)
+{
+    assert(field != NULL);
+    assert(value != NULL);
+    assert(length != NULL);
+
+    ib_status_t rc;
+
+    if (ib_field_is_dynamic(field)) {
+        return false;
+    }
+
+    if (field->type == IB_FTYPE_BYTESTR) {
+        const ib_bytestr_t *bs;
+
+        rc = ib_field_value(field, ib_ftype_bytestr_out(&bs));
+        if (rc != IB_OK) {
+            return false;
+        }
+        *value = (bs == NULL) ? NULL : ib_bytestr_const_ptr(bs);
+        *length = (bs == NULL) ? 0 : ib_bytestr_length(bs);
+        return true;
+    }
+    else if (field->type == IB_FTYPE_NULSTR) {
+        const char *str;
+
+        rc = ib_field_value(field, ib_ftype_nulstr_out(&str));
+        if (rc != IB_OK) {
+            return false;
+        }
+        /* Replacing a string always changes the pointer. */
+        *value = str;
+        *length = 0;
+        return true;
+    }
+
+    return false;
+}
+
+/**
+ * Look up the memoized result of a transformation.
+ *
+ * @param[in] rule_exec The rule execution object
+ * @param[in] tfn The transformation
+ * @param[in] value The input field
+ * @param[out] result The cached result
+ *
+ * @returns
+ *   - IB_OK if a valid result was found.
+ *   - IB_ENOENT if not.
+ */
+static ib_status_t tfn_cache_get(const ib_rule_exec_t *rule_exec,
+                                 const ib_tfn_t *tfn,
+                                 const ib_field_t *value,
+                                 ib_field_t **result)
+{
+    assert(rule_exec != NULL);
+    assert(tfn != NULL);
+    assert(value != NULL);
+    assert(result != NULL);
+
+    ib_status_t rc;
+    tfn_cache_key_t key;
+    tfn_cache_entry_t *entry;
+    const void *in_value;
+    size_t in_length;
+
+    if (rule_exec->tfn_cache == NULL) {
+        return IB_ENOENT;
+    }
+
+    memset(&key, 0, sizeof(key));
+    key.in = value;
+    key.tfn = tfn;
+    rc = ib_hash_get_ex(rule_exec->tfn_cache, &entry, &key, sizeof(key));
+    if (rc != IB_OK) {
+        return IB_ENOENT;
+    }
+
+    if ( (! tfn_cache_value(value, &in_value, &in_length)) ||
+         (entry->in_version != ib_field_version(value)) ||
+         (entry->in_value != in_value) ||
+         (entry->in_length != in_length) ||
+         (entry->out_version != ib_field_version(entry->out)) )
+    {
+        return IB_ENOENT;
+    }
+
+    *result = entry->out;
+    return IB_OK;
+}
+
+/**
+ * Memoize the result of a transformation.
+ *
+ * Results for inputs that can not be cached are silently ignored.
+ *
+ * @param[in] rule_exec The rule execution object
+ * @param[in] tfn The transformation
+ * @param[in] value The input field
+ * @param[in] out The result
+ *
+ * @returns Status code
+ */
+static ib_status_t tfn_cache_set(const ib_rule_exec_t *rule_exec,
+                                 const ib_tfn_t *tfn,
+                                 const ib_field_t *value,
+                                 ib_field_t *out)
+{
+    assert(rule_exec != NULL);
+    assert(tfn != NULL);
+    assert(value != NULL);
+    assert(out != NULL);
+
+    tfn_cache_entry_t *entry;
+    const void *in_value;
+    size_t in_length;
+
+    if ( (rule_exec->tfn_cache == NULL) ||
+         (! tfn_cache_value(value, &in_value, &in_length)) )
+    {
+        return IB_OK;
+    }
+
+    entry = ib_mpool_calloc(rule_exec->tx->mp, 1, sizeof(*entry));
+    if (entry == NULL) {
+        return IB_EALLOC;
+    }
+
+    entry->in_value = in_value;
+    entry->in_length = in_length;
+    entry->key.in = value;
+    entry->key.tfn = tfn;
+    entry->in_version = ib_field_version(value);
+    entry->out = out;
+    entry->out_version = ib_field_version(out);
+
+    return ib_hash_set_ex(rule_exec->tfn_cache,
+                          &entry->key, sizeof(entry->key), entry);
+}
+
 /**
  * Execute a single transformation on a target.
  *
@@ -699,6 +1328,14 @@ static ib_status_t execute_tfn_single(const ib_rule_exec_t *rule_exec,
         }
     }
 
+    /* Another rule already ran this transformation on this value. */
+    else if (tfn_cache_get(rule_exec, tfn, value, &out) == IB_OK) {
+        ib_rule_log_trace(rule_exec,
+                          "Using cached result of transformation \"%s\"",
+                          tfn->name);
+        rc = IB_OK;
+    }
+
     /* OK, no unrolling required.  Just execute the transformation. */
     else {
         ib_flags_t flags;
@@ -717,6 +1354,15 @@ static ib_status_t execute_tfn_single(const ib_rule_exec_t *rule_exec,
                               "Transformation returned NULL");
             return IB_EINVAL;
         }
+
+        rc = tfn_cache_set(rule_exec, tfn, value, out);
+        if (rc != IB_OK) {
+            ib_rule_log_error(rule_exec,
+                              "Error caching result of transformation "
+                              "\"%s\": %s",
+                              tfn->name, ib_status_to_string(rc));
+            return rc;
+        }
     }
 
     /* The output of the final operator is the result */
@@ -732,17 +1378,21 @@ static ib_status_t execute_tfn_single(const ib_rule_exec_t *rule_exec,
  * Execute list of transformations on a target.
  *
  * @param[in] rule_exec The rule execution object
+ * @param[in] tfns Target's transformations
+ * @param[in] num_tfns Number of elements in @a tfns
  * @param[in] value Initial value of the target field
  * @param[out] result Pointer to field in which to store the result
  *
  * @returns Status code
  */
 static ib_status_t execute_tfns(const ib_rule_exec_t *rule_exec,
+                                const ib_tfn_t *const *tfns,
+                                size_t num_tfns,
                                 const ib_field_t *value,
                                 const ib_field_t **result)
 {
     ib_status_t          rc;
-    const ib_list_node_t *node = NULL;
+    size_t               n;
     const ib_field_t     *in_field;
     ib_field_t           *out = NULL;
 
@@ -754,21 +1404,20 @@ static ib_status_t execute_tfns(const ib_rule_exec_t *rule_exec,
         *result = NULL;
         return IB_OK;
     }
-    else if (IB_LIST_ELEMENTS(rule_exec->target->tfn_list) == 0) {
+    else if (num_tfns == 0) {
         *result = value;
         ib_rule_log_trace(rule_exec, "No transformations");
         return IB_OK;
     }
 
-    ib_rule_log_trace(rule_exec, "Executing %zd transformations",
-                      IB_LIST_ELEMENTS(rule_exec->target->tfn_list));
+    ib_rule_log_trace(rule_exec, "Executing %zd transformations", num_tfns);
 
     /*
      * Loop through all of the target's transformations.
      */
     in_field = value;
-    IB_LIST_LOOP_CONST(rule_exec->target->tfn_list, node) {
-        const ib_tfn_t  *tfn = (const ib_tfn_t *)node->data;
+    for (n = 0; n < num_tfns; ++n) {
+        const ib_tfn_t  *tfn = tfns[n];
 
         /* Run it */
         ib_rule_log_trace(rule_exec, "Executing transformation %s", tfn->name);
@@ -887,6 +1536,57 @@ static ib_status_t execute_action_list(const ib_rule_exec_t *rule_exec,
     return rc;
 }
 
+/**
+ * Execute a compiled rule's actions
+ *
+ * @param[in] rule_exec Rule execution object
+ * @param[in] result Rule execution result
+ * @param[in] actions Actions to execute
+ * @param[in] num_actions Number of elements in @a actions
+ *
+ * @returns Status code
+ */
+static ib_status_t execute_action_array(const ib_rule_exec_t *rule_exec,
+                                        ib_num_t result,
+                                        const ib_action_inst_t *const *actions,
+                                        size_t num_actions)
+{
+    assert(rule_exec != NULL);
+
+    ib_status_t           rc = IB_OK;
+    const char           *name;
+    size_t                n;
+
+    if (num_actions == 0) {
+        return IB_OK;
+    }
+
+    name = (result != 0) ? "True" : "False";
+    ib_rule_log_trace(rule_exec, "Executing rule %s actions", name);
+
+    /* Same error handling as execute_action_list() */
+    for (n = 0; n < num_actions; ++n) {
+        ib_status_t             arc;     /* Action's return code */
+        const ib_action_inst_t *action = actions[n];
+
+        /* Execute the action */
+        arc = execute_action(rule_exec, result, action);
+        ib_rule_log_exec_add_action(rule_exec->exec_log, action, arc);
+
+        /* Record an error status code unless a block rc is to be reported. */
+        if (arc != IB_OK) {
+            ib_rule_log_error(rule_exec,
+                              "Action %s/\"%s\" returned an error: %s",
+                              name,
+                              action->action->name,
+                              ib_status_to_string(arc));
+            rc = arc;
+        }
+    }
+
+    return rc;
+}
+
 /**
  * Perform a block operation by signaling an error to the server.
  *
@@ -1135,16 +1835,19 @@ static ib_status_t set_target_fields(ib_rule_exec_t *rule_exec,
  * @returns Status code
  */
 static ib_status_t execute_operator(ib_rule_exec_t *rule_exec,
+                                    const ib_rule_program_t *program,
+                                    const ib_rule_prog_rec_t *rec,
                                     const ib_field_t *value,
                                     int recursion)
 {
     assert(rule_exec != NULL);
-    assert(rule_exec->rule != NULL);
-    assert(rule_exec->rule->opinst != NULL);
+    assert(program != NULL);
+    assert(rec != NULL);
+    assert(rec->opinst != NULL);
     assert(rule_exec->target != NULL);
 
     ib_status_t rc;
-    const ib_operator_inst_t *opinst = rule_exec->rule->opinst;
+    const ib_operator_inst_t *opinst = rec->opinst;
     const ib_rule_target_t   *target = rule_exec->target;
 
     /* This if-block is only to log operator values when tracing. */
@@ -1249,7 +1952,7 @@ static ib_status_t execute_operator(ib_rule_exec_t *rule_exec,
             pushed = rule_exec_push_value(rule_exec, nvalue);
 
             /* Recursive call. */
-            rc = execute_operator(rule_exec, nvalue, recursion);
+            rc = execute_operator(rule_exec, program, rec, nvalue, recursion);
             if (rc != IB_OK) {
                 ib_rule_log_warn(rule_exec,
                                  "Error executing list element #%d: %s",
@@ -1264,10 +1967,14 @@ static ib_status_t execute_operator(ib_rule_exec_t *rule_exec,
 
     /* No recursion required, handle it here */
     else {
-        ib_list_t  *actions;
+        const ib_action_inst_t *const *actions;
+        size_t      num_actions;
         ib_num_t    result = 0;
         ib_status_t op_rc = IB_OK;
         ib_status_t act_rc = IB_OK;
+        ib_rule_profile_counters_t *counters =
+            rule_profile_counters(rule_exec, rule_exec->rule);
+        uint64_t    start = 0;
 
         /* Fill in the FIELD* fields */
         rc = set_target_fields(rule_exec, value);
@@ -1279,8 +1986,14 @@ static ib_status_t execute_operator(ib_rule_exec_t *rule_exec,
 
         /* Execute the operator */
         /* @todo remove the cast-away of the constness of value */
+        if (counters != NULL) {
+            start = rule_profile_now();
+        }
         op_rc = ib_operator_execute(rule_exec, opinst,
                                     (ib_field_t *)value, &result);
+        if (counters != NULL) {
+            counters->operator_ns += rule_profile_now() - start;
+        }
         if (op_rc != IB_OK) {
             ib_rule_log_warn(rule_exec, "Operator returned an error: %s",
                              ib_status_to_string(op_rc));
@@ -1308,16 +2021,23 @@ static ib_status_t execute_operator(ib_rule_exec_t *rule_exec,
         }
         if (op_rc != IB_OK) {
             actions = NULL;
+            num_actions = 0;
         }
         else if (result != 0) {
-            actions = rule_exec->rule->true_actions;
+            actions = program->actions + rec->true_start;
+            num_actions = rec->num_true;
         }
         else {
-            actions = rule_exec->rule->false_actions;
+            actions = program->actions + rec->false_start;
+            num_actions = rec->num_false;
+        }
+        if (counters != NULL) {
+            counters->matches += ( (op_rc == IB_OK) && (result != 0) );
+            counters->actions += num_actions;
         }
 
         ib_rule_log_exec_add_result(rule_exec->exec_log, value, result);
-        act_rc = execute_action_list(rule_exec, result, actions);
+        act_rc = execute_action_array(rule_exec, result, actions, num_actions);
 
         /* Done. */
         clear_target_fields(rule_exec);
@@ -1336,29 +2056,46 @@ static ib_status_t execute_operator(ib_rule_exec_t *rule_exec,
  * Execute a single rule's operator on all target fields.
  *
  * @param[in] rule_exec Rule execution object
+ * @param[in] program Rule program
+ * @param[in] rec Compiled rule record in @a program
  *
  * @returns Status code
  */
-static ib_status_t execute_phase_rule_targets(ib_rule_exec_t *rule_exec)
+static ib_status_t execute_phase_rule_targets(ib_rule_exec_t *rule_exec,
+                                              const ib_rule_program_t *program,
+                                              const ib_rule_prog_rec_t *rec)
 {
     assert(rule_exec != NULL);
     assert(rule_exec->rule != NULL);
     assert(rule_exec->tx != NULL);
-
-    ib_tx_t            *tx = rule_exec->tx;
-    ib_rule_t          *rule = rule_exec->rule;
-    ib_operator_inst_t *opinst = rule_exec->rule->opinst;
-    ib_status_t         rc = IB_OK;
-    ib_list_node_t     *node = NULL;
+    assert(program != NULL);
+    assert(rec != NULL);
+
+    ib_tx_t                     *tx = rule_exec->tx;
+    const ib_operator_inst_t    *opinst = rec->opinst;
+    ib_status_t                  rc = IB_OK;
+    const ib_rule_prog_target_t *ptarget;
+    const ib_rule_prog_target_t *ptarget_end;
+    ib_rule_profile_counters_t  *counters =
+        rule_profile_counters(rule_exec, rule_exec->rule);
+    uint64_t                     start = 0;
 
     /* Special case: External rules */
-    if (ib_flags_all(rule->flags, IB_RULE_FLAG_EXTERNAL)) {
+    if (ib_flags_all(rec->flags, IB_RULE_FLAG_EXTERNAL)) {
         ib_status_t op_rc;
 
         /* Execute the operator */
         ib_rule_log_trace(rule_exec, "Executing external rule");
+        if (counters != NULL) {
+            start = rule_profile_now();
+        }
         op_rc = ib_operator_execute(rule_exec, opinst, NULL,
                                     &rule_exec->result);
+        if (counters != NULL) {
+            counters->operator_ns += rule_profile_now() - start;
+            counters->matches += ( (op_rc == IB_OK) &&
+                                   (rule_exec->result != 0) );
+        }
         if (op_rc != IB_OK) {
             ib_rule_log_error(rule_exec,
                               "External operator returned an error: %s",
@@ -1378,15 +2115,15 @@ static ib_status_t execute_phase_rule_targets(ib_rule_exec_t *rule_exec)
     ib_rule_log_debug(rule_exec, "Executing rule");
 
     /* If this is a no-target rule (i.e. action), do nothing */
-    if (ib_flags_all(rule->flags, IB_RULE_FLAG_NO_TGT)) {
-        assert(ib_list_elements(rule->target_fields) == 1);
+    if (ib_flags_all(rec->flags, IB_RULE_FLAG_NO_TGT)) {
+        assert(rec->num_targets == 1);
     }
     else {
-        assert(ib_list_elements(rule->target_fields) != 0);
+        assert(rec->num_targets != 0);
     }
 
     ib_rule_log_debug(rule_exec, "Operating on %zd fields.",
-                      ib_list_elements(rule->target_fields));
+                      rec->num_targets);
 
     /*
      * Loop through all of the fields.
@@ -1395,8 +2132,10 @@ static ib_status_t execute_phase_rule_targets(ib_rule_exec_t *rule_exec)
      * returns an error.  This needs further discussion to determine what the
      * correct behavior should be.
      */
-    IB_LIST_LOOP(rule->target_fields, node) {
-        ib_rule_target_t   *target = (ib_rule_target_t *)node->data;
+    ptarget = program->targets + rec->target_start;
+    ptarget_end = ptarget + rec->num_targets;
+    for (; ptarget < ptarget_end; ++ptarget) {
+        ib_rule_target_t   *target = ptarget->target;
         assert(target != NULL);
         const char         *fname = target->field_name;
         assert(fname != NULL);
@@ -1410,7 +2149,12 @@ static ib_status_t execute_phase_rule_targets(ib_rule_exec_t *rule_exec)
         rule_exec_set_target(rule_exec, target);
 
         /* Get the field value */
-        getrc = ib_data_get(tx->data, fname, &value);
+        if (target->data_target != NULL) {
+            getrc = ib_data_target_get(tx->data, target->data_target, &value);
+        }
+        else {
+            getrc = ib_data_get(tx->data, fname, &value);
+        }
         if (getrc == IB_ENOENT) {
             bool allow  =
                 ib_flags_all(opinst->op->flags, IB_OP_FLAG_ALLOW_NULL);
@@ -1442,12 +2186,22 @@ static ib_status_t execute_phase_rule_targets(ib_rule_exec_t *rule_exec)
         ib_rule_log_exec_add_target(rule_exec->exec_log, target, value);
 
         /* Execute the target transformations */
+        if (counters != NULL) {
+            ++counters->targets;
+            start = rule_profile_now();
+        }
         if (value != NULL) {
-            rc = execute_tfns(rule_exec, value, &tfnvalue);
+            rc = execute_tfns(rule_exec,
+                              program->tfns + ptarget->tfn_start,
+                              ptarget->num_tfns,
+                              value, &tfnvalue);
             if (rc != IB_OK) {
                 return rc;
             }
         }
+        if (counters != NULL) {
+            counters->tfn_ns += rule_profile_now() - start;
+        }
 
         /* Store the rule's final value */
         ib_rule_log_exec_set_tgt_final(rule_exec->exec_log, tfnvalue);
@@ -1487,7 +2241,7 @@ static ib_status_t execute_phase_rule_targets(ib_rule_exec_t *rule_exec)
                 lpushed = rule_exec_push_value(rule_exec, node_value);
 
 
-                rc = execute_operator(rule_exec, node_value,
+                rc = execute_operator(rule_exec, program, rec, node_value,
                                       MAX_LIST_RECURSION);
                 if (rc != IB_OK) {
                     ib_rule_log_error(rule_exec,
@@ -1502,7 +2256,8 @@ static ib_status_t execute_phase_rule_targets(ib_rule_exec_t *rule_exec)
         }
         else {
             ib_rule_log_trace(rule_exec, "calling exop on single target");
-            rc = execute_operator(rule_exec, tfnvalue, MAX_LIST_RECURSION);
+            rc = execute_operator(rule_exec, program, rec, tfnvalue,
+                                  MAX_LIST_RECURSION);
             if (rc != IB_OK) {
                 ib_rule_log_error(rule_exec,
                                   "Operator returned an error: %s",
@@ -1537,20 +2292,26 @@ static ib_status_t execute_phase_rule_targets(ib_rule_exec_t *rule_exec)
  * Execute a single phase rule, it's actions, and it's chained rules.
  *
  * @param[in] rule_exec Rule execution object
- * @param[in] rule Rule to execute
+ * @param[in] program Rule program
+ * @param[in] rec Compiled record of the rule to execute
  * @param[in] recursion Recursion limit
  *
  * @returns Status code
  */
 static ib_status_t execute_phase_rule(ib_rule_exec_t *rule_exec,
-                                      ib_rule_t *rule,
+                                      const ib_rule_program_t *program,
+                                      const ib_rule_prog_rec_t *rec,
                                       int recursion)
 {
     ib_status_t         rc = IB_OK;
     ib_status_t         trc;          /* Temporary status code */
+    ib_rule_t          *rule;
+    ib_rule_profile_counters_t *counters;
 
     assert(rule_exec != NULL);
-    assert(rule != NULL);
+    assert(program != NULL);
+    assert(rec != NULL);
+    rule = rec->rule;
     assert(! rule->phase_meta->is_stream);
 
 
@@ -1570,6 +2331,10 @@ static ib_status_t execute_phase_rule(ib_rule_exec_t *rule_exec,
                           ib_status_to_string(rc));
         return rc;
     }
+    counters = rule_profile_counters(rule_exec, rule);
+    if (counters != NULL) {
+        ++counters->invocations;
+    }
 
     /*
      * Execute the rule operator on the target fields.
@@ -1578,7 +2343,7 @@ static ib_status_t execute_phase_rule(ib_rule_exec_t *rule_exec,
      * returns an error.  This needs further discussion to determine what the
      * correct behavior should be.
      */
-    trc = execute_phase_rule_targets(rule_exec);
+    trc = execute_phase_rule_targets(rule_exec, program, rec);
     if (trc != IB_OK) {
         rc = trc;
         goto cleanup;
@@ -1593,11 +2358,12 @@ static ib_status_t execute_phase_rule(ib_rule_exec_t *rule_exec,
      *
      * @note Chaining is currently done via recursion.
      */
-    if ( (rule_exec->result != 0) && (rule->chained_rule != NULL) ) {
+    if ( (rule_exec->result != 0) && (rec->chain != IB_RULE_PROG_NONE) ) {
         ib_rule_log_debug(rule_exec,
                           "Chaining to rule \"%s\"",
                           ib_rule_id(rule->chained_rule));
-        trc = execute_phase_rule(rule_exec, rule->chained_rule, recursion);
+        trc = execute_phase_rule(rule_exec, program,
+                                 &(program->recs[rec->chain]), recursion);
 
         if (trc != IB_OK) {
             ib_rule_log_error(rule_exec,
@@ -1720,15 +2486,16 @@ static ib_status_t run_phase_rules(ib_engine_t *ib,
     const ib_rule_phase_meta_t *meta = (const ib_rule_phase_meta_t *) cbdata;
     ib_context_t               *ctx = tx->ctx;
     const ib_ruleset_phase_t   *ruleset_phase;
+    const ib_rule_program_t    *program;
     ib_rule_exec_t             *rule_exec;
-    ib_list_t                  *rules;
-    ib_list_node_t             *node = NULL;
+    size_t                      num_rules;
+    size_t                      n;
     ib_status_t                rc = IB_OK;
 
     ruleset_phase = &(ctx->rules->ruleset.phases[meta->phase_num]);
     assert(ruleset_phase != NULL);
-    rules = ruleset_phase->rule_list;
-    assert(rules != NULL);
+    program = ruleset_phase->program;
+    num_rules = (program == NULL) ? 0 : program->num_rules;
 
     /* Create the rule execution object */
     rc = ib_rule_exec_create(tx, &rule_exec);
@@ -1743,7 +2510,7 @@ static ib_status_t run_phase_rules(ib_engine_t *ib,
     ib_rule_log_tx_event_start(rule_exec, event);
     ib_rule_log_phase(rule_exec,
                       meta->phase_num, phase_name(meta),
-                      ib_list_elements(rules));
+                      num_rules);
 
     /* Allow (skip) this phase? */
     if (rule_allow(tx, meta, NULL, false)) {
@@ -1780,7 +2547,7 @@ static ib_status_t run_phase_rules(ib_engine_t *ib,
     }
 
     /* Walk through the rules & execute them */
-    if (IB_LIST_ELEMENTS(rules) == 0) {
+    if (num_rules == 0) {
         ib_rule_log_tx_debug(tx,
                              "No rules for phase %d/\"%s\" in context \"%s\"",
                              meta->phase_num, phase_name(meta),
@@ -1791,7 +2558,7 @@ static ib_status_t run_phase_rules(ib_engine_t *ib,
     ib_rule_log_tx_debug(tx,
                          "Executing %zd rules for phase %d/\"%s\" "
                          "in context \"%s\"",
-                         IB_LIST_ELEMENTS(rules),
+                         num_rules,
                          meta->phase_num, phase_name(meta),
                          ib_context_full_get(ctx));
 
@@ -1801,27 +2568,21 @@ static ib_status_t run_phase_rules(ib_engine_t *ib,
      * @todo The current behavior is to keep running even after rule execution
      * returns an error.  This needs further discussion to determine what the
      * correct behavior should be.
+     *
+     * Invalid / disabled rules were left out when the program was built.
      */
-    IB_LIST_LOOP(rules, node) {
-        ib_rule_ctx_data_t *ctx_rule = (ib_rule_ctx_data_t *)node->data;
-        ib_rule_t          *rule;
-        ib_status_t         rule_rc;
-
-        /* Skip invalid / disabled rules */
-        rule = ctx_rule->rule;
-        if (! rule_is_runnable(ctx_rule, rule)) {
-            ib_rule_log_tx_debug(tx,
-                                 "Not executing invalid/disabled phase rule");
-            continue;
-        }
+    for (n = 0; n < num_rules; ++n) {
+        const ib_rule_prog_rec_t *rec = &(program->recs[n]);
+        ib_status_t               rule_rc;
 
         /* Allow (skip) this phase? */
-        if (rule_allow(tx, meta, rule, true)) {
+        if (rule_allow(tx, meta, rec->rule, true)) {
             break;
         }
 
         /* Execute the rule, it's actions and chains */
-        rule_rc = execute_phase_rule(rule_exec, rule, MAX_CHAIN_RECURSION);
+        rule_rc = execute_phase_rule(rule_exec, program, rec,
+                                     MAX_CHAIN_RECURSION);
 
         /* Handle declined return code. Did this block? */
         if (ib_tx_flags_isset(tx, IB_TX_BLOCK_IMMEDIATE) ) {
@@ -1891,6 +2652,9 @@ static ib_status_t execute_stream_operator(ib_rule_exec_t *rule_exec,
     ib_num_t         result = 0;
     ib_status_t      op_rc;
     ib_status_t      act_rc;
+    ib_rule_profile_counters_t *counters =
+        rule_profile_counters(rule_exec, rule);
+    uint64_t         start = 0;
 
     /* Add a target execution result to the log object */
     ib_rule_log_exec_add_stream_tgt(rule_exec->exec_log, value);
@@ -1904,7 +2668,14 @@ static ib_status_t execute_stream_operator(ib_rule_exec_t *rule_exec,
     }
 
     /* Execute the rule operator */
+    if (counters != NULL) {
+        ++counters->targets;
+        start = rule_profile_now();
+    }
     op_rc = ib_operator_execute(rule_exec, rule->opinst, value, &result);
+    if (counters != NULL) {
+        counters->operator_ns += rule_profile_now() - start;
+    }
     if (op_rc != IB_OK) {
         ib_rule_log_error(rule_exec, "Operator returned an error: %s",
                           ib_status_to_string(op_rc));
@@ -1940,6 +2711,10 @@ static ib_status_t execute_stream_operator(ib_rule_exec_t *rule_exec,
     else {
         actions = rule_exec->rule->false_actions;
     }
+    if (counters != NULL) {
+        counters->matches += (result != 0);
+        counters->actions += (actions == NULL) ? 0 : ib_list_elements(actions);
+    }
 
     ib_rule_log_exec_add_result(rule_exec->exec_log, value, result);
     act_rc = execute_action_list(rule_exec, result, actions);
@@ -2162,6 +2937,7 @@ static ib_status_t run_stream_rules(ib_engine_t *ib,
             (const ib_rule_ctx_data_t *)node->data;
         const ib_rule_t    *rule;
         ib_status_t         trc;
+        ib_rule_profile_counters_t *counters;
 
         /* Reset status */
         rc = IB_OK;
@@ -2184,6 +2960,10 @@ static ib_status_t run_stream_rules(ib_engine_t *ib,
         if (trc != IB_OK) {
             break;
         }
+        counters = rule_profile_counters(rule_exec, rule);
+        if (counters != NULL) {
+            ++counters->invocations;
+        }
 
         /*
          * Execute the rule
@@ -2578,6 +3358,22 @@ static ib_status_t create_rule_engine(const ib_engine_t *ib,
         return rc;
     }
 
+    rc = ib_hash_create_nocase(&(rule_engine->target_slots), mp);
+    if (rc != IB_OK) {
+        ib_log_error(ib,
+                     "Rule engine failed to create target slot hash: %s",
+                     ib_status_to_string(rc));
+        return rc;
+    }
+
+    rc = ib_hash_create(&(rule_engine->ruleset_cache), mp);
+    if (rc != IB_OK) {
+        ib_log_error(ib,
+                     "Rule engine failed to create rule set cache: %s",
+                     ib_status_to_string(rc));
+        return rc;
+    }
+
     *p_rule_engine = rule_engine;
     return IB_OK;
 }
@@ -2704,54 +3500,108 @@ static ib_status_t copy_rule_hash(const ib_context_t *ctx,
         assert(node->data != NULL);
         const ib_rule_t *rule = (const ib_rule_t *)node->data;
 
-        rc = ib_hash_set(dest_hash, rule->meta.id, node->data);
-        if (rc != IB_OK) {
-            return rc;
-        }
-    }
-    return IB_OK;
+        rc = ib_hash_set(dest_hash, rule->meta.id, node->data);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+    return IB_OK;
+}
+
+/**
+ * Import a rule's context from it's parent
+ *
+ * The parent's rules, rule hash and enable / disable lists are shared, not
+ * copied; see rule_context_unshare().
+ *
+ * @param[in,out] parent_rules Parent's rule context object
+ * @param[in,out] ctx_rules Rule context object
+ */
+static void import_rule_context(ib_rule_context_t *parent_rules,
+                                ib_rule_context_t *ctx_rules)
+{
+    assert(parent_rules != NULL);
+    assert(ctx_rules != NULL);
+
+    ctx_rules->rule_list    = parent_rules->rule_list;
+    ctx_rules->rule_hash    = parent_rules->rule_hash;
+    ctx_rules->enable_list  = parent_rules->enable_list;
+    ctx_rules->disable_list = parent_rules->disable_list;
+    ctx_rules->shared       = true;
+    parent_rules->shared    = true;
 }
 
 /**
- * Import a rule's context from it's parent
+ * Give a context private copies of rules it may share with another context.
  *
- * @param[in] ctx Context being imported to
- * @param[in] parent_rules Parent's rule context object
- * @param[in,out] ctx_rules Rule context object
+ * Must be called before modifying the context's rule list, rule hash or
+ * enable / disable lists.
+ *
+ * @param[in] ctx Context
  *
  * @returns Status code
  */
-static ib_status_t import_rule_context(const ib_context_t *ctx,
-                                       const ib_rule_context_t *parent_rules,
-                                       ib_rule_context_t *ctx_rules)
+static ib_status_t rule_context_unshare(ib_context_t *ctx)
 {
-    assert(parent_rules != NULL);
-    assert(ctx_rules != NULL);
-    ib_status_t rc;
+    assert(ctx != NULL);
+    assert(ctx->rules != NULL);
+
+    ib_rule_context_t *ctx_rules = ctx->rules;
+    ib_list_t         *rule_list;
+    ib_list_t         *enable_list;
+    ib_list_t         *disable_list;
+    ib_hash_t         *rule_hash;
+    ib_status_t        rc;
 
-    /* Copy rules list */
-    rc = copy_rule_list(parent_rules->rule_list, ctx_rules->rule_list);
+    if (! ctx_rules->shared) {
+        return IB_OK;
+    }
+
+    rc = ib_list_create(&rule_list, ctx->mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = copy_rule_list(ctx_rules->rule_list, rule_list);
     if (rc != IB_OK) {
         return rc;
     }
 
-    /* Copy enable list */
-    rc = copy_rule_list(parent_rules->enable_list, ctx_rules->enable_list);
+    rc = ib_list_create(&enable_list, ctx->mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = copy_rule_list(ctx_rules->enable_list, enable_list);
     if (rc != IB_OK) {
         return rc;
     }
 
-    /* Copy disable list */
-    rc = copy_rule_list(parent_rules->disable_list, ctx_rules->disable_list);
+    rc = ib_list_create(&disable_list, ctx->mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = copy_rule_list(ctx_rules->disable_list, disable_list);
     if (rc != IB_OK) {
         return rc;
     }
 
-    /* Copy rule hash */
-    rc = copy_rule_hash(ctx, parent_rules->rule_hash, ctx_rules->rule_hash);
+    rc = ib_hash_create_nocase(&rule_hash, ctx->mp);
     if (rc != IB_OK) {
         return rc;
     }
+    rc = copy_rule_hash(ctx, ctx_rules->rule_hash, rule_hash);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    ctx_rules->rule_list    = rule_list;
+    ctx_rules->enable_list  = enable_list;
+    ctx_rules->disable_list = disable_list;
+    ctx_rules->rule_hash    = rule_hash;
+    ctx_rules->shared       = false;
+
+    ib_log_debug3(ctx->ib, "Copied shared rules of context \"%s\"",
+                  ib_context_full_get(ctx));
+
     return IB_OK;
 }
 
@@ -2813,13 +3663,7 @@ ib_status_t ib_rule_engine_ctx_open(ib_engine_t *ib,
 
     /* If this is a location context, import our parents context info */
     if (ctx->ctype == IB_CTYPE_LOCATION) {
-        rc = import_rule_context(ctx, ctx->parent->rules, ctx->rules);
-        if (rc != IB_OK) {
-            ib_log_error(ib,
-                         "Rule engine failed to import from parent: %s",
-                         ib_status_to_string(rc));
-            return rc;
-        }
+        import_rule_context(ctx->parent->rules, ctx->rules);
     }
 
     return IB_OK;
@@ -2977,6 +3821,430 @@ static ib_status_t enable_rules(ib_engine_t *ib,
     return IB_OK;
 }
 
+/**
+ * Create a pre-parsed data target, sharing data slots by field key.
+ *
+ * @param[in] ib Engine
+ * @param[in] name Field name
+ * @param[in] nlen Length of @a name
+ * @param[out] ptarget Created target
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if @a name can't be pre-parsed.
+ * - IB_EALLOC on allocation failure.
+ */
+static ib_status_t rule_data_target_create(ib_engine_t *ib,
+                                           const char *name,
+                                           size_t nlen,
+                                           ib_data_target_t **ptarget)
+{
+    assert(ib != NULL);
+    assert(name != NULL);
+    assert(ptarget != NULL);
+
+    ib_rule_engine_t *rule_engine = ib->rule_engine;
+    ib_mpool_t       *mp = ib_rule_mpool(ib);
+    const char       *marker;
+    size_t            klen;
+    size_t           *slot;
+    ib_status_t       rc;
+
+    marker = memchr(name, ':', nlen);
+    klen = (marker == NULL) ? nlen : (size_t)(marker - name);
+
+    rc = ib_hash_get_ex(rule_engine->target_slots, &slot, name, klen);
+    if (rc == IB_ENOENT) {
+        const char *key = ib_mpool_memdup(mp, name, klen);
+
+        slot = ib_mpool_alloc(mp, sizeof(*slot));
+        if ( (key == NULL) || (slot == NULL) ) {
+            return IB_EALLOC;
+        }
+        *slot = rule_engine->num_target_slots++;
+        rc = ib_hash_set_ex(rule_engine->target_slots, key, klen, slot);
+    }
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    return ib_data_target_create(mp, name, nlen, *slot, ptarget);
+}
+
+/**
+ * Resolve a rule target's field name into a pre-parsed data target.
+ *
+ * Targets that share a field key share a data slot.  Targets whose name
+ * can't be pre-parsed are left alone; they fall back to ib_data_get() at
+ * execution time, which reports the error as before.
+ *
+ * @param[in] ib Engine
+ * @param[in,out] target Rule target to resolve
+ *
+ * @returns Status code
+ */
+static ib_status_t compile_rule_target(ib_engine_t *ib,
+                                       ib_rule_target_t *target)
+{
+    assert(ib != NULL);
+    assert(target != NULL);
+
+    const char       *fname = target->field_name;
+    ib_status_t       rc;
+
+    if (target->data_target != NULL) {
+        return IB_OK;
+    }
+
+    rc = rule_data_target_create(ib, fname, strlen(fname),
+                                 &(target->data_target));
+    if (rc == IB_EINVAL) {
+        ib_log_debug2(ib, "Target \"%s\" will be resolved at runtime",
+                      fname);
+        target->data_target = NULL;
+        return IB_OK;
+    }
+
+    return rc;
+}
+
+/**
+ * Create data targets for the field names of an expansion.
+ *
+ * @param[in] cbdata Engine (ib_engine_t *)
+ * @param[in] name Field name
+ * @param[in] nlen Length of @a name
+ * @param[out] ptarget Created target
+ *
+ * @returns Status code of rule_data_target_create()
+ */
+static ib_status_t rule_expand_target_fn(void *cbdata,
+                                         const char *name,
+                                         size_t nlen,
+                                         ib_data_target_t **ptarget)
+{
+    return rule_data_target_create((ib_engine_t *)cbdata, name, nlen,
+                                   ptarget);
+}
+
+ib_status_t ib_rule_expand_compile(ib_engine_t *ib,
+                                   const char *str,
+                                   size_t slen,
+                                   ib_data_expand_t **pexpand)
+{
+    assert(ib != NULL);
+    assert(ib->rule_engine != NULL);
+    assert(str != NULL);
+    assert(pexpand != NULL);
+
+    return ib_data_expand_compile(ib_rule_mpool(ib), str, slen,
+                                  rule_expand_target_fn, ib, pexpand);
+}
+
+/**
+ * Resolve the targets of a rule and all rules chained to it.
+ *
+ * @param[in] ib Engine
+ * @param[in,out] rule Rule
+ *
+ * @returns Status code
+ */
+static ib_status_t compile_rule_targets(ib_engine_t *ib,
+                                        ib_rule_t *rule)
+{
+    assert(ib != NULL);
+    assert(rule != NULL);
+
+    for (; rule != NULL; rule = rule->chained_rule) {
+        const ib_list_node_t *node;
+
+        IB_LIST_LOOP_CONST(rule->target_fields, node) {
+            ib_rule_target_t *target =
+                (ib_rule_target_t *)ib_list_node_data_const(node);
+            ib_status_t rc = compile_rule_target(ib, target);
+            if (rc != IB_OK) {
+                return rc;
+            }
+        }
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Fill in a rule program record from a rule.
+ *
+ * Appends the rule's targets, transformations and actions to the program's
+ * arrays at the positions given by the running counters.
+ *
+ * @param[in,out] program Program being built
+ * @param[out] rec Record to fill in
+ * @param[in] rule Rule
+ * @param[in,out] num_targets Targets used so far
+ * @param[in,out] num_tfns Transformations used so far
+ * @param[in,out] num_actions Actions used so far
+ */
+static void fill_rule_prog_rec(ib_rule_program_t *program,
+                               ib_rule_prog_rec_t *rec,
+                               ib_rule_t *rule,
+                               size_t *num_targets,
+                               size_t *num_tfns,
+                               size_t *num_actions)
+{
+    const ib_list_node_t *node;
+    const ib_list_node_t *tfn_node;
+
+    rec->rule = rule;
+    rec->opinst = rule->opinst;
+    rec->flags = rule->flags;
+    rec->chain = IB_RULE_PROG_NONE;
+
+    rec->target_start = *num_targets;
+    IB_LIST_LOOP_CONST(rule->target_fields, node) {
+        ib_rule_prog_target_t *ptarget = &(program->targets[*num_targets]);
+
+        ptarget->target = (ib_rule_target_t *)ib_list_node_data_const(node);
+        ptarget->tfn_start = *num_tfns;
+        IB_LIST_LOOP_CONST(ptarget->target->tfn_list, tfn_node) {
+            program->tfns[(*num_tfns)++] =
+                (const ib_tfn_t *)ib_list_node_data_const(tfn_node);
+        }
+        ptarget->num_tfns = *num_tfns - ptarget->tfn_start;
+        ++(*num_targets);
+    }
+    rec->num_targets = *num_targets - rec->target_start;
+
+    rec->true_start = *num_actions;
+    IB_LIST_LOOP_CONST(rule->true_actions, node) {
+        program->actions[(*num_actions)++] =
+            (const ib_action_inst_t *)ib_list_node_data_const(node);
+    }
+    rec->num_true = *num_actions - rec->true_start;
+
+    rec->false_start = *num_actions;
+    IB_LIST_LOOP_CONST(rule->false_actions, node) {
+        program->actions[(*num_actions)++] =
+            (const ib_action_inst_t *)ib_list_node_data_const(node);
+    }
+    rec->num_false = *num_actions - rec->false_start;
+}
+
+/**
+ * Build the rule program for a phase from its rule list.
+ *
+ * Each array of the program is a single allocation so that the rule loop
+ * walks contiguous memory instead of list nodes.
+ *
+ * @param[in] ib Engine
+ * @param[in] mp Memory pool to allocate the program from
+ * @param[in,out] ruleset_phase Phase to build the program for
+ *
+ * @returns Status code
+ */
+static ib_status_t build_rule_program(ib_engine_t *ib,
+                                      ib_mpool_t *mp,
+                                      ib_ruleset_phase_t *ruleset_phase)
+{
+    assert(ib != NULL);
+    assert(mp != NULL);
+    assert(ruleset_phase != NULL);
+
+    ib_rule_program_t    *program;
+    const ib_list_node_t *node;
+    size_t                num_rules = 0;
+    size_t                num_recs = 0;
+    size_t                num_targets = 0;
+    size_t                num_tfns = 0;
+    size_t                num_actions = 0;
+    size_t                rule_num;
+    size_t                chain_num;
+
+    /* Pass 1: size the arrays */
+    IB_LIST_LOOP_CONST(ruleset_phase->rule_list, node) {
+        const ib_rule_ctx_data_t *ctx_rule =
+            (const ib_rule_ctx_data_t *)ib_list_node_data_const(node);
+        const ib_rule_t *rule;
+
+        if (! rule_is_runnable(ctx_rule, ctx_rule->rule)) {
+            continue;
+        }
+        ++num_rules;
+        for (rule = ctx_rule->rule; rule != NULL; rule = rule->chained_rule) {
+            const ib_list_node_t *tnode;
+
+            ++num_recs;
+            num_targets += ib_list_elements(rule->target_fields);
+            IB_LIST_LOOP_CONST(rule->target_fields, tnode) {
+                const ib_rule_target_t *target =
+                    (const ib_rule_target_t *)ib_list_node_data_const(tnode);
+                num_tfns += ib_list_elements(target->tfn_list);
+            }
+            num_actions += ib_list_elements(rule->true_actions);
+            num_actions += ib_list_elements(rule->false_actions);
+        }
+    }
+
+    program = ib_mpool_calloc(mp, 1, sizeof(*program));
+    if (program == NULL) {
+        return IB_EALLOC;
+    }
+    program->num_rules = num_rules;
+    program->num_recs = num_recs;
+    if (num_recs != 0) {
+        program->recs = ib_mpool_calloc(mp, num_recs, sizeof(*program->recs));
+        program->targets =
+            ib_mpool_calloc(mp, num_targets, sizeof(*program->targets));
+        if ( (program->recs == NULL) || (program->targets == NULL) ) {
+            return IB_EALLOC;
+        }
+    }
+    if (num_tfns != 0) {
+        program->tfns = ib_mpool_calloc(mp, num_tfns, sizeof(*program->tfns));
+        if (program->tfns == NULL) {
+            return IB_EALLOC;
+        }
+    }
+    if (num_actions != 0) {
+        program->actions =
+            ib_mpool_calloc(mp, num_actions, sizeof(*program->actions));
+        if (program->actions == NULL) {
+            return IB_EALLOC;
+        }
+    }
+
+    /* Pass 2: top-level rules first, in order, then their chains */
+    num_targets = num_tfns = num_actions = 0;
+    rule_num = 0;
+    chain_num = num_rules;
+    IB_LIST_LOOP_CONST(ruleset_phase->rule_list, node) {
+        const ib_rule_ctx_data_t *ctx_rule =
+            (const ib_rule_ctx_data_t *)ib_list_node_data_const(node);
+        ib_rule_prog_rec_t *rec;
+        ib_rule_t          *rule;
+
+        if (! rule_is_runnable(ctx_rule, ctx_rule->rule)) {
+            continue;
+        }
+        rec = &(program->recs[rule_num++]);
+        fill_rule_prog_rec(program, rec, ctx_rule->rule,
+                           &num_targets, &num_tfns, &num_actions);
+        for (rule = ctx_rule->rule->chained_rule;
+             rule != NULL;
+             rule = rule->chained_rule)
+        {
+            rec->chain = chain_num;
+            rec = &(program->recs[chain_num++]);
+            fill_rule_prog_rec(program, rec, rule,
+                               &num_targets, &num_tfns, &num_actions);
+        }
+    }
+    assert(rule_num == num_rules);
+    assert(chain_num == num_recs);
+
+    ruleset_phase->program = program;
+    ib_log_debug2(ib, "Built rule program for phase %d/\"%s\": "
+                  "%zd rules, %zd records, %zd targets",
+                  ruleset_phase->phase_num,
+                  phase_name(ruleset_phase->phase_meta),
+                  num_rules, num_recs, num_targets);
+
+    return IB_OK;
+}
+
+/**
+ * Append the key of a list of enables / disables to a rule set key.
+ *
+ * @param[in,out] key Key buffer
+ * @param[in] size Size of @a key
+ * @param[in,out] len Length of @a key
+ * @param[in] list List of ib_rule_enable_t
+ */
+static void ruleset_key_enables(char *key,
+                                size_t size,
+                                size_t *len,
+                                const ib_list_t *list)
+{
+    const ib_list_node_t *node;
+
+    IB_LIST_LOOP_CONST(list, node) {
+        const ib_rule_enable_t *enable =
+            (const ib_rule_enable_t *)ib_list_node_data_const(node);
+        const char *str = (enable->enable_str == NULL) ?
+            "" : enable->enable_str;
+
+        *len += snprintf(key + *len, size - *len, "%d:%zd:%s,",
+                         (int)enable->enable_type, strlen(str), str);
+    }
+    *len += snprintf(key + *len, size - *len, "|");
+}
+
+/**
+ * Build the key of the compiled rule set of a location context.
+ *
+ * The rule set of a location context is a function of the rules of the
+ * main context, its own (or inherited) rules and its enables / disables.
+ * Contexts with equal keys compile to equal rule sets, so sites and
+ * locations that only inherit rules share them.
+ *
+ * @param[in] ib Engine
+ * @param[in] ctx Location context
+ * @param[out] pkey Key, allocated from the temporary pool
+ *
+ * @returns Status code
+ */
+static ib_status_t ruleset_key(ib_engine_t *ib,
+                               const ib_context_t *ctx,
+                               const char **pkey)
+{
+    assert(ib != NULL);
+    assert(ctx != NULL);
+    assert(pkey != NULL);
+
+    const ib_rule_context_t *ctx_rules = ctx->rules;
+    const ib_rule_context_t *main_rules = ib_context_main(ib)->rules;
+    const ib_list_node_t    *node;
+    const ib_list_t         *lists[2];
+    char                    *key;
+    size_t                   size;
+    size_t                   len = 0;
+    int                      n;
+
+    /* Size: main version, one pointer per rule, enables and disables */
+    size = 64 +
+        ib_list_elements(ctx_rules->rule_list) * (sizeof(void *) * 2 + 4);
+    lists[0] = ctx_rules->enable_list;
+    lists[1] = ctx_rules->disable_list;
+    for (n = 0; n < 2; ++n) {
+        IB_LIST_LOOP_CONST(lists[n], node) {
+            const ib_rule_enable_t *enable =
+                (const ib_rule_enable_t *)ib_list_node_data_const(node);
+            size += 48;
+            if (enable->enable_str != NULL) {
+                size += strlen(enable->enable_str);
+            }
+        }
+    }
+
+    key = ib_mpool_alloc(ib_engine_pool_temp_get(ib), size);
+    if (key == NULL) {
+        return IB_EALLOC;
+    }
+
+    len += snprintf(key, size, "%p:%zd|", (void *)main_rules,
+                    main_rules->version);
+    IB_LIST_LOOP_CONST(ctx_rules->rule_list, node) {
+        len += snprintf(key + len, size - len, "%p,",
+                        ib_list_node_data_const(node));
+    }
+    len += snprintf(key + len, size - len, "|");
+    ruleset_key_enables(key, size, &len, ctx_rules->enable_list);
+    ruleset_key_enables(key, size, &len, ctx_rules->disable_list);
+    assert(len < size);
+
+    *pkey = key;
+    return IB_OK;
+}
+
 ib_status_t ib_rule_engine_ctx_close(ib_engine_t *ib,
                                      ib_module_t *mod,
                                      ib_context_t *ctx)
@@ -2989,13 +4257,29 @@ ib_status_t ib_rule_engine_ctx_close(ib_engine_t *ib,
     ib_list_node_t *node;
     ib_flags_t      skip_flags;
     ib_context_t   *main_ctx = ib_context_main(ib);
+    const char     *key;
+    ib_ruleset_t   *cached;
     ib_status_t     rc;
+    int             n;
 
     /* Don't enable rules for non-location contexts */
     if (ctx->ctype != IB_CTYPE_LOCATION) {
         return IB_OK;
     }
 
+    /* Share the rule set of a context with the same rules, if any */
+    rc = ruleset_key(ib, ctx, &key);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = ib_hash_get(ib->rule_engine->ruleset_cache, &cached, key);
+    if (rc == IB_OK) {
+        ctx->rules->ruleset = *cached;
+        ib_log_debug2(ib, "Context \"%s\" shares a compiled rule set",
+                      ib_context_full_get(ctx));
+        return IB_OK;
+    }
+
     /* Create the list of all rules */
     rc = ib_list_create(&all_rules, ctx->mp);
     if (rc != IB_OK) {
@@ -3181,6 +4465,15 @@ ib_status_t ib_rule_engine_ctx_close(ib_engine_t *ib,
         assert(ruleset_phase->phase_meta == rule->phase_meta);
         phase_rule_list = ruleset_phase->rule_list;
 
+        /* Resolve its targets so execution skips name lookups */
+        rc = compile_rule_targets(ib, rule);
+        if (rc != IB_OK) {
+            ib_log_error(ib,
+                         "Failed to resolve targets of rule \"%s\": %s",
+                         ib_rule_id(rule), ib_status_to_string(rc));
+            return rc;
+        }
+
         /* Add it to the list */
         rc = ib_list_push(phase_rule_list, (void *)ctx_rule);
         if (rc != IB_OK) {
@@ -3204,6 +4497,35 @@ ib_status_t ib_rule_engine_ctx_close(ib_engine_t *ib,
                      ib_context_full_get(ctx));
     }
 
+    /* Step 8: Build the rule programs for the non-stream phases */
+    for (n = 0; n < IB_RULE_PHASE_COUNT; ++n) {
+        ib_ruleset_phase_t *ruleset_phase = &(ctx->rules->ruleset.phases[n]);
+
+        if (ruleset_phase->phase_meta->is_stream) {
+            continue;
+        }
+        rc = build_rule_program(ib, ctx->mp, ruleset_phase);
+        if (rc != IB_OK) {
+            ib_log_error(ib,
+                         "Failed to build rule program for phase %d "
+                         "context=\"%s\": %s",
+                         ruleset_phase->phase_num, ib_context_full_get(ctx),
+                         ib_status_to_string(rc));
+            return rc;
+        }
+    }
+
+    /* Step 9: Let contexts with the same rules share the rule set */
+    key = ib_mpool_strdup(ib_rule_mpool(ib), key);
+    if (key == NULL) {
+        return IB_EALLOC;
+    }
+    rc = ib_hash_set(ib->rule_engine->ruleset_cache, key,
+                     &(ctx->rules->ruleset));
+    if (rc != IB_OK) {
+        return rc;
+    }
+
     ib_rule_log_flags_dump(ib, ctx);
 
     return IB_OK;
@@ -3791,6 +5113,13 @@ ib_status_t ib_rule_register(ib_engine_t *ib,
         return IB_EEXIST;
     }
 
+    /* The context's rules may be shared with its parent or children */
+    rc = rule_context_unshare(ctx);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    ++context_rules->version;
+
     /* Remove the old version from the hash */
     if (lookup != NULL) {
         ib_hash_remove(context_rules->rule_hash, NULL, rule->meta.id);
@@ -3858,6 +5187,13 @@ ib_status_t ib_rule_register(ib_engine_t *ib,
                              rule->meta.revision);
     }
 
+    /* Assign the rule an engine-wide index */
+    rc = ib_list_push(ib->rule_engine->rule_list, rule);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rule->index = ib->rule_engine->num_rules++;
+
     /* Mark the rule as valid */
     rule->flags |= IB_RULE_FLAG_VALID;
 
@@ -3900,6 +5236,13 @@ ib_status_t ib_rule_enable(const ib_engine_t *ib,
     item->file = file;
     item->lineno = lineno;
 
+    /* The context's lists may be shared with its parent or children */
+    rc = rule_context_unshare(ctx);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    ++ctx->rules->version;
+
     /* Add the item to the appropriate list */
     if (enable) {
         rc = ib_list_push(ctx->rules->enable_list, item);
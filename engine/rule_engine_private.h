@@ -28,9 +28,12 @@
  */
 
 #include <ironbee/clock.h>
+#include <ironbee/data.h>
 #include <ironbee/rule_engine.h>
 #include <ironbee/types.h>
 
+#include <stdint.h>
+
 /**
  * Context-specific rule object.  This is the type of the objects
  * stored in the 'rule_list' field of ib_ruleset_phase_t.
@@ -40,6 +43,56 @@ typedef struct {
     ib_flags_t             flags;        /**< Rule flags (IB_RULECTX_FLAG_xx) */
 } ib_rule_ctx_data_t;
 
+/** Index value meaning "no record" in a rule program */
+#define IB_RULE_PROG_NONE SIZE_MAX
+
+/**
+ * Compiled rule target.
+ *
+ * The target's transformations are stored as a slice of the program's
+ * tfns array.
+ */
+typedef struct {
+    ib_rule_target_t      *target;       /**< The rule target */
+    size_t                 tfn_start;    /**< First tfn in program tfns */
+    size_t                 num_tfns;     /**< Number of tfns */
+} ib_rule_prog_target_t;
+
+/**
+ * Compiled rule record.
+ *
+ * Targets and actions are slices of the owning program's arrays; chained
+ * rules are records of the same program referenced by index.
+ */
+typedef struct {
+    ib_rule_t                *rule;         /**< The rule */
+    const ib_operator_inst_t *opinst;       /**< Rule operator */
+    ib_flags_t                flags;        /**< Copy of the rule flags */
+    size_t                    target_start; /**< First target in targets */
+    size_t                    num_targets;  /**< Number of targets */
+    size_t                    true_start;   /**< First True action */
+    size_t                    num_true;     /**< Number of True actions */
+    size_t                    false_start;  /**< First False action */
+    size_t                    num_false;    /**< Number of False actions */
+    size_t                    chain;        /**< Chained record index */
+} ib_rule_prog_rec_t;
+
+/**
+ * Compiled rules for a single (context, phase).
+ *
+ * Built by ib_rule_engine_ctx_close() from the phase's rule list.  Only
+ * enabled, valid rules are included; they are recs[0 .. num_rules), in
+ * execution order, and are followed by the records of chained rules.
+ */
+typedef struct {
+    ib_rule_prog_rec_t      *recs;       /**< Rule records */
+    size_t                   num_recs;   /**< Total number of records */
+    size_t                   num_rules;  /**< Number of top-level records */
+    ib_rule_prog_target_t   *targets;    /**< All targets */
+    const ib_tfn_t         **tfns;       /**< All transformations */
+    const ib_action_inst_t **actions;    /**< All actions */
+} ib_rule_program_t;
+
 /**
  * Ruleset for a single phase.
  *  rule_list is a list of pointers to ib_rule_ctx_data_t objects.
@@ -48,6 +101,7 @@ typedef struct {
     ib_rule_phase_num_t         phase_num;   /**< Phase number */
     const ib_rule_phase_meta_t *phase_meta;  /**< Rule phase meta-data */
     ib_list_t                  *rule_list;   /**< Rules to execute in phase */
+    ib_rule_program_t          *program;     /**< Compiled rule_list */
 } ib_ruleset_phase_t;
 
 /**
@@ -70,6 +124,10 @@ typedef struct {
 
 /**
  * Rules data for each context.
+ *
+ * A location context shares @a rule_list, @a rule_hash, @a enable_list and
+ * @a disable_list with its parent until either context modifies them;
+ * @a shared is set on both and the modifier copies them first.
  */
 struct ib_rule_context_t {
     ib_ruleset_t           ruleset;      /**< Rules to exec */
@@ -77,6 +135,8 @@ struct ib_rule_context_t {
     ib_hash_t             *rule_hash;    /**< Hash of rules (by rule-id) */
     ib_list_t             *enable_list;  /**< Enable All/IDs/tags */
     ib_list_t             *disable_list; /**< All/IDs/tags disabled */
+    bool                   shared;       /**< Lists/hash may be shared */
+    size_t                 version;      /**< Bumped on every modification */
     ib_rule_parser_data_t  parser_data;  /**< Rule parser specific data */
 };
 
@@ -87,15 +147,26 @@ struct ib_rule_target_t {
     const char            *field_name;    /**< The field name */
     const char            *target_str;    /**< The target string */
     ib_list_t             *tfn_list;      /**< List of transformations */
+    ib_data_target_t      *data_target;   /**< Pre-parsed field (or NULL) */
 };
 
+/**
+ * Rule profiling data; defined in rule_engine.c.
+ */
+typedef struct ib_rule_profile_t ib_rule_profile_t;
+
 /**
  * Rule engine.
  */
 struct ib_rule_engine_t {
-    ib_list_t *rule_list;        /**< All rules owned by this context */
+    ib_list_t *rule_list;        /**< All registered rules, by index */
     ib_hash_t *rule_hash;        /**< Hash of rules (by rule-id) */
     ib_hash_t *external_drivers; /**< Drivers for external rules. */
+    ib_hash_t *target_slots;     /**< Data slot (size_t *) by field key */
+    size_t     num_target_slots; /**< Number of data slots assigned */
+    size_t     num_rules;        /**< Number of rule indexes assigned */
+    ib_hash_t *ruleset_cache;    /**< Compiled ib_ruleset_t by inputs */
+    ib_rule_profile_t *profile;  /**< Profiling data (NULL if disabled) */
 };
 
 /**
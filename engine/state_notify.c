@@ -740,16 +740,27 @@ ib_status_t ib_state_notify_request_header_finished(ib_engine_t *ib,
 ib_status_t ib_state_notify_request_body_data(ib_engine_t *ib,
                                               ib_tx_t *tx,
                                               ib_txdata_t *txdata)
+{
+    assert(txdata != NULL);
+
+    return ib_state_notify_request_body_datav(ib, tx, txdata, 1);
+}
+
+ib_status_t ib_state_notify_request_body_datav(ib_engine_t *ib,
+                                               ib_tx_t *tx,
+                                               const ib_txdata_t *txdata,
+                                               size_t ntxdata)
 {
     assert(ib != NULL);
     assert(ib->cfg_state == CFG_FINISHED);
     assert(tx != NULL);
-    assert(txdata != NULL);
+    assert(txdata != NULL || ntxdata == 0);
 
     ib_provider_inst_t *pi = ib_parser_provider_get_instance(tx->conn->ctx);
     IB_PROVIDER_IFACE_TYPE(parser) *iface =
         pi ? (IB_PROVIDER_IFACE_TYPE(parser) *)pi->pr->iface : NULL;
     ib_status_t rc;
+    size_t i;
 
     if (iface == NULL) {
         ib_log_alert(ib, "Failed to fetch parser interface.");
@@ -769,21 +780,26 @@ ib_status_t ib_state_notify_request_body_data(ib_engine_t *ib,
         ib_tx_flags_set(tx, IB_TX_FREQ_SEENBODY);
     }
 
-    /* Notify the parser of request body data. */
-    if (iface->request_body_data != NULL) {
-        rc = iface->request_body_data(pi, tx, txdata);
+    for (i = 0; i < ntxdata; ++i) {
+        /* Callbacks get a non-const descriptor; the data is not copied. */
+        ib_txdata_t seg = txdata[i];
+
+        /* Notify the parser of request body data. */
+        if (iface->request_body_data != NULL) {
+            rc = iface->request_body_data(pi, tx, &seg);
+            if (rc != IB_OK) {
+                return rc;
+            }
+        }
+
+        /* Notify the engine and any callbacks of the data. */
+        rc = ib_state_notify_txdata(ib, tx, request_body_data_event, &seg);
         if (rc != IB_OK) {
             return rc;
         }
     }
 
-    /* Notify the engine and any callbacks of the data. */
-    rc = ib_state_notify_txdata(ib, tx, request_body_data_event, txdata);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    return rc;
+    return IB_OK;
 }
 
 ib_status_t ib_state_notify_request_finished(ib_engine_t *ib,
@@ -1008,16 +1024,27 @@ ib_status_t ib_state_notify_response_header_finished(ib_engine_t *ib,
 ib_status_t ib_state_notify_response_body_data(ib_engine_t *ib,
                                                ib_tx_t *tx,
                                                ib_txdata_t *txdata)
+{
+    assert(txdata != NULL);
+
+    return ib_state_notify_response_body_datav(ib, tx, txdata, 1);
+}
+
+ib_status_t ib_state_notify_response_body_datav(ib_engine_t *ib,
+                                                ib_tx_t *tx,
+                                                const ib_txdata_t *txdata,
+                                                size_t ntxdata)
 {
     assert(ib != NULL);
     assert(ib->cfg_state == CFG_FINISHED);
     assert(tx != NULL);
-    assert(txdata != NULL);
+    assert(txdata != NULL || ntxdata == 0);
 
     ib_provider_inst_t *pi = ib_parser_provider_get_instance(tx->conn->ctx);
     IB_PROVIDER_IFACE_TYPE(parser) *iface =
         pi ? (IB_PROVIDER_IFACE_TYPE(parser) *)pi->pr->iface : NULL;
     ib_status_t rc;
+    size_t i;
 
     if (iface == NULL) {
         ib_log_alert(ib, "Failed to fetch parser interface.");
@@ -1051,18 +1078,25 @@ ib_status_t ib_state_notify_response_body_data(ib_engine_t *ib,
         ib_tx_flags_set(tx, IB_TX_FRES_SEENBODY);
     }
 
-    /* Notify the parser of response body data. */
-    if (iface->response_body_data != NULL) {
-        rc = iface->response_body_data(pi, tx, txdata);
+    for (i = 0; i < ntxdata; ++i) {
+        ib_txdata_t seg = txdata[i];
+
+        /* Notify the parser of response body data. */
+        if (iface->response_body_data != NULL) {
+            rc = iface->response_body_data(pi, tx, &seg);
+            if (rc != IB_OK) {
+                return rc;
+            }
+        }
+
+        /* Notify the engine and any callbacks of the data. */
+        rc = ib_state_notify_txdata(ib, tx, response_body_data_event, &seg);
         if (rc != IB_OK) {
             return rc;
         }
     }
 
-    /* Notify the engine and any callbacks of the data. */
-    rc = ib_state_notify_txdata(ib, tx, response_body_data_event, txdata);
-
-    return rc;
+    return IB_OK;
 }
 
 ib_status_t ib_state_notify_response_finished(ib_engine_t *ib,
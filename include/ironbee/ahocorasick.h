@@ -51,6 +51,10 @@ extern "C" {
                                               links and output state links
                                               are built */
 #define IB_AC_FLAG_PARSER_READY     0x04 /**< the ac automata is ready */
+#define IB_AC_FLAG_PARSER_DFA       0x08 /**< Compile the trie into a flat
+                                              transition table when links
+                                              are built (faster matching,
+                                              more memory) */
 
 /* Node specific flags */
 #define IB_AC_FLAG_STATE_OUTPUT     0x01 /**< This flag indicates that
@@ -83,6 +87,7 @@ typedef struct ib_ac_t ib_ac_t;
 typedef struct ib_ac_state_t ib_ac_state_t;
 typedef struct ib_ac_context_t ib_ac_context_t;
 typedef struct ib_ac_match_t ib_ac_match_t;
+typedef struct ib_ac_dfa_t ib_ac_dfa_t;
 
 typedef char ib_ac_char_t;
 
@@ -94,6 +99,7 @@ struct ib_ac_t {
     ib_mpool_t *mp;         /**< mem pool */
 
     ib_ac_state_t *root;     /**< root of the direct tree */
+    ib_ac_dfa_t *dfa;        /**< flat transition table, if compiled */
 
     uint32_t pattern_cnt;   /**< number of patterns */
 };
@@ -199,6 +205,10 @@ ib_status_t ib_ac_create(ib_ac_t **ac_tree,
 /**
  * builds links between states (the AC failure function)
  *
+ * If the matcher was created with IB_AC_FLAG_PARSER_DFA, the trie is also
+ * compiled into a flat transition table that ib_ac_consume() uses instead
+ * of walking the trie.
+ *
  * @param ac_tree pointer to store the matcher
  *
  * @returns Status code
@@ -91,6 +91,36 @@ ib_status_t DLL_PUBLIC ib_bytestr_create(ib_bytestr_t **pdst,
                                          ib_mpool_t *pool,
                                          size_t size);
 
+/**
+ * Size of storage needed by ib_bytestr_embed().
+ *
+ * @returns Bytes needed to embed a byte string in another allocation.
+ */
+size_t DLL_PUBLIC ib_bytestr_embed_size(void);
+
+/**
+ * Initialize a byte string in caller provided storage.
+ *
+ * This allows a structure that owns a byte string, such as a field, to
+ * allocate it along with itself.  The byte string uses @a data as is.  If
+ * @a flags contains IB_BYTESTR_FREADONLY the byte string is an alias of
+ * @a data; otherwise @a data must be writable and live as long as @a pool.
+ *
+ * @param storage At least ib_bytestr_embed_size() bytes, suitably aligned,
+ *                that live as long as @a pool.
+ * @param pool Memory pool used if the byte string grows
+ * @param data Memory address which contains the data
+ * @param dlen Length of data
+ * @param flags Byte string flags
+ *
+ * @returns Byte string located at @a storage.
+ */
+ib_bytestr_t DLL_PUBLIC *ib_bytestr_embed(void *storage,
+                                          ib_mpool_t *pool,
+                                          uint8_t *data,
+                                          size_t dlen,
+                                          ib_flags_t flags);
+
 /**
  * Create a byte string as a copy of another byte string.
  *
@@ -73,6 +73,8 @@ struct ib_core_cfg_t {
     ib_num_t         log_level;         /**< Log level */
     const char      *log_uri;           /**< Log URI */
     FILE            *log_fp;            /**< File pointer for log. */
+    ib_num_t         log_mode;          /**< Log mode (sync/async) */
+    ib_num_t         log_buffer_size;   /**< Async log buffer size (bytes) */
     const char      *logevent;          /**< Active logevent provider key */
     ib_list_t       *initvar_list;      /**< List of ib_field_t for InitVar */
     ib_list_t       *mancoll_list;      /**< List of ib_managed_collection_t */
@@ -86,6 +88,11 @@ struct ib_core_cfg_t {
     const ib_logformat_t *auditlog_index_hp; /**< Audit log index fmt helper */
     const char      *auditlog_dir;      /**< Audit log base directory */
     const char      *auditlog_sdir_fmt; /**< Audit log sub-directory format */
+    ib_num_t         auditlog_mode;     /**< Audit log mode (file/segment) */
+    ib_num_t         auditlog_seg_size; /**< Segment rotation size (bytes) */
+    ib_num_t         auditlog_flush_ms; /**< Segment flush interval (ms) */
+    ib_num_t         auditlog_queue_limit; /**< Segment queue limit (bytes) */
+    ib_num_t         auditlog_backpressure; /**< Policy when queue is full */
     const char      *audit;             /**< Active audit provider key */
     const char      *parser;            /**< Active parser provider key */
     const char      *data;              /**< Active data provider key */
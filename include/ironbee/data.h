@@ -210,6 +210,61 @@ ib_status_t DLL_PUBLIC ib_data_get_ex(
     ib_field_t      **pf
 );
 
+/**
+ * Pre-parsed data field name.
+ *
+ * A target holds the result of parsing a field name such as @c FOO,
+ * @c FOO:bar or @c FOO:/regex/ once, including the compiled regex, so that
+ * repeated lookups skip name parsing.  Each target also carries a slot
+ * index; lookups through the same slot are answered from a per-data cache
+ * until the set of top-level fields changes.
+ */
+typedef struct ib_data_target_t ib_data_target_t;
+
+/**
+ * Create a pre-parsed data target.
+ *
+ * Targets sharing a key (the part before any @c :) should share a
+ * @a slot.  Slots should be small, dense integers as each data instance
+ * allocates a cache array indexed by slot on first use.
+ *
+ * @param[in] mp Memory pool; the compiled regex is released with it.
+ * @param[in] name Field name, in the syntax accepted by ib_data_get_ex().
+ * @param[in] nlen Length of @a name.
+ * @param[in] slot Slot index for cached lookups.
+ * @param[out] ptarget The new target.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if @a name is not a valid field name or its filter regex
+ *   fails to compile.
+ * - IB_EALLOC on allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_data_target_create(
+    ib_mpool_t        *mp,
+    const char        *name,
+    size_t             nlen,
+    size_t             slot,
+    ib_data_target_t **ptarget
+);
+
+/**
+ * Get a data field using a pre-parsed target.
+ *
+ * Equivalent to ib_data_get_ex() on the target's name.
+ *
+ * @param[in] data Data.
+ * @param[in] target Target created by ib_data_target_create().
+ * @param[out] pf Pointer where field is written.  Must not be NULL.
+ *
+ * @returns IB_OK on success or IB_ENOENT if the element is not found.
+ */
+ib_status_t DLL_PUBLIC ib_data_target_get(
+    ib_data_t               *data,
+    const ib_data_target_t  *target,
+    ib_field_t             **pf
+);
+
 /**
  * Get all data fields from a data provider instance.
  *
@@ -468,6 +523,87 @@ ib_status_t DLL_PUBLIC ib_data_expand_test_str_ex(
     bool       *result
 );
 
+/**
+ * Pre-compiled expansion string.
+ *
+ * An expansion holds a string parsed once into literal text and the field
+ * names of its "%{"+_name_+"}" references, each pre-parsed into a data
+ * target where possible.  Rendering it performs the same substitutions as
+ * ib_data_expand_str() in a single pass into one allocation.
+ *
+ * Unlike ib_data_expand_str(), substituted field values are never scanned
+ * for further references.
+ */
+typedef struct ib_data_expand_t ib_data_expand_t;
+
+/**
+ * Function to create a data target for a field name of an expansion.
+ *
+ * @param[in] cbdata Callback data.
+ * @param[in] name Field name.
+ * @param[in] nlen Length of @a name.
+ * @param[out] ptarget Created target.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if @a name should be looked up by name when rendering.
+ * - Other on fatal error.
+ */
+typedef ib_status_t (*ib_data_expand_target_fn_t)(
+    void              *cbdata,
+    const char        *name,
+    size_t             nlen,
+    ib_data_target_t **ptarget
+);
+
+/**
+ * Compile a string for expansion.
+ *
+ * @param[in] mp Memory pool to allocate from.
+ * @param[in] str String to compile; copied.
+ * @param[in] slen Length of @a str.
+ * @param[in] target_fn Function to create data targets or NULL to look up
+ *            every field by name when rendering.
+ * @param[in] cbdata Callback data for @a target_fn.
+ * @param[out] pexpand The compiled expansion.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ * - Errors returned by @a target_fn.
+ */
+ib_status_t DLL_PUBLIC ib_data_expand_compile(
+    ib_mpool_t                  *mp,
+    const char                  *str,
+    size_t                       slen,
+    ib_data_expand_target_fn_t   target_fn,
+    void                        *cbdata,
+    ib_data_expand_t           **pexpand
+);
+
+/**
+ * Render a compiled expansion using fields from the data store.
+ *
+ * @param[in] data Data.
+ * @param[in] expand Expansion created by ib_data_expand_compile().
+ * @param[in] nul Append NUL byte to @a result?
+ * @param[out] result The expanded string, allocated from the data's memory
+ *             pool.
+ * @param[out] result_len Length of @a result.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ * - Errors from field lookups other than IB_ENOENT.
+ */
+ib_status_t DLL_PUBLIC ib_data_expand_render(
+    ib_data_t               *data,
+    const ib_data_expand_t  *expand,
+    bool                     nul,
+    char                   **result,
+    size_t                  *result_len
+);
+
 /**
  * @} IronBeeEngineData
  */
@@ -625,6 +625,28 @@ void ib_conn_parser_context_set(ib_conn_t *conn,
  */
 void DLL_PUBLIC *ib_conn_parser_context_get(ib_conn_t *conn);
 
+/**
+ * Get the remote address of a connection in binary form.
+ *
+ * @c remote_ipstr is parsed on the first call and the result is cached on
+ * @a conn until @c remote_ipstr changes, so rules testing the remote
+ * address do not each parse it.
+ *
+ * @param[in] conn Connection structure
+ * @param[out] ip4 Set to the IPv4 address or NULL if it is not IPv4.
+ * @param[out] ip6 Set to the IPv6 address or NULL if it is not IPv6.
+ *
+ * @returns
+ * - IB_OK on success; exactly one of @a ip4 and @a ip6 is set.
+ * - IB_ENOENT if @a conn has no remote address.
+ * - IB_EINVAL if the remote address is not an IP address.
+ */
+ib_status_t DLL_PUBLIC ib_conn_remote_ip(
+    ib_conn_t       *conn,
+    const ib_ip4_t **ip4,
+    const ib_ip6_t **ip6
+);
+
 /**
  * Set connection flags.
  *
@@ -0,0 +1,177 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+#ifndef _IB_ENGINE_MANAGER_H_
+#define _IB_ENGINE_MANAGER_H_
+
+/**
+ * @file
+ * @brief IronBee --- Engine Manager
+ */
+
+#include <ironbee/build.h>
+#include <ironbee/engine.h>
+#include <ironbee/server.h>
+#include <ironbee/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup IronBeeEngineManager Engine Manager
+ * @ingroup IronBeeEngine
+ *
+ * Reload configuration without restarting the server.
+ *
+ * The engine manager owns a current engine and any older engines still in
+ * use.  ib_manager_engine_create() builds and configures a new engine
+ * without disturbing traffic and, if configuration succeeds, publishes it
+ * as the current engine.  Servers acquire the current engine when a
+ * connection opens and release it when the connection is destroyed; an
+ * engine that is no longer current is destroyed when its last reference is
+ * released.  Each engine has its own copy of the module state, so the old
+ * and new engines serve their connections side by side during a reload.
+ *
+ * All functions are thread safe.
+ *
+ * @{
+ */
+
+/** Engine manager; opaque. */
+typedef struct ib_manager_t ib_manager_t;
+
+/**
+ * Function called to set up each new engine.
+ *
+ * Called after ib_engine_create() and before ib_engine_init(); this is the
+ * place to set the logger and register hooks.
+ *
+ * @param[in] ib The new engine.
+ * @param[in] cbdata Callback data.
+ *
+ * @returns Status code; any value other than IB_OK abandons the engine.
+ */
+typedef ib_status_t (*ib_manager_engine_setup_fn_t)(
+    ib_engine_t *ib,
+    void        *cbdata
+);
+
+/**
+ * Create an engine manager.
+ *
+ * ib_initialize() must have been called.  The manager has no engine until
+ * ib_manager_engine_create() succeeds.
+ *
+ * @param[out] pmanager Created manager.
+ * @param[in] server Server passed to ib_engine_create().
+ * @param[in] setup_fn Function to set up new engines or NULL.
+ * @param[in] setup_cbdata Callback data for @a setup_fn.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_manager_create(
+    ib_manager_t                  **pmanager,
+    ib_server_t                    *server,
+    ib_manager_engine_setup_fn_t    setup_fn,
+    void                           *setup_cbdata
+);
+
+/**
+ * Destroy an engine manager and all of its engines.
+ *
+ * All acquired engines should be released first.
+ *
+ * @param[in] manager Manager to destroy.
+ */
+void DLL_PUBLIC ib_manager_destroy(
+    ib_manager_t *manager
+);
+
+/**
+ * Create, configure and publish a new engine.
+ *
+ * Configuration happens in the calling thread, while other threads keep
+ * using the current engine.  The new engine only replaces it if it is
+ * configured successfully.  The replaced engine is destroyed once every
+ * reference to it is released.
+ *
+ * @param[in] manager Engine manager.
+ * @param[in] config_file Configuration file to load.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - Error from engine creation, setup or configuration; the current engine
+ *   is unchanged.
+ */
+ib_status_t DLL_PUBLIC ib_manager_engine_create(
+    ib_manager_t *manager,
+    const char   *config_file
+);
+
+/**
+ * Acquire a reference to the current engine.
+ *
+ * Every successful call must be matched by ib_manager_engine_release().
+ *
+ * @param[in] manager Engine manager.
+ * @param[out] pengine Current engine.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_DECLINED if there is no current engine.
+ */
+ib_status_t DLL_PUBLIC ib_manager_engine_acquire(
+    ib_manager_t  *manager,
+    ib_engine_t  **pengine
+);
+
+/**
+ * Release a reference acquired with ib_manager_engine_acquire().
+ *
+ * @param[in] manager Engine manager.
+ * @param[in] engine Engine to release.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_ENOENT if @a engine is not managed by @a manager.
+ */
+ib_status_t DLL_PUBLIC ib_manager_engine_release(
+    ib_manager_t *manager,
+    ib_engine_t  *engine
+);
+
+/**
+ * Number of engines alive: the current engine and any still in use.
+ *
+ * @param[in] manager Engine manager.
+ *
+ * @returns Number of engines.
+ */
+size_t DLL_PUBLIC ib_manager_engine_count(
+    ib_manager_t *manager
+);
+
+/** @} IronBeeEngineManager */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IB_ENGINE_MANAGER_H_ */
@@ -29,6 +29,7 @@
 #include <ironbee/clock.h>
 #include <ironbee/data.h>
 #include <ironbee/hash.h>
+#include <ironbee/ip.h>
 #include <ironbee/mpool.h>
 #include <ironbee/parsed_content.h>
 #include <ironbee/rule_defs.h>
@@ -192,6 +193,16 @@ struct ib_conn_t {
     const char         *remote_ipstr;    /**< Remote IP as string */
     uint16_t            remote_port;     /**< Remote port */
 
+    /** Parsed @c remote_ipstr; use ib_conn_remote_ip() */
+    struct {
+        const char     *ipstr;           /**< remote_ipstr when parsed */
+        size_t          ipstr_len;       /**< Length of @c ipstr */
+        const ib_ip4_t *ip4;             /**< @c ip4_buf if IPv4 or NULL */
+        const ib_ip6_t *ip6;             /**< @c ip6_buf if IPv6 or NULL */
+        ib_ip4_t        ip4_buf;         /**< IPv4 address */
+        ib_ip6_t        ip6_buf;         /**< IPv6 address */
+    } remote_ip;
+
     const char         *local_ipstr;     /**< Local IP as string */
     uint16_t            local_port;      /**< Local port */
 
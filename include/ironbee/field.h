@@ -603,6 +603,30 @@ ib_status_t DLL_PUBLIC ib_field_create_no_copy(
     void        *mutable_in_pval
 );
 
+/**
+ * Create a list field whose value is a read-only list shared with others.
+ *
+ * The field never modifies @a list: the first time its value is handed
+ * out for modification (ib_field_mutable_value(), ib_field_list_add()),
+ * @a list is copied into @a mp and the copy is modified instead.  Setting
+ * a new value drops @a list.
+ *
+ * @param[out] pf   Address to write new field to.
+ * @param[in]  mp   Memory pool.
+ * @param[in]  name Field name.
+ * @param[in]  nlen Field name length.
+ * @param[in]  list Shared list.
+ *
+ * @returns Status code
+ */
+ib_status_t DLL_PUBLIC ib_field_create_list_view(
+    ib_field_t      **pf,
+    ib_mpool_t       *mp,
+    const char       *name,
+    size_t            nlen,
+    const ib_list_t  *list
+);
+
 /**
  * Create a field but use @a *mutable_out_pval as the storage.
  *
@@ -899,6 +923,9 @@ ib_status_t DLL_PUBLIC ib_field_value_type(
 /**
  * Get the value stored in the field.  Non-dynamic only.
  *
+ * The version of @a f is changed, as the caller may modify the value.  A
+ * list shared by ib_field_create_list_view() is copied first.
+ *
  * @param[in]  f                Field.
  * @param[out] mutable_out_pval Where to store value.
  *
@@ -935,6 +962,62 @@ int DLL_PUBLIC ib_field_is_dynamic(
      const ib_field_t *f
 );
 
+/**
+ * Get the version of a field.
+ *
+ * The version changes whenever the value of a static field is set or
+ * handed out for modification (ib_field_mutable_value()).  It can be used
+ * to detect that data derived from a field is stale.  Values of dynamic
+ * fields and of fields aliasing external storage may change without a
+ * version change.
+ *
+ * @param[in] f Field
+ *
+ * @return Version of @a f.
+ */
+size_t DLL_PUBLIC ib_field_version(
+     const ib_field_t *f
+);
+
+/**
+ * Get the members of list field @a f named @a name.
+ *
+ * Names are compared case insensitively.  The result is the list of
+ * matching members (empty if there are none).
+ *
+ * For lists with at least @ref IB_FIELD_LIST_INDEX_MIN members a name index
+ * is built on first use and kept with @a f, making later lookups O(1) on
+ * average.  Members appended with ib_field_list_add() are added to the
+ * index.  Any other change to @a f (a new version, see ib_field_version())
+ * or to the number of members or the last member of the list causes the
+ * index to be rebuilt.  Results served from the index are shared between
+ * callers and reflect later ib_field_list_add() calls; use
+ * ib_field_create_list_view() to wrap one in a field.
+ *
+ * @param[in] f List field.
+ * @param[in] name Member name.
+ * @param[in] nlen Length of @a name.
+ * @param[out] members Matching members.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if @a f is not a static list field.
+ * - IB_EALLOC on allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_field_list_subfields(
+    const ib_field_t  *f,
+    const char        *name,
+    size_t             nlen,
+    const ib_list_t  **members
+);
+
+/**
+ * Minimum list size for which ib_field_list_subfields() builds an index.
+ *
+ * Smaller lists are scanned.
+ */
+#define IB_FIELD_LIST_INDEX_MIN 8
+
 /**
  * Helper function for providing null terminated strings.
  *
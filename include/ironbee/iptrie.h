@@ -0,0 +1,179 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+#ifndef _IB_IPTRIE_H_
+#define _IB_IPTRIE_H_
+
+/**
+ * @file
+ * @brief IronBee --- IP Trie Utility Functions
+ */
+
+#include <ironbee/build.h>
+#include <ironbee/ip.h>
+#include <ironbee/mpool.h>
+#include <ironbee/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup IronBeeUtilIPTrie IP Trie
+ * @ingroup IronBeeUtil
+ *
+ * Membership tests against large sets of IPv4 and IPv6 networks.
+ *
+ * Where @ref IronBeeUtilIPSet answers richer queries (negative networks,
+ * most specific and most general entries, associated data) with binary
+ * searches, an IP trie only answers whether an address is in any of its
+ * networks, but does so in a few memory accesses regardless of the number
+ * of networks.  It is intended for reputation lists of millions of
+ * prefixes.
+ *
+ * Both families are stored as multibit tries with prefix expansion: a
+ * 65536 entry table indexed by the first 16 bits followed by a node for
+ * each further byte.  Nodes are compressed with bitmaps in the style of
+ * poptrie, costing 72 bytes instead of 256 entries.  A lookup is at most 3
+ * table reads for IPv4 and 15 for IPv6, and stops at the first entry that
+ * is a match or a miss.  Nodes are only created below prefixes that are
+ * split by longer networks, and nothing is allocated for a family without
+ * networks.
+ *
+ * IP tries are static: all networks are provided at creation.
+ *
+ * @{
+ */
+
+/**
+ * An IP trie.  Opaque datastructure.
+ *
+ * @sa ib_iptrie_create()
+ * @sa ib_iptrie_query4()
+ * @sa ib_iptrie_query6()
+ */
+typedef struct ib_iptrie_t ib_iptrie_t;
+
+/**
+ * Create an IP trie.
+ *
+ * The arrays @a net4 and @a net6 are reordered (sorted by prefix length)
+ * but not retained.  Host bits of each network are ignored.
+ *
+ * @param[out] ptrie    Created trie.
+ * @param[in]  mp       Memory pool; the tables are released when it is.
+ * @param[in,out] net4  IPv4 networks; may be NULL if @a num_net4 is 0.
+ * @param[in]  num_net4 Number of elements of @a net4.
+ * @param[in,out] net6  IPv6 networks; may be NULL if @a num_net6 is 0.
+ * @param[in]  num_net6 Number of elements of @a net6.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL if a network size is out of range.
+ * - IB_EALLOC on allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_create(
+    ib_iptrie_t      **ptrie,
+    ib_mpool_t        *mp,
+    ib_ip4_network_t  *net4,
+    size_t             num_net4,
+    ib_ip6_network_t  *net6,
+    size_t             num_net6
+);
+
+/**
+ * Create an IP trie from a file.
+ *
+ * The file contains one IPv4 or IPv6 address or network (address/bits)
+ * per line.  Leading and trailing whitespace, empty lines and text from
+ * @c # to the end of a line are ignored.
+ *
+ * The file is mapped into memory for parsing if possible and read
+ * otherwise.
+ *
+ * @param[out] ptrie      Created trie.
+ * @param[in]  mp         Memory pool; the tables are released when it is.
+ * @param[in]  path       File to load.
+ * @param[out] error_line If not NULL, set to the line number of a parse
+ *                        error.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_ENOENT if @a path can not be opened.
+ * - IB_EOTHER on any other I/O error; see errno.
+ * - IB_EINVAL if a line is not an address or network.
+ * - IB_EALLOC on allocation failure.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_create_from_file(
+    ib_iptrie_t **ptrie,
+    ib_mpool_t   *mp,
+    const char   *path,
+    size_t       *error_line
+);
+
+/**
+ * Query @a trie for the IPv4 address @a ip.
+ *
+ * This function makes no allocations.
+ *
+ * @param[in] trie IP trie to query.
+ * @param[in] ip   IP to query.
+ *
+ * @returns
+ * - IB_OK if @a ip is in a network of @a trie.
+ * - IB_ENOENT otherwise.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_query4(
+    const ib_iptrie_t *trie,
+    ib_ip4_t           ip
+);
+
+/**
+ * Query @a trie for the IPv6 address @a ip.
+ *
+ * This function makes no allocations.
+ *
+ * @param[in] trie IP trie to query.
+ * @param[in] ip   IP to query.
+ *
+ * @returns
+ * - IB_OK if @a ip is in a network of @a trie.
+ * - IB_ENOENT otherwise.
+ */
+ib_status_t DLL_PUBLIC ib_iptrie_query6(
+    const ib_iptrie_t *trie,
+    const ib_ip6_t    *ip
+);
+
+/**
+ * Memory used by the tables of @a trie in bytes.
+ *
+ * @param[in] trie IP trie.
+ *
+ * @returns Size of the tables of @a trie.
+ */
+size_t DLL_PUBLIC ib_iptrie_memory_size(
+    const ib_iptrie_t *trie
+);
+
+/** @} IronBeeUtilIPTrie */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _IB_IPTRIE_H_ */
@@ -300,6 +300,14 @@ struct ib_module_t {
  *
  * Use this to initialize a static module.
  *
+ * A module structure not created for @a ib, such as the static structure
+ * of a compiled in module, is shared by every engine of the process.  In
+ * that case @a ib gets its own copy of it, including the global
+ * configuration, and the copy is what the module functions are passed and
+ * what ib_engine_module_get() returns.  A module has the same index in every
+ * engine, so the static structure can still be used to look up
+ * configuration and transaction data.
+ *
  * @param[in] m  Module handle (already loaded)
  * @param[in] ib Engine handle
  *
@@ -328,7 +336,9 @@ ib_status_t DLL_PUBLIC ib_module_create(
 /**
  * Load and initialize an engine module.
  *
- * This causes the module init() function to be called.
+ * This causes the module init() function to be called.  The handle written
+ * to @a pm is the engine's copy of the module structure; see
+ * ib_module_init().
  *
  * @param[out] pm   Address which module handle is written
  * @param[in]  ib   Engine handle
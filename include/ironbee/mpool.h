@@ -176,6 +176,65 @@ ib_status_t DLL_PUBLIC ib_mpool_create_ex(
     ib_mpool_free_fn_t     free_fn
 );
 
+/**
+ * Create a new recycling memory pool.
+ *
+ * As ib_mpool_create(), but the pool is drawn from a per-thread cache of
+ * released pools if one is available and takes its pages from a per-thread
+ * cache of free pages before calling malloc().  When a recycling pool with
+ * a parent is released (ib_mpool_release()), it is cleared and returned,
+ * with its pages, to the cache of the releasing thread rather than to its
+ * parent.
+ *
+ * The caches are bounded and unused cache entries are trimmed
+ * periodically.  Recycling is only done for pools using the default page
+ * size, malloc(), and free(); otherwise this is identical to
+ * ib_mpool_create().
+ *
+ * Recycling pools are intended for short lived pools that are created and
+ * released at a high rate, e.g., per transaction pools.
+ *
+ * @param[out] pmp    Address which new pool is written
+ * @param[in]  name   Logical name of the pool (used in reports), can be
+ *                    NULL.
+ * @param[in]  parent Optional parent memory pool (or NULL)
+ *
+ * @returns As ib_mpool_create().
+ */
+ib_status_t DLL_PUBLIC ib_mpool_create_recycled(
+    ib_mpool_t **pmp,
+    const char  *name,
+    ib_mpool_t  *parent
+);
+
+/**
+ * Statistics of recycling memory pools.
+ *
+ * @sa ib_mpool_recycle_stats()
+ */
+typedef struct ib_mpool_recycle_stats_t ib_mpool_recycle_stats_t;
+struct ib_mpool_recycle_stats_t {
+    uint64_t pool_hits;     /**< Pools taken from a thread cache. */
+    uint64_t pool_misses;   /**< Pools allocated as the cache was empty. */
+    uint64_t page_hits;     /**< Pages taken from a thread cache. */
+    uint64_t page_misses;   /**< Pages allocated as the cache was empty. */
+    uint64_t pools_trimmed; /**< Cached pools freed by trimming. */
+    uint64_t pages_trimmed; /**< Cached pages freed by trimming. */
+};
+
+/**
+ * Get recycling statistics.
+ *
+ * Statistics are kept per thread and periodically summed into process wide
+ * totals.  The result is the process wide totals plus the not yet summed
+ * statistics of the calling thread.
+ *
+ * @param[out] stats Statistics.
+ */
+void DLL_PUBLIC ib_mpool_recycle_stats(
+    ib_mpool_recycle_stats_t *stats
+);
+
 /**
  * Set the name of a memory pool.
  *
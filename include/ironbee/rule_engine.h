@@ -28,10 +28,14 @@
 #include <ironbee/action.h>
 #include <ironbee/build.h>
 #include <ironbee/config.h>
+#include <ironbee/data.h>
+#include <ironbee/hash.h>
 #include <ironbee/operator.h>
 #include <ironbee/rule_defs.h>
 #include <ironbee/types.h>
 
+#include <stdio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -55,6 +59,8 @@ typedef struct {
     const char            *chain_id;        /**< Rule's chain ID */
     const char            *msg;             /**< Rule message */
     const char            *data;            /**< Rule logdata */
+    ib_data_expand_t      *msg_expand;      /**< Compiled message or NULL */
+    ib_data_expand_t      *data_expand;     /**< Compiled logdata or NULL */
     ib_list_t             *tags;            /**< Rule tags */
     ib_rule_phase_num_t    phase;           /**< Phase number */
     uint8_t                severity;        /**< Rule severity */
@@ -87,8 +93,24 @@ struct ib_rule_t {
     ib_rule_t             *chained_rule;    /**< Next rule in the chain */
     ib_rule_t             *chained_from;    /**< Ptr to rule chained from */
     ib_flags_t             flags;           /**< External, etc. */
+    size_t                 index;           /**< Index of registered rule */
 };
 
+/**
+ * Rule profiling counters.
+ *
+ * @sa ib_rule_profile_enable()
+ */
+typedef struct {
+    uint64_t               invocations;     /**< Times rule was executed */
+    uint64_t               targets;         /**< Targets evaluated */
+    uint64_t               tfn_ns;          /**< Time in transformations */
+    uint64_t               operator_ns;     /**< Time in operator */
+    uint64_t               matches;         /**< Operator results true */
+    uint64_t               actions;         /**< Actions fired */
+    uint64_t               operator_skips;  /**< Operator work skipped */
+} ib_rule_profile_counters_t;
+
 /**
  * Rule engine parser data
  */
@@ -115,6 +137,13 @@ struct ib_rule_exec_t {
 
     /* Stack of values for the FIELD* targets */
     ib_list_t              *value_stack; /**< Stack of values */
+
+    /* Transformation results shared by all rules of the transaction */
+    ib_hash_t              *tfn_cache;   /**< Memoized tfn results */
+
+    /* Profiling counters of the executing thread (NULL if disabled) */
+    ib_rule_profile_counters_t *profile; /**< Counters indexed by rule */
+    size_t                  profile_size; /**< Number of counters */
 };
 
 /**
@@ -647,6 +676,27 @@ ib_status_t DLL_PUBLIC ib_rule_chain_invalidate(
 ib_mpool_t DLL_PUBLIC *ib_rule_mpool(
     ib_engine_t                *ib);
 
+/**
+ * Compile a string for expansion with ib_data_expand_render().
+ *
+ * Field names in @a str are pre-parsed into data targets that share data
+ * slots with the rule targets of the same field.  The expansion is
+ * allocated from the rule memory pool.  Must be called at configuration
+ * time.
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] str String to compile
+ * @param[in] slen Length of @a str
+ * @param[out] pexpand Compiled expansion
+ *
+ * @returns Status code of ib_data_expand_compile()
+ */
+ib_status_t DLL_PUBLIC ib_rule_expand_compile(
+    ib_engine_t                *ib,
+    const char                 *str,
+    size_t                      slen,
+    ib_data_expand_t          **pexpand);
+
 /**
  * Determine of operator results should be captured
  *
@@ -792,6 +842,90 @@ void ib_rule_log_tx(ib_rule_dlog_level_t level,
     ib_rule_log_tx(IB_RULE_DLOG_TRACE, tx, \
                    __FILE__, __LINE__, __VA_ARGS__)
 
+/**
+ * Enable rule profiling.
+ *
+ * When enabled, each rule execution updates counters (see
+ * ib_rule_profile_counters_t) kept in per-thread arrays indexed by rule.
+ * The arrays are summed on demand by ib_rule_profile_get() and
+ * ib_rule_profile_write().  Profiling should be enabled before any
+ * transaction is processed; rules registered after the first transaction
+ * are not profiled.
+ *
+ * If @a path is not NULL, the profile is written to it, as JSON, when the
+ * engine is destroyed and after ib_rule_profile_request_dump() is called.
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] path Path of profile file (or NULL)
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ *   - IB_EUNKNOWN if thread local storage is not available.
+ */
+ib_status_t DLL_PUBLIC ib_rule_profile_enable(
+    ib_engine_t                *ib,
+    const char                 *path);
+
+/**
+ * Get the profiling counters of a rule, summed over all threads.
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] rule Rule
+ * @param[out] counters Counters
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_ENOENT if profiling is not enabled or @a rule is not profiled.
+ */
+ib_status_t DLL_PUBLIC ib_rule_profile_get(
+    const ib_engine_t          *ib,
+    const ib_rule_t            *rule,
+    ib_rule_profile_counters_t *counters);
+
+/**
+ * Write the profile of all executed rules as JSON.
+ *
+ * Rules are ordered by total (transformation plus operator) time,
+ * most expensive first.
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] fp File to write to
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_ENOENT if profiling is not enabled.
+ *   - IB_EALLOC on allocation failure.
+ *   - IB_EOTHER on write failure.
+ */
+ib_status_t DLL_PUBLIC ib_rule_profile_write(
+    const ib_engine_t          *ib,
+    FILE                       *fp);
+
+/**
+ * Count an operator execution that skipped its work.
+ *
+ * Operators with a cheap pre-check (such as the rx literal prefilter) call
+ * this when the check alone decides the result, so the profile shows how
+ * often the expensive path is avoided.  Does nothing if the rule is not
+ * being profiled.
+ *
+ * @param[in] rule_exec Rule execution object
+ */
+void DLL_PUBLIC ib_rule_profile_operator_skip(
+    const ib_rule_exec_t       *rule_exec);
+
+/**
+ * Request that the profile be written to the profile file.
+ *
+ * The profile is written by the next rule phase executed.  This function
+ * is async-signal-safe, so servers may call it from a signal handler.
+ *
+ * @param[in] ib IronBee engine
+ */
+void DLL_PUBLIC ib_rule_profile_request_dump(
+    ib_engine_t                *ib);
+
 /** @} */
 
 #ifdef __cplusplus
@@ -155,6 +155,28 @@ ib_status_t DLL_PUBLIC ib_state_notify_request_body_data(ib_engine_t *ib,
                                                          ib_tx_t *tx,
                                                          ib_txdata_t *txdata);
 
+/**
+ * Notify the state machine that more request body data is available as a
+ * sequence of segments.
+ *
+ * This is equivalent to notifying each segment in order with
+ * ib_state_notify_request_body_data(), but lets a server hand over its own
+ * buffer chain without first gathering it into one buffer.  The segments
+ * only need to remain valid for the duration of the call.
+ *
+ * @param[in] ib Engine handle
+ * @param[in] tx Transaction
+ * @param[in] txdata Array of @a ntxdata data segments
+ * @param[in] ntxdata Number of segments
+ *
+ * @returns Status code
+ */
+ib_status_t DLL_PUBLIC ib_state_notify_request_body_datav(
+    ib_engine_t *ib,
+    ib_tx_t *tx,
+    const ib_txdata_t *txdata,
+    size_t ntxdata);
+
 /**
  * Notify the state machine that the entire request is finished.
  *
@@ -222,6 +244,28 @@ ib_status_t DLL_PUBLIC ib_state_notify_response_body_data(ib_engine_t *ib,
                                                           ib_tx_t *tx,
                                                           ib_txdata_t *txdata);
 
+/**
+ * Notify the state machine that more response body data is available as a
+ * sequence of segments.
+ *
+ * This is equivalent to notifying each segment in order with
+ * ib_state_notify_response_body_data(), but lets a server hand over its own
+ * buffer chain without first gathering it into one buffer.  The segments
+ * only need to remain valid for the duration of the call.
+ *
+ * @param[in] ib Engine handle
+ * @param[in] tx Transaction
+ * @param[in] txdata Array of @a ntxdata data segments
+ * @param[in] ntxdata Number of segments
+ *
+ * @returns Status code
+ */
+ib_status_t DLL_PUBLIC ib_state_notify_response_body_datav(
+    ib_engine_t *ib,
+    ib_tx_t *tx,
+    const ib_txdata_t *txdata,
+    size_t ntxdata);
+
 /**
  * Notify the state machine that the entire response is finished.
  *
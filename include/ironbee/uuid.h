@@ -99,6 +99,9 @@ ib_status_t DLL_PUBLIC ib_uuid_bin_to_ascii(
 /**
  * Creates a new, random, v4 uuid.
  *
+ * Lock free: each thread uses its own pseudo-random generator, seeded from
+ * the system on first use.  Suitable for IDs, not for secrets.
+ *
  * @param uuid Pointer to allocated ib_uuid_t to store result in.
  *
  * @returns Status code
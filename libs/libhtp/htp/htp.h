@@ -251,25 +251,10 @@ if ((X)->in_current_offset < (X)->in_current_len) { \
     return HTP_DATA; \
 }
 
-#define IN_COPY_BYTE_OR_RETURN(X) \
-if ((X)->in_current_offset < (X)->in_current_len) { \
-    (X)->in_next_byte = (X)->in_current_data[(X)->in_current_offset]; \
-    (X)->in_current_offset++; \
-    (X)->in_stream_offset++; \
-} else { \
-    return HTP_DATA; \
-} \
-\
-if ((X)->in_line_len < (X)->in_line_size) { \
-    (X)->in_line[(X)->in_line_len] = (X)->in_next_byte; \
-    (X)->in_line_len++; \
-    if (((X)->in_line_len == HTP_HEADER_LIMIT_SOFT)&&(!((X)->in_tx->flags & HTP_FIELD_LONG))) { \
-        (X)->in_tx->flags |= HTP_FIELD_LONG; \
-        htp_log((X), HTP_LOG_MARK, HTP_LOG_ERROR, HTP_LINE_TOO_LONG_SOFT, "Request field over soft limit"); \
-    } \
-} else { \
-    htp_log((X), HTP_LOG_MARK, HTP_LOG_ERROR, HTP_LINE_TOO_LONG_HARD, "Request field over hard limit"); \
-    return HTP_ERROR; \
+#define IN_READ_LINE_OR_RETURN(X) \
+{ \
+    int rc = htp_connp_req_read_line(X); \
+    if (rc != HTP_OK) return rc; \
 }
 
 #define OUT_TEST_NEXT_BYTE_OR_RETURN(X) \
@@ -295,25 +280,10 @@ if ((X)->out_current_offset < (X)->out_current_len) { \
     return HTP_DATA; \
 }
 
-#define OUT_COPY_BYTE_OR_RETURN(X) \
-if ((X)->out_current_offset < (X)->out_current_len) { \
-    (X)->out_next_byte = (X)->out_current_data[(X)->out_current_offset]; \
-    (X)->out_current_offset++; \
-    (X)->out_stream_offset++; \
-} else { \
-    return HTP_DATA; \
-} \
-\
-if ((X)->out_line_len < (X)->out_line_size) { \
-    (X)->out_line[(X)->out_line_len] = (X)->out_next_byte; \
-    (X)->out_line_len++; \
-    if (((X)->out_line_len == HTP_HEADER_LIMIT_SOFT)&&(!((X)->out_tx->flags & HTP_FIELD_LONG))) { \
-        (X)->out_tx->flags |= HTP_FIELD_LONG; \
-        htp_log((X), HTP_LOG_MARK, HTP_LOG_ERROR, HTP_LINE_TOO_LONG_SOFT, "Response field over soft limit"); \
-    } \
-} else { \
-    htp_log((X), HTP_LOG_MARK, HTP_LOG_ERROR, HTP_LINE_TOO_LONG_HARD, "Response field over hard limit"); \
-    return HTP_ERROR; \
+#define OUT_READ_LINE_OR_RETURN(X) \
+{ \
+    int rc = htp_connp_res_read_line(X); \
+    if (rc != HTP_OK) return rc; \
 }
 
 #ifdef __cplusplus
@@ -646,9 +616,14 @@ struct htp_connp_t {
     /** The value of the request byte currently being processed. */
     int in_next_byte;
 
-    /** Pointer to the request line buffer. */
+    /** Pointer to the current request line. This is either in_line_buf or,
+     *  when the whole line arrived in one chunk, the chunk data itself.
+     */
     unsigned char *in_line;
 
+    /** The request line buffer. */
+    unsigned char *in_line_buf;
+
     /** Size of the request line buffer. */
     size_t in_line_size;
 
@@ -717,9 +692,14 @@ struct htp_connp_t {
     /** The value of the response byte currently being processed. */
     int out_next_byte;
 
-    /** Pointer to the response line buffer. */
+    /** Pointer to the current response line. This is either out_line_buf or,
+     *  when the whole line arrived in one chunk, the chunk data itself.
+     */
     unsigned char *out_line;
 
+    /** The response line buffer. */
+    unsigned char *out_line_buf;
+
     /** Size of the response line buffer. */
     size_t out_line_size;
 
@@ -1344,6 +1324,9 @@ int htp_connp_RES_BODY_CHUNKED_LENGTH(htp_connp_t *connp);
 int htp_connp_RES_BODY_CHUNKED_DATA(htp_connp_t *connp);
 int htp_connp_RES_BODY_CHUNKED_DATA_END(htp_connp_t *connp);
 
+int htp_connp_req_read_line(htp_connp_t *connp);
+int htp_connp_res_read_line(htp_connp_t *connp);
+
 // Utility functions
 
 int htp_convert_method_to_number(bstr *);
@@ -97,13 +97,14 @@ htp_connp_t *htp_connp_create(htp_cfg_t *cfg) {
 
     connp->in_line_size = cfg->field_limit_hard;
     connp->in_line_len = 0;
-    connp->in_line = malloc(connp->in_line_size);
-    if (connp->in_line == NULL) {
+    connp->in_line_buf = malloc(connp->in_line_size);
+    if (connp->in_line_buf == NULL) {
         htp_conn_destroy(connp->conn);
         free(connp);
         return NULL;
     }
 
+    connp->in_line = connp->in_line_buf;
     connp->in_header_line_index = -1;
     connp->in_state = htp_connp_REQ_IDLE;
 
@@ -111,14 +112,15 @@ htp_connp_t *htp_connp_create(htp_cfg_t *cfg) {
 
     connp->out_line_size = cfg->field_limit_hard;
     connp->out_line_len = 0;
-    connp->out_line = malloc(connp->out_line_size);
-    if (connp->out_line == NULL) {
-        free(connp->in_line);
+    connp->out_line_buf = malloc(connp->out_line_size);
+    if (connp->out_line_buf == NULL) {
+        free(connp->in_line_buf);
         htp_conn_destroy(connp->conn);
         free(connp);
         return NULL;
     }
 
+    connp->out_line = connp->out_line_buf;
     connp->out_header_line_index = -1;
     connp->out_state = htp_connp_RES_IDLE;
 
@@ -172,8 +174,8 @@ void htp_connp_destroy(htp_connp_t *connp) {
         free(connp->in_header_line);
     }
 
-    if (connp->in_line != NULL) {
-        free(connp->in_line);
+    if (connp->in_line_buf != NULL) {
+        free(connp->in_line_buf);
     }
 
     if (connp->out_header_line != NULL) {
@@ -184,8 +186,8 @@ void htp_connp_destroy(htp_connp_t *connp) {
         free(connp->out_header_line);
     }
 
-    if (connp->out_line != NULL) {
-        free(connp->out_line);
+    if (connp->out_line_buf != NULL) {
+        free(connp->out_line_buf);
     }
 
     // Destroy the configuration structure, but only
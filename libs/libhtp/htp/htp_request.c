@@ -35,9 +35,62 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "htp.h"
 
+/**
+ * Reads request line data from the current chunk, up to and including the
+ * next LF. A line that is entirely within the current chunk is used in
+ * place; otherwise, its data is accumulated in connp->in_line_buf. Either
+ * way, connp->in_line points to the line data.
+ *
+ * @param connp
+ * @returns HTP_OK when a complete line is available, HTP_DATA when more data is needed,
+ *          or HTP_ERROR when the line is over the hard limit.
+ */
+int htp_connp_req_read_line(htp_connp_t *connp) {
+    unsigned char *data = &connp->in_current_data[connp->in_current_offset];
+    size_t len = connp->in_current_len - connp->in_current_offset;
+
+    if (len == 0) return HTP_DATA;
+
+    // Look for the end of the line
+    unsigned char *lf = memchr(data, LF, len);
+    if (lf != NULL) {
+        len = lf - data + 1;
+    }
+
+    size_t line_len = connp->in_line_len + len;
+
+    if (line_len > connp->in_line_size) {
+        htp_log(connp, HTP_LOG_MARK, HTP_LOG_ERROR, HTP_LINE_TOO_LONG_HARD, "Request field over hard limit");
+        return HTP_ERROR;
+    }
+
+    if ((line_len >= HTP_HEADER_LIMIT_SOFT) && (!(connp->in_tx->flags & HTP_FIELD_LONG))) {
+        connp->in_tx->flags |= HTP_FIELD_LONG;
+        htp_log(connp, HTP_LOG_MARK, HTP_LOG_ERROR, HTP_LINE_TOO_LONG_SOFT, "Request field over soft limit");
+    }
+
+    if ((lf != NULL) && (connp->in_line_len == 0)) {
+        // The whole line is in this chunk
+        connp->in_line = data;
+    } else {
+        memcpy(connp->in_line_buf + connp->in_line_len, data, len);
+        connp->in_line = connp->in_line_buf;
+    }
+
+    connp->in_line_len = line_len;
+    connp->in_current_offset += len;
+    connp->in_stream_offset += len;
+    connp->in_next_byte = data[len - 1];
+
+    if (lf == NULL) return HTP_DATA;
+
+    return HTP_OK;
+}
+
 /**
  * Performs check for a CONNECT transaction to decide whether inbound
  * parsing needs to be suspended.
@@ -187,40 +240,38 @@ int htp_connp_REQ_BODY_CHUNKED_DATA(htp_connp_t *connp) {
  * @returns HTP_OK on state change, HTTP_ERROR on error, or HTP_DATA when more data is needed.
  */
 int htp_connp_REQ_BODY_CHUNKED_LENGTH(htp_connp_t *connp) {
-    for (;;) {
-        IN_COPY_BYTE_OR_RETURN(connp);
+    int64_t offset = connp->in_current_offset;
+    int rc = htp_connp_req_read_line(connp);
 
-        connp->in_tx->request_message_len++;
+    connp->in_tx->request_message_len += connp->in_current_offset - offset;
 
-        // Have we reached the end of the line?
-        if (connp->in_next_byte == LF) {
-            htp_chomp(connp->in_line, &connp->in_line_len);
+    if (rc != HTP_OK) return rc;
 
-            // Extract chunk length
-            connp->in_chunked_length = htp_parse_chunked_length(connp->in_line, connp->in_line_len);
+    htp_chomp(connp->in_line, &connp->in_line_len);
 
-            // Cleanup for the next line
-            connp->in_line_len = 0;
+    // Extract chunk length
+    connp->in_chunked_length = htp_parse_chunked_length(connp->in_line, connp->in_line_len);
 
-            // Handle chunk length
-            if (connp->in_chunked_length > 0) {
-                // More data available
-                // TODO Add a check for chunk length
-                connp->in_state = htp_connp_REQ_BODY_CHUNKED_DATA;
-            } else if (connp->in_chunked_length == 0) {
-                // End of data
-                connp->in_state = htp_connp_REQ_HEADERS;
-                connp->in_tx->progress = TX_PROGRESS_REQ_TRAILER;
-            } else {
-                // Invalid chunk length
-                htp_log(connp, HTP_LOG_MARK, HTP_LOG_ERROR, 0,
-                    "Request chunk encoding: Invalid chunk length");
-                return HTP_ERROR;
-            }
+    // Cleanup for the next line
+    connp->in_line_len = 0;
 
-            return HTP_OK;
-        }
+    // Handle chunk length
+    if (connp->in_chunked_length > 0) {
+        // More data available
+        // TODO Add a check for chunk length
+        connp->in_state = htp_connp_REQ_BODY_CHUNKED_DATA;
+    } else if (connp->in_chunked_length == 0) {
+        // End of data
+        connp->in_state = htp_connp_REQ_HEADERS;
+        connp->in_tx->progress = TX_PROGRESS_REQ_TRAILER;
+    } else {
+        // Invalid chunk length
+        htp_log(connp, HTP_LOG_MARK, HTP_LOG_ERROR, 0,
+            "Request chunk encoding: Invalid chunk length");
+        return HTP_ERROR;
     }
+
+    return HTP_OK;
 }
 
 /**
@@ -457,7 +508,7 @@ int htp_connp_REQ_BODY_DETERMINE(htp_connp_t *connp) {
  */
 int htp_connp_REQ_HEADERS(htp_connp_t *connp) {
     for (;;) {
-        IN_COPY_BYTE_OR_RETURN(connp);
+        IN_READ_LINE_OR_RETURN(connp);
 
         // Allocate structure to hold one header line
         if (connp->in_header_line == NULL) {
@@ -467,136 +518,136 @@ int htp_connp_REQ_HEADERS(htp_connp_t *connp) {
         }
 
         // Keep track of NUL bytes
-        if (connp->in_next_byte == 0) {
+        unsigned char *nul = connp->in_line;
+        unsigned char *end = connp->in_line + connp->in_line_len;
+        while ((nul = memchr(nul, 0, end - nul)) != NULL) {
             // Store the offset of the first NUL
             if (connp->in_header_line->has_nulls == 0) {
-                connp->in_header_line->first_nul_offset = connp->in_line_len;
+                connp->in_header_line->first_nul_offset = nul - connp->in_line;
             }
 
             // Remember how many NULs there were
             connp->in_header_line->flags |= HTP_FIELD_NUL_BYTE;
             connp->in_header_line->has_nulls++;
+            nul++;
         }
 
-        // Have we reached the end of the line?
-        if (connp->in_next_byte == LF) {
-            #ifdef HTP_DEBUG
-            fprint_raw_data(stderr, __FUNCTION__, connp->in_line, connp->in_line_len);
-            #endif
+        #ifdef HTP_DEBUG
+        fprint_raw_data(stderr, __FUNCTION__, connp->in_line, connp->in_line_len);
+        #endif
+
+        // Should we terminate headers?
+        if (htp_connp_is_line_terminator(connp, connp->in_line, connp->in_line_len)) {
+            // Terminator line
+            connp->in_tx->request_headers_sep = bstr_dup_mem((char *)connp->in_line, connp->in_line_len);
+            if (connp->in_tx->request_headers_sep == NULL) {
+                return HTP_ERROR;
+            }
 
-            // Should we terminate headers?
-            if (htp_connp_is_line_terminator(connp, connp->in_line, connp->in_line_len)) {
-                // Terminator line
-                connp->in_tx->request_headers_sep = bstr_dup_mem((char *)connp->in_line, connp->in_line_len);
-                if (connp->in_tx->request_headers_sep == NULL) {
+            // Parse previous header, if any
+            if (connp->in_header_line_index != -1) {
+                if (connp->cfg->process_request_header(connp) != HTP_OK) {
+                    // Note: downstream responsible for error logging
                     return HTP_ERROR;
                 }
 
-                // Parse previous header, if any
-                if (connp->in_header_line_index != -1) {
-                    if (connp->cfg->process_request_header(connp) != HTP_OK) {
-                        // Note: downstream responsible for error logging
-                        return HTP_ERROR;
-                    }
-
-                    // Reset index
-                    connp->in_header_line_index = -1;
-                }
+                // Reset index
+                connp->in_header_line_index = -1;
+            }
 
-                // Cleanup
-                free(connp->in_header_line);
-                connp->in_line_len = 0;
-                connp->in_header_line = NULL;
+            // Cleanup
+            free(connp->in_header_line);
+            connp->in_line_len = 0;
+            connp->in_header_line = NULL;
 
-                // We've seen all request headers
+            // We've seen all request headers
 
-                // Did this request arrive in multiple chunks?
-                if (connp->in_chunk_count != connp->in_chunk_request_index) {
-                    connp->in_tx->flags |= HTP_MULTI_PACKET_HEAD;
-                }
+            // Did this request arrive in multiple chunks?
+            if (connp->in_chunk_count != connp->in_chunk_request_index) {
+                connp->in_tx->flags |= HTP_MULTI_PACKET_HEAD;
+            }
 
-                // Move onto the next processing phase
-                if (connp->in_tx->progress == TX_PROGRESS_REQ_HEADERS) {
-                    // Remember how many header lines there were before trailers
-                    connp->in_tx->request_header_lines_no_trailers = list_size(connp->in_tx->request_header_lines);
+            // Move onto the next processing phase
+            if (connp->in_tx->progress == TX_PROGRESS_REQ_HEADERS) {
+                // Remember how many header lines there were before trailers
+                connp->in_tx->request_header_lines_no_trailers = list_size(connp->in_tx->request_header_lines);
 
-                    // Run hook REQUEST_HEADERS_RAW
-                    //if (connp->cfg->hook_request_headers_raw != NULL) {
-                    //    htp_req_run_hook_request_headers_raw(connp, 0,
-                    //        connp->in_tx->request_header_lines_no_trailers);
-                    //}
+                // Run hook REQUEST_HEADERS_RAW
+                //if (connp->cfg->hook_request_headers_raw != NULL) {
+                //    htp_req_run_hook_request_headers_raw(connp, 0,
+                //        connp->in_tx->request_header_lines_no_trailers);
+                //}
 
-                    // Determine if this request has a body
-                    connp->in_state = htp_connp_REQ_CONNECT_CHECK;
-                } else {
-                    // Run hook REQUEST_HEADERS_RAW
-                    //if ((connp->cfg->hook_request_headers_raw != NULL)
-                    //    && (list_size(connp->in_tx->request_header_lines) > connp->in_tx->request_header_lines_no_trailers)) {
-                    //    htp_req_run_hook_request_headers_raw(connp,
-                    //        connp->in_tx->request_header_lines_no_trailers,
-                    //        list_size(connp->in_tx->request_header_lines));
-                    //}
-
-                    // Run hook REQUEST_TRAILER
-                    int rc = hook_run_all(connp->cfg->hook_request_trailer, connp);
-                    if (rc != HOOK_OK) return rc;
-
-                    // We've completed parsing this request
-                    connp->in_state = htp_connp_REQ_IDLE;
-                    connp->in_tx->progress = TX_PROGRESS_WAIT;
-                }
+                // Determine if this request has a body
+                connp->in_state = htp_connp_REQ_CONNECT_CHECK;
+            } else {
+                // Run hook REQUEST_HEADERS_RAW
+                //if ((connp->cfg->hook_request_headers_raw != NULL)
+                //    && (list_size(connp->in_tx->request_header_lines) > connp->in_tx->request_header_lines_no_trailers)) {
+                //    htp_req_run_hook_request_headers_raw(connp,
+                //        connp->in_tx->request_header_lines_no_trailers,
+                //        list_size(connp->in_tx->request_header_lines));
+                //}
+
+                // Run hook REQUEST_TRAILER
+                int rc = hook_run_all(connp->cfg->hook_request_trailer, connp);
+                if (rc != HOOK_OK) return rc;
 
-                return HTP_OK;
+                // We've completed parsing this request
+                connp->in_state = htp_connp_REQ_IDLE;
+                connp->in_tx->progress = TX_PROGRESS_WAIT;
             }
 
-            // Prepare line for consumption
-            int chomp_result = htp_chomp(connp->in_line, &connp->in_line_len);
+            return HTP_OK;
+        }
 
-            // Check for header folding
-            if (htp_connp_is_line_folded(connp->in_line, connp->in_line_len) == 0) {
-                // New header line
+        // Prepare line for consumption
+        int chomp_result = htp_chomp(connp->in_line, &connp->in_line_len);
 
-                // Parse previous header, if any
-                if (connp->in_header_line_index != -1) {
-                    if (connp->cfg->process_request_header(connp) != HTP_OK) {
-                        // Note: downstream responsible for error logging
-                        return HTP_ERROR;
-                    }
+        // Check for header folding
+        if (htp_connp_is_line_folded(connp->in_line, connp->in_line_len) == 0) {
+            // New header line
 
-                    // Reset index
-                    connp->in_header_line_index = -1;
+            // Parse previous header, if any
+            if (connp->in_header_line_index != -1) {
+                if (connp->cfg->process_request_header(connp) != HTP_OK) {
+                    // Note: downstream responsible for error logging
+                    return HTP_ERROR;
                 }
 
-                // Remember the index of the fist header line
-                connp->in_header_line_index = connp->in_header_line_counter;
-            } else {
-                // Folding; check that there's a previous header line to add to
-                if (connp->in_header_line_index == -1) {
-                    if (!(connp->in_tx->flags & HTP_INVALID_FOLDING)) {
-                        connp->in_tx->flags |= HTP_INVALID_FOLDING;
-                        htp_log(connp, HTP_LOG_MARK, HTP_LOG_WARNING, 0,
-                            "Invalid request field folding");
-                    }
-                }
+                // Reset index
+                connp->in_header_line_index = -1;
             }
 
-            // Add the raw header line to the list
-            connp->in_header_line->line = bstr_dup_mem((char *) connp->in_line, connp->in_line_len + chomp_result);
-            if (connp->in_header_line->line == NULL) {
-                return HTP_ERROR;
+            // Remember the index of the fist header line
+            connp->in_header_line_index = connp->in_header_line_counter;
+        } else {
+            // Folding; check that there's a previous header line to add to
+            if (connp->in_header_line_index == -1) {
+                if (!(connp->in_tx->flags & HTP_INVALID_FOLDING)) {
+                    connp->in_tx->flags |= HTP_INVALID_FOLDING;
+                    htp_log(connp, HTP_LOG_MARK, HTP_LOG_WARNING, 0,
+                        "Invalid request field folding");
+                }
             }
+        }
 
-            list_add(connp->in_tx->request_header_lines, connp->in_header_line);
-            connp->in_header_line = NULL;
+        // Add the raw header line to the list
+        connp->in_header_line->line = bstr_dup_mem((char *) connp->in_line, connp->in_line_len + chomp_result);
+        if (connp->in_header_line->line == NULL) {
+            return HTP_ERROR;
+        }
 
-            // Cleanup for the next line
-            connp->in_line_len = 0;
-            if (connp->in_header_line_index == -1) {
-                connp->in_header_line_index = connp->in_header_line_counter;
-            }
+        list_add(connp->in_tx->request_header_lines, connp->in_header_line);
+        connp->in_header_line = NULL;
 
-            connp->in_header_line_counter++;
+        // Cleanup for the next line
+        connp->in_line_len = 0;
+        if (connp->in_header_line_index == -1) {
+            connp->in_header_line_index = connp->in_header_line_counter;
         }
+
+        connp->in_header_line_counter++;
     }
 }
 
@@ -630,168 +681,168 @@ int htp_connp_REQ_PROTOCOL(htp_connp_t *connp) {
  */
 int htp_connp_REQ_LINE(htp_connp_t *connp) {
     for (;;) {
-        // Get one byte
-        IN_COPY_BYTE_OR_RETURN(connp);
+        IN_READ_LINE_OR_RETURN(connp);
 
         // Keep track of NUL bytes
-        if (connp->in_next_byte == 0) {
+        unsigned char *nul = connp->in_line;
+        unsigned char *end = connp->in_line + connp->in_line_len;
+        while ((nul = memchr(nul, 0, end - nul)) != NULL) {
             // Remember how many NULs there were
             connp->in_tx->request_line_nul++;
 
             // Store the offset of the first NUL byte
             if (connp->in_tx->request_line_nul_offset == -1) {
-                connp->in_tx->request_line_nul_offset = connp->in_line_len;
+                connp->in_tx->request_line_nul_offset = nul - connp->in_line;
             }
+
+            nul++;
         }
 
-        // Have we reached the end of the line?
-        if (connp->in_next_byte == LF) {
-            #ifdef HTP_DEBUG
-            fprint_raw_data(stderr, __FUNCTION__, connp->in_line, connp->in_line_len);
-            #endif
+        #ifdef HTP_DEBUG
+        fprint_raw_data(stderr, __FUNCTION__, connp->in_line, connp->in_line_len);
+        #endif
 
-            // Is this a line that should be ignored?
-            if (htp_connp_is_line_ignorable(connp, connp->in_line, connp->in_line_len)) {
-                // We have an empty/whitespace line, which we'll note, ignore and move on
-                connp->in_tx->request_ignored_lines++;
+        // Is this a line that should be ignored?
+        if (htp_connp_is_line_ignorable(connp, connp->in_line, connp->in_line_len)) {
+            // We have an empty/whitespace line, which we'll note, ignore and move on
+            connp->in_tx->request_ignored_lines++;
 
-                // TODO How many empty lines are we willing to accept?
+            // TODO How many empty lines are we willing to accept?
 
-                // Start again
-                connp->in_line_len = 0;
+            // Start again
+            connp->in_line_len = 0;
 
-                return HTP_OK;
-            }
+            return HTP_OK;
+        }
+
+        // Process request line
 
-            // Process request line
+        connp->in_tx->request_line_raw = bstr_dup_mem((char *) connp->in_line, connp->in_line_len);
+        if (connp->in_tx->request_line_raw == NULL) {
+            return HTP_ERROR;
+        }
 
-            connp->in_tx->request_line_raw = bstr_dup_mem((char *) connp->in_line, connp->in_line_len);
-            if (connp->in_tx->request_line_raw == NULL) {
+        /// @todo Would be nice to reference request_line_raw data
+        htp_chomp(connp->in_line, &connp->in_line_len);
+        connp->in_tx->request_line = bstr_dup_ex(connp->in_tx->request_line_raw, 0, connp->in_line_len);
+        if (connp->in_tx->request_line == NULL) {
+            return HTP_ERROR;
+        }
+
+        // Parse request line
+        if (connp->cfg->parse_request_line(connp) != HTP_OK) {
+            // Note: downstream responsible for error logging
+            return HTP_ERROR;
+        }
+
+        if (connp->in_tx->request_method_number == M_CONNECT) {
+            // Parse authority
+            if (htp_parse_authority(connp, connp->in_tx->request_uri, &(connp->in_tx->parsed_uri_incomplete)) != HTP_OK) {
+                // Note: downstream responsible for error logging
                 return HTP_ERROR;
             }
-
-            /// @todo Would be nice to reference request_line_raw data
-            htp_chomp(connp->in_line, &connp->in_line_len);
-            connp->in_tx->request_line = bstr_dup_ex(connp->in_tx->request_line_raw, 0, connp->in_line_len);
-            if (connp->in_tx->request_line == NULL) {
+        } else {
+            // Parse the request URI
+            if (htp_parse_uri(connp->in_tx->request_uri, &(connp->in_tx->parsed_uri_incomplete)) != HTP_OK) {
+                // Note: downstream responsible for error logging
                 return HTP_ERROR;
             }
 
-            // Parse request line
-            if (connp->cfg->parse_request_line(connp) != HTP_OK) {
+            // Keep the original URI components, but
+            // create a copy which we can normalize and use internally
+            if (htp_normalize_parsed_uri(connp, connp->in_tx->parsed_uri_incomplete, connp->in_tx->parsed_uri) != HTP_OK) {
                 // Note: downstream responsible for error logging
                 return HTP_ERROR;
             }
 
-            if (connp->in_tx->request_method_number == M_CONNECT) {
-                // Parse authority
-                if (htp_parse_authority(connp, connp->in_tx->request_uri, &(connp->in_tx->parsed_uri_incomplete)) != HTP_OK) {
-                    // Note: downstream responsible for error logging
-                    return HTP_ERROR;
-                }
-            } else {
-                // Parse the request URI
-                if (htp_parse_uri(connp->in_tx->request_uri, &(connp->in_tx->parsed_uri_incomplete)) != HTP_OK) {
-                    // Note: downstream responsible for error logging
-                    return HTP_ERROR;
-                }
+            // Run hook REQUEST_URI_NORMALIZE
+            int rc = hook_run_all(connp->cfg->hook_request_uri_normalize, connp);
+            if (rc != HOOK_OK) return rc;
 
-                // Keep the original URI components, but
-                // create a copy which we can normalize and use internally
-                if (htp_normalize_parsed_uri(connp, connp->in_tx->parsed_uri_incomplete, connp->in_tx->parsed_uri) != HTP_OK) {
-                    // Note: downstream responsible for error logging
+            // Now is a good time to generate request_uri_normalized, before we finalize
+            // parsed_uri (and lose the information which parts were provided in the request and
+            // which parts we added).
+            if (connp->cfg->generate_request_uri_normalized) {
+                connp->in_tx->request_uri_normalized = htp_unparse_uri_noencode(connp->in_tx->parsed_uri);
+
+                if (connp->in_tx->request_uri_normalized == NULL) {
+                    // There's no sense in logging anything on a memory allocation failure
                     return HTP_ERROR;
                 }
 
-                // Run hook REQUEST_URI_NORMALIZE
-                int rc = hook_run_all(connp->cfg->hook_request_uri_normalize, connp);
-                if (rc != HOOK_OK) return rc;
-
-                // Now is a good time to generate request_uri_normalized, before we finalize
-                // parsed_uri (and lose the information which parts were provided in the request and
-                // which parts we added).
-                if (connp->cfg->generate_request_uri_normalized) {
-                    connp->in_tx->request_uri_normalized = htp_unparse_uri_noencode(connp->in_tx->parsed_uri);
+                #ifdef HTP_DEBUG
+                fprint_raw_data(stderr, "request_uri_normalized",
+                    (unsigned char *) bstr_ptr(connp->in_tx->request_uri_normalized),
+                    bstr_len(connp->in_tx->request_uri_normalized));
+                #endif
+            }
 
-                    if (connp->in_tx->request_uri_normalized == NULL) {
-                        // There's no sense in logging anything on a memory allocation failure
-                        return HTP_ERROR;
-                    }
+            // Finalize parsed_uri
 
-                    #ifdef HTP_DEBUG
-                    fprint_raw_data(stderr, "request_uri_normalized",
-                        (unsigned char *) bstr_ptr(connp->in_tx->request_uri_normalized),
-                        bstr_len(connp->in_tx->request_uri_normalized));
-                    #endif
+            // Scheme
+            if (connp->in_tx->parsed_uri->scheme != NULL) {
+                if (bstr_cmp_c(connp->in_tx->parsed_uri->scheme, "http") != 0) {
+                    // TODO Invalid scheme
                 }
-
-                // Finalize parsed_uri
-
-                // Scheme
-                if (connp->in_tx->parsed_uri->scheme != NULL) {
-                    if (bstr_cmp_c(connp->in_tx->parsed_uri->scheme, "http") != 0) {
-                        // TODO Invalid scheme
-                    }
-                } else {
-                    connp->in_tx->parsed_uri->scheme = bstr_dup_c("http");
-                    if (connp->in_tx->parsed_uri->scheme == NULL) {
-                        return HTP_ERROR;
-                    }
+            } else {
+                connp->in_tx->parsed_uri->scheme = bstr_dup_c("http");
+                if (connp->in_tx->parsed_uri->scheme == NULL) {
+                    return HTP_ERROR;
                 }
+            }
 
-                // Port
-                if (connp->in_tx->parsed_uri->port != NULL) {
-                    if (connp->in_tx->parsed_uri->port_number != -1) {
-                        // Check that the port in the URI is the same
-                        // as the port on which the client is talking
-                        // to the server
-                        if (connp->cfg->use_local_port) {
-                            if (connp->in_tx->parsed_uri->port_number != connp->conn->local_port) {
-                                // Incorrect port; use the real port instead
-                                connp->in_tx->parsed_uri->port_number = connp->conn->local_port;
-                                // TODO Log
-                            }
-                        } else {
-                            connp->in_tx->parsed_uri->port_number = connp->conn->remote_port;
-                        }
-                    } else {
-                        // Invalid port; use the real port instead
-                        if (connp->cfg->use_local_port) {
+            // Port
+            if (connp->in_tx->parsed_uri->port != NULL) {
+                if (connp->in_tx->parsed_uri->port_number != -1) {
+                    // Check that the port in the URI is the same
+                    // as the port on which the client is talking
+                    // to the server
+                    if (connp->cfg->use_local_port) {
+                        if (connp->in_tx->parsed_uri->port_number != connp->conn->local_port) {
+                            // Incorrect port; use the real port instead
                             connp->in_tx->parsed_uri->port_number = connp->conn->local_port;
-                        } else {
-                            connp->in_tx->parsed_uri->port_number = connp->conn->remote_port;
+                            // TODO Log
                         }
-                        // TODO Log
+                    } else {
+                        connp->in_tx->parsed_uri->port_number = connp->conn->remote_port;
                     }
                 } else {
+                    // Invalid port; use the real port instead
                     if (connp->cfg->use_local_port) {
                         connp->in_tx->parsed_uri->port_number = connp->conn->local_port;
                     } else {
                         connp->in_tx->parsed_uri->port_number = connp->conn->remote_port;
                     }
+                    // TODO Log
                 }
+            } else {
+                if (connp->cfg->use_local_port) {
+                    connp->in_tx->parsed_uri->port_number = connp->conn->local_port;
+                } else {
+                    connp->in_tx->parsed_uri->port_number = connp->conn->remote_port;
+                }
+            }
 
-                // Path
+            // Path
+            if (connp->in_tx->parsed_uri->path == NULL) {
+                connp->in_tx->parsed_uri->path = bstr_dup_c("/");
                 if (connp->in_tx->parsed_uri->path == NULL) {
-                    connp->in_tx->parsed_uri->path = bstr_dup_c("/");
-                    if (connp->in_tx->parsed_uri->path == NULL) {
-                        return HTP_ERROR;
-                    }
+                    return HTP_ERROR;
                 }
             }
+        }
 
-            // Run hook REQUEST_LINE
-            int rc = hook_run_all(connp->cfg->hook_request_line, connp);
-            if (rc != HOOK_OK) return rc;
+        // Run hook REQUEST_LINE
+        int rc = hook_run_all(connp->cfg->hook_request_line, connp);
+        if (rc != HOOK_OK) return rc;
 
-            // Clean up.
-            connp->in_line_len = 0;
+        // Clean up.
+        connp->in_line_len = 0;
 
-            // Move on to the next phase.
-            connp->in_state = htp_connp_REQ_PROTOCOL;
+        // Move on to the next phase.
+        connp->in_state = htp_connp_REQ_PROTOCOL;
 
-            return HTP_OK;
-        }
+        return HTP_OK;
     }
 }
 
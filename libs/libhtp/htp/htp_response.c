@@ -35,8 +35,61 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "htp.h"
 
+/**
+ * Reads response line data from the current chunk, up to and including the
+ * next LF. A line that is entirely within the current chunk is used in
+ * place; otherwise, its data is accumulated in connp->out_line_buf. Either
+ * way, connp->out_line points to the line data.
+ *
+ * @param connp
+ * @returns HTP_OK when a complete line is available, HTP_DATA when more data is needed,
+ *          or HTP_ERROR when the line is over the hard limit.
+ */
+int htp_connp_res_read_line(htp_connp_t *connp) {
+    unsigned char *data = &connp->out_current_data[connp->out_current_offset];
+    size_t len = connp->out_current_len - connp->out_current_offset;
+
+    if (len == 0) return HTP_DATA;
+
+    // Look for the end of the line
+    unsigned char *lf = memchr(data, LF, len);
+    if (lf != NULL) {
+        len = lf - data + 1;
+    }
+
+    size_t line_len = connp->out_line_len + len;
+
+    if (line_len > connp->out_line_size) {
+        htp_log(connp, HTP_LOG_MARK, HTP_LOG_ERROR, HTP_LINE_TOO_LONG_HARD, "Response field over hard limit");
+        return HTP_ERROR;
+    }
+
+    if ((line_len >= HTP_HEADER_LIMIT_SOFT) && (!(connp->out_tx->flags & HTP_FIELD_LONG))) {
+        connp->out_tx->flags |= HTP_FIELD_LONG;
+        htp_log(connp, HTP_LOG_MARK, HTP_LOG_ERROR, HTP_LINE_TOO_LONG_SOFT, "Response field over soft limit");
+    }
+
+    if ((lf != NULL) && (connp->out_line_len == 0)) {
+        // The whole line is in this chunk
+        connp->out_line = data;
+    } else {
+        memcpy(connp->out_line_buf + connp->out_line_len, data, len);
+        connp->out_line = connp->out_line_buf;
+    }
+
+    connp->out_line_len = line_len;
+    connp->out_current_offset += len;
+    connp->out_stream_offset += len;
+    connp->out_next_byte = data[len - 1];
+
+    if (lf == NULL) return HTP_DATA;
+
+    return HTP_OK;
+}
+
 /**
  * Invoked whenever decompressed response body data becomes available.
  *
@@ -178,40 +231,38 @@ int htp_connp_RES_BODY_CHUNKED_DATA(htp_connp_t *connp) {
  * @returns HTP_OK on state change, HTTP_ERROR on error, or HTP_DATA when more data is needed.
  */
 int htp_connp_RES_BODY_CHUNKED_LENGTH(htp_connp_t *connp) {
-    for (;;) {
-        OUT_COPY_BYTE_OR_RETURN(connp);
+    int64_t offset = connp->out_current_offset;
+    int rc = htp_connp_res_read_line(connp);
 
-        connp->out_tx->response_message_len++;
+    connp->out_tx->response_message_len += connp->out_current_offset - offset;
 
-        // Have we reached the end of the line?
-        if (connp->out_next_byte == LF) {
-            htp_chomp(connp->out_line, &connp->out_line_len);
+    if (rc != HTP_OK) return rc;
 
-            // Extract chunk length
-            connp->out_chunked_length = htp_parse_chunked_length(connp->out_line, connp->out_line_len);
+    htp_chomp(connp->out_line, &connp->out_line_len);
 
-            // Cleanup for the next line
-            connp->out_line_len = 0;
+    // Extract chunk length
+    connp->out_chunked_length = htp_parse_chunked_length(connp->out_line, connp->out_line_len);
 
-            // Handle chunk length
-            if (connp->out_chunked_length > 0) {
-                // More data available
-                // TODO Add a check for chunk length
-                connp->out_state = htp_connp_RES_BODY_CHUNKED_DATA;
-            } else if (connp->out_chunked_length == 0) {
-                // End of data
-                connp->out_state = htp_connp_RES_HEADERS;
-                connp->out_tx->progress = TX_PROGRESS_RES_TRAILER;
-            } else {
-                // Invalid chunk length
-                htp_log(connp, HTP_LOG_MARK, HTP_LOG_ERROR, 0,
-                    "Response chunk encoding: Invalid chunk length: %d", connp->out_chunked_length);
-                return HTP_ERROR;
-            }
+    // Cleanup for the next line
+    connp->out_line_len = 0;
 
-            return HTP_OK;
-        }
+    // Handle chunk length
+    if (connp->out_chunked_length > 0) {
+        // More data available
+        // TODO Add a check for chunk length
+        connp->out_state = htp_connp_RES_BODY_CHUNKED_DATA;
+    } else if (connp->out_chunked_length == 0) {
+        // End of data
+        connp->out_state = htp_connp_RES_HEADERS;
+        connp->out_tx->progress = TX_PROGRESS_RES_TRAILER;
+    } else {
+        // Invalid chunk length
+        htp_log(connp, HTP_LOG_MARK, HTP_LOG_ERROR, 0,
+            "Response chunk encoding: Invalid chunk length: %d", connp->out_chunked_length);
+        return HTP_ERROR;
     }
+
+    return HTP_OK;
 }
 
 /**
@@ -534,8 +585,9 @@ int htp_connp_RES_BODY_DETERMINE(htp_connp_t *connp) {
  */
 int htp_connp_RES_HEADERS(htp_connp_t * connp) {
     for (;;) {
-        OUT_COPY_BYTE_OR_RETURN(connp);
+        OUT_READ_LINE_OR_RETURN(connp);
 
+        // Allocate structure to hold one header line
         if (connp->out_header_line == NULL) {
             connp->out_header_line = calloc(1, sizeof (htp_header_line_t));
             if (connp->out_header_line == NULL) return HTP_ERROR;
@@ -543,112 +595,112 @@ int htp_connp_RES_HEADERS(htp_connp_t * connp) {
         }
 
         // Keep track of NUL bytes
-        if (connp->out_next_byte == 0) {
+        unsigned char *nul = connp->out_line;
+        unsigned char *end = connp->out_line + connp->out_line_len;
+        while ((nul = memchr(nul, 0, end - nul)) != NULL) {
             // Store the offset of the first NUL
             if (connp->out_header_line->has_nulls == 0) {
-                connp->out_header_line->first_nul_offset = connp->out_line_len;
+                connp->out_header_line->first_nul_offset = nul - connp->out_line;
             }
 
             // Remember how many NULs there were
             connp->out_header_line->flags |= HTP_FIELD_NUL_BYTE;
             connp->out_header_line->has_nulls++;
+            nul++;
         }
 
-        // Have we reached the end of the line?
-        if (connp->out_next_byte == LF) {
-            #ifdef HTP_DEBUG
-            fprint_raw_data(stderr, __FUNCTION__, connp->out_line, connp->out_line_len);
-            #endif
+        #ifdef HTP_DEBUG
+        fprint_raw_data(stderr, __FUNCTION__, connp->out_line, connp->out_line_len);
+        #endif
 
-            // Should we terminate headers?
-            if (htp_connp_is_line_terminator(connp, connp->out_line, connp->out_line_len)) {
-                // Terminator line
+        // Should we terminate headers?
+        if (htp_connp_is_line_terminator(connp, connp->out_line, connp->out_line_len)) {
+            // Terminator line
+            if (connp->out_tx->response_headers_sep == NULL) {
+                connp->out_tx->response_headers_sep =
+                    bstr_dup_mem((char *)connp->out_line, connp->out_line_len);
                 if (connp->out_tx->response_headers_sep == NULL) {
-                    connp->out_tx->response_headers_sep =
-                        bstr_dup_mem((char *)connp->out_line, connp->out_line_len);
-                    if (connp->out_tx->response_headers_sep == NULL) {
-                        return HTP_ERROR;
-                    }
+                    return HTP_ERROR;
                 }
+            }
 
-                // Parse previous header, if any
-                if (connp->out_header_line_index != -1) {
-                    // Only try to parse a header, but ignore
-                    // any problems. That's what browsers do.
-                    connp->cfg->process_response_header(connp);
-
-                    // Reset index
-                    connp->out_header_line_index = -1;
-                }
+            // Parse previous header, if any
+            if (connp->out_header_line_index != -1) {
+                // Only try to parse a header, but ignore
+                // any problems. That's what browsers do.
+                connp->cfg->process_response_header(connp);
 
-                // Cleanup
-                free(connp->out_header_line);
-                connp->out_line_len = 0;
-                connp->out_header_line = NULL;
+                // Reset index
+                connp->out_header_line_index = -1;
+            }
 
-                // We've seen all response headers
-                if (connp->out_tx->progress == TX_PROGRESS_RES_HEADERS) {
-                    // Determine if this response has a body
-                    connp->out_state = htp_connp_RES_BODY_DETERMINE;
-                } else {
-                    // Run hook response_TRAILER
-                    int rc = hook_run_all(connp->cfg->hook_response_trailer, connp);
-                    if (rc != HOOK_OK) return rc;
+            // Cleanup
+            free(connp->out_header_line);
+            connp->out_line_len = 0;
+            connp->out_header_line = NULL;
 
-                    // We've completed parsing this response
-                    connp->out_state = htp_connp_RES_IDLE;
-                }
+            // We've seen all response headers
+            if (connp->out_tx->progress == TX_PROGRESS_RES_HEADERS) {
+                // Determine if this response has a body
+                connp->out_state = htp_connp_RES_BODY_DETERMINE;
+            } else {
+                // Run hook response_TRAILER
+                int rc = hook_run_all(connp->cfg->hook_response_trailer, connp);
+                if (rc != HOOK_OK) return rc;
 
-                return HTP_OK;
+                // We've completed parsing this response
+                connp->out_state = htp_connp_RES_IDLE;
             }
 
-            // Prepare line for consumption
-            int chomp_result = htp_chomp(connp->out_line, &connp->out_line_len);
+            return HTP_OK;
+        }
 
-            // Check for header folding
-            if (htp_connp_is_line_folded(connp->out_line, connp->out_line_len) == 0) {
-                // New header line
+        // Prepare line for consumption
+        int chomp_result = htp_chomp(connp->out_line, &connp->out_line_len);
 
-                // Parse previous header, if any
-                if (connp->out_header_line_index != -1) {
-                    // Only try to parse a header, but ignore
-                    // any problems. That's what browsers do.
-                    connp->cfg->process_response_header(connp);
+        // Check for header folding
+        if (htp_connp_is_line_folded(connp->out_line, connp->out_line_len) == 0) {
+            // New header line
 
-                    // Reset index
-                    connp->out_header_line_index = -1;
-                }
+            // Parse previous header, if any
+            if (connp->out_header_line_index != -1) {
+                // Only try to parse a header, but ignore
+                // any problems. That's what browsers do.
+                connp->cfg->process_response_header(connp);
 
-                // Remember the index of the fist header line
-                connp->out_header_line_index = connp->out_header_line_counter;
-            } else {
-                // Folding; check that there's a previous header line to add to
-                if (connp->out_header_line_index == -1) {
-                    if (!(connp->out_tx->flags & HTP_INVALID_FOLDING)) {
-                        connp->out_tx->flags |= HTP_INVALID_FOLDING;
-                        htp_log(connp, HTP_LOG_MARK, HTP_LOG_WARNING, 0, "Invalid response field folding");
-                    }
-                }
+                // Reset index
+                connp->out_header_line_index = -1;
             }
 
-            // Add the raw header line to the list
-            connp->out_header_line->line = bstr_dup_mem((char *) connp->out_line, connp->out_line_len + chomp_result);
-            if (connp->out_header_line->line == NULL) {
-                return HTP_ERROR;
+            // Remember the index of the fist header line
+            connp->out_header_line_index = connp->out_header_line_counter;
+        } else {
+            // Folding; check that there's a previous header line to add to
+            if (connp->out_header_line_index == -1) {
+                if (!(connp->out_tx->flags & HTP_INVALID_FOLDING)) {
+                    connp->out_tx->flags |= HTP_INVALID_FOLDING;
+                    htp_log(connp, HTP_LOG_MARK, HTP_LOG_WARNING, 0, "Invalid response field folding");
+                }
             }
+        }
 
-            list_add(connp->out_tx->response_header_lines, connp->out_header_line);
-            connp->out_header_line = NULL;
+        // Add the raw header line to the list
+        connp->out_header_line->line = bstr_dup_mem((char *) connp->out_line, connp->out_line_len + chomp_result);
+        if (connp->out_header_line->line == NULL) {
+            return HTP_ERROR;
+        }
 
-            // Cleanup for the next line
-            connp->out_line_len = 0;
-            if (connp->out_header_line_index == -1) {
+        list_add(connp->out_tx->response_header_lines, connp->out_header_line);
+        connp->out_header_line = NULL;
 
-                connp->out_header_line_index = connp->out_header_line_counter;
-            }
+        // Cleanup for the next line
+        connp->out_line_len = 0;
+        if (connp->out_header_line_index == -1) {
 
-            connp->out_header_line_counter++;
+            connp->out_header_line_index = connp->out_header_line_counter;
         }
+
+        connp->out_header_line_counter++;
     }
 }
 
@@ -660,120 +712,119 @@ int htp_connp_RES_HEADERS(htp_connp_t * connp) {
  */
 int htp_connp_RES_LINE(htp_connp_t * connp) {
     for (;;) {
-        // Get one byte
-        OUT_COPY_BYTE_OR_RETURN(connp);
+        OUT_READ_LINE_OR_RETURN(connp);
 
-        // Have we reached the end of the line?
-        if (connp->out_next_byte == LF) {
-            #ifdef HTP_DEBUG
-            fprint_raw_data(stderr, __FUNCTION__, connp->out_line, connp->out_line_len);
-            #endif
-
-            // Is this a line that should be ignored?
-            if (htp_connp_is_line_ignorable(connp, connp->out_line, connp->out_line_len)) {
-                // We have an empty/whitespace line, which we'll note, ignore and move on
-                connp->out_tx->response_ignored_lines++;
+        #ifdef HTP_DEBUG
+        fprint_raw_data(stderr, __FUNCTION__, connp->out_line, connp->out_line_len);
+        #endif
 
-                // TODO How many lines are we willing to accept?
+        // Is this a line that should be ignored?
+        if (htp_connp_is_line_ignorable(connp, connp->out_line, connp->out_line_len)) {
+            // We have an empty/whitespace line, which we'll note, ignore and move on
+            connp->out_tx->response_ignored_lines++;
 
-                // Start again
-                connp->out_line_len = 0;
+            // TODO How many lines are we willing to accept?
 
-                return HTP_OK;
-            }
-
-            // Process response line
+            // Start again
+            connp->out_line_len = 0;
 
-            // Deallocate previous response line allocations, which we would have on a 100 response
-            // TODO Consider moving elsewhere; no need to make these checks on every response
-            if (connp->out_tx->response_line != NULL) {
-                bstr_free(&connp->out_tx->response_line);
-            }
+            return HTP_OK;
+        }
 
-            if (connp->out_tx->response_protocol != NULL) {
-                bstr_free(&connp->out_tx->response_protocol);
-            }
+        // Process response line
 
-            if (connp->out_tx->response_status != NULL) {
-                bstr_free(&connp->out_tx->response_status);
-            }
+        // Deallocate previous response line allocations, which we would have on a 100 response
+        // TODO Consider moving elsewhere; no need to make these checks on every response
+        if (connp->out_tx->response_line != NULL) {
+            bstr_free(&connp->out_tx->response_line);
+        }
 
-            if (connp->out_tx->response_message != NULL) {
-                bstr_free(&connp->out_tx->response_message);
-            }
+        if (connp->out_tx->response_protocol != NULL) {
+            bstr_free(&connp->out_tx->response_protocol);
+        }
 
-            connp->out_tx->response_line_raw = bstr_dup_mem((char *) connp->out_line, connp->out_line_len);
-            if (connp->out_tx->response_line_raw == NULL) {
-                return HTP_ERROR;
-            }
+        if (connp->out_tx->response_status != NULL) {
+            bstr_free(&connp->out_tx->response_status);
+        }
 
-            /// @todo Would be nice to reference response_line_raw data
-            int chomp_result = htp_chomp(connp->out_line, &connp->out_line_len);
-            connp->out_tx->response_line = bstr_dup_ex(connp->out_tx->response_line_raw, 0, connp->out_line_len);
-            if (connp->out_tx->response_line == NULL) {
-                return HTP_ERROR;
-            }
+        if (connp->out_tx->response_message != NULL) {
+            bstr_free(&connp->out_tx->response_message);
+        }
 
-            // Parse response line
-            if (connp->cfg->parse_response_line(connp) != HTP_OK) {
-                // Note: downstream responsible for error logging
-                return HTP_ERROR;
-            }
+        connp->out_tx->response_line_raw = bstr_dup_mem((char *) connp->out_line, connp->out_line_len);
+        if (connp->out_tx->response_line_raw == NULL) {
+            return HTP_ERROR;
+        }
 
-            // Is the response line valid?
-            if ((connp->out_tx->response_protocol_number < 0)
-                || (connp->out_tx->response_status_number < 0)
-                || (connp->out_tx->response_status_number < HTP_VALID_STATUS_MIN)
-                || (connp->out_tx->response_status_number > HTP_VALID_STATUS_MAX)) {
-                // Response line is invalid
-                htp_log(connp, HTP_LOG_MARK, HTP_LOG_WARNING, 0, "Invalid response line");
+        /// @todo Would be nice to reference response_line_raw data
+        int chomp_result = htp_chomp(connp->out_line, &connp->out_line_len);
+        connp->out_tx->response_line = bstr_dup_ex(connp->out_tx->response_line_raw, 0, connp->out_line_len);
+        if (connp->out_tx->response_line == NULL) {
+            return HTP_ERROR;
+        }
 
-                connp->out_tx->flags |= HTP_STATUS_LINE_INVALID;
-            }
+        // Parse response line
+        if (connp->cfg->parse_response_line(connp) != HTP_OK) {
+            // Note: downstream responsible for error logging
+            return HTP_ERROR;
+        }
 
-            // Even when the response line is invalid, determine if it looks like
-            // a response line (which is what browsers do).
-            if (htp_resembles_response_line(connp->out_tx) == 0) {
-                // Process this line as response body data
-                htp_tx_data_t d;
+        // Is the response line valid?
+        if ((connp->out_tx->response_protocol_number < 0)
+            || (connp->out_tx->response_status_number < 0)
+            || (connp->out_tx->response_status_number < HTP_VALID_STATUS_MIN)
+            || (connp->out_tx->response_status_number > HTP_VALID_STATUS_MAX)) {
+            // Response line is invalid
+            htp_log(connp, HTP_LOG_MARK, HTP_LOG_WARNING, 0, "Invalid response line");
 
-                d.tx = connp->out_tx;
-                d.data = connp->out_line;
-                d.len = connp->out_line_len + chomp_result;
+            connp->out_tx->flags |= HTP_STATUS_LINE_INVALID;
+        }
 
-                d.tx->response_message_len += d.len;
+        // Even when the response line is invalid, determine if it looks like
+        // a response line (which is what browsers do).
+        if (htp_resembles_response_line(connp->out_tx) == 0) {
+            // Process this line as response body data
+            htp_tx_data_t d;
 
-                // Keep track of actual response body length
-                d.tx->response_entity_len += d.len;
+            d.tx = connp->out_tx;
+            d.data = connp->out_line;
+            d.len = connp->out_line_len + chomp_result;
 
-                int rc = htp_res_run_hook_body_data(connp, &d);
-                if (rc != HOOK_OK) {
-                    htp_log(connp, HTP_LOG_MARK, HTP_LOG_ERROR, 0,
-                        "Response body data callback returned error (%d)", rc);
-                    return HTP_ERROR;
-                }
+            d.tx->response_message_len += d.len;
 
-                // Continue to process response body
-                connp->out_tx->response_transfer_coding = IDENTITY;
-                connp->out_state = htp_connp_RES_BODY_IDENTITY;
-                connp->out_tx->progress = TX_PROGRESS_RES_BODY;
+            // Keep track of actual response body length
+            d.tx->response_entity_len += d.len;
 
-                return HTP_OK;
+            int rc = htp_res_run_hook_body_data(connp, &d);
+            if (rc != HOOK_OK) {
+                htp_log(connp, HTP_LOG_MARK, HTP_LOG_ERROR, 0,
+                    "Response body data callback returned error (%d)", rc);
+                return HTP_ERROR;
             }
 
-            // Run hook RESPONSE_LINE
-            int rc = hook_run_all(connp->cfg->hook_response_line, connp);
-            if (rc != HOOK_OK) return rc;
-
-            // Clean up.
+            // The line has been consumed; it may not be in out_line_buf
             connp->out_line_len = 0;
 
-            // Move on to the next phase.
-            connp->out_state = htp_connp_RES_HEADERS;
-            connp->out_tx->progress = TX_PROGRESS_RES_HEADERS;
+            // Continue to process response body
+            connp->out_tx->response_transfer_coding = IDENTITY;
+            connp->out_state = htp_connp_RES_BODY_IDENTITY;
+            connp->out_tx->progress = TX_PROGRESS_RES_BODY;
 
             return HTP_OK;
         }
+
+        // Run hook RESPONSE_LINE
+        int rc = hook_run_all(connp->cfg->hook_response_line, connp);
+        if (rc != HOOK_OK) return rc;
+
+        // Clean up.
+        connp->out_line_len = 0;
+
+        // Move on to the next phase.
+        connp->out_state = htp_connp_RES_HEADERS;
+        connp->out_tx->progress = TX_PROGRESS_RES_HEADERS;
+
+        return HTP_OK;
     }
 }
 
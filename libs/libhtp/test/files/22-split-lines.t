@@ -0,0 +1,20 @@
+>>>
+GET /ind
+>>>
+ex.html HTTP/1.1
+Host: www.exa
+>>>
+mple.com
+User-Agent: Mozilla/5.0
+
+
+<<<
+HTTP/1.1 200 O
+<<<
+K
+Content-Type: text/ht
+<<<
+ml
+Content-Length: 12
+
+Hello World!
\ No newline at end of file
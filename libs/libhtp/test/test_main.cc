@@ -489,3 +489,28 @@ TEST_F(ConnectionParsingTest, Http_0_9) {
 
 
 
+
+TEST_F(ConnectionParsingTest, SplitLines) {
+    int rc = test_run(home, "22-split-lines.t", cfg, &connp);
+    ASSERT_GE(rc, 0);
+
+    ASSERT_EQ(list_size(connp->conn->transactions), 1UL);
+
+    htp_tx_t *tx = (htp_tx_t *)list_get(connp->conn->transactions, 0);
+    ASSERT_TRUE(tx != NULL);
+    ASSERT_TRUE(tx->progress == TX_PROGRESS_DONE);
+
+    ASSERT_EQ(bstr_cmp_c(tx->request_uri, "/index.html"), 0);
+    ASSERT_EQ(table_size(tx->request_headers), 2UL);
+
+    htp_header_t *h = (htp_header_t *)table_get_c(tx->request_headers, "host");
+    ASSERT_TRUE(h != NULL);
+    ASSERT_EQ(bstr_cmp_c(h->value, "www.example.com"), 0);
+
+    ASSERT_EQ(tx->response_status_number, 200);
+    ASSERT_EQ(bstr_cmp_c(tx->response_message, "OK"), 0);
+
+    h = (htp_header_t *)table_get_c(tx->response_headers, "content-type");
+    ASSERT_TRUE(h != NULL);
+    ASSERT_EQ(bstr_cmp_c(h->value, "text/html"), 0);
+}
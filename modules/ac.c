@@ -564,7 +564,7 @@ static ib_status_t pmf_operator_create(ib_engine_t *ib,
         return rc;
     }
 
-    rc = ib_ac_create(&ac, 0, pool);
+    rc = ib_ac_create(&ac, IB_AC_FLAG_PARSER_DFA, pool);
 
     if (rc != IB_OK) {
         free(file);
@@ -647,7 +647,7 @@ static ib_status_t pm_operator_create(ib_engine_t *ib,
 
     memcpy(tok_buffer, pattern, tok_buffer_sz);
 
-    rc = ib_ac_create(&ac, 0, pool);
+    rc = ib_ac_create(&ac, IB_AC_FLAG_PARSER_DFA, pool);
 
     if (rc != IB_OK) {
         free(tok_buffer);
@@ -28,6 +28,8 @@
 
 #include <ironbee/capture.h>
 #include <ironbee/hash.h>
+#include <ironbee/list.h>
+#include <ironbee/mpool.h>
 #include <ironbee/module.h>
 #include <ironbee/operator.h>
 #include <ironbee/path.h>
@@ -35,6 +37,7 @@
 #include <ironbee/util.h>
 
 #include <assert.h>
+#include <strings.h>
 #include <unistd.h>
 
 /* Define the module name as well as a string version of it. */
@@ -44,8 +47,34 @@
 /* Define the public module symbol. */
 IB_MODULE_DECLARE();
 
-/* Global hash to store patterns */
-static ib_hash_t *g_eudoxus_pattern_hash = NULL;
+/**
+ * Get the hash storing the patterns of engine @a ib.
+ *
+ * The hash is the module data of the engine's module instance.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[out] phash The pattern hash.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_ENOENT if the module is not loaded in @a ib.
+ */
+static ib_status_t ee_pattern_hash(ib_engine_t *ib, ib_hash_t **phash)
+{
+    ib_module_t *m;
+    ib_status_t rc;
+
+    rc = ib_engine_module_get(ib, MODULE_NAME_STR, &m);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if (m->data == NULL) {
+        return IB_ENOENT;
+    }
+
+    *phash = (ib_hash_t *)m->data;
+    return IB_OK;
+}
 
 /**
  * Load a eudoxus pattern so it can be used in rules.
@@ -53,35 +82,41 @@ static ib_hash_t *g_eudoxus_pattern_hash = NULL;
  * The filename should point to a compiled automata. If a relative path is
  * given, it will be loaded relative to the current configuration file.
  *
+ * The automata is memory mapped read only rather than copied, so it loads
+ * in constant time and its pages are shared between processes.
+ *
  * @param[in] cp Configuration parser.
- * @param[in] name Directive name.
  * @param[in] pattern_name Name to associate with the pattern.
  * @param[in] filename Filename to load.
- * @param[in] cbdata Callback data (unused)
+ * @param[in] flags Bitwise or of @c ia_eudoxus_mmap_flags_t.
  */
-static ib_status_t load_eudoxus_pattern_param2(ib_cfgparser_t *cp,
-                                               const char *name,
-                                               const char *pattern_name,
-                                               const char *filename,
-                                               void *cbdata)
+static ib_status_t load_eudoxus_pattern(ib_cfgparser_t *cp,
+                                        const char *pattern_name,
+                                        const char *filename,
+                                        int flags)
 {
     ib_status_t rc;
     const char *automata_file;
     ia_eudoxus_result_t ia_rc;
     ia_eudoxus_t *eudoxus;
     ib_mpool_t *mp_tmp;
+    ib_hash_t *pattern_hash;
     void *tmp;
 
     assert(cp != NULL);
     assert(cp->ib != NULL);
-    assert(g_eudoxus_pattern_hash != NULL);
     assert(pattern_name != NULL);
     assert(filename != NULL);
 
+    rc = ee_pattern_hash(cp->ib, &pattern_hash);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
     mp_tmp = ib_engine_pool_temp_get(cp->ib);
 
     /* Check if the pattern name is already in use */
-    rc = ib_hash_get(g_eudoxus_pattern_hash, &tmp, pattern_name);
+    rc = ib_hash_get(pattern_hash, &tmp, pattern_name);
     if (rc == IB_OK) {
         ib_log_error(cp->ib,
                      MODULE_NAME_STR ": Pattern named \"%s\" already defined",
@@ -102,7 +137,7 @@ static ib_status_t load_eudoxus_pattern_param2(ib_cfgparser_t *cp,
         return IB_EINVAL;
     }
 
-    ia_rc = ia_eudoxus_create_from_path(&eudoxus, automata_file);
+    ia_rc = ia_eudoxus_create_from_path_mmap(&eudoxus, automata_file, flags);
     if (ia_rc != IA_EUDOXUS_OK) {
         ib_log_error(cp->ib,
                      MODULE_NAME_STR ": Error loading eudoxus automata file[%d]: %s.",
@@ -110,7 +145,7 @@ static ib_status_t load_eudoxus_pattern_param2(ib_cfgparser_t *cp,
         return IB_EINVAL;
     }
 
-    rc = ib_hash_set(g_eudoxus_pattern_hash, pattern_name, eudoxus);
+    rc = ib_hash_set(pattern_hash, pattern_name, eudoxus);
     if (rc != IB_OK) {
         ia_eudoxus_destroy(eudoxus);
         return rc;
@@ -119,10 +154,69 @@ static ib_status_t load_eudoxus_pattern_param2(ib_cfgparser_t *cp,
     return IB_OK;
 }
 
+/**
+ * Handle the LoadEudoxus directive.
+ *
+ * LoadEudoxus name file [populate] [hugepage]
+ *
+ * The @c populate option faults in the whole automata at load time rather
+ * than on first use; @c hugepage asks the kernel to back the mapping with
+ * huge pages.  Options not supported by the platform are ignored.
+ *
+ * @param[in] cp Configuration parser.
+ * @param[in] name Directive name.
+ * @param[in] params Pattern name, filename and options.
+ * @param[in] cbdata Callback data (unused)
+ */
+static ib_status_t load_eudoxus_pattern_list(ib_cfgparser_t *cp,
+                                             const char *name,
+                                             const ib_list_t *params,
+                                             void *cbdata)
+{
+    const ib_list_node_t *node;
+    const char *pattern_name;
+    const char *filename;
+    int flags = 0;
+
+    assert(cp != NULL);
+    assert(params != NULL);
+
+    if (ib_list_elements(params) < 2) {
+        ib_log_error(cp->ib,
+                     MODULE_NAME_STR ": %s requires a pattern name and a file.",
+                     name);
+        return IB_EINVAL;
+    }
+
+    node = ib_list_first_const(params);
+    pattern_name = (const char *)ib_list_node_data_const(node);
+    node = ib_list_node_next_const(node);
+    filename = (const char *)ib_list_node_data_const(node);
+
+    while ( (node = ib_list_node_next_const(node)) != NULL) {
+        const char *option = (const char *)ib_list_node_data_const(node);
+
+        if (strcasecmp(option, "populate") == 0) {
+            flags |= IA_EUDOXUS_MMAP_POPULATE;
+        }
+        else if (strcasecmp(option, "hugepage") == 0) {
+            flags |= IA_EUDOXUS_MMAP_HUGEPAGE;
+        }
+        else {
+            ib_log_error(cp->ib,
+                         MODULE_NAME_STR ": Unknown %s option \"%s\".",
+                         name, option);
+            return IB_EINVAL;
+        }
+    }
+
+    return load_eudoxus_pattern(cp, pattern_name, filename, flags);
+}
+
 static IB_DIRMAP_INIT_STRUCTURE(eudoxus_directive_map) = {
-    IB_DIRMAP_INIT_PARAM2(
+    IB_DIRMAP_INIT_LIST(
         "LoadEudoxus",
-        load_eudoxus_pattern_param2,
+        load_eudoxus_pattern_list,
         NULL
     ),
 
@@ -130,19 +224,55 @@ static IB_DIRMAP_INIT_STRUCTURE(eudoxus_directive_map) = {
     IB_DIRMAP_INIT_LAST
 };
 
+/**
+ * Data passed to ee_first_match_callback().
+ */
+typedef struct ee_callback_data_t ee_callback_data_t;
+struct ee_callback_data_t {
+    /** Rule being executed; updated on every operator call. */
+    const ib_rule_exec_t *rule_exec;
+    /** Start of the input currently being executed on. */
+    const uint8_t        *input_start;
+    /** Consuming input after a match; do not capture or stop. */
+    bool                  draining;
+};
+
+/**
+ * Per (transaction, rule) state of a stream @c ee_match_any.
+ *
+ * The automata state is kept across calls so that patterns straddling
+ * chunk boundaries are found without buffering the stream.
+ */
+typedef struct ee_stream_data_t ee_stream_data_t;
+struct ee_stream_data_t {
+    ia_eudoxus_state_t *state;  /**< Automata state; NULL once destroyed. */
+    ee_callback_data_t  cbdata; /**< Callback data for @a state. */
+    bool                at_end; /**< Automata can make no more progress. */
+};
+
+/**
+ * Per transaction module data.
+ */
+typedef struct ee_tx_data_t ee_tx_data_t;
+struct ee_tx_data_t {
+    ib_hash_t *stream_data;     /**< Rule id -> ee_stream_data_t */
+};
+
 /**
  * Eudoxus first match callback function.  Called when a match occurs.
  *
  * Always returns IA_EUDOXUS_CMD_STOP to stop matching (unless an
- * error occurs). If capture is enabled the matched text will be stored in the
- * capture variable.
+ * error occurs or the rest of a stream chunk is being drained, see
+ * ee_stream_drain()). If capture is enabled the matched text will be stored
+ * in the capture variable.  If the match began in an earlier stream chunk,
+ * only the part of the match in the current chunk is captured.
  *
  * @param[in] engine Eudoxus engine.
  * @param[in] output Output defined by automata.
  * @param[in] output_length Length of output.
  * @param[in] input Current location in the input (first character
  *                  after the match).
- * @param[in,out] cbdata Pointer to the ib_rule_exec_t instance we are
+ * @param[in,out] cbdata Pointer to the ee_callback_data_t instance we are
  *                       handling. This is needed for handling capture
  *                       of the match.
  */
@@ -154,22 +284,35 @@ static ia_eudoxus_command_t ee_first_match_callback(const ia_eudoxus_t* engine,
 {
     ib_status_t rc;
     uint32_t match_len;
-    const ib_rule_exec_t *rule_exec = cbdata;
-    ib_tx_t *tx = rule_exec->tx;
+    const ee_callback_data_t *ee_cbdata = cbdata;
+    const ib_rule_exec_t *rule_exec;
+    ib_tx_t *tx;
     ib_bytestr_t *bs;
     ib_field_t *field;
     const char *name;
 
     assert(cbdata != NULL);
+    assert(ee_cbdata->rule_exec != NULL);
+    assert(output != NULL);
+
+    if (ee_cbdata->draining) {
+        return IA_EUDOXUS_CMD_CONTINUE;
+    }
+
+    rule_exec = ee_cbdata->rule_exec;
+    tx = rule_exec->tx;
+
     assert(rule_exec->rule != NULL);
     assert(tx != NULL);
-    assert(output != NULL);
 
     if (ib_flags_all(rule_exec->rule->flags, IB_RULE_FLAG_CAPTURE)) {
         if (output_length != sizeof(uint32_t)) {
             return IA_EUDOXUS_CMD_ERROR;
         }
         match_len = *(uint32_t *)(output);
+        if ((size_t)(input - ee_cbdata->input_start) < match_len) {
+            match_len = input - ee_cbdata->input_start;
+        }
         rc = ib_capture_clear(tx);
         if (rc != IB_OK) {
             ib_log_error_tx(tx, "Error clearing captures: %s",
@@ -222,13 +365,18 @@ static ib_status_t ee_match_any_operator_create(ib_engine_t *ib,
 
     ib_status_t rc;
     ia_eudoxus_t* eudoxus;
+    ib_hash_t *pattern_hash;
 
     assert(ib != NULL);
-    assert(g_eudoxus_pattern_hash != NULL);
     assert(automata_name != NULL);
     assert(op_inst != NULL);
 
-    rc = ib_hash_get(g_eudoxus_pattern_hash, &eudoxus, automata_name);
+    rc = ee_pattern_hash(ib, &pattern_hash);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    rc = ib_hash_get(pattern_hash, &eudoxus, automata_name);
     if (rc == IB_ENOENT ) {
         ib_log_error(ib,
                      MODULE_NAME_STR ": No eudoxus automata named %s found.",
@@ -246,11 +394,388 @@ static ib_status_t ee_match_any_operator_create(ib_engine_t *ib,
     return IB_OK;
 }
 
+/**
+ * Get the input of a string field without copying it.
+ *
+ * @param[in] field Field of type IB_FTYPE_NULSTR or IB_FTYPE_BYTESTR.
+ * @param[out] input Start of the field value.
+ * @param[out] input_len Length of the field value.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if @a field is not a string field.
+ *   - Errors from ib_field_value().
+ */
+static ib_status_t ee_field_input(const ib_field_t *field,
+                                  const uint8_t **input,
+                                  size_t *input_len)
+{
+    ib_status_t rc;
+
+    assert(field != NULL);
+    assert(input != NULL);
+    assert(input_len != NULL);
+
+    if (field->type == IB_FTYPE_NULSTR) {
+        const char *s;
+        rc = ib_field_value(field, ib_ftype_nulstr_out(&s));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        *input = (const uint8_t *)s;
+        *input_len = strlen(s);
+    }
+    else if (field->type == IB_FTYPE_BYTESTR) {
+        const ib_bytestr_t *bs;
+        rc = ib_field_value(field, ib_ftype_bytestr_out(&bs));
+        if (rc != IB_OK) {
+            return rc;
+        }
+        *input = ib_bytestr_const_ptr(bs);
+        *input_len = ib_bytestr_length(bs);
+    }
+    else {
+        return IB_EINVAL;
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Run @a state on the value of @a field.
+ *
+ * @param[in] state Automata state.
+ * @param[in,out] cbdata Callback data of @a state.
+ * @param[in] field String field to execute on.
+ * @param[out] result Set to 1 if a match is found, 0 otherwise.
+ * @param[out] at_end Set to true if the automata can make no more progress.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if @a field is not a string field.
+ *   - IB_EUNKNOWN if the callback reported an error.
+ */
+static ib_status_t ee_execute_field(ia_eudoxus_state_t *state,
+                                    ee_callback_data_t *cbdata,
+                                    const ib_field_t *field,
+                                    ib_num_t *result,
+                                    bool *at_end)
+{
+    ib_status_t rc;
+    ia_eudoxus_result_t ia_rc;
+    const uint8_t *input;
+    size_t input_len;
+
+    rc = ee_field_input(field, &input, &input_len);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    *result = 0;
+    cbdata->input_start = input;
+    ia_rc = ia_eudoxus_execute(state, input, input_len);
+    if (ia_rc == IA_EUDOXUS_STOP) {
+        *result = 1;
+    }
+    else if (ia_rc == IA_EUDOXUS_END) {
+        *at_end = true;
+    }
+    else if (ia_rc == IA_EUDOXUS_ERROR) {
+        return IB_EUNKNOWN;
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Run a new automata state on @a field.
+ *
+ * List fields are executed member by member, each with its own state, until
+ * a member matches.
+ *
+ * @param[in] rule_exec The rule being executed.
+ * @param[in] eudoxus Eudoxus engine.
+ * @param[in] field Field to execute on.
+ * @param[out] result Set to 1 if a match is found, 0 otherwise.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if a state could not be created or a field is not a string.
+ *   - IB_EUNKNOWN if the callback reported an error.
+ */
+static ib_status_t ee_execute_phase(const ib_rule_exec_t *rule_exec,
+                                    ia_eudoxus_t *eudoxus,
+                                    const ib_field_t *field,
+                                    ib_num_t *result)
+{
+    ib_status_t rc;
+    ia_eudoxus_result_t ia_rc;
+    ia_eudoxus_state_t *state;
+    ee_callback_data_t cbdata;
+    bool at_end = false;
+
+    if (field->type == IB_FTYPE_LIST) {
+        const ib_list_t *list;
+        const ib_list_node_t *node;
+
+        rc = ib_field_value(field, ib_ftype_list_out(&list));
+        if (rc != IB_OK) {
+            return rc;
+        }
+
+        IB_LIST_LOOP_CONST(list, node) {
+            rc = ee_execute_phase(rule_exec, eudoxus,
+                                  (const ib_field_t *)ib_list_node_data_const(node),
+                                  result);
+            if (rc != IB_OK || *result != 0) {
+                return rc;
+            }
+        }
+        return IB_OK;
+    }
+
+    cbdata.rule_exec = rule_exec;
+    cbdata.input_start = NULL;
+    cbdata.draining = false;
+    ia_rc = ia_eudoxus_create_state(&state, eudoxus, ee_first_match_callback,
+                                    &cbdata);
+    if (ia_rc != IA_EUDOXUS_OK) {
+        return IB_EINVAL;
+    }
+    rc = ee_execute_field(state, &cbdata, field, result, &at_end);
+    ia_eudoxus_destroy_state(state);
+
+    return rc;
+}
+
+/**
+ * Memory pool cleanup function to destroy a stream automata state.
+ *
+ * @param[in] data The ee_stream_data_t whose state to destroy.
+ */
+static void ee_stream_data_cleanup(void *data)
+{
+    ee_stream_data_t *stream_data = data;
+
+    assert(stream_data != NULL);
+
+    ia_eudoxus_destroy_state(stream_data->state);
+    stream_data->state = NULL;
+}
+
+/**
+ * Get or create the stream state of @a rule_exec's rule in its transaction.
+ *
+ * The automata state is destroyed when the transaction memory pool is
+ * released.
+ *
+ * @param[in] rule_exec The rule being executed.
+ * @param[in] eudoxus Eudoxus engine.
+ * @param[out] stream_data Stream state.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ *   - IB_EINVAL if a state could not be created.
+ */
+static ib_status_t ee_get_stream_data(const ib_rule_exec_t *rule_exec,
+                                      ia_eudoxus_t *eudoxus,
+                                      ee_stream_data_t **stream_data)
+{
+    ib_tx_t *tx = rule_exec->tx;
+    const char *id = ib_rule_id(rule_exec->rule);
+    ee_tx_data_t *tx_data = NULL;
+    ee_stream_data_t *data;
+    ia_eudoxus_result_t ia_rc;
+    ib_status_t rc;
+
+    assert(tx != NULL);
+    assert(id != NULL);
+
+    rc = ib_tx_get_module_data(tx, IB_MODULE_STRUCT_PTR, (void **)&tx_data);
+    if (rc != IB_OK || tx_data == NULL) {
+        tx_data = ib_mpool_alloc(tx->mp, sizeof(*tx_data));
+        if (tx_data == NULL) {
+            return IB_EALLOC;
+        }
+        rc = ib_hash_create(&tx_data->stream_data, tx->mp);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_tx_set_module_data(tx, IB_MODULE_STRUCT_PTR, tx_data);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    rc = ib_hash_get(tx_data->stream_data, stream_data, id);
+    if (rc == IB_OK) {
+        (*stream_data)->cbdata.rule_exec = rule_exec;
+        return IB_OK;
+    }
+
+    data = ib_mpool_alloc(tx->mp, sizeof(*data));
+    if (data == NULL) {
+        return IB_EALLOC;
+    }
+    data->cbdata.rule_exec = rule_exec;
+    data->cbdata.input_start = NULL;
+    data->cbdata.draining = false;
+    data->at_end = false;
+
+    ia_rc = ia_eudoxus_create_state(&data->state, eudoxus,
+                                    ee_first_match_callback, &data->cbdata);
+    if (ia_rc != IA_EUDOXUS_OK) {
+        return IB_EINVAL;
+    }
+    rc = ib_mpool_cleanup_register(tx->mp, ee_stream_data_cleanup, data);
+    if (rc != IB_OK) {
+        ia_eudoxus_destroy_state(data->state);
+        return rc;
+    }
+
+    rc = ib_hash_set(tx_data->stream_data, id, data);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    *stream_data = data;
+    return IB_OK;
+}
+
+/**
+ * Consume the rest of the input a stream state stopped in.
+ *
+ * A match stops the automata in the middle of its input.  The next chunk
+ * must continue from the end of this input rather than from the match, so
+ * the remainder is run without stopping or capturing.
+ *
+ * @param[in] stream_data Stream state that just stopped on a match.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EUNKNOWN if the automata reported an error.
+ */
+static ib_status_t ee_stream_drain(ee_stream_data_t *stream_data)
+{
+    ia_eudoxus_result_t ia_rc;
+
+    assert(stream_data != NULL);
+
+    stream_data->cbdata.draining = true;
+    ia_rc = ia_eudoxus_execute(stream_data->state, NULL, 0);
+    stream_data->cbdata.draining = false;
+
+    if (ia_rc == IA_EUDOXUS_END) {
+        stream_data->at_end = true;
+    }
+    else if (ia_rc != IA_EUDOXUS_OK) {
+        return IB_EUNKNOWN;
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Run the stream state on one chunk.
+ *
+ * @param[in] stream_data Stream state.
+ * @param[in] field String field (chunk) to execute on.
+ * @param[out] result Set to 1 if a match completes in @a field, 0 otherwise.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if @a field is not a string.
+ *   - IB_EUNKNOWN if the callback reported an error.
+ */
+static ib_status_t ee_stream_execute_field(ee_stream_data_t *stream_data,
+                                           const ib_field_t *field,
+                                           ib_num_t *result)
+{
+    ib_status_t rc;
+
+    rc = ee_execute_field(stream_data->state, &stream_data->cbdata,
+                          field, result, &stream_data->at_end);
+    if ( (rc != IB_OK) || (*result == 0) ) {
+        return rc;
+    }
+
+    return ee_stream_drain(stream_data);
+}
+
+/**
+ * Resume the stream state of @a rule_exec's rule on @a field.
+ *
+ * List fields are treated as consecutive chunks of the stream.
+ *
+ * @param[in] rule_exec The rule being executed.
+ * @param[in] eudoxus Eudoxus engine.
+ * @param[in] field Field (chunk) to execute on.
+ * @param[out] result Set to 1 if a match completes in @a field, 0 otherwise.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if a field is not a string.
+ *   - IB_EUNKNOWN if the callback reported an error.
+ *   - Errors from ee_get_stream_data().
+ */
+static ib_status_t ee_execute_stream(const ib_rule_exec_t *rule_exec,
+                                     ia_eudoxus_t *eudoxus,
+                                     const ib_field_t *field,
+                                     ib_num_t *result)
+{
+    ib_status_t rc;
+    ee_stream_data_t *stream_data;
+
+    rc = ee_get_stream_data(rule_exec, eudoxus, &stream_data);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if (stream_data->at_end) {
+        return IB_OK;
+    }
+
+    if (field->type == IB_FTYPE_LIST) {
+        const ib_list_t *list;
+        const ib_list_node_t *node;
+
+        rc = ib_field_value(field, ib_ftype_list_out(&list));
+        if (rc != IB_OK) {
+            return rc;
+        }
+
+        IB_LIST_LOOP_CONST(list, node) {
+            ib_num_t member_result = 0;
+
+            rc = ee_stream_execute_field(
+                stream_data,
+                (const ib_field_t *)ib_list_node_data_const(node),
+                &member_result);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            if (member_result != 0) {
+                *result = 1;
+            }
+            if (stream_data->at_end) {
+                break;
+            }
+        }
+        return IB_OK;
+    }
+
+    return ee_stream_execute_field(stream_data, field, result);
+}
+
 /**
  * Execute the @c ee_match_any operator.
  *
  * At first match the operator will stop searching and return true.
  *
+ * When used in a stream rule, the automata state is kept for the rest of
+ * the transaction and resumed on each chunk, so matches spanning chunk
+ * boundaries are found.  List fields are searched member by member.
+ *
  * The capture option is supported; the matched pattern will be placed in the
  * capture variable if a match occurs.
  *
@@ -268,58 +793,22 @@ static ib_status_t ee_match_any_operator_execute(
     ib_field_t *field,
     ib_num_t *result)
 {
-    ib_status_t rc;
-    ia_eudoxus_result_t ia_rc;
     ia_eudoxus_t* eudoxus = data;
-    ia_eudoxus_state_t* state;
-    const char *input;
-    size_t input_len;
 
     assert(rule_exec != NULL);
     assert(data != NULL);
 
     *result = 0;
 
-    if (field->type == IB_FTYPE_NULSTR) {
-        rc = ib_field_value(field, ib_ftype_nulstr_out(&input));
-        if (rc != IB_OK) {
-            return rc;
-        }
-        input_len = strlen(input);
-    }
-    else if (field->type == IB_FTYPE_BYTESTR) {
-        const ib_bytestr_t *bs;
-        rc = ib_field_value(field, ib_ftype_bytestr_out(&bs));
-        if (rc != IB_OK) {
-            return rc;
-        }
-        input = (const char *)ib_bytestr_const_ptr(bs);
-        input_len = ib_bytestr_length(bs);
-    }
-    else if (field->type == IB_FTYPE_LIST) {
-        return IB_ENOTIMPL;
-    }
-    else {
+    if (field == NULL) {
         return IB_EINVAL;
     }
 
-    ia_rc = ia_eudoxus_create_state(&state, eudoxus, ee_first_match_callback,
-                                    (void *)rule_exec);
-    if (ia_rc != IA_EUDOXUS_OK) {
-        return IB_EINVAL;
-    }
-    rc = IB_OK;
-    ia_rc = ia_eudoxus_execute(state, (const uint8_t *)input, input_len);
-    if (ia_rc == IA_EUDOXUS_STOP) {
-        *result = 1;
-        rc = IB_OK;
+    if (ib_rule_is_stream(rule_exec->rule)) {
+        return ee_execute_stream(rule_exec, eudoxus, field, result);
     }
-    else if (ia_rc == IA_EUDOXUS_ERROR) {
-        rc = IB_EUNKNOWN;
-    }
-    ia_eudoxus_destroy_state(state);
 
-    return rc;
+    return ee_execute_phase(rule_exec, eudoxus, field, result);
 }
 
 /**
@@ -334,8 +823,8 @@ static ib_status_t ee_match_any_operator_destroy(ib_operator_inst_t *op_inst)
 /**
  * Initialize the eudoxus operator module.
  *
- * Registers the operators and the hash for storing the eudoxus engine
- * instances created by the LoadEudoxus directive.
+ * Registers the operators and creates the hash for storing the eudoxus
+ * engine instances created by the LoadEudoxus directive as the module data.
  *
  * @param[in] ib Ironbee engine.
  * @param[in] m Module instance.
@@ -347,14 +836,16 @@ static ib_status_t ee_module_init(ib_engine_t *ib,
 {
     ib_status_t rc;
     ib_mpool_t *mp;
+    ib_hash_t *pattern_hash;
 
     ib_mpool_create(&mp, "ee_module", ib_engine_pool_main_get(ib));
-    if (g_eudoxus_pattern_hash == NULL) {
-        rc = ib_hash_create_nocase(&g_eudoxus_pattern_hash, mp);
+    if (m->data == NULL) {
+        rc = ib_hash_create_nocase(&pattern_hash, mp);
         if (rc != IB_OK ) {
             ib_log_error(ib, MODULE_NAME_STR ": Error initializing module.");
             return rc;
         }
+        m->data = pattern_hash;
     }
 
     ib_operator_register(ib,
@@ -390,10 +881,11 @@ static ib_status_t ee_module_finish(ib_engine_t *ib,
     ib_list_node_t *next;
     ia_eudoxus_t *eudoxus;
     ib_mpool_t *pool;
+    ib_hash_t *pattern_hash = (ib_hash_t *)m->data;
 
     /* Destroy all eudoxus automata */
-    if (g_eudoxus_pattern_hash != NULL) {
-        pool = ib_hash_pool(g_eudoxus_pattern_hash);
+    if (pattern_hash != NULL) {
+        pool = ib_hash_pool(pattern_hash);
 
         /* The only way to iterate over a hash is to covert it into a list. */
         rc = ib_list_create(&list, pool);
@@ -401,7 +893,7 @@ static ib_status_t ee_module_finish(ib_engine_t *ib,
             ib_log_error(ib, MODULE_NAME_STR ": Error unloading module.");
             return rc;
         }
-        rc = ib_hash_get_all(g_eudoxus_pattern_hash, list);
+        rc = ib_hash_get_all(pattern_hash, list);
         if (rc != IB_OK) {
             return rc;
         }
@@ -412,9 +904,9 @@ static ib_status_t ee_module_finish(ib_engine_t *ib,
             }
             ib_list_node_remove(list, node);
         }
-        ib_hash_clear(g_eudoxus_pattern_hash);
+        ib_hash_clear(pattern_hash);
         ib_mpool_release(pool);
-        g_eudoxus_pattern_hash = NULL;
+        m->data = NULL;
     }
 
     return IB_OK;
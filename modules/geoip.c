@@ -37,10 +37,9 @@
 /* Declare the public module symbol. */
 IB_MODULE_DECLARE();
 
-/**
- * The GeoIP database.
+/*
+ * The GeoIP database of an engine is the data of its module instance.
  */
-static GeoIP *geoip_db = NULL;
 
 static ib_status_t geoip_lookup(
     ib_engine_t *ib,
@@ -49,6 +48,8 @@ static ib_status_t geoip_lookup(
     void *data
 )
 {
+    const ib_module_t *m = (const ib_module_t *)data;
+    GeoIP *geoip_db = (GeoIP *)m->data;
     const char *ip = tx->er_ipstr;
 
     if (ip == NULL) {
@@ -197,10 +198,18 @@ static ib_status_t geoip_database_file_dir_param1(ib_cfgparser_t *cp,
     assert(p1!=NULL);
 
     ib_status_t rc;
+    ib_module_t *m;
+    GeoIP *geoip_db;
     size_t p1_len = strlen(p1);
     size_t p1_unescaped_len;
-    char *p1_unescaped = malloc(p1_len+1);
+    char *p1_unescaped;
 
+    rc = ib_engine_module_get(cp->ib, MODULE_NAME_STR, &m);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    p1_unescaped = malloc(p1_len+1);
     if ( p1_unescaped == NULL ) {
         return IB_EALLOC;
     }
@@ -222,10 +231,10 @@ static ib_status_t geoip_database_file_dir_param1(ib_cfgparser_t *cp,
         return rc;
     }
 
-    if (geoip_db != NULL)
+    if (m->data != NULL)
     {
-        GeoIP_delete(geoip_db);
-        geoip_db = NULL;
+        GeoIP_delete((GeoIP *)m->data);
+        m->data = NULL;
     }
 
             geoip_db = GeoIP_open(p1_unescaped, GEOIP_MMAP_CACHE);
@@ -236,6 +245,7 @@ static ib_status_t geoip_database_file_dir_param1(ib_cfgparser_t *cp,
     {
                 return IB_EUNKNOWN;
     }
+    m->data = geoip_db;
 
     return IB_OK;
 }
@@ -258,13 +268,13 @@ static ib_status_t geoip_init(ib_engine_t *ib, ib_module_t *m, void *cbdata)
 {
     ib_status_t rc;
 
-    if (geoip_db == NULL)
+    if (m->data == NULL)
     {
         ib_log_debug(ib, "Initializing default GeoIP database...");
-        geoip_db = GeoIP_new(GEOIP_MMAP_CACHE);
+        m->data = GeoIP_new(GEOIP_MMAP_CACHE);
     }
 
-    if (geoip_db == NULL)
+    if (m->data == NULL)
     {
         ib_log_debug(ib, "Failed to initialize GeoIP database.");
         return IB_EUNKNOWN;
@@ -277,7 +287,7 @@ static ib_status_t geoip_init(ib_engine_t *ib, ib_module_t *m, void *cbdata)
     rc = ib_hook_tx_register(ib,
                              handle_context_tx_event,
                              geoip_lookup,
-                             NULL);
+                             m);
 
     ib_log_debug(ib, "Done registering handler.");
 
@@ -294,9 +304,10 @@ static ib_status_t geoip_init(ib_engine_t *ib, ib_module_t *m, void *cbdata)
 /* Called when module is unloaded. */
 static ib_status_t geoip_fini(ib_engine_t *ib, ib_module_t *m, void *cbdata)
 {
-    if (geoip_db!=NULL)
+    if (m->data!=NULL)
     {
-        GeoIP_delete(geoip_db);
+        GeoIP_delete((GeoIP *)m->data);
+        m->data = NULL;
     }
     ib_log_debug(ib, "GeoIP module unloaded.");
     return IB_OK;
@@ -38,6 +38,7 @@
 #include <ironbee/module.h>
 #include <ironbee/mpool.h>
 #include <ironbee/provider.h>
+#include <ironbee/string.h>
 
 #include <lauxlib.h>
 #include <lua.h>
@@ -46,6 +47,8 @@
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 
 #if defined(__cplusplus) && !defined(__STDC_FORMAT_MACROS)
 /* C99 requires that inttypes.h only exposes PRI* macros
@@ -70,29 +73,12 @@
 /* Define the public module symbol. */
 IB_MODULE_DECLARE();
 
-typedef struct modlua_runtime_t modlua_runtime_t;
 typedef struct modlua_cfg_t modlua_cfg_t;
 typedef struct modlua_lua_cbdata_t modlua_lua_cbdata_t;
-
-/**
- * Callback type for functions executed protected by global lock.
- *
- * This callback should take a @c ib_engine_t* which is used
- * for logging, a @c lua_State* which is used to create the
- * new thread, and a @c lua_State** which will be assigned a
- * new @c lua_State*.
- */
-typedef ib_status_t(*critical_section_fn_t)(ib_engine_t *ib,
-                                            lua_State *parent,
-                                            lua_State **out_new);
-/**
- * Per-connection module data containing a Lua runtime.
- *
- * Created for each connection and stored as the module's connection data.
- */
-struct modlua_runtime_t {
-    lua_State          *L;            /**< Lua stack */
-};
+typedef struct modlua_journal_t modlua_journal_t;
+typedef struct modlua_state_t modlua_state_t;
+typedef struct modlua_pool_t modlua_pool_t;
+typedef struct modlua_exec_t modlua_exec_t;
 
 /**
  * Callback data passed to Lua module C dispatch functions.
@@ -107,22 +93,125 @@ struct modlua_lua_cbdata_t {
     ib_module_t *module; /**< The module object for this Lua module. */
 };
 
+/**
+ * Kind of configuration step recorded in the configuration journal.
+ */
+typedef enum {
+    MODLUA_JOURNAL_MODULE,    /**< A Lua module was loaded. */
+    MODLUA_JOURNAL_DIRECTIVE, /**< A Lua module directive was processed. */
+    MODLUA_JOURNAL_RULE       /**< A Lua rule was loaded. */
+} modlua_journal_type_t;
+
+/**
+ * Type of a recorded directive argument.
+ */
+typedef enum {
+    MODLUA_ARG_STRING,        /**< Pushed as a Lua string. */
+    MODLUA_ARG_INTEGER,       /**< Pushed as a Lua integer. */
+    MODLUA_ARG_LIST           /**< Pushed as a light userdata ib_list_t. */
+} modlua_arg_type_t;
+
+/**
+ * A recorded directive argument.
+ */
+typedef struct {
+    modlua_arg_type_t  type;  /**< Which member is valid. */
+    const char        *str;   /**< MODLUA_ARG_STRING value. */
+    lua_Integer        num;   /**< MODLUA_ARG_INTEGER value. */
+    const ib_list_t   *list;  /**< MODLUA_ARG_LIST value. */
+} modlua_arg_t;
+
+/** Maximum number of arguments of a Lua module directive callback. */
+#define MODLUA_MAX_ARGS 2
+
+/**
+ * One step of Lua configuration.
+ *
+ * Every step that changes the configuration-time Lua state is recorded so
+ * that it can be replayed, in order, into the Lua states used by worker
+ * threads. All data is allocated from the engine main memory pool.
+ */
+struct modlua_journal_t {
+    modlua_journal_type_t  type;      /**< Kind of step. */
+    ib_module_t           *module;    /**< Lua module (MODULE, DIRECTIVE). */
+    const char            *file;      /**< File loaded (MODULE, RULE). */
+    const char            *func_name; /**< Rule function name (RULE). */
+    ib_context_t          *ctx;       /**< Context of directive (DIRECTIVE). */
+    const char            *handler;   /**< modlua handler (DIRECTIVE). */
+    const char            *name;      /**< Directive name (DIRECTIVE). */
+    int                    nargs;     /**< Number of args (DIRECTIVE). */
+    modlua_arg_t           args[MODLUA_MAX_ARGS]; /**< Args (DIRECTIVE). */
+};
+
+/**
+ * A fully configured Lua state.
+ *
+ * A state is claimed by one worker thread for the duration of a Lua
+ * execution, so no locking is needed to execute Lua on it. Lua executed
+ * from within Lua on the same thread reuses the claimed state.
+ */
+struct modlua_state_t {
+    lua_State      *L;         /**< Lua runtime stack. */
+    modlua_pool_t  *pool;      /**< Pool the state belongs to. */
+    pthread_t       owner;     /**< Thread the state is claimed by. */
+    size_t          depth;     /**< Nested claims by owner; 0 when idle. */
+    modlua_state_t *next_idle; /**< Next state not claimed. */
+    modlua_state_t *next;      /**< Next state in registry. */
+};
+
+/**
+ * Pool of Lua states shared by the worker threads.
+ *
+ * All states are built when configuration finishes; a thread that finds
+ * no idle state waits for one to be released rather than building one.
+ * The lock is only taken when a thread claims or releases a state, never
+ * while Lua code is running.
+ */
+struct modlua_pool_t {
+    pthread_key_t   key;        /**< State the thread last claimed. */
+    ib_lock_t       lock;       /**< Protects all states and idle. */
+    pthread_cond_t  released;   /**< Signaled when a state becomes idle. */
+    modlua_state_t *states;     /**< Every state, for destruction. */
+    modlua_state_t *idle;       /**< States not claimed by a thread. */
+    size_t          num_states; /**< Number of states in @c states. */
+    bool            ready;      /**< Configuration has finished. */
+};
+
+/**
+ * A Lua thread (coroutine) borrowed from the calling thread's state.
+ *
+ * Each callback and rule executes on its own coroutine so that errors or
+ * stack imbalance in one cannot leak into another.
+ */
+struct modlua_exec_t {
+    modlua_state_t *state;     /**< Claimed state; NULL at config time. */
+    lua_State      *parent;    /**< Lua state of @c state. */
+    lua_State      *L;         /**< Coroutine to execute on. */
+    int             ref;       /**< Registry reference anchoring @c L. */
+};
+
 /**
  * Global module configuration.
+ *
+ * Each engine has its own copy, see modlua_global_cfg_get().
  */
 struct modlua_cfg_t {
     char               *pkg_path;  /**< Package path Lua Configuration. */
     char               *pkg_cpath; /**< Cpath Lua Configuration. */
-    lua_State          *L;         /**< Lua runtime stack. */
-    ib_lock_t          *L_lck;     /**< Lua runtime stack lock. */
+    lua_State          *L;         /**< Configuration-time Lua state. */
+    ib_list_t          *journal;   /**< List of modlua_journal_t. */
+    modlua_pool_t      *pool;      /**< Worker thread Lua states. */
+    ib_num_t            states;    /**< States to build when config ends. */
 };
 
 /* Instantiate a module global configuration. */
 static modlua_cfg_t modlua_global_cfg = {
     NULL, /* pkg_path */
     NULL, /* pkg_cpath */
-    NULL,
-    NULL
+    NULL, /* L */
+    NULL, /* journal */
+    NULL, /* pool */
+    0     /* states */
 };
 
 ib_status_t modlua_rule_driver(
@@ -133,134 +222,43 @@ ib_status_t modlua_rule_driver(
     void *cbdata
 );
 
-/* -- Lua Routines -- */
-
-#define IB_FFI_MODULE  ironbee-ffi
-#define IB_FFI_MODULE_STR IB_XSTRINGIFY(IB_FFI_MODULE)
-
-#define IB_FFI_MODULE_WRAPPER     _IRONBEE_CALL_MODULE_HANDLER
-#define IB_FFI_MODULE_WRAPPER_STR IB_XSTRINGIFY(IB_FFI_MODULE_WRAPPER)
-
-#define IB_FFI_MODULE_CFG_WRAPPER     _IRONBEE_CALL_CONFIG_HANDLER
-#define IB_FFI_MODULE_CFG_WRAPPER_STR IB_XSTRINGIFY(IB_FFI_MODULE_CFG_WRAPPER)
-
-#define IB_FFI_MODULE_EVENT_WRAPPER     _IRONBEE_CALL_EVENT_HANDLER
-#define IB_FFI_MODULE_EVENT_WRAPPER_STR IB_XSTRINGIFY(IB_FFI_MODULE_EVENT_WRAPPER)
+static ib_status_t modlua_exec_begin(ib_engine_t *ib, modlua_exec_t *exec);
+static void modlua_exec_end(modlua_exec_t *exec);
 
 /**
- * Get the lua runtime from the connection.
- *
- * @param[in] conn Connection
- * @param[out] lua Lua runtime struct.
+ * Get the global configuration of the lua module of @a ib.
  *
- * @returns
- *   - IB_OK on success.
- *   - Result of ib_engine_module_get() on error.
- */
-static ib_status_t modlua_runtime_get(
-    ib_conn_t *conn,
-    modlua_runtime_t **lua)
-{
-    assert(conn);
-    assert(conn->ib);
-    assert(lua);
-
-    ib_status_t rc;
-    ib_module_t *module;
-
-    rc = ib_engine_module_get(conn->ib, MODULE_NAME_STR, &module);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    ib_conn_get_module_data(conn, module, (void **)lua);
-
-    return IB_OK;
-}
-
-/**
- * Set the lua runtime from the connection.
- *
- * @param[in] conn Connection
- * @param[in] lua Lua runtime struct.
+ * @param[in] ib IronBee engine.
  *
- * @returns
- *   - IB_OK on success.
- *   - Result of ib_engine_module_get() on error.
+ * @returns The engine's global configuration, or NULL if the lua module is
+ *          not loaded in @a ib.
  */
-static ib_status_t modlua_runtime_set(
-    ib_conn_t *conn,
-    modlua_runtime_t *lua)
+static modlua_cfg_t *modlua_global_cfg_get(ib_engine_t *ib)
 {
-    assert(conn);
-    assert(conn->ib);
-    assert(lua);
+    assert(ib);
 
-    ib_status_t rc;
-    ib_module_t *module;
+    ib_module_t *m;
 
-    rc = ib_engine_module_get(conn->ib, MODULE_NAME_STR, &module);
-    if (rc != IB_OK) {
-        return rc;
+    if (ib_engine_module_get(ib, MODULE_NAME_STR, &m) != IB_OK) {
+        return NULL;
     }
 
-    ib_conn_set_module_data(conn, module, lua);
-
-    return IB_OK;
+    return (modlua_cfg_t *)m->gcdata;
 }
 
-/**
- * This will use module lock to atomically call @a fn.
- *
- * The argument @a fn will be either
- * ib_lua_new_thread() or ib_lua_join_thread() which will be called
- * only if module lock can be locked using @c semop.
- *
- * @param[in] ib IronBee context. Used for logging.
- * @param[in] fn The function to execute. This is passed @a ib and @a fn.
- * @param[in,out] L The Lua State to create or destroy. Passed to @a fn.
- * @returns If any error locking or unlocking the
- *          semaphore is encountered, the error code is returned.
- *          Otherwise the result of @a fn is returned.
- */
-static ib_status_t call_in_critical_section(ib_engine_t *ib,
-                                            critical_section_fn_t fn,
-                                            lua_State **L)
-{
-    assert(ib);
-    assert(fn);
-    assert(L);
-
-    /* Return code from IronBee calls. */
-    ib_status_t ib_rc;
-    /* Return code form critical call. */
-    ib_status_t critical_rc;
-
-    ib_rc  = ib_lock_lock(modlua_global_cfg.L_lck);
-    /* Report semop error and return. */
-    if (ib_rc != IB_OK) {
-        ib_log_error(ib, "Failed to lock Lua context.");
-        return ib_rc;
-    }
-
-    /* Execute lua call in critical section. */
-    critical_rc = fn(ib, modlua_global_cfg.L, L);
+/* -- Lua Routines -- */
 
-    ib_rc = ib_lock_unlock(modlua_global_cfg.L_lck);
+#define IB_FFI_MODULE  ironbee-ffi
+#define IB_FFI_MODULE_STR IB_XSTRINGIFY(IB_FFI_MODULE)
 
-    if (critical_rc != IB_OK) {
-        ib_log_error(ib, "Critical call failed: %s",
-                     ib_status_to_string(critical_rc));
-    }
+#define IB_FFI_MODULE_WRAPPER     _IRONBEE_CALL_MODULE_HANDLER
+#define IB_FFI_MODULE_WRAPPER_STR IB_XSTRINGIFY(IB_FFI_MODULE_WRAPPER)
 
-    /* Report semop error and return. */
-    if (ib_rc != IB_OK) {
-        ib_log_error(ib, "Failed to unlock Lua context.");
-        return ib_rc;
-    }
+#define IB_FFI_MODULE_CFG_WRAPPER     _IRONBEE_CALL_CONFIG_HANDLER
+#define IB_FFI_MODULE_CFG_WRAPPER_STR IB_XSTRINGIFY(IB_FFI_MODULE_CFG_WRAPPER)
 
-    return critical_rc;
-}
+#define IB_FFI_MODULE_EVENT_WRAPPER     _IRONBEE_CALL_EVENT_HANDLER
+#define IB_FFI_MODULE_EVENT_WRAPPER_STR IB_XSTRINGIFY(IB_FFI_MODULE_EVENT_WRAPPER)
 
 /**
  * Create a near-empty module structure.
@@ -466,72 +464,147 @@ static ib_status_t modlua_push_config_path(
 }
 
 /**
- * @param[in] cp Configuration parser.
- * @param[in] name Directive name for the block that is being closed.
- * @param[in,out] cbdata Callback data.
+ * Call a modlua directive handler on @a L for a recorded directive.
+ *
+ * This is used both when the directive is first processed, against the
+ * configuration-time Lua state, and when the journal is replayed into a
+ * worker thread's Lua state.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in] L Lua state to configure.
+ * @param[in] entry The recorded directive.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - The directive handler's status or IB_EINVAL on a Lua error.
  */
-static ib_status_t modlua_config_cb_blkend(
-    ib_cfgparser_t *cp,
-    const char *name,
-    void *cbdata)
+static ib_status_t modlua_config_cb_run(
+    ib_engine_t *ib,
+    lua_State *L,
+    const modlua_journal_t *entry)
 {
-    assert(cp);
-    assert(name);
-    assert(cbdata);
+    assert(ib);
+    assert(L);
+    assert(entry);
+    assert(entry->type == MODLUA_JOURNAL_DIRECTIVE);
 
     ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
-
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
+    ib_module_t *module = entry->module;
 
     /* Push standard module directive arguments. */
     lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_blkend");
+    lua_getfield(L, -1, entry->handler);
     lua_replace(L, -2); /* Effectively remove then modlua table. */
     lua_pushlightuserdata(L, module->ib);
     lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
+    rc = modlua_push_config_path(ib, entry->ctx, L);
     if (rc != IB_OK) {
         lua_pop(L, 3);
         return rc;
     }
 
     /* Push config parameters. */
-    lua_pushstring(L, name);
+    lua_pushstring(L, entry->name);
+    for (int i = 0; i < entry->nargs; ++i) {
+        const modlua_arg_t *arg = &(entry->args[i]);
+
+        switch(arg->type) {
+            case MODLUA_ARG_STRING:
+                lua_pushstring(L, arg->str);
+                break;
+            case MODLUA_ARG_INTEGER:
+                lua_pushinteger(L, arg->num);
+                break;
+            case MODLUA_ARG_LIST:
+                lua_pushlightuserdata(L, (void *)arg->list);
+                break;
+        }
+    }
 
-    rc = modlua_config_cb_eval(L, ib, module, name, 4);
-    return rc;
+    return modlua_config_cb_eval(L, ib, module, entry->name, 4 + entry->nargs);
+}
+
+/**
+ * Append a step to the configuration journal.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in] type Kind of step.
+ * @param[out] entry The new, zeroed, journal entry. Set when IB_OK.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ */
+static ib_status_t modlua_journal_add(
+    ib_engine_t *ib,
+    modlua_journal_type_t type,
+    modlua_journal_t **entry)
+{
+    assert(ib);
+    assert(entry);
+
+    ib_status_t rc;
+    modlua_cfg_t *cfg = modlua_global_cfg_get(ib);
+    modlua_journal_t *new_entry;
+
+    assert(cfg);
+    assert(cfg->journal);
+
+    new_entry = ib_mpool_calloc(ib_engine_pool_main_get(ib),
+                                1,
+                                sizeof(*new_entry));
+    if (new_entry == NULL) {
+        return IB_EALLOC;
+    }
+    new_entry->type = type;
+
+    rc = ib_list_push(cfg->journal, new_entry);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    *entry = new_entry;
+    return IB_OK;
 }
 
 /**
+ * Record a Lua module directive and run it against the configuration state.
+ *
+ * String and list arguments are copied into the engine main memory pool so
+ * that they outlive the configuration parser.
+ *
  * @param[in] cp Configuration parser.
  * @param[in] name Configuration directive name.
- * @param[in] onoff On or off setting.
- * @param[in] cbdata Callback data.
+ * @param[in] cbdata Callback data; a modlua_lua_cbdata_t.
+ * @param[in] handler Name of the function in the modlua Lua table to call.
+ * @param[in] args Directive arguments.
+ * @param[in] nargs Number of elements in @a args.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ *   - The result of the directive handler.
  */
-static ib_status_t modlua_config_cb_onoff(
+static ib_status_t modlua_config_cb_record(
     ib_cfgparser_t *cp,
     const char *name,
-    int onoff,
-    void *cbdata)
+    void *cbdata,
+    const char *handler,
+    const modlua_arg_t *args,
+    int nargs)
 {
     assert(cp);
     assert(name);
     assert(cbdata);
+    assert(handler);
+    assert(nargs <= MODLUA_MAX_ARGS);
 
     ib_status_t rc;
     modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
     ib_module_t *module = modlua_lua_cbdata->module;
     ib_engine_t *ib = module->ib;
+    ib_mpool_t *mp = ib_engine_pool_main_get(ib);
+    modlua_journal_t *entry;
     ib_context_t *ctx;
 
     rc = ib_cfgparser_context_current(cp, &ctx);
@@ -540,24 +613,95 @@ static ib_status_t modlua_config_cb_onoff(
         return rc;
     }
 
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_onoff");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
+    rc = modlua_journal_add(ib, MODLUA_JOURNAL_DIRECTIVE, &entry);
     if (rc != IB_OK) {
-        lua_pop(L, 3);
         return rc;
     }
+    entry->module = module;
+    entry->ctx = ctx;
+    entry->handler = handler;
+    entry->name = ib_mpool_strdup(mp, name);
+    if (entry->name == NULL) {
+        return IB_EALLOC;
+    }
+    entry->nargs = nargs;
 
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushinteger(L, onoff);
+    for (int i = 0; i < nargs; ++i) {
+        modlua_arg_t *arg = &(entry->args[i]);
 
-    rc = modlua_config_cb_eval(L, ib, module, name, 5);
-    return rc;
+        *arg = args[i];
+        if (arg->type == MODLUA_ARG_STRING) {
+            arg->str = ib_mpool_strdup(mp, args[i].str);
+            if (arg->str == NULL) {
+                return IB_EALLOC;
+            }
+        }
+        else if (arg->type == MODLUA_ARG_LIST) {
+            const ib_list_node_t *node;
+            ib_list_t *list;
+
+            rc = ib_list_create(&list, mp);
+            if (rc != IB_OK) {
+                return rc;
+            }
+            IB_LIST_LOOP_CONST(args[i].list, node) {
+                const char *str =
+                    ib_mpool_strdup(mp, ib_list_node_data_const(node));
+                if (str == NULL) {
+                    return IB_EALLOC;
+                }
+                rc = ib_list_push(list, (void *)str);
+                if (rc != IB_OK) {
+                    return rc;
+                }
+            }
+            arg->list = list;
+        }
+    }
+
+    return modlua_config_cb_run(ib, modlua_global_cfg_get(ib)->L, entry);
+}
+
+/**
+ * @param[in] cp Configuration parser.
+ * @param[in] name Directive name for the block that is being closed.
+ * @param[in,out] cbdata Callback data.
+ */
+static ib_status_t modlua_config_cb_blkend(
+    ib_cfgparser_t *cp,
+    const char *name,
+    void *cbdata)
+{
+    assert(cp);
+    assert(name);
+    assert(cbdata);
+
+    return modlua_config_cb_record(
+        cp, name, cbdata, "modlua_config_cb_blkend", NULL, 0);
+}
+
+/**
+ * @param[in] cp Configuration parser.
+ * @param[in] name Configuration directive name.
+ * @param[in] onoff On or off setting.
+ * @param[in] cbdata Callback data.
+ */
+static ib_status_t modlua_config_cb_onoff(
+    ib_cfgparser_t *cp,
+    const char *name,
+    int onoff,
+    void *cbdata)
+{
+    assert(cp);
+    assert(name);
+    assert(cbdata);
+
+    modlua_arg_t args[1] = {
+        { MODLUA_ARG_INTEGER, NULL, onoff, NULL }
+    };
+
+    return modlua_config_cb_record(
+        cp, name, cbdata, "modlua_config_cb_onoff", args, 1);
 }
 /**
  * @param[in] cp Configuration parser.
@@ -576,37 +720,12 @@ static ib_status_t modlua_config_cb_param1(
     assert(p1);
     assert(cbdata);
 
-    ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
-
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
+    modlua_arg_t args[1] = {
+        { MODLUA_ARG_STRING, p1, 0, NULL }
+    };
 
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_param1");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
-    if (rc != IB_OK) {
-        lua_pop(L, 3);
-        return rc;
-    }
-
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushstring(L, p1);
-
-    rc = modlua_config_cb_eval(L, ib, module, name, 5);
-    return rc;
+    return modlua_config_cb_record(
+        cp, name, cbdata, "modlua_config_cb_param1", args, 1);
 }
 /**
  * @param[in] cp Configuration parser.
@@ -628,38 +747,13 @@ static ib_status_t modlua_config_cb_param2(
     assert(p2);
     assert(cbdata);
 
-    ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
-
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
-
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_param2");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
-    if (rc != IB_OK) {
-        lua_pop(L, 3);
-        return rc;
-    }
-
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushstring(L, p1);
-    lua_pushstring(L, p2);
+    modlua_arg_t args[2] = {
+        { MODLUA_ARG_STRING, p1, 0, NULL },
+        { MODLUA_ARG_STRING, p2, 0, NULL }
+    };
 
-    rc = modlua_config_cb_eval(L, ib, module, name, 6);
-    return rc;
+    return modlua_config_cb_record(
+        cp, name, cbdata, "modlua_config_cb_param2", args, 2);
 }
 /**
  * @param[in] cp Configuration parser.
@@ -678,37 +772,12 @@ static ib_status_t modlua_config_cb_list(
     assert(list);
     assert(cbdata);
 
-    ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
+    modlua_arg_t args[1] = {
+        { MODLUA_ARG_LIST, NULL, 0, list }
+    };
 
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
-
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_list");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
-    if (rc != IB_OK) {
-        lua_pop(L, 3);
-        return rc;
-    }
-
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushlightuserdata(L, (void *)list);
-
-    rc = modlua_config_cb_eval(L, ib, module, name, 5);
-    return rc;
+    return modlua_config_cb_record(
+        cp, name, cbdata, "modlua_config_cb_list", args, 1);
 }
 /**
  * @param[in] cp Configuration parser.
@@ -726,37 +795,12 @@ static ib_status_t modlua_config_cb_opflags(
     assert(name);
     assert(cbdata);
 
-    ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
-
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
-
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_opflags");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
-    if (rc != IB_OK) {
-        lua_pop(L, 3);
-        return rc;
-    }
-
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushinteger(L, mask);
+    modlua_arg_t args[1] = {
+        { MODLUA_ARG_INTEGER, NULL, mask, NULL }
+    };
 
-    rc = modlua_config_cb_eval(L, ib, module, name, 5);
-    return rc;
+    return modlua_config_cb_record(
+        cp, name, cbdata, "modlua_config_cb_opflags", args, 1);
 }
 /**
  * @param[in] cp Configuration parser.
@@ -775,37 +819,12 @@ static ib_status_t modlua_config_cb_sblk1(
     assert(p1);
     assert(cbdata);
 
-    ib_status_t rc;
-    modlua_lua_cbdata_t *modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
-    lua_State *L = modlua_global_cfg.L;
-    ib_module_t *module = modlua_lua_cbdata->module;
-    ib_engine_t *ib = module->ib;
-    ib_context_t *ctx;
-
-    rc = ib_cfgparser_context_current(cp, &ctx);
-    if (rc != IB_OK) {
-        ib_cfg_log_error(cp, "Could not retrieve current context.");
-        return rc;
-    }
-
-    /* Push standard module directive arguments. */
-    lua_getglobal(L, "modlua");
-    lua_getfield(L, -1, "modlua_config_cb_sblk1");
-    lua_replace(L, -2); /* Effectively remove then modlua table. */
-    lua_pushlightuserdata(L, module->ib);
-    lua_pushinteger(L, module->idx);
-    rc = modlua_push_config_path(ib, ctx, L);
-    if (rc != IB_OK) {
-        lua_pop(L, 3);
-        return rc;
-    }
-
-    /* Push config parameters. */
-    lua_pushstring(L, name);
-    lua_pushstring(L, p1);
+    modlua_arg_t args[1] = {
+        { MODLUA_ARG_STRING, p1, 0, NULL }
+    };
 
-    rc = modlua_config_cb_eval(L, ib, module, name, 5);
-    return rc;
+    return modlua_config_cb_record(
+        cp, name, cbdata, "modlua_config_cb_sblk1", args, 1);
 }
 
 
@@ -1002,6 +1021,24 @@ exit:
     return lua_gettop(L);
 }
 
+/**
+ * Stand-in for modlua_config_register_directive used on journal replay.
+ *
+ * Directives were registered with the engine when the module was first
+ * loaded. Replaying the module into a worker state only needs the Lua side
+ * bookkeeping done by @c moduleapi.register_directive.
+ *
+ * @param[in] L Lua state. Arguments are as modlua_config_register_directive.
+ */
+static int modlua_config_register_directive_replay(lua_State *L)
+{
+    lua_pop(L, lua_gettop(L));
+    lua_pushinteger(L, IB_OK);
+    lua_pushstring(L, "Success.");
+
+    return lua_gettop(L);
+}
+
 /**
  * Push the specified handler for a lua module on top of the Lua stack L.
  *
@@ -1203,9 +1240,8 @@ static ib_status_t modlua_push_dispatcher(
 /**
  * Push the callback dispatcher, callback handler, and argument table.
  *
- * Functions (callback hooks) that use this function should then
- * modify the table at the top of the stack to include custom
- * arguments and then call @ref modlua_callback_dispatch.
+ * This is called by @ref modlua_callback_dispatch on the Lua thread it
+ * borrowed for the callback.
  *
  * The table at the top of the stack will have defined in it:
  *   - @c ib_engine
@@ -1216,9 +1252,9 @@ static ib_status_t modlua_push_dispatcher(
  * @param[in] ib The IronBee engine. This may not be null.
  * @param[in] event The event type.
  * @param[in] tx The transaction. This may be null.
- * @param[in] conn The connection. This may not be null. We require it to,
- *            at a minimum, find the Lua runtime stack.
+ * @param[in] conn The connection. This may not be null.
  * @param[in] cbdata The callback data. This may not be null.
+ * @param[in,out] L The Lua thread to push onto.
  *
  * @returns
  *   - IB_OK on success.
@@ -1229,28 +1265,21 @@ static ib_status_t modlua_callback_setup(
     ib_state_event_type_t event,
     ib_tx_t *tx,
     ib_conn_t *conn,
-    void *cbdata)
+    void *cbdata,
+    lua_State *L)
 {
     assert(ib);
     assert(conn);
     assert(cbdata);
+    assert(L);
 
     ib_status_t rc;
     modlua_lua_cbdata_t *modlua_lua_cbdata;
     ib_module_t *module;
-    lua_State *L;
-    modlua_runtime_t *lua;
 
     modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
     module = modlua_lua_cbdata->module;
 
-    rc = modlua_runtime_get(conn, &lua);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    L = lua->L;
-
     /* Push Lua dispatch method to stack. */
     rc = modlua_push_dispatcher(ib, module, event, L);
     if (rc != IB_OK) {
@@ -1383,13 +1412,13 @@ static ib_status_t modlua_callback_dispatch_base(
 /**
  * Common code to run the module handler.
  *
- * This requires modlua_callback_setup to have been successfully run.
+ * The handler runs on a Lua thread borrowed from the calling worker
+ * thread's Lua state, so no lock is taken.
  *
  * @param[in] ib The IronBee engine. This may not be null.
  * @param[in] event The event type.
  * @param[in] tx The transaction. This may be null.
- * @param[in] conn The connection. This may not be null. We require it to,
- *            at a minimum, find the Lua runtime stack.
+ * @param[in] conn The connection. This may not be null.
  * @param[in] cbdata The callback data. This may not be null.
  *
  * @returns
@@ -1413,20 +1442,24 @@ static ib_status_t modlua_callback_dispatch(
     ib_status_t rc;
     modlua_lua_cbdata_t *modlua_lua_cbdata;
     ib_module_t *module;
-    lua_State *L;
-    modlua_runtime_t *lua;
+    modlua_exec_t exec;
 
     modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
     module = modlua_lua_cbdata->module;
 
-    rc = modlua_runtime_get(conn, &lua);
+    rc = modlua_exec_begin(ib, &exec);
     if (rc != IB_OK) {
         return rc;
     }
 
-    L = lua->L;
+    rc = modlua_callback_setup(ib, event, tx, conn, cbdata, exec.L);
+    if (rc == IB_OK) {
+        rc = modlua_callback_dispatch_base(ib, module, exec.L);
+    }
+
+    modlua_exec_end(&exec);
 
-    return modlua_callback_dispatch_base(ib, module, L);
+    return rc;
 }
 
 /**
@@ -1441,7 +1474,7 @@ static ib_status_t modlua_null(
     assert(cbdata);
 
     ib_status_t rc;
-    ib_status_t join_rc; /* We need a temporary rc value for thread joins. */
+    modlua_exec_t exec;
     lua_State *L;
     modlua_lua_cbdata_t *modlua_lua_cbdata;
     ib_module_t *module;
@@ -1449,25 +1482,26 @@ static ib_status_t modlua_null(
     modlua_lua_cbdata = (modlua_lua_cbdata_t *)cbdata;
     module = modlua_lua_cbdata->module;
 
-    /* Since there is  no connection Lua stack, we make a new one. */
-    rc = call_in_critical_section(ib, &ib_lua_new_thread, &L);
+    /* Since there is no connection, the main context's config is used. */
+    rc = modlua_exec_begin(ib, &exec);
     if (rc != IB_OK) {
         ib_log_alert(ib, "Failed to allocate new Lua thread.");
         return rc;
     }
+    L = exec.L;
 
     /* Push Lua dispatch method to stack. */
     rc = modlua_push_dispatcher(ib, module, event, L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Cannot push modlua.dispatch_handler to stack.");
-        return rc;
+        goto exit;
     }
 
     /* Push Lua handler onto the table. */
     rc = modlua_push_lua_handler(ib, module, event, L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Cannot push modlua event handler to stack.");
-        return rc;
+        goto exit;
     }
 
     lua_pushlightuserdata(L, ib);
@@ -1476,7 +1510,7 @@ static ib_status_t modlua_null(
     rc = modlua_push_config_path(ib, ib_context_main(ib), L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Cannot push modlua.config_path to stack.");
-        return rc;
+        goto exit;
     }
     lua_pushnil(L); /* Connection (conn) is nil. */
     lua_pushnil(L); /* Transaction (tx) is nil. */
@@ -1484,18 +1518,10 @@ static ib_status_t modlua_null(
     rc = modlua_callback_dispatch_base(ib, module, L);
     if (rc != IB_OK) {
         ib_log_error(ib, "Failure while executing callback handler.");
-        /* Do not return. We must join the Lua thread. */
     }
 
-    join_rc = call_in_critical_section(ib, &ib_lua_join_thread, &L);
-    if (join_rc != IB_OK) {
-        ib_log_alert(ib, "Failed to join created Lua thread.");
-
-        /* If there is no other error, return the join error. */
-        if (rc == IB_OK) {
-            rc = join_rc;
-        }
-    }
+exit:
+    modlua_exec_end(&exec);
 
     return rc;
 }
@@ -1515,13 +1541,6 @@ static ib_status_t modlua_conn(
 
     ib_status_t rc;
 
-    rc = modlua_callback_setup(ib, event, NULL, conn, cbdata);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    /* Custom table setup */
-
     rc = modlua_callback_dispatch(ib, event, NULL, conn, cbdata);
     if (rc != IB_OK) {
         return rc;
@@ -1541,17 +1560,10 @@ static ib_status_t modlua_conndata(
 {
     assert(ib);
     assert(conndata);
-    assert(conndata->conn);
-    assert(cbdata);
-
-    ib_status_t rc;
-
-    rc = modlua_callback_setup(ib, event, NULL, conndata->conn, cbdata);
-    if (rc != IB_OK) {
-        return rc;
-    }
+    assert(conndata->conn);
+    assert(cbdata);
 
-    /* Custom table setup */
+    ib_status_t rc;
 
     rc = modlua_callback_dispatch(ib, event, NULL, conndata->conn, cbdata);
     if (rc != IB_OK) {
@@ -1577,13 +1589,6 @@ static ib_status_t modlua_tx(
 
     ib_status_t rc;
 
-    rc = modlua_callback_setup(ib, event, tx, tx->conn, cbdata);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    /* Custom table setup */
-
     rc = modlua_callback_dispatch(ib, event, tx, tx->conn, cbdata);
     if (rc != IB_OK) {
         return rc;
@@ -1609,13 +1614,6 @@ static ib_status_t modlua_txdata(
 
     ib_status_t rc;
 
-    rc = modlua_callback_setup(ib, event, tx, tx->conn, cbdata);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    /* Custom table setup */
-
     rc = modlua_callback_dispatch(ib, event, tx, tx->conn, cbdata);
     if (rc != IB_OK) {
         return rc;
@@ -1641,13 +1639,6 @@ static ib_status_t modlua_header(
 
     ib_status_t rc;
 
-    rc = modlua_callback_setup(ib, event, tx, tx->conn, cbdata);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    /* Custom table setup */
-
     rc = modlua_callback_dispatch(ib, event, tx, tx->conn, cbdata);
     if (rc != IB_OK) {
         return rc;
@@ -1673,13 +1664,6 @@ static ib_status_t modlua_reqline(
 
     ib_status_t rc;
 
-    rc = modlua_callback_setup(ib, event, tx, tx->conn, cbdata);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    /* Custom table setup */
-
     rc = modlua_callback_dispatch(ib, event, tx, tx->conn, cbdata);
     if (rc != IB_OK) {
         return rc;
@@ -1705,13 +1689,6 @@ static ib_status_t modlua_respline(
 
     ib_status_t rc;
 
-    rc = modlua_callback_setup(ib, event, tx, tx->conn, cbdata);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    /* Custom table setup */
-
     rc = modlua_callback_dispatch(ib, event, tx, tx->conn, cbdata);
     if (rc != IB_OK) {
         return rc;
@@ -1728,6 +1705,8 @@ static ib_status_t modlua_respline(
  * @param[in] module The registered module structure.
  * @param[in,out] L The lua context that @a file will be loaded into as
  *                @a module.
+ * @param[in] register_directive Function the module uses to register its
+ *            directives.
  * @returns
  *   - IB_OK on success.
  */
@@ -1735,7 +1714,8 @@ static ib_status_t modlua_module_load_lua(
     ib_engine_t *ib,
     const char *file,
     ib_module_t *module,
-    lua_State *L)
+    lua_State *L,
+    lua_CFunction register_directive)
 {
     assert(ib);
     assert(file);
@@ -1771,7 +1751,7 @@ static ib_status_t modlua_module_load_lua(
     lua_pushlightuserdata(L, module); /* Push module engine. */
     lua_pushstring(L, file);
     lua_pushinteger(L, module->idx);
-    lua_pushcfunction(L, &modlua_config_register_directive);
+    lua_pushcfunction(L, register_directive);
     lua_rc = luaL_loadfile(L, file);
     switch(lua_rc) {
         case 0:
@@ -1999,258 +1979,628 @@ static ib_status_t modlua_module_load_wire_callbacks(
 }
 
 /**
- * Load a Lua module from a .lua file.
- *
- * This will dynamically create a Lua module that is managed by this
- * module.
+ * Load a Lua module from a .lua file.
+ *
+ * This will dynamically create a Lua module that is managed by this
+ * module.
+ *
+ * @param[in,out] ib IronBee Engine. Mostly used for logging, but will also
+ *                receive the constructed module.
+ * @param[in] file The file to read off of disk that contains the
+ *            Lua module definition.
+ *
+ * @returns
+ *   - IB_OK on success.
+ */
+static ib_status_t modlua_module_load(ib_engine_t *ib, const char *file) {
+    lua_State *L;
+    ib_module_t *module;
+    modlua_journal_t *entry;
+    ib_status_t rc;
+
+    rc = build_near_empty_module(ib, file, &module);
+    if (rc != IB_OK) {
+        ib_log_error(ib, "Cannot initialize empty lua module structure.");
+        return rc;
+    }
+
+    /* Uses the main configuration's Lua state to create a global,
+     * read-only module object. */
+    L = modlua_global_cfg_get(ib)->L;
+    if (L == NULL) {
+        ib_log_error(
+            ib,
+            "Cannot load lua module \"%s\": Lua support not available.",
+            file);
+        return IB_OK;
+    }
+
+    rc = modlua_module_load_lua(ib,
+                                file,
+                                module,
+                                L,
+                                &modlua_config_register_directive);
+    if (rc != IB_OK) {
+        ib_log_error(ib, "Failed to load lua modules: %s", file);
+        return rc;
+    }
+
+    rc = modlua_journal_add(ib, MODLUA_JOURNAL_MODULE, &entry);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    entry->module = module;
+    entry->file = ib_mpool_strdup(ib_engine_pool_main_get(ib), file);
+    if (entry->file == NULL) {
+        return IB_EALLOC;
+    }
+
+    rc = modlua_module_load_wire_callbacks(ib, file, module, L);
+    if (rc != IB_OK) {
+        ib_log_error(ib, "Failed register lua callbacks for module : %s", file);
+        return rc;
+    }
+
+    return rc;
+}
+
+/**
+ * Pre-load files into the given lua stack.
+ *
+ * This will attempt to run...
+ *   - ffi     = require("ffi")
+ *   - ironbee = require("ironbee-ffi")
+ *   - ibapi   = require("ironbee-api")
+ *   - modlua  = require("ironbee-modlua")
+ *
+ * @param[in] ib IronBee engine. Used to find load paths from the
+ *            core module.
+ * @param[out] L The Lua state that the modules will be "required" into.
+ */
+static ib_status_t modlua_preload(ib_engine_t *ib, lua_State *L) {
+
+    ib_status_t rc;
+
+    ib_core_cfg_t *corecfg = NULL;
+
+    /* This is the search pattern that is appended to each element of
+     * lua_search_paths and then added to the Lua runtime package.path
+     * global variable. */
+    const char *lua_file_pattern = "?.lua";
+
+    /* Null terminated list of search paths. */
+    const char *lua_search_paths[3];
+
+    const char *lua_preloads[][2] = { { "ffi", "ffi" },
+                                      { "ironbee", "ironbee-ffi" },
+                                      { "ibapi", "ironbee-api" },
+                                      { "modlua", "ironbee-modlua" },
+                                      { NULL, NULL } };
+    char *path = NULL; /* Tmp string to build a search path. */
+    int i = 0; /* An iterator. */
+
+    rc = ib_context_module_config(ib_context_main(ib),
+                                  ib_core_module(),
+                                  &corecfg);
+
+    if (rc != IB_OK) {
+        ib_log_error(ib, "Could not retrieve core module configuration.");
+        return rc;
+    }
+
+    /* Initialize the search paths list. */
+    lua_search_paths[0] = corecfg->module_base_path;
+    lua_search_paths[1] = corecfg->rule_base_path;
+    lua_search_paths[2] = NULL;
+
+    for (i = 0; lua_search_paths[i] != NULL; ++i)
+    {
+        char *tmp;
+        ib_log_debug(ib,
+            "Adding \"%s\" to lua search path.", lua_search_paths[i]);
+
+        /* Strlen + 2. One for \0 and 1 for the path separator. */
+        tmp = realloc(path,
+                      strlen(lua_search_paths[i]) +
+                      strlen(lua_file_pattern) + 2);
+
+        if (tmp == NULL) {
+            ib_log_error(ib, "Could allocate buffer for string append.");
+            free(path);
+            return IB_EALLOC;
+        }
+        path = tmp;
+
+        strcpy(path, lua_search_paths[i]);
+        strcpy(path + strlen(path), "/");
+        strcpy(path + strlen(path), lua_file_pattern);
+
+        ib_lua_add_require_path(ib, L, path);
+
+        ib_log_debug(ib, "Added \"%s\" to lua search path.", path);
+    }
+
+    /* We are done with path. To be safe, we NULL it as there is more work
+     * to be done in this function, and we do not want to touch path again. */
+    free(path);
+    path = NULL;
+
+    for (i = 0; lua_preloads[i][0] != NULL; ++i)
+    {
+        rc = ib_lua_require(ib,
+                            L,
+                            lua_preloads[i][0],
+                            lua_preloads[i][1]);
+        if (rc != IB_OK)
+        {
+            ib_log_error(ib,
+                "Failed to load mode \"%s\" into \"%s\".",
+                lua_preloads[i][1],
+                lua_preloads[i][0]);
+            return rc;
+        }
+    }
+    return IB_OK;
+}
+
+/* -- Lua State Pool -- */
+
+/**
+ * Create a Lua state with the IronBee Lua support code loaded.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[out] L The new Lua state.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC if the state cannot be created.
+ *   - The result of modlua_preload() on failure.
+ */
+static ib_status_t modlua_newstate(ib_engine_t *ib, lua_State **L)
+{
+    assert(ib);
+    assert(L);
+
+    ib_status_t rc;
+    modlua_cfg_t *cfg = modlua_global_cfg_get(ib);
+    lua_State *new_L;
+
+    assert(cfg);
+
+    new_L = luaL_newstate();
+    if (new_L == NULL) {
+        ib_log_error(ib, "Failed to create Lua state.");
+        return IB_EALLOC;
+    }
+
+    luaL_openlibs(new_L);
+
+    /* Load ffi, api, etc. */
+    rc = modlua_preload(ib, new_L);
+    if (rc != IB_OK) {
+        ib_log_error(ib, "Failed to pre-load Lua files.");
+        lua_close(new_L);
+        return rc;
+    }
+
+    /* Set package paths if configured. */
+    if (cfg->pkg_path) {
+        ib_log_debug(
+            ib,
+            "Using lua package.path=\"%s\"",
+             cfg->pkg_path);
+        lua_getfield(new_L, -1, "path");
+        lua_pushstring(new_L, cfg->pkg_path);
+        lua_setglobal(new_L, "path");
+    }
+    if (cfg->pkg_cpath) {
+        ib_log_debug(
+            ib,
+            "Using lua package.cpath=\"%s\"",
+            cfg->pkg_cpath);
+        lua_getfield(new_L, -1, "cpath");
+        lua_pushstring(new_L, cfg->pkg_cpath);
+        lua_setglobal(new_L, "cpath");
+    }
+
+    *L = new_L;
+
+    return IB_OK;
+}
+
+/**
+ * Replay the configuration journal into @a L.
+ *
+ * Lua modules are loaded, their directives processed and Lua rules loaded
+ * in the order they appeared in the configuration. Directives are not
+ * registered with the engine again.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in,out] L Lua state created by modlua_newstate().
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - The first failing step's status otherwise.
+ */
+static ib_status_t modlua_journal_replay(ib_engine_t *ib, lua_State *L)
+{
+    assert(ib);
+    assert(L);
+
+    const modlua_cfg_t *cfg = modlua_global_cfg_get(ib);
+    const ib_list_node_t *node;
+
+    assert(cfg);
+    assert(cfg->journal);
+
+    IB_LIST_LOOP_CONST(cfg->journal, node) {
+        const modlua_journal_t *entry =
+            (const modlua_journal_t *)ib_list_node_data_const(node);
+        ib_status_t rc = IB_EINVAL;
+
+        switch(entry->type) {
+            case MODLUA_JOURNAL_MODULE:
+                rc = modlua_module_load_lua(
+                    ib,
+                    entry->file,
+                    entry->module,
+                    L,
+                    &modlua_config_register_directive_replay);
+                break;
+            case MODLUA_JOURNAL_DIRECTIVE:
+                rc = modlua_config_cb_run(ib, L, entry);
+                break;
+            case MODLUA_JOURNAL_RULE:
+                rc = ib_lua_load_func(ib, L, entry->file, entry->func_name);
+                break;
+        }
+        if (rc != IB_OK) {
+            ib_log_error(ib,
+                         "Failed to replay Lua configuration into new state: %s",
+                         ib_status_to_string(rc));
+            return rc;
+        }
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Add a Lua state to the pool's registry.
+ *
+ * @param[in] pool The pool.
+ * @param[in] L The Lua state. The pool takes ownership.
+ * @param[out] state The state's pool record.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure.
+ */
+static ib_status_t modlua_pool_add(
+    modlua_pool_t *pool,
+    lua_State *L,
+    modlua_state_t **state)
+{
+    assert(pool);
+    assert(L);
+    assert(state);
+
+    modlua_state_t *new_state;
+
+    new_state = calloc(1, sizeof(*new_state));
+    if (new_state == NULL) {
+        return IB_EALLOC;
+    }
+    new_state->L = L;
+    new_state->pool = pool;
+
+    ib_lock_lock(&pool->lock);
+    new_state->next = pool->states;
+    pool->states = new_state;
+    ++pool->num_states;
+    ib_lock_unlock(&pool->lock);
+
+    *state = new_state;
+
+    return IB_OK;
+}
+
+/**
+ * Build a new, fully configured, Lua state and add it to the pool.
  *
- * @param[in,out] ib IronBee Engine. Mostly used for logging, but will also
- *                receive the constructed module.
- * @param[in] file The file to read off of disk that contains the
- *            Lua module definition.
+ * @param[in] ib IronBee engine.
+ * @param[in] pool The pool.
+ * @param[out] state The new state.
  *
  * @returns
  *   - IB_OK on success.
+ *   - Other on failure to build or configure the state.
  */
-static ib_status_t modlua_module_load(ib_engine_t *ib, const char *file) {
-    lua_State *L;
-    ib_module_t *module;
+static ib_status_t modlua_pool_build(
+    ib_engine_t *ib,
+    modlua_pool_t *pool,
+    modlua_state_t **state)
+{
+    assert(ib);
+    assert(pool);
+    assert(state);
+
     ib_status_t rc;
+    lua_State *L;
 
-    rc = build_near_empty_module(ib, file, &module);
+    rc = modlua_newstate(ib, &L);
     if (rc != IB_OK) {
-        ib_log_error(ib, "Cannot initialize empty lua module structure.");
         return rc;
     }
 
-    /* Uses the main configuration's Lua state to create a global,
-     * read-only module object. */
-    L = modlua_global_cfg.L;
-    if (L == NULL) {
-        ib_log_error(
-            ib,
-            "Cannot load lua module \"%s\": Lua support not available.",
-            file);
-        return IB_OK;
-    }
-
-    rc = modlua_module_load_lua(ib, file, module, L);
+    rc = modlua_journal_replay(ib, L);
     if (rc != IB_OK) {
-        ib_log_error(ib, "Failed to load lua modules: %s", file);
+        lua_close(L);
         return rc;
     }
 
-    rc = modlua_module_load_wire_callbacks(ib, file, module, L);
+    rc = modlua_pool_add(pool, L, state);
     if (rc != IB_OK) {
-        ib_log_error(ib, "Failed register lua callbacks for module : %s", file);
+        lua_close(L);
         return rc;
     }
 
-    return rc;
+    return IB_OK;
 }
 
 /**
- * Pre-load files into the given lua stack.
+ * Release a claim on a state.
  *
- * This will attempt to run...
- *   - ffi     = require("ffi")
- *   - ironbee = require("ironbee-ffi")
- *   - ibapi   = require("ironbee-api")
- *   - modlua  = require("ironbee-modlua")
+ * The state returns to the idle list, and a waiting thread is woken, when
+ * its outermost claim is released. States that were never claimed are
+ * added to the idle list directly.
  *
- * @param[in] ib IronBee engine. Used to find load paths from the
- *            core module.
- * @param[out] L The Lua state that the modules will be "required" into.
+ * @param[in] state The state being released.
  */
-static ib_status_t modlua_preload(ib_engine_t *ib, lua_State *L) {
+static void modlua_pool_release(modlua_state_t *state)
+{
+    assert(state);
 
-    ib_status_t rc;
+    modlua_pool_t *pool = state->pool;
 
-    ib_core_cfg_t *corecfg = NULL;
+    ib_lock_lock(&pool->lock);
+    if (state->depth > 0) {
+        --state->depth;
+    }
+    if (state->depth == 0) {
+        state->next_idle = pool->idle;
+        pool->idle = state;
+        pthread_cond_signal(&pool->released);
+    }
+    ib_lock_unlock(&pool->lock);
+}
 
-    /* This is the search pattern that is appended to each element of
-     * lua_search_paths and then added to the Lua runtime package.path
-     * global variable. */
-    const char *lua_file_pattern = "?.lua";
+/**
+ * Claim a state for the calling thread, waiting until one is idle.
+ *
+ * States are never built here: the pool is filled when configuration
+ * finishes (see modlua_pool_start()). A thread that already holds a state
+ * claims it again, so Lua called from Lua cannot wait on itself. The
+ * state the thread claimed last is preferred, so that the Lua data of a
+ * connection tends to stay on one state.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in] pool The pool.
+ * @param[out] state The claimed state. Return with modlua_pool_release().
+ */
+static void modlua_pool_claim(
+    ib_engine_t *ib,
+    modlua_pool_t *pool,
+    modlua_state_t **state)
+{
+    assert(ib);
+    assert(pool);
+    assert(state);
 
-    /* Null terminated list of search paths. */
-    const char *lua_search_paths[3];
+    modlua_state_t *last = pthread_getspecific(pool->key);
+    modlua_state_t **link;
+    modlua_state_t *claimed;
+    pthread_t self = pthread_self();
 
-    const char *lua_preloads[][2] = { { "ffi", "ffi" },
-                                      { "ironbee", "ironbee-ffi" },
-                                      { "ibapi", "ironbee-api" },
-                                      { "modlua", "ironbee-modlua" },
-                                      { NULL, NULL } };
-    char *path = NULL; /* Tmp string to build a search path. */
-    int i = 0; /* An iterator. */
+    ib_lock_lock(&pool->lock);
 
-    rc = ib_context_module_config(ib_context_main(ib),
-                                  ib_core_module(),
-                                  &corecfg);
+    if ( (last != NULL) &&
+         (last->depth > 0) &&
+         pthread_equal(last->owner, self) )
+    {
+        ++last->depth;
+        ib_lock_unlock(&pool->lock);
+        *state = last;
+        return;
+    }
 
-    if (rc != IB_OK) {
-        ib_log_error(ib, "Could not retrieve core module configuration.");
-        return rc;
+    if (pool->idle == NULL) {
+        ib_log_debug2(ib, "All %zu Lua states are busy; waiting.",
+                      pool->num_states);
+        do {
+            pthread_cond_wait(&pool->released, &pool->lock);
+        } while (pool->idle == NULL);
     }
 
-    /* Initialize the search paths list. */
-    lua_search_paths[0] = corecfg->module_base_path;
-    lua_search_paths[1] = corecfg->rule_base_path;
-    lua_search_paths[2] = NULL;
+    for (link = &pool->idle; *link != NULL; link = &(*link)->next_idle) {
+        if (*link == last) {
+            break;
+        }
+    }
+    if (*link == NULL) {
+        link = &pool->idle;
+    }
+    claimed = *link;
+    *link = claimed->next_idle;
+    claimed->next_idle = NULL;
+    claimed->owner = self;
+    claimed->depth = 1;
 
-    for (i = 0; lua_search_paths[i] != NULL; ++i)
-    {
-        char *tmp;
-        ib_log_debug(ib,
-            "Adding \"%s\" to lua search path.", lua_search_paths[i]);
+    ib_lock_unlock(&pool->lock);
 
-        /* Strlen + 2. One for \0 and 1 for the path separator. */
-        tmp = realloc(path,
-                      strlen(lua_search_paths[i]) +
-                      strlen(lua_file_pattern) + 2);
+    if (claimed != last) {
+        pthread_setspecific(pool->key, claimed);
+    }
+    *state = claimed;
+}
 
-        if (tmp == NULL) {
-            ib_log_error(ib, "Could allocate buffer for string append.");
-            free(path);
-            return IB_EALLOC;
-        }
-        path = tmp;
+/**
+ * Borrow a Lua thread from a Lua state of the pool.
+ *
+ * Before configuration has finished this uses the configuration state.
+ * Afterwards a state is claimed from the pool, waiting for one if all are
+ * busy, and kept until modlua_exec_end().
+ *
+ * @param[in] ib IronBee engine.
+ * @param[out] exec The borrowed Lua thread. Return with modlua_exec_end().
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EINVAL if Lua support is not available.
+ *   - IB_EALLOC on allocation failure.
+ */
+static ib_status_t modlua_exec_begin(ib_engine_t *ib, modlua_exec_t *exec)
+{
+    assert(ib);
+    assert(exec);
 
-        strcpy(path, lua_search_paths[i]);
-        strcpy(path + strlen(path), "/");
-        strcpy(path + strlen(path), lua_file_pattern);
+    const modlua_cfg_t *cfg = modlua_global_cfg_get(ib);
+    modlua_pool_t *pool;
 
-        ib_lua_add_require_path(ib, L, path);
+    if (cfg == NULL) {
+        ib_log_error(ib, "Lua support not available.");
+        return IB_EINVAL;
+    }
+    pool = cfg->pool;
 
-        ib_log_debug(ib, "Added \"%s\" to lua search path.", path);
+    if ( (pool == NULL) || (! pool->ready) ) {
+        exec->state = NULL;
+        exec->parent = cfg->L;
+    }
+    else {
+        modlua_pool_claim(ib, pool, &exec->state);
+        exec->parent = exec->state->L;
     }
 
-    /* We are done with path. To be safe, we NULL it as there is more work
-     * to be done in this function, and we do not want to touch path again. */
-    free(path);
-    path = NULL;
+    if (exec->parent == NULL) {
+        ib_log_error(ib, "Lua support not available.");
+        return IB_EINVAL;
+    }
 
-    for (i = 0; lua_preloads[i][0] != NULL; ++i)
-    {
-        rc = ib_lua_require(ib,
-                            L,
-                            lua_preloads[i][0],
-                            lua_preloads[i][1]);
-        if (rc != IB_OK)
-        {
-            ib_log_error(ib,
-                "Failed to load mode \"%s\" into \"%s\".",
-                lua_preloads[i][1],
-                lua_preloads[i][0]);
-            return rc;
+    exec->L = lua_newthread(exec->parent);
+    if (exec->L == NULL) {
+        ib_log_error(ib, "Failed to allocate new Lua execution stack.");
+        if (exec->state != NULL) {
+            modlua_pool_release(exec->state);
         }
+        return IB_EALLOC;
     }
+
+    /* Anchor the thread in the registry so it is not collected. */
+    exec->ref = luaL_ref(exec->parent, LUA_REGISTRYINDEX);
+
     return IB_OK;
 }
 
-/* -- Event Handlers -- */
+/**
+ * Return a Lua thread borrowed with modlua_exec_begin().
+ *
+ * @param[in] exec The borrowed Lua thread.
+ */
+static void modlua_exec_end(modlua_exec_t *exec)
+{
+    assert(exec);
+    assert(exec->parent);
+
+    luaL_unref(exec->parent, LUA_REGISTRYINDEX, exec->ref);
+    if (exec->state != NULL) {
+        modlua_pool_release(exec->state);
+    }
+}
 
 /**
- * Callback to initialize the per-connection Lua stack.
+ * Start serving Lua from the pool once configuration has finished.
  *
- * Every Lua Module shares the same Lua stack for execution. This stack is
- * "owned" not by the module written in Lua by the user, but by this
- * module, the Lua Module.
+ * The configuration state becomes the first idle state and further states
+ * are built, by replaying the configuration journal, until the configured
+ * number of states is idle. This is the only time states are built.
  *
- * @param ib Engine.
- * @param event Event type.
- * @param conn Connection.
- * @param cbdata Unused.
+ * @param[in] ib IronBee engine.
+ * @param[in] states Number of states to have ready.
  *
- * @return
- *   - IB_OK
- *   - IB_EALLOC on memory allocation failure.
- *   - Other upon failure of callback registration.
+ * @returns
+ *   - IB_OK on success.
+ *   - Other on failure to build a state.
  */
-static ib_status_t modlua_conn_init_lua_runtime(ib_engine_t *ib,
-                                                ib_state_event_type_t event,
-                                                ib_conn_t *conn,
-                                                void *cbdata)
+static ib_status_t modlua_pool_start(ib_engine_t *ib, ib_num_t states)
 {
-    assert(event == conn_started_event);
     assert(ib);
-    assert(conn);
 
     ib_status_t rc;
-    modlua_runtime_t *modlua_runtime;
+    const modlua_cfg_t *cfg = modlua_global_cfg_get(ib);
+    modlua_pool_t *pool = cfg->pool;
+    modlua_state_t *state;
 
-    modlua_runtime = ib_mpool_alloc(conn->mp, sizeof(modlua_runtime));
-    if (!modlua_runtime) {
-        return IB_EALLOC;
+    if ( (pool == NULL) || (cfg->L == NULL) ) {
+        return IB_OK;
     }
 
-    rc = call_in_critical_section(ib, &ib_lua_new_thread, &modlua_runtime->L);
+    rc = modlua_pool_add(pool, cfg->L, &state);
     if (rc != IB_OK) {
-        ib_log_alert(ib, "Failed to allocate new Lua thread for connection.");
         return rc;
     }
+    modlua_pool_release(state);
 
-    rc = modlua_runtime_set(conn, modlua_runtime);
-    if (rc != IB_OK) {
-        ib_log_alert(
-            ib,
-            "Could not store connection Lua stack in connection.");
-        return rc;
+    while ((ib_num_t)pool->num_states < states) {
+        rc = modlua_pool_build(ib, pool, &state);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        modlua_pool_release(state);
     }
 
+    pool->ready = true;
+
+    ib_log_debug(ib, "Lua state pool ready with %zu states.",
+                 pool->num_states);
+
     return IB_OK;
 }
 
 /**
- * Callback to destroy the per-connection Lua stack.
- *
- * Every Lua Module shares the same Lua stack for execution. This stack is
- * "owned" not by the module written in Lua by the user, but by this
- * module, the Lua Module.
+ * Close every pooled Lua state and destroy the pool.
  *
- * This is registered when the main context is closed to ensure that it
- * executes after all the Lua modules call backs (callbacks are executed
- * in the order of their registration).
+ * The configuration state is left to the caller.
  *
- * @param ib Engine.
- * @param event Event type.
- * @param conn Connection.
- * @param cbdata Unused.
- *
- * @return
- *   - IB_OK
- *   - IB_EALLOC on memory allocation failure.
- *   - IB_EOTHER if the stored Lua stack in the module's connection data
- *               is NULL.
- *   - Other upon failure of callback registration.
+ * @param[in,out] cfg Global configuration owning the pool.
  */
-static ib_status_t modlua_conn_fini_lua_runtime(ib_engine_t *ib,
-                                                ib_state_event_type_t event,
-                                                ib_conn_t *conn,
-                                                void *cbdata)
+static void modlua_pool_destroy(modlua_cfg_t *cfg)
 {
-    assert(event == conn_finished_event);
-    assert(ib);
-    assert(conn);
+    modlua_pool_t *pool = cfg->pool;
+    modlua_state_t *state;
 
-    ib_status_t rc;
+    if (pool == NULL) {
+        return;
+    }
 
-    modlua_runtime_t *modlua_runtime;
+    pool->ready = false;
+    pthread_key_delete(pool->key);
+    pthread_cond_destroy(&pool->released);
 
-    rc = modlua_runtime_get(conn, &modlua_runtime);
-    if (rc != IB_OK) {
-        ib_log_alert(ib, "Could not fetch per-connection Lua execution stack.");
-        return rc;
-    }
-    if (modlua_runtime == NULL) {
-        ib_log_alert(ib, "Stored Lua execution stack was unexpectedly NULL.");
-        return IB_EOTHER;
-    }
+    state = pool->states;
+    while (state != NULL) {
+        modlua_state_t *next = state->next;
 
-    /* Atomically destroy the Lua stack */
-    rc = call_in_critical_section(ib, &ib_lua_join_thread, &modlua_runtime->L);
+        if (state->L != cfg->L) {
+            lua_close(state->L);
+        }
+        free(state);
+        state = next;
+    }
 
-    return rc;
+    ib_lock_destroy(&pool->lock);
+    free(pool);
+    cfg->pool = NULL;
 }
 
 /* -- External Rule Driver -- */
@@ -2277,17 +2627,16 @@ static ib_status_t rules_lua_init(ib_engine_t *ib, ib_module_t *m, void *cbdata)
 
 /**
  * @brief Call the rule named @a func_name on a new Lua stack.
- * @details This will atomically create and destroy a lua_State*
- *          allowing for concurrent execution of @a func_name
- *          by a ib_lua_func_eval(ib_engine_t*, ib_txt_t*, const char*).
+ * @details The stack is a Lua thread of the calling worker thread's own
+ *          Lua state, so concurrent rule evaluations do not contend.
  *
  * @param[in,out] rule_exec Rule execution environment
  * @param[in] func_name The Lua function name to call.
  * @param[out] result The result integer value. This should be set to
  *             1 (true) or 0 (false).
  *
- * @returns IB_OK on success, IB_EUNKNOWN on semaphore locking error, and
- *          IB_EALLOC is returned if a new execution stack cannot be created.
+ * @returns IB_OK on success, IB_EALLOC if a new execution stack cannot be
+ *          created and IB_EINVAL on a Lua error.
  */
 static ib_status_t ib_lua_func_eval_r(const ib_rule_exec_t *rule_exec,
                                       const char *func_name,
@@ -2299,29 +2648,31 @@ static ib_status_t ib_lua_func_eval_r(const ib_rule_exec_t *rule_exec,
     ib_tx_t *tx = rule_exec->tx;
     int result_int;
     ib_status_t ib_rc;
-    lua_State *L;
-
-    /* Atomically create a new Lua stack */
-    ib_rc = call_in_critical_section(ib, &ib_lua_new_thread, &L);
+    modlua_exec_t exec;
 
+    ib_rc = modlua_exec_begin(ib, &exec);
     if (ib_rc != IB_OK) {
         return ib_rc;
     }
 
     /* Call the rule in isolation. */
-    ib_rc = ib_lua_func_eval_int(rule_exec, ib, tx, L, func_name, &result_int);
+    ib_rc = ib_lua_func_eval_int(rule_exec,
+                                 ib,
+                                 tx,
+                                 exec.L,
+                                 func_name,
+                                 &result_int);
 
-    /* Convert the passed in integer type to an ib_num_t. */
-    *result = result_int;
+    modlua_exec_end(&exec);
 
     if (ib_rc != IB_OK) {
         return ib_rc;
     }
 
-    /* Atomically destroy the Lua stack */
-    ib_rc = call_in_critical_section(ib, &ib_lua_join_thread, &L);
+    /* Convert the passed in integer type to an ib_num_t. */
+    *result = result_int;
 
-    return ib_rc;
+    return IB_OK;
 }
 
 static ib_status_t lua_operator_create(ib_engine_t *ib,
@@ -2388,6 +2739,8 @@ ib_status_t modlua_rule_driver(
 
     ib_status_t rc;
     ib_operator_inst_t *op_inst;
+    modlua_journal_t *entry;
+    const modlua_cfg_t *cfg;
 
     if (strncmp(tag, "lua", 3) != 0) {
         ib_cfg_log_error(cp, "Lua rule driver called for non-lua tag.");
@@ -2395,13 +2748,14 @@ ib_status_t modlua_rule_driver(
     }
 
     /* Check if lua is available. */
-    if (modlua_global_cfg.L == NULL) {
+    cfg = modlua_global_cfg_get(cp->ib);
+    if ( (cfg == NULL) || (cfg->L == NULL) ) {
         ib_cfg_log_error(cp, "Lua is not available");
         return IB_EINVAL;
     }
 
     rc = ib_lua_load_func(cp->ib,
-                          modlua_global_cfg.L,
+                          cfg->L,
                           location,
                           ib_rule_id(rule));
 
@@ -2412,6 +2766,16 @@ ib_status_t modlua_rule_driver(
 
     ib_cfg_log_debug3(cp, "Loaded lua file %s", location);
 
+    rc = modlua_journal_add(cp->ib, MODLUA_JOURNAL_RULE, &entry);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    entry->file = ib_mpool_strdup(ib_engine_pool_main_get(cp->ib), location);
+    entry->func_name = ib_rule_id(rule);
+    if (entry->file == NULL) {
+        return IB_EALLOC;
+    }
+
     rc = ib_operator_register(cp->ib,
                               location,
                               IB_OP_FLAG_PHASE,
@@ -2475,79 +2839,57 @@ static ib_status_t modlua_init(ib_engine_t *ib,
                                void        *cbdata)
 {
     ib_status_t rc;
+    modlua_cfg_t *cfg = (modlua_cfg_t *)m->gcdata;
 
     /* Set up defaults */
-    modlua_global_cfg.L = NULL;
-
-    modlua_global_cfg.L = luaL_newstate();
-    if (modlua_global_cfg.L == NULL) {
-        ib_log_error(ib, "Failed to initialize lua module.");
-        return IB_EUNKNOWN;
-    }
-
-    luaL_openlibs(modlua_global_cfg.L);
+    cfg->L = NULL;
 
-    /* Load ffi, api, etc. */
-    rc = modlua_preload(ib, modlua_global_cfg.L);
+    /* Create the configuration-time Lua state. */
+    rc = modlua_newstate(ib, &cfg->L);
     if (rc != IB_OK) {
-        ib_log_error(ib, "Failed to pre-load Lua files.");
+        ib_log_error(ib, "Failed to initialize lua module.");
         return rc;
     }
 
-    /* Set package paths if configured. */
-    if (modlua_global_cfg.pkg_path) {
-        ib_log_debug(
-            ib,
-            "Using lua package.path=\"%s\"",
-             modlua_global_cfg.pkg_path);
-        lua_getfield(modlua_global_cfg.L, -1, "path");
-        lua_pushstring(modlua_global_cfg.L, modlua_global_cfg.pkg_path);
-        lua_setglobal(modlua_global_cfg.L, "path");
-    }
-    if (modlua_global_cfg.pkg_cpath) {
-        ib_log_debug(
-            ib,
-            "Using lua package.cpath=\"%s\"",
-            modlua_global_cfg.pkg_cpath);
-        lua_getfield(modlua_global_cfg.L, -1, "cpath");
-        lua_pushstring(modlua_global_cfg.L, modlua_global_cfg.pkg_cpath);
-        lua_setglobal(modlua_global_cfg.L, "cpath");
-    }
-
-    /* Hook to initialize the lua runtime with the connection.
-     * There is a modlua_conn_fini_lua_runtime which is only registered
-     * when the main configuration context is being closed. This ensures
-     * that it is the last hook to fire relative to the various
-     * Lua-implemented modules this module may created and register. */
-    rc = ib_hook_conn_register(
-        ib,
-        conn_started_event,
-        modlua_conn_init_lua_runtime,
-        NULL);
+    /* Journal of configuration steps to replay into worker states. */
+    rc = ib_list_create(&cfg->journal,
+                        ib_engine_pool_main_get(ib));
     if (rc != IB_OK) {
-        ib_log_error(
-            ib,
-            "Failed to register conn_started_event hook: %s",
-            ib_status_to_string(rc));
+        ib_log_error(ib, "Failed to create lua configuration journal.");
         return rc;
     }
 
-    /* Initialize lock to protect making new lua threads. */
-    /* NOTE: To avoid any confusion as to whether the lock
-     *       is thread-safe or all copies of the lock structure
-     *       are thread safe we use a pointer to a lock structure
-     *       so that all copies of the module configuration use
-     *       the same lock structure in memory. */
-    modlua_global_cfg.L_lck = malloc(sizeof(*modlua_global_cfg.L_lck));
-    if (modlua_global_cfg.L_lck == NULL) {
-        ib_log_error(ib, "Failed to initialize lua global lock.");
+    /* Create the pool of worker thread Lua states. */
+    /* NOTE: As with the previous global lock, a pointer is used so that
+     *       all context copies of the engine's module configuration share
+     *       the same pool. */
+    cfg->pool = calloc(1, sizeof(*cfg->pool));
+    if (cfg->pool == NULL) {
+        ib_log_error(ib, "Failed to allocate lua state pool.");
         return IB_EALLOC;
     }
-    rc = ib_lock_init(modlua_global_cfg.L_lck);
+    rc = ib_lock_init(&cfg->pool->lock);
     if (rc != IB_OK) {
-        ib_log_error(ib, "Failed to initialize lua global lock.");
+        ib_log_error(ib, "Failed to initialize lua state pool lock.");
+        free(cfg->pool);
+        cfg->pool = NULL;
         return rc;
     }
+    if (pthread_cond_init(&cfg->pool->released, NULL) != 0) {
+        ib_log_error(ib, "Failed to initialize lua state pool condition.");
+        ib_lock_destroy(&cfg->pool->lock);
+        free(cfg->pool);
+        cfg->pool = NULL;
+        return IB_EUNKNOWN;
+    }
+    if (pthread_key_create(&cfg->pool->key, NULL) != 0) {
+        ib_log_error(ib, "Failed to create lua state pool thread key.");
+        pthread_cond_destroy(&cfg->pool->released);
+        ib_lock_destroy(&cfg->pool->lock);
+        free(cfg->pool);
+        cfg->pool = NULL;
+        return IB_EUNKNOWN;
+    }
 
     /* Set up rule support. */
     rc = rules_lua_init(ib, m, cbdata);
@@ -2564,23 +2906,25 @@ static ib_status_t modlua_context_close(ib_engine_t  *ib,
                                         void         *cbdata)
 {
     ib_status_t rc;
+    modlua_cfg_t *cfg;
 
     /* Close of the main context signifies configuration finished. */
     if (ib_context_type(ctx) == IB_CTYPE_MAIN) {
 
-        /* Register this callback after the main context is closed.
-         * This allows it to be executed LAST allowing all the Lua
-         * modules created during configuration to be executed first. */
-        rc = ib_hook_conn_register(
-            ib,
-            conn_finished_event,
-            modlua_conn_fini_lua_runtime,
-            NULL);
+        rc = ib_context_module_config(ctx, m, &cfg);
+        if (rc != IB_OK) {
+            ib_log_error(ib, "Failed to retrieve lua configuration.");
+            return rc;
+        }
+
+        /* From here on Lua executes on states claimed from the pool. */
+        rc = modlua_pool_start(ib, cfg->states);
         if (rc != IB_OK) {
             ib_log_error(
                 ib,
-                "Failed to register conn_finished_event hook: %s",
+                "Failed to start lua state pool: %s",
                 ib_status_to_string(rc));
+            return rc;
         }
     }
 
@@ -2603,6 +2947,12 @@ static IB_CFGMAP_INIT_STRUCTURE(modlua_config_map) = {
         modlua_cfg_t,
         pkg_cpath
     ),
+    IB_CFGMAP_INIT_ENTRY(
+        MODULE_NAME_STR ".states",
+        IB_FTYPE_NUM,
+        modlua_cfg_t,
+        states
+    ),
 
     IB_CFGMAP_INIT_LAST
 };
@@ -2728,6 +3078,22 @@ static ib_status_t modlua_dir_param1(ib_cfgparser_t *cp,
         free(p1_unescaped);
         return rc;
     }
+    else if (strcasecmp("LuaWorkerStates", name) == 0) {
+        ib_context_t *ctx = cp->cur_ctx ? cp->cur_ctx : ib_context_main(ib);
+        ib_num_t states;
+
+        rc = ib_string_to_num(p1_unescaped, 10, &states);
+        if ( (rc != IB_OK) || (states < 0) ) {
+            ib_cfg_log_error(cp, "Invalid value for %s: %s",
+                             name, p1_unescaped);
+            free(p1_unescaped);
+            return IB_EINVAL;
+        }
+        ib_log_debug2(ib, "%s: %" PRId64 " ctx=%p", name, states, ctx);
+        rc = ib_context_set_num(ctx, MODULE_NAME_STR ".states", states);
+        free(p1_unescaped);
+        return rc;
+    }
     else {
         ib_log_error(ib, "Unhandled directive: %s %s", name, p1_unescaped);
         free(p1_unescaped);
@@ -2755,22 +3121,30 @@ static IB_DIRMAP_INIT_STRUCTURE(modlua_directive_map) = {
         modlua_dir_param1,
         NULL
     ),
+    IB_DIRMAP_INIT_PARAM1(
+        "LuaWorkerStates",
+        modlua_dir_param1,
+        NULL
+    ),
 
     /* End */
     IB_DIRMAP_INIT_LAST
 };
 
 /**
- * Destroy global lock and Lua state.
+ * Destroy the Lua state pool and configuration Lua state.
  */
 static ib_status_t modlua_fini(ib_engine_t *ib, ib_module_t *m, void *cbdata) {
 
-    ib_lock_destroy(modlua_global_cfg.L_lck);
-    free(modlua_global_cfg.L_lck);
-    modlua_global_cfg.L_lck = NULL;
+    modlua_cfg_t *cfg = (modlua_cfg_t *)m->gcdata;
 
-    lua_close(modlua_global_cfg.L);
-    modlua_global_cfg.L = NULL;
+    modlua_pool_destroy(cfg);
+
+    if (cfg->L != NULL) {
+        lua_close(cfg->L);
+        cfg->L = NULL;
+    }
+    cfg->journal = NULL;
 
     return IB_OK;
 }
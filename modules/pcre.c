@@ -24,12 +24,15 @@
  * @author Brian Rectanus <brectanus@qualys.com>
  */
 
+#include <ironbee/ahocorasick.h>
 #include <ironbee/bytestr.h>
 #include <ironbee/capture.h>
 #include <ironbee/cfgmap.h>
 #include <ironbee/engine.h>
 #include <ironbee/escape.h>
 #include <ironbee/field.h>
+#include <ironbee/hash.h>
+#include <ironbee/lock.h>
 #include <ironbee/module.h>
 #include <ironbee/mpool.h>
 #include <ironbee/operator.h>
@@ -41,6 +44,8 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <inttypes.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -80,9 +85,38 @@ const int PCRE_JIT_STACK_MAX_MULT   = 512;
  */
 #define WORKSPACE_SIZE_DEFAULT (WORKSPACE_SIZE_MIN * 10)
 
+/**
+ * Shortest literal factor worth adding to the prefilter.
+ */
+#define PREFILTER_LITERAL_MIN  (3)
+
+/**
+ * Prefilter literal id of operators that are not prefiltered.
+ */
+#define PREFILTER_NONE         SIZE_MAX
+
 /* Define the public module symbol. */
 IB_MODULE_DECLARE();
 
+/**
+ * Literal prefilter shared by all rx operators of an engine.
+ *
+ * A mandatory literal factor is extracted from each rx pattern when the
+ * operator is created.  The distinct literals are compiled into a single
+ * case insensitive Aho-Corasick automaton when the main context is closed.
+ * At runtime each subject is scanned once per transaction into a bitmap of
+ * the literals it contains, and pcre_exec() is skipped for rules whose
+ * literal bit is clear.
+ */
+typedef struct modpcre_prefilter_t {
+    ib_ac_t             *ac;              /**< Literal automaton */
+    ib_hash_t           *literals;        /**< Literal -> size_t id */
+    size_t               count;           /**< Number of literals */
+    size_t               operators;       /**< Number of rx operators */
+    size_t               filtered;        /**< Operators with a literal */
+    bool                 ready;           /**< Automaton is built */
+} modpcre_prefilter_t;
+
 /**
  * Module Configuration Structure.
  */
@@ -94,6 +128,8 @@ typedef struct modpcre_cfg_t {
     ib_num_t       jit_stack_start;       /**< Starting JIT stack size */
     ib_num_t       jit_stack_max;         /**< Max JIT stack size */
     ib_num_t       dfa_workspace_size;    /**< Size of DFA workspace */
+    ib_num_t       use_prefilter;         /**< Bool: Use literal prefilter */
+    modpcre_prefilter_t *prefilter;       /**< Engine literal prefilter */
 } modpcre_cfg_t;
 
 /**
@@ -118,8 +154,93 @@ typedef struct modpcre_cpat_data_t {
 typedef struct modpcre_rule_data_t {
     modpcre_cpat_data_t *cpdata;          /**< Compiled pattern data */
     const char          *id;              /**< ID for DFA rules */
+    modpcre_prefilter_t *prefilter;       /**< Prefilter for rx rules */
+    size_t               prefilter_id;    /**< Literal id or PREFILTER_NONE */
 } modpcre_rule_data_t;
 
+/**
+ * Literals seen in a subject, cached for the rest of the transaction.
+ *
+ * An entry is reused as long as the field has the same version and value;
+ * otherwise the subject is rescanned into the same bitmap.
+ */
+typedef struct modpcre_prefilter_scan_t {
+    const ib_field_t    *field;           /**< Scanned field; hash key */
+    size_t               version;         /**< ib_field_version() of field */
+    const char          *subject;         /**< Scanned subject */
+    size_t               subject_len;     /**< Length of subject */
+    uint8_t              seen[];          /**< Bitmap of literal ids */
+} modpcre_prefilter_scan_t;
+
+/**
+ * Per-transaction module data.
+ */
+typedef struct modpcre_tx_data_t {
+    ib_hash_t           *dfa_workspaces;  /**< Rule id -> dfa_workspace_t */
+    ib_hash_t           *prefilter_scans; /**< Field -> prefilter scan */
+} modpcre_tx_data_t;
+
+/**
+ * Match and prefilter counters.
+ */
+typedef struct modpcre_stats_t {
+    uint64_t             hits;             /**< Matches served by cache */
+    uint64_t             misses;           /**< Matches that allocated */
+    uint64_t             prefilter_checks; /**< Prefiltered executions */
+    uint64_t             prefilter_skips;  /**< pcre_exec() calls skipped */
+} modpcre_stats_t;
+
+/**
+ * Per-thread match resources.
+ *
+ * The ovector and JIT stack are reused by every rx and dfa match executed
+ * on the owning thread so that the match path does not touch the heap.
+ * All caches are linked into the module's registry so their counters can be
+ * aggregated and so they can be released when the module is unloaded.
+ */
+typedef struct modpcre_thread_cache_t modpcre_thread_cache_t;
+struct modpcre_thread_cache_t {
+    int                     ovector[3 * MATCH_MAX]; /**< Match offsets */
+#ifdef PCRE_JIT_STACK
+    pcre_jit_stack         *jit_stack;       /**< Cached JIT stack or NULL */
+    int                     jit_stack_start; /**< Start size of jit_stack */
+    int                     jit_stack_max;   /**< Max size of jit_stack */
+#endif
+    modpcre_stats_t         stats;           /**< Counters of this thread */
+    bool                    pending_miss;    /**< Allocated during match */
+    uint8_t                *prefilter_seen;  /**< Bitmap of current scan */
+    modpcre_thread_cache_t *prev;            /**< Previous in registry */
+    modpcre_thread_cache_t *next;            /**< Next in registry */
+};
+
+/**
+ * Registry of all per-thread caches.
+ *
+ * Only touched when a thread creates or releases its cache and when the
+ * counters are reported, never on the match path.
+ */
+typedef struct modpcre_thread_registry_t {
+    ib_lock_t               lock;         /**< Protects all other members */
+    pthread_key_t           key;          /**< Thread-specific cache key */
+    modpcre_thread_cache_t *list;         /**< Live caches */
+    size_t                  users;        /**< Engines using the registry */
+    modpcre_stats_t         retired;      /**< Counters of released caches */
+} modpcre_thread_registry_t;
+
+/* The lock is initialized statically: engines may be created and destroyed
+ * concurrently, so it must exist before the first user. */
+static modpcre_thread_registry_t modpcre_threads = {
+    PTHREAD_MUTEX_INITIALIZER,  /* lock */
+    0,                          /* key; created by the first user */
+    NULL,                       /* list */
+    0,                          /* users */
+    { 0, 0, 0, 0 }              /* retired */
+};
+
+#ifdef PCRE_JIT_STACK
+static pcre_jit_stack *modpcre_jit_stack_callback(void *data);
+#endif
+
 /* Instantiate a module global configuration. */
 static modpcre_cfg_t modpcre_global_cfg = {
     1,                      /* study */
@@ -128,7 +249,9 @@ static modpcre_cfg_t modpcre_global_cfg = {
     5000,                   /* match_limit_recursion */
     0,                      /* jit_stack_start; 0 means auto */
     0,                      /* jit_stack_max; 0 means auto */
-    WORKSPACE_SIZE_DEFAULT  /* dfa_workspace_size */
+    WORKSPACE_SIZE_DEFAULT, /* dfa_workspace_size */
+    1,                      /* use_prefilter */
+    NULL                    /* prefilter; created at module init */
 };
 
 /**
@@ -288,113 +411,1042 @@ static ib_status_t pcre_compile_internal(ib_engine_t *ib,
         return IB_EALLOC;
     }
 
-    /* Copy compiled pattern. */
-    cpdata->cpatt = ib_mpool_memdup(pool, cpatt, cpatt_sz);
-    pcre_free(cpatt);
-    if (cpdata->cpatt == NULL) {
-        pcre_free(edata);
-        ib_log_error(ib, "Failed to duplicate pattern of size: %zd", cpatt_sz);
-        return IB_EALLOC;
+    /* Copy compiled pattern. */
+    cpdata->cpatt = ib_mpool_memdup(pool, cpatt, cpatt_sz);
+    pcre_free(cpatt);
+    if (cpdata->cpatt == NULL) {
+        pcre_free(edata);
+        ib_log_error(ib, "Failed to duplicate pattern of size: %zd", cpatt_sz);
+        return IB_EALLOC;
+    }
+    ib_log_debug(ib, "PCRE copied cpatt @ %p -> %p (%zd bytes)",
+                 (void *)cpatt, (void *)cpdata->cpatt, cpatt_sz);
+
+    /* Copy extra data (study data). */
+    if (edata != NULL) {
+
+        /* Copy edata. */
+        cpdata->edata = ib_mpool_memdup(pool, edata, sizeof(*edata));
+        if (cpdata->edata == NULL) {
+            pcre_free(edata);
+            ib_log_error(ib, "Failed to duplicate edata.");
+            return IB_EALLOC;
+        }
+
+        /* Copy edata->study_data. */
+        if (edata->study_data != NULL) {
+            cpdata->edata->study_data =
+                ib_mpool_memdup(pool, edata->study_data, study_data_sz);
+
+            if (cpdata->edata->study_data == NULL) {
+                ib_log_error(ib, "Failed to study data of size: %zd",
+                             study_data_sz);
+                pcre_free(edata);
+                return IB_EALLOC;
+            }
+        }
+        pcre_free(edata);
+    }
+    else {
+        cpdata->edata = ib_mpool_calloc(pool, 1, sizeof(*edata));
+        if (cpdata->edata == NULL) {
+            pcre_free(edata);
+            ib_log_error(ib, "Failed to allocate edata.");
+            return IB_EALLOC;
+        }
+    }
+
+    /* Set the PCRE limits for non-DFA patterns */
+    if (! is_dfa) {
+        cpdata->edata->flags |=
+            (PCRE_EXTRA_MATCH_LIMIT | PCRE_EXTRA_MATCH_LIMIT_RECURSION);
+        cpdata->edata->match_limit =
+            (unsigned long)config->match_limit;
+        cpdata->edata->match_limit_recursion =
+            (unsigned long)config->match_limit_recursion;
+        cpdata->dfa_ws_size = 0;
+    }
+    else {
+        cpdata->edata->match_limit = 0U;
+        cpdata->edata->match_limit_recursion = 0U;
+        cpdata->dfa_ws_size = (int)config->dfa_workspace_size;
+    }
+
+    /* Set stack limits for JIT */
+    if (cpdata->is_jit) {
+#ifdef PCRE_HAVE_JIT
+        if (config->jit_stack_start == 0U) {
+            cpdata->jit_stack_start =
+                PCRE_JIT_STACK_START_MULT * config->match_limit_recursion;
+        }
+        else {
+            cpdata->jit_stack_start = (int)config->jit_stack_start;
+        }
+        if (config->jit_stack_max == 0U) {
+            cpdata->jit_stack_max =
+                PCRE_JIT_STACK_MAX_MULT * config->match_limit_recursion;
+        }
+        else {
+            cpdata->jit_stack_max = (int)config->jit_stack_max;
+        }
+#endif
+    }
+    else {
+        cpdata->jit_stack_start = 0;
+        cpdata->jit_stack_max = 0;
+    }
+
+#ifdef PCRE_JIT_STACK
+    /* The edata is shared by all threads, so instead of assigning a stack
+     * for each match, let PCRE ask for the calling thread's stack. */
+    if (cpdata->is_jit) {
+        pcre_assign_jit_stack(cpdata->edata,
+                              modpcre_jit_stack_callback,
+                              cpdata);
+    }
+#endif
+
+    ib_log_trace(ib,
+                 "Compiled pcre pattern \"%s\": "
+                 "cpatt=%p edata=%p limit=%ld rlimit=%ld study=%p "
+                 "dfa=%s dfa-ws-sz=%d "
+                 "jit=%s jit-stack: start=%d max=%d",
+                 patt,
+                 (void *)cpdata->cpatt,
+                 (void *)cpdata->edata,
+                 cpdata->edata->match_limit,
+                 cpdata->edata->match_limit_recursion,
+                 cpdata->edata->study_data,
+                 cpdata->is_dfa ? "yes" : "no",
+                 cpdata->dfa_ws_size,
+                 cpdata->is_jit ? "yes" : "no",
+                 cpdata->jit_stack_start,
+                 cpdata->jit_stack_max);
+    *pcpdata = cpdata;
+
+    return IB_OK;
+}
+
+
+/* -- Per-thread Match Cache -- */
+
+/**
+ * Release a thread cache and fold its counters into the registry totals.
+ *
+ * Caller must hold the registry lock.
+ *
+ * @param[in] cache The cache to release.
+ */
+static void modpcre_thread_cache_release(modpcre_thread_cache_t *cache)
+{
+    assert(cache != NULL);
+
+    if (cache->prev != NULL) {
+        cache->prev->next = cache->next;
+    }
+    else {
+        modpcre_threads.list = cache->next;
+    }
+    if (cache->next != NULL) {
+        cache->next->prev = cache->prev;
+    }
+
+    modpcre_threads.retired.hits += cache->stats.hits;
+    modpcre_threads.retired.misses += cache->stats.misses;
+    modpcre_threads.retired.prefilter_checks += cache->stats.prefilter_checks;
+    modpcre_threads.retired.prefilter_skips += cache->stats.prefilter_skips;
+
+#ifdef PCRE_JIT_STACK
+    if (cache->jit_stack != NULL) {
+        pcre_jit_stack_free(cache->jit_stack);
+    }
+#endif
+    free(cache);
+}
+
+/**
+ * Thread exit destructor for the thread-specific cache.
+ *
+ * @param[in] data The exiting thread's modpcre_thread_cache_t.
+ */
+static void modpcre_thread_cache_destroy(void *data)
+{
+    if (data == NULL) {
+        return;
+    }
+
+    ib_lock_lock(&modpcre_threads.lock);
+    modpcre_thread_cache_release((modpcre_thread_cache_t *)data);
+    ib_lock_unlock(&modpcre_threads.lock);
+}
+
+/**
+ * Get the calling thread's cache, creating it on first use.
+ *
+ * @param[out] miss Set to true if the cache had to be allocated.
+ *
+ * @returns The thread cache or NULL on allocation failure.
+ */
+static modpcre_thread_cache_t *modpcre_thread_cache_get(bool *miss)
+{
+    assert(miss != NULL);
+
+    modpcre_thread_cache_t *cache;
+
+    cache = pthread_getspecific(modpcre_threads.key);
+    if (cache != NULL) {
+        return cache;
+    }
+
+    *miss = true;
+    cache = calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    if (pthread_setspecific(modpcre_threads.key, cache) != 0) {
+        free(cache);
+        return NULL;
+    }
+
+    ib_lock_lock(&modpcre_threads.lock);
+    cache->next = modpcre_threads.list;
+    if (cache->next != NULL) {
+        cache->next->prev = cache;
+    }
+    modpcre_threads.list = cache;
+    ib_lock_unlock(&modpcre_threads.lock);
+
+    return cache;
+}
+
+#ifdef PCRE_JIT_STACK
+/**
+ * Get a JIT stack of the given dimensions from a thread cache.
+ *
+ * The cached stack is reused when its dimensions match, otherwise it is
+ * replaced by a newly allocated one.
+ *
+ * @param[in] cache The thread cache.
+ * @param[in] start Starting JIT stack size.
+ * @param[in] max Maximum JIT stack size.
+ * @param[out] miss Set to true if a new stack had to be allocated.
+ *
+ * @returns The JIT stack or NULL on allocation failure.
+ */
+static pcre_jit_stack *modpcre_thread_cache_jit_stack(
+    modpcre_thread_cache_t *cache,
+    int                     start,
+    int                     max,
+    bool                   *miss)
+{
+    assert(cache != NULL);
+    assert(miss != NULL);
+
+    if ( (cache->jit_stack != NULL) &&
+         (cache->jit_stack_start == start) &&
+         (cache->jit_stack_max == max) )
+    {
+        return cache->jit_stack;
+    }
+
+    *miss = true;
+    if (cache->jit_stack != NULL) {
+        pcre_jit_stack_free(cache->jit_stack);
+    }
+    cache->jit_stack = pcre_jit_stack_alloc(start, max);
+    cache->jit_stack_start = start;
+    cache->jit_stack_max = max;
+
+    return cache->jit_stack;
+}
+
+/**
+ * PCRE JIT stack callback: the calling thread's JIT stack.
+ *
+ * Assigned to each JIT compiled pattern once, at compile time.  If no
+ * stack can be allocated, PCRE falls back to a small stack of its own.
+ * An allocation made here is counted as a miss of the running match.
+ *
+ * @param[in] data The pattern's modpcre_cpat_data_t.
+ *
+ * @returns The JIT stack or NULL.
+ */
+static pcre_jit_stack *modpcre_jit_stack_callback(void *data)
+{
+    assert(data != NULL);
+
+    const modpcre_cpat_data_t *cpdata = (const modpcre_cpat_data_t *)data;
+    modpcre_thread_cache_t *cache;
+    bool miss = false;
+
+    pcre_jit_stack *jit_stack;
+
+    cache = modpcre_thread_cache_get(&miss);
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    jit_stack = modpcre_thread_cache_jit_stack(cache,
+                                               cpdata->jit_stack_start,
+                                               cpdata->jit_stack_max,
+                                               &miss);
+    if (miss) {
+        cache->pending_miss = true;
+    }
+
+    return jit_stack;
+}
+#endif
+
+/**
+ * Count a match as a cache hit or miss.
+ *
+ * A match is a miss if @a miss is set or if an allocation was made on its
+ * behalf since the last match was counted (see cache->pending_miss).
+ *
+ * @param[in] cache The thread cache.
+ * @param[in] miss True if the match required an allocation.
+ */
+static void modpcre_thread_cache_count(modpcre_thread_cache_t *cache,
+                                       bool miss)
+{
+    assert(cache != NULL);
+
+    if (miss || cache->pending_miss) {
+        ++cache->stats.misses;
+        cache->pending_miss = false;
+    }
+    else {
+        ++cache->stats.hits;
+    }
+}
+
+/**
+ * Sum the counters of all current and released caches.
+ *
+ * @param[out] stats Totals.
+ */
+static void modpcre_thread_cache_stats(modpcre_stats_t *stats)
+{
+    assert(stats != NULL);
+
+    const modpcre_thread_cache_t *cache;
+
+    ib_lock_lock(&modpcre_threads.lock);
+    *stats = modpcre_threads.retired;
+    for (cache = modpcre_threads.list; cache != NULL; cache = cache->next) {
+        stats->hits += cache->stats.hits;
+        stats->misses += cache->stats.misses;
+        stats->prefilter_checks += cache->stats.prefilter_checks;
+        stats->prefilter_skips += cache->stats.prefilter_skips;
+    }
+    ib_lock_unlock(&modpcre_threads.lock);
+}
+
+/**
+ * Get the match cache counters, summed over all threads.
+ *
+ * Not part of the module interface: the unit tests find it with
+ * ib_dso_sym_find() to check that repeated matches do not allocate.
+ *
+ * @param[out] hits Matches served without allocating.
+ * @param[out] misses Matches that allocated.
+ */
+void DLL_PUBLIC modpcre_match_cache_stats(uint64_t *hits, uint64_t *misses);
+
+void modpcre_match_cache_stats(uint64_t *hits, uint64_t *misses)
+{
+    assert(hits != NULL);
+    assert(misses != NULL);
+
+    modpcre_stats_t stats;
+
+    modpcre_thread_cache_stats(&stats);
+    *hits = stats.hits;
+    *misses = stats.misses;
+}
+
+/* -- Literal Prefilter -- */
+
+/**
+ * Automaton callback: record a literal in the bitmap of the current scan.
+ *
+ * The automaton is shared by all threads, so the bitmap being filled is
+ * found through the calling thread's cache.
+ *
+ * @param[in] orig Automaton.
+ * @param[in] pattern Literal.
+ * @param[in] pattern_len Length of @a pattern.
+ * @param[in] userdata The literal's size_t id.
+ * @param[in] offset Offset of the match in the subject.
+ * @param[in] relative_offset Offset of the match in the current chunk.
+ */
+static void prefilter_literal_seen(ib_ac_t *orig,
+                                   ib_ac_char_t *pattern,
+                                   size_t pattern_len,
+                                   void *userdata,
+                                   size_t offset,
+                                   size_t relative_offset)
+{
+    assert(userdata != NULL);
+
+    const modpcre_thread_cache_t *cache;
+    size_t id = *(const size_t *)userdata;
+
+    cache = pthread_getspecific(modpcre_threads.key);
+    if ( (cache != NULL) && (cache->prefilter_seen != NULL) ) {
+        cache->prefilter_seen[id / 8] |= (uint8_t)(1 << (id % 8));
+    }
+}
+
+/**
+ * Parse a hex digit.
+ *
+ * @param[in] c Character.
+ *
+ * @returns Value of @a c or -1 if it is not a hex digit.
+ */
+static int prefilter_hex_value(char c)
+{
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+/**
+ * Skip over a character class.
+ *
+ * @param[in] p Points at the opening '['.
+ *
+ * @returns Pointer just past the closing ']' or NULL if the class can not
+ *          be skipped safely.
+ */
+static const char *prefilter_skip_class(const char *p)
+{
+    assert(*p == '[');
+
+    ++p;
+    if (*p == '^') {
+        ++p;
+    }
+    /* A leading ']' is a literal member of the class. */
+    if (*p == ']') {
+        ++p;
+    }
+    for (; *p != '\0'; ++p) {
+        if (*p == '\\') {
+            if (*(p + 1) == '\0') {
+                return NULL;
+            }
+            ++p;
+        }
+        else if (*p == '[') {
+            /* POSIX classes; not worth handling. */
+            return NULL;
+        }
+        else if (*p == ']') {
+            return p + 1;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Skip over a group, including any nested groups and classes.
+ *
+ * @param[in] p Points at the opening '('.
+ *
+ * @returns Pointer just past the closing ')' or NULL if the group can not
+ *          be skipped safely.
+ */
+static const char *prefilter_skip_group(const char *p)
+{
+    assert(*p == '(');
+
+    int depth = 0;
+
+    while (*p != '\0') {
+        switch (*p) {
+            case '\\':
+                if (*(p + 1) == '\0' || *(p + 1) == 'Q') {
+                    return NULL;
+                }
+                p += 2;
+                break;
+            case '[':
+                p = prefilter_skip_class(p);
+                if (p == NULL) {
+                    return NULL;
+                }
+                break;
+            case '(':
+                ++depth;
+                ++p;
+                break;
+            case ')':
+                ++p;
+                if (--depth == 0) {
+                    return p;
+                }
+                break;
+            default:
+                ++p;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Parse a {n}, {n,} or {n,m} quantifier.
+ *
+ * @param[in] p Points at the opening '{'.
+ * @param[out] min Minimum repeat count.
+ *
+ * @returns Pointer just past the closing '}' or NULL if @a p does not start
+ *          a quantifier (in which case PCRE treats the '{' as a literal).
+ */
+static const char *prefilter_quantifier(const char *p, unsigned long *min)
+{
+    assert(*p == '{');
+
+    const char *start = ++p;
+    unsigned long n = 0;
+
+    while (isdigit((unsigned char)*p)) {
+        n = (n * 10) + (*p - '0');
+        ++p;
+    }
+    if (p == start) {
+        return NULL;
+    }
+    if (*p == ',') {
+        ++p;
+        while (isdigit((unsigned char)*p)) {
+            ++p;
+        }
+    }
+    if (*p != '}') {
+        return NULL;
+    }
+
+    *min = n;
+    return p + 1;
+}
+
+/**
+ * Extract the longest literal that every match of a pattern must contain.
+ *
+ * The parser is deliberately conservative: it gives up on any construct it
+ * does not fully understand (top level alternation, extended mode, \\Q,
+ * back references, ...).  Groups and classes are skipped as single atoms and
+ * quantifiers that allow zero repeats remove the preceding character.
+ *
+ * @param[in] mp Memory pool for the result.
+ * @param[in] patt Pattern (compiled with PCRE_DOTALL | PCRE_DOLLAR_ENDONLY).
+ * @param[out] literal The literal.
+ * @param[out] literal_len Length of @a literal.
+ *
+ * @returns
+ *   - IB_OK if a literal of at least PREFILTER_LITERAL_MIN bytes was found.
+ *   - IB_ENOENT if there is no usable literal.
+ *   - IB_EALLOC on allocation error.
+ */
+static ib_status_t prefilter_extract_literal(ib_mpool_t *mp,
+                                             const char *patt,
+                                             const char **literal,
+                                             size_t *literal_len)
+{
+    assert(mp != NULL);
+    assert(patt != NULL);
+    assert(literal != NULL);
+    assert(literal_len != NULL);
+
+    size_t patt_len = strlen(patt);
+    char *cur;
+    char *best;
+    size_t cur_len = 0;
+    size_t best_len = 0;
+    bool last_is_char = false;
+    const char *p = patt;
+
+    /* Literals are never longer than the pattern. */
+    cur = ib_mpool_alloc(mp, patt_len + 1);
+    best = ib_mpool_alloc(mp, patt_len + 1);
+    if (cur == NULL || best == NULL) {
+        return IB_EALLOC;
+    }
+
+/* End the current run of literal characters. */
+#define PREFILTER_BREAK() \
+    do { \
+        if (cur_len > best_len) { \
+            memcpy(best, cur, cur_len); \
+            best_len = cur_len; \
+        } \
+        cur_len = 0; \
+        last_is_char = false; \
+    } while (0)
+
+    while (*p != '\0') {
+        char c = *p;
+        unsigned long min = 0;
+        const char *next;
+
+        switch (c) {
+            case '\\':
+                c = *(p + 1);
+                if (c == '\0') {
+                    return IB_ENOENT;
+                }
+                p += 2;
+                if (! isalnum((unsigned char)c)) {
+                    cur[cur_len++] = c;
+                    last_is_char = true;
+                    break;
+                }
+                switch (c) {
+                    case 'n': c = '\n'; break;
+                    case 'r': c = '\r'; break;
+                    case 't': c = '\t'; break;
+                    case 'f': c = '\f'; break;
+                    case 'a': c = '\a'; break;
+                    case 'e': c = '\x1b'; break;
+                    case 'x':
+                        if ( (prefilter_hex_value(*p) < 0) ||
+                             (prefilter_hex_value(*(p + 1)) < 0) )
+                        {
+                            return IB_ENOENT;
+                        }
+                        c = (char)((prefilter_hex_value(*p) << 4) |
+                                   prefilter_hex_value(*(p + 1)));
+                        p += 2;
+                        break;
+                    case 'd': case 'D': case 'w': case 'W':
+                    case 's': case 'S': case 'h': case 'H':
+                    case 'v': case 'V': case 'R': case 'X':
+                    case 'N': case 'C':
+                    case 'b': case 'B': case 'A': case 'z':
+                    case 'Z': case 'G': case 'K':
+                        /* Character types and assertions. */
+                        PREFILTER_BREAK();
+                        continue;
+                    default:
+                        /* \Q, back references, properties, ... */
+                        return IB_ENOENT;
+                }
+                cur[cur_len++] = c;
+                last_is_char = true;
+                break;
+            case '[':
+                p = prefilter_skip_class(p);
+                if (p == NULL) {
+                    return IB_ENOENT;
+                }
+                PREFILTER_BREAK();
+                break;
+            case '(':
+                if (*(p + 1) == '?') {
+                    /* Inline options; only extended mode changes how the
+                     * rest of the pattern must be read. */
+                    for (next = p + 2;
+                         isalpha((unsigned char)*next) || *next == '-';
+                         ++next)
+                    {
+                        if (*next == 'x') {
+                            return IB_ENOENT;
+                        }
+                    }
+                }
+                p = prefilter_skip_group(p);
+                if (p == NULL) {
+                    return IB_ENOENT;
+                }
+                PREFILTER_BREAK();
+                break;
+            case ')':
+            case '|':
+                /* Top level alternation has no mandatory literal. */
+                return IB_ENOENT;
+            case '.':
+            case '^':
+            case '$':
+                ++p;
+                PREFILTER_BREAK();
+                break;
+            case '*':
+            case '?':
+                ++p;
+                if (last_is_char) {
+                    --cur_len;
+                }
+                PREFILTER_BREAK();
+                break;
+            case '+':
+                ++p;
+                PREFILTER_BREAK();
+                break;
+            case '{':
+                next = prefilter_quantifier(p, &min);
+                if (next == NULL) {
+                    cur[cur_len++] = c;
+                    last_is_char = true;
+                    ++p;
+                    break;
+                }
+                p = next;
+                if (last_is_char && min == 0) {
+                    --cur_len;
+                }
+                PREFILTER_BREAK();
+                break;
+            default:
+                cur[cur_len++] = c;
+                last_is_char = true;
+                ++p;
+        }
+    }
+    PREFILTER_BREAK();
+
+#undef PREFILTER_BREAK
+
+    if (best_len < PREFILTER_LITERAL_MIN) {
+        return IB_ENOENT;
+    }
+
+    *literal = best;
+    *literal_len = best_len;
+    return IB_OK;
+}
+
+/**
+ * Create the literal prefilter of an engine.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[out] pprefilter The new prefilter.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation error.
+ */
+static ib_status_t prefilter_create(ib_engine_t *ib,
+                                    modpcre_prefilter_t **pprefilter)
+{
+    assert(ib != NULL);
+    assert(pprefilter != NULL);
+
+    ib_mpool_t *mp = ib_engine_pool_main_get(ib);
+    modpcre_prefilter_t *prefilter;
+    ib_status_t rc;
+
+    prefilter = ib_mpool_calloc(mp, 1, sizeof(*prefilter));
+    if (prefilter == NULL) {
+        return IB_EALLOC;
+    }
+
+    rc = ib_ac_create(&prefilter->ac,
+                      IB_AC_FLAG_PARSER_NOCASE | IB_AC_FLAG_PARSER_DFA,
+                      mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    rc = ib_hash_create_nocase(&prefilter->literals, mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    *pprefilter = prefilter;
+    return IB_OK;
+}
+
+/**
+ * Register the literal factor of an rx pattern with the prefilter.
+ *
+ * Operators created after the prefilter is built, and patterns without a
+ * usable literal, are never prefiltered.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in] prefilter The prefilter.
+ * @param[in] patt The pattern.
+ * @param[out] id The literal id or PREFILTER_NONE.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation error.
+ */
+static ib_status_t prefilter_add(ib_engine_t *ib,
+                                 modpcre_prefilter_t *prefilter,
+                                 const char *patt,
+                                 size_t *id)
+{
+    assert(ib != NULL);
+    assert(prefilter != NULL);
+    assert(patt != NULL);
+    assert(id != NULL);
+
+    ib_mpool_t *mp = ib_engine_pool_main_get(ib);
+    const char *literal;
+    size_t literal_len;
+    size_t *literal_id;
+    ib_status_t rc;
+
+    *id = PREFILTER_NONE;
+
+    if (prefilter->ready) {
+        return IB_OK;
+    }
+    ++prefilter->operators;
+
+    rc = prefilter_extract_literal(mp, patt, &literal, &literal_len);
+    if (rc == IB_ENOENT) {
+        ib_log_debug2(ib, "PCRE prefilter: no literal in \"%s\"", patt);
+        return IB_OK;
+    }
+    else if (rc != IB_OK) {
+        return rc;
+    }
+
+    rc = ib_hash_get_ex(prefilter->literals,
+                        &literal_id, literal, literal_len);
+    if (rc == IB_ENOENT) {
+        literal_id = ib_mpool_alloc(mp, sizeof(*literal_id));
+        if (literal_id == NULL) {
+            return IB_EALLOC;
+        }
+        *literal_id = prefilter->count;
+
+        rc = ib_ac_add_pattern(prefilter->ac, literal,
+                               prefilter_literal_seen,
+                               literal_id, literal_len);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_hash_set_ex(prefilter->literals,
+                            literal, literal_len, literal_id);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        ++prefilter->count;
+    }
+    else if (rc != IB_OK) {
+        return rc;
+    }
+
+    ib_log_debug2(ib, "PCRE prefilter: literal \"%.*s\" for \"%s\"",
+                  (int)literal_len, literal, patt);
+
+    ++prefilter->filtered;
+    *id = *literal_id;
+    return IB_OK;
+}
+
+/**
+ * Build the prefilter automaton.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in] prefilter The prefilter.
+ *
+ * @returns Status code.
+ */
+static ib_status_t prefilter_build(ib_engine_t *ib,
+                                   modpcre_prefilter_t *prefilter)
+{
+    assert(ib != NULL);
+    assert(prefilter != NULL);
+
+    ib_status_t rc;
+
+    if (prefilter->ready) {
+        return IB_OK;
+    }
+
+    if (prefilter->count > 0) {
+        rc = ib_ac_build_links(prefilter->ac);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+    prefilter->ready = true;
+
+    ib_log_debug(ib,
+                 "PCRE prefilter: %zd literals for %zd of %zd rx operators",
+                 prefilter->count, prefilter->filtered, prefilter->operators);
+
+    return IB_OK;
+}
+
+/**
+ * Get or create the module data of @a tx.
+ *
+ * @param[in] tx Transaction.
+ * @param[out] tx_data The fetched or created data.
+ *
+ * @returns
+ *   - IB_OK on success.
+ *   - IB_EALLOC on allocation failure
+ */
+static ib_status_t get_or_create_tx_data(ib_tx_t *tx,
+                                         modpcre_tx_data_t **tx_data)
+{
+    assert(tx != NULL);
+    assert(tx->mp != NULL);
+    assert(tx_data != NULL);
+
+    ib_status_t rc;
+    modpcre_tx_data_t *data;
+
+    rc = ib_tx_get_module_data(tx, IB_MODULE_STRUCT_PTR, (void **)tx_data);
+    if ( (rc == IB_OK) && (*tx_data != NULL) ) {
+        return IB_OK;
+    }
+
+    data = ib_mpool_calloc(tx->mp, 1, sizeof(*data));
+    if (data == NULL) {
+        return IB_EALLOC;
+    }
+
+    rc = ib_hash_create(&data->dfa_workspaces, tx->mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    rc = ib_hash_create(&data->prefilter_scans, tx->mp);
+    if (rc != IB_OK) {
+        return rc;
     }
-    ib_log_debug(ib, "PCRE copied cpatt @ %p -> %p (%zd bytes)",
-                 (void *)cpatt, (void *)cpdata->cpatt, cpatt_sz);
 
-    /* Copy extra data (study data). */
-    if (edata != NULL) {
+    rc = ib_tx_set_module_data(tx, IB_MODULE_STRUCT_PTR, data);
+    if (rc != IB_OK) {
+        ib_log_debug2_tx(tx, "Failed to store tx data: %s",
+                         ib_status_to_string(rc));
+        return rc;
+    }
 
-        /* Copy edata. */
-        cpdata->edata = ib_mpool_memdup(pool, edata, sizeof(*edata));
-        if (cpdata->edata == NULL) {
-            pcre_free(edata);
-            ib_log_error(ib, "Failed to duplicate edata.");
-            return IB_EALLOC;
-        }
+    *tx_data = data;
+    return IB_OK;
+}
 
-        /* Copy edata->study_data. */
-        if (edata->study_data != NULL) {
-            cpdata->edata->study_data =
-                ib_mpool_memdup(pool, edata->study_data, study_data_sz);
+/**
+ * Check if the literal of an rx rule occurs in a subject.
+ *
+ * The first check of a subject in a transaction scans it for all literals
+ * of the prefilter at once and caches the result, keyed by field, so every
+ * further rule checking the same field and version only tests one bit.
+ *
+ * @param[in] tx Transaction.
+ * @param[in] cache The calling thread's cache.
+ * @param[in] rule_data Rule data of a prefiltered rx operator.
+ * @param[in] field Field @a subject was taken from.
+ * @param[in] subject Subject.
+ * @param[in] subject_len Length of @a subject.
+ * @param[out] found True if the literal occurs in @a subject.
+ * @param[out] miss Set to true if the scan had to allocate.
+ *
+ * @returns Status code.
+ */
+static ib_status_t prefilter_check(ib_tx_t *tx,
+                                   modpcre_thread_cache_t *cache,
+                                   const modpcre_rule_data_t *rule_data,
+                                   const ib_field_t *field,
+                                   const char *subject,
+                                   size_t subject_len,
+                                   bool *found,
+                                   bool *miss)
+{
+    assert(tx != NULL);
+    assert(cache != NULL);
+    assert(rule_data != NULL);
+    assert(rule_data->prefilter != NULL);
+    assert(rule_data->prefilter_id != PREFILTER_NONE);
+    assert(field != NULL);
+    assert(subject != NULL);
+    assert(found != NULL);
+    assert(miss != NULL);
+
+    const modpcre_prefilter_t *prefilter = rule_data->prefilter;
+    size_t id = rule_data->prefilter_id;
+    size_t bitmap_size = (prefilter->count + 7) / 8;
+    size_t version = ib_field_version(field);
+    modpcre_tx_data_t *tx_data;
+    modpcre_prefilter_scan_t *scan;
+    ib_ac_context_t ac_ctx;
+    ib_status_t rc;
 
-            if (cpdata->edata->study_data == NULL) {
-                ib_log_error(ib, "Failed to study data of size: %zd",
-                             study_data_sz);
-                pcre_free(edata);
-                return IB_EALLOC;
-            }
-        }
-        pcre_free(edata);
-    }
-    else {
-        cpdata->edata = ib_mpool_calloc(pool, 1, sizeof(*edata));
-        if (cpdata->edata == NULL) {
-            pcre_free(edata);
-            ib_log_error(ib, "Failed to allocate edata.");
-            return IB_EALLOC;
-        }
+    /* Operators may only be created before the automaton is built. */
+    if (! prefilter->ready) {
+        *found = true;
+        return IB_OK;
     }
 
-    /* Set the PCRE limits for non-DFA patterns */
-    if (! is_dfa) {
-        cpdata->edata->flags |=
-            (PCRE_EXTRA_MATCH_LIMIT | PCRE_EXTRA_MATCH_LIMIT_RECURSION);
-        cpdata->edata->match_limit =
-            (unsigned long)config->match_limit;
-        cpdata->edata->match_limit_recursion =
-            (unsigned long)config->match_limit_recursion;
-        cpdata->dfa_ws_size = 0;
+    *found = false;
+    if (subject_len < PREFILTER_LITERAL_MIN) {
+        return IB_OK;
     }
-    else {
-        cpdata->edata->match_limit = 0U;
-        cpdata->edata->match_limit_recursion = 0U;
-        cpdata->dfa_ws_size = (int)config->dfa_workspace_size;
+
+    rc = get_or_create_tx_data(tx, &tx_data);
+    if (rc != IB_OK) {
+        return rc;
     }
 
-    /* Set stack limits for JIT */
-    if (cpdata->is_jit) {
-#ifdef PCRE_HAVE_JIT
-        if (config->jit_stack_start == 0U) {
-            cpdata->jit_stack_start =
-                PCRE_JIT_STACK_START_MULT * config->match_limit_recursion;
-        }
-        else {
-            cpdata->jit_stack_start = (int)config->jit_stack_start;
-        }
-        if (config->jit_stack_max == 0U) {
-            cpdata->jit_stack_max =
-                PCRE_JIT_STACK_MAX_MULT * config->match_limit_recursion;
+    rc = ib_hash_get_ex(tx_data->prefilter_scans,
+                        &scan, (const char *)&field, sizeof(field));
+    if (rc == IB_ENOENT) {
+        *miss = true;
+        scan = ib_mpool_alloc(tx->mp, sizeof(*scan) + bitmap_size);
+        if (scan == NULL) {
+            return IB_EALLOC;
         }
-        else {
-            cpdata->jit_stack_max = (int)config->jit_stack_max;
+        scan->field = field;
+        scan->subject = NULL;
+        rc = ib_hash_set_ex(tx_data->prefilter_scans,
+                            (const char *)&scan->field, sizeof(scan->field),
+                            scan);
+        if (rc != IB_OK) {
+            return rc;
         }
-#endif
     }
-    else {
-        cpdata->jit_stack_start = 0;
-        cpdata->jit_stack_max = 0;
+    else if (rc != IB_OK) {
+        return rc;
     }
 
-    ib_log_trace(ib,
-                 "Compiled pcre pattern \"%s\": "
-                 "cpatt=%p edata=%p limit=%ld rlimit=%ld study=%p "
-                 "dfa=%s dfa-ws-sz=%d "
-                 "jit=%s jit-stack: start=%d max=%d",
-                 patt,
-                 (void *)cpdata->cpatt,
-                 (void *)cpdata->edata,
-                 cpdata->edata->match_limit,
-                 cpdata->edata->match_limit_recursion,
-                 cpdata->edata->study_data,
-                 cpdata->is_dfa ? "yes" : "no",
-                 cpdata->dfa_ws_size,
-                 cpdata->is_jit ? "yes" : "no",
-                 cpdata->jit_stack_start,
-                 cpdata->jit_stack_max);
-    *pcpdata = cpdata;
+    if ( (scan->subject != subject) ||
+         (scan->subject_len != subject_len) ||
+         (scan->version != version) )
+    {
+        memset(scan->seen, 0, bitmap_size);
+        scan->version = version;
+        scan->subject = subject;
+        scan->subject_len = subject_len;
+
+        /* prefilter_literal_seen() fills the bitmap; no match list. */
+        cache->prefilter_seen = scan->seen;
+        ib_ac_init_ctx(&ac_ctx, prefilter->ac);
+        rc = ib_ac_consume(&ac_ctx,
+                           subject,
+                           subject_len,
+                           IB_AC_FLAG_CONSUME_MATCHALL |
+                           IB_AC_FLAG_CONSUME_DOCALLBACK,
+                           tx->mp);
+        cache->prefilter_seen = NULL;
+        if ( (rc != IB_OK) && (rc != IB_ENOENT) ) {
+            scan->subject = NULL;
+            return rc;
+        }
+    }
 
+    *found = (scan->seen[id / 8] & (1 << (id % 8))) != 0;
     return IB_OK;
 }
 
-
 /* -- Matcher Interface -- */
 
 /**
@@ -639,6 +1691,17 @@ static ib_status_t pcre_operator_create(ib_engine_t *ib,
     }
     rule_data->cpdata = cpdata;
     rule_data->id = NULL;           /* Not needed for rx rules */
+    rule_data->prefilter = NULL;
+    rule_data->prefilter_id = PREFILTER_NONE;
+
+    if ( (config->use_prefilter != 0) && (config->prefilter != NULL) ) {
+        rc = prefilter_add(ib, config->prefilter, pattern,
+                           &rule_data->prefilter_id);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rule_data->prefilter = config->prefilter;
+    }
 
     /* Rule data is an alias for the compiled pattern data */
     op_inst->data = rule_data;
@@ -773,26 +1836,26 @@ static ib_status_t pcre_operator_execute(const ib_rule_exec_t *rule_exec,
     int matches;
     ib_status_t ib_rc;
     const int ovecsize = 3 * MATCH_MAX;
-    int *ovector = (int *)malloc(ovecsize*sizeof(*ovector));
+    int *ovector;
+    modpcre_thread_cache_t *cache;
+    bool miss = false;
     const char *subject = NULL;
     size_t subject_len = 0;
     const ib_bytestr_t *bytestr;
     modpcre_rule_data_t *rule_data = (modpcre_rule_data_t *)data;
     pcre_extra *edata = NULL;
-#ifdef PCRE_JIT_STACK
-    pcre_jit_stack *jit_stack = NULL;
-#endif
 
     assert(rule_data->cpdata->is_dfa == false);
 
-    if (ovector==NULL) {
+    cache = modpcre_thread_cache_get(&miss);
+    if (cache == NULL) {
         return IB_EALLOC;
     }
+    ovector = cache->ovector;
 
     if (field->type == IB_FTYPE_NULSTR) {
         ib_rc = ib_field_value(field, ib_ftype_nulstr_out(&subject));
         if (ib_rc != IB_OK) {
-            free(ovector);
             return ib_rc;
         }
 
@@ -803,7 +1866,6 @@ static ib_status_t pcre_operator_execute(const ib_rule_exec_t *rule_exec,
     else if (field->type == IB_FTYPE_BYTESTR) {
         ib_rc = ib_field_value(field, ib_ftype_bytestr_out(&bytestr));
         if (ib_rc != IB_OK) {
-            free(ovector);
             return ib_rc;
         }
 
@@ -813,7 +1875,6 @@ static ib_status_t pcre_operator_execute(const ib_rule_exec_t *rule_exec,
         }
     }
     else {
-        free(ovector);
         return IB_EINVAL;
     }
 
@@ -837,23 +1898,41 @@ static ib_status_t pcre_operator_execute(const ib_rule_exec_t *rule_exec,
         }
     }
 
+    /* Skip the match if the pattern's literal is not in the subject. */
+    if (rule_data->prefilter_id != PREFILTER_NONE) {
+        bool found;
+
+        ib_rc = prefilter_check(rule_exec->tx,
+                                cache,
+                                rule_data,
+                                field,
+                                subject,
+                                subject_len,
+                                &found,
+                                &miss);
+        if (ib_rc != IB_OK) {
+            return ib_rc;
+        }
+
+        ++cache->stats.prefilter_checks;
+        if (! found) {
+            ++cache->stats.prefilter_skips;
+            modpcre_thread_cache_count(cache, miss);
+            ib_rule_profile_operator_skip(rule_exec);
+            ib_rule_log_trace(rule_exec,
+                              "Prefilter: no literal of pattern \"%s\".",
+                              rule_data->cpdata->patt);
+            *result = 0;
+            return IB_OK;
+        }
+    }
+
     if (rule_data->cpdata->is_jit) {
 #ifdef PCRE_JIT_STACK
-        jit_stack = pcre_jit_stack_alloc(rule_data->cpdata->jit_stack_start,
-                                         rule_data->cpdata->jit_stack_max);
-        if (jit_stack == NULL) {
-            ib_rule_log_debug(rule_exec,
-                              "Failed to allocate a jit stack for a "
-                              "jit-compiled rule.  "
-                              "Not using jit for this call.");
-        }
-        /* If the study data is NULL or size zero, don't use it. */
-        else if (rule_data->cpdata->study_data_sz > 0) {
+        /* The JIT stack comes from modpcre_jit_stack_callback(). */
+        if (rule_data->cpdata->study_data_sz > 0) {
             edata = rule_data->cpdata->edata;
         }
-        if (edata != NULL) {
-            pcre_assign_jit_stack(edata, NULL, jit_stack);
-        }
 #else
         edata = NULL;
 #endif
@@ -873,12 +1952,7 @@ static ib_status_t pcre_operator_execute(const ib_rule_exec_t *rule_exec,
                         0, /* Options. */
                         ovector,
                         ovecsize);
-
-#ifdef PCRE_JIT_STACK
-    if (jit_stack != NULL) {
-        pcre_jit_stack_free(jit_stack);
-    }
-#endif
+    modpcre_thread_cache_count(cache, miss);
 
     if (matches > 0) {
         if (ib_flags_all(rule_exec->rule->flags, IB_RULE_FLAG_CAPTURE)) {
@@ -913,7 +1987,6 @@ static ib_status_t pcre_operator_execute(const ib_rule_exec_t *rule_exec,
         *result = 0;
     }
 
-    free(ovector);
     return ib_rc;
 }
 
@@ -1035,6 +2108,8 @@ static ib_status_t dfa_operator_create(ib_engine_t *ib,
         return IB_EALLOC;
     }
     rule_data->cpdata = cpdata;
+    rule_data->prefilter = NULL;
+    rule_data->prefilter_id = PREFILTER_NONE;
     rc = dfa_id_set(rule, op_inst, pool, rule_data);
     if (rc != IB_OK) {
         ib_log_error(ib, "Error creating ID for DFA: %s",
@@ -1048,57 +2123,6 @@ static ib_status_t dfa_operator_create(ib_engine_t *ib,
     return IB_OK;
 }
 
-/**
- * Get or create an ib_hash_t inside of @c tx for storing dfa rule data.
- *
- * The hash is stored at the key @c HASH_NAME_STR.
- *
- * @param[in] tx The transaction containing @c tx->data which holds
- *            the @a rule_data object.
- * @param[out] hash The fetched or created rule data hash. This is set
- *             to NULL on failure.
- *
- * @return
- *   - IB_OK on success.
- *   - IB_EALLOC on allocation failure
- */
-static ib_status_t get_or_create_rule_data_hash(ib_tx_t *tx,
-                                                ib_hash_t **hash)
-{
-    assert(tx);
-    assert(tx->mp);
-
-    ib_status_t rc;
-
-    /* Get or create the hash that contains the rule data. */
-    rc = ib_tx_get_module_data(tx, IB_MODULE_STRUCT_PTR, (void **)hash);
-    if ( (rc == IB_OK) && (*hash != NULL) ) {
-        ib_log_debug2_tx(tx, "Found rule data hash in tx.");
-        return IB_OK;
-    }
-
-    ib_log_debug2_tx(tx, "Rule data hash did not exist in tx.");
-
-    rc = ib_hash_create(hash, tx->mp);
-    if (rc != IB_OK) {
-        ib_log_debug2_tx(tx, "Failed to create hash: %s",
-                         ib_status_to_string(rc));
-        return rc;
-    }
-
-    rc = ib_tx_set_module_data(tx, IB_MODULE_STRUCT_PTR, *hash);
-    if (rc != IB_OK) {
-        ib_log_debug2_tx(tx, "Failed to store hash: %s",
-                         ib_status_to_string(rc));
-        *hash = NULL;
-    }
-
-    ib_log_debug2_tx(tx, "Returning rule hash at %p.", *hash);
-
-    return rc;
-
-}
-
 struct dfa_workspace_t {
     int *workspace;
     int wscount;
@@ -1127,13 +2151,13 @@ static ib_status_t alloc_dfa_tx_data(ib_tx_t *tx,
     assert(id);
     assert(workspace);
 
-    ib_hash_t *hash;
+    modpcre_tx_data_t *tx_data;
     ib_status_t rc;
     dfa_workspace_t *ws;
     size_t size;
 
     *workspace = NULL;
-    rc = get_or_create_rule_data_hash(tx, &hash);
+    rc = get_or_create_tx_data(tx, &tx_data);
     if (rc != IB_OK) {
         return rc;
     }
@@ -1150,7 +2174,7 @@ static ib_status_t alloc_dfa_tx_data(ib_tx_t *tx,
         return IB_EALLOC;
     }
 
-    rc = ib_hash_set(hash, id, ws);
+    rc = ib_hash_set(tx_data->dfa_workspaces, id, ws);
     if (rc == IB_OK) {
         *workspace = ws;
     }
@@ -1179,15 +2203,15 @@ static ib_status_t get_dfa_tx_data(ib_tx_t *tx,
     assert(id);
     assert(workspace);
 
-    ib_hash_t *hash;
+    modpcre_tx_data_t *tx_data;
     ib_status_t rc;
 
-    rc = get_or_create_rule_data_hash(tx, &hash);
+    rc = get_or_create_tx_data(tx, &tx_data);
     if (rc != IB_OK) {
         return rc;
     }
 
-    rc = ib_hash_get(hash, workspace, id);
+    rc = ib_hash_get(tx_data->dfa_workspaces, workspace, id);
     if (rc != IB_OK) {
         *workspace = NULL;
     }
@@ -1223,6 +2247,8 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
     ib_status_t ib_rc;
     const int ovecsize = 3 * MATCH_MAX;
     modpcre_rule_data_t *rule_data = (modpcre_rule_data_t *)data;
+    modpcre_thread_cache_t *cache;
+    bool miss = false;
     int *ovector;
     const char *subject;
     size_t subject_len;
@@ -1233,15 +2259,16 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
 
     assert(rule_data->cpdata->is_dfa == true);
 
-    ovector = (int *)malloc(ovecsize*sizeof(*ovector));
-    if (ovector==NULL) {
+    cache = modpcre_thread_cache_get(&miss);
+    if (cache == NULL) {
         return IB_EALLOC;
     }
+    ovector = cache->ovector;
+    modpcre_thread_cache_count(cache, miss);
 
     if (field->type == IB_FTYPE_NULSTR) {
         ib_rc = ib_field_value(field, ib_ftype_nulstr_out(&subject));
         if (ib_rc != IB_OK) {
-            free(ovector);
             return ib_rc;
         }
 
@@ -1250,7 +2277,6 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
     else if (field->type == IB_FTYPE_BYTESTR) {
         ib_rc = ib_field_value(field, ib_ftype_bytestr_out(&bytestr));
         if (ib_rc != IB_OK) {
-            free(ovector);
             return ib_rc;
         }
 
@@ -1258,7 +2284,6 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
         subject = (const char *) ib_bytestr_const_ptr(bytestr);
     }
     else {
-        free(ovector);
         return IB_EINVAL;
     }
 
@@ -1285,7 +2310,6 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
 
         ib_rc = alloc_dfa_tx_data(tx, rule_data->cpdata, id, &dfa_workspace);
         if (ib_rc != IB_OK) {
-            free(ovector);
             ib_rule_log_error(rule_exec,
                               "Error creating tx storage for dfa operator: %s",
                               ib_status_to_string(ib_rc));
@@ -1301,7 +2325,6 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
                           dfa_workspace);
     }
     else {
-        free(ovector);
         ib_rule_log_error(rule_exec,
                           "Error fetching dfa data for dfa operator: %s",
                           ib_status_to_string(ib_rc));
@@ -1355,7 +2378,6 @@ static ib_status_t dfa_operator_execute(const ib_rule_exec_t *rule_exec,
         *result = 0;
     }
 
-    free(ovector);
     return ib_rc;
 }
 
@@ -1420,6 +2442,12 @@ static IB_CFGMAP_INIT_STRUCTURE(config_map) = {
         modpcre_cfg_t,
         dfa_workspace_size
     ),
+    IB_CFGMAP_INIT_ENTRY(
+        MODULE_NAME_STR ".use_prefilter",
+        IB_FTYPE_NUM,
+        modpcre_cfg_t,
+        use_prefilter
+    ),
     IB_CFGMAP_INIT_LAST
 };
 
@@ -1471,6 +2499,9 @@ static ib_status_t handle_directive_onoff(ib_cfgparser_t *cp,
     else if (strcasecmp("PcreUseJit", name) == 0) {
         pname = MODULE_NAME_STR ".use_jit";
     }
+    else if (strcasecmp("PcrePrefilter", name) == 0) {
+        pname = MODULE_NAME_STR ".use_prefilter";
+    }
     else {
         ib_cfg_log_error(cp, "Unhandled directive \"%s\"", name);
         return IB_EINVAL;
@@ -1575,6 +2606,11 @@ static IB_DIRMAP_INIT_STRUCTURE(directive_map) = {
         handle_directive_onoff,
         NULL
     ),
+    IB_DIRMAP_INIT_ONOFF(
+        "PcrePrefilter",
+        handle_directive_onoff,
+        NULL
+    ),
     IB_DIRMAP_INIT_PARAM1(
         "PcreMatchLimit",
         handle_directive_param,
@@ -1610,6 +2646,7 @@ static ib_status_t modpcre_init(ib_engine_t *ib,
     assert(ib != NULL);
     assert(m != NULL);
     ib_status_t rc;
+    modpcre_cfg_t *config;
 
     /* Register as a matcher provider. */
     rc = ib_provider_register(ib,
@@ -1629,6 +2666,39 @@ static ib_status_t modpcre_init(ib_engine_t *ib,
     ib_log_debug(ib, "PCRE Status: compiled=\"%d.%d %s\" loaded=\"%s\"",
         PCRE_MAJOR, PCRE_MINOR, IB_XSTRINGIFY(PCRE_DATE), pcre_version());
 
+    /* Set up the per-thread match cache; shared by all engines. */
+    ib_lock_lock(&modpcre_threads.lock);
+    if ( (modpcre_threads.users == 0) &&
+         (pthread_key_create(&modpcre_threads.key,
+                             modpcre_thread_cache_destroy) != 0) )
+    {
+        ib_lock_unlock(&modpcre_threads.lock);
+        ib_log_error(ib,
+                     MODULE_NAME_STR
+                     ": Error creating match cache thread key.");
+        return IB_EALLOC;
+    }
+    ++modpcre_threads.users;
+    ib_lock_unlock(&modpcre_threads.lock);
+
+    /* Create the engine's literal prefilter.  It is stored in the main
+     * context configuration so that all child contexts share it. */
+    rc = ib_context_module_config(ib_context_main(ib), m, &config);
+    if (rc != IB_OK) {
+        ib_log_error(ib,
+                     MODULE_NAME_STR
+                     ": Error getting main context configuration: %s",
+                     ib_status_to_string(rc));
+        return rc;
+    }
+    rc = prefilter_create(ib, &config->prefilter);
+    if (rc != IB_OK) {
+        ib_log_error(ib,
+                     MODULE_NAME_STR ": Error creating prefilter: %s",
+                     ib_status_to_string(rc));
+        return rc;
+    }
+
     /* Register operators. */
     ib_operator_register(ib,
                          "pcre",
@@ -1665,6 +2735,105 @@ static ib_status_t modpcre_init(ib_engine_t *ib,
     return IB_OK;
 }
 
+/**
+ * Build the literal prefilter once the main context is closed.
+ *
+ * All rules are created by then; rx operators created later are never
+ * prefiltered.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in] m Module instance.
+ * @param[in] ctx Context being closed.
+ * @param[in] cbdata Not used.
+ *
+ * @returns Status code.
+ */
+static ib_status_t modpcre_context_close(ib_engine_t  *ib,
+                                         ib_module_t  *m,
+                                         ib_context_t *ctx,
+                                         void         *cbdata)
+{
+    assert(ib != NULL);
+    assert(m != NULL);
+    assert(ctx != NULL);
+
+    ib_status_t rc;
+    modpcre_cfg_t *config;
+
+    if (ctx != ib_context_main(ib)) {
+        return IB_OK;
+    }
+
+    rc = ib_context_module_config(ctx, m, &config);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    if (config->prefilter == NULL) {
+        return IB_OK;
+    }
+
+    rc = prefilter_build(ib, config->prefilter);
+    if (rc != IB_OK) {
+        ib_log_error(ib,
+                     MODULE_NAME_STR ": Error building prefilter: %s",
+                     ib_status_to_string(rc));
+    }
+
+    return rc;
+}
+
+/**
+ * Report match cache statistics and release the caches.
+ *
+ * Caches are only released when the last engine using the module finishes.
+ *
+ * @param[in] ib IronBee engine.
+ * @param[in] m Module instance.
+ * @param[in] cbdata Not used.
+ *
+ * @returns IB_OK.
+ */
+static ib_status_t modpcre_fini(ib_engine_t *ib,
+                                ib_module_t *m,
+                                void        *cbdata)
+{
+    assert(ib != NULL);
+    assert(m != NULL);
+
+    modpcre_stats_t stats;
+    size_t users;
+
+    ib_lock_lock(&modpcre_threads.lock);
+    users = modpcre_threads.users;
+    ib_lock_unlock(&modpcre_threads.lock);
+    if (users == 0) {
+        return IB_OK;
+    }
+
+    modpcre_thread_cache_stats(&stats);
+    ib_log_debug(ib,
+                 "PCRE match cache: hits=%" PRIu64 " misses=%" PRIu64,
+                 stats.hits, stats.misses);
+    ib_log_info(ib,
+                "PCRE prefilter: checks=%" PRIu64 " skips=%" PRIu64
+                " skip rate=%.1f%%",
+                stats.prefilter_checks, stats.prefilter_skips,
+                (stats.prefilter_checks == 0) ? 0.0 :
+                (100.0 * stats.prefilter_skips) / stats.prefilter_checks);
+
+    ib_lock_lock(&modpcre_threads.lock);
+    if (--modpcre_threads.users == 0) {
+        pthread_key_delete(modpcre_threads.key);
+        while (modpcre_threads.list != NULL) {
+            modpcre_thread_cache_release(modpcre_threads.list);
+        }
+        memset(&modpcre_threads.retired, 0, sizeof(modpcre_threads.retired));
+    }
+    ib_lock_unlock(&modpcre_threads.lock);
+
+    return IB_OK;
+}
+
 /**
  * Module structure.
  *
@@ -1678,11 +2847,11 @@ IB_MODULE_INIT(
     directive_map,                        /**< Config directive map */
     modpcre_init,                         /**< Initialize function */
     NULL,                                 /**< Callback data */
-    NULL,                                 /**< Finish function */
+    modpcre_fini,                         /**< Finish function */
     NULL,                                 /**< Callback data */
     NULL,                                 /**< Context open function */
     NULL,                                 /**< Callback data */
-    NULL,                                 /**< Context close function */
+    modpcre_context_close,                /**< Context close function */
     NULL,                                 /**< Callback data */
     NULL,                                 /**< Context destroy function */
     NULL                                  /**< Callback data */
@@ -37,21 +37,20 @@
 #include <sys/time.h>
 #include <sys/types.h>
 
-/** File system persistence parameter parsing data */
+/** File system persistence parameter parsing data (module data) */
 typedef struct {
     const pcre   *key_pcre;          /**< Compiled PCRE to match key=[name] */
     const ib_collection_manager_t *manager; /**< Collection manager */
 } mod_persist_param_data_t;
-static mod_persist_param_data_t mod_persist_param_data = { NULL, NULL };
 
 /** File system persistence kvstore data */
 typedef struct {
-    const char    *collection_name;  /**< Name of the collection */
-    const char    *path;             /**< Path to the fs kvstore */
-    const char    *key;              /**< Key in TX data for population */
-    bool           key_expand;       /**< Key is expandable */
-    ib_kvstore_t  *kvstore;          /**< kvstore object */
-    uint32_t       expiration;       /**< Expiration time in seconds */
+    const char       *collection_name; /**< Name of the collection */
+    const char       *path;            /**< Path to the fs kvstore */
+    const char       *key;             /**< Key in TX data for population */
+    ib_data_expand_t *key_expand;      /**< Compiled key if expandable */
+    ib_kvstore_t     *kvstore;         /**< kvstore object */
+    uint32_t          expiration;      /**< Expiration time in seconds */
 } mod_persist_kvstore_t;
 
 /** File system persistence configuration data */
@@ -83,7 +82,7 @@ IB_MODULE_DECLARE();
  * @param[in] uri_scheme URI scheme
  * @param[in] uri_data Hierarchical/data part of the URI (typically a path)
  * @param[in] params List of parameter strings
- * @param[in] register_data Selection callback data
+ * @param[in] register_data Parameter parsing data (mod_persist_param_data_t)
  * @param[out] pmanager_inst_data Pointer to manager specific collection data
  *
  * @returns Status code:
@@ -110,13 +109,16 @@ static ib_status_t mod_persist_register_fn(
     assert(collection_name != NULL);
     assert(params != NULL);
     assert(pmanager_inst_data != NULL);
-    assert(mod_persist_param_data.key_pcre != NULL);
+    assert(register_data != NULL);
 
+    const mod_persist_param_data_t *param_data =
+        (const mod_persist_param_data_t *)register_data;
     const ib_list_node_t *node;
     const char *nodestr;
     const char *path;
     const char *key = NULL;
-    bool key_expand;
+    bool expand;
+    ib_data_expand_t *key_expand = NULL;
     mod_persist_kvstore_t *persist;
     ib_kvstore_t *kvstore;
     ib_status_t rc;
@@ -154,7 +156,7 @@ static ib_status_t mod_persist_register_fn(
         const char *value;
         size_t      value_len;
 
-        pcre_rc = pcre_exec(mod_persist_param_data.key_pcre, NULL,
+        pcre_rc = pcre_exec(param_data->key_pcre, NULL,
                             nodestr, strlen(nodestr),
                             0, 0, ovector, ovecsize);
         if (pcre_rc < 0) {
@@ -184,10 +186,17 @@ static ib_status_t mod_persist_register_fn(
         ib_log_error(ib, "No key specified");
     }
 
-    rc = ib_data_expand_test_str(key, &key_expand);
+    rc = ib_data_expand_test_str(key, &expand);
     if (rc != IB_OK) {
         return rc;
     }
+    if (expand) {
+        rc = ib_data_expand_compile(mp, key, strlen(key), NULL, NULL,
+                                    &key_expand);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
 
     /* Allocate and initialize a kvstore object */
     kvstore = ib_mpool_alloc(mp, sizeof(*kvstore));
@@ -356,9 +365,11 @@ static ib_status_t mod_persist_populate_fn(
     ib_kvstore_value_t *kvstore_val;
 
     /* Generate the key */
-    if (persist->key_expand) {
+    if (persist->key_expand != NULL) {
         char *expanded;
-        rc = ib_data_expand_str(tx->data, persist->key, false, &expanded);
+        size_t len;
+        rc = ib_data_expand_render(tx->data, persist->key_expand, true,
+                                   &expanded, &len);
         if (rc != IB_OK) {
             return rc;
         }
@@ -448,9 +459,11 @@ static ib_status_t mod_persist_persist_fn(
     size_t bufsize;
 
     /* Generate the key */
-    if (persist->key_expand) {
+    if (persist->key_expand != NULL) {
         char *expanded;
-        rc = ib_data_expand_str(tx->data, persist->key, false, &expanded);
+        size_t len;
+        rc = ib_data_expand_render(tx->data, persist->key_expand, true,
+                                   &expanded, &len);
         if (rc != IB_OK) {
             return rc;
         }
@@ -508,16 +521,24 @@ static ib_status_t mod_persist_init(
 
     const char *key_pattern = "^(?i)(key|expire)=(.+)$";
     const int compile_flags = PCRE_DOTALL | PCRE_DOLLAR_ENDONLY;
+    mod_persist_param_data_t *param_data;
     pcre *compiled;
     const char *error;
     int eoff;
     ib_status_t rc;
     const ib_collection_manager_t *manager;
 
+    param_data = ib_mpool_calloc(ib_engine_pool_main_get(ib),
+                                 1, sizeof(*param_data));
+    if (param_data == NULL) {
+        return IB_EALLOC;
+    }
+    module->data = param_data;
+
     /* Register the name/value pair InitCollection handler */
     rc = ib_collection_manager_register(
         ib, module, "Filesystem K/V-Store", "persist-fs://",
-        mod_persist_register_fn, NULL,
+        mod_persist_register_fn, param_data,
         mod_persist_unregister_fn, NULL,
         mod_persist_populate_fn, NULL,
         mod_persist_persist_fn, NULL,
@@ -535,8 +556,8 @@ static ib_status_t mod_persist_init(
         ib_log_error(ib, "Failed to compile pattern \"%s\"", key_pattern);
         return IB_EUNKNOWN;
     }
-    mod_persist_param_data.key_pcre = compiled;
-    mod_persist_param_data.manager = manager;
+    param_data->key_pcre = compiled;
+    param_data->manager = manager;
 
     return IB_OK;
 }
@@ -545,8 +566,12 @@ static ib_status_t mod_persist_fini(ib_engine_t *ib,
                                     ib_module_t *m,
                                     void *cbdata)
 {
-    if (mod_persist_param_data.key_pcre != NULL) {
-        pcre_free((pcre *)mod_persist_param_data.key_pcre);
+    mod_persist_param_data_t *param_data =
+        (mod_persist_param_data_t *)m->data;
+
+    if ( (param_data != NULL) && (param_data->key_pcre != NULL) ) {
+        pcre_free((pcre *)param_data->key_pcre);
+        param_data->key_pcre = NULL;
     }
 
     return IB_OK;
@@ -608,6 +608,13 @@ static ib_status_t parse_modifier(ib_cfgparser_t *cp,
         }
         if (expand) {
             rule->meta.flags |= IB_RULEMD_FLAG_EXPAND_MSG;
+            rc = ib_rule_expand_compile(cp->ib, value, strlen(value),
+                                        &(rule->meta.msg_expand));
+            if (rc != IB_OK) {
+                ib_cfg_log_error(cp, "Failed to compile expansion: %s",
+                                 ib_status_to_string(rc));
+                return rc;
+            }
         }
         return IB_OK;
     }
@@ -623,6 +630,13 @@ static ib_status_t parse_modifier(ib_cfgparser_t *cp,
         }
         if (expand) {
             rule->meta.flags |= IB_RULEMD_FLAG_EXPAND_DATA;
+            rc = ib_rule_expand_compile(cp->ib, value, strlen(value),
+                                        &(rule->meta.data_expand));
+            if (rc != IB_OK) {
+                ib_cfg_log_error(cp, "Failed to compile expansion: %s",
+                                 ib_status_to_string(rc));
+                return rc;
+            }
         }
         return IB_OK;
     }
@@ -30,6 +30,8 @@
 
 #include <ctype.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -1004,6 +1006,10 @@ static ib_status_t modua_field_rule_init(modua_field_rule_t *rule)
     return IB_OK;
 }
 
+/* The rules are shared by every engine; initialize them once. */
+static pthread_mutex_t modua_ruleset_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool modua_ruleset_initialized = false;
+
 /* Initialize the static rules */
 ib_status_t modua_ruleset_init(modua_match_rule_t **failed_rule,
                                unsigned int *failed_field_rule_num)
@@ -1013,6 +1019,15 @@ ib_status_t modua_ruleset_init(modua_match_rule_t **failed_rule,
     ib_status_t          rc;
     modua_field_rule_t  *field_rule;
 
+    pthread_mutex_lock(&modua_ruleset_lock);
+    if (modua_ruleset_initialized) {
+        pthread_mutex_unlock(&modua_ruleset_lock);
+        *failed_rule = NULL;
+        *failed_field_rule_num = 0;
+        return IB_OK;
+    }
+    modua_match_ruleset.num_rules = 0;
+
     /* For each of the rules, */
     for (match_rule_num = 0, match_rule = modua_match_ruleset.rules;
          match_rule->category != NULL;
@@ -1028,11 +1043,13 @@ ib_status_t modua_ruleset_init(modua_match_rule_t **failed_rule,
             /* Initialize the field rules for the match rule */
             rc = modua_field_rule_init(field_rule);
             if (rc != IB_OK) {
+                pthread_mutex_unlock(&modua_ruleset_lock);
                 *failed_rule           = match_rule;
                 *failed_field_rule_num = field_rule_num;
                 return IB_EUNKNOWN;
             }
             if (field_rule_num > MODUA_MAX_FIELD_RULES) {
+                pthread_mutex_unlock(&modua_ruleset_lock);
                 *failed_rule           = match_rule;
                 *failed_field_rule_num = field_rule_num;
                 return IB_EUNKNOWN;
@@ -1043,6 +1060,8 @@ ib_status_t modua_ruleset_init(modua_match_rule_t **failed_rule,
         /* Update the match rule count */
         ++modua_match_ruleset.num_rules;
     }
+    modua_ruleset_initialized = true;
+    pthread_mutex_unlock(&modua_ruleset_lock);
 
     /* No failures */
     *failed_rule = NULL;
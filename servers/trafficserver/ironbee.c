@@ -41,6 +41,7 @@
 # include <inttypes.h>
 
 #include <ironbee/engine.h>
+#include <ironbee/engine_manager.h>
 #include <ironbee/config.h>
 #include <ironbee/module.h> /* Only needed while config is in here. */
 #include <ironbee/provider.h>
@@ -51,13 +52,18 @@
 #include <ironbee/util.h>
 #include <ironbee/regex.h>
 static void addr2str(const struct sockaddr *addr, char *str, int *port);
+static void *ironbee_reload(void *arg);
 
 #define ADDRSIZE 48 /* what's the longest IPV6 addr ? */
 
-ib_engine_t DLL_LOCAL *ironbee = NULL;
+static ib_manager_t *manager = NULL;
+static char *ironbee_config_file = NULL;
 TSTextLogObject ironbee_log;
 #define DEFAULT_LOG "ts-ironbee"
 
+/* Number of IOBuffer blocks passed to IronBee per body data notification */
+#define BODY_SEGMENTS 16
+
 typedef enum {
     HDR_OK,
     HDR_ERROR,
@@ -175,7 +181,8 @@ typedef struct {
     ib_status_t (*ib_notify_header)(ib_engine_t*, ib_tx_t*,
                  ib_parsed_header_wrapper_t*);
     ib_status_t (*ib_notify_header_finished)(ib_engine_t*, ib_tx_t*);
-    ib_status_t (*ib_notify_body)(ib_engine_t*, ib_tx_t*, ib_txdata_t*);
+    ib_status_t (*ib_notify_body)(ib_engine_t*, ib_tx_t*,
+                                  const ib_txdata_t*, size_t);
     ib_status_t (*ib_notify_end)(ib_engine_t*, ib_tx_t*);
     ib_status_t (*ib_notify_post)(ib_engine_t*, ib_tx_t*);
 } ib_direction_data_t;
@@ -186,7 +193,7 @@ static ib_direction_data_t ib_direction_client_req = {
     TSHttpTxnClientReqGet,
     ib_state_notify_request_header_data,
     ib_state_notify_request_header_finished,
-    ib_state_notify_request_body_data,
+    ib_state_notify_request_body_datav,
     ib_state_notify_request_finished,
     NULL
 };
@@ -196,7 +203,7 @@ static ib_direction_data_t ib_direction_server_resp = {
     TSHttpTxnServerRespGet,
     ib_state_notify_response_header_data,
     ib_state_notify_response_header_finished,
-    ib_state_notify_response_body_data,
+    ib_state_notify_response_body_datav,
     ib_state_notify_response_finished,
     ib_state_notify_postprocess
 };
@@ -206,7 +213,7 @@ static ib_direction_data_t ib_direction_client_resp = {
     TSHttpTxnClientRespGet,
     ib_state_notify_response_header_data,
     ib_state_notify_response_header_finished,
-    ib_state_notify_response_body_data,
+    ib_state_notify_response_body_datav,
     ib_state_notify_response_finished,
     ib_state_notify_postprocess
 };
@@ -307,7 +314,7 @@ static void error_response(TSHttpTxn txnp, ib_txn_ctx *txndata)
         TSError("ErrorDoc - ib_parsed_resp_line_create");
     }
     else {
-        rc = ib_state_notify_response_started(ironbee, txndata->tx, rline);
+        rc = ib_state_notify_response_started(txndata->tx->ib, txndata->tx, rline);
         if (rc != IB_OK) {
             TSError("ErrorDoc - ib_state_notify_response_started");
         }
@@ -384,12 +391,12 @@ errordoc_free:
 
     if (nhdrs > 0) {
         TSDebug("ironbee", "process_hdr: notifying header data");
-        rc = ib_state_notify_response_header_data(ironbee, txndata->tx, ibhdrs);
+        rc = ib_state_notify_response_header_data(txndata->tx->ib, txndata->tx, ibhdrs);
         if (rc != IB_OK) {
             TSError("ErrorDoc - ib_state_notify_response_header_data");
         }
         TSDebug("ironbee", "process_hdr: notifying header finished");
-        rc = ib_state_notify_response_header_finished(ironbee, txndata->tx);
+        rc = ib_state_notify_response_header_finished(txndata->tx->ib, txndata->tx);
         if (rc != IB_OK) {
             TSError("ErrorDoc - ib_state_notify_response_header_finished");
         }
@@ -467,6 +474,24 @@ ib_server_t DLL_LOCAL ibplugin = {
     NULL,
 };
 
+/**
+ * Close and destroy an IronBee connection.
+ *
+ * Releases the engine acquired when the connection was created; an engine
+ * replaced by a reload is destroyed with its last connection.
+ *
+ * @param[in] iconn IronBee connection
+ */
+static void ironbee_conn_destroy(ib_conn_t *iconn)
+{
+    ib_engine_t *ib = iconn->ib;
+
+    ib_state_notify_conn_closed(ib, iconn);
+    TSDebug("ironbee", "CONN DESTROY: conn=%p", iconn);
+    ib_conn_destroy(iconn);
+    ib_manager_engine_release(manager, ib);
+}
+
 /**
  * Handle transaction context destroy.
  *
@@ -509,9 +534,7 @@ static void ib_txn_ctx_destroy(ib_txn_ctx * data)
                 tx_list_destroy(data->ssn->txns);
                 if (data->ssn->iconn) {
                     TSDebug("ironbee", "ib_txn_ctx_destroy: calling ib_state_notify_conn_closed()");
-                    ib_state_notify_conn_closed(ironbee, data->ssn->iconn);
-                    TSDebug("ironbee", "CONN DESTROY: conn=%p", data->ssn->iconn);
-                    ib_conn_destroy(data->ssn->iconn);
+                    ironbee_conn_destroy(data->ssn->iconn);
                 }
                 TSContDestroy(data->ssn->contp);
                 TSfree(data->ssn);
@@ -546,9 +569,7 @@ static void ib_ssn_ctx_destroy(ib_ssn_ctx * data)
             tx_list_destroy(data->txns);
             if (data->iconn) {
                 TSDebug("ironbee", "ib_ssn_ctx_destroy: calling ib_state_notify_conn_closed()");
-                ib_state_notify_conn_closed(ironbee, data->iconn);
-                TSDebug("ironbee", "CONN DESTROY: conn=%p", data->iconn);
-                ib_conn_destroy(data->iconn);
+                ironbee_conn_destroy(data->iconn);
             }
             /* Unlock has to come first 'cos ContDestroy destroys the mutex */
             TSMutexUnlock(data->mutex);
@@ -654,7 +675,7 @@ static void process_data(TSCont contp, ibd_ctx* ibd)
         TSDebug("ironbee",
                 "process_data: calling ib_state_notify_%s_body() %s:%d",
                 ibd->ibd->label, __FILE__, __LINE__);
-        (*ibd->ibd->ib_notify_body)(ironbee, data->tx, &itxdata);
+        (*ibd->ibd->ib_notify_body)(data->tx->ib, data->tx, &itxdata, 1);
         TSfree(ibd->data->buf);
         ibd->data->buf = NULL;
         ibd->data->buflen = 0;
@@ -723,39 +744,66 @@ static void process_data(TSCont contp, ibd_ctx* ibd)
             if (first_time) {
                 bufp = ibd->data->buf = TSmalloc(towrite);
                 ibd->data->buflen = towrite;
-            }
 
-            /* feed the data to ironbee, and consume them */
-            while (btowrite > 0) {
-                //ib_conndata_t icdata;
-                int64_t ilength;
-                TSIOBufferReader input_reader = TSVIOReaderGet(input_vio);
-                TSIOBufferBlock blkp = TSIOBufferReaderStart(input_reader);
-                const char *ibuf = TSIOBufferBlockReadStart(blkp, input_reader, &ilength);
+                while (btowrite > 0) {
+                    int64_t ilength;
+                    TSIOBufferReader input_reader = TSVIOReaderGet(input_vio);
+                    TSIOBufferBlock blkp = TSIOBufferReaderStart(input_reader);
+                    const char *ibuf = TSIOBufferBlockReadStart(blkp, input_reader, &ilength);
 
-                /* feed it to ironbee or to buffer */
-                if (first_time) {
+                    if (ilength > btowrite) {
+                        ilength = btowrite;
+                    }
                     memcpy(bufp, ibuf, ilength);
                     bufp += ilength;
+
+                    /* and mark it as all consumed */
+                    btowrite -= ilength;
+                    TSIOBufferReaderConsume(input_reader, ilength);
+                    TSVIONDoneSet(input_vio, TSVIONDoneGet(input_vio) + ilength);
                 }
-                else {
-                    ib_txdata_t itxdata;
-                    itxdata.data = (uint8_t *)ibd->data->buf;
-                    itxdata.dlen = ibd->data->buflen;
-                    TSDebug("ironbee", "process_data: calling ib_state_notify_%s_body() %s:%d", ((ibd->ibd->dir == IBD_REQ)?"request":"response"), __FILE__, __LINE__);
-                    (*ibd->ibd->ib_notify_body)(ironbee, data->tx,
-                                                (ilength!=0) ? &itxdata : NULL);
-                    if (IB_HTTP_CODE(data->status)) {  /* We're going to an error document,
-                                                        * so we discard all this data
-                                                        */
-                        ibd->data->buffering = IOBUF_DISCARD;
+            }
+            else {
+                /* Hand the blocks to ironbee in place, then consume them.
+                 * They stay valid until consumed. */
+                TSIOBufferReader input_reader = TSVIOReaderGet(input_vio);
+                TSIOBufferBlock blkp = TSIOBufferReaderStart(input_reader);
+                ib_txdata_t itxdata[BODY_SEGMENTS];
+                size_t nsegs = 0;
+
+                while (btowrite > 0 && blkp != NULL) {
+                    int64_t ilength;
+                    const char *ibuf = TSIOBufferBlockReadStart(blkp, input_reader, &ilength);
+
+                    if (ilength > btowrite) {
+                        ilength = btowrite;
+                    }
+                    if (ilength > 0) {
+                        itxdata[nsegs].data = (uint8_t *)ibuf;
+                        itxdata[nsegs].dlen = ilength;
+                        ++nsegs;
+                        btowrite -= ilength;
+                    }
+                    blkp = TSIOBufferBlockNext(blkp);
+
+                    if (nsegs == BODY_SEGMENTS ||
+                        (nsegs > 0 && (btowrite == 0 || blkp == NULL)))
+                    {
+                        TSDebug("ironbee", "process_data: calling ib_state_notify_%s_body() %s:%d", ((ibd->ibd->dir == IBD_REQ)?"request":"response"), __FILE__, __LINE__);
+                        (*ibd->ibd->ib_notify_body)(data->tx->ib, data->tx,
+                                                    itxdata, nsegs);
+                        nsegs = 0;
+                        if (IB_HTTP_CODE(data->status)) {  /* We're going to an error document,
+                                                            * so we discard all this data
+                                                            */
+                            ibd->data->buffering = IOBUF_DISCARD;
+                        }
                     }
                 }
 
                 /* and mark it as all consumed */
-                btowrite -= ilength;
-                TSIOBufferReaderConsume(input_reader, ilength);
-                TSVIONDoneSet(input_vio, TSVIONDoneGet(input_vio) + ilength);
+                TSIOBufferReaderConsume(input_reader, towrite);
+                TSVIONDoneSet(input_vio, TSVIONDoneGet(input_vio) + towrite);
             }
         }
     }
@@ -863,11 +911,11 @@ static int data_event(TSCont contp, TSEvent event, ibd_ctx *ibd)
 
             data = TSContDataGet(contp);
             TSDebug("ironbee", "data_event: calling ib_state_notify_%s_finished()", ((ibd->ibd->dir == IBD_REQ)?"request":"response"));
-            (*ibd->ibd->ib_notify_end)(ironbee, data->tx);
+            (*ibd->ibd->ib_notify_end)(data->tx->ib, data->tx);
             if ( (ibd->ibd->ib_notify_post != NULL) &&
                  (!ib_tx_flags_isset(data->tx, IB_TX_FPOSTPROCESS)) )
             {
-                (*ibd->ibd->ib_notify_post)(ironbee, data->tx);
+                (*ibd->ibd->ib_notify_post)(data->tx->ib, data->tx);
             }
             break;
         case TS_EVENT_VCONN_WRITE_READY:
@@ -1249,7 +1297,7 @@ static ib_hdr_outcome process_hdr(ib_txn_ctx *data,
         }
         else {
             TSDebug("ironbee", "process_hdr: calling ib_state_notify_request_started()");
-            ib_state_notify_request_started(ironbee, data->tx, rline);
+            ib_state_notify_request_started(data->tx->ib, data->tx, rline);
         }
 
         TSIOBufferReaderFree(readerp);
@@ -1300,7 +1348,7 @@ static ib_hdr_outcome process_hdr(ib_txn_ctx *data,
         else {
             TSDebug("ironbee", "process_hdr: calling ib_state_notify_response_started()");
             ib_log_debug_tx(data->tx, "ib_state_notify_response_started rline=%p", rline);
-            rv = ib_state_notify_response_started(ironbee, data->tx, rline);
+            rv = ib_state_notify_response_started(data->tx->ib, data->tx, rline);
             if (rv != IB_OK)
                 TSError("Error notifying ironbee response line!");
         }
@@ -1322,22 +1370,26 @@ static ib_hdr_outcome process_hdr(ib_txn_ctx *data,
     readerp = TSIOBufferReaderAlloc(iobufp);
     blockp = TSIOBufferReaderStart(readerp);
 
-    len = TSIOBufferBlockReadAvail(blockp, readerp);
-    //ib_log_debug(ironbee, 9, "ts/ironbee/process_header: len=%ld", len);
-
-    /* if we're going to enable manipulation of headers, we need a copy */
-    icdatabuf = dptr = TSmalloc(len);
+    /* The header list copies names and values, so parse the header in
+     * place when it is in a single block (the usual case) and only gather
+     * it into one buffer when it spans blocks.
+     */
+    head_buf = (void *)TSIOBufferBlockReadStart(blockp, readerp, &len);
+    if (len < TSIOBufferReaderAvail(readerp)) {
+        icdatabuf = dptr = TSmalloc(TSIOBufferReaderAvail(readerp));
 
-    for (head_buf = (void *)TSIOBufferBlockReadStart(blockp, readerp, &len);
-         len > 0;
-         head_buf = (void *)TSIOBufferBlockReadStart(
-                        TSIOBufferReaderStart(readerp), readerp, &len)) {
+        for (;
+             len > 0;
+             head_buf = (void *)TSIOBufferBlockReadStart(
+                            TSIOBufferReaderStart(readerp), readerp, &len)) {
 
-        memcpy(dptr, head_buf, len);
-        dptr += len;
+            memcpy(dptr, head_buf, len);
+            dptr += len;
 
-        /* if there's more to come, go round again ... */
-        TSIOBufferReaderConsume(readerp, len);
+            /* if there's more to come, go round again ... */
+            TSIOBufferReaderConsume(readerp, len);
+        }
+        head_buf = (char *)icdatabuf;
     }
 
     /* parse into lines and feed to ironbee as parsed data */
@@ -1355,7 +1407,7 @@ static ib_hdr_outcome process_hdr(ib_txn_ctx *data,
         goto process_hdr_cleanup;
     }
     // get_line ensures CRLF (line_len + 2)?
-    line = (const char*) icdatabuf;
+    line = (const char*) head_buf;
     while (next_line(&line, &line_len) > 0) {
         size_t n_len;
         size_t v_len;
@@ -1381,11 +1433,11 @@ static ib_hdr_outcome process_hdr(ib_txn_ctx *data,
     /* Notify headers if present */
     if (nhdrs > 0) {
         TSDebug("ironbee", "process_hdr: notifying header data");
-        rv = (*ibd->ib_notify_header)(ironbee, data->tx, ibhdrs);
+        rv = (*ibd->ib_notify_header)(data->tx->ib, data->tx, ibhdrs);
         if (rv != IB_OK)
             TSError("Error notifying Ironbee header data event");
         TSDebug("ironbee", "process_hdr: notifying header finished");
-        rv = (*ibd->ib_notify_header_finished)(ironbee, data->tx);
+        rv = (*ibd->ib_notify_header_finished)(data->tx->ib, data->tx);
         if (rv != IB_OK)
             TSError("Error notifying Ironbee header finished event");
     }
@@ -1481,6 +1533,13 @@ static int ironbee_plugin(TSCont contp, TSEvent event, void *edata)
     TSDebug("ironbee", "Entering ironbee_plugin with %d", event);
     switch (event) {
 
+        /* CONFIGURATION */
+        case TS_EVENT_MGMT_UPDATE:
+            if (TSThreadCreate(ironbee_reload, NULL) == NULL) {
+                TSError("[ironbee] failed to start reload thread\n");
+            }
+            break;
+
         /* CONNECTION */
         case TS_EVENT_HTTP_SSN_START:
             /* start of connection */
@@ -1511,9 +1570,24 @@ static int ironbee_plugin(TSCont contp, TSEvent event, void *edata)
             ssndata = TSContDataGet(contp);
             TSMutexLock(ssndata->mutex);
             if (ssndata->iconn == NULL) {
+                ib_engine_t *ib;
                 ib_status_t rc;
-                rc = ib_conn_create(ironbee, &ssndata->iconn, contp);
+
+                /* The connection keeps this engine until it is destroyed,
+                 * even if a reload publishes a new one. */
+                rc = ib_manager_engine_acquire(manager, &ib);
+                if (rc != IB_OK) {
+                    /* Never pass traffic uninspected: without an engine
+                     * the transaction is denied. */
+                    TSError("ironbee: no engine available: %d; "
+                            "denying transaction\n", rc);
+                    TSMutexUnlock(ssndata->mutex);
+                    TSHttpTxnReenable(txnp, TS_EVENT_HTTP_ERROR);
+                    break;
+                }
+                rc = ib_conn_create(ib, &ssndata->iconn, contp);
                 if (rc != IB_OK) {
+                    ib_manager_engine_release(manager, ib);
                     TSError("ironbee: ib_conn_create: %d\n", rc);
                     return rc; // FIXME - figure out what to do
                 }
@@ -1522,7 +1596,7 @@ static int ironbee_plugin(TSCont contp, TSEvent event, void *edata)
                 ssndata->txn_count = ssndata->closing = 0;
                 TSContDataSet(contp, ssndata);
                 TSDebug("ironbee", "ironbee_plugin: calling ib_state_notify_conn_opened()");
-                ib_state_notify_conn_opened(ironbee, ssndata->iconn);
+                ib_state_notify_conn_opened(ib, ssndata->iconn);
             }
             ++ssndata->txn_count;
             TSMutexUnlock(ssndata->mutex);
@@ -1692,7 +1766,7 @@ static int ironbee_plugin(TSCont contp, TSEvent event, void *edata)
             ib_txn_ctx *ctx = TSContDataGet(contp);
             TSDebug("ironbee", "TXN Close: %p\n", (void *)contp);
             if (!ib_tx_flags_isset(ctx->tx, IB_TX_FPOSTPROCESS)) {
-                ib_state_notify_postprocess(ironbee, ctx->tx);
+                ib_state_notify_postprocess(ctx->tx->ib, ctx->tx);
             }
             ib_txn_ctx_destroy(ctx);
             TSContDataSet(contp, NULL);
@@ -1927,7 +2001,55 @@ static ib_status_t ironbee_conn_init(ib_engine_t *ib,
 static void ibexit(void)
 {
     TSTextLogObjectDestroy(ironbee_log);
-    ib_engine_destroy(ironbee);
+    ib_manager_destroy(manager);
+    TSfree(ironbee_config_file);
+}
+
+/**
+ * Set up a new IronBee engine for ATS.
+ *
+ * Called by the engine manager for every engine it creates.
+ *
+ * @param[in] ib IronBee engine
+ * @param[in] cbdata Unused
+ *
+ * @returns status
+ */
+static ib_status_t ironbee_engine_setup(ib_engine_t *ib, void *cbdata)
+{
+    ib_log_set_logger(ib, ironbee_logger, NULL);
+    /* Using default log level function. */
+    ib_context_set_num(ib_context_engine(ib), "logger.log_level", 4);
+
+    return ib_hook_conn_register(ib, conn_opened_event,
+                                 ironbee_conn_init, NULL);
+}
+
+/**
+ * Reload the IronBee configuration.
+ *
+ * Runs in its own thread so the configuration is parsed without holding up
+ * traffic; connections keep their engine until they close.
+ *
+ * @param[in] arg Unused
+ *
+ * @returns NULL
+ */
+static void *ironbee_reload(void *arg)
+{
+    ib_status_t rc;
+
+    rc = ib_manager_engine_create(manager, ironbee_config_file);
+    if (rc != IB_OK) {
+        TSError("[ironbee] reload of %s failed with %d; "
+                "keeping the previous configuration\n",
+                ironbee_config_file, rc);
+    }
+    else {
+        TSDebug("ironbee", "reloaded %s", ironbee_config_file);
+    }
+
+    return NULL;
 }
 
 /**
@@ -1944,9 +2066,6 @@ static int ironbee_init(const char *configfile, const char *logfile)
 {
     /* grab from httpd module's post-config */
     ib_status_t rc;
-//  ib_provider_t *lpr;
-    ib_cfgparser_t *cp;
-    ib_context_t *ctx;
     int rv;
 
     rc = ib_initialize();
@@ -1965,54 +2084,20 @@ static int ironbee_init(const char *configfile, const char *logfile)
 
     ib_util_log_level(4);
 
-    rc = ib_engine_create(&ironbee, &ibplugin);
+    rc = ib_manager_create(&manager, &ibplugin, ironbee_engine_setup, NULL);
     if (rc != IB_OK) {
         return rc;
     }
 
-    ib_log_set_logger(ironbee, ironbee_logger, NULL);
-    /* Using default log level function. */
-    ib_context_set_num(ib_context_engine(ironbee),
-                       "logger.log_level", 4);
-
-    rc = ib_engine_init(ironbee);
-    if (rc != IB_OK) {
-        return rc;
-    }
     rc = atexit(ibexit);
     if (rc != 0) {
         return IB_OK + rv;
     }
 
-    ib_hook_conn_register(ironbee, conn_opened_event,
-                          ironbee_conn_init, NULL);
-
-
-    /* This creates the main context */
-    rc = ib_cfgparser_create(&cp, ironbee);
-    if (rc != IB_OK) {
-        return rc;
-    }
-    rc = ib_engine_config_started(ironbee, cp);
-    if (rc != IB_OK) {
-        return rc;
-    }
-
-    /* Get the main context, set some defaults */
-    ctx = ib_context_main(ironbee);
-    ib_context_set_num(ctx, "logger.log_level", 4);
+    /* Kept for reloads. */
+    ironbee_config_file = TSstrdup(configfile);
 
-    rc = ib_cfgparser_parse(cp, configfile);
-    if (rc != IB_OK) {
-        ib_engine_config_finished(ironbee);
-        ib_cfgparser_destroy(cp);
-        return rc;
-    }
-    rc = ib_engine_config_finished(ironbee);
-    if (rc != IB_OK) {
-        return rc;
-    }
-    rc = ib_cfgparser_destroy(cp);
+    rc = ib_manager_engine_create(manager, configfile);
     if (rc != IB_OK) {
         return rc;
     }
@@ -2054,6 +2139,9 @@ void TSPluginInit(int argc, const char *argv[])
     /* connection initialization & cleanup */
     TSHttpHookAdd(TS_HTTP_SSN_START_HOOK, cont);
 
+    /* reload configuration on "traffic_line -x" */
+    TSMgmtUpdateRegister(cont, "ironbee");
+
 
     if (argc < 2) {
         TSError("[ironbee] configuration file name required\n");
@@ -0,0 +1,78 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- Benchmark Test Helpers
+///
+/// Benchmarks are gtest tests named DISABLED_bench_*, so the unit test
+/// suites never run them.  Run them with "make bench" in tests/, or with
+/// --gtest_also_run_disabled_tests --gtest_filter='*.DISABLED_bench_*'.
+/// Results are reported as test properties.
+//////////////////////////////////////////////////////////////////////////////
+#ifndef __IBTEST_BENCH_HH__
+#define __IBTEST_BENCH_HH__
+
+#include "gtest/gtest.h"
+
+#include <string>
+
+#include <sys/time.h>
+
+/**
+ * Wall clock timer for benchmarks.
+ */
+class BenchTimer
+{
+public:
+    BenchTimer()
+    {
+        Start();
+    }
+
+    //! Restart the timer.
+    void Start()
+    {
+        gettimeofday(&m_start, NULL);
+    }
+
+    //! Microseconds elapsed since the timer was started.
+    double Usec() const
+    {
+        struct timeval now;
+
+        gettimeofday(&now, NULL);
+        return (now.tv_sec - m_start.tv_sec) * 1e6 +
+               (now.tv_usec - m_start.tv_usec);
+    }
+
+private:
+    struct timeval m_start;
+};
+
+/**
+ * Record a benchmark result as a property of the running test.
+ *
+ * @param[in] key Property name.
+ * @param[in] value Value; truncated to an integer.
+ */
+inline void BenchRecord(const std::string& key, double value)
+{
+    ::testing::Test::RecordProperty(key.c_str(), static_cast<int>(value));
+}
+
+#endif /* __IBTEST_BENCH_HH__ */
@@ -26,6 +26,7 @@
 #include <ironbee/server.h>
 #include <ironbee/engine.h>
 #include <ironbee/mpool.h>
+#include <ironbee/rule_engine.h>
 
 #include "gtest/gtest.h"
 #include "gtest/gtest-spi.h"
@@ -129,3 +130,41 @@ TEST_F(CoreActionTest, integration) {
     ib_field_value(f, ib_ftype_num_out(&n));
     ASSERT_EQ(1, n);
 }
+
+class CoreActionProfileTest : public BaseFixture {
+    public:
+    ib_conn_t *ib_conn;
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+        configureIronBee("CoreActionTest.integration.config");
+        ASSERT_EQ(IB_OK, ib_rule_profile_enable(ib_engine, NULL));
+
+        ib_conn = buildIronBeeConnection();
+
+        sendDataIn(ib_conn,
+                   "GET / HTTP/1.1\r\n"
+                   "Host: UnitTest\r\n"
+                   "\r\n");
+
+        assert(ib_conn->tx!=NULL);
+    }
+};
+
+TEST_F(CoreActionProfileTest, counters) {
+    ib_rule_t *rule;
+    ib_rule_profile_counters_t counters;
+
+    ASSERT_EQ(IB_OK, ib_rule_lookup(ib_engine, ib_conn->tx->ctx, "1", &rule));
+    ASSERT_EQ(IB_OK, ib_rule_profile_get(ib_engine, rule, &counters));
+    ASSERT_LE(1U, counters.invocations);
+    ASSERT_LE(1U, counters.targets);
+    ASSERT_LE(1U, counters.matches);
+    ASSERT_LE(1U, counters.actions);
+
+    FILE *fp = tmpfile();
+    ASSERT_TRUE(fp);
+    ASSERT_EQ(IB_OK, ib_rule_profile_write(ib_engine, fp));
+    ASSERT_LT(0, ftell(fp));
+    fclose(fp);
+}
@@ -29,12 +29,27 @@
 #include <ironbee/field.h>
 #include <ironbee/state_notify.h>
 #include <ironbee/bytestr.h>
+#include <ironbee/context_selection.h>
+#include <ironbee/engine_manager.h>
 #include <ironbee/transformation.h>
 #include <ironbee/provider.h>
+#include <ironbee/string.h>
 
 #include "config-parser.h"
+#include "ibtest_bench.hpp"
 #include "ibtest_util.hpp"
 #include "engine_private.h"
+#include "rule_engine_private.h"
+
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 /// @test Test ironbee library - ib_engine_create()
 TEST(TestIronBee, test_engine_create_null_server)
@@ -399,3 +414,1036 @@ TEST(TestIronBee, test_data_pcre)
 
     ibtest_engine_destroy(ib);
 }
+
+// Test lookups through pre-parsed targets.
+TEST(TestIronBee, test_data_target)
+{
+    ib_engine_t *ib;
+    ib_data_t *data;
+    ib_data_target_t *t_plain;
+    ib_data_target_t *t_sub;
+    ib_data_target_t *t_re;
+    ib_data_target_t *t_bad;
+    ib_data_target_t *t_num;
+    ib_field_t *list_field;
+    ib_field_t *out_field;
+    ib_field_t *field1;
+    ib_field_t *field2;
+    ib_list_t *out_list;
+    ib_num_t num1 = 1;
+    ib_num_t num2 = 2;
+
+    ibtest_engine_create(&ib);
+    ib_mpool_t *mp = ib_engine_pool_main_get(ib);
+
+    ASSERT_EQ(IB_OK, ib_data_create(mp, &data));
+
+    ASSERT_IB_OK(ib_data_target_create(mp, IB_S2SL("ARGV"), 0, &t_plain));
+    ASSERT_IB_OK(ib_data_target_create(mp, IB_S2SL("argv:field1"), 0, &t_sub));
+    ASSERT_IB_OK(ib_data_target_create(mp, IB_S2SL("ARGV:/2$/"), 0, &t_re));
+    ASSERT_EQ(IB_EINVAL,
+              ib_data_target_create(mp, IB_S2SL("ARGV://"), 1, &t_bad));
+
+    /* Missing field; a cached miss must not outlive an add. */
+    ASSERT_EQ(IB_ENOENT, ib_data_target_get(data, t_plain, &out_field));
+    ASSERT_FALSE(out_field);
+
+    ASSERT_IB_OK(
+        ib_field_create(&field1, mp, "field1", 6, IB_FTYPE_NUM, &num1));
+    ASSERT_IB_OK(
+        ib_field_create(&field2, mp, "field2", 6, IB_FTYPE_NUM, &num2));
+    ASSERT_IB_OK(ib_data_add_list(data, "ARGV", &list_field));
+    ASSERT_IB_OK(ib_field_list_add(list_field, field1));
+    ASSERT_IB_OK(ib_field_list_add(list_field, field2));
+
+    ASSERT_IB_OK(ib_data_target_get(data, t_plain, &out_field));
+    ASSERT_EQ(list_field, out_field);
+
+    ASSERT_IB_OK(ib_data_target_get(data, t_sub, &out_field));
+    ASSERT_IB_OK(ib_field_value(out_field, &out_list));
+    ASSERT_EQ(1U, IB_LIST_ELEMENTS(out_list));
+    ASSERT_EQ(field1, IB_LIST_FIRST(out_list)->data);
+
+    ASSERT_IB_OK(ib_data_target_get(data, t_re, &out_field));
+    ASSERT_IB_OK(ib_field_value(out_field, &out_list));
+    ASSERT_EQ(1U, IB_LIST_ELEMENTS(out_list));
+    ASSERT_EQ(field2, IB_LIST_FIRST(out_list)->data);
+
+    /* Removal invalidates the cached slot. */
+    ASSERT_IB_OK(ib_data_remove(data, "ARGV", NULL));
+    ASSERT_EQ(IB_ENOENT, ib_data_target_get(data, t_plain, &out_field));
+
+    /* Setting one key leaves the slot of another key intact. */
+    ASSERT_IB_OK(ib_data_target_create(mp, IB_S2SL("NUM"), 1, &t_num));
+    ASSERT_IB_OK(ib_data_set(data, field1, IB_S2SL("ARGV")));
+    ASSERT_IB_OK(ib_data_set(data, field2, IB_S2SL("NUM")));
+    ASSERT_IB_OK(ib_data_target_get(data, t_plain, &out_field));
+    ASSERT_EQ(field1, out_field);
+    ASSERT_IB_OK(ib_data_target_get(data, t_num, &out_field));
+    ASSERT_EQ(field2, out_field);
+    ASSERT_IB_OK(ib_data_set(data, field2, IB_S2SL("argv")));
+    ASSERT_IB_OK(ib_data_target_get(data, t_plain, &out_field));
+    ASSERT_EQ(field2, out_field);
+    ASSERT_IB_OK(ib_data_target_get(data, t_num, &out_field));
+    ASSERT_EQ(field2, out_field);
+    ASSERT_IB_OK(ib_data_remove(data, "NUM", NULL));
+    ASSERT_EQ(IB_ENOENT, ib_data_target_get(data, t_num, &out_field));
+    ASSERT_IB_OK(ib_data_target_get(data, t_plain, &out_field));
+    ASSERT_EQ(field2, out_field);
+
+    ibtest_engine_destroy(ib);
+}
+
+// Test compiled expansions.
+TEST(TestIronBee, test_data_expand)
+{
+    ib_engine_t *ib;
+    ib_data_t *data;
+    ib_data_expand_t *expand;
+    ib_field_t *list_field;
+    ib_field_t *field1;
+    ib_num_t num1 = 1;
+    char *result;
+    size_t result_len;
+    char *expected;
+
+    ibtest_engine_create(&ib);
+    ib_mpool_t *mp = ib_engine_pool_main_get(ib);
+
+    ASSERT_EQ(IB_OK, ib_data_create(mp, &data));
+    ASSERT_IB_OK(ib_data_add_nulstr(data, "NAME", "World", NULL));
+    ASSERT_IB_OK(ib_data_add_nulstr(data, "REF", "%{NAME}", NULL));
+    ASSERT_IB_OK(ib_data_add_num(data, "NUM", -5, NULL));
+    ASSERT_IB_OK(
+        ib_field_create(&field1, mp, "field1", 6, IB_FTYPE_NUM, &num1));
+    ASSERT_IB_OK(ib_data_add_list(data, "ARGV", &list_field));
+    ASSERT_IB_OK(ib_field_list_add(list_field, field1));
+
+    const char *str = "Hello %{NAME}, %{NUM}%{MISSING}|%{}|%{ARGV:field1} %{";
+    ASSERT_IB_OK(ib_rule_expand_compile(ib, IB_S2SL(str), &expand));
+    ASSERT_IB_OK(ib_data_expand_render(data, expand, true,
+                                       &result, &result_len));
+    EXPECT_STREQ("Hello World, -5||1 %{", result);
+    EXPECT_EQ(strlen(result), result_len);
+
+    /* Same as the non-compiled expansion. */
+    ASSERT_IB_OK(ib_data_expand_str(data, str, false, &expected));
+    EXPECT_STREQ(expected, result);
+
+    /* Names looked up when rendering; values are not expanded again. */
+    ASSERT_IB_OK(
+        ib_data_expand_compile(mp, IB_S2SL("<%{REF}>"), NULL, NULL, &expand));
+    ASSERT_IB_OK(ib_data_expand_render(data, expand, false,
+                                       &result, &result_len));
+    EXPECT_EQ("<%{NAME}>", std::string(result, result_len));
+
+    /* More references than are rendered on the stack. */
+    ASSERT_IB_OK(ib_rule_expand_compile(
+        ib, IB_S2SL("%{NUM}%{NUM}%{NUM}%{NUM}%{NUM}"
+                    "%{NUM}%{NUM}%{NUM}%{NUM}%{NAME}"),
+        &expand));
+    ASSERT_IB_OK(ib_data_expand_render(data, expand, true,
+                                       &result, &result_len));
+    EXPECT_STREQ("-5-5-5-5-5-5-5-5-5World", result);
+
+    /* Literal only and empty strings. */
+    ASSERT_IB_OK(ib_rule_expand_compile(ib, IB_S2SL("plain"), &expand));
+    ASSERT_IB_OK(ib_data_expand_render(data, expand, true,
+                                       &result, &result_len));
+    EXPECT_STREQ("plain", result);
+    ASSERT_IB_OK(ib_rule_expand_compile(ib, "", 0, &expand));
+    ASSERT_IB_OK(ib_data_expand_render(data, expand, true,
+                                       &result, &result_len));
+    EXPECT_STREQ("", result);
+    EXPECT_EQ(0UL, result_len);
+
+    ibtest_engine_destroy(ib);
+}
+
+/// Number of times count_calls has been executed.
+static int count_calls_calls = 0;
+
+/// Transformation that counts its executions and copies its input.
+static ib_status_t count_calls(ib_engine_t *ib,
+                               ib_mpool_t *mp,
+                               void *fndata,
+                               const ib_field_t *fin,
+                               ib_field_t **fout,
+                               ib_flags_t *pflags)
+{
+    ++count_calls_calls;
+    *pflags = IB_TFN_NONE;
+    return ib_field_copy(fout, mp, fin->name, fin->nlen, fin);
+}
+
+class TfnCacheTest : public BaseFixture {
+public:
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+
+        count_calls_calls = 0;
+        if (ib_tfn_register(ib_engine, "count_calls", count_calls,
+                            IB_TFN_FLAG_NONE, NULL) != IB_OK)
+        {
+            throw std::runtime_error("Could not register count_calls.");
+        }
+
+        configureIronBeeByString(
+            "LogLevel 4\n"
+            "LoadModule \"ibmod_htp.so\"\n"
+            "LoadModule \"ibmod_rules.so\"\n"
+            "Set parser \"htp\"\n"
+            "AuditEngine Off\n"
+            "<Site test-site>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+            "  Hostname *\n"
+            "  Rule request_headers.host @streq x id:tfn1 "
+            "phase:REQUEST_HEADER t:count_calls\n"
+            "  Rule request_headers.host @streq x id:tfn2 "
+            "phase:REQUEST_HEADER t:count_calls\n"
+            "  Rule request_headers.host @streq x id:tfn3 "
+            "phase:REQUEST_HEADER t:count_calls t:count_calls\n"
+            "</Site>\n");
+    }
+};
+
+/// @test Rules sharing a transformation chain (prefix) share its results
+TEST_F(TfnCacheTest, shared_prefix)
+{
+    ib_conn_t *ib_conn = buildIronBeeConnection();
+
+    sendDataIn(ib_conn,
+               "GET / HTTP/1.1\r\n"
+               "Host: UnitTest\r\n"
+               "\r\n");
+    ASSERT_TRUE(ib_conn->tx != NULL);
+
+    /* tfn1 computes count_calls(host), tfn2 reuses it and tfn3 only
+     * computes its second step. */
+    ASSERT_EQ(2, count_calls_calls);
+}
+
+class RuleProgramTest : public BaseFixture {
+public:
+    /// Configure a site with @a rules rules of which only the last matches.
+    void configureRules(int rules)
+    {
+        std::ostringstream config;
+        config << "LogLevel 4\n"
+               << "LoadModule \"ibmod_htp.so\"\n"
+               << "LoadModule \"ibmod_rules.so\"\n"
+               << "Set parser \"htp\"\n"
+               << "AuditEngine Off\n"
+               << "<Site test-site>\n"
+               << "  SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+               << "  Hostname *\n";
+        for (int i = 0; i < rules - 2; ++i) {
+            config << "  Rule request_headers.host @streq nomatch" << i
+                   << " id:miss" << i << " phase:REQUEST_HEADER"
+                   << " t:lowercase \"SetVar:rule_miss=1\"\n";
+        }
+        config << "  Rule request_headers.host @streq UnitTest"
+               << " id:last phase:REQUEST_HEADER chain\n"
+               << "  Rule request_headers.host @contains Unit"
+               << " \"SetVar:rule_hit=1\"\n"
+               << "</Site>\n";
+        configureIronBeeByString(config.str());
+    }
+
+    /// Run a transaction.
+    void runTx(ib_conn_t *ib_conn)
+    {
+        sendDataIn(ib_conn,
+                   "GET / HTTP/1.1\r\n"
+                   "Host: UnitTest\r\n"
+                   "\r\n");
+        ASSERT_TRUE(ib_conn->tx != NULL);
+    }
+};
+
+/// @test The phase rule loop runs only the chained rule that matches.
+TEST_F(RuleProgramTest, phase_loop)
+{
+    ib_field_t *f;
+
+    configureRules(50);
+    ib_conn_t *ib_conn = buildIronBeeConnection();
+    runTx(ib_conn);
+
+    ASSERT_EQ(IB_OK, ib_data_get(ib_conn->tx->data, "rule_hit", &f));
+    ASSERT_EQ(IB_ENOENT, ib_data_get(ib_conn->tx->data, "rule_miss", &f));
+}
+
+/// @test Benchmark: per-transaction cost of the phase rule loop.
+TEST_F(RuleProgramTest, DISABLED_bench_phase_loop)
+{
+    const int rules = 5000;
+    const int iterations = 200;
+
+    configureRules(rules);
+    ib_conn_t *ib_conn = buildIronBeeConnection();
+
+    BenchTimer timer;
+    for (int i = 0; i < iterations; ++i) {
+        runTx(ib_conn);
+    }
+    BenchRecord("rules", rules);
+    BenchRecord("usec_per_tx", timer.Usec() / iterations);
+}
+
+class RuleSetShareTest : public BaseFixture {
+public:
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+
+        std::ostringstream config;
+        config << "LogLevel 4\n"
+               << "LoadModule \"ibmod_htp.so\"\n"
+               << "LoadModule \"ibmod_rules.so\"\n"
+               << "Set parser \"htp\"\n"
+               << "AuditEngine Off\n"
+               << "Rule request_headers.host @contains test"
+               << " id:share1 phase:REQUEST_HEADER \"SetVar:share1=1\"\n"
+               << "Rule request_headers.host @contains test"
+               << " id:share2 phase:REQUEST_HEADER \"SetVar:share2=1\"\n";
+        for (int i = 0; i < 2; ++i) {
+            config << "<Site same" << i << ">\n"
+                   << "  SiteId AAAABBBB-1111-2222-5555-00000000000" << i
+                   << "\n"
+                   << "  Hostname same" << i << ".test\n"
+                   << "  RuleEnable all\n"
+                   << "</Site>\n";
+        }
+        config << "<Site other>\n"
+               << "  SiteId AAAABBBB-1111-2222-5555-000000000009\n"
+               << "  Hostname other.test\n"
+               << "  RuleEnable all\n"
+               << "  <Location /loc>\n"
+               << "    RuleDisable id:share2\n"
+               << "  </Location>\n"
+               << "</Site>\n";
+        configureIronBeeByString(config.str());
+    }
+
+    /// Run a request and return the rule program of its header phase.
+    const ib_rule_program_t *program(const std::string& host,
+                                     const std::string& path,
+                                     bool *share2)
+    {
+        ib_conn_t *ib_conn = buildIronBeeConnection();
+        ib_field_t *f;
+
+        sendDataIn(ib_conn,
+                   "GET " + path + " HTTP/1.1\r\n"
+                   "Host: " + host + "\r\n"
+                   "\r\n");
+        if (ib_conn->tx == NULL) {
+            throw std::runtime_error("No transaction.");
+        }
+        *share2 = (ib_data_get(ib_conn->tx->data, "share2", &f) == IB_OK);
+
+        return ib_conn->tx->ctx->rules->
+            ruleset.phases[PHASE_REQUEST_HEADER].program;
+    }
+};
+
+/// @test Contexts that only inherit rules share their compiled rule sets.
+TEST_F(RuleSetShareTest, shares_programs)
+{
+    const ib_rule_program_t *same0;
+    const ib_rule_program_t *same1;
+    const ib_rule_program_t *other;
+    const ib_rule_program_t *loc;
+    bool share2;
+
+    same0 = program("same0.test", "/", &share2);
+    ASSERT_TRUE(same0 != NULL);
+    ASSERT_EQ(2U, same0->num_rules);
+    ASSERT_TRUE(share2);
+
+    same1 = program("same1.test", "/", &share2);
+    ASSERT_EQ(same0, same1);
+
+    other = program("other.test", "/", &share2);
+    ASSERT_EQ(same0, other);
+
+    /* The location's disable gives it its own rule set. */
+    loc = program("other.test", "/loc", &share2);
+    ASSERT_TRUE(loc != NULL);
+    ASSERT_NE(same0, loc);
+    ASSERT_EQ(1U, loc->num_rules);
+    ASSERT_FALSE(share2);
+}
+
+class AuditLogSegmentTest : public BaseFixture {
+public:
+    char dir[64];
+
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+
+        strcpy(dir, "ironbee_gtest_audit_XXXXXX");
+        ASSERT_TRUE(mkdtemp(dir) != NULL);
+
+        std::ostringstream config;
+        config << "LogLevel 4\n"
+               << "LoadModule \"ibmod_htp.so\"\n"
+               << "Set parser \"htp\"\n"
+               << "AuditEngine On\n"
+               << "AuditLogBaseDir " << dir << "\n"
+               << "AuditLogMode Segment\n"
+               << "AuditLogFlushInterval 0\n"
+               << "<Site test-site>\n"
+               << "  SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+               << "  Hostname *\n"
+               << "</Site>\n";
+        configureIronBeeByString(config.str());
+    }
+
+    /// Contents of the first segment offset index in @c dir, or "".
+    std::string readSegmentIndex()
+    {
+        std::string contents;
+        DIR *d = opendir(dir);
+        struct dirent *ent;
+
+        if (d == NULL) {
+            return contents;
+        }
+        while ((ent = readdir(d)) != NULL) {
+            std::string name(ent->d_name);
+            if ( (name.size() > 8) &&
+                 (name.compare(name.size() - 8, 8, ".seg.idx") == 0) )
+            {
+                std::ifstream idx((std::string(dir) + "/" + name).c_str());
+                std::getline(idx, contents);
+                break;
+            }
+        }
+        closedir(d);
+        return contents;
+    }
+
+    virtual void TearDown()
+    {
+        BaseFixture::TearDown();
+
+        DIR *d = opendir(dir);
+        struct dirent *ent;
+        if (d != NULL) {
+            while ((ent = readdir(d)) != NULL) {
+                if (ent->d_name[0] != '.') {
+                    unlink((std::string(dir) + "/" + ent->d_name).c_str());
+                }
+            }
+            closedir(d);
+        }
+        rmdir(dir);
+    }
+};
+
+/// @test Segment mode audit records are appended by the writer thread.
+TEST_F(AuditLogSegmentTest, writes_segment)
+{
+    ib_conn_t *ib_conn = buildIronBeeConnection();
+    std::string line;
+    unsigned long offset = 1;
+    unsigned long length = 0;
+
+    sendDataIn(ib_conn,
+               "GET / HTTP/1.1\r\n"
+               "Host: UnitTest\r\n"
+               "\r\n");
+    sendDataOut(ib_conn,
+                "HTTP/1.1 200 OK\r\n"
+                "Content-Length: 0\r\n"
+                "\r\n");
+    ib_state_notify_conn_closed(ib_engine, ib_conn);
+
+    /* The writer runs asynchronously; give it a moment. */
+    for (int i = 0; (i < 200) && line.empty(); ++i) {
+        usleep(10000);
+        line = readSegmentIndex();
+    }
+
+    ASSERT_FALSE(line.empty());
+    ASSERT_EQ(2, sscanf(line.c_str(), "%lu %lu", &offset, &length));
+    ASSERT_EQ(0UL, offset);
+    ASSERT_LT(0UL, length);
+}
+
+class AsyncLogTest : public BaseFixture {
+public:
+    char path[64];
+
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+
+        strcpy(path, "ironbee_gtest_log_XXXXXX");
+        int fd = mkstemp(path);
+        ASSERT_LE(0, fd);
+        close(fd);
+
+        std::ostringstream config;
+        config << "LogLevel 4\n"
+               << "Log " << path << "\n"
+               << "LogMode Async\n"
+               << "LogBufferSize 4096\n"
+               << "LoadModule \"ibmod_htp.so\"\n"
+               << "Set parser \"htp\"\n"
+               << "<Site test-site>\n"
+               << "  SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+               << "  Hostname *\n"
+               << "</Site>\n";
+        configureIronBeeByString(config.str());
+    }
+
+    /// Number of lines in the log containing @a text.
+    int countLines(const std::string& text)
+    {
+        std::ifstream log(path);
+        std::string line;
+        int count = 0;
+
+        while (std::getline(log, line)) {
+            if (line.find(text) != std::string::npos) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    virtual void TearDown()
+    {
+        BaseFixture::TearDown();
+        unlink(path);
+    }
+};
+
+/// @test Async mode messages are written by the writer thread.
+TEST_F(AsyncLogTest, writes_messages)
+{
+    ib_log_error(ib_engine, "async log test %d", 1);
+
+    /* The writer runs asynchronously; give it a moment. */
+    for (int i = 0; (i < 200) && (countLines("async log test 1") == 0); ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(1, countLines("async log test 1"));
+}
+
+/// @test Messages that overflow the buffer are counted, not blocked on.
+TEST_F(AsyncLogTest, drops_on_overflow)
+{
+    std::string big(300, 'x');
+
+    /* A 4k buffer cannot hold 100 of these before the writer wakes. */
+    for (int i = 0; i < 100; ++i) {
+        ib_log_error(ib_engine, "overflow %s", big.c_str());
+    }
+
+    for (int i = 0; (i < 200) && (countLines("Dropped") == 0); ++i) {
+        usleep(10000);
+    }
+    ASSERT_LE(1, countLines("Dropped"));
+    ASSERT_LT(0, countLines("overflow"));
+    ASSERT_GT(100, countLines("overflow"));
+}
+
+/// Arguments of async_log_thread().
+struct async_log_arg_t {
+    ib_engine_t   *ib;
+    volatile bool  stop;
+};
+
+/// Log until told to stop.
+static void *async_log_thread(void *arg)
+{
+    async_log_arg_t *log = static_cast<async_log_arg_t *>(arg);
+
+    for (int i = 0; ! log->stop; ++i) {
+        ib_log_error(log->ib, "parent %d", i);
+    }
+    return NULL;
+}
+
+/// @test A child forked while other threads log can log and shut down.
+TEST_F(AsyncLogTest, fork_while_logging)
+{
+    static const int children = 20;
+    async_log_arg_t arg;
+    pthread_t thread;
+
+    arg.ib = ib_engine;
+    arg.stop = false;
+    ASSERT_EQ(0, pthread_create(&thread, NULL, async_log_thread, &arg));
+
+    for (int i = 0; i < children; ++i) {
+        int status = 0;
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            /* A writer lock inherited locked would hang here. */
+            alarm(10);
+            ib_log_error(ib_engine, "fork child %d", i);
+            ib_engine_destroy(ib_engine);
+            _exit(0);
+        }
+        ASSERT_LT(0, pid);
+        ASSERT_EQ(pid, waitpid(pid, &status, 0));
+        ASSERT_TRUE(WIFEXITED(status));
+        ASSERT_EQ(0, WEXITSTATUS(status));
+    }
+
+    arg.stop = true;
+    ASSERT_EQ(0, pthread_join(thread, NULL));
+
+    /* Each child drained its own message when its engine was destroyed. */
+    ASSERT_EQ(children, countLines("fork child"));
+}
+
+/// Record each request body data notification.
+static ib_status_t collect_body_data(
+    ib_engine_t *ib,
+    ib_tx_t *tx,
+    ib_state_event_type_t event,
+    ib_txdata_t *txdata,
+    void *cbdata
+)
+{
+    std::vector<std::string> *segments =
+        static_cast<std::vector<std::string> *>(cbdata);
+
+    segments->push_back(
+        std::string(reinterpret_cast<const char *>(txdata->data),
+                    txdata->dlen));
+    return IB_OK;
+}
+
+class BodyDataTest : public BaseFixture {
+public:
+    std::vector<std::string> segments;
+
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+
+        if (ib_hook_txdata_register(ib_engine, request_body_data_event,
+                                    collect_body_data, &segments) != IB_OK)
+        {
+            throw std::runtime_error("Could not register body data hook.");
+        }
+
+        configureIronBeeByString(
+            "LogLevel 4\n"
+            "LoadModule \"ibmod_htp.so\"\n"
+            "Set parser \"htp\"\n"
+            "AuditEngine Off\n"
+            "<Site test-site>\n"
+            "  SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+            "  Hostname *\n"
+            "</Site>\n");
+    }
+};
+
+/// @test Body data segments are notified in order, in place.
+TEST_F(BodyDataTest, segments)
+{
+    ib_conn_t *ib_conn = buildIronBeeConnection();
+    char part1[] = "first,";
+    char part2[] = "second";
+    ib_txdata_t txdata[3];
+
+    sendDataIn(ib_conn,
+               "POST / HTTP/1.1\r\n"
+               "Host: UnitTest\r\n"
+               "Content-Length: 12\r\n"
+               "\r\n");
+    ASSERT_TRUE(ib_conn->tx != NULL);
+    segments.clear();
+
+    txdata[0].data = reinterpret_cast<uint8_t *>(part1);
+    txdata[0].dlen = strlen(part1);
+    txdata[1].data = reinterpret_cast<uint8_t *>(part2);
+    txdata[1].dlen = strlen(part2);
+    txdata[2].data = reinterpret_cast<uint8_t *>(part2);
+    txdata[2].dlen = 0;
+
+    ASSERT_EQ(IB_OK, ib_state_notify_request_body_datav(
+        ib_engine, ib_conn->tx, txdata, 3));
+
+    ASSERT_EQ(3UL, segments.size());
+    ASSERT_EQ("first,", segments[0]);
+    ASSERT_EQ("second", segments[1]);
+    ASSERT_EQ("", segments[2]);
+}
+
+/// Number of generated sites in ContextSelectionTest.
+static const int ctxsel_sites = 2000;
+
+class ContextSelectionTest : public BaseFixture {
+public:
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+
+        std::ostringstream config;
+        char site_id[40];
+
+        config << "LogLevel 4\n"
+               << "LoadModule \"ibmod_htp.so\"\n"
+               << "Set parser \"htp\"\n"
+               << "AuditEngine Off\n";
+        for (int i = 0; i < ctxsel_sites; ++i) {
+            snprintf(site_id, sizeof(site_id),
+                     "AAAABBBB-1111-2222-3333-%012d", i);
+            config << "<Site site" << i << ">\n"
+                   << "  SiteId " << site_id << "\n"
+                   << "  Hostname host" << i << ".example.com\n"
+                   << "</Site>\n";
+        }
+        config << "<Site wild>\n"
+               << "  SiteId AAAABBBB-1111-2222-4444-000000000001\n"
+               << "  Hostname *.wild.test\n"
+               << "</Site>\n"
+               << "<Site exact>\n"
+               << "  SiteId AAAABBBB-1111-2222-4444-000000000002\n"
+               << "  Hostname www.wild.test\n"
+               << "  Hostname other.test\n"
+               << "</Site>\n"
+               << "<Site loc>\n"
+               << "  SiteId AAAABBBB-1111-2222-4444-000000000003\n"
+               << "  Hostname LOC.test\n"
+               << "  <Location /foo>\n"
+               << "  </Location>\n"
+               << "  <Location /foo/bar>\n"
+               << "  </Location>\n"
+               << "</Site>\n"
+               << "<Site default>\n"
+               << "  SiteId AAAABBBB-1111-2222-4444-000000000004\n"
+               << "  Hostname *\n"
+               << "</Site>\n";
+        configureIronBeeByString(config.str());
+    }
+
+    /// Run a request and return the selected site and location path.
+    std::string select(ib_conn_t *ib_conn,
+                       const std::string& host,
+                       const std::string& path)
+    {
+        const ib_site_t *site;
+        const ib_site_location_t *location;
+
+        sendDataIn(ib_conn,
+                   "GET " + path + " HTTP/1.1\r\n"
+                   "Host: " + host + "\r\n"
+                   "\r\n");
+        if ( (ib_conn->tx == NULL) ||
+             (ib_context_site_get(ib_conn->tx->ctx, &site) != IB_OK) ||
+             (site == NULL) ||
+             (ib_context_location_get(ib_conn->tx->ctx, &location) != IB_OK) ||
+             (location == NULL) )
+        {
+            return "";
+        }
+        return std::string(site->name) + ":" + location->path;
+    }
+};
+
+/// @test Indexed selection keeps the first match in configuration order.
+TEST_F(ContextSelectionTest, first_match)
+{
+    ib_conn_t *ib_conn = buildIronBeeConnection();
+
+    ASSERT_EQ("site0:/", select(ib_conn, "host0.example.com", "/"));
+    ASSERT_EQ("site1999:/", select(ib_conn, "HOST1999.example.com", "/x"));
+    ASSERT_EQ("wild:/", select(ib_conn, "www.wild.test", "/"));
+    ASSERT_EQ("exact:/", select(ib_conn, "other.test", "/"));
+    ASSERT_EQ("default:/", select(ib_conn, "wild.test", "/"));
+    ASSERT_EQ("loc:/foo", select(ib_conn, "loc.test", "/foo/bar/baz"));
+    ASSERT_EQ("loc:/", select(ib_conn, "loc.test", "/fo"));
+    ASSERT_EQ("default:/", select(ib_conn, "unknown.test", "/foo"));
+
+    ib_state_notify_conn_closed(ib_engine, ib_conn);
+}
+
+/// @test Benchmark: per-transaction cost of context selection.
+TEST_F(ContextSelectionTest, DISABLED_bench_select)
+{
+    const int iterations = 2000;
+    ib_conn_t *ib_conn = buildIronBeeConnection();
+    ib_context_t *ctx;
+
+    sendDataIn(ib_conn,
+               "GET / HTTP/1.1\r\n"
+               "Host: host1999.example.com\r\n"
+               "\r\n");
+    ASSERT_TRUE(ib_conn->tx != NULL);
+
+    BenchTimer timer;
+    for (int i = 0; i < iterations; ++i) {
+        ib_ctxsel_select_context(ib_engine, ib_conn, ib_conn->tx, &ctx);
+    }
+    BenchRecord("sites", ctxsel_sites);
+    BenchRecord("nsec_per_select", timer.Usec() * 1000 / iterations);
+
+    ib_state_notify_conn_closed(ib_engine, ib_conn);
+}
+
+class EngineManagerTest : public ::testing::Test {
+public:
+    virtual void SetUp()
+    {
+        ibt_ibserver.vernum = IB_VERNUM;
+        ibt_ibserver.abinum = IB_ABINUM;
+        ibt_ibserver.version = IB_VERSION;
+        ibt_ibserver.filename = __FILE__;
+        ibt_ibserver.name = "unit_tests";
+
+        ASSERT_EQ(IB_OK, ib_initialize());
+        ASSERT_EQ(IB_OK, ib_manager_create(&manager, &ibt_ibserver,
+                                           NULL, NULL));
+
+        strcpy(dir, "ironbee_gtest_audit_XXXXXX");
+        ASSERT_TRUE(mkdtemp(dir) != NULL);
+        strcpy(log, "ironbee_gtest_log_XXXXXX");
+        int fd = mkstemp(log);
+        ASSERT_LE(0, fd);
+        close(fd);
+    }
+
+    virtual void TearDown()
+    {
+        ib_manager_destroy(manager);
+        ib_shutdown();
+
+        DIR *d = opendir(dir);
+        struct dirent *ent;
+        if (d != NULL) {
+            while ((ent = readdir(d)) != NULL) {
+                if (ent->d_name[0] != '.') {
+                    unlink((std::string(dir) + "/" + ent->d_name).c_str());
+                }
+            }
+            closedir(d);
+        }
+        rmdir(dir);
+        unlink(log);
+    }
+
+    //! Write @a text to a temporary file and return its name.
+    std::string writeConfig(const std::string& text)
+    {
+        char name[] = "ironbee_gtest.conf_XXXXXX";
+        int fd = mkstemp(name);
+        if (fd < 0) {
+            throw std::runtime_error("Failed to open tmp ironbee conf file.");
+        }
+        ssize_t size = write(fd, text.data(), text.size());
+        close(fd);
+        if (size != static_cast<ssize_t>(text.size())) {
+            unlink(name);
+            throw std::runtime_error("Failed to write whole config file.");
+        }
+        return name;
+    }
+
+    //! Configuration that logs asynchronously and audits every transaction.
+    std::string writeGoodConfig()
+    {
+        std::ostringstream config;
+        config << "LogLevel 4\n"
+               << "Log " << log << "\n"
+               << "LogMode Async\n"
+               << "ModuleBasePath " IB_XSTRINGIFY(MODULE_BASE_PATH) "\n"
+               << "LoadModule \"ibmod_htp.so\"\n"
+               << "Set parser \"htp\"\n"
+               << "SensorId B9C1B52B-C24A-4309-B9F9-0EF4CD577A3E\n"
+               << "SensorName UnitTesting\n"
+               << "SensorHostname unit-testing.sensor.tld\n"
+               << "AuditEngine On\n"
+               << "AuditLogBaseDir " << dir << "\n"
+               << "AuditLogMode Segment\n"
+               << "AuditLogFlushInterval 0\n"
+               << "<Site default>\n"
+               << "  SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+               << "  Hostname *\n"
+               << "</Site>\n";
+        return writeConfig(config.str());
+    }
+
+    //! Send @a data through @a ib_conn in direction @a in.
+    void sendData(ib_engine_t *ib, ib_conn_t *ib_conn,
+                  const std::string& data, bool in)
+    {
+        ib_conndata_t *ib_conndata;
+
+        ASSERT_EQ(IB_OK, ib_conn_data_create(ib_conn, &ib_conndata,
+                                             data.size()));
+        ib_conndata->dlen = data.size();
+        memcpy(ib_conndata->data, data.data(), data.size());
+        if (in) {
+            ASSERT_EQ(IB_OK, ib_state_notify_conn_data_in(ib, ib_conndata));
+        }
+        else {
+            ASSERT_EQ(IB_OK, ib_state_notify_conn_data_out(ib, ib_conndata));
+        }
+    }
+
+    //! Open a connection on @a ib, as a server would.
+    ib_conn_t *openConnection(ib_engine_t *ib)
+    {
+        ib_conn_t *ib_conn = NULL;
+
+        if (ib_conn_create(ib, &ib_conn, NULL) != IB_OK) {
+            throw std::runtime_error("Failed to create connection.");
+        }
+        ib_conn->local_ipstr = "1.0.0.1";
+        ib_conn->remote_ipstr = "1.0.0.2";
+        ib_conn->remote_port = 65534;
+        ib_conn->local_port = 80;
+        ib_state_notify_conn_opened(ib, ib_conn);
+        return ib_conn;
+    }
+
+    //! Run one transaction on @a ib_conn and log @a message.
+    void runTransaction(ib_engine_t *ib, ib_conn_t *ib_conn,
+                        const char *message)
+    {
+        sendData(ib, ib_conn,
+                 "GET / HTTP/1.1\r\n"
+                 "Host: UnitTest\r\n"
+                 "\r\n", true);
+        ib_log_error(ib, "%s", message);
+        sendData(ib, ib_conn,
+                 "HTTP/1.1 200 OK\r\n"
+                 "Content-Length: 0\r\n"
+                 "\r\n", false);
+    }
+
+    //! Close @a ib_conn and release its engine, as a server would.
+    void closeConnection(ib_engine_t *ib, ib_conn_t *ib_conn)
+    {
+        ib_state_notify_conn_closed(ib, ib_conn);
+        ib_conn_destroy(ib_conn);
+        ASSERT_EQ(IB_OK, ib_manager_engine_release(manager, ib));
+    }
+
+    //! Number of lines in the log containing @a text.
+    int countLogLines(const std::string& text)
+    {
+        std::ifstream in(log);
+        std::string line;
+        int count = 0;
+
+        while (std::getline(in, line)) {
+            if (line.find(text) != std::string::npos) {
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    //! Number of audit records in the segment indexes in @c dir.
+    int countAuditRecords()
+    {
+        DIR *d = opendir(dir);
+        struct dirent *ent;
+        int count = 0;
+
+        if (d == NULL) {
+            return 0;
+        }
+        while ((ent = readdir(d)) != NULL) {
+            std::string name(ent->d_name);
+            if ( (name.size() > 8) &&
+                 (name.compare(name.size() - 8, 8, ".seg.idx") == 0) )
+            {
+                std::ifstream idx((std::string(dir) + "/" + name).c_str());
+                std::string line;
+                while (std::getline(idx, line)) {
+                    ++count;
+                }
+            }
+        }
+        closedir(d);
+        return count;
+    }
+
+    ib_server_t   ibt_ibserver;
+    ib_manager_t *manager;
+    char          dir[64];
+    char          log[64];
+};
+
+/// @test Reload under a live connection; both engines log and audit.
+TEST_F(EngineManagerTest, reload)
+{
+    std::string good = writeGoodConfig();
+    std::string bad = writeConfig("NoSuchDirective On\n");
+    ib_engine_t *first;
+    ib_engine_t *second;
+    ib_engine_t *current;
+    ib_conn_t *live;
+    ib_conn_t *ib_conn;
+
+    ASSERT_EQ(IB_DECLINED, ib_manager_engine_acquire(manager, &current));
+
+    ASSERT_EQ(IB_OK, ib_manager_engine_create(manager, good.c_str()));
+    ASSERT_EQ(IB_OK, ib_manager_engine_acquire(manager, &first));
+    ASSERT_EQ(1U, ib_manager_engine_count(manager));
+
+    /* A live connection holds the first engine across the reload. */
+    live = openConnection(first);
+    runTransaction(first, live, "before reload 1");
+
+    /* The new engine is published without waiting for the connection. */
+    ASSERT_EQ(IB_OK, ib_manager_engine_create(manager, good.c_str()));
+    ASSERT_EQ(2U, ib_manager_engine_count(manager));
+    ASSERT_EQ(IB_OK, ib_manager_engine_acquire(manager, &second));
+    ASSERT_NE(first, second);
+
+    /* Both engines serve their connections side by side. */
+    ib_conn = openConnection(second);
+    runTransaction(second, ib_conn, "after reload");
+    runTransaction(first, live, "before reload 2");
+    closeConnection(second, ib_conn);
+
+    /* Destroying the first engine leaves the second one working. */
+    closeConnection(first, live);
+    ASSERT_EQ(1U, ib_manager_engine_count(manager));
+    ASSERT_EQ(IB_OK, ib_manager_engine_acquire(manager, &current));
+    ASSERT_EQ(second, current);
+    ib_conn = openConnection(current);
+    runTransaction(current, ib_conn, "after first destroyed");
+    closeConnection(current, ib_conn);
+
+    /* A failed reload keeps the current engine. */
+    ASSERT_NE(IB_OK, ib_manager_engine_create(manager, bad.c_str()));
+    ASSERT_EQ(1U, ib_manager_engine_count(manager));
+    ASSERT_EQ(IB_OK, ib_manager_engine_acquire(manager, &current));
+    ASSERT_EQ(second, current);
+    ib_conn = openConnection(current);
+    runTransaction(current, ib_conn, "after failed reload");
+    closeConnection(current, ib_conn);
+
+    /* The writers run asynchronously; give them a moment. */
+    for (int i = 0; (i < 200) && (countAuditRecords() < 5); ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(5, countAuditRecords());
+    for (int i = 0; (i < 200) && (countLogLines("after failed") == 0); ++i) {
+        usleep(10000);
+    }
+    ASSERT_EQ(2, countLogLines("before reload"));
+    ASSERT_EQ(1, countLogLines("after reload"));
+    ASSERT_EQ(1, countLogLines("after first destroyed"));
+    ASSERT_EQ(1, countLogLines("after failed reload"));
+
+    unlink(good.c_str());
+    unlink(bad.c_str());
+}
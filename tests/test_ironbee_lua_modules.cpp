@@ -143,3 +143,77 @@ TEST_F(IronBeeLuaModules, test_site_directive){
     ASSERT_TRUE(field1_val);
     ASSERT_STREQ("param2", field1_val);
 }
+
+/**
+ * Lua modules running on worker states built by replaying configuration.
+ *
+ * With more than one worker state configured, the first state claimed is
+ * one built from the configuration journal rather than the state the
+ * configuration was originally evaluated in.
+ */
+struct IronBeeLuaWorkerStates : public BaseFixture {
+
+    ib_conn_t *ib_conn;
+
+    static const char *c_ib_conf;
+
+    virtual void SetUp()
+    {
+        BaseFixture::SetUp();
+
+        configureIronBeeByString(c_ib_conf);
+
+        ib_conn = buildIronBeeConnection();
+
+        BaseFixture::sendDataIn(ib_conn,
+            "GET / HTTP/1.1\r\nHost: UnitTest\r\n\r\n");
+        BaseFixture::sendDataOut(ib_conn,
+            "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n\r\n");
+
+        assert(ib_conn->tx != NULL);
+    }
+
+    virtual void TearDown()
+    {
+        ib_state_notify_conn_closed(ib_engine, ib_conn);
+
+        BaseFixture::TearDown();
+    }
+};
+
+const char * IronBeeLuaWorkerStates::c_ib_conf =
+    "LogLevel 9\n"
+    "SensorId AAAABBBB-1111-2222-3333-FFFF00000023\n"
+    "SensorName ExampleSensorName\n"
+    "SensorHostname example.sensor.tld\n"
+    "LoadModule \"ibmod_htp.so\"\n"
+    "LoadModule \"ibmod_pcre.so\"\n"
+    "LoadModule \"ibmod_rules.so\"\n"
+    "LoadModule \"ibmod_lua.so\"\n"
+    "ModuleBasePath \".\"\n"
+    "LuaWorkerStates 3\n"
+    "LuaLoadModule \"test_ironbee_lua_modules.lua\"\n"
+    "Set parser \"htp\"\n"
+    "MyLuaDirective param1\n"
+    "MyLuaDirective2 param3\n"
+    "<Site default>\n"
+        "SiteId AAAABBBB-1111-2222-3333-000000000000\n"
+        "Hostname *\n"
+        "MyLuaDirective param2\n"
+    "</Site>\n" ;
+
+TEST_F(IronBeeLuaWorkerStates, test_replayed_directives){
+    ib_field_t *field1;
+    const char *field1_val;
+
+    ASSERT_EQ(IB_OK, ib_data_get(ib_conn->tx->data, "MyLuaDirective", &field1));
+    ASSERT_EQ(IB_FTYPE_NULSTR, field1->type);
+    ASSERT_EQ(IB_OK, ib_field_value(field1, ib_ftype_nulstr_out(&field1_val)));
+    ASSERT_TRUE(field1_val);
+    ASSERT_STREQ("param2", field1_val);
+
+    ASSERT_EQ(IB_OK, ib_data_get(ib_conn->tx->data, "MyLuaDirective2", &field1));
+    ASSERT_EQ(IB_OK, ib_field_value(field1, ib_ftype_nulstr_out(&field1_val)));
+    ASSERT_TRUE(field1_val);
+    ASSERT_STREQ("param3", field1_val);
+}
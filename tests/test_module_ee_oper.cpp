@@ -27,6 +27,9 @@
 
 #include "base_fixture.h"
 #include <ironbee/operator.h>
+#include <ironbee/rule_engine.h>
+
+#include <ironautomata/eudoxus.h>
 
 // @todo Remove once ib_engine_operator_get() is available.
 #include "engine_private.h"
@@ -135,3 +138,204 @@ TEST_F(EeOperModuleTest, test_ee_match_any_fail)
     ib_field_value(f, ib_ftype_num_out(&n));
     EXPECT_EQ(0, n);
 }
+
+TEST_F(EeOperModuleTest, test_ee_match_any_stream_across_chunks)
+{
+    ib_conn_t *ib_conn;
+    ib_field_t *f;
+    ib_num_t n;
+
+    ib_conn = buildIronBeeConnection();
+
+    // Split the pattern across two request body chunks.
+    sendDataIn(ib_conn,
+               "POST / HTTP/1.1\r\n"
+               "Host: UnitTest\r\n"
+               "Content-Length: 25\r\n"
+               "\r\n"
+               "xxxxstring_t");
+    ASSERT_NE(IB_OK, ib_data_get(ib_conn->tx->data, "stream_body_matched", &f));
+
+    sendDataIn(ib_conn, "o_matchxxxxxx");
+
+    ASSERT_EQ(IB_OK, ib_data_get(ib_conn->tx->data, "stream_body_matched", &f));
+    ASSERT_EQ(IB_FTYPE_NUM, f->type);
+    ib_field_value(f, ib_ftype_num_out(&n));
+    EXPECT_EQ(1, n);
+}
+
+// A match stops the automata in the middle of a chunk; the next chunk must
+// continue from the end of that chunk, not from the match.
+TEST_F(EeOperModuleTest, test_ee_match_any_stream_after_match)
+{
+    ib_conn_t *ib_conn;
+    ib_field_t *f;
+    ib_num_t n;
+
+    ib_conn = buildIronBeeConnection();
+
+    sendDataIn(ib_conn,
+               "POST / HTTP/1.1\r\n"
+               "Host: UnitTest\r\n"
+               "Content-Length: 30\r\n"
+               "\r\n"
+               "string_to_matchstring_t");
+    ASSERT_EQ(IB_OK, ib_data_get(ib_conn->tx->data, "stream_body_count", &f));
+    ib_field_value(f, ib_ftype_num_out(&n));
+    EXPECT_EQ(1, n);
+
+    sendDataIn(ib_conn, "o_match");
+
+    ASSERT_EQ(IB_OK, ib_data_get(ib_conn->tx->data, "stream_body_count", &f));
+    ib_field_value(f, ib_ftype_num_out(&n));
+    EXPECT_EQ(2, n);
+}
+
+// Members of a list field are consecutive chunks of the stream.
+TEST_F(EeOperModuleTest, test_ee_match_any_stream_list)
+{
+    ib_conn_t *ib_conn;
+    ib_mpool_t *mp;
+    ib_rule_t *rule;
+    ib_rule_exec_t rule_exec;
+    ib_operator_inst_t *op_inst;
+    ib_field_t *list;
+    ib_field_t *chunk;
+    ib_num_t result;
+
+    ib_conn = buildIronBeeConnection();
+    sendDataIn(ib_conn,
+               "GET / HTTP/1.1\r\n"
+               "Host: UnitTest\r\n"
+               "\r\n");
+    ASSERT_TRUE(ib_conn->tx != NULL);
+    mp = ib_conn->tx->mp;
+
+    ASSERT_EQ(IB_OK, ib_rule_create(ib_engine, ib_context_engine(ib_engine),
+                                    __FILE__, __LINE__, true, &rule));
+    ASSERT_EQ(IB_OK, ib_rule_set_id(ib_engine, rule, "ee_stream_list"));
+    ASSERT_EQ(IB_OK, ib_rule_set_phase(ib_engine, rule,
+                                       PHASE_STR_REQUEST_BODY));
+    ASSERT_EQ(IB_OK,
+              ib_operator_inst_create(ib_engine,
+                                      ib_context_main(ib_engine),
+                                      rule,
+                                      IB_OP_FLAG_STREAM,
+                                      "ee_match_any",
+                                      "pattern1",
+                                      IB_OPINST_FLAG_NONE,
+                                      &op_inst));
+
+    memset(&rule_exec, 0, sizeof(rule_exec));
+    rule_exec.ib = ib_engine;
+    rule_exec.tx = ib_conn->tx;
+    rule_exec.rule = rule;
+
+    /* The pattern spans the two members of the first list. */
+    ASSERT_EQ(IB_OK, ib_field_create(&list, mp, IB_FIELD_NAME("list"),
+                                     IB_FTYPE_LIST, NULL));
+    ASSERT_EQ(IB_OK, ib_field_create(&chunk, mp, IB_FIELD_NAME("a"),
+                                     IB_FTYPE_NULSTR,
+                                     ib_ftype_nulstr_in("xxstring_to")));
+    ASSERT_EQ(IB_OK, ib_field_list_add(list, chunk));
+    ASSERT_EQ(IB_OK, ib_field_create(&chunk, mp, IB_FIELD_NAME("b"),
+                                     IB_FTYPE_NULSTR,
+                                     ib_ftype_nulstr_in("_matchstring_")));
+    ASSERT_EQ(IB_OK, ib_field_list_add(list, chunk));
+    ASSERT_EQ(IB_OK, op_inst->op->fn_execute(&rule_exec, op_inst->data,
+                                             op_inst->flags, list, &result));
+    EXPECT_EQ(1, result);
+
+    /* The rest of the member after the match is kept for the next list. */
+    ASSERT_EQ(IB_OK, ib_field_create(&list, mp, IB_FIELD_NAME("list"),
+                                     IB_FTYPE_LIST, NULL));
+    ASSERT_EQ(IB_OK, ib_field_create(&chunk, mp, IB_FIELD_NAME("c"),
+                                     IB_FTYPE_NULSTR,
+                                     ib_ftype_nulstr_in("to_")));
+    ASSERT_EQ(IB_OK, ib_field_list_add(list, chunk));
+    ASSERT_EQ(IB_OK, ib_field_create(&chunk, mp, IB_FIELD_NAME("d"),
+                                     IB_FTYPE_NULSTR,
+                                     ib_ftype_nulstr_in("match")));
+    ASSERT_EQ(IB_OK, ib_field_list_add(list, chunk));
+    ASSERT_EQ(IB_OK, op_inst->op->fn_execute(&rule_exec, op_inst->data,
+                                             op_inst->flags, list, &result));
+    EXPECT_EQ(1, result);
+
+    /* No match in a later chunk. */
+    ASSERT_EQ(IB_OK, ib_field_create(&chunk, mp, IB_FIELD_NAME("e"),
+                                     IB_FTYPE_NULSTR,
+                                     ib_ftype_nulstr_in("string_to_mat")));
+    ASSERT_EQ(IB_OK, op_inst->op->fn_execute(&rule_exec, op_inst->data,
+                                             op_inst->flags, chunk, &result));
+    EXPECT_EQ(0, result);
+}
+
+// Automata loaded with the populate and hugepage options match as usual.
+TEST_F(EeOperModuleTest, test_ee_match_any_populated)
+{
+    ib_conn_t *ib_conn;
+    ib_field_t *f;
+    ib_num_t n;
+
+    ib_conn = buildIronBeeConnection();
+    sendDataIn(ib_conn,
+               "GET / HTTP/1.1\r\n"
+               "Host: UnitTest\r\n"
+               "X-MyHeader: xxstring with spacesxx\r\n"
+               "\r\n");
+
+    ASSERT_EQ(IB_OK, ib_data_get(ib_conn->tx->data, "populated_matched", &f));
+    ASSERT_EQ(IB_FTYPE_NUM, f->type);
+    ib_field_value(f, ib_ftype_num_out(&n));
+    EXPECT_EQ(1, n);
+}
+
+/// Eudoxus callback: count outputs.
+static ia_eudoxus_command_t ee_count_callback(const ia_eudoxus_t *engine,
+                                              const char *output,
+                                              size_t output_length,
+                                              const uint8_t *input,
+                                              void *cbdata)
+{
+    ++*static_cast<int *>(cbdata);
+    return IA_EUDOXUS_CMD_CONTINUE;
+}
+
+// Memory mapped automata, with each mapping flag, match and unmap cleanly.
+TEST(EeOperMmapTest, create_from_path_mmap)
+{
+    static const int flags[] = {
+        0,
+        IA_EUDOXUS_MMAP_POPULATE,
+        IA_EUDOXUS_MMAP_HUGEPAGE,
+        IA_EUDOXUS_MMAP_POPULATE | IA_EUDOXUS_MMAP_HUGEPAGE
+    };
+    static const char input[] = "string_to_match bogusxxx string with";
+
+    for (size_t i = 0; i < sizeof(flags) / sizeof(*flags); ++i) {
+        ia_eudoxus_t *eudoxus;
+        ia_eudoxus_state_t *state;
+        int matches = 0;
+
+        ASSERT_EQ(IA_EUDOXUS_OK,
+                  ia_eudoxus_create_from_path_mmap(&eudoxus,
+                                                   "eudoxus_pattern1.e",
+                                                   flags[i]));
+        ASSERT_EQ(IA_EUDOXUS_OK,
+                  ia_eudoxus_create_state(&state, eudoxus,
+                                          ee_count_callback, &matches));
+        ASSERT_EQ(IA_EUDOXUS_OK,
+                  ia_eudoxus_execute(state,
+                                     reinterpret_cast<const uint8_t *>(input),
+                                     sizeof(input) - 1));
+        EXPECT_EQ(2, matches);
+
+        ia_eudoxus_destroy_state(state);
+        ia_eudoxus_destroy(eudoxus);
+    }
+
+    ia_eudoxus_t *eudoxus;
+    EXPECT_NE(IA_EUDOXUS_OK,
+              ia_eudoxus_create_from_path_mmap(&eudoxus,
+                                               "no_such_automata.e", 0));
+}
@@ -26,12 +26,14 @@
 #include "gtest/gtest-spi.h"
 
 #include "base_fixture.h"
+#include "ibtest_bench.hpp"
 #include <ironbee/rule_engine.h>
 #include <ironbee/operator.h>
 #include <ironbee/hash.h>
 #include <ironbee/mpool.h>
 #include <ironbee/field.h>
 #include <ironbee/bytestr.h>
+#include <ironbee/dso.h>
 
 // @todo Remove once ib_engine_operator_get() is available.
 #include "engine_private.h"
@@ -59,7 +61,7 @@ public:
         const char *s1 = "string 1";
         const char *s2 = "string 2";
 
-        configureIronBee();
+        configure();
 
         ib_conn = buildIronBeeConnection();
 
@@ -156,6 +158,45 @@ public:
         rule_exec2.rule = rule2;
     }
 
+    //! Configure the engine; tests use their own configuration file.
+    virtual void configure()
+    {
+        configureIronBee();
+    }
+
+    /**
+     * Get the module's match cache counters, summed over all threads.
+     *
+     * @param[out] hits Matches that did not allocate.
+     * @param[out] misses Matches that allocated.
+     */
+    void cacheStats(uint64_t *hits, uint64_t *misses)
+    {
+        typedef void (*stats_fn_t)(uint64_t *, uint64_t *);
+        std::string module_path =
+            std::string(IB_XSTRINGIFY(MODULE_BASE_PATH)) +
+            "/" +
+            m_module_file;
+        ib_dso_t *dso;
+        ib_dso_sym_t *sym;
+
+        ASSERT_EQ(IB_OK, ib_dso_open(&dso,
+                                     module_path.c_str(),
+                                     ib_engine_pool_main_get(ib_engine)));
+        ASSERT_EQ(IB_OK,
+                  ib_dso_sym_find(&sym, dso, "modpcre_match_cache_stats"));
+        ((stats_fn_t)sym)(hits, misses);
+        ASSERT_EQ(IB_OK, ib_dso_close(dso));
+    }
+};
+
+// Benchmarks share the configuration of test_match_repeat.
+class PcreModuleBenchTest : public PcreModuleTest {
+public:
+    virtual void configure()
+    {
+        configureIronBee("PcreModuleTest.test_match_repeat.config");
+    }
 };
 
 TEST_F(PcreModuleTest, test_load_module)
@@ -353,3 +394,147 @@ TEST_F(PcreModuleTest, test_match_capture)
     ib_field_value(ib_field, ib_ftype_list_out(&ib_list));
     ASSERT_EQ(0U, IB_LIST_ELEMENTS(ib_list));
 }
+
+// Every match after the first on a thread is served by the per-thread
+// ovector and JIT stack cache; check that reused resources still match.
+TEST_F(PcreModuleTest, test_match_repeat)
+{
+    ib_operator_inst_t *op_inst = NULL;
+    ib_num_t result;
+    uint64_t hits1, misses1;
+    uint64_t hits2, misses2;
+
+    ASSERT_EQ(IB_OK,
+              ib_operator_inst_create(ib_engine,
+                                      ib_context_main(ib_engine),
+                                      rule1,
+                                      IB_OP_FLAG_PHASE,
+                                      "rx",
+                                      "string\\s(\\d)",
+                                      IB_OPINST_FLAG_NONE,
+                                      &op_inst));
+
+    // The first matches allocate the thread's match resources.
+    cacheStats(&hits1, &misses1);
+    for (int i = 0; i < 2; ++i) {
+        ASSERT_EQ(IB_OK, op_inst->op->fn_execute(&rule_exec1,
+                                                 op_inst->data,
+                                                 op_inst->flags,
+                                                 (i % 2) ? field2 : field1,
+                                                 &result));
+        ASSERT_TRUE(result);
+    }
+    cacheStats(&hits2, &misses2);
+    ASSERT_EQ(2U, (hits2 - hits1) + (misses2 - misses1));
+    ASSERT_LT(0U, misses2 - misses1);
+
+    // Later matches allocate nothing.
+    for (int i = 0; i < 100; ++i) {
+        ASSERT_EQ(IB_OK, op_inst->op->fn_execute(&rule_exec1,
+                                                 op_inst->data,
+                                                 op_inst->flags,
+                                                 (i % 2) ? field2 : field1,
+                                                 &result));
+        ASSERT_TRUE(result);
+    }
+    cacheStats(&hits1, &misses1);
+    ASSERT_EQ(100U, hits1 - hits2);
+    ASSERT_EQ(0U, misses1 - misses2);
+}
+
+// Benchmark of the rx match path against the nop operator, which measures
+// the cost of the call itself; also reports allocations per 1000 matches.
+TEST_F(PcreModuleBenchTest, DISABLED_bench_match_repeat)
+{
+    const int iterations = 100000;
+    ib_operator_inst_t *nop_inst = NULL;
+    ib_operator_inst_t *op_inst = NULL;
+    ib_num_t result;
+    uint64_t hits1, misses1;
+    uint64_t hits2, misses2;
+
+    ASSERT_EQ(IB_OK,
+              ib_operator_inst_create(ib_engine,
+                                      ib_context_main(ib_engine),
+                                      rule1,
+                                      IB_OP_FLAG_PHASE,
+                                      "nop",
+                                      "",
+                                      IB_OPINST_FLAG_NONE,
+                                      &nop_inst));
+    ASSERT_EQ(IB_OK,
+              ib_operator_inst_create(ib_engine,
+                                      ib_context_main(ib_engine),
+                                      rule1,
+                                      IB_OP_FLAG_PHASE,
+                                      "rx",
+                                      "string\\s(\\d)",
+                                      IB_OPINST_FLAG_NONE,
+                                      &op_inst));
+
+    BenchTimer timer;
+    for (int i = 0; i < iterations; ++i) {
+        nop_inst->op->fn_execute(&rule_exec1,
+                                 nop_inst->data,
+                                 nop_inst->flags,
+                                 (i % 2) ? field2 : field1,
+                                 &result);
+    }
+    BenchRecord("baseline_nsec_per_call", timer.Usec() * 1000 / iterations);
+
+    cacheStats(&hits1, &misses1);
+    timer.Start();
+    for (int i = 0; i < iterations; ++i) {
+        op_inst->op->fn_execute(&rule_exec1,
+                                op_inst->data,
+                                op_inst->flags,
+                                (i % 2) ? field2 : field1,
+                                &result);
+    }
+    BenchRecord("nsec_per_match", timer.Usec() * 1000 / iterations);
+    cacheStats(&hits2, &misses2);
+
+    BenchRecord("iterations", iterations);
+    BenchRecord("cache_hits", hits2 - hits1);
+    BenchRecord("allocs_per_1000_matches",
+                (misses2 - misses1) * 1000.0 / iterations);
+}
+
+// Rules are created by the configuration, so their literals are part of the
+// prefilter; check that it only ever skips rules that can not match.
+TEST_F(PcreModuleTest, test_match_prefilter)
+{
+    ib_field_t *f;
+    ib_num_t n;
+
+    ASSERT_EQ(IB_OK, ib_data_get(ib_tx->data, "pf_nocase", &f));
+    ASSERT_EQ(IB_FTYPE_NUM, f->type);
+    ib_field_value(f, ib_ftype_num_out(&n));
+    ASSERT_EQ(1, n);
+
+    ASSERT_EQ(IB_OK, ib_data_get(ib_tx->data, "pf_hit", &f));
+    ASSERT_EQ(IB_FTYPE_NUM, f->type);
+    ib_field_value(f, ib_ftype_num_out(&n));
+    ASSERT_EQ(1, n);
+
+    ASSERT_EQ(IB_OK, ib_data_get(ib_tx->data, "pf_none", &f));
+    ASSERT_EQ(IB_FTYPE_NUM, f->type);
+    ib_field_value(f, ib_ftype_num_out(&n));
+    ASSERT_EQ(1, n);
+
+    ASSERT_EQ(IB_ENOENT, ib_data_get(ib_tx->data, "pf_case", &f));
+    ASSERT_EQ(IB_ENOENT, ib_data_get(ib_tx->data, "pf_skip", &f));
+
+    // Skips are counted in the rule profile.
+    ib_rule_t *rule;
+    ib_rule_profile_counters_t counters;
+
+    ASSERT_EQ(IB_OK, ib_rule_lookup(ib_engine, ib_tx->ctx, "pf_skip", &rule));
+    ASSERT_EQ(IB_OK, ib_rule_profile_get(ib_engine, rule, &counters));
+    ASSERT_LE(1U, counters.operator_skips);
+    ASSERT_EQ(0U, counters.matches);
+
+    ASSERT_EQ(IB_OK, ib_rule_lookup(ib_engine, ib_tx->ctx, "pf_none", &rule));
+    ASSERT_EQ(IB_OK, ib_rule_profile_get(ib_engine, rule, &counters));
+    ASSERT_EQ(0U, counters.operator_skips);
+}
@@ -30,8 +30,14 @@
 
 #include "gtest/gtest.h"
 #include "gtest/gtest-spi.h"
+#include "ibtest_bench.hpp"
 
+#include <algorithm>
 #include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
 
 class TestIBUtilAhoCorasick : public ::testing::Test
 {
@@ -411,8 +417,9 @@ TEST_F(TestIBUtilAhoCorasick, ib_ac_consume_multiple_common_prefix)
     );
     ASSERT_EQ(IB_OK, rc);
 
+    /* expen, pen, expensive, sive and ve */
     ASSERT_TRUE(ac_mctx.match_list);
-    ASSERT_EQ(4UL, ib_list_elements(ac_mctx.match_list));
+    ASSERT_EQ(5UL, ib_list_elements(ac_mctx.match_list));
 }
 
 /// @test Check the list of matches
@@ -547,3 +554,238 @@ TEST_F(TestIBUtilAhoCorasick, ib_ac_consume_contained_patterns)
     ASSERT_TRUE(ac_mctx.match_list != NULL);
     ASSERT_EQ(9UL, ib_list_elements(ac_mctx.match_list));
 }
+
+/// @test Check that fail transitions walk the whole fail chain
+TEST_F(TestIBUtilAhoCorasick, ib_ac_consume_deep_fail_links)
+{
+    ib_status_t rc;
+    const char *text = "xyzwq";
+    ib_ac_t *ac_tree = NULL;
+    ib_ac_context_t ac_mctx;
+    ib_ac_match_t *mt = NULL;
+
+    rc = ib_ac_create(&ac_tree, 0, m_pool);
+    ASSERT_EQ(IB_OK, rc);
+
+    rc = ib_ac_add_pattern(ac_tree, "xyzwa", callback, (void *)"xyzwa", 0);
+    ASSERT_EQ(IB_OK, rc);
+
+    rc = ib_ac_add_pattern(ac_tree, "yzt", callback, (void *)"yzt", 0);
+    ASSERT_EQ(IB_OK, rc);
+
+    rc = ib_ac_add_pattern(ac_tree, "zwq", callback, (void *)"zwq", 0);
+    ASSERT_EQ(IB_OK, rc);
+
+    rc = ib_ac_build_links(ac_tree);
+    ASSERT_EQ(IB_OK, rc);
+    ib_ac_init_ctx(&ac_mctx, ac_tree);
+
+    rc = ib_ac_consume(
+        &ac_mctx,
+        text,
+        strlen(text),
+        IB_AC_FLAG_CONSUME_DOLIST | IB_AC_FLAG_CONSUME_MATCHALL,
+        m_pool
+    );
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(ac_mctx.match_list != NULL);
+    ASSERT_EQ(1UL, ib_list_elements(ac_mctx.match_list));
+
+    rc = ib_list_dequeue(ac_mctx.match_list, (void *)&mt);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(0, strncmp(mt->pattern, "zwq", 3));
+    ASSERT_EQ(2UL, mt->offset);
+}
+
+/// @test Check outputs reached through a state that is not an output
+TEST_F(TestIBUtilAhoCorasick, ib_ac_consume_suffix_output)
+{
+    ib_status_t rc;
+    const char *text = "abcx";
+    ib_ac_t *ac_tree = NULL;
+    ib_ac_context_t ac_mctx;
+    ib_ac_match_t *mt = NULL;
+
+    rc = ib_ac_create(&ac_tree, 0, m_pool);
+    ASSERT_EQ(IB_OK, rc);
+
+    rc = ib_ac_add_pattern(ac_tree, "abcd", callback, (void *)"abcd", 0);
+    ASSERT_EQ(IB_OK, rc);
+
+    rc = ib_ac_add_pattern(ac_tree, "bc", callback, (void *)"bc", 0);
+    ASSERT_EQ(IB_OK, rc);
+
+    rc = ib_ac_build_links(ac_tree);
+    ASSERT_EQ(IB_OK, rc);
+    ib_ac_init_ctx(&ac_mctx, ac_tree);
+
+    rc = ib_ac_consume(
+        &ac_mctx,
+        text,
+        strlen(text),
+        IB_AC_FLAG_CONSUME_DOLIST | IB_AC_FLAG_CONSUME_MATCHALL,
+        m_pool
+    );
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(ac_mctx.match_list != NULL);
+    ASSERT_EQ(1UL, ib_list_elements(ac_mctx.match_list));
+
+    /* The data must belong to the pattern matched, not the branch */
+    rc = ib_list_dequeue(ac_mctx.match_list, (void *)&mt);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(0, strncmp(mt->pattern, "bc", 2));
+    ASSERT_STREQ("bc", (const char *)mt->data);
+    ASSERT_EQ(1UL, mt->offset);
+}
+
+/* -- DFA Helpers -- */
+
+/// Build a tree of @a n random lowercase patterns with @a flags.
+static ib_ac_t *random_tree(ib_mpool_t *mp, uint8_t flags, size_t n)
+{
+    ib_ac_t *ac_tree = NULL;
+    unsigned int seed = 1;
+
+    if (ib_ac_create(&ac_tree, flags, mp) != IB_OK) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < n; ++i) {
+        char pattern[16];
+        size_t len = 4 + rand_r(&seed) % 8;
+
+        for (size_t j = 0; j < len; ++j) {
+            pattern[j] = 'a' + rand_r(&seed) % 26;
+        }
+        if (ib_ac_add_pattern(ac_tree, pattern, callback, NULL, len) != IB_OK)
+        {
+            return NULL;
+        }
+    }
+
+    if (ib_ac_build_links(ac_tree) != IB_OK) {
+        return NULL;
+    }
+
+    return ac_tree;
+}
+
+/// Random text over the pattern alphabet, with some capitals.
+static std::string random_text(size_t len)
+{
+    std::string text(len, ' ');
+    unsigned int seed = 2;
+
+    for (size_t i = 0; i < len; ++i) {
+        int r = rand_r(&seed) % 60;
+        text[i] = (r < 26) ? 'a' + r : (r < 52) ? 'A' + r - 26 : ' ';
+    }
+
+    return text;
+}
+
+/// Consume @a text in chunks of @a chunk; return matches as offset/length.
+static std::vector<std::pair<size_t, size_t> > match_all(
+    ib_ac_t           *ac_tree,
+    const std::string &text,
+    size_t             chunk,
+    ib_mpool_t        *mp
+)
+{
+    std::vector<std::pair<size_t, size_t> > result;
+    ib_ac_context_t ac_mctx;
+    ib_ac_match_t *mt = NULL;
+
+    ib_ac_init_ctx(&ac_mctx, ac_tree);
+    for (size_t i = 0; i < text.size(); i += chunk) {
+        ib_ac_consume(&ac_mctx, text.data() + i,
+                      std::min(chunk, text.size() - i),
+                      IB_AC_FLAG_CONSUME_DOLIST | IB_AC_FLAG_CONSUME_MATCHALL,
+                      mp);
+    }
+    while (ac_mctx.match_list != NULL &&
+           ib_list_dequeue(ac_mctx.match_list, (void *)&mt) == IB_OK)
+    {
+        result.push_back(std::make_pair(mt->offset, mt->pattern_len));
+    }
+
+    return result;
+}
+
+/// @test The DFA reports the same matches as the trie
+TEST_F(TestIBUtilAhoCorasick, dfa_matches_trie)
+{
+    static const uint8_t flags[] = { 0, IB_AC_FLAG_PARSER_NOCASE };
+    std::string text = random_text(200000);
+
+    for (size_t i = 0; i < sizeof(flags); ++i) {
+        ib_ac_t *trie = random_tree(m_pool, flags[i], 2000);
+        ib_ac_t *dfa = random_tree(m_pool, flags[i] | IB_AC_FLAG_PARSER_DFA,
+                                   2000);
+        ASSERT_TRUE(trie != NULL);
+        ASSERT_TRUE(dfa != NULL);
+        ASSERT_TRUE(trie->dfa == NULL);
+        ASSERT_TRUE(dfa->dfa != NULL);
+
+        std::vector<std::pair<size_t, size_t> > expected =
+            match_all(trie, text, text.size(), m_pool);
+        ASSERT_FALSE(expected.empty());
+        ASSERT_TRUE(expected == match_all(dfa, text, text.size(), m_pool));
+        ASSERT_TRUE(expected == match_all(dfa, text, 7, m_pool));
+    }
+}
+
+/// @test Stop at the first match with the DFA
+TEST_F(TestIBUtilAhoCorasick, dfa_first_match)
+{
+    ib_status_t rc;
+    const char *text = "shershis";
+    ib_ac_t *ac_tree = NULL;
+    ib_ac_context_t ac_mctx;
+
+    rc = ib_ac_create(&ac_tree, IB_AC_FLAG_PARSER_DFA, m_pool);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(IB_OK, ib_ac_add_pattern(ac_tree, "he", callback, NULL, 0));
+    ASSERT_EQ(IB_OK, ib_ac_add_pattern(ac_tree, "hers", callback, NULL, 0));
+    ASSERT_EQ(IB_OK, ib_ac_build_links(ac_tree));
+    ib_ac_init_ctx(&ac_mctx, ac_tree);
+
+    rc = ib_ac_consume(&ac_mctx, text, strlen(text),
+                       IB_AC_FLAG_CONSUME_DEFAULT, m_pool);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(1UL, ac_mctx.match_cnt);
+    ASSERT_EQ(3UL, ac_mctx.processed);
+
+    /* Resumes where it stopped */
+    rc = ib_ac_consume(&ac_mctx, text + 3, strlen(text) - 3,
+                       IB_AC_FLAG_CONSUME_MATCHALL, m_pool);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(2UL, ac_mctx.match_cnt);
+
+    rc = ib_ac_consume(&ac_mctx, "xyz", 3,
+                       IB_AC_FLAG_CONSUME_MATCHALL, m_pool);
+    ASSERT_EQ(IB_ENOENT, rc);
+}
+
+/// @test Benchmark: throughput of the trie and the DFA
+TEST_F(TestIBUtilAhoCorasick, DISABLED_bench_dfa)
+{
+    static const uint8_t flags[] = { 0, IB_AC_FLAG_PARSER_DFA };
+    static const char *names[] = { "trie_mb_per_sec", "dfa_mb_per_sec" };
+    std::string text = random_text(1 << 18);
+
+    for (size_t i = 0; i < sizeof(flags); ++i) {
+        ib_ac_t *ac_tree = random_tree(m_pool,
+                                       IB_AC_FLAG_PARSER_NOCASE | flags[i],
+                                       50000);
+        ib_ac_context_t ac_mctx;
+
+        ASSERT_TRUE(ac_tree != NULL);
+        ib_ac_init_ctx(&ac_mctx, ac_tree);
+
+        BenchTimer timer;
+        ib_ac_consume(&ac_mctx, text.data(), text.size(),
+                      IB_AC_FLAG_CONSUME_MATCHALL, m_pool);
+        BenchRecord(names[i], text.size() / timer.Usec());
+    }
+}
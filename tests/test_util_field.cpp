@@ -28,11 +28,13 @@
 #include "gtest/gtest.h"
 #include "gtest/gtest-spi.h"
 #include "simple_fixture.hpp"
+#include "ibtest_bench.hpp"
 
 #include <ironbee/field.h>
 #include <ironbee/util.h>
 #include <ironbee/mpool.h>
 #include <ironbee/bytestr.h>
+#include <ironbee/list.h>
 
 #include <stdexcept>
 
@@ -531,3 +533,311 @@ TEST_F(TestIBUtilField, AliasBytestr)
     ASSERT_EQ(0, memcmp(s2,
                         ib_bytestr_const_ptr(obs), ib_bytestr_length(obs)) );
 }
+
+TEST_F(TestIBUtilField, InlineValue)
+{
+    ib_field_t *f;
+    ib_bytestr_t *bs;
+    ib_bytestr_t *mbs;
+    const ib_bytestr_t *obs;
+    char nulstr[] = "hello";
+    const char *os;
+    ib_status_t rc;
+
+    /* Inline byte string values are copies of the source. */
+    rc = ib_bytestr_dup_nulstr(&bs, MemPool(), "foo");
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_field_create(&f, MemPool(), IB_FIELD_NAME("foo"),
+                         IB_FTYPE_BYTESTR, ib_ftype_bytestr_in(bs));
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(std::string("foo"), std::string(f->name, f->nlen));
+    ib_bytestr_ptr(bs)[0] = 'b';
+    rc = ib_field_value(f, ib_ftype_bytestr_out(&obs));
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(std::string("foo"),
+              std::string((const char *)ib_bytestr_const_ptr(obs),
+                          ib_bytestr_length(obs)));
+
+    /* And can grow. */
+    rc = ib_field_mutable_value(f, ib_ftype_bytestr_mutable_out(&mbs));
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_bytestr_append_nulstr(mbs, "bar");
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(std::string("foobar"),
+              std::string((const char *)ib_bytestr_const_ptr(mbs),
+                          ib_bytestr_length(mbs)));
+
+    rc = ib_field_create(&f, MemPool(), IB_FIELD_NAME("nul"),
+                         IB_FTYPE_NULSTR, ib_ftype_nulstr_in(nulstr));
+    ASSERT_EQ(IB_OK, rc);
+    nulstr[0] = 'j';
+    rc = ib_field_value(f, ib_ftype_nulstr_out(&os));
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(std::string("hello"), std::string(os));
+
+    /* Inline aliases are read only. */
+    rc = ib_field_create_bytestr_alias(&f, MemPool(), IB_FIELD_NAME("alias"),
+                                       (uint8_t *)nulstr, 5);
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_field_mutable_value(f, ib_ftype_bytestr_mutable_out(&mbs));
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(ib_bytestr_ptr(mbs) == NULL);
+    ASSERT_EQ(std::string("jello"),
+              std::string((const char *)ib_bytestr_const_ptr(mbs),
+                          ib_bytestr_length(mbs)));
+}
+
+TEST_F(TestIBUtilField, Version)
+{
+    ib_field_t *f;
+    ib_bytestr_t *bs;
+    const ib_bytestr_t *obs;
+    ib_status_t rc;
+    size_t version;
+
+    rc = ib_bytestr_dup_nulstr(&bs, MemPool(), "foo");
+    ASSERT_EQ(IB_OK, rc);
+    rc = ib_field_create(&f, MemPool(), IB_FIELD_NAME("foo"),
+                         IB_FTYPE_BYTESTR, ib_ftype_bytestr_in(bs));
+    ASSERT_EQ(IB_OK, rc);
+
+    /* Reading does not change the version. */
+    version = ib_field_version(f);
+    rc = ib_field_value(f, ib_ftype_bytestr_out(&obs));
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_EQ(version, ib_field_version(f));
+
+    rc = ib_field_setv(f, ib_ftype_bytestr_in(bs));
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_NE(version, ib_field_version(f));
+
+    version = ib_field_version(f);
+    rc = ib_field_mutable_value(f, ib_ftype_bytestr_mutable_out(&bs));
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_NE(version, ib_field_version(f));
+}
+
+TEST_F(TestIBUtilField, ListSubfields)
+{
+    ib_field_t *f;
+    ib_field_t *member;
+    ib_list_t *list;
+    const ib_list_t *rlist;
+    ib_num_t n = 1;
+    char name[16];
+
+    ASSERT_EQ(IB_OK, ib_list_create(&list, MemPool()));
+    ASSERT_EQ(IB_OK, ib_field_create(&f, MemPool(), IB_FIELD_NAME("ARGS"),
+                                     IB_FTYPE_LIST, list));
+
+    /* Scanned below IB_FIELD_LIST_INDEX_MIN; indexed above. */
+    for (int i = 0; i < 2 * IB_FIELD_LIST_INDEX_MIN; ++i) {
+        snprintf(name, sizeof(name), "a%d", i % 4);
+        ASSERT_EQ(IB_OK, ib_field_create(&member, MemPool(),
+                                         IB_FIELD_NAME(name),
+                                         IB_FTYPE_NUM, ib_ftype_num_in(&n)));
+        ASSERT_EQ(IB_OK, ib_list_push(list, member));
+
+        ASSERT_EQ(IB_OK, ib_field_list_subfields(f, IB_FIELD_NAME("A1"),
+                                                 &rlist));
+        EXPECT_EQ((i + 3) / 4, (int)ib_list_elements(rlist));
+    }
+
+    ASSERT_EQ(IB_OK, ib_field_list_subfields(f, IB_FIELD_NAME("missing"),
+                                             &rlist));
+    EXPECT_EQ(0U, ib_list_elements(rlist));
+
+    ASSERT_EQ(IB_OK, ib_field_create(&member, MemPool(), IB_FIELD_NAME("x"),
+                                     IB_FTYPE_NUM, ib_ftype_num_in(&n)));
+    EXPECT_EQ(IB_EINVAL, ib_field_list_subfields(member, IB_FIELD_NAME("x"),
+                                                 &rlist));
+}
+
+TEST_F(TestIBUtilField, ListSubfieldsAppend)
+{
+    ib_field_t *f;
+    ib_field_t *member;
+    const ib_list_t *first;
+    ib_list_t *list;
+    const ib_list_t *rlist;
+    ib_num_t n = 1;
+    char name[16];
+
+    ASSERT_EQ(IB_OK, ib_list_create(&list, MemPool()));
+    ASSERT_EQ(IB_OK, ib_field_create(&f, MemPool(), IB_FIELD_NAME("ARGS"),
+                                     IB_FTYPE_LIST, list));
+
+    for (int i = 0; i < 4 * IB_FIELD_LIST_INDEX_MIN; ++i) {
+        snprintf(name, sizeof(name), "A%d", i % 4);
+        ASSERT_EQ(IB_OK, ib_field_create(&member, MemPool(),
+                                         IB_FIELD_NAME(name),
+                                         IB_FTYPE_NUM, ib_ftype_num_in(&n)));
+
+        /* Appends through the field extend the index, direct pushes
+         * force a rebuild. */
+        if (i % 5 == 0) {
+            ASSERT_EQ(IB_OK, ib_list_push(list, member));
+        }
+        else {
+            ASSERT_EQ(IB_OK, ib_field_list_add(f, member));
+        }
+
+        ASSERT_EQ(IB_OK, ib_field_list_subfields(f, IB_FIELD_NAME("a2"),
+                                                 &rlist));
+        EXPECT_EQ((i + 2) / 4, (int)ib_list_elements(rlist));
+    }
+
+    /* A result served from the index sees later appends. */
+    ASSERT_EQ(IB_OK, ib_field_list_subfields(f, IB_FIELD_NAME("a3"), &first));
+    ASSERT_EQ(IB_OK, ib_field_create(&member, MemPool(), IB_FIELD_NAME("a3"),
+                                     IB_FTYPE_NUM, ib_ftype_num_in(&n)));
+    ASSERT_EQ(IB_OK, ib_field_list_add(f, member));
+    ASSERT_EQ(IB_OK, ib_field_list_subfields(f, IB_FIELD_NAME("A3"), &rlist));
+    EXPECT_EQ(first, rlist);
+    EXPECT_EQ(IB_FIELD_LIST_INDEX_MIN + 1, (int)ib_list_elements(rlist));
+    EXPECT_EQ(member, ib_list_node_data_const(ib_list_last_const(rlist)));
+}
+
+TEST_F(TestIBUtilField, ListSubfieldsReplace)
+{
+    ib_field_t *f;
+    ib_field_t *member;
+    ib_list_t *list;
+    ib_list_node_t *node;
+    const ib_list_t *rlist;
+    ib_num_t n = 1;
+    char name[16];
+
+    ASSERT_EQ(IB_OK, ib_list_create(&list, MemPool()));
+    ASSERT_EQ(IB_OK, ib_field_create(&f, MemPool(), IB_FIELD_NAME("ARGS"),
+                                     IB_FTYPE_LIST, list));
+    for (int i = 0; i < 2 * IB_FIELD_LIST_INDEX_MIN; ++i) {
+        snprintf(name, sizeof(name), "a%d", i % 2);
+        ASSERT_EQ(IB_OK, ib_field_create(&member, MemPool(),
+                                         IB_FIELD_NAME(name),
+                                         IB_FTYPE_NUM, ib_ftype_num_in(&n)));
+        ASSERT_EQ(IB_OK, ib_field_list_add(f, member));
+    }
+    ASSERT_EQ(IB_OK, ib_field_list_subfields(f, IB_FIELD_NAME("b"), &rlist));
+    EXPECT_EQ(0U, ib_list_elements(rlist));
+
+    /* Replacing a member in place keeps the size and tail of the list, but
+     * changes the field's version, so the index is rebuilt. */
+    ASSERT_EQ(IB_OK, ib_field_create(&member, MemPool(), IB_FIELD_NAME("b"),
+                                     IB_FTYPE_NUM, ib_ftype_num_in(&n)));
+    ASSERT_EQ(IB_OK, ib_field_mutable_value(f,
+                                            ib_ftype_list_mutable_out(&list)));
+    node = ib_list_first(list);
+    node->data = member;
+
+    ASSERT_EQ(IB_OK, ib_field_list_subfields(f, IB_FIELD_NAME("b"), &rlist));
+    EXPECT_EQ(1U, ib_list_elements(rlist));
+    ASSERT_EQ(IB_OK, ib_field_list_subfields(f, IB_FIELD_NAME("a0"), &rlist));
+    EXPECT_EQ(IB_FIELD_LIST_INDEX_MIN - 1, (int)ib_list_elements(rlist));
+}
+
+TEST_F(TestIBUtilField, ListView)
+{
+    ib_field_t *view;
+    ib_field_t *copy;
+    ib_field_t *member;
+    ib_list_t *list;
+    ib_list_t *mlist;
+    const ib_list_t *rlist;
+    ib_num_t n = 1;
+
+    ASSERT_EQ(IB_OK, ib_list_create(&list, MemPool()));
+    ASSERT_EQ(IB_OK, ib_field_create(&member, MemPool(), IB_FIELD_NAME("a"),
+                                     IB_FTYPE_NUM, ib_ftype_num_in(&n)));
+    ASSERT_EQ(IB_OK, ib_list_push(list, member));
+
+    ASSERT_EQ(IB_OK, ib_field_create_list_view(&view, MemPool(),
+                                               IB_FIELD_NAME("ARGS"), list));
+    ASSERT_EQ(IB_OK, ib_field_value(view, ib_ftype_list_out(&rlist)));
+    EXPECT_EQ(list, rlist);
+    ASSERT_EQ(IB_OK, ib_field_copy(&copy, MemPool(), IB_FIELD_NAME("ARGS"),
+                                   view));
+
+    /* Modifying the view copies the shared list first. */
+    ASSERT_EQ(IB_OK, ib_field_list_add(view, member));
+    ASSERT_EQ(IB_OK, ib_field_value(view, ib_ftype_list_out(&rlist)));
+    EXPECT_NE(list, rlist);
+    EXPECT_EQ(2U, ib_list_elements(rlist));
+    EXPECT_EQ(1U, ib_list_elements(list));
+
+    /* So does modifying a copy of the view. */
+    ASSERT_EQ(IB_OK, ib_field_mutable_value(copy,
+                                            ib_ftype_list_mutable_out(&mlist)));
+    EXPECT_NE(list, mlist);
+    ASSERT_EQ(IB_OK, ib_list_push(mlist, member));
+    EXPECT_EQ(1U, ib_list_elements(list));
+}
+
+/* Field creation cost, per kind of value. */
+TEST_F(TestIBUtilField, DISABLED_bench_create)
+{
+    static const int iterations = 1000000;
+    static const int per_clear = 10000;
+    ib_field_t *f;
+    ib_bytestr_t *bs;
+    ib_num_t n = 5;
+    size_t inuse;
+
+    ASSERT_EQ(IB_OK, ib_bytestr_dup_nulstr(&bs, MemPool(),
+                                           "Mozilla/5.0 (X11; Linux x86_64)"));
+
+    for (int kind = 0; kind < 4; ++kind) {
+        ib_mpool_t *mp;
+        BenchTimer timer;
+        double usec = 0;
+        const char *label = NULL;
+
+        ASSERT_EQ(IB_OK, ib_mpool_create(&mp, "bench", MemPool()));
+
+        for (int i = 0; i < iterations; ++i) {
+            ib_status_t rc = IB_OK;
+
+            if (i % per_clear == 0) {
+                if (i > 0) {
+                    usec += timer.Usec();
+                }
+                inuse = ib_mpool_inuse(mp);
+                ib_mpool_clear(mp);
+                timer.Start();
+            }
+            switch (kind) {
+            case 0:
+                label = "bytestr";
+                rc = ib_field_create(&f, mp, IB_FIELD_NAME("User-Agent"),
+                                     IB_FTYPE_BYTESTR,
+                                     ib_ftype_bytestr_in(bs));
+                break;
+            case 1:
+                label = "bytestr_alias";
+                rc = ib_field_create_bytestr_alias(
+                    &f, mp, IB_FIELD_NAME("ARGS:a"),
+                    (uint8_t *)"value", 5);
+                break;
+            case 2:
+                label = "nulstr";
+                rc = ib_field_create(&f, mp, IB_FIELD_NAME("name"),
+                                     IB_FTYPE_NULSTR,
+                                     ib_ftype_nulstr_in("value"));
+                break;
+            default:
+                label = "num";
+                rc = ib_field_create(&f, mp, IB_FIELD_NAME("name"),
+                                     IB_FTYPE_NUM, ib_ftype_num_in(&n));
+                break;
+            }
+            ASSERT_EQ(IB_OK, rc);
+        }
+        usec += timer.Usec();
+
+        BenchRecord(std::string(label) + "_ns_per_field",
+                    usec * 1000 / iterations);
+        BenchRecord(std::string(label) + "_bytes_per_field",
+                    (double)inuse / per_clear);
+        ib_mpool_destroy(mp);
+    }
+}
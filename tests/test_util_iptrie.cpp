@@ -0,0 +1,335 @@
+//////////////////////////////////////////////////////////////////////////////
+// Licensed to Qualys, Inc. (QUALYS) under one or more
+// contributor license agreements.  See the NOTICE file distributed with
+// this work for additional information regarding copyright ownership.
+// QUALYS licenses this file to You under the Apache License, Version 2.0
+// (the "License"); you may not use this file except in compliance with
+// the License.  You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//////////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////////
+/// @file
+/// @brief IronBee --- IP Trie tests
+//////////////////////////////////////////////////////////////////////////////
+
+#include "ironbee_config_auto.h"
+#include "gtest/gtest.h"
+#include "simple_fixture.hpp"
+
+#include <ironbee/iptrie.h>
+
+#include <string>
+#include <vector>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#ifdef __clang__
+#pragma clang diagnostic push
+#pragma clang diagnostic ignored "-Wdelete-non-virtual-dtor"
+#endif
+#include <boost/random.hpp>
+#ifdef __clang__
+#pragma clang diagnostic pop
+#endif
+
+using namespace std;
+
+class TestIPTrie : public SimpleFixture
+{
+protected:
+    /** Chose a random integer uniformly from [@a min, @a max]. */
+    uint32_t random(uint32_t min, uint32_t max)
+    {
+        static boost::random::mt19937 rng;
+        return boost::random::uniform_int_distribution<uint32_t>(min, max)(rng);
+    }
+
+    /** Construct v4 IP from 4 bytes. */
+    static ib_ip4_t ip4(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+    {
+        return (a << 24) + (b << 16) + (c << 8) + d;
+    }
+
+    /** Construct v4 network from 4 bytes and number of bits. */
+    static ib_ip4_network_t net4(
+        uint8_t a, uint8_t b, uint8_t c, uint8_t d, uint8_t bits
+    )
+    {
+        ib_ip4_network_t result;
+        result.ip = ip4(a, b, c, d);
+        result.size = bits;
+        return result;
+    }
+
+    /** Is @a ip in @a net? */
+    static bool contains4(const ib_ip4_network_t& net, ib_ip4_t ip)
+    {
+        return net.size == 0 || ((net.ip ^ ip) >> (32 - net.size)) == 0;
+    }
+
+    /** Is @a ip in @a net? */
+    static bool contains6(const ib_ip6_network_t& net, const ib_ip6_t& ip)
+    {
+        for (int i = 0; i < 4; ++i) {
+            int bits = net.size - 32 * i;
+            if (bits <= 0) {
+                return true;
+            }
+            if (bits < 32) {
+                return ((net.ip.ip[i] ^ ip.ip[i]) >> (32 - bits)) == 0;
+            }
+            if (net.ip.ip[i] != ip.ip[i]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /** Write @a contents to a temporary file and return its name. */
+    string write_file(const string& contents)
+    {
+        char path[] = "/tmp/test_util_iptrie.XXXXXX";
+        int fd = mkstemp(path);
+        if (fd < 0) {
+            throw runtime_error("Could not create temporary file.");
+        }
+        if (write(fd, contents.data(), contents.length()) !=
+            ssize_t(contents.length()))
+        {
+            close(fd);
+            throw runtime_error("Could not write temporary file.");
+        }
+        close(fd);
+        m_files.push_back(path);
+        return path;
+    }
+
+    virtual void TearDown()
+    {
+        for (size_t i = 0; i < m_files.size(); ++i) {
+            unlink(m_files[i].c_str());
+        }
+        SimpleFixture::TearDown();
+    }
+
+    vector<string> m_files;
+};
+
+TEST_F(TestIPTrie, Empty)
+{
+    ib_iptrie_t *trie;
+    ib_ip6_t     ip6 = {{0, 0, 0, 0}};
+
+    ASSERT_EQ(IB_OK, ib_iptrie_create(&trie, MemPool(), NULL, 0, NULL, 0));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(1, 2, 3, 4)));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query6(trie, &ip6));
+    EXPECT_EQ(0UL, ib_iptrie_memory_size(trie));
+}
+
+TEST_F(TestIPTrie, Simple4)
+{
+    ib_iptrie_t      *trie;
+    ib_ip4_network_t  nets[] = {
+        net4(192, 168, 1, 1, 32),
+        net4(10, 0, 0, 0, 8),
+        net4(172, 16, 0, 0, 12),
+        net4(1, 2, 3, 128, 25),
+        net4(10, 1, 2, 3, 32)     // Covered by 10/8.
+    };
+
+    ASSERT_EQ(IB_OK, ib_iptrie_create(
+        &trie, MemPool(), nets, sizeof(nets) / sizeof(*nets), NULL, 0
+    ));
+
+    EXPECT_EQ(IB_OK,     ib_iptrie_query4(trie, ip4(192, 168, 1, 1)));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(192, 168, 1, 2)));
+    EXPECT_EQ(IB_OK,     ib_iptrie_query4(trie, ip4(10, 255, 0, 1)));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(11, 0, 0, 0)));
+    EXPECT_EQ(IB_OK,     ib_iptrie_query4(trie, ip4(172, 31, 255, 255)));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(172, 32, 0, 0)));
+    EXPECT_EQ(IB_OK,     ib_iptrie_query4(trie, ip4(1, 2, 3, 200)));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(1, 2, 3, 127)));
+
+    // Root table plus nodes for 192.168, 192.168.1, 1.2 and 1.2.3, which
+    // together are smaller than one uncompressed table of 256 entries.
+    EXPECT_LT(65536 * sizeof(uint32_t), ib_iptrie_memory_size(trie));
+    EXPECT_GT((65536 + 256) * sizeof(uint32_t), ib_iptrie_memory_size(trie));
+}
+
+TEST_F(TestIPTrie, EdgeBytes4)
+{
+    ib_iptrie_t      *trie;
+    ib_ip4_network_t  nets[] = {
+        net4(1, 255, 255, 255, 32),
+        net4(1, 255, 0, 0, 32),
+        net4(1, 0, 255, 255, 32),
+        net4(1, 0, 0, 0, 32),
+        net4(1, 63, 64, 0, 32),
+        net4(1, 64, 63, 0, 32)
+    };
+
+    // Nodes with children on word boundaries and at 255 exercise counting
+    // all 256 child bits.
+    ASSERT_EQ(IB_OK, ib_iptrie_create(
+        &trie, MemPool(), nets, sizeof(nets) / sizeof(*nets), NULL, 0
+    ));
+
+    for (size_t i = 0; i < sizeof(nets) / sizeof(*nets); ++i) {
+        EXPECT_EQ(IB_OK, ib_iptrie_query4(trie, nets[i].ip));
+    }
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(1, 255, 255, 254)));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(1, 255, 0, 1)));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(1, 0, 0, 255)));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(1, 64, 64, 0)));
+}
+
+TEST_F(TestIPTrie, Random4)
+{
+    vector<ib_ip4_network_t> nets;
+    ib_iptrie_t *trie;
+
+    for (int i = 0; i < 2000; ++i) {
+        ib_ip4_network_t net;
+        // Few leading values so that networks overlap.
+        net.ip = (random(0, 3) << 30) | random(0, 0x3fffffff);
+        net.size = random(2, 32);
+        nets.push_back(net);
+    }
+    vector<ib_ip4_network_t> copy(nets);
+
+    ASSERT_EQ(IB_OK, ib_iptrie_create(
+        &trie, MemPool(), &copy[0], copy.size(), NULL, 0
+    ));
+
+    for (int i = 0; i < 20000; ++i) {
+        ib_ip4_t ip;
+        if (i % 2 == 0) {
+            // Near a network.
+            ip = nets[random(0, nets.size() - 1)].ip ^ random(0, 0xffff);
+        }
+        else {
+            ip = random(0, 0xffffffff);
+        }
+
+        bool expected = false;
+        for (size_t j = 0; j < nets.size() && ! expected; ++j) {
+            expected = contains4(nets[j], ip);
+        }
+        EXPECT_EQ(expected ? IB_OK : IB_ENOENT, ib_iptrie_query4(trie, ip))
+            << "ip = " << hex << ip;
+    }
+}
+
+TEST_F(TestIPTrie, Random6)
+{
+    vector<ib_ip6_network_t> nets;
+    ib_iptrie_t *trie;
+
+    for (int i = 0; i < 1000; ++i) {
+        ib_ip6_network_t net;
+        net.ip.ip[0] = 0x20010000 | random(0, 3);
+        for (int j = 1; j < 4; ++j) {
+            net.ip.ip[j] = random(0, 0xffffffff);
+        }
+        net.size = random(16, 128);
+        nets.push_back(net);
+    }
+    vector<ib_ip6_network_t> copy(nets);
+
+    ASSERT_EQ(IB_OK, ib_iptrie_create(
+        &trie, MemPool(), NULL, 0, &copy[0], copy.size()
+    ));
+
+    for (int i = 0; i < 10000; ++i) {
+        ib_ip6_t ip = nets[random(0, nets.size() - 1)].ip;
+        // Perturb one word so some queries fall outside of the network.
+        ip.ip[random(0, 3)] ^= random(0, 0xffffffff) >> random(0, 31);
+
+        bool expected = false;
+        for (size_t j = 0; j < nets.size() && ! expected; ++j) {
+            expected = contains6(nets[j], ip);
+        }
+        EXPECT_EQ(expected ? IB_OK : IB_ENOENT, ib_iptrie_query6(trie, &ip));
+    }
+}
+
+TEST_F(TestIPTrie, Inval)
+{
+    ib_iptrie_t      *trie;
+    ib_ip4_network_t  net = net4(1, 2, 3, 4, 33);
+
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_create(
+        &trie, MemPool(), &net, 1, NULL, 0
+    ));
+}
+
+TEST_F(TestIPTrie, File)
+{
+    ib_iptrie_t *trie;
+    ib_ip6_t     ip6;
+    size_t       line = 0;
+
+    string path = write_file(
+        "# Reputation list\n"
+        "\n"
+        "  10.0.0.0/8\n"
+        "192.168.1.1   # host\n"
+        "2001:db8::/32\n"
+        "\t::1\n"
+        "1.2.3.4"
+    );
+
+    ASSERT_EQ(IB_OK, ib_iptrie_create_from_file(
+        &trie, MemPool(), path.c_str(), &line
+    ));
+
+    EXPECT_EQ(IB_OK,     ib_iptrie_query4(trie, ip4(10, 20, 30, 40)));
+    EXPECT_EQ(IB_OK,     ib_iptrie_query4(trie, ip4(192, 168, 1, 1)));
+    EXPECT_EQ(IB_OK,     ib_iptrie_query4(trie, ip4(1, 2, 3, 4)));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(1, 2, 3, 5)));
+
+    ASSERT_EQ(IB_OK, ib_ip6_str_to_ip("2001:db8:1::1", &ip6));
+    EXPECT_EQ(IB_OK, ib_iptrie_query6(trie, &ip6));
+    ASSERT_EQ(IB_OK, ib_ip6_str_to_ip("::1", &ip6));
+    EXPECT_EQ(IB_OK, ib_iptrie_query6(trie, &ip6));
+    ASSERT_EQ(IB_OK, ib_ip6_str_to_ip("::2", &ip6));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query6(trie, &ip6));
+}
+
+TEST_F(TestIPTrie, FileErrors)
+{
+    ib_iptrie_t *trie;
+    size_t       line = 0;
+
+    string path = write_file("1.2.3.4\n\n1.2.3.256\n");
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_create_from_file(
+        &trie, MemPool(), path.c_str(), &line
+    ));
+    EXPECT_EQ(3UL, line);
+
+    path = write_file("2001:db8::/129\n");
+    EXPECT_EQ(IB_EINVAL, ib_iptrie_create_from_file(
+        &trie, MemPool(), path.c_str(), &line
+    ));
+    EXPECT_EQ(1UL, line);
+
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_create_from_file(
+        &trie, MemPool(), "/nonexistent/iptrie", NULL
+    ));
+
+    path = write_file("");
+    ASSERT_EQ(IB_OK, ib_iptrie_create_from_file(
+        &trie, MemPool(), path.c_str(), NULL
+    ));
+    EXPECT_EQ(IB_ENOENT, ib_iptrie_query4(trie, ip4(1, 2, 3, 4)));
+}
@@ -839,3 +839,44 @@ TEST(TestMpool, ReleaseComplex)
     ASSERT_EQ(g_malloc_calls, g_free_calls);
     ASSERT_EQ(g_malloc_bytes, g_free_bytes);
 }
+
+TEST(TestMpool, Recycled)
+{
+    ib_mpool_t* mp = NULL;
+    ib_status_t rc = ib_mpool_create(&mp, "recycled", NULL);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(mp);
+
+    ib_mpool_recycle_stats_t before;
+    ib_mpool_recycle_stats(&before);
+
+    ib_mpool_t* child = NULL;
+    rc = ib_mpool_create_recycled(&child, "recycled_child", mp);
+    EXPECT_VALID(child);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(child);
+
+    void* p = ib_mpool_alloc(child, 100);
+    EXPECT_TRUE(p);
+
+    ib_mpool_release(child);
+    EXPECT_VALID(mp);
+
+    rc = ib_mpool_create_recycled(&child, "recycled_child2", mp);
+    EXPECT_VALID(child);
+    ASSERT_EQ(IB_OK, rc);
+    ASSERT_TRUE(child);
+    EXPECT_EQ("recycled_child2", string(ib_mpool_name(child)));
+
+    p = ib_mpool_alloc(child, 100);
+    EXPECT_TRUE(p);
+    EXPECT_VALID(mp);
+
+    ib_mpool_recycle_stats_t after;
+    ib_mpool_recycle_stats(&after);
+    EXPECT_EQ(before.pool_hits + 1, after.pool_hits);
+    EXPECT_EQ(before.page_hits + 1, after.page_hits);
+
+    ib_mpool_release(child);
+    ib_mpool_destroy(mp);
+}
@@ -28,7 +28,13 @@
 
 #include "gtest/gtest.h"
 #include "gtest/gtest-spi.h"
+#include "ibtest_bench.hpp"
 
+#include <set>
+#include <sstream>
+#include <string>
+
+#include <pthread.h>
 #include <string.h>
 
 namespace OSSPUUID {
@@ -124,3 +130,93 @@ TEST(TestIBUtilUUID, random)
     free(str);
     ib_uuid_shutdown();
 }
+
+TEST(TestIBUtilUUID, version)
+{
+    std::set<std::string> seen;
+    ib_uuid_t uuid;
+
+    ib_uuid_initialize();
+
+    for (int i = 0; i < 10000; ++i) {
+        ASSERT_EQ(IB_OK, ib_uuid_create_v4(&uuid));
+        ASSERT_EQ(0x40, uuid.byte[6] & 0xf0);
+        ASSERT_EQ(0x80, uuid.byte[8] & 0xc0);
+        ASSERT_TRUE(seen.insert(
+            std::string(reinterpret_cast<char *>(uuid.byte), 16)).second);
+    }
+
+    ib_uuid_shutdown();
+}
+
+/// Arguments of uuid_thread().
+struct uuid_thread_arg {
+    int       count; /**< Number of UUIDs to create. */
+    ib_uuid_t last;  /**< Last UUID created. */
+};
+
+/// Thread body: create UUIDs; returns non-NULL on error.
+static void *uuid_thread(void *arg)
+{
+    uuid_thread_arg *targ = static_cast<uuid_thread_arg *>(arg);
+
+    for (int i = 0; i < targ->count; ++i) {
+        if (ib_uuid_create_v4(&targ->last) != IB_OK) {
+            return targ;
+        }
+    }
+    return NULL;
+}
+
+/// Run @a nthreads threads creating @a count UUIDs each.
+static void uuid_run_threads(int nthreads, int count)
+{
+    const int max_threads = 8;
+    pthread_t handles[max_threads];
+    uuid_thread_arg args[max_threads];
+
+    ASSERT_LE(nthreads, max_threads);
+    for (int i = 0; i < nthreads; ++i) {
+        args[i].count = count;
+        ASSERT_EQ(0, pthread_create(&handles[i], NULL,
+                                    uuid_thread, &args[i]));
+    }
+    for (int i = 0; i < nthreads; ++i) {
+        void *result;
+        ASSERT_EQ(0, pthread_join(handles[i], &result));
+        ASSERT_TRUE(result == NULL);
+    }
+
+    /* Threads must not share a sequence. */
+    for (int i = 1; i < nthreads; ++i) {
+        ASSERT_NE(0, memcmp(&args[0].last, &args[i].last, sizeof(ib_uuid_t)));
+    }
+}
+
+/// @test Concurrent ib_uuid_create_v4() calls.
+TEST(TestIBUtilUUID, threads)
+{
+    ib_uuid_initialize();
+    uuid_run_threads(4, 1000);
+    ib_uuid_shutdown();
+}
+
+/// @test Benchmark: throughput of ib_uuid_create_v4() by thread count.
+TEST(TestIBUtilUUID, DISABLED_bench_threads)
+{
+    const int count = 200000;
+
+    ib_uuid_initialize();
+
+    for (int nthreads = 1; nthreads <= 8; nthreads *= 2) {
+        std::ostringstream key;
+        BenchTimer timer;
+
+        uuid_run_threads(nthreads, count);
+
+        key << "ids_per_sec_" << nthreads << "_threads";
+        BenchRecord(key.str(), nthreads * count / (timer.Usec() / 1e6));
+    }
+
+    ib_uuid_shutdown();
+}
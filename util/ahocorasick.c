@@ -285,32 +285,36 @@ static void ib_ac_unlink_unuseful(ib_ac_t *ac_tree,
          child != NULL;
          child = child->sibling)
     {
-        if (child->fail == NULL ||
-            child->fail->child == NULL ||
-            child->child == NULL)
-        {
+        if (child->child == NULL) {
             continue;
         }
 
-        for (fail_state = child->fail->child;
-             fail_state != ac_tree->root && fail_state != NULL;
-             fail_state = fail_state->sibling)
+        while (child->fail != NULL &&
+               child->fail != ac_tree->root &&
+               child->fail->child != NULL)
         {
-            found = ib_ac_child_for_code(child, fail_state->letter);
+            found = NULL;
+            for (fail_state = child->fail->child;
+                 fail_state != NULL;
+                 fail_state = fail_state->sibling)
+            {
+                found = ib_ac_child_for_code(child, fail_state->letter);
+                if (found == NULL) {
+                    break;
+                }
+            }
+
             if (found == NULL) {
                 break;
             }
-        }
 
-        if (found != NULL) {
             /* There's no transition in the fail state that will
              * success, since the fail state doesn't have any letter not
-             * present at the goto() of the main state. So let's
-             * change the fail state to parent. Consider that this is
-             * different to the output links (they'll still valid) */
-             child->fail = ac_tree->root;
-
-             /* printf("Removing invalid fails\n"); */
+             * present at the goto() of the main state. So let's skip
+             * to the next fail state in the chain. Going straight to
+             * root would lose matches that start further back. Output
+             * links are already resolved and stay valid */
+            child->fail = child->fail->fail;
         }
     }
 
@@ -483,6 +487,7 @@ static ib_status_t ib_ac_link_fail_states(ib_ac_t *ac_tree)
     ib_ac_state_t *child = NULL;
     ib_ac_state_t *state = NULL;
     ib_ac_state_t *goto_state = NULL;
+    ib_ac_state_t *fail_state = NULL;
 
     ib_list_t *iter_queue = NULL;
 
@@ -520,10 +525,22 @@ static ib_status_t ib_ac_link_fail_states(ib_ac_t *ac_tree)
         state->fail = ac_tree->root;
 
         if (state->parent != ac_tree->root) {
-            goto_state = ib_ac_child_for_code(state->parent->fail,
-                                             state->letter);
-            if (goto_state != NULL) {
-                state->fail = goto_state;
+            /* Walk the fail chain of the parent until a state with a
+             * transition for this letter is found (or root is reached) */
+            for (fail_state = state->parent->fail;
+                 fail_state != NULL;
+                 fail_state = fail_state->fail)
+            {
+                goto_state = ib_ac_child_for_code(fail_state,
+                                                  state->letter);
+                if (goto_state != NULL && goto_state != state) {
+                    state->fail = goto_state;
+                    break;
+                }
+
+                if (fail_state == ac_tree->root) {
+                    break;
+                }
             }
         }
 
@@ -586,6 +603,237 @@ static inline ib_ac_state_t *ib_ac_bintree_goto(ib_ac_state_t *state,
     return NULL;
 }
 
+/**
+ * Count the states of the branch starting at the given state
+ *
+ * @param state the state where it should start (it's used recursively)
+ *
+ * @return number of states
+ */
+static size_t ib_ac_count_states(ib_ac_state_t *state)
+{
+    ib_ac_state_t *child = NULL;
+    size_t count = 1;
+
+    for (child = state->child;
+         child != NULL;
+         child = child->sibling)
+    {
+        count += ib_ac_count_states(child);
+    }
+
+    return count;
+}
+
+/**
+ * Returns the state of the flat transition table at the given offset
+ *
+ * @param dfa the flat transition table
+ * @param offset offset of the state
+ *
+ * @return the state
+ */
+static inline ib_ac_dfa_state_t *ib_ac_dfa_state(const ib_ac_dfa_t *dfa,
+                                                 uint32_t offset)
+{
+    return (ib_ac_dfa_state_t *)&dfa->table[offset];
+}
+
+/**
+ * Returns the state of the flat transition table that results of
+ * applying the transition function to the given state and letter
+ *
+ * @param dfa the flat transition table
+ * @param offset offset of the current state
+ * @param letter the (folded) letter
+ *
+ * @return offset of the next state
+ */
+static inline uint32_t ib_ac_dfa_next(const ib_ac_dfa_t *dfa,
+                                      uint32_t offset,
+                                      uint8_t letter)
+{
+    for (;;) {
+        const ib_ac_dfa_state_t *dstate = ib_ac_dfa_state(dfa, offset);
+        uint32_t i = (uint32_t)letter - dstate->lo;
+
+        if (i < dstate->len) {
+            return dstate->row[i];
+        }
+
+        offset = dstate->fail;
+    }
+}
+
+/**
+ * Computes the letters covered by the row of a state of the flat
+ * transition table
+ *
+ * @param ac_tree the ac tree matcher
+ * @param state the trie state
+ * @param lo where to store the first letter of the row
+ * @param len where to store the number of letters in the row
+ */
+static void ib_ac_dfa_row(const ib_ac_t *ac_tree,
+                          const ib_ac_state_t *state,
+                          uint8_t *lo,
+                          uint16_t *len)
+{
+    const ib_ac_state_t *child = NULL;
+    uint8_t hi = 0;
+
+    if (state == ac_tree->root || state->parent == ac_tree->root) {
+        *lo = 0;
+        *len = 256;
+        return;
+    }
+
+    if (state->child == NULL) {
+        *lo = 0;
+        *len = 0;
+        return;
+    }
+
+    *lo = 255;
+    for (child = state->child;
+         child != NULL;
+         child = child->sibling)
+    {
+        uint8_t letter = (uint8_t)child->letter;
+
+        *lo = (letter < *lo) ? letter : *lo;
+        hi = (letter > hi) ? letter : hi;
+    }
+    *len = hi - *lo + 1;
+}
+
+/**
+ * Compiles the trie, with its fail links, into a flat transition table.
+ *
+ * States are laid out in breadth first order so that the transitions of
+ * the (shallower) fail state of a state are always known when the state
+ * is compiled.  The root and its children get full 256 letter rows, as
+ * nearly every input letter goes through them.  Deeper states get a row
+ * covering only the band of their goto() letters, and a fail link to the
+ * first state of the fail chain with a row covering other letters.
+ *
+ * @param ac_tree the ac tree matcher
+ *
+ * @return ib_status_t status of the operation
+ */
+static ib_status_t ib_ac_build_dfa(ib_ac_t *ac_tree)
+{
+    ib_ac_dfa_t *dfa = NULL;
+    ib_ac_state_t *state = NULL;
+    ib_ac_state_t *child = NULL;
+
+    size_t head = 0;
+    size_t tail = 0;
+    size_t table_len = 0;
+
+    int c = 0;
+
+    dfa = (ib_ac_dfa_t *)ib_mpool_calloc(ac_tree->mp, 1, sizeof(*dfa));
+    if (dfa == NULL) {
+        return IB_EALLOC;
+    }
+
+    dfa->num_states = ib_ac_count_states(ac_tree->root);
+    dfa->states = (ib_ac_state_t **)ib_mpool_alloc(
+        ac_tree->mp, dfa->num_states * sizeof(*dfa->states));
+    if (dfa->states == NULL) {
+        return IB_EALLOC;
+    }
+
+    /* Order the states and lay them out. The states array is used as the
+     * queue of the breadth first walk */
+    dfa->states[tail++] = ac_tree->root;
+    for (head = 0; head < tail; ++head) {
+        uint8_t lo = 0;
+        uint16_t len = 0;
+
+        state = dfa->states[head];
+        ib_ac_dfa_row(ac_tree, state, &lo, &len);
+
+        state->dfa_offset = table_len;
+        table_len += sizeof(ib_ac_dfa_state_t) / sizeof(uint32_t) + len;
+        if (table_len > UINT32_MAX) {
+            return IB_EINVAL;
+        }
+
+        for (child = state->child;
+             child != NULL;
+             child = child->sibling)
+        {
+            dfa->states[tail++] = child;
+        }
+    }
+
+    dfa->table_len = table_len;
+    dfa->table = (uint32_t *)ib_mpool_alloc(
+        ac_tree->mp, table_len * sizeof(*dfa->table));
+    if (dfa->table == NULL) {
+        return IB_EALLOC;
+    }
+
+    /* Fill the states. Letters without a goto() take the transition of
+     * the fail state, which is already compiled */
+    for (head = 0; head < tail; ++head) {
+        ib_ac_dfa_state_t *dstate = NULL;
+        uint32_t fail = 0;
+
+        state = dfa->states[head];
+        dstate = ib_ac_dfa_state(dfa, state->dfa_offset);
+
+        dstate->index = head;
+        dstate->output = (state->flags & IB_AC_FLAG_STATE_OUTPUT) ||
+                         state->outputs != NULL;
+
+        ib_ac_dfa_row(ac_tree, state, &dstate->lo, &dstate->len);
+
+        if (state != ac_tree->root) {
+            const ib_ac_dfa_state_t *fstate;
+
+            /* Skip fail states whose rows are within this row: letters
+             * outside of this row are outside of theirs too */
+            fail = state->fail->dfa_offset;
+            for (fstate = ib_ac_dfa_state(dfa, fail);
+                 fstate->len != 256 &&
+                 fstate->lo >= dstate->lo &&
+                 fstate->lo + fstate->len <= dstate->lo + dstate->len;
+                 fstate = ib_ac_dfa_state(dfa, fail))
+            {
+                fail = fstate->fail;
+            }
+        }
+        dstate->fail = fail;
+
+        for (c = 0; c < dstate->len; ++c) {
+            dstate->row[c] = (state == ac_tree->root) ?
+                             0 :
+                             ib_ac_dfa_next(dfa, state->fail->dfa_offset,
+                                            (uint8_t)(dstate->lo + c));
+        }
+
+        for (child = state->child;
+             child != NULL;
+             child = child->sibling)
+        {
+            dstate->row[(uint8_t)child->letter - dstate->lo] =
+                child->dfa_offset;
+        }
+    }
+
+    for (c = 0; c < 256; ++c) {
+        dfa->fold[c] = (ac_tree->flags & IB_AC_FLAG_PARSER_NOCASE) ?
+                       (uint8_t)tolower(c) : (uint8_t)c;
+    }
+
+    ac_tree->dfa = dfa;
+
+    return IB_OK;
+}
+
 /**
  * Builds links between states (the AC failure function)
  * It also link outputs of subpatterns found between branches,
@@ -606,6 +854,13 @@ ib_status_t ib_ac_build_links(ib_ac_t *ac_tree)
         return st;
     }
 
+    if ((ac_tree->flags & IB_AC_FLAG_PARSER_DFA) && ac_tree->dfa == NULL) {
+        st = ib_ac_build_dfa(ac_tree);
+        if (st != IB_OK) {
+            return st;
+        }
+    }
+
     ac_tree->flags |= IB_AC_FLAG_PARSER_READY;
 
     return IB_OK;
@@ -630,11 +885,139 @@ static void ib_ac_do_callback(ib_ac_context_t *ac_ctx,
                       ac_ctx->current_offset - (state->level + 1));
     }
 
-    ++state->match_cnt;
-
     return;
 }
 
+/**
+ * Report the matches of the given output state and the outputs linked
+ * to it
+ *
+ * @param ac_ctx the matching context
+ * @param outs the first output state to report
+ * @param flags options to use while matching
+ * @param mp memory pool to use
+ *
+ * @returns IB_OK to continue matching, IB_DECLINED to stop after the first
+ *          match (IB_AC_FLAG_CONSUME_MATCHALL not set) or an error status
+ */
+static ib_status_t ib_ac_report_outputs(ib_ac_context_t *ac_ctx,
+                                        ib_ac_state_t *outs,
+                                        uint8_t flags,
+                                        ib_mpool_t *mp)
+{
+    for (; outs != NULL; outs = outs->outputs) {
+        ++ac_ctx->match_cnt;
+
+        if (flags & IB_AC_FLAG_CONSUME_DOCALLBACK)
+        {
+            ib_ac_do_callback(ac_ctx, outs);
+        }
+
+        if (flags & IB_AC_FLAG_CONSUME_DOLIST)
+        {
+            /* If list is not created yet, create it */
+            if (ac_ctx->match_list == NULL)
+            {
+                ib_status_t rc;
+                rc = ib_list_create(&ac_ctx->match_list, mp);
+                if (rc != IB_OK) {
+                    return rc;
+                }
+            }
+
+            ib_ac_match_t *mt = NULL;
+            mt = (ib_ac_match_t *)ib_mpool_calloc(mp,
+                              1, sizeof(ib_ac_match_t));
+            if (mt == NULL) {
+                return IB_EALLOC;
+            }
+
+            mt->pattern = outs->pattern;
+            mt->data = outs->data;
+            mt->pattern_len = outs->level + 1;
+            mt->offset = ac_ctx->processed - (outs->level + 1);
+            mt->relative_offset = ac_ctx->current_offset -
+                                             (outs->level + 1);
+
+            ib_list_enqueue(ac_ctx->match_list, (void *) mt);
+        }
+
+        if ( !(flags & IB_AC_FLAG_CONSUME_MATCHALL))
+        {
+            return IB_DECLINED;
+        }
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Search patterns using the flat transition table. See ib_ac_consume()
+ *
+ * @param ac_ctx pointer to the matching context
+ * @param data pointer to the buffer to search in
+ * @param len the length of the data
+ * @param flags options to use while matching
+ * @param mp memory pool to use
+ *
+ * @returns Status code
+ */
+static ib_status_t ib_ac_consume_dfa(ib_ac_context_t *ac_ctx,
+                                     const char *data,
+                                     size_t len,
+                                     uint8_t flags,
+                                     ib_mpool_t *mp)
+{
+    const ib_ac_dfa_t *dfa = ac_ctx->ac_tree->dfa;
+    const ib_ac_dfa_state_t *dstate = NULL;
+    const uint8_t *start = (const uint8_t *)data;
+    const uint8_t *end = start + len;
+    const uint8_t *p = start;
+    size_t processed = ac_ctx->processed;
+    uint32_t offset = ac_ctx->current->dfa_offset;
+
+    int flag_match = 0;
+
+    while (p < end) {
+        offset = ib_ac_dfa_next(dfa, offset, dfa->fold[*p++]);
+        dstate = ib_ac_dfa_state(dfa, offset);
+
+        if (dstate->output) {
+            ib_ac_state_t *state = dfa->states[dstate->index];
+            ib_status_t rc;
+
+            flag_match = 1;
+
+            ac_ctx->current = state;
+            ac_ctx->current_offset = p - start;
+            ac_ctx->processed = processed + ac_ctx->current_offset;
+
+            rc = ib_ac_report_outputs(
+                ac_ctx,
+                (state->flags & IB_AC_FLAG_STATE_OUTPUT) ?
+                    state : state->outputs,
+                flags, mp);
+            if (rc == IB_DECLINED) {
+                return IB_OK;
+            }
+            if (rc != IB_OK) {
+                return rc;
+            }
+        }
+    }
+
+    ac_ctx->current = dfa->states[ib_ac_dfa_state(dfa, offset)->index];
+    ac_ctx->current_offset = len;
+    ac_ctx->processed = processed + len;
+
+    /* If we have a match, return ok. Otherwise return IB_ENOENT */
+    if (flag_match == 1) {
+        return IB_OK;
+    }
+
+    return IB_ENOENT;
+}
+
 /**
  * Search patterns of the ac_tree matcher in the given buffer using a
  * matching context. The matching context stores offsets used to process
@@ -677,6 +1060,10 @@ ib_status_t ib_ac_consume(ib_ac_context_t *ac_ctx,
         ac_ctx->current = ac_tree->root;
     }
 
+    if (ac_tree->dfa != NULL) {
+        return ib_ac_consume_dfa(ac_ctx, data, len, flags, mp);
+    }
+
     state = ac_ctx->current;
     end = data + len;
 
@@ -694,103 +1081,30 @@ ib_status_t ib_ac_consume(ib_ac_context_t *ac_ctx,
             fgoto = ib_ac_bintree_goto(state, letter);
 
             if (fgoto != NULL) {
+                ib_ac_state_t *outs = NULL;
 
-                if (fgoto->flags & IB_AC_FLAG_STATE_OUTPUT) {
-                    flag_match = 1;
-
-                    ++fgoto->match_cnt;
-                    ++ac_ctx->match_cnt;
+                ac_ctx->current = fgoto;
+                state = fgoto;
 
-                    ac_ctx->current = fgoto;
-                    state = fgoto;
+                /* Report the state itself if it is an output, followed
+                 * by the subpatterns of the current walked branch that
+                 * are present as independent patterns in the tree. The
+                 * latter must be reported even if the state reached is
+                 * not an output itself */
+                outs = (fgoto->flags & IB_AC_FLAG_STATE_OUTPUT) ?
+                       fgoto : fgoto->outputs;
 
-                    if (flags & IB_AC_FLAG_CONSUME_DOCALLBACK)
-                    {
-                        ib_ac_do_callback(ac_ctx, state);
-                    }
+                if (outs != NULL) {
+                    ib_status_t rc;
 
-                    if (flags & IB_AC_FLAG_CONSUME_DOLIST)
-                    {
-                        /* If list is not created yet, create it */
-                        if (ac_ctx->match_list == NULL)
-                        {
-                            ib_status_t rc;
-                            rc = ib_list_create(&ac_ctx->match_list, mp);
-                            if (rc != IB_OK) {
-                                return rc;
-                            }
-                        }
-
-                        ib_ac_match_t *mt = NULL;
-                        mt = (ib_ac_match_t *)ib_mpool_calloc(mp,
-                                          1, sizeof(ib_ac_match_t));
-                        if (mt == NULL) {
-                            return IB_EALLOC;
-                        }
-
-                        mt->pattern = state->pattern;
-                        mt->data = state->data;
-                        mt->pattern_len = state->level + 1;
-                        mt->offset = ac_ctx->processed - (fgoto->level + 1);
-                        mt->relative_offset = ac_ctx->current_offset -
-                                                         (fgoto->level + 1);
-
-                        ib_list_enqueue(ac_ctx->match_list, (void *) mt);
-                    }
+                    flag_match = 1;
 
-                    if ( !(flags & IB_AC_FLAG_CONSUME_MATCHALL))
-                    {
+                    rc = ib_ac_report_outputs(ac_ctx, outs, flags, mp);
+                    if (rc == IB_DECLINED) {
                         return IB_OK;
                     }
-
-                    ib_ac_state_t *outs = NULL;
-
-                    for (outs = state->outputs;
-                         outs != NULL;
-                         outs = outs->outputs)
-                    {
-                        /* This are subpatterns of the current walked branch
-                         * that are present as independent patterns as well
-                         * in the tree */
-
-                        ++outs->match_cnt;
-                        ++ac_ctx->match_cnt;
-
-                        if (flags & IB_AC_FLAG_CONSUME_DOCALLBACK)
-                        {
-                            ib_ac_do_callback(ac_ctx, outs);
-                        }
-
-                        if (flags & IB_AC_FLAG_CONSUME_DOLIST)
-                        {
-                            /* If list is not created yet, create it */
-                            if (ac_ctx->match_list == NULL)
-                            {
-                                ib_status_t rc;
-                                rc = ib_list_create(&ac_ctx->match_list, mp);
-                                if (rc != IB_OK) {
-                                    return rc;
-                                }
-                            }
-
-                            ib_ac_match_t *mt = NULL;
-                            mt = (ib_ac_match_t *)ib_mpool_calloc(mp,
-                                              1, sizeof(ib_ac_match_t));
-                            if (mt == NULL) {
-                                return IB_EALLOC;
-                            }
-
-                            mt->pattern = outs->pattern;
-                            mt->data = state->data;
-                            mt->pattern_len = outs->level + 1;
-                            mt->offset =
-                                ac_ctx->processed - (outs->level + 1);
-                            mt->relative_offset = ac_ctx->current_offset -
-                                                         (outs->level + 1);
-
-                            ib_list_enqueue(ac_ctx->match_list,
-                                            (void *) mt);
-                        }
+                    if (rc != IB_OK) {
+                        return rc;
                     }
                 }
             }
@@ -56,7 +56,7 @@ struct ib_ac_state_t {
 
     ib_ac_bintree_t   *bintree;   /**< bintree to speed up the goto() search*/
 
-    uint32_t           match_cnt; /**< match count of this state */
+    uint32_t           dfa_offset;/**< offset of this state in the DFA */
 
     ib_ac_char_t      *pattern;   /**< (sub) pattern path to this state */
 
@@ -77,6 +77,38 @@ struct ib_ac_bintree_t {
     ib_ac_bintree_t   *right;     /**< chars greater than current */
 };
 
+/**
+ * State of the flat transition table.
+ *
+ * States are stored back to back in one array of 32 bit words, so that
+ * the header of a state and its transitions share cache lines.  The
+ * transitions of a state are the row of @c len letters starting at letter
+ * @c lo; each is the offset of the next state.  Letters outside of the row
+ * take the transition of state @c fail.  Rows of shallow states cover all
+ * 256 letters; deeper states only cover the band of letters between their
+ * lowest and highest goto() letter.
+ */
+typedef struct ib_ac_dfa_state_t ib_ac_dfa_state_t;
+struct ib_ac_dfa_state_t {
+    uint8_t            lo;        /**< first letter of the row */
+    uint8_t            output;    /**< 1 if the state produces output */
+    uint16_t           len;       /**< number of letters in the row */
+    uint32_t           fail;      /**< state for letters outside the row */
+    uint32_t           index;     /**< index of the trie state */
+    uint32_t           row[];     /**< transitions */
+};
+
+/**
+ * Aho Corasick trie compiled into a flat transition table (a DFA).
+ */
+struct ib_ac_dfa_t {
+    uint32_t          *table;     /**< states, in breadth first order */
+    size_t             table_len; /**< number of words in table */
+    ib_ac_state_t    **states;    /**< trie states, by index */
+    size_t             num_states;/**< number of states */
+    uint8_t            fold[256]; /**< input letter translation */
+};
+
 #ifdef __cplusplus
 }
 #endif
@@ -91,27 +91,21 @@ ib_status_t ib_bytestr_create(
 
     ib_status_t rc;
 
-    /* Create the structure. */
-    *pdst = (ib_bytestr_t *)ib_mpool_alloc(pool, sizeof(**pdst));
+    /* Create the structure and the initial data in a single allocation;
+     * growing the byte string later allocates new data and leaves the
+     * original in place. */
+    *pdst = (ib_bytestr_t *)ib_mpool_alloc(pool, sizeof(**pdst) + size);
     if (*pdst == NULL) {
         rc = IB_EALLOC;
         goto failed;
     }
 
-    (*pdst)->data   = NULL;
+    (*pdst)->data   = (size != 0) ? (uint8_t *)(*pdst + 1) : NULL;
     (*pdst)->mp     = pool;
     (*pdst)->flags  = 0;
     (*pdst)->size   = size;
     (*pdst)->length = 0;
 
-    if (size != 0) {
-        (*pdst)->data = (uint8_t *)ib_mpool_alloc(pool, size);
-        if ((*pdst)->data == NULL) {
-            rc = IB_EALLOC;
-            goto failed;
-        }
-    }
-
     return IB_OK;
 
 failed:
@@ -120,6 +114,34 @@ failed:
     return rc;
 }
 
+size_t ib_bytestr_embed_size(void)
+{
+    return sizeof(ib_bytestr_t);
+}
+
+ib_bytestr_t *ib_bytestr_embed(
+    void          *storage,
+    ib_mpool_t    *pool,
+    uint8_t       *data,
+    size_t         data_length,
+    ib_flags_t     flags
+)
+{
+    assert(storage != NULL);
+    assert(pool != NULL);
+    assert(data != NULL || data_length == 0);
+
+    ib_bytestr_t *bs = (ib_bytestr_t *)storage;
+
+    bs->mp     = pool;
+    bs->flags  = flags;
+    bs->data   = data;
+    bs->length = data_length;
+    bs->size   = data_length;
+
+    return bs;
+}
+
 ib_status_t ib_bytestr_dup(
     ib_bytestr_t       **pdst,
     ib_mpool_t          *pool,
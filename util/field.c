@@ -30,18 +30,145 @@
 #include <ironbee/bytestr.h>
 #include <ironbee/engine.h>
 #include <ironbee/escape.h>
+#include <ironbee/hash.h>
+#include <ironbee/list.h>
 #include <ironbee/log.h>
 #include <ironbee/stream.h>
 #include <ironbee/util.h>
 
 #include <assert.h>
+#include <ctype.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <pthread.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
 #if ((__GNUC__==4) && (__GNUC_MINOR__==4))
 #pragma GCC optimize ("O0")
 #pragma message "Warning: GCC optimization turned on off GCC 4.4"
 #endif
 
+/**
+ * Case insensitive name index of the members of a list field.
+ *
+ * @sa ib_field_list_subfields()
+ */
+typedef struct {
+    const ib_list_t      *list;     /**< List indexed */
+    size_t                version;  /**< Version of the field when indexed */
+    size_t                nelts;    /**< Elements of @a list when indexed */
+    const ib_list_node_t *tail;     /**< Last node of @a list when indexed */
+    ib_hash_t            *members;  /**< Name -> ib_list_t of members */
+    const ib_list_t      *empty;    /**< Result for names not present */
+} ib_field_list_index_t;
+
+/**
+ * Process wide key of the list index hash.
+ *
+ * List indexes are keyed by member names, which are often attacker
+ * controlled (ARGS, headers), so they use a keyed hash rather than djb2.
+ */
+#define FIELD_LIST_INDEX_HASH_SIZE 16
+
+static uint64_t       field_list_index_key[2];
+static pthread_once_t field_list_index_key_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Seed @ref field_list_index_key from /dev/urandom.
+ *
+ * Falls back to mixing the time and process id if urandom is unavailable.
+ */
+static void field_list_index_key_init(void)
+{
+    uint64_t key[2] = { 0, 0 };
+    struct timespec ts;
+    ssize_t got = 0;
+    int fd;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        got = read(fd, key, sizeof(key));
+        close(fd);
+    }
+    if (got != (ssize_t)sizeof(key)) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        key[0] ^= ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec;
+        key[1] ^= ((uint64_t)getpid() << 32) ^
+                  (uint64_t)(uintptr_t)&field_list_index_key;
+    }
+
+    field_list_index_key[0] = key[0];
+    field_list_index_key[1] = key[1];
+}
+
+#define FIELD_SIP_ROTL(x, b) (((x) << (b)) | ((x) >> (64 - (b))))
+#define FIELD_SIP_ROUND(v0, v1, v2, v3) \
+    do { \
+        v0 += v1; v1 = FIELD_SIP_ROTL(v1, 13); v1 ^= v0; \
+        v0 = FIELD_SIP_ROTL(v0, 32); \
+        v2 += v3; v3 = FIELD_SIP_ROTL(v3, 16); v3 ^= v2; \
+        v0 += v3; v3 = FIELD_SIP_ROTL(v3, 21); v3 ^= v0; \
+        v2 += v1; v1 = FIELD_SIP_ROTL(v1, 17); v1 ^= v2; \
+        v2 = FIELD_SIP_ROTL(v2, 32); \
+    } while (0)
+
+/**
+ * Case insensitive SipHash-2-4 of a member name.
+ *
+ * Keyed by @ref field_list_index_key; @a randomizer is mixed into the key.
+ *
+ * @param[in] key Name.
+ * @param[in] key_length Length of @a key.
+ * @param[in] randomizer Per hash randomizer.
+ *
+ * @returns Hash value.
+ */
+static uint32_t field_list_index_hash(
+    const void *key,
+    size_t      key_length,
+    uint32_t    randomizer
+)
+{
+    assert(key != NULL);
+
+    const unsigned char *k = (const unsigned char *)key;
+    uint64_t k0 = field_list_index_key[0] ^ randomizer;
+    uint64_t k1 = field_list_index_key[1];
+    uint64_t v0 = k0 ^ UINT64_C(0x736f6d6570736575);
+    uint64_t v1 = k1 ^ UINT64_C(0x646f72616e646f6d);
+    uint64_t v2 = k0 ^ UINT64_C(0x6c7967656e657261);
+    uint64_t v3 = k1 ^ UINT64_C(0x7465646279746573);
+    uint64_t m = 0;
+    size_t i;
+
+    for (i = 0; i < key_length; ++i) {
+        m |= (uint64_t)tolower(k[i]) << (8 * (i & 7));
+        if ((i & 7) == 7) {
+            v3 ^= m;
+            FIELD_SIP_ROUND(v0, v1, v2, v3);
+            FIELD_SIP_ROUND(v0, v1, v2, v3);
+            v0 ^= m;
+            m = 0;
+        }
+    }
+    m |= (uint64_t)key_length << 56;
+    v3 ^= m;
+    FIELD_SIP_ROUND(v0, v1, v2, v3);
+    FIELD_SIP_ROUND(v0, v1, v2, v3);
+    v0 ^= m;
+
+    v2 ^= 0xff;
+    FIELD_SIP_ROUND(v0, v1, v2, v3);
+    FIELD_SIP_ROUND(v0, v1, v2, v3);
+    FIELD_SIP_ROUND(v0, v1, v2, v3);
+    FIELD_SIP_ROUND(v0, v1, v2, v3);
+    m = v0 ^ v1 ^ v2 ^ v3;
+
+    return (uint32_t)(m ^ (m >> 32));
+}
+
 /**
  * Field value structure.
  *
@@ -54,8 +181,87 @@ struct ib_field_val_t {
     void                 *cbdata_set;    /**< Data passed to fn_get. */
     void                 *pval;          /**< Address where value is stored */
     ib_field_val_union_t  u;             /**< Union of value types */
+    size_t                version;       /**< Modification counter */
+    ib_field_list_index_t *index;        /**< List member index or NULL */
+    bool                  shared;        /**< List is shared; copy on write */
 };
 
+/**
+ * Field allocation.
+ *
+ * A field, its value store and its name are allocated together.  Fields
+ * created with a copied string or byte string value also hold that value,
+ * and its byte string structure, at the end of the same allocation.
+ */
+typedef struct {
+    ib_field_t     field;       /**< Field */
+    ib_field_val_t val;         /**< Value store of @a field */
+} ib_field_block_t;
+
+/** Round @a n up to the alignment of a field allocation. */
+#define FIELD_ALIGN(n) \
+    (((n) + sizeof(ib_field_block_t *) - 1) & \
+     ~(sizeof(ib_field_block_t *) - 1))
+
+/**
+ * Allocate a field, its value store and name.
+ *
+ * @param[out] pf     The allocated field.
+ * @param[in]  mp     Memory pool to allocate from.
+ * @param[in]  name   Field name.
+ * @param[in]  nlen   Length of @a name.
+ * @param[in]  type   Field type.
+ * @param[in]  extra  Additional bytes to allocate for an inline value.
+ * @param[out] pextra Set to the additional bytes if @a extra is non-zero.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+static ib_status_t field_alloc(
+    ib_field_t **pf,
+    ib_mpool_t  *mp,
+    const char  *name,
+    size_t       nlen,
+    ib_ftype_t   type,
+    size_t       extra,
+    void       **pextra
+)
+{
+    ib_field_block_t *block;
+    char *name_copy;
+
+    extra = FIELD_ALIGN(extra);
+    block = (ib_field_block_t *)ib_mpool_alloc(
+        mp,
+        sizeof(*block) + extra + nlen
+    );
+    if (block == NULL) {
+        *pf = NULL;
+        return IB_EALLOC;
+    }
+    memset(&block->val, 0, sizeof(block->val));
+
+    if (extra != 0) {
+        assert(pextra != NULL);
+        *pextra = block + 1;
+    }
+
+    name_copy = (char *)(block + 1) + extra;
+    memcpy(name_copy, name, nlen);
+
+    block->field.mp   = mp;
+    block->field.type = type;
+    block->field.name = name_copy;
+    block->field.nlen = nlen;
+    block->field.tfn  = NULL;
+    block->field.val  = &block->val;
+
+    *pf = &block->field;
+
+    return IB_OK;
+}
+
 const char *ib_field_type_name(
     ib_ftype_t ftype
 )
@@ -310,10 +516,10 @@ static ib_status_t field_from_string_internal(
             if (rc != IB_OK) {
                 return rc;
             }
-            rc = ib_field_create(&field, mp,
-                                 name, nlen,
-                                 IB_FTYPE_BYTESTR,
-                                 ib_ftype_bytestr_in(bs));
+            rc = ib_field_create_no_copy(&field, mp,
+                                         name, nlen,
+                                         IB_FTYPE_BYTESTR,
+                                         ib_ftype_bytestr_mutable_in(bs));
         }
         if (pvalue != NULL) {
             pvalue->nulstr = (char *)vstr;
@@ -477,8 +683,21 @@ ib_status_t ib_field_create(
 )
 {
     ib_status_t rc;
+    size_t extra = 0;
+    void *inline_value = NULL;
 
-    rc = ib_field_create_alias(pf, mp, name, nlen, type, NULL);
+    /* Store copied strings and byte strings inline with the field. */
+    if (in_pval != NULL) {
+        if (type == IB_FTYPE_NULSTR) {
+            extra = strlen((const char *)in_pval) + 1;
+        }
+        else if (type == IB_FTYPE_BYTESTR) {
+            extra = FIELD_ALIGN(ib_bytestr_embed_size()) +
+                ib_bytestr_length((const ib_bytestr_t *)in_pval);
+        }
+    }
+
+    rc = field_alloc(pf, mp, name, nlen, type, extra, &inline_value);
     if (rc != IB_OK) {
         goto failed;
     }
@@ -486,9 +705,30 @@ ib_status_t ib_field_create(
     /* Point to internal memory */
     (*pf)->val->pval = &((*pf)->val->u);
 
-    rc = ib_field_setv((*pf), in_pval);
-    if (rc != IB_OK) {
-        goto failed;
+    if (type == IB_FTYPE_NULSTR && in_pval != NULL) {
+        memcpy(inline_value, in_pval, extra);
+        (*pf)->val->u.nulstr = (char *)inline_value;
+        ++(*pf)->val->version;
+    }
+    else if (type == IB_FTYPE_BYTESTR && in_pval != NULL) {
+        const ib_bytestr_t *src = (const ib_bytestr_t *)in_pval;
+        size_t len = ib_bytestr_length(src);
+        uint8_t *data = (uint8_t *)inline_value +
+            FIELD_ALIGN(ib_bytestr_embed_size());
+
+        if (len > 0) {
+            memcpy(data, ib_bytestr_const_ptr(src), len);
+        }
+        (*pf)->val->u.bytestr = ib_bytestr_embed(
+            inline_value, mp, (len > 0) ? data : NULL, len, 0
+        );
+        ++(*pf)->val->version;
+    }
+    else {
+        rc = ib_field_setv((*pf), in_pval);
+        if (rc != IB_OK) {
+            goto failed;
+        }
     }
 
     ib_field_util_log_debug("FIELD_CREATE", (*pf));
@@ -537,6 +777,28 @@ failed:
     return rc;
 }
 
+ib_status_t ib_field_create_list_view(
+    ib_field_t      **pf,
+    ib_mpool_t       *mp,
+    const char       *name,
+    size_t            nlen,
+    const ib_list_t  *list
+)
+{
+    assert(list != NULL);
+
+    ib_status_t rc;
+
+    rc = ib_field_create(pf, mp, name, nlen,
+                         IB_FTYPE_LIST, (void *)list);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    (*pf)->val->shared = true;
+
+    return IB_OK;
+}
+
 ib_status_t ib_field_create_alias(
     ib_field_t **pf,
     ib_mpool_t  *mp,
@@ -547,46 +809,16 @@ ib_status_t ib_field_create_alias(
 )
 {
     ib_status_t rc;
-    char *name_copy;
-
-    /* Allocate the field structure. */
-    *pf = (ib_field_t *)ib_mpool_alloc(mp, sizeof(**pf));
-    if (*pf == NULL) {
-        rc = IB_EALLOC;
-        goto failed;
-    }
-    (*pf)->mp = mp;
-    (*pf)->type = type;
-    (*pf)->tfn = NULL;
 
-    /* Copy the name. */
-    (*pf)->nlen = nlen;
-    name_copy = (char *)ib_mpool_alloc(mp, nlen);
-    if (name_copy == NULL) {
-        rc = IB_EALLOC;
-        goto failed;
-    }
-    memcpy(name_copy, name, nlen);
-    (*pf)->name = (const char *)name_copy;
-
-    (*pf)->val = (ib_field_val_t *)ib_mpool_calloc(mp,
-        1, sizeof(*((*pf)->val))
-    );
-    if ((*pf)->val == NULL) {
-        rc = IB_EALLOC;
-        goto failed;
+    rc = field_alloc(pf, mp, name, nlen, type, 0, NULL);
+    if (rc != IB_OK) {
+        return rc;
     }
 
     (*pf)->val->pval = storage_pval;
 
     ib_field_util_log_debug("FIELD_CREATE_ALIAS", (*pf));
     return IB_OK;
-
-failed:
-    /* Make sure everything is cleaned up on failure. */
-    *pf = NULL;
-
-    return rc;
 }
 
 ib_status_t ib_field_create_dynamic(
@@ -719,6 +951,9 @@ ib_status_t ib_field_copy(
         goto failed;
     }
 
+    /* A copy of a list view is a view of the same list. */
+    (*pf)->val->shared = src->val->shared;
+
     ib_field_util_log_debug("FIELD_COPY", (*pf));
 
     return rc;
@@ -738,31 +973,76 @@ ib_status_t ib_field_create_bytestr_alias(
 )
 {
     ib_status_t rc;
-    ib_bytestr_t *bs;
+    void *storage = NULL;
 
-    rc = ib_bytestr_alias_mem(&bs, mp, val, vlen);
-    if (rc != IB_OK) {
-        goto failed;
+    if (val == NULL) {
+        *pf = NULL;
+        return IB_EINVAL;
     }
 
-    rc = ib_field_create_no_copy(
+    /* The aliasing byte string lives in the field allocation. */
+    rc = field_alloc(
         pf, mp, name, nlen,
         IB_FTYPE_BYTESTR,
-        ib_ftype_bytestr_mutable_in(bs)
+        ib_bytestr_embed_size(),
+        &storage
     );
     if (rc != IB_OK) {
-        goto failed;
+        return rc;
     }
 
+    (*pf)->val->pval = &((*pf)->val->u);
+    (*pf)->val->u.bytestr = ib_bytestr_embed(
+        storage, mp, val, vlen, IB_BYTESTR_FREADONLY
+    );
+    ++(*pf)->val->version;
+
     ib_field_util_log_debug("FIELD_CREATE_BYTESTR_ALIAS", (*pf));
 
     return IB_OK;
+}
 
-failed:
-    /* Make sure everything is cleaned up on failure. */
-    *pf = NULL;
+/**
+ * Add @a member to the member name index @a index of list field @a f.
+ *
+ * @param[in] f List field.
+ * @param[in] index Index of @a f.
+ * @param[in] member Member to add.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+static ib_status_t field_list_index_add(
+    const ib_field_t      *f,
+    ib_field_list_index_t *index,
+    ib_field_t            *member
+)
+{
+    ib_status_t rc;
+    ib_list_t *members;
 
-    return rc;
+    if (member == NULL || member->nlen == 0) {
+        return IB_OK;
+    }
+
+    rc = ib_hash_get_ex(index->members, &members, member->name, member->nlen);
+    if (rc == IB_ENOENT) {
+        rc = ib_list_create(&members, f->mp);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        rc = ib_hash_set_ex(index->members,
+                            member->name, member->nlen, members);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+    else if (rc != IB_OK) {
+        return rc;
+    }
+
+    return ib_list_push(members, member);
 }
 
 ib_status_t ib_field_list_add(
@@ -772,6 +1052,10 @@ ib_status_t ib_field_list_add(
 {
     ib_status_t rc;
     ib_list_t *l = NULL;
+    ib_field_list_index_t *index;
+    const ib_list_node_t *tail;
+    size_t nelts;
+    size_t version = f->val->version;
 
     rc = ib_field_mutable_value_type(
         f,
@@ -782,8 +1066,34 @@ ib_status_t ib_field_list_add(
         return rc;
     }
 
+    nelts = ib_list_elements(l);
+    tail = ib_list_last_const(l);
+
     rc = ib_list_push(l, (void *)fval);
-    return rc;
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    /* Extend an up to date member index rather than rebuilding it. */
+    index = f->val->index;
+    if ( (index != NULL) &&
+         (index->list == l) &&
+         (index->version == version) &&
+         (index->nelts == nelts) &&
+         (index->tail == tail) )
+    {
+        rc = field_list_index_add(f, index, fval);
+        if (rc != IB_OK) {
+            /* The index is only a cache; rebuild it on next use. */
+            f->val->index = NULL;
+            return IB_OK;
+        }
+        index->version = f->val->version;
+        index->nelts = ib_list_elements(l);
+        index->tail = ib_list_last_const(l);
+    }
+
+    return IB_OK;
 }
 
 ib_status_t ib_field_buf_add(
@@ -823,6 +1133,7 @@ ib_status_t ib_field_make_static(
     f->val->fn_set     = NULL;
     f->val->cbdata_get = NULL;
     f->val->cbdata_set = NULL;
+    ++f->val->version;
 
     ib_field_util_log_debug("FIELD_MAKE_STATIC", f);
 
@@ -839,7 +1150,8 @@ ib_status_t ib_field_setv_no_copy(
     }
 
     *(void **)(f->val->pval) = mutable_in_pval;
-
+    f->val->shared = false;
+    ++f->val->version;
 
     return IB_OK;
 }
@@ -953,6 +1265,9 @@ ib_status_t ib_field_setv_ex(
     }
     }
 
+    f->val->shared = false;
+    ++f->val->version;
+
     ib_field_util_log_debug("FIELD_SETV", f);
 
     return IB_OK;
@@ -1059,6 +1374,27 @@ ib_status_t ib_field_mutable_value(
         return IB_ENOENT;
     }
 
+    /* Copy a shared list before handing it out for modification. */
+    if (f->val->shared) {
+        const ib_list_t *shared = *(const ib_list_t **)f->val->pval;
+        const ib_list_node_t *node;
+        ib_list_t *copy;
+        ib_status_t rc;
+
+        rc = ib_list_create(&copy, f->mp);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        IB_LIST_LOOP_CONST(shared, node) {
+            rc = ib_list_push(copy, (void *)ib_list_node_data_const(node));
+            if (rc != IB_OK) {
+                return rc;
+            }
+        }
+        *(ib_list_t **)f->val->pval = copy;
+        f->val->shared = false;
+    }
+
     if (f->type == IB_FTYPE_NUM || f->type == IB_FTYPE_FLOAT)
     {
         *(void**)mutable_out_pval = f->val->pval;
@@ -1067,6 +1403,9 @@ ib_status_t ib_field_mutable_value(
         *(void**)mutable_out_pval = *(void **)f->val->pval;
     }
 
+    /* The caller may now modify the value. */
+    ++f->val->version;
+
     return IB_OK;
 }
 
@@ -1094,6 +1433,143 @@ int ib_field_is_dynamic(const ib_field_t *f)
     return f->val->pval == NULL ? 1 : 0;
 }
 
+size_t ib_field_version(const ib_field_t *f)
+{
+    return f->val->version;
+}
+
+/**
+ * Build the member name index of list field @a f.
+ *
+ * @param[in] f List field.
+ * @param[in] list Value of @a f.
+ * @param[out] pindex Index.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+static ib_status_t field_list_index_build(
+    const ib_field_t       *f,
+    const ib_list_t        *list,
+    ib_field_list_index_t **pindex
+)
+{
+    ib_status_t rc;
+    ib_field_list_index_t *index;
+    const ib_list_node_t *node;
+    ib_list_t *empty;
+
+    index = ib_mpool_alloc(f->mp, sizeof(*index));
+    if (index == NULL) {
+        return IB_EALLOC;
+    }
+    index->list = list;
+    index->version = f->val->version;
+    index->nelts = ib_list_elements(list);
+    index->tail = ib_list_last_const(list);
+
+    pthread_once(&field_list_index_key_once, field_list_index_key_init);
+    rc = ib_hash_create_ex(&index->members, f->mp,
+                           FIELD_LIST_INDEX_HASH_SIZE,
+                           field_list_index_hash,
+                           ib_hashequal_nocase);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    rc = ib_list_create(&empty, f->mp);
+    if (rc != IB_OK) {
+        return rc;
+    }
+    index->empty = empty;
+
+    IB_LIST_LOOP_CONST(list, node) {
+        rc = field_list_index_add(
+            f, index, (ib_field_t *)ib_list_node_data_const(node));
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    *pindex = index;
+    return IB_OK;
+}
+
+ib_status_t ib_field_list_subfields(
+    const ib_field_t  *f,
+    const char        *name,
+    size_t             nlen,
+    const ib_list_t  **members
+)
+{
+    assert(f != NULL);
+    assert(name != NULL);
+    assert(members != NULL);
+
+    ib_status_t rc;
+    const ib_list_t *list;
+    ib_field_list_index_t *index;
+
+    if (f->type != IB_FTYPE_LIST || ib_field_is_dynamic(f)) {
+        return IB_EINVAL;
+    }
+
+    rc = ib_field_value(f, ib_ftype_list_out(&list));
+    if (rc != IB_OK) {
+        return rc;
+    }
+
+    /* Small lists are cheaper to scan than to index. */
+    if (list == NULL || ib_list_elements(list) < IB_FIELD_LIST_INDEX_MIN) {
+        const ib_list_node_t *node;
+        ib_list_t *matches;
+
+        rc = ib_list_create(&matches, f->mp);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        if (list != NULL) {
+            IB_LIST_LOOP_CONST(list, node) {
+                ib_field_t *member =
+                    (ib_field_t *)ib_list_node_data_const(node);
+
+                if (member->nlen == nlen &&
+                    strncasecmp(member->name, name, nlen) == 0)
+                {
+                    rc = ib_list_push(matches, member);
+                    if (rc != IB_OK) {
+                        return rc;
+                    }
+                }
+            }
+        }
+        *members = matches;
+        return IB_OK;
+    }
+
+    index = f->val->index;
+    if ( (index == NULL) ||
+         (index->list != list) ||
+         (index->version != f->val->version) ||
+         (index->nelts != ib_list_elements(list)) ||
+         (index->tail != ib_list_last_const(list)) )
+    {
+        rc = field_list_index_build(f, list, &index);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        f->val->index = index;
+    }
+
+    rc = ib_hash_get_ex(index->members, members, name, nlen);
+    if (rc == IB_ENOENT) {
+        *members = index->empty;
+        return IB_OK;
+    }
+
+    return rc;
+}
+
 ib_status_t ib_field_convert(
     ib_mpool_t        *mp,
     const ib_ftype_t   desired_type,
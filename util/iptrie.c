@@ -0,0 +1,890 @@
+/*****************************************************************************
+ * Licensed to Qualys, Inc. (QUALYS) under one or more
+ * contributor license agreements.  See the NOTICE file distributed with
+ * this work for additional information regarding copyright ownership.
+ * QUALYS licenses this file to You under the Apache License, Version 2.0
+ * (the "License"); you may not use this file except in compliance with
+ * the License.  You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ ****************************************************************************/
+
+/**
+ * @file
+ * @brief IronBee --- IP Trie Implementation
+ *
+ * Each family has a root table of IPTRIE_ROOT_SIZE entries indexed by the
+ * first 16 bits of an address.  An entry is IPTRIE_MISS, IPTRIE_HIT or
+ * IPTRIE_NODE plus the index of the node for the next byte.
+ *
+ * A node covers one byte.  Instead of 256 entries it holds two 256 bit
+ * maps: bits set in @c child have a child node, the others are a hit or
+ * a miss according to @c hit.  The children of a node are stored
+ * contiguously in breadth first order, so the child for a byte is found by
+ * counting the @c child bits below it.  A node is 72 bytes where a table
+ * of entries would be 1024.
+ *
+ * Tries are built from mutable nodes with pointers to their children and
+ * then laid out in the final arrays.  Networks are inserted shortest
+ * first.  A network that ends inside a node or the root table is expanded
+ * to all entries it covers; a network below a hit is covered and needs no
+ * nodes.
+ */
+
+#include "ironbee_config_auto.h"
+
+#include <ironbee/iptrie.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/** Root entry for addresses not in the trie. */
+#define IPTRIE_MISS 0
+/** Root entry for addresses in the trie. */
+#define IPTRIE_HIT  1
+/** Root entries of nodes are the node index plus this. */
+#define IPTRIE_NODE 2
+/** Entries in the root table. */
+#define IPTRIE_ROOT_SIZE 65536
+
+/** Longest address or network accepted by ib_iptrie_create_from_file(). */
+#define IPTRIE_MAX_TOKEN 64
+
+/**
+ * Node of a trie being built.
+ */
+typedef struct ib_iptrie_build_node_t ib_iptrie_build_node_t;
+struct ib_iptrie_build_node_t {
+    uint64_t                 hit[4];       /**< Hits without children. */
+    uint64_t                 child[4];     /**< Bytes with children. */
+    ib_iptrie_build_node_t **children;     /**< Children in byte order. */
+};
+
+/**
+ * Trie of one family being built.
+ */
+typedef struct ib_iptrie_build_t ib_iptrie_build_t;
+struct ib_iptrie_build_t {
+    uint64_t                 hit[IPTRIE_ROOT_SIZE / 64]; /**< Root hits. */
+    ib_iptrie_build_node_t  *root[IPTRIE_ROOT_SIZE];     /**< Root nodes. */
+    size_t                   num_nodes;    /**< Nodes below the root. */
+};
+
+/**
+ * Node of a trie.
+ */
+typedef struct ib_iptrie_node_t ib_iptrie_node_t;
+struct ib_iptrie_node_t {
+    uint64_t hit[4];    /**< Hits without children. */
+    uint64_t child[4];  /**< Bytes with children. */
+    uint32_t base;      /**< Index of first child. */
+};
+
+/**
+ * Trie of one address family.
+ */
+typedef struct ib_iptrie_family_t ib_iptrie_family_t;
+struct ib_iptrie_family_t {
+    uint32_t         *root;      /**< Root table; NULL if no networks. */
+    ib_iptrie_node_t *nodes;     /**< Nodes in breadth first order. */
+    size_t            num_nodes; /**< Number of @c nodes. */
+};
+
+/**
+ * IP trie.
+ */
+struct ib_iptrie_t {
+    ib_iptrie_family_t v4; /**< IPv4 trie */
+    ib_iptrie_family_t v6; /**< IPv6 trie */
+};
+
+/**
+ * Is bit @a i of @a bits set?
+ */
+static inline
+bool ib_iptrie_bit(const uint64_t *bits, unsigned int i)
+{
+    return (bits[i / 64] >> (i % 64)) & 1;
+}
+
+/**
+ * Set bit @a i of @a bits.
+ */
+static inline
+void ib_iptrie_bit_set(uint64_t *bits, unsigned int i)
+{
+    bits[i / 64] |= (uint64_t)1 << (i % 64);
+}
+
+/**
+ * Number of bits of @a bits below bit @a i.
+ *
+ * @a i may be 256, giving the number of bits set.
+ */
+static inline
+unsigned int ib_iptrie_rank(const uint64_t *bits, unsigned int i)
+{
+#if __GNUC__ >= 4
+    unsigned int rank = 0;
+    unsigned int w;
+
+    for (w = 0; w < i / 64; ++w) {
+        rank += __builtin_popcountll(bits[w]);
+    }
+    /* Do not touch bits[i / 64], which is past the end for i == 256. */
+    if (i % 64 == 0) {
+        return rank;
+    }
+    return rank + __builtin_popcountll(
+        bits[w] & (((uint64_t)1 << (i % 64)) - 1)
+    );
+#else
+#error "__builtin_popcountll support required.  Please report this to developers."
+#endif
+}
+
+/**
+ * Free @a node and all nodes below it.
+ *
+ * @param[in] node Node to free.
+ */
+static
+void ib_iptrie_build_node_free(ib_iptrie_build_node_t *node)
+{
+    unsigned int num_children = ib_iptrie_rank(node->child, 256);
+    unsigned int i;
+
+    for (i = 0; i < num_children; ++i) {
+        ib_iptrie_build_node_free(node->children[i]);
+    }
+    free(node->children);
+    free(node);
+}
+
+/**
+ * Free @a build and all of its nodes.
+ *
+ * @param[in] build Trie being built; may be NULL.
+ */
+static
+void ib_iptrie_build_free(ib_iptrie_build_t *build)
+{
+    size_t i;
+
+    if (build == NULL) {
+        return;
+    }
+    for (i = 0; i < IPTRIE_ROOT_SIZE; ++i) {
+        if (build->root[i] != NULL) {
+            ib_iptrie_build_node_free(build->root[i]);
+        }
+    }
+    free(build);
+}
+
+/**
+ * Create a node.
+ *
+ * @param[in,out] build Trie being built.
+ *
+ * @returns New node or NULL on allocation failure.
+ */
+static
+ib_iptrie_build_node_t *ib_iptrie_build_node_create(
+    ib_iptrie_build_t *build
+)
+{
+    ib_iptrie_build_node_t *node;
+
+    if (build->num_nodes >= UINT32_MAX - IPTRIE_NODE) {
+        return NULL;
+    }
+    node = calloc(1, sizeof(*node));
+    if (node != NULL) {
+        ++build->num_nodes;
+    }
+
+    return node;
+}
+
+/**
+ * Get or create the child of @a node for @a byte.
+ *
+ * @param[in,out] build  Trie being built.
+ * @param[in,out] node   Parent node.
+ * @param[in]     byte   Byte of child.
+ * @param[out]    pchild Child.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+static
+ib_status_t ib_iptrie_build_child(
+    ib_iptrie_build_t       *build,
+    ib_iptrie_build_node_t  *node,
+    unsigned int             byte,
+    ib_iptrie_build_node_t **pchild
+)
+{
+    unsigned int             rank = ib_iptrie_rank(node->child, byte);
+    unsigned int             num_children;
+    ib_iptrie_build_node_t **children;
+    ib_iptrie_build_node_t  *child;
+
+    if (ib_iptrie_bit(node->child, byte)) {
+        *pchild = node->children[rank];
+        return IB_OK;
+    }
+
+    num_children = ib_iptrie_rank(node->child, 256);
+    children = realloc(node->children,
+                       (num_children + 1) * sizeof(*children));
+    if (children == NULL) {
+        return IB_EALLOC;
+    }
+    node->children = children;
+
+    child = ib_iptrie_build_node_create(build);
+    if (child == NULL) {
+        return IB_EALLOC;
+    }
+
+    memmove(children + rank + 1, children + rank,
+            (num_children - rank) * sizeof(*children));
+    children[rank] = child;
+    ib_iptrie_bit_set(node->child, byte);
+
+    *pchild = child;
+    return IB_OK;
+}
+
+/**
+ * Insert the network @a key / @a bits into @a build.
+ *
+ * Networks must be inserted shortest first.
+ *
+ * @param[in,out] build Trie being built.
+ * @param[in]     key   Network address, most significant byte first.
+ * @param[in]     bits  Network size.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+static
+ib_status_t ib_iptrie_build_insert(
+    ib_iptrie_build_t *build,
+    const uint8_t     *key,
+    size_t             bits
+)
+{
+    unsigned int            index = ((unsigned int)key[0] << 8) | key[1];
+    ib_iptrie_build_node_t *node;
+    unsigned int            span;
+    unsigned int            i;
+    ib_status_t             rc;
+
+    if (bits <= 16) {
+        span = 1U << (16 - bits);
+        index &= ~(span - 1);
+        for (i = index; i < index + span; ++i) {
+            assert(build->root[i] == NULL);
+            ib_iptrie_bit_set(build->hit, i);
+        }
+        return IB_OK;
+    }
+
+    if (ib_iptrie_bit(build->hit, index)) {
+        /* Covered by a shorter network. */
+        return IB_OK;
+    }
+    node = build->root[index];
+    if (node == NULL) {
+        node = ib_iptrie_build_node_create(build);
+        if (node == NULL) {
+            return IB_EALLOC;
+        }
+        build->root[index] = node;
+    }
+
+    for (key += 2, bits -= 16; bits > 8; ++key, bits -= 8) {
+        if (ib_iptrie_bit(node->hit, *key)) {
+            return IB_OK;
+        }
+        rc = ib_iptrie_build_child(build, node, *key, &node);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    span = 1U << (8 - bits);
+    index = *key & ~(span - 1);
+    for (i = index; i < index + span; ++i) {
+        assert(! ib_iptrie_bit(node->child, i));
+        ib_iptrie_bit_set(node->hit, i);
+    }
+
+    return IB_OK;
+}
+
+/**
+ * Memory pool cleanup function to free tables.
+ *
+ * @param[in] data Tables to free.
+ */
+static
+void ib_iptrie_cleanup(void *data)
+{
+    free(data);
+}
+
+/**
+ * Lay out @a build in @a family.
+ *
+ * Nodes are numbered in breadth first order so that the children of each
+ * node are adjacent.  @a build is freed in the process.
+ *
+ * @param[out] family Trie to fill in.
+ * @param[in]  build  Trie built; freed.
+ * @param[in]  mp     Memory pool to free @a family with.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EALLOC on allocation failure.
+ */
+static
+ib_status_t ib_iptrie_build_finish(
+    ib_iptrie_family_t *family,
+    ib_iptrie_build_t  *build,
+    ib_mpool_t         *mp
+)
+{
+    ib_iptrie_build_node_t **queue = NULL;
+    size_t                   head;
+    size_t                   tail = 0;
+    size_t                   i;
+    ib_status_t              rc;
+
+    family->root = malloc(IPTRIE_ROOT_SIZE * sizeof(*family->root));
+    if (build->num_nodes > 0) {
+        family->nodes = malloc(build->num_nodes * sizeof(*family->nodes));
+        queue = malloc(build->num_nodes * sizeof(*queue));
+    }
+    if (family->root == NULL ||
+        (build->num_nodes > 0 && (family->nodes == NULL || queue == NULL)))
+    {
+        rc = IB_EALLOC;
+        goto failed;
+    }
+    family->num_nodes = build->num_nodes;
+
+    for (i = 0; i < IPTRIE_ROOT_SIZE; ++i) {
+        if (build->root[i] != NULL) {
+            family->root[i] = IPTRIE_NODE + tail;
+            queue[tail++] = build->root[i];
+            build->root[i] = NULL;
+        }
+        else {
+            family->root[i] = ib_iptrie_bit(build->hit, i) ?
+                IPTRIE_HIT : IPTRIE_MISS;
+        }
+    }
+
+    /* The queue ends up holding every node, each one once. */
+    for (head = 0; head < tail; ++head) {
+        ib_iptrie_build_node_t *bnode = queue[head];
+        ib_iptrie_node_t       *node  = &family->nodes[head];
+        unsigned int            num_children;
+
+        memcpy(node->hit, bnode->hit, sizeof(node->hit));
+        memcpy(node->child, bnode->child, sizeof(node->child));
+        node->base = tail;
+
+        num_children = ib_iptrie_rank(bnode->child, 256);
+        for (i = 0; i < num_children; ++i) {
+            queue[tail++] = bnode->children[i];
+        }
+        free(bnode->children);
+        free(bnode);
+    }
+    assert(tail == family->num_nodes);
+    free(queue);
+    queue = NULL;
+    free(build);
+    build = NULL;
+
+    rc = ib_mpool_cleanup_register(mp, ib_iptrie_cleanup, family->root);
+    if (rc != IB_OK) {
+        goto failed;
+    }
+    if (family->nodes != NULL) {
+        rc = ib_mpool_cleanup_register(mp, ib_iptrie_cleanup, family->nodes);
+        if (rc != IB_OK) {
+            /* The root is owned by the pool now. */
+            family->root = NULL;
+            goto failed;
+        }
+    }
+
+    return IB_OK;
+
+failed:
+    free(queue);
+    ib_iptrie_build_free(build);
+    free(family->root);
+    free(family->nodes);
+    family->root = NULL;
+    family->nodes = NULL;
+    family->num_nodes = 0;
+    return rc;
+}
+
+/**
+ * Look up @a key in @a family.
+ *
+ * @param[in] family Trie with at least one network.
+ * @param[in] key    Address, most significant byte first.
+ *
+ * @returns true iff @a key is in a network.
+ */
+static inline
+bool ib_iptrie_lookup(
+    const ib_iptrie_family_t *family,
+    const uint8_t            *key
+)
+{
+    uint32_t                entry = family->root[(key[0] << 8) | key[1]];
+    const ib_iptrie_node_t *node;
+
+    if (entry < IPTRIE_NODE) {
+        return entry == IPTRIE_HIT;
+    }
+
+    node = &family->nodes[entry - IPTRIE_NODE];
+    for (key += 2; ib_iptrie_bit(node->child, *key); ++key) {
+        node = &family->nodes[node->base + ib_iptrie_rank(node->child, *key)];
+    }
+
+    return ib_iptrie_bit(node->hit, *key);
+}
+
+/**
+ * Store the bytes of @a ip in @a key, most significant first.
+ */
+static inline
+void ib_iptrie_key4(uint8_t key[4], ib_ip4_t ip)
+{
+    key[0] = ip >> 24;
+    key[1] = ip >> 16;
+    key[2] = ip >> 8;
+    key[3] = ip;
+}
+
+/**
+ * Store the bytes of @a ip in @a key, most significant first.
+ */
+static inline
+void ib_iptrie_key6(uint8_t key[16], const ib_ip6_t *ip)
+{
+    int i;
+
+    for (i = 0; i < 4; ++i) {
+        ib_iptrie_key4(key + 4 * i, ip->ip[i]);
+    }
+}
+
+/** qsort() comparison of IPv4 networks by size. */
+static
+int ib_iptrie_compare4(const void *a, const void *b)
+{
+    return (int)((const ib_ip4_network_t *)a)->size -
+           (int)((const ib_ip4_network_t *)b)->size;
+}
+
+/** qsort() comparison of IPv6 networks by size. */
+static
+int ib_iptrie_compare6(const void *a, const void *b)
+{
+    return (int)((const ib_ip6_network_t *)a)->size -
+           (int)((const ib_ip6_network_t *)b)->size;
+}
+
+ib_status_t ib_iptrie_create(
+    ib_iptrie_t      **ptrie,
+    ib_mpool_t        *mp,
+    ib_ip4_network_t  *net4,
+    size_t             num_net4,
+    ib_ip6_network_t  *net6,
+    size_t             num_net6
+)
+{
+    assert(ptrie != NULL);
+    assert(mp    != NULL);
+    assert(net4  != NULL || num_net4 == 0);
+    assert(net6  != NULL || num_net6 == 0);
+
+    ib_iptrie_t       *trie;
+    ib_iptrie_build_t *build;
+    uint8_t            key[16];
+    size_t             i;
+    ib_status_t        rc;
+
+    for (i = 0; i < num_net4; ++i) {
+        if (net4[i].size > 32) {
+            return IB_EINVAL;
+        }
+    }
+    for (i = 0; i < num_net6; ++i) {
+        if (net6[i].size > 128) {
+            return IB_EINVAL;
+        }
+    }
+
+    trie = ib_mpool_calloc(mp, 1, sizeof(*trie));
+    if (trie == NULL) {
+        return IB_EALLOC;
+    }
+
+    /* Networks are inserted shortest first, so no node is created below a
+     * hit. */
+    if (num_net4 > 0) {
+        qsort(net4, num_net4, sizeof(*net4), ib_iptrie_compare4);
+        build = calloc(1, sizeof(*build));
+        if (build == NULL) {
+            return IB_EALLOC;
+        }
+        for (i = 0; i < num_net4; ++i) {
+            ib_iptrie_key4(key, net4[i].ip);
+            rc = ib_iptrie_build_insert(build, key, net4[i].size);
+            if (rc != IB_OK) {
+                ib_iptrie_build_free(build);
+                return rc;
+            }
+        }
+        rc = ib_iptrie_build_finish(&trie->v4, build, mp);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    if (num_net6 > 0) {
+        qsort(net6, num_net6, sizeof(*net6), ib_iptrie_compare6);
+        build = calloc(1, sizeof(*build));
+        if (build == NULL) {
+            return IB_EALLOC;
+        }
+        for (i = 0; i < num_net6; ++i) {
+            ib_iptrie_key6(key, &(net6[i].ip));
+            rc = ib_iptrie_build_insert(build, key, net6[i].size);
+            if (rc != IB_OK) {
+                ib_iptrie_build_free(build);
+                return rc;
+            }
+        }
+        rc = ib_iptrie_build_finish(&trie->v6, build, mp);
+        if (rc != IB_OK) {
+            return rc;
+        }
+    }
+
+    *ptrie = trie;
+
+    return IB_OK;
+}
+
+/**
+ * Parse the networks in @a buf.
+ *
+ * Called twice: with @a net4 and @a net6 NULL to count the networks and
+ * then to store them.
+ *
+ * @param[in]  buf        File contents.
+ * @param[in]  len        Length of @a buf.
+ * @param[out] net4       IPv4 networks or NULL.
+ * @param[out] num_net4   Number of IPv4 networks.
+ * @param[out] net6       IPv6 networks or NULL.
+ * @param[out] num_net6   Number of IPv6 networks.
+ * @param[out] error_line Line number of an error or NULL.
+ *
+ * @returns
+ * - IB_OK on success.
+ * - IB_EINVAL on a parse error.
+ */
+static
+ib_status_t ib_iptrie_parse(
+    const char       *buf,
+    size_t            len,
+    ib_ip4_network_t *net4,
+    size_t           *num_net4,
+    ib_ip6_network_t *net6,
+    size_t           *num_net6,
+    size_t           *error_line
+)
+{
+    const char *end = buf + len;
+    size_t      line = 0;
+    char        token[IPTRIE_MAX_TOKEN + 1];
+    ib_status_t rc;
+
+    *num_net4 = 0;
+    *num_net6 = 0;
+
+    while (buf < end) {
+        const char *eol = memchr(buf, '\n', end - buf);
+        const char *next;
+        const char *comment;
+        size_t      token_len;
+
+        ++line;
+        if (eol == NULL) {
+            eol = end;
+        }
+        next = eol + 1;
+
+        comment = memchr(buf, '#', eol - buf);
+        if (comment != NULL) {
+            eol = comment;
+        }
+        while (buf < eol && isspace((unsigned char)*buf)) {
+            ++buf;
+        }
+        while (eol > buf && isspace((unsigned char)eol[-1])) {
+            --eol;
+        }
+
+        token_len = eol - buf;
+        if (token_len == 0) {
+            buf = next;
+            continue;
+        }
+        if (token_len > IPTRIE_MAX_TOKEN) {
+            rc = IB_EINVAL;
+            goto error;
+        }
+
+        if (memchr(buf, ':', token_len) != NULL) {
+            if (net6 != NULL) {
+                ib_ip6_network_t *net = &net6[*num_net6];
+
+                memcpy(token, buf, token_len);
+                token[token_len] = '\0';
+                rc = ib_ip6_str_to_net(token, net);
+                if (rc == IB_EINVAL) {
+                    rc = ib_ip6_str_to_ip(token, &(net->ip));
+                    net->size = 128;
+                }
+                if (rc != IB_OK) {
+                    goto error;
+                }
+            }
+            ++*num_net6;
+        }
+        else {
+            if (net4 != NULL) {
+                ib_ip4_network_t *net = &net4[*num_net4];
+
+                memcpy(token, buf, token_len);
+                token[token_len] = '\0';
+                rc = ib_ip4_str_to_net(token, net);
+                if (rc == IB_EINVAL) {
+                    rc = ib_ip4_str_to_ip(token, &(net->ip));
+                    net->size = 32;
+                }
+                if (rc != IB_OK) {
+                    goto error;
+                }
+            }
+            ++*num_net4;
+        }
+
+        buf = next;
+    }
+
+    return IB_OK;
+
+error:
+    if (error_line != NULL) {
+        *error_line = line;
+    }
+    return rc;
+}
+
+ib_status_t ib_iptrie_create_from_file(
+    ib_iptrie_t **ptrie,
+    ib_mpool_t   *mp,
+    const char   *path,
+    size_t       *error_line
+)
+{
+    assert(ptrie != NULL);
+    assert(mp    != NULL);
+    assert(path  != NULL);
+
+    int               fd;
+    struct stat       st;
+    char             *buf = NULL;
+    size_t            len;
+    bool              mapped = false;
+    ib_ip4_network_t *net4 = NULL;
+    ib_ip6_network_t *net6 = NULL;
+    size_t            num_net4;
+    size_t            num_net6;
+    ib_status_t       rc;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return IB_ENOENT;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return IB_EOTHER;
+    }
+    len = st.st_size;
+
+    if (len > 0) {
+        buf = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buf != MAP_FAILED) {
+            mapped = true;
+            madvise(buf, len, MADV_SEQUENTIAL);
+        }
+        else {
+            /* Not mappable; read it instead. */
+            size_t total = 0;
+
+            buf = malloc(len);
+            if (buf == NULL) {
+                close(fd);
+                return IB_EALLOC;
+            }
+            while (total < len) {
+                ssize_t n = read(fd, buf + total, len - total);
+                if (n < 0 && errno == EINTR) {
+                    continue;
+                }
+                if (n <= 0) {
+                    free(buf);
+                    close(fd);
+                    return IB_EOTHER;
+                }
+                total += n;
+            }
+        }
+    }
+    close(fd);
+
+    /* Count, allocate, then parse for real. */
+    rc = ib_iptrie_parse(buf, len, NULL, &num_net4, NULL, &num_net6,
+                         error_line);
+    if (rc != IB_OK) {
+        goto finished;
+    }
+    if (num_net4 > 0) {
+        net4 = malloc(num_net4 * sizeof(*net4));
+        if (net4 == NULL) {
+            rc = IB_EALLOC;
+            goto finished;
+        }
+    }
+    if (num_net6 > 0) {
+        net6 = malloc(num_net6 * sizeof(*net6));
+        if (net6 == NULL) {
+            rc = IB_EALLOC;
+            goto finished;
+        }
+    }
+    rc = ib_iptrie_parse(buf, len, net4, &num_net4, net6, &num_net6,
+                         error_line);
+    if (rc != IB_OK) {
+        goto finished;
+    }
+
+    rc = ib_iptrie_create(ptrie, mp, net4, num_net4, net6, num_net6);
+
+finished:
+    free(net4);
+    free(net6);
+    if (mapped) {
+        munmap(buf, len);
+    }
+    else {
+        free(buf);
+    }
+
+    return rc;
+}
+
+ib_status_t ib_iptrie_query4(
+    const ib_iptrie_t *trie,
+    ib_ip4_t           ip
+)
+{
+    assert(trie != NULL);
+
+    uint8_t key[4];
+
+    if (trie->v4.root == NULL) {
+        return IB_ENOENT;
+    }
+
+    ib_iptrie_key4(key, ip);
+
+    return ib_iptrie_lookup(&trie->v4, key) ? IB_OK : IB_ENOENT;
+}
+
+ib_status_t ib_iptrie_query6(
+    const ib_iptrie_t *trie,
+    const ib_ip6_t    *ip
+)
+{
+    assert(trie != NULL);
+    assert(ip   != NULL);
+
+    uint8_t key[16];
+
+    if (trie->v6.root == NULL) {
+        return IB_ENOENT;
+    }
+
+    ib_iptrie_key6(key, ip);
+
+    return ib_iptrie_lookup(&trie->v6, key) ? IB_OK : IB_ENOENT;
+}
+
+/**
+ * Memory used by @a family in bytes.
+ */
+static
+size_t ib_iptrie_family_size(const ib_iptrie_family_t *family)
+{
+    if (family->root == NULL) {
+        return 0;
+    }
+
+    return IPTRIE_ROOT_SIZE * sizeof(*family->root) +
+           family->num_nodes * sizeof(*family->nodes);
+}
+
+size_t ib_iptrie_memory_size(
+    const ib_iptrie_t *trie
+)
+{
+    assert(trie != NULL);
+
+    return ib_iptrie_family_size(&trie->v4) +
+           ib_iptrie_family_size(&trie->v6);
+}
@@ -36,6 +36,7 @@
 #endif
 
 #include <assert.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -438,6 +439,15 @@ struct ib_mpool_t
      * @sa ib_mpool_t
      **/
     ib_mpool_t              *free_children;
+    /**
+     * Is this a recycling pool?
+     *
+     * Recycling pools take pages from and are released to the thread
+     * cache.
+     *
+     * @sa ib_mpool_create_recycled()
+     **/
+    bool                     recycle;
 };
 
 /**
@@ -588,6 +598,226 @@ void ib_mpool_remove_child_from_parent(const ib_mpool_t *child)
 
 /**@}*/
 
+/**
+ * @name Thread cache for recycling pools.
+ *
+ * Each thread has a cache of released recycling pools and of free pages of
+ * the default page size.  Recycling pools take pages from and are released
+ * to the cache of the current thread, so creating and releasing them needs
+ * neither malloc() nor free() in the common case.
+ *
+ * The cache is bounded by IB_MPOOL_RECYCLE_MAX_POOLS and
+ * IB_MPOOL_RECYCLE_MAX_PAGES.  Every IB_MPOOL_RECYCLE_TRIM_INTERVAL
+ * releases, half of the entries that were never used during the interval
+ * are freed, so a cache grown by a burst shrinks back to its working set.
+ */
+/**@{*/
+
+/** Maximum number of pools in a thread cache. */
+#define IB_MPOOL_RECYCLE_MAX_POOLS 64
+
+/** Maximum number of pages in a thread cache. */
+#define IB_MPOOL_RECYCLE_MAX_PAGES 1024
+
+/** Number of releases between cache trims. */
+#define IB_MPOOL_RECYCLE_TRIM_INTERVAL 1024
+
+/**
+ * Per-thread cache of recycling pools and pages.
+ */
+typedef struct {
+    ib_mpool_t               *pools;      /**< Free pools. */
+    size_t                    num_pools;  /**< Length of @a pools. */
+    size_t                    low_pools;  /**< Low water of @a num_pools. */
+    ib_mpool_page_t          *pages;      /**< Free pages. */
+    size_t                    num_pages;  /**< Length of @a pages. */
+    size_t                    low_pages;  /**< Low water of @a num_pages. */
+    size_t                    releases;   /**< Releases since last trim. */
+    ib_mpool_recycle_stats_t  stats;      /**< Not yet summed statistics. */
+} ib_mpool_thread_cache_t;
+
+static pthread_once_t           g_recycle_once = PTHREAD_ONCE_INIT;
+static pthread_key_t            g_recycle_key;
+static bool                     g_recycle_key_ok = false;
+static pthread_mutex_t          g_recycle_stats_lock =
+    PTHREAD_MUTEX_INITIALIZER;
+static ib_mpool_recycle_stats_t g_recycle_stats;
+
+/**
+ * Add @a stats to the process wide statistics and zero it.
+ *
+ * @param[in,out] stats Statistics to sum.
+ */
+static
+void ib_mpool_recycle_stats_sum(ib_mpool_recycle_stats_t *stats)
+{
+    pthread_mutex_lock(&g_recycle_stats_lock);
+    g_recycle_stats.pool_hits     += stats->pool_hits;
+    g_recycle_stats.pool_misses   += stats->pool_misses;
+    g_recycle_stats.page_hits     += stats->page_hits;
+    g_recycle_stats.page_misses   += stats->page_misses;
+    g_recycle_stats.pools_trimmed += stats->pools_trimmed;
+    g_recycle_stats.pages_trimmed += stats->pages_trimmed;
+    pthread_mutex_unlock(&g_recycle_stats_lock);
+
+    memset(stats, 0, sizeof(*stats));
+}
+
+/**
+ * Free up to @a n pools and @a m pages from @a cache.
+ *
+ * @param[in] cache Thread cache.
+ * @param[in] n     Number of pools to free.
+ * @param[in] m     Number of pages to free.
+ */
+static
+void ib_mpool_thread_cache_trim(
+    ib_mpool_thread_cache_t *cache,
+    size_t                   n,
+    size_t                   m
+)
+{
+    assert(cache != NULL);
+
+    while (n > 0 && cache->pools != NULL) {
+        ib_mpool_t *mp = cache->pools;
+        cache->pools = mp->next;
+        --cache->num_pools;
+        ++cache->stats.pools_trimmed;
+        --n;
+
+        mp->next = NULL;
+        ib_mpool_destroy(mp);
+    }
+
+    while (m > 0 && cache->pages != NULL) {
+        ib_mpool_page_t *mpage = cache->pages;
+        cache->pages = mpage->next;
+        --cache->num_pages;
+        ++cache->stats.pages_trimmed;
+        --m;
+
+        free(mpage);
+    }
+}
+
+/**
+ * Thread exit handler: free the thread cache.
+ *
+ * @param[in] data Thread cache.
+ */
+static
+void ib_mpool_thread_cache_destroy(void *data)
+{
+    ib_mpool_thread_cache_t *cache = (ib_mpool_thread_cache_t *)data;
+
+    ib_mpool_thread_cache_trim(cache, cache->num_pools, cache->num_pages);
+    ib_mpool_recycle_stats_sum(&cache->stats);
+    free(cache);
+}
+
+/**
+ * One time initialization of the thread cache key.
+ */
+static
+void ib_mpool_recycle_once(void)
+{
+    g_recycle_key_ok = (
+        pthread_key_create(&g_recycle_key, ib_mpool_thread_cache_destroy)
+        == 0
+    );
+}
+
+/**
+ * Get the thread cache of the current thread, creating it if needed.
+ *
+ * @return Thread cache or NULL on allocation error.
+ */
+static
+ib_mpool_thread_cache_t *ib_mpool_thread_cache(void)
+{
+    ib_mpool_thread_cache_t *cache;
+
+    pthread_once(&g_recycle_once, ib_mpool_recycle_once);
+    if (! g_recycle_key_ok) {
+        return NULL;
+    }
+
+    cache = (ib_mpool_thread_cache_t *)pthread_getspecific(g_recycle_key);
+    if (cache == NULL) {
+        cache = (ib_mpool_thread_cache_t *)calloc(1, sizeof(*cache));
+        if (cache == NULL) {
+            return NULL;
+        }
+        if (pthread_setspecific(g_recycle_key, cache) != 0) {
+            free(cache);
+            return NULL;
+        }
+    }
+
+    return cache;
+}
+
+/**
+ * Move every free page of @a mp to @a cache.
+ *
+ * Pages beyond IB_MPOOL_RECYCLE_MAX_PAGES are freed.
+ *
+ * @param[in] cache Thread cache.
+ * @param[in] mp    Cleared recycling pool.
+ */
+static
+void ib_mpool_thread_cache_put_pages(
+    ib_mpool_thread_cache_t *cache,
+    ib_mpool_t              *mp
+)
+{
+    assert(cache != NULL);
+    assert(mp    != NULL);
+
+    IB_MPOOL_FOREACH(ib_mpool_page_t, mpage, mp->free_pages) {
+        if (cache->num_pages < IB_MPOOL_RECYCLE_MAX_PAGES) {
+            mpage->next = cache->pages;
+            cache->pages = mpage;
+            ++cache->num_pages;
+        }
+        else {
+            ++cache->stats.pages_trimmed;
+            mp->free_fn(mpage);
+        }
+    }
+    mp->free_pages = NULL;
+}
+
+/**
+ * Account for a release to @a cache and trim it if due.
+ *
+ * @param[in] cache Thread cache.
+ */
+static
+void ib_mpool_thread_cache_released(ib_mpool_thread_cache_t *cache)
+{
+    assert(cache != NULL);
+
+    ++cache->releases;
+    if (cache->releases < IB_MPOOL_RECYCLE_TRIM_INTERVAL) {
+        return;
+    }
+
+    ib_mpool_thread_cache_trim(
+        cache,
+        cache->low_pools / 2,
+        cache->low_pages / 2
+    );
+    ib_mpool_recycle_stats_sum(&cache->stats);
+
+    cache->releases  = 0;
+    cache->low_pools = cache->num_pools;
+    cache->low_pages = cache->num_pages;
+}
+
+/**@}*/
+
 /**
  * @name Helper functions for managing internal memory.
  */
@@ -615,6 +845,27 @@ ib_mpool_page_t *ib_mpool_acquire_page(
         mpage = mp->free_pages;
         mp->free_pages = mp->free_pages->next;
     }
+    else if (mp->recycle) {
+        ib_mpool_thread_cache_t *cache = ib_mpool_thread_cache();
+
+        if (cache != NULL && cache->pages != NULL) {
+            mpage = cache->pages;
+            cache->pages = mpage->next;
+            --cache->num_pages;
+            if (cache->num_pages < cache->low_pages) {
+                cache->low_pages = cache->num_pages;
+            }
+            ++cache->stats.page_hits;
+        }
+        else {
+            mpage = mp->malloc_fn(
+                sizeof(ib_mpool_page_t) + mp->pagesize - 1
+            );
+            if (cache != NULL) {
+                ++cache->stats.page_misses;
+            }
+        }
+    }
     else {
         mpage = mp->malloc_fn(sizeof(ib_mpool_page_t) + mp->pagesize - 1);
     }
@@ -1496,6 +1747,117 @@ failure:
     return rc;
 }
 
+ib_status_t ib_mpool_create_recycled(
+    ib_mpool_t **pmp,
+    const char  *name,
+    ib_mpool_t  *parent
+)
+{
+    ib_status_t rc;
+    ib_mpool_t *mp;
+    ib_mpool_thread_cache_t *cache;
+
+    if (pmp == NULL) {
+        return IB_EINVAL;
+    }
+
+    /* Only pools of the default configuration can share cached pages. */
+    if (
+        parent != NULL && (
+            parent->pagesize  != IB_MPOOL_DEFAULT_PAGE_SIZE ||
+            parent->malloc_fn != &malloc ||
+            parent->free_fn   != &free
+        )
+    ) {
+        return ib_mpool_create(pmp, name, parent);
+    }
+
+    cache = ib_mpool_thread_cache();
+    if (cache == NULL || cache->pools == NULL) {
+        rc = ib_mpool_create(pmp, name, parent);
+        if (rc != IB_OK) {
+            return rc;
+        }
+        (*pmp)->recycle = true;
+        if (cache != NULL) {
+            ++cache->stats.pool_misses;
+        }
+        return IB_OK;
+    }
+
+    mp = cache->pools;
+    cache->pools = mp->next;
+    --cache->num_pools;
+    if (cache->num_pools < cache->low_pools) {
+        cache->low_pools = cache->num_pools;
+    }
+    ++cache->stats.pool_hits;
+
+    assert(mp->recycle);
+    assert(mp->inuse    == 0);
+    assert(mp->children == NULL);
+
+    mp->next   = NULL;
+    mp->parent = parent;
+
+    rc = ib_mpool_setname(mp, name);
+    if (rc != IB_OK) {
+        mp->parent = NULL;
+        ib_mpool_destroy(mp);
+        *pmp = NULL;
+        return rc;
+    }
+
+    if (parent != NULL) {
+        rc = ib_lock_lock(&(parent->lock));
+        if (rc != IB_OK) {
+            mp->parent = NULL;
+            ib_mpool_destroy(mp);
+            *pmp = NULL;
+            return rc;
+        }
+        mp->next = parent->children;
+        if (parent->children == NULL) {
+            parent->children_end = mp;
+        }
+        parent->children = mp;
+        ib_lock_unlock(&(parent->lock));
+    }
+
+#ifdef IB_MPOOL_VALGRIND
+    VALGRIND_CREATE_MEMPOOL(mp, IB_MPOOL_REDZONE_SIZE, 0);
+#endif
+
+    *pmp = mp;
+    return IB_OK;
+}
+
+void ib_mpool_recycle_stats(
+    ib_mpool_recycle_stats_t *stats
+)
+{
+    ib_mpool_thread_cache_t *cache = NULL;
+
+    assert(stats != NULL);
+
+    pthread_mutex_lock(&g_recycle_stats_lock);
+    *stats = g_recycle_stats;
+    pthread_mutex_unlock(&g_recycle_stats_lock);
+
+    pthread_once(&g_recycle_once, ib_mpool_recycle_once);
+    if (g_recycle_key_ok) {
+        cache = (ib_mpool_thread_cache_t *)pthread_getspecific(g_recycle_key);
+    }
+    if (cache != NULL) {
+        stats->pool_hits     += cache->stats.pool_hits;
+        stats->pool_misses   += cache->stats.pool_misses;
+        stats->page_hits     += cache->stats.page_hits;
+        stats->page_misses   += cache->stats.page_misses;
+        stats->pools_trimmed += cache->stats.pools_trimmed;
+        stats->pages_trimmed += cache->stats.pages_trimmed;
+    }
+}
+
 ib_status_t ib_mpool_setname(
     ib_mpool_t *mp,
     const char *name
@@ -1801,6 +2163,39 @@ void ib_mpool_release(
     /* Remove from parent child list. */
     ib_mpool_remove_child_from_parent(mp);
 
+    if (mp->recycle) {
+        ib_mpool_thread_cache_t *cache;
+
+        ib_lock_unlock(&(mp->parent->lock));
+
+        mp->parent = NULL;
+        mp->next   = NULL;
+
+        cache = ib_mpool_thread_cache();
+        if (cache == NULL) {
+            ib_mpool_destroy(mp);
+            return;
+        }
+
+        /* Pages go to the thread, the pool to the cache if it has room. */
+        ib_mpool_thread_cache_put_pages(cache, mp);
+        if (cache->num_pools < IB_MPOOL_RECYCLE_MAX_POOLS) {
+#ifdef IB_MPOOL_VALGRIND
+            VALGRIND_DESTROY_MEMPOOL(mp);
+#endif
+            mp->next = cache->pools;
+            cache->pools = mp;
+            ++cache->num_pools;
+        }
+        else {
+            ++cache->stats.pools_trimmed;
+            ib_mpool_destroy(mp);
+        }
+        ib_mpool_thread_cache_released(cache);
+
+        return;
+    }
+
     /* Add to parent free children list. */
     mp->next = mp->parent->free_children;
     mp->parent->free_children = mp;
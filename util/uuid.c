@@ -31,7 +31,12 @@
 #include <uuid.h>
 
 #include <assert.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 /*
  * These are initialized by ib_uuid_init();
@@ -42,6 +47,156 @@
 static ib_lock_t  g_uuid_lock;
 uuid_t           *g_ossp_uuid;
 
+/*
+ * V4 UUIDs are just 122 random bits, so ib_uuid_create_v4() does not use
+ * OSSP UUID (or its lock) at all.  Each thread has its own xoshiro256**
+ * generator, seeded from /dev/urandom when the thread first creates a UUID.
+ * A fork bumps g_uuid_fork_gen so the child reseeds rather than repeating
+ * the parent's sequence.
+ */
+
+/**
+ * Per-thread V4 UUID generator state.
+ */
+typedef struct {
+    uint64_t      s[4];          /**< xoshiro256** state */
+    unsigned int  fork_gen;      /**< g_uuid_fork_gen when seeded */
+} uuid_rng_t;
+
+static pthread_once_t        g_uuid_rng_once = PTHREAD_ONCE_INIT;
+static pthread_key_t         g_uuid_rng_key;
+static volatile unsigned int g_uuid_fork_gen = 0;
+static volatile uint64_t     g_uuid_seed_counter = 0;
+
+/**
+ * Fork child handler: invalidate all generator states.
+ */
+static void uuid_rng_atfork_child(void)
+{
+    ++g_uuid_fork_gen;
+}
+
+/**
+ * One time initialization of the per-thread generator key.
+ */
+static void uuid_rng_once(void)
+{
+    if (pthread_key_create(&g_uuid_rng_key, free) == 0) {
+        pthread_atfork(NULL, NULL, uuid_rng_atfork_child);
+    }
+}
+
+/**
+ * SplitMix64 step; used to expand seed material.
+ *
+ * @param[in,out] x SplitMix64 state.
+ *
+ * @returns Next value.
+ */
+static uint64_t uuid_splitmix64(uint64_t *x)
+{
+    uint64_t z = (*x += UINT64_C(0x9e3779b97f4a7c15));
+
+    z = (z ^ (z >> 30)) * UINT64_C(0xbf58476d1ce4e5b9);
+    z = (z ^ (z >> 27)) * UINT64_C(0x94d049bb133111eb);
+    return z ^ (z >> 31);
+}
+
+/**
+ * Seed a generator.
+ *
+ * Uses /dev/urandom; if that is unavailable, falls back to mixing the time,
+ * process and thread identity and a process wide counter.
+ *
+ * @param[out] rng Generator to seed.
+ */
+static void uuid_rng_seed(uuid_rng_t *rng)
+{
+    uint64_t seed[4] = { 0, 0, 0, 0 };
+    uint64_t x;
+    struct timespec ts;
+    ssize_t got = 0;
+    int fd;
+    int i;
+
+    fd = open("/dev/urandom", O_RDONLY);
+    if (fd >= 0) {
+        got = read(fd, seed, sizeof(seed));
+        close(fd);
+    }
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    x = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec;
+    x ^= (uint64_t)getpid() << 48;
+    x ^= (uint64_t)(uintptr_t)pthread_self();
+    x ^= (uint64_t)(uintptr_t)rng;
+    x ^= __sync_add_and_fetch(&g_uuid_seed_counter, 1) << 20;
+
+    for (i = 0; i < 4; ++i) {
+        /* With a good urandom read this is a harmless extra mix. */
+        rng->s[i] = (got == (ssize_t)sizeof(seed) ? seed[i] : 0) ^
+                    uuid_splitmix64(&x);
+    }
+    if ((rng->s[0] | rng->s[1] | rng->s[2] | rng->s[3]) == 0) {
+        rng->s[0] = 1;
+    }
+    rng->fork_gen = g_uuid_fork_gen;
+}
+
+/**
+ * xoshiro256** step.
+ *
+ * @param[in,out] rng Generator.
+ *
+ * @returns Next 64 random bits.
+ */
+static uint64_t uuid_rng_next(uuid_rng_t *rng)
+{
+    uint64_t *s = rng->s;
+    uint64_t r = s[1] * 5;
+    uint64_t t = s[1] << 17;
+
+    r = ((r << 7) | (r >> 57)) * 9;
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = (s[3] << 45) | (s[3] >> 19);
+
+    return r;
+}
+
+/**
+ * Get the calling thread's generator, creating and seeding it as needed.
+ *
+ * @returns Generator or NULL on allocation failure.
+ */
+static uuid_rng_t *uuid_rng_get(void)
+{
+    uuid_rng_t *rng;
+
+    pthread_once(&g_uuid_rng_once, uuid_rng_once);
+
+    rng = (uuid_rng_t *)pthread_getspecific(g_uuid_rng_key);
+    if (rng == NULL) {
+        rng = (uuid_rng_t *)malloc(sizeof(*rng));
+        if (rng == NULL) {
+            return NULL;
+        }
+        if (pthread_setspecific(g_uuid_rng_key, rng) != 0) {
+            free(rng);
+            return NULL;
+        }
+        uuid_rng_seed(rng);
+    }
+    else if (rng->fork_gen != g_uuid_fork_gen) {
+        uuid_rng_seed(rng);
+    }
+
+    return rng;
+}
+
 ib_status_t ib_uuid_initialize(void)
 {
     ib_status_t rc;
@@ -168,41 +323,25 @@ finish:
 
 ib_status_t ib_uuid_create_v4(ib_uuid_t *uuid)
 {
-    uuid_rc_t uuid_rc;
-    size_t uuid_len = UUID_LEN_BIN;
-    ib_status_t rc = IB_OK;
+    uuid_rng_t *rng;
+    uint64_t    r[2];
 
-    rc = ib_lock_lock(&g_uuid_lock);
-    if (rc != IB_OK) {
-        return rc;
+    if (uuid == NULL) {
+        return IB_EINVAL;
     }
 
-    uuid_rc = uuid_make(g_ossp_uuid, UUID_MAKE_V4);
-    if (uuid_rc == UUID_RC_MEM) {
-        rc = IB_EALLOC;
-        goto finish;
-    }
-    else if (uuid_rc != UUID_RC_OK) {
-        rc = IB_EOTHER;
-        goto finish;
+    rng = uuid_rng_get();
+    if (rng == NULL) {
+        return IB_EALLOC;
     }
 
-    uuid_rc = uuid_export(g_ossp_uuid,
-        UUID_FMT_BIN, (void *)&uuid, &uuid_len
-    );
-    if (uuid_rc == UUID_RC_MEM) {
-        rc = IB_EALLOC;
-        goto finish;
-    }
-    else if (uuid_rc != UUID_RC_OK || uuid_len != UUID_LEN_BIN) {
-        rc = IB_EOTHER;
-        goto finish;
-    }
+    r[0] = uuid_rng_next(rng);
+    r[1] = uuid_rng_next(rng);
+    memcpy(uuid->byte, r, sizeof(r));
 
-finish:
-    if (ib_lock_unlock(&g_uuid_lock) != IB_OK) {
-        return IB_EOTHER;
-    }
+    /* Version 4, variant 10xx (RFC 4122). */
+    uuid->byte[6] = (uuid->byte[6] & 0x0f) | 0x40;
+    uuid->byte[8] = (uuid->byte[8] & 0x3f) | 0x80;
 
-    return rc;
+    return IB_OK;
 }